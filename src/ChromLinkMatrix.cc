@@ -14,33 +14,45 @@
 ///////////////////////////////////////////////////////////////////////////////
 #include <algorithm> // count, max_element
 #include <assert.h>
+#include <chrono>
+#include <float.h> // DBL_MAX
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <iomanip> // setprecision, boolalpha
 #include <map>
 #include <numeric> // accumulate
 #include <queue>
 #include <set>
+#include <sstream>
 #include <string>
+#include <stdlib.h> // erand48
+#include <string.h> // memcpy, memset, strnlen
+#include <unordered_map>
 #include <vector>
 
 // Boost libraries
 #include <boost/algorithm/string.hpp> // split
 #include <boost/filesystem.hpp>
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/graphviz.hpp>
-#include <boost/graph/prim_minimum_spanning_tree.hpp>
+#include <boost/graph/detail/d_ary_heap.hpp> // d_ary_heap_indirect
 #include <boost/lexical_cast.hpp>
 #include <boost/numeric/ublas/matrix_sparse.hpp>
+#include <boost/property_map/property_map.hpp> // iterator_property_map
 
 // For documentation, see ChromLinkMatrix.h
 #include "sam.h"  // from samtools 0.19
-#include "gtools/SAMStepper.h" // SAMStepper, NTargetsInSAM
+#include "gtools/SAMStepper.h" // SAMStepper, NTargetsInSAM, HasBAMIndex
 #include "markov/WDAG.h"
 #include "ChromLinkMatrix.h"
 #include "ClusterVec.h"
 #include "ContigOrdering.h"
+#include "Heatmap.h"
+#include "HiCLinks.h"
+#include "LinkKernels.h"
 #include "LinkSizeDistribution.h"
+#include "MappedFile.h"
+#include "Parallel.h" // NThreadsToUse, ParallelForRanges
+#include "SAMIngest.h"
 #include "TextFileParsers.h" // ParseTabDelimFile
 #include "TimeMem.h"
 #include "TrueMapping.h"
@@ -55,16 +67,15 @@ int most_distant_node(const vector< vector<int> > &adj_list,
 
   bool verbose = false;
 
-  // Make a vector to keep track of each node's distance from A.
+  // Make a vector to keep track of each node's distance from A, and of the previous node on its
+  // path from A.  (Storing the whole path for every node would take O(N^2) memory.)
   vector<int> dist_from_A(adj_list.size(), -1);
-  vector< vector<int> > path_from_A(adj_list.size(), vector<int>(0));
+  vector<int> prev_from_A(adj_list.size(), -1);
   dist_from_A[A] = 0;
-  path_from_A[A].push_back(A);
 
   // Initially, set B = A.
   int B = A;
   int dist_AB = 0;
-  path_AB.resize(1, A);
 
   // Set up a queue of "live" nodes with which to step through the graph, starting at A.
   queue<int> live_nodes;
@@ -75,14 +86,12 @@ int most_distant_node(const vector< vector<int> > &adj_list,
     int node = live_nodes.front();
     live_nodes.pop();
     int dist = dist_from_A[node];
-    vector<int> &path = path_from_A[node];
     if (verbose) {
-      cout << "node = " << node << "; dist = " << dist << "; path has length " << path.size() << "; adj_list = ";
+      cout << "node = " << node << "; dist = " << dist << "; path has length " << dist+1 << "; adj_list = ";
     }
 
     // Check the distance of this node.
     if (dist > dist_AB) {
-      path_AB = path;
       dist_AB = dist;
       B = node;
     }
@@ -95,8 +104,7 @@ int most_distant_node(const vector< vector<int> > &adj_list,
       }
       if (dist_from_A[node2] == -1) { // e.g., if this node hasn't been seen yet
 	dist_from_A[node2] = dist + 1;
-	path_from_A[node2] = path;
-	path_from_A[node2].push_back(node2);
+	prev_from_A[node2] = node;
 	live_nodes.push(node2);
       }
     }
@@ -105,6 +113,12 @@ int most_distant_node(const vector< vector<int> > &adj_list,
     }
   }
 
+  // Trace the path from B back to A.
+  path_AB.resize(dist_AB + 1);
+  for (int node = B, i = dist_AB; i >= 0; node = prev_from_A[node], i--) {
+    path_AB[i] = node;
+  }
+
   if (verbose) {
     cout << "MAXIMUM DISTANCE IS " << dist_AB << " AT NODE " << B << endl;
     cout << "PATH:";
@@ -116,6 +130,71 @@ int most_distant_node(const vector< vector<int> > &adj_list,
   return B;
 } //  End of most_distant_node
 
+/*******************************************************************************
+ * prim_on_sparse_graph: Graph theory helper function for FindSpanningTree.  Find a minimum spanning
+ * tree with Prim's algorithm, on a graph of N vertices given as a sparse adjacency list: the
+ * neighbors of vertex u are adj[adj_ptr[u]], ..., adj[adj_ptr[u+1]-1], in increasing order, and the
+ * weight of the edge to adj[k] is weights[adj_edge[k]].  Pairs of vertices with no edge between
+ * them are treated as having an edge of weight infinity.  The output is in the same format as that
+ * of boost::prim_minimum_spanning_tree: MST_adjs[v] is the parent of v in the tree, or v itself.
+ *
+ * This gives exactly the same tree as boost::prim_minimum_spanning_tree, as FindSpanningTree used
+ * to call it: on the complete graph (with weight-infinity edges for unlinked pairs), from vertex 0.
+ * It follows the same steps, with the same 4-ary heap, so ties are broken in the same way.  The
+ * infinite edges never change a vertex's distance, but they do mean that every vertex is
+ * discovered, and pushed onto the heap, when vertex 0 is visited.
+ ******************************************************************************/
+void prim_on_sparse_graph(const int N,
+                          const vector<uint64_t> &adj_ptr,
+                          const vector<int> &adj,
+                          const vector<int> &adj_edge,
+                          const vector<double> &weights,
+                          vector<int> &MST_adjs) {
+  typedef boost::iterator_property_map<vector<size_t>::iterator, boost::identity_property_map> IndexInHeapMap;
+  vector<double> dist(N, DBL_MAX);
+  vector<size_t> index_in_heap(N, 0);
+  vector<bool> done(N, false);
+  boost::d_ary_heap_indirect<int, 4, IndexInHeapMap, double*, std::less<double> > heap(&dist[0], IndexInHeapMap(index_in_heap.begin()), std::less<double>());
+  MST_adjs.resize(N);
+  for (int v = 0; v < N; v++) {
+    MST_adjs[v] = v;
+  }
+
+  // Relax the edge u-v of weight w.
+  auto relax = [&](const int u, const int v, const double w) {
+    if (!(w < dist[v])) {
+      return false;
+    }
+    dist[v] = w;
+    MST_adjs[v] = u;
+    return true;
+  };
+
+  // Visit vertex 0, which discovers every other vertex, in order.
+  dist[0] = 0;
+  done[0] = true;
+  uint64_t k = adj_ptr[0];
+  for (int v = 1; v < N; v++) {
+    if (k < adj_ptr[1] && adj[k] == v) {
+      relax(0, v, weights[ adj_edge[k++] ]);
+    }
+    heap.push(v);
+  }
+
+  // Visit the rest of the vertices in order of distance.
+  while (!heap.empty()) {
+    const int u = heap.top();
+    heap.pop();
+    for (k = adj_ptr[u]; k < adj_ptr[u+1]; k++) {
+      const int v = adj[k];
+      if (!done[v] && relax(u, v, weights[ adj_edge[k] ])) {
+        heap.update(v);
+      }
+    }
+    done[u] = true;
+  }
+}  // End of prim_on_sparse_graph
+
 /*******************************************************************************
  * find_longest_path: Graph theory function to find the longest path in a tree (given in the form of
  * an adjacency list.)
@@ -192,6 +271,7 @@ ChromLinkMatrix::ChromLinkMatrix() {
   _repeat_factors.clear();
   _tree.clear();
   _SAM_files.clear();
+  _compact = false;
   _CP_score_dist = 1e7;
 }
 
@@ -211,6 +291,7 @@ ChromLinkMatrix::ChromLinkMatrix(const string &species,
   _repeat_factors.clear();
   _tree.clear();
   _SAM_files.clear();
+  _compact = false;
   _CP_score_dist = 1e7;
   int N_bins = 2 * _N_contigs;
   cout << "Creating a new ChromLinkMatrix for a chromosome with " << _N_contigs << " contigs of size " << _contig_size << " (matrix size = " << N_bins << "x" << N_bins << ")" << endl;
@@ -229,6 +310,7 @@ ChromLinkMatrix::ChromLinkMatrix(const string &species,
   _longest_contig = -1;
   _tree.clear();
   _SAM_files.clear();
+  _compact = false;
   _CP_score_dist = 1e7;
   cout << "Creating a new ChromLinkMatrix for a cluster with " << _N_contigs << " contigs (matrix size = " << N_bins() << "x" << N_bins() << ")" << endl;
   InitMatrix();
@@ -251,6 +333,7 @@ ChromLinkMatrix::ChromLinkMatrix(const string &species,
   _longest_contig = -1;
   _tree.clear();
   _SAM_files.clear(); // this vector will be filled by LoadFromSAMDeNovo
+  _compact = false;
   _CP_score_dist = 1e7;
   InitMatrix();
   LoadFromSAMDeNovo( SAM_files, RE_sites_file, clusters, cluster_ID );
@@ -265,14 +348,63 @@ ChromLinkMatrix::~ChromLinkMatrix() {
 }
 
 static const unsigned LINE_LEN = 100000;
+
+/*******************************************************************************
+ * The binary CLM format.  All integers are stored in the native byte order of the machine that
+ * wrote the file (ReadFile() refuses files with the wrong byte order), and every array starts on
+ * an 8-byte boundary, so that the file can be mmap'ed and the arrays used in place.
+ *
+ *   CLMBinaryHeader                     the fixed-size header below
+ *   char     text[header_text_len]      the "# ..." header lines of the text format, zero-padded
+ *   uint64_t pair_ptr[N_contigs+1]      contig pairs (c1,c2) with c1 <= c2 that have any links,
+ *                                       sorted by c1 then c2; c1's pairs are the range
+ *                                       [pair_ptr[c1], pair_ptr[c1+1])
+ *   int32_t  pair_c2[N_pairs]           c2 for each pair (zero-padded to 8 bytes)
+ *   uint64_t cell_ptr[4*N_pairs+1]      the links of pair p in orientation k = 2*rc1 + rc2 are
+ *                                       dists[cell_ptr[4*p+k], cell_ptr[4*p+k+1])
+ *   int32_t  dists[N_dists]             link distances, in the order in which they were loaded
+ *
+ * Each pair of contigs is stored once: bin [2*c2+rc2][2*c1+rc1] always holds the same data as bin
+ * [2*c1+(1-rc1)][2*c2+(1-rc2)] (see AddLinkToMatrix), so the mirror image is implied.
+ *
+ * A compact CLM (see SetCompactDists) is written as version 2 of the format, which is the same
+ * except that cell_ptr is a uint32_t array (zero-padded to 8 bytes), and dists is a uint16_t array
+ * of coded distances (see EncodeLinkDist in LinkKernels.h).
+ ******************************************************************************/
+static const char CLM_BINARY_MAGIC[8] = { 'L', 'A', 'C', 'H', 'C', 'L', 'M', '\0' };
+static const uint32_t CLM_BINARY_VERSION = 1;
+static const uint32_t CLM_BINARY_VERSION_COMPACT = 2;
+static const uint32_t CLM_BYTE_ORDER_MARK = 0x01020304;
+
+struct CLMBinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  int32_t N_contigs;
+  int32_t contig_size;
+  uint64_t header_text_len; // padded to a multiple of 8
+  uint64_t N_pairs;
+  uint64_t N_dists;
+};
+
 // ReadFile: Read the data from file CLM_file into this ChromLinkMatrix.
 // Overwrite any existing data.
 // The file CLM_file should have been created by a previous call to
-// ChromLinkMatrix::WriteFile() with heatmap=false.
+// ChromLinkMatrix::WriteFile() with heatmap=false.  It may be binary or text.
 void ChromLinkMatrix::ReadFile(const string &CLM_file) {
+  cout << ": ChromLinkMatrix::ReadFile   <-  " << CLM_file << "\t" << flush;
+  assert(boost::filesystem::is_regular_file(CLM_file));
+
+  if (FileHasMagic(CLM_file, CLM_BINARY_MAGIC, sizeof(CLM_BINARY_MAGIC))) {
+    ReadBinaryFile(CLM_file);
+  } else {
+    ReadTextFile(CLM_file);
+  }
+}  // End of ReadFile
+
+// ReadTextFile: Helper function for ReadFile().  Read a CLM file in the text format.
+void ChromLinkMatrix::ReadTextFile(const string &CLM_file) {
   string clm_file = CLM_file;
-  cout << ": ChromLinkMatrix::ReadFile   <-  " << clm_file << "\t" << flush;
-  assert(boost::filesystem::is_regular_file(clm_file));
 
   // Set initial values that MUST be overwritten later.
   _contig_size = -1;
@@ -295,33 +427,7 @@ void ChromLinkMatrix::ReadFile(const string &CLM_file) {
 
     // Examine the header lines carefully.  These header lines should have been generated in ChromLinkMatrix::WriteFile.
     if (line[0] == '#') {
-      boost::split(tokens, line, boost::is_any_of(" "));
-      assert(tokens.size() > 3);
-
-      // line: "# species = human"
-      if (tokens[1] == "Species") {
-	_species = tokens[3];
-      } else if (tokens[1] == "N_contigs") { // line: "# N_contigs = 1"
-	if (_matrix_init) {
-          assert(_N_contigs == boost::lexical_cast<int>(tokens[3]));
-        } else {
-	  _N_contigs = boost::lexical_cast<int>(tokens[3]);
-	  InitMatrix();
-	}
-      } else if (tokens[1] == "contig_size") { // line: "# contig_size = 1"
-	_contig_size = boost::lexical_cast<int>(tokens[3]);
-      } else if (tokens[1] == "contig_lens_file") { // line: "# contig_lens_file = <filename>" or "# contig_lens_file = ."
-	contig_lens_file = tokens[3];
-      } else if (tokens[1] == "RE_sites_file") { // line: "# RE_sites_file = <filename>"
-	RE_sites_file = tokens[3];
-      } else if (tokens[0] == "heatmap") { // line: "# heatmap = false"
-	assert(tokens[3] == "false");
-      } else if (tokens[1] == "SAM") { // line: "# SAM files used in generating this dataset: test.sam"
-	for (size_t i = 8; i < tokens.size(); i++) {
-	  _SAM_files.push_back(tokens[i]);
-        }
-	AssertFilesExist(_SAM_files);
-      }
+      ReadHeaderLine(line, contig_lens_file, RE_sites_file);
     } // End checking that the line is #
 
     else if (line[0] == 'X') {
@@ -340,13 +446,145 @@ void ChromLinkMatrix::ReadFile(const string &CLM_file) {
         continue;
       }
       assert((int) tokens.size() == 3 + Z);
+      // The file lists every bin, including the mirror image of each bin; only one copy is needed.
+      int c1 = X/2, c2 = Y/2;
+      if (c1 > c2) {
+        continue;
+      }
+      NewLink link = { c1, c2, { -1, -1, -1, -1 } };
       for (int i = 0; i < Z; i++) {
-	_matrix[X][Y].push_back(boost::lexical_cast<int>(tokens[3+i]));
+	link.dists[ 2*(X%2) + Y%2 ] = boost::lexical_cast<int>(tokens[3+i]);
+	_new_links.push_back(link);
       }
     }
   } // End the while(1) above
 
   in.close();
+  CompileLinks();
+  FinishReadFile(CLM_file, seen_data, contig_lens_file, RE_sites_file);
+}  // End of ReadTextFile
+
+/*******************************************************************************
+ * ReadBinaryFile: Helper function for ReadFile().  Read a CLM file in the binary format (see
+ * above).  The file is mmap'ed rather than read, and nothing in it needs to be parsed except the
+ * header lines.  Its arrays are in exactly the same layout as the ChromLinkMatrix's own storage, so
+ * they're used in place, without copying; the file stays mapped as long as they're in use.
+ ******************************************************************************/
+void ChromLinkMatrix::ReadBinaryFile(const string &CLM_file) {
+  MappedFile *mapped_file = new MappedFile(CLM_file);
+  const MappedFile &file = *mapped_file;
+  const CLMBinaryHeader &header = *file.at<CLMBinaryHeader>(0);
+
+  if (header.byte_order != CLM_BYTE_ORDER_MARK) {
+    cerr << "ERROR: ChromLinkMatrix::ReadFile: CLM file '" << CLM_file << "' was written on a machine with a different byte order.  Re-create it with OVERWRITE_CLMS = 1." << endl;
+    exit(1);
+  }
+  if (header.version != CLM_BINARY_VERSION && header.version != CLM_BINARY_VERSION_COMPACT) {
+    cerr << "ERROR: ChromLinkMatrix::ReadFile: CLM file '" << CLM_file << "' has format version " << header.version << ", but this version of Lachesis reads versions " << CLM_BINARY_VERSION << " and " << CLM_BINARY_VERSION_COMPACT << ".  Re-create it with OVERWRITE_CLMS = 1." << endl;
+    exit(1);
+  }
+  const bool compact = header.version == CLM_BINARY_VERSION_COMPACT;
+
+  // Set initial values that MUST be overwritten later.
+  _contig_size = -1;
+  _SAM_files.clear();
+  _matrix_init = false;
+  string contig_lens_file = "";
+  string RE_sites_file = "";
+
+  // Parse the header lines, exactly as in the text format.  One of these lines sets _N_contigs and calls InitMatrix().
+  size_t offset = sizeof(CLMBinaryHeader);
+  const char *text = file.at<char>(offset, header.header_text_len);
+  vector<string> lines;
+  string header_text(text, strnlen(text, header.header_text_len));
+  boost::split(lines, header_text, boost::is_any_of("\n"));
+  for (size_t i = 0; i < lines.size(); i++) {
+    if (!lines[i].empty() && lines[i][0] == '#') {
+      ReadHeaderLine(lines[i], contig_lens_file, RE_sites_file);
+    }
+  }
+  offset += header.header_text_len;
+  assert(_matrix_init);
+  assert(_N_contigs == header.N_contigs);
+  assert(_contig_size == header.contig_size);
+
+  // Find the arrays.
+  const uint64_t *pair_ptr = file.at<uint64_t>(offset, _N_contigs+1);
+  offset += (_N_contigs+1) * sizeof(uint64_t);
+  const int32_t *pair_c2 = file.at<int32_t>(offset, header.N_pairs);
+  offset += PadTo8(header.N_pairs * sizeof(int32_t));
+  const uint64_t *cell_ptr = compact ? NULL : file.at<uint64_t>(offset, 4*header.N_pairs+1);
+  const uint32_t *cell_ptr32 = compact ? file.at<uint32_t>(offset, 4*header.N_pairs+1) : NULL;
+  offset += compact ? PadTo8((4*header.N_pairs+1) * sizeof(uint32_t)) : (4*header.N_pairs+1) * sizeof(uint64_t);
+  const int32_t *dists = compact ? NULL : file.at<int32_t>(offset, header.N_dists);
+  const uint16_t *dist_codes = compact ? file.at<uint16_t>(offset, header.N_dists) : NULL;
+  assert(pair_ptr[_N_contigs] == header.N_pairs);
+  assert((compact ? cell_ptr32[4*header.N_pairs] : cell_ptr[4*header.N_pairs]) == header.N_dists);
+
+  // Use the arrays in place.  Check that the pairs are sorted, since Links() depends on it.
+  for (int c1 = 0; c1 < _N_contigs; c1++) {
+    assert(pair_ptr[c1] <= pair_ptr[c1+1]);
+    for (uint64_t p = pair_ptr[c1]; p < pair_ptr[c1+1]; p++) {
+      assert(c1 <= pair_c2[p] && pair_c2[p] < _N_contigs);
+      assert(p == pair_ptr[c1] || pair_c2[p-1] < pair_c2[p]);
+    }
+  }
+  _pair_ptr = pair_ptr;
+  _pair_c2 = pair_c2;
+  if (compact) {
+    _cell_ptr32 = cell_ptr32;
+    _dist_codes = dist_codes;
+  } else {
+    _cell_ptr = cell_ptr;
+    _dists = dists;
+  }
+  _compact = compact;
+  _mapped_file = mapped_file;
+  _orient_LLs.clear();
+
+  FinishReadFile(CLM_file, header.N_dists > 0, contig_lens_file, RE_sites_file);
+}  // End of ReadBinaryFile
+
+// ReadHeaderLine: Helper function for ReadFile().  Parse one of the "# ..." header lines generated
+// by FileHeader().
+void ChromLinkMatrix::ReadHeaderLine(const string &line,
+                                     string &contig_lens_file,
+                                     string &RE_sites_file) {
+  vector<string> tokens;
+  boost::split(tokens, line, boost::is_any_of(" "));
+  assert(tokens.size() > 3);
+
+  // line: "# species = human"
+  if (tokens[1] == "Species") {
+    _species = tokens[3];
+  } else if (tokens[1] == "N_contigs") { // line: "# N_contigs = 1"
+    if (_matrix_init) {
+      assert(_N_contigs == boost::lexical_cast<int>(tokens[3]));
+    } else {
+      _N_contigs = boost::lexical_cast<int>(tokens[3]);
+      InitMatrix();
+    }
+  } else if (tokens[1] == "contig_size") { // line: "# contig_size = 1"
+    _contig_size = boost::lexical_cast<int>(tokens[3]);
+  } else if (tokens[1] == "contig_lens_file") { // line: "# contig_lens_file = <filename>" or "# contig_lens_file = ."
+    contig_lens_file = tokens[3];
+  } else if (tokens[1] == "RE_sites_file") { // line: "# RE_sites_file = <filename>"
+    RE_sites_file = tokens[3];
+  } else if (tokens[0] == "heatmap") { // line: "# heatmap = false"
+    assert(tokens[3] == "false");
+  } else if (tokens[1] == "SAM") { // line: "# SAM files used in generating this dataset: test.sam"
+    for (size_t i = 8; i < tokens.size(); i++) {
+      _SAM_files.push_back(tokens[i]);
+    }
+    AssertFilesExist(_SAM_files);
+  }
+}
+
+// FinishReadFile: Helper function for ReadFile().  Sanity checks, and load the auxiliary files.
+void ChromLinkMatrix::FinishReadFile(const string &CLM_file,
+                                     const bool seen_data,
+                                     const string &contig_lens_file,
+                                     const string &RE_sites_file) {
   cout << "\tN contigs = " << _N_contigs << endl;
 
   if (_N_contigs > 1) {
@@ -374,28 +612,72 @@ void ChromLinkMatrix::ReadFile(const string &CLM_file) {
     assert(contig_lens_file == ".");
     _longest_contig = -1;
   }
-}  // End of ReadFile
+}
 
 /*******************************************************************************
- * WriteFile: Write the data in this ChromLinkMatrix to file CLM_file. The output format is a long
- * tall table with (4*_N_contigs^2) rows and three (or more) columns: X, Y, Z, [data]. X and Y are
- * bin IDs (bin ID = 2 * contig ID + contig orientation).  Z is an integer representing the amount
- * of data in bin [X,Y]. If heatmap = false (default), then following Z is actually a tab-separated
- * list of all the integers in bin [X,Y]. This format is designed for easy input to
- * ChromLinkMatrix::ReadFile() (if heatmap = false), or to R (if heatmap = true). If this is a de
- * novo CLM, also write the contig lengths to an auxiliary file.
+ * WriteFile: Write the data in this ChromLinkMatrix to file CLM_file.  By default the file is in
+ * the binary format (see above), which is much more compact and much faster to read.  If text =
+ * true, or if heatmap = true, the file is in the text format (see WriteTextFile).  If this is a de
+ * novo CLM, also write the contig lengths and RE sites to auxiliary files.
  ******************************************************************************/
 void ChromLinkMatrix::WriteFile(const string &CLM_file,
-                                const bool heatmap) const {
-  cout << "ChromLinkMatrix::WriteFile(" << (heatmap ? "heatmap" : "CLM") << ") -> " << CLM_file << endl;
+                                const bool heatmap,
+                                const bool text) const {
+  cout << "ChromLinkMatrix::WriteFile(" << (heatmap ? "heatmap" : text ? "CLM, text" : "CLM") << ") -> " << CLM_file << endl;
+  WriteFileData(CLM_file, heatmap, text);
+} // End of ChromLinkMatrix::WriteFile
+
+thread ChromLinkMatrix::WriteFileAsync(const string &CLM_file, const bool text) const {
+  cout << "ChromLinkMatrix::WriteFile(" << (text ? "CLM, text" : "CLM") << ") -> " << CLM_file << endl;
+  return thread(&ChromLinkMatrix::WriteFileData, this, CLM_file, false, text);
+}
+
+// WriteFileData: Helper function for WriteFile() and WriteFileAsync(), which does the writing.
+void ChromLinkMatrix::WriteFileData(const string &CLM_file,
+                                    const bool heatmap,
+                                    const bool text) const {
+  if (heatmap || text) {
+    WriteTextFile(CLM_file, heatmap);
+  } else {
+    WriteBinaryFile(CLM_file);
+  }
+
+  // If this is a de novo CLM, also write the contig lengths and RE sites to auxiliary files.
+  WriteAuxFiles(CLM_file);
+}
+
+// WriteAuxFiles: Write the contig lengths and RE sites of a de novo CLM to <CLM_file>.lens and
+// <CLM_file>.RE_sites.  For a non-de novo CLM, do nothing.
+void ChromLinkMatrix::WriteAuxFiles(const string &CLM_file) const {
+  if (DeNovo()) {
+    string contig_lens_file = CLM_file + ".lens";
+    string contig_RE_sites_file = CLM_file + ".RE_sites";
+
+    ofstream out2(contig_lens_file.c_str(), ios::out);
+    for (int i = 0; i < _N_contigs; i++) {
+      out2 << _contig_lengths[i] << endl;
+    }
+    out2.close();
+
+    ofstream out3(contig_RE_sites_file.c_str(), ios::out);
+    for (int i = 0; i < _N_contigs; i++) {
+      out3 << (_contig_RE_sites[i] - 1) << endl; // subtract 1 to make up for the 1 added in
+                                                 // LoadRESites()
+    }
+    out3.close();
+  }
+}
 
+// FileHeader: Helper function for WriteFile().  Return the header lines that describe this
+// ChromLinkMatrix.  The header is for easier human reading and also contains numbers used by
+// ChromLinkMatrix::ReadFile().
+string ChromLinkMatrix::FileHeader(const string &CLM_file,
+                                   const bool heatmap) const {
   // If this is a de novo CLM, set filenames for the auxiliary contig lengths and contig RE sites file.
   string contig_lens_file = DeNovo() ? CLM_file + ".lens" : ".";
   string contig_RE_sites_file = DeNovo() ? CLM_file + ".RE_sites" : ".";
-  bool seen_data = false;
-  ofstream out(CLM_file.c_str(), ios::out);
 
-  // Print a header to file.  The header is for easier human reading and also contains numbers used by ChromLinkMatrix::ReadFile().
+  ostringstream out;
   out << "# ChromLinkMatrix file - see ChromLinkMatrix.h for documentation of this object type" << endl;
   out << "# Species = " << _species << endl;
   out << "# De novo CLM? " << boolalpha << DeNovo() << endl;
@@ -409,14 +691,51 @@ void ChromLinkMatrix::WriteFile(const string &CLM_file,
     out << " " << _SAM_files[i];
   }
   out << endl;
+  return out.str();
+}
+
+/*******************************************************************************
+ * WriteTextFile: Helper function for WriteFile(). The output format is a long tall table with
+ * (4*_N_contigs^2) rows and three (or more) columns: X, Y, Z, [data]. X and Y are bin IDs (bin ID =
+ * 2 * contig ID + contig orientation).  Z is an integer representing the amount of data in bin
+ * [X,Y]. If heatmap = false, then following Z is actually a tab-separated list of all the integers
+ * in bin [X,Y]. This format is designed for easy input to ChromLinkMatrix::ReadFile() (if heatmap =
+ * false), or to R (if heatmap = true).
+ ******************************************************************************/
+void ChromLinkMatrix::WriteTextFile(const string &CLM_file,
+                                    const bool heatmap) const {
+  bool seen_data = false;
+  ofstream out(CLM_file.c_str(), ios::out);
+
+  // Print a header to file.
+  out << FileHeader(CLM_file, heatmap);
 
   // Print the table to file.
   out << "X\tY\tZ" << (heatmap ? "" : "\tlink_lengths") << endl;
 
+  // Find the contigs that each contig has links with, in order.  Only these bins can be non-empty.
+  vector< vector<int> > partners(_N_contigs);
+  for (int c1 = 0; c1 < _N_contigs; c1++) {
+    for (uint64_t p = _pair_ptr[c1]; p < _pair_ptr[c1+1]; p++) {
+      partners[c1].push_back(_pair_c2[p]);
+    }
+  }
+  for (int c1 = 0; c1 < _N_contigs; c1++) {
+    for (uint64_t p = _pair_ptr[c1]; p < _pair_ptr[c1+1]; p++) {
+      if (_pair_c2[p] != c1) {
+        partners[ _pair_c2[p] ].push_back(c1);
+      }
+    }
+  }
+  for (int c = 0; c < _N_contigs; c++) {
+    sort(partners[c].begin(), partners[c].end());
+  }
+
   for (int X = 0; X < 2*_N_contigs; X++) {
-    for (int Y = 0; Y < 2*_N_contigs; Y++) {
+    for (size_t i = 0; i < 2 * partners[X/2].size(); i++) {
+      const int Y = 2 * partners[X/2][i/2] + i%2;
 
-      vector<int> & Z = _matrix[X][Y];
+      const LinkDistances Z = Links(X/2, X%2, Y/2, Y%2);
       //PRINT3( X, Y, Z.size() );
       if (Z.empty()) {
         continue; // this makes the matrix sparse
@@ -455,36 +774,317 @@ void ChromLinkMatrix::WriteFile(const string &CLM_file,
     //PRINT2( seen_data, has_links() );
     //assert( seen_data == has_links() );
   }
+} // End of ChromLinkMatrix::WriteTextFile
 
-  // If this is a de novo CLM, also write the contig lengths and RE sites to auxiliary files.
-  if (DeNovo()) {
-    ofstream out2(contig_lens_file.c_str(), ios::out);
-    for (int i = 0; i < _N_contigs; i++) {
-      out2 << _contig_lengths[i] << endl;
+/*******************************************************************************
+ * WriteBinaryFile: Helper function for WriteFile().  Write the binary format described above.
+ * Unlike the text format, there is no limit on the number of links in a bin.
+ ******************************************************************************/
+void ChromLinkMatrix::WriteBinaryFile(const string &CLM_file) const {
+  assert(_new_links.empty());
+  const uint64_t N_pairs = _pair_ptr[_N_contigs];
+  const string header_text = FileHeader(CLM_file, false);
+
+  CLMBinaryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CLM_BINARY_MAGIC, sizeof(CLM_BINARY_MAGIC));
+  header.version = _compact ? CLM_BINARY_VERSION_COMPACT : CLM_BINARY_VERSION;
+  header.byte_order = CLM_BYTE_ORDER_MARK;
+  header.N_contigs = _N_contigs;
+  header.contig_size = _contig_size;
+  header.header_text_len = PadTo8(header_text.size() + 1); // include at least one terminating '\0'
+  header.N_pairs = N_pairs;
+  header.N_dists = CellPtr(4*N_pairs);
+
+  // The file's arrays are the same as the ChromLinkMatrix's own storage, so they're just written out.
+  ofstream out(CLM_file.c_str(), ios::out | ios::binary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(header_text.c_str(), header_text.size() + 1);
+  WritePadding(out, header_text.size() + 1);
+  out.write(reinterpret_cast<const char *>(_pair_ptr), (_N_contigs+1) * sizeof(uint64_t));
+  out.write(reinterpret_cast<const char *>(_pair_c2), N_pairs * sizeof(int32_t));
+  WritePadding(out, N_pairs * sizeof(int32_t));
+  if (_compact) {
+    out.write(reinterpret_cast<const char *>(_cell_ptr32), (4*N_pairs+1) * sizeof(uint32_t));
+    WritePadding(out, (4*N_pairs+1) * sizeof(uint32_t));
+    out.write(reinterpret_cast<const char *>(_dist_codes), header.N_dists * sizeof(uint16_t));
+  } else {
+    out.write(reinterpret_cast<const char *>(_cell_ptr), (4*N_pairs+1) * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char *>(_dists), header.N_dists * sizeof(int32_t));
+  }
+
+  if (!out) {
+    cerr << "ERROR: ChromLinkMatrix::WriteFile: failed to write CLM file '" << CLM_file << "'" << endl;
+    exit(1);
+  }
+  out.close();
+
+  if (_N_contigs > 1 && header.N_dists == 0) {
+    cerr << "WARNING: ChromLinkMatrix::WriteFile: CLM file '" << CLM_file << "' has multiple contigs but no link data" << endl;
+  }
+} // End of ChromLinkMatrix::WriteBinaryFile
+
+// CompactCellPtrs: Return a copy of these N cell pointers in 32 bits, for a compact CLM.  The last
+// one is the number of links, which must be less than 2^32.
+static vector<uint32_t> CompactCellPtrs(const uint64_t *cell_ptr,
+                                        const size_t N) {
+  if (cell_ptr[N-1] > UINT32_MAX) {
+    cerr << "ERROR: ChromLinkMatrix: a CLM with " << cell_ptr[N-1] << " links is too big to be compact (limit: 2^32-1 links).  Set COMPACT_STORAGE = 0." << endl;
+    exit(1);
+  }
+  return vector<uint32_t>(cell_ptr, cell_ptr + N);
+}
+
+// LinkPairKey: The contig pair of a NewLink, as one number that sorts by c1, then c2.
+static inline int64_t LinkPairKey(const int32_t c1,
+                                  const int32_t c2) {
+  return (int64_t(c1) << 32) | uint32_t(c2);
+}
+
+/*******************************************************************************
+ * WriteSpilledBinaryFile: Write a binary CLM file (see above) for links that were spilled to disk
+ * as NewLink records, in the order in which they were found, rather than added to this matrix.
+ * This is an external merge sort, in two passes, using about memory_budget bytes of memory:
+ * 1. The records are read in chunks.  Each chunk is sorted by contig pair (stably, so each pair's
+ *    links stay in order) and appended to <CLM_file>.runs as a sorted run.
+ * 2. The runs are merged, pair by pair.  Each pair's distances are appended to <CLM_file>.dists,
+ *    and its cell pointers are kept in memory; their size depends on the number of contig pairs
+ *    with links, not on the number of links.  Then the arrays are written to the CLM file,
+ *    followed by the contents of <CLM_file>.dists.
+ * The runs are merged in order, so each pair's links come out in the order in which they were
+ * found, and the file is exactly the same as if the links had been loaded into memory.  (If this
+ * CLM is compact, the distances are coded as they're copied into the CLM file.)
+ ******************************************************************************/
+void ChromLinkMatrix::WriteSpilledBinaryFile(const string &CLM_file,
+                                             const vector<string> &spill_files,
+                                             const size_t memory_budget) const {
+  assert(_matrix_init);
+  assert(_new_links.empty());
+  assert(_pair_ptr[_N_contigs] == 0); // all of the links must be in the spill files
+  cout << "ChromLinkMatrix::WriteFile(CLM, from " << spill_files.size() << " spill files) -> " << CLM_file << endl;
+
+  // The chunk can only take half the budget, because stable_sort needs a buffer as big as the chunk.
+  const size_t chunk_size = max(size_t(1) << 16, memory_budget / (2 * sizeof(NewLink)));
+  const string runs_file = CLM_file + ".runs";
+  const string dists_file = CLM_file + ".dists";
+
+  // 1. Sort the records into runs.  Run r is records [run_starts[r], run_starts[r+1]) of runs_file.
+  vector<uint64_t> run_starts(1, 0);
+  {
+    ofstream runs(runs_file.c_str(), ios::out | ios::binary);
+    vector<NewLink> chunk;
+    chunk.reserve(chunk_size);
+    auto write_run = [&]() {
+      stable_sort(chunk.begin(), chunk.end(), [](const NewLink &a, const NewLink &b) {
+          return LinkPairKey(a.c1, a.c2) < LinkPairKey(b.c1, b.c2);
+        });
+      runs.write(reinterpret_cast<const char *>(chunk.data()), chunk.size() * sizeof(NewLink));
+      run_starts.push_back(run_starts.back() + chunk.size());
+      chunk.clear();
+    };
+
+    for (size_t i = 0; i < spill_files.size(); i++) {
+      if (!boost::filesystem::is_regular_file(spill_files[i])) {
+        continue; // no links for this CLM in this SAM file
+      }
+      ifstream in(spill_files[i].c_str(), ios::in | ios::binary);
+      while (in) {
+        const size_t N = chunk.size();
+        chunk.resize(chunk_size);
+        in.read(reinterpret_cast<char *>(chunk.data() + N), (chunk_size - N) * sizeof(NewLink));
+        assert(in.gcount() % sizeof(NewLink) == 0); // if this fails, the spill file is truncated
+        chunk.resize(N + in.gcount() / sizeof(NewLink));
+        if (chunk.size() == chunk_size) {
+          write_run();
+        }
+      }
+    }
+    if (!chunk.empty()) {
+      write_run();
     }
-    out2.close();
 
-    ofstream out3(contig_RE_sites_file.c_str(), ios::out);
-    for (int i = 0; i < _N_contigs; i++) {
-      out3 << (_contig_RE_sites[i] - 1) << endl; // subtract 1 to make up for the 1 added in
-                                                 // LoadRESites()
+    if (!runs) {
+      cerr << "ERROR: ChromLinkMatrix::WriteFile: failed to write temporary file '" << runs_file << "'" << endl;
+      exit(1);
     }
-    out3.close();
   }
-} // End of ChromLinkMatrix::WriteFile
 
-// DrawHeatmap: Call WriteFile("heatmap.txt"), then run the R script "heatmap.R", which uses R and
-// ggplot2 to make a heatmap image of this ChromLinkMatrix.
+  // 2. Merge the runs.  Each run is read through its own buffer; the buffers share the budget.
+  struct Run {
+    uint64_t next, stop; // the records of the run not yet in buf
+    vector<NewLink> buf;
+    size_t pos; // the next record in buf
+  };
+  const size_t N_runs = run_starts.size() - 1;
+  const size_t buf_size = max(size_t(1024), chunk_size / max(N_runs, size_t(1)));
+  ifstream runs_in(runs_file.c_str(), ios::in | ios::binary);
+  vector<Run> runs(N_runs);
+  auto refill = [&](Run &run) {
+    const size_t N = min(uint64_t(buf_size), run.stop - run.next);
+    run.buf.resize(N);
+    runs_in.seekg(run.next * sizeof(NewLink));
+    runs_in.read(reinterpret_cast<char *>(run.buf.data()), N * sizeof(NewLink));
+    assert(runs_in.gcount() == streamsize(N * sizeof(NewLink)));
+    run.next += N;
+    run.pos = 0;
+  };
+
+  // The heap holds the next contig pair in each run that hasn't been used up.  Ties go to the
+  // earlier run, which has the earlier links.
+  typedef pair<int64_t, size_t> HeapEntry; // (pair key, run)
+  priority_queue<HeapEntry, vector<HeapEntry>, greater<HeapEntry> > heap;
+  for (size_t r = 0; r < N_runs; r++) {
+    runs[r].next = run_starts[r];
+    runs[r].stop = run_starts[r+1];
+    refill(runs[r]);
+    heap.push(HeapEntry(LinkPairKey(runs[r].buf[0].c1, runs[r].buf[0].c2), r));
+  }
+
+  vector<uint64_t> pair_ptr(_N_contigs+1, 0), cell_ptr(1, 0);
+  vector<int32_t> pair_c2, dists;
+  vector<NewLink> pair_links; // the links of the current pair, in order
+  ofstream dists_out(dists_file.c_str(), ios::out | ios::binary);
+  uint64_t N_dists = 0;
+
+  while (!heap.empty()) {
+    const int64_t key = heap.top().first;
+
+    // Collect this pair's links from each run that has any, in run order.
+    pair_links.clear();
+    while (!heap.empty() && heap.top().first == key) {
+      const size_t r = heap.top().second;
+      Run &run = runs[r];
+      heap.pop();
+      while (true) {
+        if (run.pos == run.buf.size()) {
+          if (run.next == run.stop) {
+            break;
+          }
+          refill(run);
+        }
+        if (LinkPairKey(run.buf[run.pos].c1, run.buf[run.pos].c2) != key) {
+          break;
+        }
+        pair_links.push_back(run.buf[run.pos++]);
+      }
+      if (run.pos < run.buf.size()) {
+        heap.push(HeapEntry(LinkPairKey(run.buf[run.pos].c1, run.buf[run.pos].c2), r));
+      }
+    }
+
+    // Add the pair, and its links in each orientation, exactly as in CompileLinks().
+    const int c1 = pair_links[0].c1;
+    assert(0 <= c1 && c1 <= pair_links[0].c2 && pair_links[0].c2 < _N_contigs);
+    pair_ptr[c1+1]++;
+    pair_c2.push_back(pair_links[0].c2);
+    for (int k = 0; k < 4; k++) {
+      for (size_t i = 0; i < pair_links.size(); i++) {
+        if (pair_links[i].dists[k] != -1) {
+          dists.push_back(pair_links[i].dists[k]);
+          N_dists++;
+        }
+      }
+      cell_ptr.push_back(N_dists);
+    }
+
+    if (dists.size() >= buf_size * sizeof(NewLink) / sizeof(int32_t)) {
+      dists_out.write(reinterpret_cast<const char *>(dists.data()), dists.size() * sizeof(int32_t));
+      dists.clear();
+    }
+  }
+  dists_out.write(reinterpret_cast<const char *>(dists.data()), dists.size() * sizeof(int32_t));
+  dists_out.close();
+  runs_in.close();
+  if (!dists_out) {
+    cerr << "ERROR: ChromLinkMatrix::WriteFile: failed to write temporary file '" << dists_file << "'" << endl;
+    exit(1);
+  }
+  boost::filesystem::remove(runs_file);
+  for (int i = 0; i < _N_contigs; i++) {
+    pair_ptr[i+1] += pair_ptr[i];
+  }
+
+  // Write the file, in the same layout as WriteBinaryFile().
+  const uint64_t N_pairs = pair_c2.size();
+  const string header_text = FileHeader(CLM_file, false);
+
+  CLMBinaryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CLM_BINARY_MAGIC, sizeof(CLM_BINARY_MAGIC));
+  header.version = _compact ? CLM_BINARY_VERSION_COMPACT : CLM_BINARY_VERSION;
+  header.byte_order = CLM_BYTE_ORDER_MARK;
+  header.N_contigs = _N_contigs;
+  header.contig_size = _contig_size;
+  header.header_text_len = PadTo8(header_text.size() + 1);
+  header.N_pairs = N_pairs;
+  header.N_dists = N_dists;
+
+  ofstream out(CLM_file.c_str(), ios::out | ios::binary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(header_text.c_str(), header_text.size() + 1);
+  WritePadding(out, header_text.size() + 1);
+  out.write(reinterpret_cast<const char *>(pair_ptr.data()), (_N_contigs+1) * sizeof(uint64_t));
+  out.write(reinterpret_cast<const char *>(pair_c2.data()), N_pairs * sizeof(int32_t));
+  WritePadding(out, N_pairs * sizeof(int32_t));
+  if (_compact) {
+    const vector<uint32_t> cell_ptr32 = CompactCellPtrs(cell_ptr.data(), cell_ptr.size());
+    out.write(reinterpret_cast<const char *>(cell_ptr32.data()), (4*N_pairs+1) * sizeof(uint32_t));
+    WritePadding(out, (4*N_pairs+1) * sizeof(uint32_t));
+  } else {
+    out.write(reinterpret_cast<const char *>(cell_ptr.data()), (4*N_pairs+1) * sizeof(uint64_t));
+  }
+
+  // Copy in the distances, a buffer at a time.
+  ifstream dists_in(dists_file.c_str(), ios::in | ios::binary);
+  dists.resize(buf_size * sizeof(NewLink) / sizeof(int32_t));
+  vector<uint16_t> codes;
+  while (dists_in) {
+    dists_in.read(reinterpret_cast<char *>(dists.data()), dists.size() * sizeof(int32_t));
+    if (_compact) {
+      codes.resize(dists_in.gcount() / sizeof(int32_t));
+      for (size_t i = 0; i < codes.size(); i++) {
+        codes[i] = EncodeLinkDist(dists[i]);
+      }
+      out.write(reinterpret_cast<const char *>(codes.data()), codes.size() * sizeof(uint16_t));
+    } else {
+      out.write(reinterpret_cast<const char *>(dists.data()), dists_in.gcount());
+    }
+  }
+  dists_in.close();
+  boost::filesystem::remove(dists_file);
+
+  if (!out) {
+    cerr << "ERROR: ChromLinkMatrix::WriteFile: failed to write CLM file '" << CLM_file << "'" << endl;
+    exit(1);
+  }
+  out.close();
+
+  if (_N_contigs > 1 && N_dists == 0) {
+    cerr << "WARNING: ChromLinkMatrix::WriteFile: CLM file '" << CLM_file << "' has multiple contigs but no link data" << endl;
+  }
+} // End of ChromLinkMatrix::WriteSpilledBinaryFile
+
+// DrawHeatmap: Draw a heatmap image of this ChromLinkMatrix at out/<heatmap_file> (a PNG file, by
+// default out/heatmap.png.)  Each pair of contigs with links is added to a HeatmapPyramid once in
+// each direction, with its number of links in the forward orientations, as in the heatmap text
+// format (see WriteTextFile).
 void ChromLinkMatrix::DrawHeatmap(const string &heatmap_file) const {
-  WriteFile("heatmap.txt", true); // true means to write the file in heatmap format
-  // The R script "heatmap.R" is hardwired to take "heatmap.txt" as input and write to out/heatmap.jpg.
-  // For details on how this script works, see the script itself.
-  cout << "Plotting a heatmap at out/" << heatmap_file << endl;
-  system("./heatmap.R");
-  // Copy the file heatmap.jpg into the place desired.
-  if (heatmap_file != "" && heatmap_file != "heatmap.jpg") {
-    system(("cp out/heatmap.jpg out/" + heatmap_file).c_str());
+  const string file = "out/" + (heatmap_file == "" ? string("heatmap.png") : heatmap_file);
+  cout << "Plotting a heatmap at " << file << endl;
+
+  HeatmapPyramid heatmap(_N_contigs);
+  for (int c1 = 0; c1 < _N_contigs; c1++) {
+    for (uint64_t p = _pair_ptr[c1]; p < _pair_ptr[c1+1]; p++) {
+      const int c2 = _pair_c2[p];
+      heatmap.Add(c1, c2, NLinks(c1, c2));
+      if (c2 != c1) {
+        heatmap.Add(c2, c1, NLinks(c2, c1));
+      }
+    }
   }
+
+  system("mkdir -p out");
+  heatmap.WritePNG(file);
   cout << "Done plotting!" << endl;
 }
 
@@ -544,8 +1144,8 @@ void ChromLinkMatrix::LoadFromSAMNonDeNovo(const vector<string> &SAM_files,
 
 bool ChromLinkMatrix::has_links() const {
   for (int i = 0; i < _N_contigs; i++) {
-    for (int j = i+1; j < _N_contigs; j++) {
-      if (!_matrix[ 2*i ][ 2*j ].empty()) {
+    for (uint64_t p = _pair_ptr[i]; p < _pair_ptr[i+1]; p++) {
+      if (_pair_c2[p] != i && CellPtr(4*p) != CellPtr(4*p+1)) {
 	return true;
       }
     }
@@ -563,17 +1163,18 @@ vector<bool> ChromLinkMatrix::ContigsUsed(const bool flag_adjacent) const {
     return vector<bool>(1, true); // handle edge case
   }
   vector<bool> used(_N_contigs, true);
-  // Loop over all bins in a row.
+  // Find the contigs that have data in any bin [2*i][2*j] (or [2*j][2*i]).
+  vector<bool> has_data(_N_contigs, false);
   for (int i = 0; i < _N_contigs; i++) {
-    bool has_data = false;
-    for (int j = 0; j < _N_contigs; j++) {
-      if (!_matrix[ 2*min(i,j) ][ 2*max(i,j) ].empty()) {
-	has_data = true;
-	break;
+    for (uint64_t p = _pair_ptr[i]; p < _pair_ptr[i+1]; p++) {
+      if (CellPtr(4*p) != CellPtr(4*p+1)) {
+        has_data[i] = has_data[ _pair_c2[p] ] = true;
       }
     }
+  }
+  for (int i = 0; i < _N_contigs; i++) {
     // If there's no data in this row, flag it (and maybe its neighbors).
-    if (!has_data) {
+    if (!has_data[i]) {
       used[i] = false;
       if (flag_adjacent) {
 	if (i > 0) {
@@ -598,18 +1199,41 @@ double ChromLinkMatrix::ContigOrientLogLikelihood(const int c1,
                                                   const bool rc1,
                                                   const int c2,
                                                   const bool rc2 ) const {
-  double log_like = 0;
-  // Find the vector of contig distances that represents this pair of contigs with this orientation.
-  // For an ASCII illustration of these orientations, see AddLinkToMatrix().
-  const vector<int> & dists = _matrix[ 2*c1 + (rc1?1:0) ][ 2*c2 + (rc2?1:0) ];
-  // Each link of distance x makes a contribution of 1/x to the likelihood; hence -ln(x) to the log-likelihood.
-  int N_links = dists.size();
-  for (int j = 0; j < N_links; j++) {
-    log_like -= log(double(dists[j]));
-  }
-  return log_like;
+  assert(_new_links.empty()); // if this fails, CompileLinks() hasn't been called
+
+  // Only the pairs with c1 <= c2 are stored; the rest are their mirror images.  See Links().
+  if (c1 > c2) {
+    return ContigOrientLogLikelihood(c2, !rc2, c1, !rc1);
+  }
+  const int64_t p = FindPair(c1, c2);
+  if (p == -1) {
+    return 0;
+  }
+
+  // The log-likelihoods of all four orientations of this pair are calculated together, on the first
+  // call for this pair, and cached in _orient_LLs.  Orientation is tested over and over for the same
+  // adjacent pairs (in the trunk, then the full ordering, then the reports.)
+  if (_orient_LLs.empty()) {
+    _orient_LLs.assign(4 * _pair_ptr[_N_contigs], NAN);
+  }
+  double *LLs = &_orient_LLs[4*p];
+  if (isnan(LLs[0])) {
+    for (int k = 0; k < 4; k++) {
+      // Find the vector of contig distances that represents this pair of contigs with this
+      // orientation.  For an ASCII illustration of these orientations, see AddLinkToMatrix().
+      const LinkDistances dists = Cell(p, k);
+      // Each link of distance x makes a contribution of 1/x to the likelihood; hence -ln(x) to the log-likelihood.
+      double log_like = 0;
+      log_like -= dists.SumLogs();
+      LLs[k] = log_like;
+    }
+  }
+  return LLs[2*rc1 + rc2];
 }
 
+// Count the calls to OrderingScore().  See StageTimer in TimeMem.h.
+static CallCounter OrderingScore_calls("OrderingScore");
+
 /*******************************************************************************
  * OrderingScore: Find the "score" of this ContigOrdering, indicating how well it matches up with
  * the Hi-C link data. Specifically: This ContigOrdering implies a certain distribution of Hi-C link
@@ -630,49 +1254,105 @@ double ChromLinkMatrix::OrderingScore(const ContigOrdering &order,
                                       const bool oriented,
                                       const int range_start,
                                       const int range_stop) const {
+  return OrderingScoreOf(order, oriented, range_start, range_stop);
+}
+
+double ChromLinkMatrix::OrderingScore(const ShredInsertion &order,
+                                      const bool oriented,
+                                      const int range_start,
+                                      const int range_stop) const {
+  return OrderingScoreOf(order, oriented, range_start, range_stop);
+}
+
+template<class Ordering>
+double ChromLinkMatrix::OrderingScoreOf(const Ordering &order,
+                                        const bool oriented,
+                                        const int range_start,
+                                        const int range_stop) const {
+  ++OrderingScore_calls;
   assert(order.N_contigs() == _N_contigs); // sanity check
+  if (range_start == -1) {
+    return OrderingScoreOf<Ordering, SCORE_ALL>(order, oriented, range_start, range_stop);
+  }
+  if (range_stop == -1) {
+    return OrderingScoreOf<Ordering, SCORE_AROUND>(order, oriented, range_start, range_stop);
+  }
+  return OrderingScoreOf<Ordering, SCORE_RANGE>(order, oriented, range_start, range_stop);
+}
+
+template<class Ordering, ChromLinkMatrix::ScoreRange Range>
+double ChromLinkMatrix::OrderingScoreOf(const Ordering &order,
+                                        const bool oriented,
+                                        const int range_start,
+                                        const int range_stop) const {
+  if (_contig_size == 0) {
+    return oriented ? OrderingScoreKernel<Ordering, true, Range, true>(order, range_start, range_stop)
+                    : OrderingScoreKernel<Ordering, false, Range, true>(order, range_start, range_stop);
+  }
+  return oriented ? OrderingScoreKernel<Ordering, true, Range, false>(order, range_start, range_stop)
+                  : OrderingScoreKernel<Ordering, false, Range, false>(order, range_start, range_stop);
+}
+
+template<class Ordering, bool Oriented, ChromLinkMatrix::ScoreRange Range, bool DeNovo>
+double ChromLinkMatrix::OrderingScoreKernel(const Ordering &order,
+                                            const int range_start,
+                                            const int range_stop) const {
+  const int N_used = order.N_contigs_used();
+  // Pairs are scored if contig2 is at or after range_start, and contig1 is before range_end.
+  const int range_end = Range == SCORE_ALL ? N_used : Range == SCORE_AROUND ? range_start : range_stop;
   double score = 0;
+  // If there's a range, a contig more than _CP_score_dist before it can't be scored with any
+  // contig in it, so start from the first contig that can.
+  int i1_begin = 0;
+  if (Range != SCORE_ALL && range_start > 0) {
+    i1_begin = range_start - 1;
+    int64_t D = 0; // the length of the contigs between i1_begin and range_start
+    while (i1_begin > 0) {
+      D += (DeNovo ? _contig_lengths[order.contig_ID(i1_begin)] : _contig_size);
+      if (D > _CP_score_dist) {
+        break;
+      }
+      i1_begin--;
+    }
+  }
   // Loop over all distinct values of contig1 and contig2, such that contig1 < contig2.
-  for (int i1 = 0; i1+1 < order.N_contigs_used(); i1++) {
+  const int i1_end = min(N_used - 1, range_end); // no more pairs in the range after this
+  for (int i1 = i1_begin; i1 < i1_end; i1++) {
     int contig1 = order.contig_ID(i1);
     int rc1 = order.contig_rc(i1);
     // Keep track of the distance between contig1 and contig2 (which is occupied by other intervening contigs.)
     int contig_dist = 0;
-    for (int i2 = i1+1; i2 < order.N_contigs_used(); i2++) {
-      if (range_start != -1 && range_stop == -1) {
-	if (i1 >= range_start || i2 < range_start) {
-          continue;
-        }
-      }
-      if (range_stop != -1) {
-	if (i1 >= range_stop || i2 < range_start) {
-          continue;
+    int i2 = i1+1;
+    // Pairs before the range aren't scored, but their contigs still count toward the distance
+    // to the next contig2.
+    if (Range != SCORE_ALL) {
+      for (; i2 < range_start && i2 < N_used; i2++) {
+        contig_dist += (DeNovo ? _contig_lengths[order.contig_ID(i2)] : _contig_size);
+        if (contig_dist > _CP_score_dist) {
+          break;
         }
       }
+    }
+    for (; i2 < N_used && contig_dist <= _CP_score_dist; i2++) {
       int contig2 = order.contig_ID(i2);
       int rc2 = order.contig_rc(i2);
 
       // Each oriented pair of contigs points to an element in the ChromLinkMatrix, which is a
-      // vector<int> giving the distance between the reads in those two contigs, assuming the
+      // list of the distances between the reads in those two contigs, assuming the
       // contigs are immediately adjacent with the specified orientations. For an ASCII illustration
       // of these distances, see AddLinkToMatrix().
-      const vector<int> &dists = _matrix[ 2*contig1+rc1 ] [ 2*contig2+rc2 ];
+      const LinkDistances dists = Links(contig1, rc1, contig2, rc2);
       // If we take orientation into account, we have to do a bunch of computation on the individual links.
-      if (oriented) {
+      if (Oriented) {
 	// Adjust the distances to account for the space between contig1 and contig2 in this ContigOrdering.
 	// Each link of distance x makes a contribution to the score that is equal to 1/x.
-	for (size_t i = 0; i < dists.size(); i++) {
-	  if (dists[i] == 0) {
-            PRINT4(i1, i2, i, dists[i]);
-          }
-	  score += 1.0 / double(dists[i] + contig_dist);
-        }
+	score += dists.SumReciprocals(contig_dist);
       }
-      contig_dist += (_contig_size != 0 ? _contig_size : _contig_lengths[contig2]);
+      contig_dist += (DeNovo ? _contig_lengths[contig2] : _contig_size);
       if (contig_dist > _CP_score_dist) {
         break;
       }
-      if (!oriented) {
+      if (!Oriented) {
 	// Just count the number of links between the two contigs.
 	score += dists.size() / double(contig_dist);
       }
@@ -683,41 +1363,243 @@ double ChromLinkMatrix::OrderingScore(const ContigOrdering &order,
 }  // End of OrderingScore
 
 /*******************************************************************************
- * EnrichmentScore: Find the "enrichment" for this ContigOrdering: the degree to which it causes the
- * Hi-C links between contigs to be between close contigs.  It's analogous to the concentration of
- * signal along the main diagonal of the heatmap.  To calculate enrichment, the OrderingScore is
- * divided by the "null score", which is the value that would result from this ContigOrdering under
- * the  condition of constant link density.
+ * OrderingScoreReference: The original, interpreted OrderingScore(), from before the kernels.  It
+ * doesn't count toward the OrderingScore calls.  The kernels add up the same terms in the same
+ * order, so their scores should be exactly equal to this one's.
  ******************************************************************************/
-double ChromLinkMatrix::EnrichmentScore(const ContigOrdering &order) const {
+double ChromLinkMatrix::OrderingScoreReference(const ContigOrdering &order,
+                                               const bool oriented,
+                                               const int range_start,
+                                               const int range_stop) const {
   assert(order.N_contigs() == _N_contigs); // sanity check
-  if (order.N_contigs() <= 2 || order.N_contigs_used() <= 1) {
-    return 0; // handle degenerate case
+  double score = 0;
+  // If there's a range, a contig more than _CP_score_dist before it can't be scored with any
+  // contig in it, so start from the first contig that can.
+  int i1_begin = 0;
+  if (range_start > 0) {
+    i1_begin = range_start - 1;
+    int64_t D = 0; // the length of the contigs between i1_begin and range_start
+    while (i1_begin > 0) {
+      D += (_contig_size != 0 ? _contig_size : _contig_lengths[order.contig_ID(i1_begin)]);
+      if (D > _CP_score_dist) {
+        break;
+      }
+      i1_begin--;
+    }
   }
-
-  // Find the total number of links and the total (squared) distance in which the links occur.  Use
-  // these numbers to calculate a link density. Also calculate the null score, which depends on the
-  // set of contigs used in the ContigOrdering, but not on their order or orientation.
-  int64_t N_links = 0, total_len = 0, total_len_sq = 0;
-  double null_score = 0;
-
-  for (int i1 = 0; i1 < order.N_contigs_used(); i1++) {
+  // Loop over all distinct values of contig1 and contig2, such that contig1 < contig2.
+  for (int i1 = i1_begin; i1+1 < order.N_contigs_used(); i1++) {
+    if (range_start != -1 && i1 >= (range_stop == -1 ? range_start : range_stop)) {
+      break; // no more pairs in the range
+    }
     int contig1 = order.contig_ID(i1);
-    total_len += _contig_lengths[contig1];
+    int rc1 = order.contig_rc(i1);
     // Keep track of the distance between contig1 and contig2 (which is occupied by other intervening contigs.)
     int contig_dist = 0;
     for (int i2 = i1+1; i2 < order.N_contigs_used(); i2++) {
+      // Pairs outside the range aren't scored, but their contigs still count toward the distance
+      // to the next contig2.
+      const bool in_range = range_start == -1 || (i2 >= range_start && i1 < (range_stop == -1 ? range_start : range_stop));
       int contig2 = order.contig_ID(i2);
-      // If the distance is too far, skip this contig pair.
+      int rc2 = order.contig_rc(i2);
+
+      // Each oriented pair of contigs points to an element in the ChromLinkMatrix, which is a
+      // list of the distances between the reads in those two contigs, assuming the
+      // contigs are immediately adjacent with the specified orientations. For an ASCII illustration
+      // of these distances, see AddLinkToMatrix().
+      const LinkDistances dists = in_range ? Links(contig1, rc1, contig2, rc2) : LinkDistances();
+      // If we take orientation into account, we have to do a bunch of computation on the individual links.
+      if (oriented && in_range) {
+	// Adjust the distances to account for the space between contig1 and contig2 in this ContigOrdering.
+	// Each link of distance x makes a contribution to the score that is equal to 1/x.
+	score += dists.SumReciprocals(contig_dist);
+      }
       contig_dist += (_contig_size != 0 ? _contig_size : _contig_lengths[contig2]);
       if (contig_dist > _CP_score_dist) {
         break;
       }
-      // Add to the contig length tallies.
-      N_links += _matrix[ 2*contig1 ] [ 2*contig2 ].size();
-
-      /* clang-tidy says: "C-style casts are discouraged. Use static_cast."
-      int64_t len_sq = (int64_t) _contig_lengths[contig1] * (int64_t) _contig_lengths[contig2];
+      if (!oriented && in_range) {
+	// Just count the number of links between the two contigs.
+	score += dists.size() / double(contig_dist);
+      }
+    }
+  }
+  assert( !isnan(score) );
+  return score;
+}  // End of OrderingScoreReference
+
+/*******************************************************************************
+ * PairScore: The contribution to OrderingScore(order, true) of the links between two oriented
+ * contigs, when they are separated by D bp of intervening contigs.  contig1 precedes contig2.
+ ******************************************************************************/
+double ChromLinkMatrix::PairScore(const int contig1,
+                                  const bool rc1,
+                                  const int contig2,
+                                  const bool rc2,
+                                  const int64_t D) const {
+  const LinkDistances dists = Links(contig1, rc1, contig2, rc2);
+  return dists.SumReciprocals(D);
+}
+
+/*******************************************************************************
+ * ShredInsertionScores: Helper function for ReinsertShreds().  For each position j in
+ * [0,order.N_contigs_used()], find the OrderingScore(order_plus, true) of order_plus, the ordering
+ * made by inserting the shred into this ContigOrdering at position j (fw_scores[j]), or inserting
+ * it and then inverting it (rc_scores[j]); that is, of ShredInsertion(order, shred, j, rc).
+ * rc_scores is only filled if the shred has more than one contig.
+ *
+ * Rather than score each order_plus from scratch, which is O(N^2) per candidate, this works out
+ * what changes when the shred is inserted.  In OrderingScore(), the links between two contigs
+ * count iff the contigs in between them add up to at most _CP_score_dist; using prefix sums of
+ * the contig lengths, these intervening lengths can be found in O(1).  So:
+ * -- The pairs of contigs that straddle position j move apart by the length of the shred.  The
+ *    change in their score doesn't depend on where the shred is, only on which positions the pair
+ *    straddles, so it's found for every j at once with a single pass over the original ordering.
+ * -- The pairs within the shred score the same at every j.
+ * -- The pairs between the shred and its new neighbors are the only ones that must be found for
+ *    each j.  This takes O(window) time per shred contig, where the window is the set of contigs
+ *    within _CP_score_dist of position j.
+ * The results are equal to OrderingScore() up to floating-point rounding.
+ ******************************************************************************/
+void ChromLinkMatrix::ShredInsertionScores(const ContigOrdering &order,
+                                           const vector<int> &shred,
+                                           vector<double> &fw_scores,
+                                           vector<double> &rc_scores,
+                                           ShredScratch &scratch) const {
+  const int N = order.N_contigs_used();
+  const int K = shred.size();
+
+  // Prefix sums of contig lengths: P[i] is the total length of the first i contigs in the ordering.
+  vector<int64_t> &P = scratch.P;
+  P.assign(N+1, 0);
+  for (int i = 0; i < N; i++) {
+    const int contig = order.contig_ID(i);
+    P[i+1] = P[i] + (_contig_size != 0 ? _contig_size : _contig_lengths[contig]);
+  }
+  int64_t shred_len = 0;
+  for (int x = 0; x < K; x++) {
+    shred_len += (_contig_size != 0 ? _contig_size : _contig_lengths[ shred[x] ]);
+  }
+
+  // Score the original ordering.  At the same time, for each pair (a,b) with a < b, find the
+  // change in its score if the shred goes in between them, and apply this change to all insertion
+  // points j with a < j <= b, via a difference array.
+  double base_score = 0;
+  vector<double> &straddle_delta = scratch.straddle_delta;
+  straddle_delta.assign(N+2, 0);
+  for (int a = 0; a+1 < N; a++) {
+    const int contig1 = order.contig_ID(a);
+    const bool rc1 = order.contig_rc(a);
+    for (int b = a+1; b < N; b++) {
+      const int64_t D = P[b] - P[a+1]; // length of the contigs in between a and b
+      if (D > _CP_score_dist) {
+        break;
+      }
+      const int contig2 = order.contig_ID(b);
+      const bool rc2 = order.contig_rc(b);
+      const double old_score = PairScore(contig1, rc1, contig2, rc2, D);
+      const double new_score = D + shred_len > _CP_score_dist ? 0 : PairScore(contig1, rc1, contig2, rc2, D + shred_len);
+      base_score += old_score;
+      straddle_delta[a+1] += new_score - old_score;
+      straddle_delta[b+1] -= new_score - old_score;
+    }
+  }
+
+  fw_scores.assign(N+1, 0);
+  rc_scores.clear();
+  for (int rc = 0; rc < 2; rc++) {
+    if (rc && K == 1) {
+      continue; // no need to reverse singletons
+    }
+
+    // The shred's contigs, in the order and orientation in which they'll be inserted.  Q[x] is the
+    // total length of the first x of them.
+    vector<int> &S = scratch.S;
+    vector<int64_t> &Q = scratch.Q;
+    S.resize(K);
+    Q.assign(K+1, 0);
+    for (int x = 0; x < K; x++) {
+      S[x] = rc ? shred[K-1-x] : shred[x];
+      Q[x+1] = Q[x] + (_contig_size != 0 ? _contig_size : _contig_lengths[ S[x] ]);
+    }
+
+    // The pairs within the shred.
+    double internal_score = 0;
+    for (int x = 0; x+1 < K; x++) {
+      for (int y = x+1; y < K; y++) {
+        const int64_t D = Q[y] - Q[x+1];
+        if (D > _CP_score_dist) {
+          break;
+        }
+        internal_score += PairScore(S[x], rc, S[y], rc, D);
+      }
+    }
+
+    vector<double> &scores = rc ? rc_scores : fw_scores;
+    scores.assign(N+1, 0);
+    double straddle_score = 0;
+    for (int j = 0; j <= N; j++) {
+      straddle_score += straddle_delta[j];
+      double score = base_score + straddle_score + internal_score;
+
+      // The pairs between the shred and the contigs before it, and after it.
+      for (int x = 0; x < K; x++) {
+        for (int a = j-1; a >= 0; a--) {
+          const int64_t D = P[j] - P[a+1] + Q[x];
+          if (D > _CP_score_dist) {
+            break;
+          }
+          score += PairScore(order.contig_ID(a), order.contig_rc(a), S[x], rc, D);
+        }
+        for (int b = j; b < N; b++) {
+          const int64_t D = shred_len - Q[x+1] + P[b] - P[j];
+          if (D > _CP_score_dist) {
+            break;
+          }
+          score += PairScore(S[x], rc, order.contig_ID(b), order.contig_rc(b), D);
+        }
+      }
+      scores[j] = score;
+    }
+  }
+}
+
+/*******************************************************************************
+ * EnrichmentScore: Find the "enrichment" for this ContigOrdering: the degree to which it causes the
+ * Hi-C links between contigs to be between close contigs.  It's analogous to the concentration of
+ * signal along the main diagonal of the heatmap.  To calculate enrichment, the OrderingScore is
+ * divided by the "null score", which is the value that would result from this ContigOrdering under
+ * the  condition of constant link density.
+ ******************************************************************************/
+double ChromLinkMatrix::EnrichmentScore(const ContigOrdering &order) const {
+  assert(order.N_contigs() == _N_contigs); // sanity check
+  if (order.N_contigs() <= 2 || order.N_contigs_used() <= 1) {
+    return 0; // handle degenerate case
+  }
+
+  // Find the total number of links and the total (squared) distance in which the links occur.  Use
+  // these numbers to calculate a link density. Also calculate the null score, which depends on the
+  // set of contigs used in the ContigOrdering, but not on their order or orientation.
+  int64_t N_links = 0, total_len = 0, total_len_sq = 0;
+  double null_score = 0;
+
+  for (int i1 = 0; i1 < order.N_contigs_used(); i1++) {
+    int contig1 = order.contig_ID(i1);
+    total_len += _contig_lengths[contig1];
+    // Keep track of the distance between contig1 and contig2 (which is occupied by other intervening contigs.)
+    int contig_dist = 0;
+    for (int i2 = i1+1; i2 < order.N_contigs_used(); i2++) {
+      int contig2 = order.contig_ID(i2);
+      // If the distance is too far, skip this contig pair.
+      contig_dist += (_contig_size != 0 ? _contig_size : _contig_lengths[contig2]);
+      if (contig_dist > _CP_score_dist) {
+        break;
+      }
+      // Add to the contig length tallies.
+      N_links += NLinks(contig1, contig2);
+
+      /* clang-tidy says: "C-style casts are discouraged. Use static_cast."
+      int64_t len_sq = (int64_t) _contig_lengths[contig1] * (int64_t) _contig_lengths[contig2];
       */
       int64_t len_sq = static_cast<int64_t>(_contig_lengths[contig1]) *
         static_cast<int64_t>(_contig_lengths[contig2]);
@@ -782,7 +1664,7 @@ void ChromLinkMatrix::PrefilterLinks(const set<int> &cluster,
   // Loop over all contig pairs.
   for (int contig1 = 0; contig1 < _N_contigs; contig1++) {
     for (int contig2 = contig1+1; contig2 < _N_contigs; contig2++) {
-      const vector<int> &links = _matrix[ 2*contig1 ][ 2*contig2 ];
+      const LinkDistances links = Links(contig1, false, contig2, false);
       int N_links = links.size();
       if (N_links == 0) {
         continue; // no links, so nothing to do
@@ -864,6 +1746,124 @@ void ChromLinkMatrix::PrefilterLinks(const set<int> &cluster,
   exit(0);
 }
 
+/*******************************************************************************
+ * Checkpointing (see SetCheckpoints in ChromLinkMatrix.h).  Each checkpoint file is a text file
+ * with a header line, the stamp, and then the step's own data, written at full precision.
+ ******************************************************************************/
+void ChromLinkMatrix::SetCheckpoints(const string &file_head, const string &stamp, const double seconds) {
+  assert(seconds >= 0);
+  _checkpoint_head = seconds > 0 ? file_head : "";
+  _checkpoint_stamp = stamp;
+  _checkpoint_seconds = seconds;
+  _last_checkpoint = chrono::steady_clock::now();
+}
+
+void ChromLinkMatrix::RemoveCheckpoints() const {
+  if (_checkpoint_head.empty()) {
+    return;
+  }
+  boost::filesystem::remove(CheckpointFile("trunk"));
+  boost::filesystem::remove(CheckpointFile("reinsert"));
+}
+
+bool ChromLinkMatrix::ReadCheckpoint(const string &step, ifstream &in) const {
+  if (_checkpoint_head.empty() || !boost::filesystem::is_regular_file(CheckpointFile(step))) {
+    return false;
+  }
+  in.open(CheckpointFile(step).c_str(), ios::in);
+  string header, stamp;
+  getline(in, header);
+  getline(in, stamp);
+  if (!in || header != "# Lachesis checkpoint: " + step || stamp != _checkpoint_stamp) {
+    cout << "Ignoring the checkpoint at " << CheckpointFile(step) << ", which is from a different CLM or different ordering parameters" << endl;
+    in.close();
+    return false;
+  }
+  cout << "Resuming from the checkpoint at " << CheckpointFile(step) << endl;
+  return true;
+}
+
+void ChromLinkMatrix::WriteCheckpoint(const string &step, const function<void(ostream &)> &write) const {
+  if (_checkpoint_head.empty()) {
+    return;
+  }
+  const string file = CheckpointFile(step);
+  {
+    ofstream out((file + ".tmp").c_str(), ios::out);
+    out << "# Lachesis checkpoint: " << step << '\n' << _checkpoint_stamp << '\n' << setprecision(17);
+    write(out);
+    if (!out) {
+      cerr << "ERROR: ChromLinkMatrix: can't write checkpoint file " << file << ".tmp" << endl;
+      exit(1);
+    }
+  }
+  boost::filesystem::rename(file + ".tmp", file); // so that an interrupted write can't leave a partial checkpoint
+  _last_checkpoint = chrono::steady_clock::now();
+}
+
+bool ChromLinkMatrix::CheckpointDue() const {
+  return !_checkpoint_head.empty() &&
+    chrono::duration<double>(chrono::steady_clock::now() - _last_checkpoint).count() >= _checkpoint_seconds;
+}
+
+// WriteCheckpointOrdering, ReadCheckpointOrdering: Write a ContigOrdering to a checkpoint file, and
+// read it back exactly, with its orientations, quality scores, and gaps.  The format is three lines:
+// "ordering N_contigs N_used" and the contig IDs (~ID if rc); "Q N" and the quality scores; "gaps N"
+// and the gap sizes.
+static void WriteCheckpointOrdering(ostream &out, const ContigOrdering &order) {
+  const int N_used = order.N_contigs_used();
+  out << "ordering " << order.N_contigs() << ' ' << N_used;
+  for (int i = 0; i < N_used; i++) {
+    out << ' ' << (order.contig_rc(i) ? ~order.contig_ID(i) : order.contig_ID(i));
+  }
+  out << "\nQ " << (order.has_Q_scores() ? N_used : 0);
+  for (int i = 0; order.has_Q_scores() && i < N_used; i++) {
+    out << ' ' << order.contig_orient_Q(i);
+  }
+  out << "\ngaps " << (order.has_gaps() ? N_used-1 : 0);
+  for (int i = 0; order.has_gaps() && i+1 < N_used; i++) {
+    out << ' ' << order.gap_size(i);
+  }
+  out << '\n';
+}
+
+static ContigOrdering ReadCheckpointOrdering(istream &in) {
+  string tag;
+  int N_contigs, N_used, N_Q, N_gaps;
+  in >> tag >> N_contigs >> N_used;
+  assert(tag == "ordering");
+  vector<int> data(N_used), IDs(N_used);
+  for (int i = 0; i < N_used; i++) {
+    in >> data[i];
+    IDs[i] = data[i] >= 0 ? data[i] : ~data[i];
+  }
+  ContigOrdering order(N_contigs, IDs);
+  for (int i = 0; i < N_used; i++) {
+    if (data[i] < 0) {
+      order.Invert(i);
+    }
+  }
+  in >> tag >> N_Q;
+  assert(tag == "Q" && (N_Q == 0 || N_Q == N_used));
+  for (int i = 0; i < N_Q; i++) {
+    double Q;
+    in >> Q;
+    order.AddOrientQ(i, Q);
+  }
+  in >> tag >> N_gaps;
+  assert(tag == "gaps" && (N_gaps == 0 || N_gaps == N_used-1));
+  for (int i = 0; i < N_gaps; i++) {
+    int gap;
+    in >> gap;
+    order.SetGap(i, gap);
+  }
+  if (!in) {
+    cerr << "ERROR: ChromLinkMatrix: can't read the ordering in a checkpoint file - it may be truncated or corrupted" << endl;
+    exit(1);
+  }
+  return order;
+}
+
 ContigOrdering ChromLinkMatrix::MakeTrunkOrder(const int min_N_REs) const {
   cout << "MakeTrunkOrder!" << endl;
   assert (!_contig_RE_sites.empty());
@@ -872,11 +1872,31 @@ ContigOrdering ChromLinkMatrix::MakeTrunkOrder(const int min_N_REs) const {
     return ContigOrdering(_N_contigs, false);
   }
 
+  // If a previous run got this far, resume from its checkpoint: the spanning tree and the trunk.
+  ifstream checkpoint;
+  if (ReadCheckpoint("trunk", checkpoint)) {
+    int N_nodes;
+    checkpoint >> N_nodes;
+    assert(N_nodes == _N_contigs);
+    _tree.assign(_N_contigs, vector<int>());
+    for (int i = 0; i < _N_contigs; i++) {
+      int N_adjs;
+      checkpoint >> N_adjs;
+      _tree[i].resize(N_adjs);
+      for (int j = 0; j < N_adjs; j++) {
+        checkpoint >> _tree[i][j];
+      }
+    }
+    return ReadCheckpointOrdering(checkpoint);
+  }
+
   // First, find the minimum spanning tree (MST) that spans a graph version of this ChromLinkMatrix.
   // The minimum spanning tree is a way to connect all the nodes (contigs) such that the total
   // weight of all the connections (measured as 1 / the number of links in support of a connection)
   // is at a minimum.
+  StageTimer tree_timer("FindSpanningTree");
   _tree = FindSpanningTree(min_N_REs);
+  tree_timer.Stop();
   // SmoothThornsInTree: Remove from the tree as many "thorns" (i.e., single-vertex spurs from the
   // main trunk) as possible.
   SmoothThornsInTree(_tree);
@@ -908,6 +1928,19 @@ ContigOrdering ChromLinkMatrix::MakeTrunkOrder(const int min_N_REs) const {
   ContigOrdering trunk = TreeTrunk(_tree, true);
   OrientContigs(trunk);
   //trunk.DrawDotplot("order_dotplot.1.trunk.txt");
+
+  // Checkpoint the tree and the trunk, which are all that MakeFullOrder() needs to continue.
+  WriteCheckpoint("trunk", [&](ostream &out) {
+      out << _N_contigs << '\n';
+      for (int i = 0; i < _N_contigs; i++) {
+        out << _tree[i].size();
+        for (size_t j = 0; j < _tree[i].size(); j++) {
+          out << ' ' << _tree[i][j];
+        }
+        out << '\n';
+      }
+      WriteCheckpointOrdering(out, trunk);
+    });
   return trunk;
 }
 
@@ -921,9 +1954,13 @@ ContigOrdering ChromLinkMatrix::MakeFullOrder(const int min_N_REs,
   }
   assert(!_tree.empty()); // if this fails, you need to run MakeTrunkOrder() first
   // Reinsert the pruned contigs into the ordering.
+  StageTimer reinsert_timer("ReinsertShreds");
   ContigOrdering ordering = ReinsertShreds(_tree, min_N_REs, use_CP_score);
+  reinsert_timer.Stop();
   // Determine the proper orientation of contigs in this ContigOrdering.
+  StageTimer orient_timer("OrientContigs");
   OrientContigs(ordering);
+  orient_timer.Stop();
   ordering.Print();
   // Find the score for the "true" ordering.  (This is worthless except in simulated assemblies in
   //which the contigs are in the proper order.)
@@ -960,6 +1997,130 @@ ContigOrdering ChromLinkMatrix::MakeFullOrder(const int min_N_REs,
   return ordering;
 }  // End of MakeTrunkOrder
 
+/*******************************************************************************
+ * RefineOrder: Improve an ordering by simulated annealing.  Each chain starts from the input
+ * ordering and repeatedly tries a random perturbation (see ContigOrdering::RandomPerturbation).
+ * A perturbation of positions [lo,hi] leaves the contigs outside the range, and the total length
+ * inside it, unchanged, so it only changes the scores of the pairs with a contig in the range.  Its
+ * effect on OrderingScore() is found from the range-limited OrderingScore(order, true, lo, hi+1),
+ * before and after, which is O(N) instead of O(N^2).  Better orderings are always accepted; worse
+ * ones with probability exp(delta/T).  The temperature T starts at the typical size of a score
+ * change and falls geometrically by a factor of 1000 over the time budget.  Each chain has its own
+ * random number state, seeded by its index, so chains don't share anything but the matrix.
+ ******************************************************************************/
+void ChromLinkMatrix::RefineOrder(ContigOrdering &order,
+                                  const double time_budget,
+                                  const int N_threads) const {
+  const int N_used = order.N_contigs_used();
+  if (N_used < 3 || time_budget <= 0) {
+    return;
+  }
+  const int N_chains = NThreadsToUse(N_threads);
+  cout << "RefineOrder with " << N_chains << " chains for " << time_budget << " seconds" << endl;
+  StageTimer timer("RefineOrder");
+
+  // Start from the ordering without its orientation quality scores, which perturbations would invalidate.
+  const ContigOrdering start_order(order, 0, N_used);
+  const double start_score = OrderingScore(start_order);
+
+  vector<ContigOrdering> best(N_chains, start_order);
+  vector<double> best_scores(N_chains, start_score);
+  vector<int64_t> N_steps(N_chains, 0), N_accepted(N_chains, 0);
+  const chrono::steady_clock::time_point t_start = chrono::steady_clock::now();
+
+  ParallelForRanges(N_chains, N_chains, [&](const int chain, const size_t, const size_t) {
+      unsigned short xsubi[3] = { 0x330E, static_cast<unsigned short>(chain), static_cast<unsigned short>(chain >> 16) };
+      ContigOrdering current = start_order;
+      double score = start_score;
+
+      // Apply a perturbation, and find the change it makes to the score.
+      int start, stop, lo, hi;
+      bool invert;
+      auto perturb = [&]() {
+        invert = current.RandomPerturbation(xsubi, start, stop);
+        lo = min(start, stop);
+        hi = max(start, stop);
+        const double before = OrderingScore(current, true, lo, hi+1);
+        if (invert) {
+          current.Invert(start, stop);
+        } else {
+          current.MoveContig(start, stop);
+        }
+        return OrderingScore(current, true, lo, hi+1) - before;
+      };
+      auto undo = [&]() {
+        if (invert) {
+          current.Invert(start, stop);
+        } else {
+          current.MoveContig(stop, start);
+        }
+      };
+
+      // Calibrate the starting temperature on a sample of perturbations.
+      const int N_calibration = 100;
+      double T0 = 0;
+      for (int i = 0; i < N_calibration; i++) {
+        T0 += fabs(perturb()) / N_calibration;
+        undo();
+      }
+      T0 = max(T0, DBL_MIN);
+      double T = T0;
+
+      for (int64_t step = 0; ; step++) {
+        // Check the clock every so often, and cool down.
+        if (step % 64 == 0) {
+          const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - t_start).count();
+          if (elapsed >= time_budget) {
+            break;
+          }
+          T = T0 * pow(1e-3, elapsed / time_budget);
+        }
+        N_steps[chain]++;
+
+        const double delta = perturb();
+        if (delta >= 0 || erand48(xsubi) < exp(delta / T)) {
+          N_accepted[chain]++;
+          score += delta;
+          if (score > best_scores[chain]) {
+            best[chain] = current;
+            best_scores[chain] = score;
+          }
+        } else {
+          undo();
+        }
+      }
+    });
+
+  // Pick the best chain.  The chains' scores were added up incrementally, so re-score the best
+  // orderings from scratch to compare them exactly.
+  int best_chain = -1;
+  double best_score = start_score;
+  for (int chain = 0; chain < N_chains; chain++) {
+    cout << "RefineOrder: chain " << chain << ": " << N_steps[chain] << " steps, " << N_accepted[chain] << " accepted" << endl;
+    const double score = OrderingScore(best[chain]);
+    if (score > best_score) {
+      best_chain = chain;
+      best_score = score;
+    }
+  }
+
+  cout << setprecision(8);
+  if (best_chain == -1) {
+    cout << "RefineOrder: no improvement on score " << start_score << endl;
+    return;
+  }
+  cout << "RefineOrder: score " << start_score << " -> " << best_score << " (chain " << best_chain << ")" << endl;
+  // OrientContigs() chooses orientations for an ordering of forward contigs, so drop the chain's.
+  vector<int> contig_IDs(N_used);
+  for (int i = 0; i < N_used; i++) {
+    contig_IDs[i] = best[best_chain].contig_ID(i);
+  }
+  order = ContigOrdering(_N_contigs, contig_IDs);
+  OrientContigs(order);
+  cout << "Refined ordering:\t";
+  ReportOrderingSize(order);
+} // End of RefineOrder
+
 /*******************************************************************************
  * SpaceContigs: No, not contigs in space.  Given an ordering of the contigs in this
  * ChromLinkMatrix, estimate the spacing between them.  Fill the variable _gaps in the
@@ -980,8 +2141,10 @@ ContigOrdering ChromLinkMatrix::MakeFullOrder(const int min_N_REs,
  *    measured as a single contig for the purposes of length.
  ******************************************************************************/
 void ChromLinkMatrix::SpaceContigs(ContigOrdering &order,
-                                   const LinkSizeDistribution &link_size_distribution) const {
+                                   const LinkSizeDistribution &link_size_distribution,
+                                   pair<int, int> *check_gap_search) const {
   cout << "SpaceContigs" << endl;
+  StageTimer timer("SpaceContigs");
   // Sanity checks.
   for (size_t i = 0; i < _SAM_files.size(); i++) {
     cout << "in CLM: " << _SAM_files[i] << endl;
@@ -1022,13 +2185,18 @@ void ChromLinkMatrix::SpaceContigs(ContigOrdering &order,
   ofstream out("enrichments.txt", ios::out);
 
   for (int i = 0; i < _N_contigs; i++) {
-    double enrichment = link_size_distribution.FindEnrichmentOnContig(_contig_lengths[i], _matrix[ 2*i ][ 2*i ]);
+    const LinkDistances intra_links = Links(i, false, i, false);
+    double enrichment = link_size_distribution.FindEnrichmentOnContig(_contig_lengths[i], vector<int>(intra_links.begin(), intra_links.end()));
     // double norm = (double) _contig_lengths[i] / (3500 * (_contig_RE_sites[i]+1) );
     enrichments.push_back(enrichment);
     out << enrichment << endl;
   }
   out.close();
+  // The expected links for each (L1,L2,D) are cached here across calls to FindGapSize(), since
+  // the same pairs of contigs are considered again and again as the scaffolds-in-progress grow.
+  GapLikelihood gap_likelihood(link_size_distribution);
   int N_gaps_found = 0;
+
   // 1. Loop Steps 2-4 repeatedly until all contigs are merged into a scaffold.
   while (N_gaps_found+1 < order.N_contigs_used()) {
     // 2. Find the longest pair of adjacent contigs in the ContigOrdering.  (A pair's "length" here
@@ -1096,19 +2264,29 @@ void ChromLinkMatrix::SpaceContigs(ContigOrdering &order,
       rc2 = swap;
     }
     // PRINT6(pos1, pos2, contig1, contig2, rc1, rc2);
-    const vector<int> &dists = _matrix[ 2*contig1+rc1 ] [ 2*contig2+rc2 ];
+    const LinkDistances links = Links(contig1, rc1, contig2, rc2);
+    const vector<int> dists(links.begin(), links.end());
     // assert( !dists.empty() );
     const int &L1 = _contig_lengths[contig1];
     const int &L2 = _contig_lengths[contig2];
 
     // Find the local LDE (link density enrichment).  It's a weighted product of the LDEs of each
     // contig.
-    double local_LDE = pow(enrichments[contig1], double(2*L1)/(L1+L2)) * pow(enrichments[contig2], double(2*L2)/(L1*L2));
+    double local_LDE = pow(enrichments[contig1], double(2*L1)/(L1+L2)) * pow(enrichments[contig2], double(2*L2)/(L1+L2));
 
     // Assuming these contigs are separated at a distance D, the actual size of all the Hi-C links
     // is D higher than the reported number. Determine the value of D that makes this set of links
     // most concordant with the expectations of the LinkSizeDistribution.
-    int D = FindGapSize(order, LP_pos2-1, link_size_distribution, enrichments);
+    double score;
+    int D = FindGapSize(order, LP_pos2-1, gap_likelihood, enrichments, false, &score);
+    if (check_gap_search != NULL) {
+      double exhaustive_score;
+      FindGapSize(order, LP_pos2-1, gap_likelihood, enrichments, true, &exhaustive_score);
+      check_gap_search->first++;
+      if (score < exhaustive_score - 1e-9 * fabs(exhaustive_score)) {
+        check_gap_search->second++;
+      }
+    }
     D = link_size_distribution.FindDistanceBetweenLinks(L1, L2, local_LDE, dists);
     // assert( D != INT_MAX );
     // 4. Using the derived gap size, merge these contigs into a scaffold-in-progress.  They are now
@@ -1136,8 +2314,9 @@ void ChromLinkMatrix::SpaceContigs(ContigOrdering &order,
  finding a spanning tree with an optimally long longest_path: First we make a graph, then we find
  the  MST (minimum spanning tree) of the graph, then we use the longest path in this MST to
  re-create the graph and find a new spanning tree.  The tree from the first iteration is an MST, but
- subsequent trees are technically merely spanning trees.  The code here follows the example given in
- [boost]/libs/graph/example/prim-example.cpp.
+ subsequent trees are technically merely spanning trees.  The graph is sparse: only linked pairs of
+ contigs have edges.  The MST is found by prim_on_sparse_graph(), which gives the same result as
+ boost::prim_minimum_spanning_tree on the complete graph.
 ******************************************************************************/
 vector< vector<int> > ChromLinkMatrix::FindSpanningTree(const int min_N_REs) const {
   // If this is a small cluster, return a trivial result, rather than failing an assert later.
@@ -1151,9 +2330,6 @@ vector< vector<int> > ChromLinkMatrix::FindSpanningTree(const int min_N_REs) con
     return best_tree;
   }
 
-  using namespace boost;
-  typedef adjacency_list < vecS, vecS, undirectedS, property<vertex_distance_t, int>, property < edge_weight_t, double > > Graph;
-  typedef pair<int, int> E;
   bool use_RE = !_contig_RE_sites.empty();
   const vector<int> & lens = use_RE ? _contig_RE_sites : _contig_lengths;
   static const int MAX_EDGE_WEIGHT_PENALTY = 10; // HEUR: setting this higher will make the search
@@ -1184,20 +2360,57 @@ vector< vector<int> > ChromLinkMatrix::FindSpanningTree(const int min_N_REs) con
   PRINT2(min_len_reduced, N_long_contigs);
 
   vector< vector<int> > best_tree; // this will contain the output
-  // Set up the edges of the graph.
-  int N_edges = _N_contigs * (_N_contigs-1) / 2;
-  E * edges = new E[N_edges];
-  int max_edge_ID = 0;
+  // Set up the edges of the graph.  Each contig becomes a vertex, and the Hi-C links between contigs
+  // are represented as edges between them.  Only pairs of long contigs with links between them get
+  // edges; all other pairs are treated as having an edge of weight infinity (i.e., unusable).  This
+  // is a small fraction of all N(N-1)/2 pairs of contigs, so large clusters fit in memory.  The
+  // edges don't change between iterations; only their weights do.
+  vector<int> edge_i, edge_j;
+  vector<double> base_weights;
   for (int i = 0; i < _N_contigs; i++) {
-    for (int j = i+1; j < _N_contigs; j++) {
-      edges[max_edge_ID++] = make_pair(i,j);
+    if (lens[i] < min_len_reduced) {
+      continue; // leave out short contigs
     }
+    for (uint64_t p = _pair_ptr[i]; p < _pair_ptr[i+1]; p++) {
+      const int j = _pair_c2[p];
+      if (j == i || lens[j] < min_len_reduced) {
+        continue; // leave out short contigs
+      }
+      double link_weight = LinkDensity(i,j);
+      // PRINT3( i, j, link_weight );
+      if (link_weight == 0) {
+        continue; // no links between these two contigs
+      }
+      edge_i.push_back(i);
+      edge_j.push_back(j);
+      base_weights.push_back(1.0 / link_weight); // better-linked contigs should have a *smaller*
+                                                 // edge weight in the graph
+    }
+  }
+  const int N_edges = edge_i.size();
+
+  // Make an adjacency list of the graph, with each vertex's neighbors in increasing order, as
+  // needed by prim_on_sparse_graph.  The edges are sorted by (i,j), so this just takes one pass.
+  vector<uint64_t> adj_ptr(_N_contigs+1, 0);
+  for (int e = 0; e < N_edges; e++) {
+    adj_ptr[ edge_i[e]+1 ]++;
+    adj_ptr[ edge_j[e]+1 ]++;
+  }
+  for (int i = 0; i < _N_contigs; i++) {
+    adj_ptr[i+1] += adj_ptr[i];
+  }
+  vector<int> adj(2 * N_edges), adj_edge(2 * N_edges);
+  vector<uint64_t> adj_fill(adj_ptr.begin(), adj_ptr.end()-1);
+  for (int e = 0; e < N_edges; e++) {
+    adj[ adj_fill[ edge_i[e] ] ] = edge_j[e];
+    adj_edge[ adj_fill[ edge_i[e] ]++ ] = e;
+    adj[ adj_fill[ edge_j[e] ] ] = edge_i[e];
+    adj_edge[ adj_fill[ edge_j[e] ]++ ] = e;
   }
-  assert(max_edge_ID == N_edges);
 
-  // Allocate memory for the edge weigths.
-  double *weights = new double[N_edges];
+  vector<double> weights(N_edges); // this will be repeatedly updated
   vector<int> trunk; // this will be repeatedly updated
+  vector<int> MST_adjs;
   int edge_weight_penalty = 1;
   size_t trunk_size = 0;
 
@@ -1207,59 +2420,40 @@ vector< vector<int> > ChromLinkMatrix::FindSpanningTree(const int min_N_REs) con
   // 2. Run Prim's algorithm to find the MST on this graph.
   // 3. Find the "trunk", the longest path in this MST.
   for (size_t iteration = 0; iteration < 100; iteration++) {
-    // Set up the edge weights to be infinity (i.e., unusable) by default.  The
-    // prim_minimum_spanning_tree algorithm can't handle non-connected graphs.  Hence,  if two
-    // vertices in the graph should have no edge between them, they'll have an edge with weight
-    // infinity.
-    for (int i = 0; i < N_edges; i++) {
-      weights[i] = INFINITY;
-    }
-    max_edge_ID = 0;
     vector<bool> isolated(_N_contigs, true);
     // 1. Build a graph.  If there was a previous iteration, use the longest path from that
-    // iteration to inform the graph building for this iteration.  Define the vertices, edges, and
-    // edge weights.  Each contig becomes a vertex, and the Hi-C links between contigs are
-    // represented as edges between them.
+    // iteration to inform the graph building for this iteration.  Set the edge weights.
 
-    // Loop over all pairs of contigs (vertices).
-    for (int i = 0; i < _N_contigs; i++) {
-      vector<int>::const_iterator i_it = find(trunk.begin(), trunk.end(), i);
-      for (int j = i+1; j < _N_contigs; j++) {
-	max_edge_ID++;
-	if (lens[i] < min_len_reduced || lens[j] < min_len_reduced) {
-          continue; // leave out short contigs
-        }
-	// PRINT7(iteration, i, j, link_weight, lens[i], lens[j], min_len_reduced);
+    // Find the position of each contig in the longest path (or -1 if it's not there).
+    vector<int> trunk_pos(_N_contigs, -1);
+    for (size_t k = 0; k < trunk.size(); k++) {
+      trunk_pos[ trunk[k] ] = k;
+    }
 
-	double link_weight = LinkDensity(i,j);
-	// PRINT3( i, j, link_weight );
-	if (link_weight == 0) {
-          continue; // no links between these two contigs
+    // Loop over all edges.
+    for (int e = 0; e < N_edges; e++) {
+      const int i = edge_i[e], j = edge_j[e];
+      double edge_weight = base_weights[e];
+
+      // Use the already-observed longest path to guide further development of the tree.  The idea
+      // is to use the longest path as a scaffold, and fit into it  the contigs that were
+      // initially left out of it.  So, for the purposes of extending the longest path, prevent
+      // non-adjacent contigs in the longest  path from moving directly to each other, and
+      // penalize adjacent ones.
+      if (trunk_pos[i] != -1 && trunk_pos[j] != -1) {
+        if (abs(trunk_pos[i] - trunk_pos[j]) != 1) {
+          weights[e] = INFINITY;
+          continue; // these two contigs aren't adjacent in the longest path
+        } else {
+          edge_weight *= edge_weight_penalty;
         }
-	double edge_weight = 1.0 / link_weight; // better-linked contigs should have a *smaller*
-                                                // edge weight in the graph
-
-	// Use the already-observed longest path to guide further development of the tree.  The idea
-	// is to use the longest path as a scaffold, and fit into it  the contigs that were
-	// initially left out of it.  So, for the purposes of extending the longest path, prevent
-	// non-adjacent contigs in the longest  path from moving directly to each other, and
-	// penalize adjacent ones.
-	vector<int>::const_iterator j_it = find(trunk.begin(), trunk.end(), j);
-	if (i_it != trunk.end() && j_it != trunk.end()) {
-	  if (i_it + 1 != j_it && i_it - 1 != j_it) {
-            continue; // these two contigs aren't adjacent in the longest path
-          } else {
-            edge_weight *= edge_weight_penalty;
-          }
-	}
-	// Keep track of which vertices are really isolated so we can remove them from the graph later.
-	isolated[i] = false;
-	isolated[j] = false;
-	//cout << "FindSpanningTree iteration #" << iteration << ": Adding edge #" << max_edge_ID << " between " << i << " and " << j << " with weight " << edge_weight << endl;
-	weights[max_edge_ID-1] = edge_weight; // subtract 1 because max_edge_weight has already been incremented in this loop
-      } //  End of the inner for loop
-    }  // End of the outer for loop
-    assert(max_edge_ID == N_edges);
+      }
+      // Keep track of which vertices are really isolated so we can remove them from the graph later.
+      isolated[i] = false;
+      isolated[j] = false;
+      //cout << "FindSpanningTree iteration #" << iteration << ": Adding edge #" << e << " between " << i << " and " << j << " with weight " << edge_weight << endl;
+      weights[e] = edge_weight;
+    }
 
     // If all edges are isolated, there is effectively no graph - i.e., no sufficiently long contigs
     // have any links to other sufficiently long contigs. In this case, let's just forget about
@@ -1269,18 +2463,9 @@ vector< vector<int> > ChromLinkMatrix::FindSpanningTree(const int min_N_REs) con
       return best_tree;
     }
 
-    if (_N_contigs > 10000) {
-      cout << "WARNING: ChromLinkMatrix contains a large number of contigs (" << _N_contigs << ").  About to create a Graph object, which will take a lot of memory.  May run out of memory and throw a bad_alloc error." << endl;
-    }
-
-    // Build the Graph object.
-    Graph g(edges, edges + max_edge_ID, weights, _N_contigs);
-    vector < graph_traits<Graph>::vertex_descriptor > MST_adjs(_N_contigs);
-
     // 2. Run Prim's algorithm to find the MST on this graph.
     cout << "prim_minimum_spanning_tree (iteration #" << iteration << ", previous trunk_size = " << trunk_size << ")" << endl;
-    prim_minimum_spanning_tree(g, &MST_adjs[0]);
-    //cout << "prim_minimum_spanning_tree done!" << endl;
+    prim_on_sparse_graph(_N_contigs, adj_ptr, adj, adj_edge, weights, MST_adjs);
 
     for (int i = 0; i < _N_contigs; i++) {
       if (lens[i] < min_len_reduced || lens[ MST_adjs[i] ] < min_len_reduced) {
@@ -1318,20 +2503,8 @@ vector< vector<int> > ChromLinkMatrix::FindSpanningTree(const int min_N_REs) con
     }
     // PRINT(trunk_size);
 
-    // Optional output: Make a dot file and then an image of this complete graph.
-    // NOT RECOMMENDED for graphs over 30 vertices, and unlikely to be useful for graphs above 10.
-    if (0) {
-      ofstream out("graph.dot", ios::out);
-      boost::write_graphviz(out, g, make_label_writer(get(vertex_index,g)), make_label_writer(get(edge_weight,g)));
-      out.close();
-      std::system ("dot -Tpng graph.dot > out/graph.png");
-      cout << "Drew an image of this graph at out/graph.png" << endl;
-    }
   } // End of the for loop above on iteration
 
-  // Cleanup.
-  delete[] edges;
-  delete[] weights;
   cout << "FindSpanningTree: Trunk length = " << trunk_size << endl;
   assert(!best_tree.empty());
   return best_tree;
@@ -1533,8 +2706,31 @@ ContigOrdering ChromLinkMatrix::ReinsertShreds(vector< vector<int> > &tree,
   // size.
   cout << "Reinserting " << shreds.size() << " shreds" << endl;
 
-  for (size_t i = 0; i < shreds.size(); i++) {
-    vector<int> shred = shreds[i];
+  // If a previous run was interrupted partway through the reinsertion, resume from its checkpoint:
+  // the ordering after the first N_shreds_done shreds.  The shreds are the same, since they come
+  // from the same tree.
+  size_t N_shreds_done = 0;
+  ifstream checkpoint;
+  if (ReadCheckpoint("reinsert", checkpoint)) {
+    size_t N_shreds;
+    checkpoint >> N_shreds >> N_shreds_done;
+    assert(N_shreds == shreds.size() && N_shreds_done <= N_shreds);
+    order = ReadCheckpointOrdering(checkpoint);
+    cout << "Resuming after " << N_shreds_done << " of " << N_shreds << " shreds" << endl;
+  }
+
+  // The candidate insertions are scored without making them (see ShredInsertionScores()), with
+  // working space that's reused from shred to shred; only the best one is applied to the ordering.
+  vector<double> fw_scores, rc_scores;
+  ShredScratch scratch;
+  for (size_t i = N_shreds_done; i < shreds.size(); i++) {
+    if (CheckpointDue()) {
+      WriteCheckpoint("reinsert", [&](ostream &out) {
+          out << shreds.size() << ' ' << i << '\n';
+          WriteCheckpointOrdering(out, order);
+        });
+    }
+    vector<int> &shred = shreds[i];
     int shred_start = shred[0];
     int shred_end = shred.back();
     if (verbose) {
@@ -1565,6 +2761,9 @@ ContigOrdering ChromLinkMatrix::ReinsertShreds(vector< vector<int> > &tree,
 
     // Consider all possible positions and orientations in which to insert this shred.
     // Find the position with the most data (immediate links) in support of it.
+    if (use_CP_score) {
+      ShredInsertionScores(order, shred, fw_scores, rc_scores, scratch);
+    }
     double best_N_links = 0;
     double best_score = 0;
     int best_j = -1;
@@ -1578,13 +2777,9 @@ ContigOrdering ChromLinkMatrix::ReinsertShreds(vector< vector<int> > &tree,
           cout << "Adding at position " << j << " with " << ( rc ? "RC" : "FW" ) << " orientation" << endl;
         }
 	if (use_CP_score) {
-	  ContigOrdering order_plus = order;
-	  order_plus.AddContigs(shred, j);
-	  if (rc) {
-            order_plus.Invert(j, j + shred.size() - 1);
-          }
-	  double score;
-	  score = OrderingScore(order_plus, true);
+	  // This is the OrderingScore of the ordering with the shred inserted at position j (and then
+	  // inverted, if rc).
+	  double score = rc ? rc_scores[j] : fw_scores[j];
 	  if (score > best_score) {
 	    best_score = score;
 	    best_j = j;
@@ -1628,6 +2823,9 @@ ContigOrdering ChromLinkMatrix::ReinsertShreds(vector< vector<int> > &tree,
 
     if (verbose) {
       cout << "Best stuff: N_links = " << (use_CP_score ? best_score : best_N_links) << " from j=" << best_j << ", rc=" << int(best_rc) << endl;
+      if (use_CP_score && best_j != -1) {
+        cout << "Best stuff, scored from scratch: " << OrderingScore(ShredInsertion(order, shred, best_j, best_rc)) << endl;
+      }
     }
     if (best_rc) {
       reverse(shred.begin(), shred.end());
@@ -1647,11 +2845,10 @@ void ChromLinkMatrix::OrientContigs(ContigOrdering &order) const {
   cout << "OrientContigs" << endl;
   // Build a WDAG (Weighed Directed Acyclic Graph) representing all possible ways to orient contigs
   // in this ContigOrdering
-  WDAG wdag = order.OrientationWDAG(this);
+  FlatWDAG wdag = order.OrientationWDAG(this);
   // Compute the highest-weight path on this WDAG.
   wdag.FindBestPath();
-  //wdag.WriteToFile("wdag.txt");
-  vector<int> best_node_IDs = wdag.BestNodeIDs();
+  const vector<int> & best_node_IDs = wdag.BestNodeIDs();
   assert((int) best_node_IDs.size() == order.N_contigs_used() + 2); // path includes start,end nodes
   // Use the node IDs of the highest-weight path to determine which contigs should be flipped.
   // Due to the node ID numbering, an even node ID indicates that a contig should be flipped.
@@ -1696,26 +2893,25 @@ void ChromLinkMatrix::OrientContigs(ContigOrdering &order) const {
   }
 } // End of OrientContigs
 
-// Initialize the matrix of data and allocate memory for it.
+// Initialize the matrix of data, with no links in it.
 void ChromLinkMatrix::InitMatrix() {
   assert(!_matrix_init);
   assert(_N_contigs > 0);
-  int N_bins = 2 * _N_contigs; // each contig gets 2 bins: one for each of its possible orientations
-  // Initialize the matrix of data.  If the matrices are big, the machine may run out of memory, so
-  // catch that error.
-  try {
-    _matrix = new vector<int> *[N_bins];
-    for (int i = 0; i < N_bins; i++) {
-      _matrix[i] = new vector<int>[N_bins];
-      for (int j = 0; j < N_bins; j++) {
-	_matrix[i][j].clear();
-      }
-    }
-  }
-  catch (std::bad_alloc &ba) {
-    cerr << "ERROR: Sorry, there's not enough memory to allocate for this ChromLinkMatrix!  Try running on a machine with more RAM.\nbad_alloc error message: " << ba.what() << endl;
-    exit(1);
-  }
+  _pair_ptr_data.assign(_N_contigs+1, 0);
+  _cell_ptr_data.assign(1, 0);
+  _cell_ptr32_data.assign(1, 0);
+  _pair_c2_data.clear();
+  _dists_data.clear();
+  _dist_codes_data.clear();
+  _pair_ptr = _pair_ptr_data.data();
+  _cell_ptr = _cell_ptr_data.data();
+  _cell_ptr32 = _cell_ptr32_data.data();
+  _pair_c2 = _pair_c2_data.data();
+  _dists = _dists_data.data();
+  _dist_codes = _dist_codes_data.data();
+  _mapped_file = NULL;
+  _new_links.clear();
+  _orient_LLs.clear();
   _matrix_init = true;
 } // End of InitMatrix
 
@@ -1723,10 +2919,199 @@ void ChromLinkMatrix::InitMatrix() {
 void ChromLinkMatrix::FreeMatrix() {
   assert(_matrix_init);
   _matrix_init = false;
-  for (int i = 0; i < 2 * _N_contigs; i++) {
-    delete[] _matrix[i];
+  vector<uint64_t>().swap(_pair_ptr_data);
+  vector<uint64_t>().swap(_cell_ptr_data);
+  vector<uint32_t>().swap(_cell_ptr32_data);
+  vector<int32_t>().swap(_pair_c2_data);
+  vector<int32_t>().swap(_dists_data);
+  vector<uint16_t>().swap(_dist_codes_data);
+  vector<NewLink>().swap(_new_links);
+  vector<double>().swap(_orient_LLs);
+  delete _mapped_file;
+  _mapped_file = NULL;
+}
+
+// FindPair: Return the index of the contig pair (contig1,contig2), with contig1 <= contig2, in the
+// compressed storage, or -1 if there are no links between them.
+int64_t ChromLinkMatrix::FindPair(const int contig1,
+                                  const int contig2) const {
+  const int32_t *begin = _pair_c2 + _pair_ptr[contig1];
+  const int32_t *end = _pair_c2 + _pair_ptr[contig1+1];
+  const int32_t *it = lower_bound(begin, end, contig2);
+  return (it != end && *it == contig2) ? it - _pair_c2 : -1;
+}
+
+// Links: Return the distances of the links in bin [2*contig1+rc1][2*contig2+rc2].
+LinkDistances ChromLinkMatrix::Links(const int contig1,
+                                     const bool rc1,
+                                     const int contig2,
+                                     const bool rc2) const {
+  assert(_new_links.empty()); // if this fails, CompileLinks() hasn't been called
+
+  // Only the pairs with contig1 <= contig2 are stored; the rest are their mirror images.
+  if (contig1 > contig2) {
+    return Links(contig2, !rc2, contig1, !rc1);
+  }
+  const int64_t p = FindPair(contig1, contig2);
+  if (p == -1) {
+    return LinkDistances();
   }
-  delete[] _matrix;
+  return Cell(p, 2*rc1 + rc2);
+}
+
+// Cell: Return the links of pair p in orientation k.
+LinkDistances ChromLinkMatrix::Cell(const int64_t p,
+                                    const int k) const {
+  const uint64_t begin = CellPtr(4*p+k), end = CellPtr(4*p+k+1);
+  if (_compact) {
+    return LinkDistances(_dist_codes + begin, _dist_codes + end);
+  }
+  return LinkDistances(_dists + begin, _dists + end);
+}
+
+/*******************************************************************************
+ * CompileLinks: Add the links in _new_links into the compressed storage.  The new links are
+ * bucketed by pair with a stable sort, so each bin ends up with its existing links followed by its
+ * new links, in the order in which they were added - exactly as if they had been appended to the
+ * bin one by one.  In a compact CLM, the new links' distances are coded as they're added.
+ ******************************************************************************/
+void ChromLinkMatrix::CompileLinks() {
+  assert(_matrix_init);
+  if (_new_links.empty()) {
+    return;
+  }
+
+  // Bucket the new links by c1 (a stable counting sort), then sort each bucket by c2.
+  vector<uint64_t> bucket_ptr(_N_contigs+1, 0);
+  for (size_t i = 0; i < _new_links.size(); i++) {
+    bucket_ptr[ _new_links[i].c1 + 1 ]++;
+  }
+  for (int c1 = 0; c1 < _N_contigs; c1++) {
+    bucket_ptr[c1+1] += bucket_ptr[c1];
+  }
+  vector<NewLink> sorted(_new_links.size());
+  {
+    vector<uint64_t> fill(bucket_ptr.begin(), bucket_ptr.end() - 1);
+    for (size_t i = 0; i < _new_links.size(); i++) {
+      sorted[ fill[ _new_links[i].c1 ]++ ] = _new_links[i];
+    }
+  }
+  vector<NewLink>().swap(_new_links); // free memory
+  for (int c1 = 0; c1 < _N_contigs; c1++) {
+    stable_sort(sorted.begin() + bucket_ptr[c1], sorted.begin() + bucket_ptr[c1+1],
+                [](const NewLink &a, const NewLink &b) { return a.c2 < b.c2; });
+  }
+
+  // Merge the existing pairs with the new ones, contig by contig.
+  vector<uint64_t> pair_ptr(1, 0), cell_ptr(1, 0);
+  vector<int32_t> pair_c2, dists;
+  vector<uint16_t> codes;
+  if (_compact) {
+    codes.reserve(CellPtr(4*_pair_ptr[_N_contigs]) + 4 * sorted.size());
+  } else {
+    dists.reserve(CellPtr(4*_pair_ptr[_N_contigs]) + 4 * sorted.size());
+  }
+  for (int c1 = 0; c1 < _N_contigs; c1++) {
+    uint64_t p = _pair_ptr[c1], q = bucket_ptr[c1];
+    while (p < _pair_ptr[c1+1] || q < bucket_ptr[c1+1]) {
+      const bool has_old = p < _pair_ptr[c1+1];
+      const bool has_new = q < bucket_ptr[c1+1];
+      const int c2 = !has_new ? _pair_c2[p] : !has_old ? sorted[q].c2 : min(_pair_c2[p], sorted[q].c2);
+      const bool use_old = has_old && _pair_c2[p] == c2;
+      uint64_t q_stop = q;
+      while (q_stop < bucket_ptr[c1+1] && sorted[q_stop].c2 == c2) {
+        q_stop++;
+      }
+
+      for (int k = 0; k < 4; k++) {
+        if (_compact) {
+          if (use_old) {
+            codes.insert(codes.end(), _dist_codes + CellPtr(4*p+k), _dist_codes + CellPtr(4*p+k+1));
+          }
+          for (uint64_t i = q; i < q_stop; i++) {
+            if (sorted[i].dists[k] != -1) {
+              codes.push_back(EncodeLinkDist(sorted[i].dists[k]));
+            }
+          }
+          cell_ptr.push_back(codes.size());
+          continue;
+        }
+        if (use_old) {
+          dists.insert(dists.end(), _dists + _cell_ptr[4*p+k], _dists + _cell_ptr[4*p+k+1]);
+        }
+        for (uint64_t i = q; i < q_stop; i++) {
+          if (sorted[i].dists[k] != -1) {
+            dists.push_back(sorted[i].dists[k]);
+          }
+        }
+        cell_ptr.push_back(dists.size());
+      }
+      pair_c2.push_back(c2);
+      if (use_old) {
+        p++;
+      }
+      q = q_stop;
+    }
+    pair_ptr.push_back(pair_c2.size());
+  }
+
+  // Replace the old storage (which may have been a mapped file).
+  if (_compact) {
+    _cell_ptr32_data = CompactCellPtrs(cell_ptr.data(), cell_ptr.size());
+    vector<uint64_t>(1, 0).swap(cell_ptr);
+  }
+  _pair_ptr_data.swap(pair_ptr);
+  _cell_ptr_data.swap(cell_ptr);
+  _pair_c2_data.swap(pair_c2);
+  _dists_data.swap(dists);
+  _dist_codes_data.swap(codes);
+  _pair_ptr = _pair_ptr_data.data();
+  _cell_ptr = _cell_ptr_data.data();
+  _cell_ptr32 = _cell_ptr32_data.data();
+  _pair_c2 = _pair_c2_data.data();
+  _dists = _dists_data.data();
+  _dist_codes = _dist_codes_data.data();
+  delete _mapped_file;
+  _mapped_file = NULL;
+  _orient_LLs.clear(); // the matrix has changed
+} // End of CompileLinks
+
+// SetCompactDists: Switch the distances between 32-bit ints and 16-bit codes, and the cell pointers
+// between 64 and 32 bits.  The other arrays stay where they are, even if that's in _mapped_file.
+void ChromLinkMatrix::SetCompactDists(const bool compact) {
+  assert(_matrix_init);
+  assert(_new_links.empty()); // if this fails, CompileLinks() hasn't been called
+  if (compact == _compact) {
+    return;
+  }
+
+  const uint64_t N_cell_ptrs = 4*_pair_ptr[_N_contigs] + 1;
+  const uint64_t N_dists = CellPtr(N_cell_ptrs - 1);
+  if (compact) {
+    _cell_ptr32_data = CompactCellPtrs(_cell_ptr, N_cell_ptrs);
+    vector<uint64_t>().swap(_cell_ptr_data);
+    vector<uint16_t> codes(N_dists);
+    for (uint64_t i = 0; i < N_dists; i++) {
+      codes[i] = EncodeLinkDist(_dists[i]);
+    }
+    _dist_codes_data.swap(codes);
+    vector<int32_t>().swap(_dists_data);
+  } else {
+    _cell_ptr_data.assign(_cell_ptr32, _cell_ptr32 + N_cell_ptrs);
+    vector<uint32_t>().swap(_cell_ptr32_data);
+    vector<int32_t> dists(N_dists);
+    for (uint64_t i = 0; i < N_dists; i++) {
+      dists[i] = DecodeLinkDist(_dist_codes[i]);
+    }
+    _dists_data.swap(dists);
+    vector<uint16_t>().swap(_dist_codes_data);
+  }
+  _cell_ptr = _cell_ptr_data.data();
+  _cell_ptr32 = _cell_ptr32_data.data();
+  _dists = _dists_data.data();
+  _dist_codes = _dist_codes_data.data();
+  _compact = compact;
+  _orient_LLs.clear(); // the distances have changed
 }
 
 // LoadRESitesFile: Fill _contig_RE_sites.
@@ -1760,6 +3145,16 @@ void ChromLinkMatrix::AddLinkToMatrix(const int contig1,
                                       const int read1_dist2,
                                       const int read2_dist1,
                                       const int read2_dist2 ) {
+  _new_links.push_back(MakeLink(contig1, contig2, read1_dist1, read1_dist2, read2_dist1, read2_dist2));
+}
+
+// MakeLink: Make the NewLink record for AddLinkToMatrix().
+ChromLinkMatrix::NewLink ChromLinkMatrix::MakeLink(const int contig1,
+                                                   const int contig2,
+                                                   const int read1_dist1,
+                                                   const int read1_dist2,
+                                                   const int read2_dist1,
+                                                   const int read2_dist2) {
   // Set a minimum offset.  This prevents distances from being equal to 0, which is good because
   // that leads to division-by-0 errors in OrderingScore().  To be pedantically accurate, we would
   // want to set OFFSET to twice the read length, but the read length currently isn't tracked.
@@ -1785,15 +3180,30 @@ void ChromLinkMatrix::AddLinkToMatrix(const int contig1,
 
   // Record all four distances in the 2-D matrix object for this ChromLinkMatrix.
   // The conversion from contig ID to bin ID is: bin ID = 2 * contig ID + (1 if rc)
-  // Note that the matrix is filled in a symmetric fashion, and should always remain symmetric.
-  _matrix[2*contig1][2*contig2].push_back(dist_fw_fw);
-  _matrix[2*contig1][2*contig2+1].push_back(dist_fw_rc);
-  _matrix[2*contig1+1][2*contig2].push_back(dist_rc_fw);
-  _matrix[2*contig1+1][2*contig2+1].push_back(dist_rc_rc);
-  _matrix[2*contig2+1][2*contig1+1].push_back(dist_fw_fw);
-  _matrix[2*contig2][2*contig1+1].push_back(dist_fw_rc);
-  _matrix[2*contig2+1][2*contig1].push_back(dist_rc_fw);
-  _matrix[2*contig2][2*contig1].push_back(dist_rc_rc);
+  // Note that the matrix is symmetric: bin [2*contig2+rc2][2*contig1+rc1] is the same as bin
+  // [2*contig1+(1-rc1)][2*contig2+(1-rc2)].  So the link is only stored under the pair with the
+  // lower contig ID first, in orientation k = 2*rc1 + rc2.
+  assert(contig1 != contig2);
+  if (contig1 < contig2) {
+    const NewLink link = { contig1, contig2, { dist_fw_fw, dist_fw_rc, dist_rc_fw, dist_rc_rc } };
+    return link;
+  } else {
+    const NewLink link = { contig2, contig1, { dist_rc_rc, dist_fw_rc, dist_rc_fw, dist_fw_fw } };
+    return link;
+  }
+}
+
+// AddIntraContigLink: Add a link within one contig, in bin [2*contig][2*contig].
+void ChromLinkMatrix::AddIntraContigLink(const int contig,
+                                         const int dist) {
+  _new_links.push_back(MakeIntraContigLink(contig, dist));
+}
+
+// MakeIntraContigLink: Make the NewLink record for AddIntraContigLink().
+ChromLinkMatrix::NewLink ChromLinkMatrix::MakeIntraContigLink(const int contig,
+                                                              const int dist) {
+  const NewLink link = { contig, contig, { dist, -1, -1, -1 } };
+  return link;
 }
 
 // CalculateRepeatFactors: Fill the _repeat_factors vector.  This vector contains the 'factor', or
@@ -1818,9 +3228,9 @@ void ChromLinkMatrix::CalculateRepeatFactors() {
 
   for (int i = 0; i < _N_contigs; i++) {
     for (int j = 0; j < _N_contigs; j++) {
-      if (!_matrix[2*i][2*j].empty()) {
+      if (NLinks(i, j) != 0) {
 	// TODO(nburton@washington.edu): there's a floating point exception in here somewhere
-	int64_t N_links_norm = _matrix[2*i][2*j].size();
+	int64_t N_links_norm = NLinks(i, j);
 	N_links_norm = N_links_norm *
           (_most_contig_REs / _contig_RE_sites[i]) *
           (_most_contig_REs / _contig_RE_sites[j]); // normalize
@@ -1854,7 +3264,7 @@ void ChromLinkMatrix::CalculateRepeatFactors() {
  ******************************************************************************/
 double ChromLinkMatrix::LinkDensity(const int contig1,
                                     const int contig2) const {
-  double N_links = _matrix[ 2*contig1 ][ 2*contig2 ].size();
+  double N_links = NLinks(contig1, contig2);
   if (!DeNovo()) {
     return N_links;
   }
@@ -1908,12 +3318,15 @@ void ChromLinkMatrix::PlotTree(const vector< vector<int> > &tree,
  * FindGapSize(): Helper function for SpaceContigs().  Finds the best estimate of the gap size
  * following contig #pos in the ContigOrdering.  Uses not just the links between contigs #pos and
  * #pos+1, but also other links between more distant contigs if their gaps have already been
- * estimated.
+ * estimated.  The candidate gap sizes are searched from coarse to fine (see below), and the
+ * log-likelihoods are found with gap_likelihood, which caches the expected links across calls.
  ******************************************************************************/
 int ChromLinkMatrix::FindGapSize(const ContigOrdering &order,
                                  const int pos,
-                                 const LinkSizeDistribution &lsd,
-                                 const vector<double> &enrichments) const {
+                                 GapLikelihood &gap_likelihood,
+                                 const vector<double> &enrichments,
+                                 const bool exhaustive,
+                                 double *best_score) const {
   cout << "FindGapSize" << endl;
   assert(pos >= 0);
   assert(pos+1 < order.N_contigs_used());
@@ -1992,7 +3405,7 @@ int ChromLinkMatrix::FindGapSize(const ContigOrdering &order,
   int max_N_links = 0;
   for (int i = s1_start; i <= pos; i++) {
     for (int j = pos+1; j <= s2_stop; j++) {
-      int N_links = _matrix[2*order.contig_ID(i)][2*order.contig_ID(j)].size();
+      int N_links = NLinks(order.contig_ID(i), order.contig_ID(j));
       if (N_links > max_N_links) {
       max_N_links = N_links;
       }
@@ -2007,65 +3420,140 @@ int ChromLinkMatrix::FindGapSize(const ContigOrdering &order,
     log_factorial[j] = log_factorial[j-1] + log(j);
   }
 
-  // TEMP: Try an exhaustive search first.  It's slow but will find a good answer.  Once this works,
-  // we'll implement the more complicated but faster binary-search method in
-  // LinkSizeDistribution::FindDistanceBetweenLinks().
-  for (int D = 0; D < MAX_DIST; D += D_step) {
-    // We are contemplating a gap size of D between contig #pos and contig #pos+1.  We must
-    // calculate the total log-likelihood of this gap size based on all available information -
-    // i.e., the various contigs in the scaffolds-in-progress  being merged.  Hence we must find the
-    // log-likelihoods of all pairwise link distributions between contigs in the first and second
-    // scaffold-in-progress.
+  // Set up the links between each pair of contigs once, rather than once for every value of D.
+  // Adjust them as necessary to take into account the extra distance between the contigs on their
+  // scaffolds, and sort them for the GapLikelihood.  Also find the local LDE (link density
+  // enrichment), which is a weighted product of the LDEs of each contig.
+  vector< vector< vector<int> > > pair_links(s1_size, vector< vector<int> >(s2_size));
+  vector< vector<double> > local_LDEs(s1_size, vector<double>(s2_size, 0));
+  for (int i = 0; i < s1_size; i++) {
+    for (int j = 0; j < s2_size; j++) {
+      int contig1 = order.contig_ID(pos - i);
+      int contig2 = order.contig_ID(pos + 1 + j);
+      const int & L1 = _contig_lengths[contig1];
+      const int & L2 = _contig_lengths[contig2];
+      const LinkDistances adjacent_links = Links(contig1, order.contig_rc(pos - i), contig2, order.contig_rc(pos + 1 + j));
+      vector<int> &links = pair_links[i][j];
+      links.assign(adjacent_links.begin(), adjacent_links.end());
+      for (size_t k = 0; k < links.size(); k++) {
+        if (links[k] + extra_dists[i][j] < 0) {
+          links[k] = INT_MAX; // prevent integer overflow
+        } else {
+          links[k] += extra_dists[i][j];
+        }
+      }
+      sort(links.begin(), links.end());
+      local_LDEs[i][j] = pow(enrichments[contig1], double(2*L1)/(L1+L2)) * pow(enrichments[contig2], double(2*L2)/(L1+L2));
+    }
+  }
+
+  // Find the log-likelihood of a gap size of D between contig #pos and contig #pos+1.  We must
+  // calculate the total log-likelihood of this gap size based on all available information - i.e.,
+  // the various contigs in the scaffolds-in-progress being merged.  Hence we must find the
+  // log-likelihoods of all pairwise link distributions between contigs in the first and second
+  // scaffold-in-progress.  Pairs of contigs that are far apart are skipped, since they could be
+  // confounded by genuine long-range interactions; however they must still count against this
+  // possible D-value, so they're given the worst log-likelihood that pair has at any D.
+  // The worst log-likelihoods are found once, over the coarse grid of D values (see below), before
+  // any D is scored.  So every D is scored against the same worsts, no matter which other D values
+  // have been evaluated, or in what order.  Each value of D is only evaluated once: the sum of its
+  // in-range contributions is kept in in_range_lls, and the penalty for the skipped pairs is added
+  // in score().
+  map<int, double> in_range_lls;
+  bool worsts_done = false;
+  auto evaluate = [&](const int D) {
+    if (D < 0 || D >= MAX_DIST || in_range_lls.count(D)) {
+      return;
+    }
     double log_likelihood = 0;
     for (int i = 0; i < s1_size; i++) {
       for (int j = 0; j < s2_size; j++) {
-	// Skip cases where contigs are far apart; these could be confounded by genuine long-range
-	// interactions. However they must still count against this possible D-value in the log
-	// likelihood score.
 	if (D + extra_dists[i][j] > MAX_DIST) {
-	  log_likelihood += worsts[i][j];
 	  continue;
 	}
-        int pos1 = pos - i;
-	int pos2 = pos + 1 + j;
-	int contig1 = order.contig_ID(pos1);
-	int rc1 = order.contig_rc(pos1);
-	int contig2 = order.contig_ID(pos2);
-	int rc2 = order.contig_rc(pos2);
-	const int & L1 = _contig_lengths[contig1];
-	const int & L2 = _contig_lengths[contig2];
-	// Find the links between these two contigs.  Adjust them as necessary to take them account
-	// the extra distance between the contigs on their scaffolds.
-	vector<int> links = _matrix[ 2*contig1+rc1 ] [ 2*contig2+rc2 ];
-	for (size_t k = 0; k < links.size(); k++) {
-	  if (links[k] + extra_dists[i][j] < 0) {
-            links[k] = INT_MAX; // prevent integer overflow
-          } else {
-            links[k] += extra_dists[i][j];
-          }
-        }
-	// Find the local LDE (link density enrichment).  It's a weighted product of the LDEs of
-	// each contig.
-	double local_LDE = pow(enrichments[contig1], double(2*L1)/(L1+L2)) * pow(enrichments[contig2], double(2*L2)/(L1*L2));
-
-	// Finally, find the log-likelihood contribution from this pair of contigs.
-	double this_ll = lsd.log_likelihood_D(D, L1, L2, local_LDE, links, log_factorial);
+	const int & L1 = _contig_lengths[order.contig_ID(pos - i)];
+	const int & L2 = _contig_lengths[order.contig_ID(pos + 1 + j)];
+	// Find the log-likelihood contribution from this pair of contigs.  The expected links for
+	// (L1,L2,D) are cached in gap_likelihood, so they needn't be recalculated in later calls.
+	double this_ll = gap_likelihood.log_likelihood_D(D, L1, L2, local_LDEs[i][j], pair_links[i][j], log_factorial);
 	// PRINT4( D, i, j, this_ll );
-	if (this_ll < worsts[i][j]) {
+	if (!worsts_done && this_ll < worsts[i][j]) {
           worsts[i][j] = this_ll;
         }
 	log_likelihood += this_ll;
       } // End for loop of j
     } // End for loop of i
+    in_range_lls[D] = log_likelihood;
+  };
+  auto score = [&](const int D) {
+    double log_likelihood = in_range_lls[D];
+    for (int i = 0; i < s1_size; i++) {
+      for (int j = 0; j < s2_size; j++) {
+	if (D + extra_dists[i][j] > MAX_DIST) {
+	  log_likelihood += worsts[i][j];
+	}
+      }
+    }
+    return log_likelihood;
+  };
+
+  // Search for the best D, from coarse to fine.  An exhaustive search over every D_step is too slow
+  // for large groups.  The log-likelihood isn't smooth in D (it has noise with a periodicity
+  // associated with bin size), so we can't just follow the slope from a starting point: in tests
+  // against the exhaustive search (see TestLachesis.cc), a hill-climb with halving steps from a
+  // 64-kb grid missed the best D about 40% of the time, and an 8-kb grid with 16 starts about 4%
+  // of the time.  Instead:
+  // 1. Evaluate D at every coarse_step, and find the worsts.
+  // 2. Around each of the N_starts best coarse values of D, evaluate every D within coarse_step.
+  // This evaluates about a fifth as many values of D as the exhaustive search.  If exhaustive =
+  // true, skip step 2 and evaluate D at every D_step instead (for testing.)
+  const int coarse_step = 8 * D_step; // HEUR
+  const size_t N_starts = 64; // HEUR
+  for (int D = 0; D < MAX_DIST; D += coarse_step) {
+    evaluate(D);
+  }
+  worsts_done = true;
+  map<int, double> log_likelihoods;
+  for (map<int, double>::const_iterator it = in_range_lls.begin(); it != in_range_lls.end(); ++it) {
+    log_likelihoods[it->first] = score(it->first);
+  }
+  auto evaluate_and_score = [&](const int D) {
+    if (D < 0 || D >= MAX_DIST || log_likelihoods.count(D)) {
+      return;
+    }
+    evaluate(D);
+    log_likelihoods[D] = score(D);
+  };
 
-    PRINT2( D, log_likelihood );
-    // Record the value of D that gives the best log-likelihood.
-    if (log_likelihood > best_log_likelihood) {
-      best_log_likelihood = log_likelihood;
-      best_D = D;
+  if (exhaustive) {
+    for (int D = 0; D < MAX_DIST; D += D_step) {
+      evaluate_and_score(D);
+    }
+  } else {
+    vector< pair<double, int> > starts;
+    for (map<int, double>::const_iterator it = log_likelihoods.begin(); it != log_likelihoods.end(); ++it) {
+      starts.push_back(make_pair(-it->second, it->first));
+    }
+    sort(starts.begin(), starts.end());
+    for (size_t s = 0; s < N_starts && s < starts.size(); s++) {
+      for (int D = starts[s].second - coarse_step; D <= starts[s].second + coarse_step; D += D_step) {
+        evaluate_and_score(D);
+      }
     }
-  }  // End the outer for loop before i
+  }
+
+  // Record the value of D that gives the best log-likelihood.
+  for (map<int, double>::const_iterator it = log_likelihoods.begin(); it != log_likelihoods.end(); ++it) {
+    PRINT2( it->first, it->second );
+    if (it->second > best_log_likelihood) {
+      best_log_likelihood = it->second;
+      best_D = it->first;
+    }
+  }
   PRINT2(best_D, best_log_likelihood);
+  if (best_score != NULL) {
+    *best_score = best_log_likelihood;
+  }
   return best_D;
 } // End of FindGapSize
 
@@ -2101,86 +3589,74 @@ void LoadDeNovoCLMsFromSAM(const string &SAM_file,
                            const string &RE_sites_file,
                            const ClusterVec &clusters,
                            vector<ChromLinkMatrix *> CLMs) {
-  assert(CLMs.size() == clusters.size());
-  int N_clusters = clusters.size();
-  bool verbose = true;
-  // Find the lengths of all of the de novo contigs.  This tells us how many de novo contigs there
-  // are in the total dataset.
-  vector<int> contig_lengths_orig = TargetLengths(SAM_file);
-  vector<int> contig_RE_sites_orig = ParseTabDelimFile<int>(RE_sites_file, 1);
-  int N_contigs_total = contig_lengths_orig.size();
-  // For each ChromLinkMatrix that we're actually creating, make a lookup table of the lengths and
-  // number of RE sites in the contigs in this cluster.
-  vector<int> used;
-  for (int i = 0; i < N_clusters; i++) {
-    if (CLMs[i] == NULL) {
-      continue;
-    }
-    used.push_back(i);
-    CLMs[i]->_contig_lengths.clear();
-    CLMs[i]->_contig_RE_sites.clear();
-    for (set<int>::const_iterator it = clusters[i].begin(); it != clusters[i].end(); ++it) {
-      // cout << "cluster #" << i << ", contig global#" << *it << ": length = " << contig_lengths_orig[*it] << endl;
-      CLMs[i]->_contig_lengths.push_back(contig_lengths_orig[*it]);
-      CLMs[i]->_contig_RE_sites.push_back(contig_RE_sites_orig[*it] );
-    }
-    CLMs[i]->FindLongestContig();
-    CLMs[i]->_SAM_files.push_back(SAM_file); // keep track of which SAM files were used to generate this matrix
-  }
+  LoadDeNovoCLMsFromSAM(vector<string>(1, SAM_file), RE_sites_file, clusters, CLMs, 1);
+}
 
-  cout << "Filling "
-       << ( used.size() == 1 ? "cluster " + boost::lexical_cast<string>(used[0]) : boost::lexical_cast<string>(used.size()) + " clusters")
-       << " with Hi-C data from SAM file " << SAM_file
-       << (verbose ? "\t(dot = 1M alignments)" : "") << endl;
+// CLMLink: A Hi-C link between two contigs in the same cluster, as found in a SAM file by
+// ReadCLMLinksFromSAM.  The contig IDs are global IDs (i.e., SAM target IDs).
+struct CLMLink {
+  int32_t tid1, pos1, tid2, pos2;
+};
+
+static void ReadCLMLinksFromIndexedBAM(const string &SAM_file,
+                                       const double subsample_fraction,
+                                       const vector<int> &cluster_IDs,
+                                       const vector<ChromLinkMatrix *> &CLMs,
+                                       const string &cluster_desc,
+                                       vector<CLMLink> &links,
+                                       const size_t spill_batch,
+                                       const function<void(vector<CLMLink> &)> &spill,
+                                       const int N_threads,
+                                       ostream &log);
 
-  // Convert the clusters vector into two lookup tables, which map contig IDs to cluster IDs, and
-  // also onto "local" contig indices for the cluster.  For example, if there are 8 contigs in two
-  // clusters: {0,2,5,6} and {1,3,7}, then the cluster_IDs table will look like this:
-  // [ 0, 1, 0, 1, -1, 0, 0, 1 ].
-  // The local_cIDs lookup table will look like this for cluster #0:
-  // [0, -1, 1, -1, -1, 2, 3, -1] and like this for cluster #1:
-  // [-1, 0, -1, 1, -1, -1, -1, 2].
-  vector<int> cluster_IDs(N_contigs_total, -1);
-  vector<int>  local_cIDs(N_contigs_total, -1);
-  vector<int> ID(N_clusters, 0);
-  for (int i = 0; i < N_clusters; i++) {
-    for (set<int>::const_iterator it = clusters[i].begin(); it != clusters[i].end(); ++it) {
-      cluster_IDs[*it] = i;
-      local_cIDs [*it] = ID[i]++;
-    }
+/*******************************************************************************
+ * ReadCLMLinksFromSAM: Helper function for LoadDeNovoCLMsFromSAM.  Read through one SAM/BAM file and
+ * find all of the read pairs that will go into one of the non-NULL CLMs.  Append them to links, in
+ * the order they appear in the file.  This function doesn't modify the CLMs, so it can be run on
+ * several SAM files at once in different threads.  If spill_batch > 0, pass links to spill() (which
+ * should empty it) whenever it reaches spill_batch links, and at the end, so that it never holds
+ * more than spill_batch links.  If the file is a BAM file with an index, only the CLMs' contigs are
+ * read, with up to N_threads threads; see ReadCLMLinksFromIndexedBAM.  If subsample_fraction < 1,
+ * only that fraction of the read pairs is used (see SAMStepper::FilterSubsample).
+ ******************************************************************************/
+static void ReadCLMLinksFromSAM(const string &SAM_file,
+                                const double subsample_fraction,
+                                const vector<int> &cluster_IDs,
+                                const vector<ChromLinkMatrix *> &CLMs,
+                                const string &cluster_desc,
+                                vector<CLMLink> &links,
+                                const size_t spill_batch,
+                                const function<void(vector<CLMLink> &)> &spill,
+                                const int N_threads,
+                                ostream &log) {
+  // An indexed BAM file is coordinate-sorted, so next_pair() can't be used on it.  But it can be
+  // read one cluster at a time.
+  if (HasBAMIndex(SAM_file)) {
+    ReadCLMLinksFromIndexedBAM(SAM_file, subsample_fraction, cluster_IDs, CLMs, cluster_desc, links, spill_batch, spill, N_threads, log);
+    return;
   }
 
-  /*******************************
-  for ( int i = 0; i < N_contigs_total; i++ )
-    PRINT3( i, cluster_IDs[i], local_cIDs[i] );
-  for ( int i = 0; i < N_clusters; i++ )
-    PRINT2( i, ID[i] );
-  for ( int i = 0; i < N_clusters; i++ )
-    PRINT( CLMs[i] );
-  *********************************/
-  int N_pairs_used = 0;
-  // Set up a SAMStepper object to read in the alignments.
-  SAMStepper stepper(SAM_file);
-  stepper.FilterAlignedPairs(); // Only look at read pairs where both reads aligned to the assembly.
-  // Loop over all pairs of alignments in the SAM file.
-  // Note that the next_pair() function assumes that all reads in a SAM file are paired, and the two
-  // reads in a pair occur in consecutive order.
-  for (pair <bam1_t *, bam1_t *> aligns = stepper.next_pair(); aligns.first != NULL; aligns = stepper.next_pair()) {
-    if (verbose && stepper.N_aligns_read() % 1000000 == 0) {
-      cout << "." << flush;
-    }
-    const bam1_core_t & c1 = aligns.first->core;
-    const bam1_core_t & c2 = aligns.second->core;
+  bool verbose = true;
+  int N_contigs_total = cluster_IDs.size();
+
+  log << "Filling " << cluster_desc << " with Hi-C data from SAM file " << SAM_file
+      << (verbose ? "\t(dot = 1M alignments)" : "") << endl;
+
+  // The fields of an alignment that are used here.
+  struct Align {
+    int32_t tid, pos, mtid, mpos, qual;
+  };
+
+  // Add the link from a pair of reads, if it's usable.
+  auto add_pair = [&](const Align &c1, const Align &c2) {
     // Ignore reads with mapping quality 0.  (In the GSM862723 dataset this is roughly 4% of reads.)
     if (c1.qual == 0 || c2.qual == 0) {
-      continue;
+      return;
     }
 
     // Sanity checks to make sure the read pairs appear as they should in the SAM file.  If one of
     // these asserts fails, there is an internal inconsistency in the SAM file.  Maybe the file is
     // truncated or it has an incorrect header?
-
-    // cout << stepper.as_SAM_line(aligns.first) << endl << stepper.as_SAM_line(aligns.second) << endl << endl;
     assert(c1.tid == c2.mtid);
     assert(c2.tid == c1.mtid);
     assert(c1.pos == c2.mpos);
@@ -2193,6 +3669,216 @@ void LoadDeNovoCLMsFromSAM(const string &SAM_file,
     // non-NULL ones that we're building.
     int cluster = cluster_IDs[c1.tid];
     int cluster2 = cluster_IDs[c2.tid];
+    if (cluster == -1) {
+      return;
+    }
+    if (cluster != cluster2) {
+      return;
+    }
+    if (CLMs[cluster] == NULL) {
+      return;
+    }
+
+    CLMLink link = { c1.tid, c1.pos, c2.tid, c2.pos };
+    links.push_back(link);
+    if (spill_batch > 0 && links.size() >= spill_batch) {
+      spill(links);
+    }
+  };
+
+  // Set up a SAMStepper object to read in the alignments.
+  SAMStepper stepper(SAM_file);
+  stepper.FilterAlignedPairs(); // Only look at read pairs where both reads aligned to the assembly.
+  stepper.FilterSubsample(subsample_fraction);
+  // Loop over all pairs of alignments in the SAM file, a batch of alignments at a time.  Each read
+  // is held back until we know whether the next read is its pair, as in next_pair().  This assumes
+  // that all reads in a SAM file are paired, and the two reads in a pair occur in consecutive order.
+  SAMBatch aligns;
+  Align prev = { -1, -1, -1, -1, 0 };
+  bool have_prev = false;
+  int64_t N_aligns_before = 0;
+  while (stepper.next_batch(aligns)) {
+    for (size_t j = 0; j < aligns.size(); j++) {
+      if (verbose && (N_aligns_before + j + 1) % 1000000 == 0) {
+        log << "." << flush;
+      }
+      const Align align = { aligns.tid[j], aligns.pos[j], aligns.mtid[j], aligns.mpos[j], aligns.qual[j] };
+      if (have_prev && aligns.pairs_with_prev[j]) {
+        add_pair(prev, align);
+        have_prev = false;
+      } else {
+        prev = align;
+        have_prev = true;
+      }
+    }
+    N_aligns_before += aligns.size();
+  }
+  if (spill_batch > 0) {
+    spill(links);
+  }
+
+  if (verbose) {
+    log << endl;
+  }
+}
+
+/*******************************************************************************
+ * ReadCLMLinksFromIndexedBAM: Like ReadCLMLinksFromSAM, but for a BAM file with a BAI index.  Only
+ * the alignments on the contigs of the non-NULL CLMs' clusters are read, via the index.  The file
+ * is coordinate-sorted, so the two reads of a pair are matched up by name.  The clusters are split
+ * among up to N_threads threads, each with its own SAMStepper: both reads of a useful pair are in
+ * the same cluster, so each thread can match up the reads it sees by itself.  The threads' links
+ * (which are in different clusters, so their order relative to each other doesn't matter) are
+ * appended to links.  If spill_batch > 0, each thread calls spill() on its own batches.
+ ******************************************************************************/
+static void ReadCLMLinksFromIndexedBAM(const string &SAM_file,
+                                       const double subsample_fraction,
+                                       const vector<int> &cluster_IDs,
+                                       const vector<ChromLinkMatrix *> &CLMs,
+                                       const string &cluster_desc,
+                                       vector<CLMLink> &links,
+                                       const size_t spill_batch,
+                                       const function<void(vector<CLMLink> &)> &spill,
+                                       const int N_threads,
+                                       ostream &log) {
+  int N_contigs_total = cluster_IDs.size();
+
+  // Find the contigs in each of the clusters that we're building.
+  map< int, vector<int> > contigs_by_cluster;
+  for (int tid = 0; tid < N_contigs_total; tid++) {
+    if (cluster_IDs[tid] != -1 && CLMs[cluster_IDs[tid]] != NULL) {
+      contigs_by_cluster[cluster_IDs[tid]].push_back(tid);
+    }
+  }
+  vector< vector<int> > cluster_contigs;
+  for (map< int, vector<int> >::const_iterator it = contigs_by_cluster.begin(); it != contigs_by_cluster.end(); ++it) {
+    cluster_contigs.push_back(it->second);
+  }
+
+  const int N_ranges = max(1, min(NThreadsToUse(N_threads), int(cluster_contigs.size())));
+  log << "Filling " << cluster_desc << " with Hi-C data from indexed BAM file " << SAM_file << ", reading "
+      << cluster_contigs.size() << " clusters' contigs with " << N_ranges << " threads" << endl;
+
+  // A read whose mate hasn't been seen yet.
+  struct Mate {
+    int32_t tid, pos, mtid, mpos, qual;
+  };
+
+  vector< vector<CLMLink> > range_links(N_ranges);
+  vector<int64_t> N_unmatched(N_ranges, 0);
+  ParallelForRanges(cluster_contigs.size(), N_ranges, [&](const int r, const size_t begin, const size_t end) {
+      unordered_map<string, Mate> mates;
+      for (size_t j = begin; j < end; j++) {
+        SAMStepper stepper(SAM_file);
+        stepper.FilterAlignedPairs(); // Only look at read pairs where both reads aligned to the assembly.
+        stepper.FilterSubsample(subsample_fraction);
+        stepper.FilterRegions(cluster_contigs[j]);
+        assert(stepper.Indexed());
+
+        for (bam1_t *align = stepper.next_read(); align != NULL; align = stepper.next_read()) {
+          const bam1_core_t &c = align->core;
+          // Skip secondary and supplementary alignments, and reads whose mates aren't in this
+          // cluster, because they can't make a link.
+          if (c.flag & 0x900) {
+            continue;
+          }
+          if (c.mtid < 0 || c.mtid >= N_contigs_total || cluster_IDs[c.mtid] != cluster_IDs[c.tid]) {
+            continue;
+          }
+
+          // Find this read's mate, by name (ignoring a "/1" or "/2" suffix, as ReadNamesMatch()
+          // does).  If it hasn't been seen yet, this read waits for it.
+          string name = bam1_qname(align);
+          if (name.size() > 2 && name[name.size()-2] == '/' && (name.back() == '1' || name.back() == '2')) {
+            name.resize(name.size() - 2);
+          }
+          unordered_map<string, Mate>::iterator it = mates.find(name);
+          if (it == mates.end()) {
+            const Mate mate = { c.tid, c.pos, c.mtid, c.mpos, int32_t(c.qual) };
+            mates[name] = mate;
+            continue;
+          }
+          const Mate mate = it->second;
+          mates.erase(it);
+
+          // The same sanity checks and filters as in ReadCLMLinksFromSAM.
+          assert(mate.tid == c.mtid);
+          assert(c.tid == mate.mtid);
+          assert(mate.pos == c.mpos);
+          assert(c.pos == mate.mpos);
+          if (mate.qual == 0 || c.qual == 0) {
+            continue;
+          }
+
+          CLMLink link = { mate.tid, mate.pos, c.tid, c.pos };
+          range_links[r].push_back(link);
+          if (spill_batch > 0 && range_links[r].size() >= spill_batch) {
+            spill(range_links[r]);
+          }
+        }
+
+        N_unmatched[r] += mates.size();
+        mates.clear();
+      }
+      if (spill_batch > 0) {
+        spill(range_links[r]);
+      }
+    });
+
+  int64_t N_unmatched_total = 0;
+  for (int r = 0; r < N_ranges; r++) {
+    links.insert(links.end(), range_links[r].begin(), range_links[r].end());
+    N_unmatched_total += N_unmatched[r];
+  }
+  if (N_unmatched_total > 0) {
+    log << "Skipped " << N_unmatched_total << " reads in " << SAM_file << " whose mates weren't found (or didn't pass the filters)" << endl;
+  }
+}
+
+/*******************************************************************************
+ * ReadCLMLinksFromLinkFile: Like ReadCLMLinksFromSAM, but reads the records for SAM file #i from a
+ * HiCLinkFile instead of reading the SAM file itself.  The same read pairs pass the same filters.
+ ******************************************************************************/
+static void ReadCLMLinksFromLinkFile(const HiCLinkFile &link_file,
+                                     const size_t i,
+                                     const vector<int> &cluster_IDs,
+                                     const vector<ChromLinkMatrix *> &CLMs,
+                                     const string &cluster_desc,
+                                     vector<CLMLink> &links,
+                                     const size_t spill_batch,
+                                     const function<void(vector<CLMLink> &)> &spill,
+                                     ostream &log) {
+  int N_contigs_total = cluster_IDs.size();
+
+  log << "Filling " << cluster_desc << " with Hi-C data for SAM file " << link_file.SAM_files()[i]
+      << " from link file " << link_file.file() << endl;
+
+  for (const HiCLink *link = link_file.begin(i); link != link_file.end(i); ++link) {
+    // Unpaired reads aren't used here; see SAMStepper::next_pair().
+    if (link->type == HIC_LINK_SINGLE) {
+      continue;
+    }
+
+    // A pair whose two records disagree is stored as two consecutive records.
+    if (link->type == HIC_LINK_BROKEN) {
+      const HiCLink *link2 = ++link;
+      assert(link2 != link_file.end(i) && link2->type == HIC_LINK_BROKEN);
+      // Ignore reads with mapping quality 0.  Otherwise, this is the same internal inconsistency
+      // in the SAM file that is caught by the sanity checks in ReadCLMLinksFromSAM.
+      assert(link[-1].qual == 0 || link2->qual == 0);
+      continue;
+    }
+
+    // Ignore reads with mapping quality 0.
+    if (link->qual == 0 || link->mqual == 0) {
+      continue;
+    }
+    assert(link->tid < N_contigs_total);
+    assert(link->mtid < N_contigs_total);
+
+    // Find which clusters the reads belong to, as in ReadCLMLinksFromSAM.
+    int cluster = cluster_IDs[link->tid];
+    int cluster2 = cluster_IDs[link->mtid];
     if (cluster == -1) {
       continue;
     }
@@ -2203,31 +3889,230 @@ void LoadDeNovoCLMsFromSAM(const string &SAM_file,
       continue;
     }
 
-    // If the two reads align to the exact same contig, the link isn't informative, so skip it.
-    if (c1.tid == c2.tid) { // TEMP: allow these links so LinkSizeDistribution can do its stuff
-      int dist = abs(c2.pos - c1.pos);
-      int x = 2*local_cIDs[c1.tid];
-      CLMs[cluster]->_matrix[x][x].push_back(dist);
+    CLMLink clm_link = { link->tid, link->pos, link->mtid, link->mpos };
+    links.push_back(clm_link);
+    if (spill_batch > 0 && links.size() >= spill_batch) {
+      spill(links);
+    }
+  }
+  if (spill_batch > 0) {
+    spill(links);
+  }
+}
+
+/*******************************************************************************
+ * The multi-SAM-file version reads the SAM files in parallel, using up to N_threads threads (see
+ * SAMIngest.h).  Each file's links are found in a worker thread, then added to the CLMs in file
+ * order, so the CLMs are exactly the same as if the files had been read one at a time.
+ ******************************************************************************/
+void LoadDeNovoCLMsFromSAM(const vector<string> &SAM_files,
+                           const string &RE_sites_file,
+                           const ClusterVec &clusters,
+                           vector<ChromLinkMatrix *> CLMs,
+                           const int N_threads,
+                           const double subsample_fraction) {
+  LoadDeNovoCLMs(SAM_files, NULL, RE_sites_file, clusters, CLMs, N_threads, vector<string>(), 0, subsample_fraction);
+}
+
+/*******************************************************************************
+ * LoadDeNovoCLMsFromLinks: Like LoadDeNovoCLMsFromSAM, but the links are read from a HiCLinkFile
+ * that was extracted from the SAM files.  The CLMs are exactly the same.
+ ******************************************************************************/
+void LoadDeNovoCLMsFromLinks(const HiCLinkFile &links,
+                             const string &RE_sites_file,
+                             const ClusterVec &clusters,
+                             vector<ChromLinkMatrix *> CLMs,
+                             const int N_threads) {
+  LoadDeNovoCLMs(links.SAM_files(), &links, RE_sites_file, clusters, CLMs, N_threads);
+}
+
+/*******************************************************************************
+ * WriteDeNovoCLMFilesFromLinks: Like LoadDeNovoCLMsFromLinks, but the links are spilled to disk
+ * and the CLM files are written from there, so that the links never all have to be in memory.
+ ******************************************************************************/
+void WriteDeNovoCLMFilesFromLinks(const HiCLinkFile &links,
+                                  const string &RE_sites_file,
+                                  const ClusterVec &clusters,
+                                  vector<ChromLinkMatrix *> CLMs,
+                                  const vector<string> &CLM_files,
+                                  const size_t memory_budget,
+                                  const int N_threads) {
+  assert(CLM_files.size() == CLMs.size());
+  LoadDeNovoCLMs(links.SAM_files(), &links, RE_sites_file, clusters, CLMs, N_threads, CLM_files, memory_budget);
+}
+
+/*******************************************************************************
+ * LoadDeNovoCLMs: The implementation of LoadDeNovoCLMsFromSAM and LoadDeNovoCLMsFromLinks.  If
+ * link_file is NULL, the links are read from the SAM files; otherwise they are read from link_file,
+ * which must have been made from the SAM files.  subsample_fraction only applies to the SAM files;
+ * a HiCLinkFile is subsampled when it's extracted.
+ *
+ * If CLM_files is non-empty, the links aren't added to the CLMs.  Instead, each worker thread turns
+ * its links into NewLink records as it finds them, in batches, and appends them to one spill file
+ * per SAM file and CLM (<CLM_file>.spill.<i>).  Then each CLM file is written from its spill files
+ * (see WriteSpilledBinaryFile), one CLM at a time.  The links in memory at any time are the
+ * threads' batches, plus the merge buffers for one CLM, which all fit in memory_budget.
+ ******************************************************************************/
+void LoadDeNovoCLMs(const vector<string> &SAM_files,
+                    const HiCLinkFile *link_file,
+                    const string &RE_sites_file,
+                    const ClusterVec &clusters,
+                    vector<ChromLinkMatrix *> CLMs,
+                    const int N_threads,
+                    const vector<string> &CLM_files,
+                    const size_t memory_budget,
+                    const double subsample_fraction) {
+  AssertFilesExist(SAM_files);
+  assert(CLMs.size() == clusters.size());
+  int N_clusters = clusters.size();
+  // Find the lengths of all of the de novo contigs.  This tells us how many de novo contigs there
+  // are in the total dataset.
+  vector<int> contig_lengths_orig = TargetLengths(SAM_files[0]);
+  vector<int> contig_RE_sites_orig = ParseTabDelimFile<int>(RE_sites_file, 1);
+  int N_contigs_total = contig_lengths_orig.size();
+  // For each ChromLinkMatrix that we're actually creating, make a lookup table of the lengths and
+  // number of RE sites in the contigs in this cluster.
+  // Convert the clusters vector into two lookup tables, which map contig IDs to cluster IDs, and
+  // also onto "local" contig indices for the cluster.  For example, if there are 8 contigs in two
+  // clusters: {0,2,5,6} and {1,3,7}, then the cluster_IDs table will look like this:
+  // [ 0, 1, 0, 1, -1, 0, 0, 1 ].
+  // The local_cIDs lookup table will look like this:
+  // [ 0, 0, 1, 1, -1, 2, 3, 2 ].
+  const ClusterIndex index(clusters, N_contigs_total);
+  const vector<int> &cluster_IDs = index.cluster_IDs();
+  const vector<int> &local_cIDs = index.local_IDs();
+
+  vector<int> used;
+  for (int i = 0; i < N_clusters; i++) {
+    if (CLMs[i] == NULL) {
       continue;
     }
+    used.push_back(i);
+    CLMs[i]->_contig_lengths.clear();
+    CLMs[i]->_contig_RE_sites.clear();
+    const ClusterIndex::Members members = index.members(i);
+    for (const int *it = members.begin(); it != members.end(); ++it) {
+      // cout << "cluster #" << i << ", contig global#" << *it << ": length = " << contig_lengths_orig[*it] << endl;
+      CLMs[i]->_contig_lengths.push_back(contig_lengths_orig[*it]);
+      CLMs[i]->_contig_RE_sites.push_back(contig_RE_sites_orig[*it] );
+    }
+    CLMs[i]->FindLongestContig();
+    // Set _most_contig_REs as ReadFile() would after reading back this CLM's files, so that the
+    // CLM can be used for ordering without being written and read back first.
+    if (!CLMs[i]->_contig_RE_sites.empty()) {
+      CLMs[i]->_most_contig_REs =
+        *max_element(CLMs[i]->_contig_RE_sites.begin(), CLMs[i]->_contig_RE_sites.end());
+    }
+  }
+
+  const string cluster_desc =
+    used.size() == 1 ? "cluster " + boost::lexical_cast<string>(used[0]) : boost::lexical_cast<string>(used.size()) + " clusters";
+
+  /*******************************
+  for ( int i = 0; i < N_contigs_total; i++ )
+    PRINT3( i, cluster_IDs[i], local_cIDs[i] );
+  for ( int i = 0; i < N_clusters; i++ )
+    PRINT2( i, index.cluster_size(i) );
+  for ( int i = 0; i < N_clusters; i++ )
+    PRINT( CLMs[i] );
+  *********************************/
+  vector< vector<CLMLink> > links(SAM_files.size());
+  const bool spill = !CLM_files.empty();
+  assert(!spill || CLM_files.size() == CLMs.size());
+
+  // Convert a link into the NewLink record for its cluster's CLM.
+  auto make_link = [&](const CLMLink &link) {
+    // If the two reads align to the exact same contig, the link isn't informative, so skip it.
+    if (link.tid1 == link.tid2) { // TEMP: allow these links so LinkSizeDistribution can do its stuff
+      int dist = abs(link.pos2 - link.pos1);
+      return ChromLinkMatrix::MakeIntraContigLink(local_cIDs[link.tid1], dist);
+    }
 
     // For each read, find the distance to either end of its contig.
-    int read1_dist1 = c1.pos;
-    int read2_dist1 = c2.pos;
-    int read1_dist2 = contig_lengths_orig[c1.tid] - c1.pos;
-    int read2_dist2 = contig_lengths_orig[c2.tid] - c2.pos;
+    int read1_dist1 = link.pos1;
+    int read2_dist1 = link.pos2;
+    int read1_dist2 = contig_lengths_orig[link.tid1] - link.pos1;
+    int read2_dist2 = contig_lengths_orig[link.tid2] - link.pos2;
     assert(read1_dist2 >= 0);
     assert(read2_dist2 >= 0);
+    return ChromLinkMatrix::MakeLink(local_cIDs[link.tid1], local_cIDs[link.tid2], read1_dist1, read1_dist2, read2_dist1, read2_dist2);
+  };
+
+  // In spill mode, each SAM file's links are appended to its spill files in batches, as they're
+  // found.  The batches of all the threads take at most about half of the memory budget.
+  auto spill_file = [&](const int cluster, const size_t i) {
+    return CLM_files[cluster] + ".spill." + boost::lexical_cast<string>(i);
+  };
+  const size_t spill_batch =
+    spill ? max(size_t(1) << 16, memory_budget / (2 * sizeof(CLMLink) * NThreadsToUse(N_threads))) : 0;
+
+  // Find each SAM file's links in a worker thread...
+  auto read_file = [&](const size_t i, ostream &log) {
+    function<void(vector<CLMLink> &)> spill_links;
+    if (spill) {
+      for (size_t j = 0; j < used.size(); j++) {
+        boost::filesystem::remove(spill_file(used[j], i)); // left over from an earlier run that failed
+      }
+      spill_links = [&, i](vector<CLMLink> &batch) {
+        // Group the batch by cluster, keeping the order in each cluster, and append to the files.
+        map< int, vector<ChromLinkMatrix::NewLink> > new_links;
+        for (size_t j = 0; j < batch.size(); j++) {
+          new_links[cluster_IDs[batch[j].tid1]].push_back(make_link(batch[j]));
+        }
+        for (map< int, vector<ChromLinkMatrix::NewLink> >::const_iterator it = new_links.begin(); it != new_links.end(); ++it) {
+          const string file = spill_file(it->first, i);
+          ofstream out(file.c_str(), ios::out | ios::binary | ios::app);
+          out.write(reinterpret_cast<const char *>(it->second.data()), it->second.size() * sizeof(ChromLinkMatrix::NewLink));
+          if (!out) {
+            cerr << "ERROR: LoadDeNovoCLMs: failed to write spill file '" << file << "'" << endl;
+            exit(1);
+          }
+        }
+        batch.clear();
+      };
+    }
 
-    // Add the link to the matrix object.
-    // cout << "Adding link to cluster #" << cluster << endl;
-    CLMs[cluster]->AddLinkToMatrix(local_cIDs[c1.tid], local_cIDs[c2.tid], read1_dist1, read1_dist2, read2_dist1, read2_dist2);
-    N_pairs_used++;
-  }
+    if (link_file != NULL) {
+      ReadCLMLinksFromLinkFile(*link_file, i, cluster_IDs, CLMs, cluster_desc, links[i], spill_batch, spill_links, log);
+    } else {
+      ReadCLMLinksFromSAM(SAM_files[i], subsample_fraction, cluster_IDs, CLMs, cluster_desc, links[i], spill_batch, spill_links,
+                          max(1, NThreadsToUse(N_threads) / int(SAM_files.size())), log);
+    }
+  };
 
-  if (verbose) {
-    cout << endl;
+  // ...then add them to the CLMs, in file order.
+  auto add_links = [&](const size_t i) {
+    for (size_t j = 0; j < used.size(); j++) {
+      CLMs[used[j]]->_SAM_files.push_back(SAM_files[i]); // keep track of which SAM files were used to generate this matrix
+    }
+
+    for (size_t j = 0; j < links[i].size(); j++) {
+      const CLMLink &link = links[i][j];
+      CLMs[cluster_IDs[link.tid1]]->_new_links.push_back(make_link(link));
+    }
+    vector<CLMLink>().swap(links[i]); // free memory
+  };
+
+  ForEachSAMFile(SAM_files, N_threads, read_file, add_links);
+
+  if (!spill) {
+    for (size_t j = 0; j < used.size(); j++) {
+      CLMs[used[j]]->CompileLinks();
+    }
+  } else {
+    for (size_t j = 0; j < used.size(); j++) {
+      vector<string> spill_files;
+      for (size_t i = 0; i < SAM_files.size(); i++) {
+        spill_files.push_back(spill_file(used[j], i));
+      }
+      CLMs[used[j]]->WriteSpilledBinaryFile(CLM_files[used[j]], spill_files, memory_budget);
+      CLMs[used[j]]->WriteAuxFiles(CLM_files[used[j]]);
+      for (size_t i = 0; i < spill_files.size(); i++) {
+        boost::filesystem::remove(spill_files[i]);
+      }
+    }
   }
+
   // for ( int i = 0; i < N_clusters; i++ ) {
   //   CLMs[i]->CalculateRepeatFactors();
   // }
@@ -2338,22 +4223,17 @@ void LoadNonDeNovoCLMsFromSAM(const string &SAM_file,
     cout << endl;
   }
   cout << "Done with " << SAM_file << "!  N aligns/pairs read: " << stepper.N_aligns_read() << "/" << stepper.N_pairs_read() << "; N pairs used: " << N_pairs_used << endl;
+  for (int chrID = 0; chrID < N_chroms; chrID++) {
+    if (CLMs[chrID]) {
+      CLMs[chrID]->CompileLinks();
+    }
+  }
   // for (int i = 0; i < N_chroms; i++) {
   //    CLMs[i]->CalculateRepeatFactors();
   // }
 }  // End of LoadNonDeNovo...
 
 // These multi-SAM-file functions are wrappers for their respective one-SAM-file functions.
-void LoadDeNovoCLMsFromSAM(const vector<string> &SAM_files,
-                           const string &RE_sites_file,
-                           const ClusterVec &clusters,
-                           vector<ChromLinkMatrix *> CLMs) {
-  AssertFilesExist(SAM_files);
-  for (size_t i = 0; i < SAM_files.size(); i++) {
-    LoadDeNovoCLMsFromSAM(SAM_files[i], RE_sites_file, clusters, CLMs);
-  }
-}
-
 
 void LoadNonDeNovoCLMsFromSAM(const vector<string> &SAM_files,
                               vector<ChromLinkMatrix *> CLMs) {
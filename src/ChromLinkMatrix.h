@@ -24,13 +24,18 @@
  * into _N_contigs contigs, each of size _contig_size; this called a "non-de novo CLM" and is used
  * for algorithmic testing.
  *
- * A ChromLinkMatrix contains a 2-D array of data, of size (2*_N_contigs) x (2*_N_contigs).  There
+ * A ChromLinkMatrix represents a 2-D array of data, of size (2*_N_contigs) x (2*_N_contigs).  There
  * are two bins for each contig, corresponding to the forward and reverse orientation of each
- * contig.  Each bin contains a vector<int> representing the set of distances of all links between
- * the two contigs, assuming a particular orientation.
+ * contig.  Each bin contains the set of distances of all links between the two contigs, assuming a
+ * particular orientation; see Links().  The matrix is symmetric, so each pair of contigs is only
+ * stored once, in a compressed sparse layout (one flat array of distances, plus offsets) that is
+ * identical to the layout of the binary cache file.
  *
  * ChromLinkMatrices take their data from SAM files.  You can load data from SAM files using
- * LoadFromSAM...().
+ * LoadFromSAM...().  Once loaded, a ChromLinkMatrix can be cached to a file with WriteFile() and
+ * reloaded with ReadFile().  The cache file is binary by default (see WriteBinaryFile() in
+ * ChromLinkMatrix.cc for the layout) and can be memory-mapped for fast loading; the original
+ * tab-delimited text format is still available for export and is still readable.
  *
  * The goal of the ChromLinkMatrix class is to find a oriented ordering of contigs (a ContigOrdering
  * object) that is best supported by the Hi-C links. The Make...Order() functions employ a
@@ -45,19 +50,85 @@
 #ifndef _CHROM_LINK_MATRIX__H
 #define _CHROM_LINK_MATRIX__H
 
+#include <inttypes.h> // int64_t
 #include <algorithm> // max_element
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iterator> // random_access_iterator_tag
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 #include <boost/numeric/ublas/matrix_sparse.hpp>
 
 #include "ClusterVec.h"
 #include "ContigOrdering.h"
+#include "HiCLinks.h"
+#include "LinkKernels.h"
 #include "LinkSizeDistribution.h"
 #include "TrueMapping.h"
 
 using namespace std;
 
+// LinkDistances: A read-only view of the link distances in one bin of a ChromLinkMatrix (see
+// ChromLinkMatrix::Links()).  It points into the ChromLinkMatrix's own storage, so it's only valid
+// as long as the ChromLinkMatrix is unchanged.  In a compact ChromLinkMatrix, the distances are
+// stored as 16-bit codes (see EncodeLinkDist() in LinkKernels.h), which are decoded as they're read.
+class LinkDistances {
+ public:
+  LinkDistances() : _dists(NULL), _codes(NULL), _size(0) {}
+  LinkDistances(const int32_t *begin, const int32_t *end) : _dists(begin), _codes(NULL), _size(end - begin) {}
+  LinkDistances(const uint16_t *begin, const uint16_t *end) : _dists(NULL), _codes(begin), _size(end - begin) {}
+
+  // const_iterator: An iterator over the distances, for copying them, e.g., into a vector<int>.
+  class const_iterator {
+   public:
+    typedef random_access_iterator_tag iterator_category;
+    typedef int value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const int *pointer;
+    typedef int reference;
+    const_iterator(const int32_t *dists, const uint16_t *codes, const size_t i) : _dists(dists), _codes(codes), _i(i) {}
+    int operator*() const { return _codes ? DecodeLinkDist(_codes[_i]) : _dists[_i]; }
+    const_iterator &operator++() { _i++; return *this; }
+    const_iterator operator++(int) { const_iterator old = *this; _i++; return old; }
+    const_iterator &operator--() { _i--; return *this; }
+    const_iterator &operator+=(const ptrdiff_t n) { _i += n; return *this; }
+    const_iterator operator+(const ptrdiff_t n) const { return const_iterator(_dists, _codes, _i + n); }
+    const_iterator operator-(const ptrdiff_t n) const { return const_iterator(_dists, _codes, _i - n); }
+    ptrdiff_t operator-(const const_iterator &other) const { return ptrdiff_t(_i) - ptrdiff_t(other._i); }
+    int operator[](const ptrdiff_t n) const { return *(*this + n); }
+    bool operator==(const const_iterator &other) const { return _i == other._i; }
+    bool operator!=(const const_iterator &other) const { return _i != other._i; }
+    bool operator<(const const_iterator &other) const { return _i < other._i; }
+   private:
+    const int32_t *_dists;
+    const uint16_t *_codes;
+    size_t _i;
+  };
+
+  const_iterator begin() const { return const_iterator(_dists, _codes, 0); }
+  const_iterator end() const { return const_iterator(_dists, _codes, _size); }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  int operator[](const size_t i) const { return _codes ? DecodeLinkDist(_codes[i]) : _dists[i]; }
+
+  // SumReciprocals, SumLogs: The sum of 1 / ( x + offset ), or of ln(x), over these distances x,
+  // using the kernels in LinkKernels.h.
+  double SumReciprocals(const int64_t offset) const {
+    return _codes ? ::SumReciprocals(_codes, _size, offset) : ::SumReciprocals(_dists, _size, offset);
+  }
+  double SumLogs() const { return _codes ? ::SumLogs(_codes, _size) : ::SumLogs(_dists, _size); }
+
+ private:
+  const int32_t *_dists;
+  const uint16_t *_codes;
+  size_t _size;
+};
+
+class MappedFile;
+
 class ChromLinkMatrix {
  public:
   /* CONSTRUCTORS */
@@ -78,7 +149,7 @@ class ChromLinkMatrix {
                   const int cluster_ID);
   // Load a ChromLinkMatrix from a file that was previously written with WriteFile().
   // ChromLinkMatrix( const string & CLM_file ) : _CP_score_dist(1e7) { ReadFile( CLM_file ); }
- ChromLinkMatrix(const string &CLM_file) : _CP_score_dist(10000000) {
+ ChromLinkMatrix(const string &CLM_file) : _compact(false), _CP_score_dist(10000000) {
     ReadFile(CLM_file);
   }
 
@@ -86,14 +157,22 @@ class ChromLinkMatrix {
   ~ChromLinkMatrix();
   /* FILE I/O */
 
-  // ReadFile: Read the data from file CLM_file into this ChromLinkMatrix.
+  // ReadFile: Read the data from file CLM_file into this ChromLinkMatrix.  The file may be in
+  // either the binary or the text format; the format is detected automatically.
   //void ReadFile(const string &CLM_file);
   void ReadFile(const string &CLM_file);
-  // WriteFile: Write the data in this ChromLinkMatrix to file "CLM_file".
+  // WriteFile: Write the data in this ChromLinkMatrix to file "CLM_file".  By default this writes
+  // the binary format.  If text = true, or if heatmap = true, write the tab-delimited text format.
   void WriteFile(const string &CLM_file,
-                 const bool heatmap = false) const;
-  // DrawHeatmap: Call WriteFile("heatmap.txt"), then run the R script "heatmap.R", which uses R and
-  // ggplot2 to make a heatmap image of this ChromLinkMatrix.
+                 const bool heatmap = false,
+                 const bool text = false) const;
+  // WriteFileAsync: Like WriteFile(CLM_file, false, text), but do the writing on a new thread, and
+  // return the thread; the caller must join() it before changing or destroying this
+  // ChromLinkMatrix.  The const functions (e.g., the ordering functions) can be used meanwhile.
+  // The log line is printed right away, so the log doesn't depend on how long the writing takes.
+  thread WriteFileAsync(const string &CLM_file, const bool text = false) const;
+  // DrawHeatmap: Draw a heatmap image of this ChromLinkMatrix at out/<heatmap_file> (a PNG file, by
+  // default out/heatmap.png), using a HeatmapPyramid.
   void DrawHeatmap(const string &heatmap_file = "") const;
 
   // LoadFromSAMDeNovo: Fill this de novo ChromLinkMatrix with data from one or more SAM/BAM files,
@@ -121,14 +200,24 @@ class ChromLinkMatrix {
   int contig_size() const { return _contig_size; }
   bool has_links() const;
   int NLinks(const int contig1,
-             const int contig2) const { return _matrix[2*contig1][2*contig2].size(); }
+             const int contig2) const { return Links(contig1, false, contig2, false).size(); }
+
+  // Links: Return the distances of the links in bin [2*contig1+rc1][2*contig2+rc2] - that is, the
+  // distances between the reads, if contig2 is immediately after contig1, with these orientations.
+  // For an ASCII illustration of these distances, see AddLinkToMatrix().  This is a lookup into the
+  // compressed storage (O(log N)), with no copying.
+  LinkDistances Links(const int contig1,
+                      const bool rc1,
+                      const int contig2,
+                      const bool rc2) const;
 
   // EmptyRows: Return a vector indicating which contigs in the ChromLinkMatrix have data at all.
   // Contigs in centromeres will end up as false.
   vector<bool> ContigsUsed(const bool flag_adjacent = true) const;
 
   // ContigOrientLogLikelihood: Return the log-likelihood of observing two contigs in a given
-  // orientation, as defined by the links between the contigs.
+  // orientation, as defined by the links between the contigs.  The values for each contig pair are
+  // calculated once and cached (see _orient_LLs.)
   double ContigOrientLogLikelihood( const int c1, const bool rc1, const int c2, const bool rc2 ) const;
 
   // OrderingScore: Find the "score" of this ContigOrdering, indicating how well it matches up with
@@ -143,6 +232,19 @@ class ChromLinkMatrix {
                        const bool oriented = true,
                        const int shred_start = -1,
                        const int shred_stop = -1) const;
+  // The same, for an ordering with a shred inserted into it (see ShredInsertion in
+  // ContigOrdering.h), without making the new ordering.
+  double OrderingScore(const ShredInsertion &order,
+                       const bool oriented = true,
+                       const int shred_start = -1,
+                       const int shred_stop = -1) const;
+  // OrderingScoreReference: The same score as OrderingScore(), by the original loop, which checks
+  // the orientation, the range, and the contig sizes at every contig pair instead of picking a
+  // compiled kernel.  It's slow; it's only kept to test the kernels against (see TestLachesis.cc.)
+  double OrderingScoreReference(const ContigOrdering &order,
+                                const bool oriented = true,
+                                const int shred_start = -1,
+                                const int shred_stop = -1) const;
   // EnrichmentScore: Find the "enrichment", the degree to which the Hi-C links between contigs are
   // between close contigs.  It's analogous to the concentration  of signal along the main diagonal
   // of the heatmap.
@@ -155,6 +257,14 @@ class ChromLinkMatrix {
   void SetCPScoreDist(const int CP_score_dist) {
     _CP_score_dist = CP_score_dist;
   }
+  // SetCompactDists: If compact = true, store the link distances as 16-bit codes rather than 32-bit
+  // ints (see EncodeLinkDist() in LinkKernels.h), and the offsets of each bin's links in 32 bits
+  // instead of 64.  This about halves the memory and the size of the binary CLM file, at the cost of
+  // rounding each distance by up to 1 part in 4096; a compact CLM can hold up to 2^32-1 links.  Any
+  // links that are already loaded are converted, but it's cheapest to call this before loading any.
+  // A CLM read from a compact binary file is compact already.
+  void SetCompactDists(const bool compact);
+  bool compact() const { return _compact; }
   // PrefilterLinks: Find contig pairs in which the distribution of Hi-C link positions on the
   // contigs suggest long-range rather than short-range contacts.
   void PrefilterLinks(const set<int> &cluster, const TrueMapping *mapping);
@@ -163,7 +273,18 @@ class ChromLinkMatrix {
   // MAIN ALGORITHMS
   ContigOrdering MakeTrunkOrder(const int min_N_REs) const;
   ContigOrdering MakeFullOrder(const int min_N_REs, const bool use_CP_score = false) const;
-  void SpaceContigs(ContigOrdering &order, const LinkSizeDistribution &link_size_distribution) const;
+  // RefineOrder: Try to improve an ordering made by MakeFullOrder() by simulated annealing, with
+  // random moves and inversions scored by OrderingScore().  Runs one independent chain per thread
+  // (up to N_threads; 0 means one per core) for about time_budget seconds.  If the best ordering
+  // found beats the original, it replaces the original and is re-oriented with OrientContigs().
+  void RefineOrder(ContigOrdering &order, const double time_budget, const int N_threads) const;
+  // SpaceContigs: Estimate the gap sizes between the contigs in an oriented ordering.  If
+  // check_gap_search isn't NULL, each gap size search (see FindGapSize) is also done exhaustively,
+  // and the two results are compared, for testing: check_gap_search->first is incremented for each
+  // search, and check_gap_search->second for each one in which the coarse-to-fine search missed
+  // the best log-likelihood found by the exhaustive search.
+  void SpaceContigs(ContigOrdering &order, const LinkSizeDistribution &link_size_distribution,
+                    pair<int, int> *check_gap_search = NULL) const;
 
   vector< vector<int> > FindSpanningTree(const int min_N_REs) const;
   void SmoothThornsInTree(vector< vector<int> > & tree) const;
@@ -171,22 +292,74 @@ class ChromLinkMatrix {
   ContigOrdering ReinsertShreds(vector< vector<int> > &tree, const int min_N_REs, const bool use_CP_score = false) const;
   void OrientContigs(ContigOrdering &order) const;
 
+  // SetCheckpoints: Make the long ordering steps save their progress to checkpoint files, so that
+  // an interrupted run can pick up where it left off.  MakeTrunkOrder() saves the trunk (and the
+  // spanning tree) as soon as it's found; ReinsertShreds() saves its progress after each shred, but
+  // no more often than once every 'seconds' seconds.  The files are named
+  // <file_head>.<step>.checkpoint and are stamped with 'stamp', which should identify this CLM and
+  // the ordering parameters: each step resumes from its checkpoint only if it has the same stamp.
+  // If seconds = 0, nothing is checkpointed.
+  // RemoveCheckpoints: Remove the checkpoint files, once the ordering is finished.
+  void SetCheckpoints(const string &file_head, const string &stamp, const double seconds);
+  void RemoveCheckpoints() const;
+
  private:
+  // Not copyable, because the storage may point into a MappedFile.
+  ChromLinkMatrix(const ChromLinkMatrix &);
+  ChromLinkMatrix &operator=(const ChromLinkMatrix &);
+
   // DeNovo: Return true iff this is a de novo CLM.
   bool DeNovo() const { return _contig_size == 0; }
-  // Initialize the matrix of data and allocate memory for it.
+  // Initialize the matrix of data (with no links) and free it.
   void InitMatrix();
   void FreeMatrix();
+  // FindPair: Return the index of the contig pair (contig1,contig2), with contig1 <= contig2, in the
+  // compressed storage, or -1 if there are no links between them.
+  int64_t FindPair(const int contig1,
+                   const int contig2) const;
+  // Cell: Return the links of pair p (as found by FindPair) in orientation k = 2*rc1 + rc2.
+  // CellPtr: Return element i of the cell pointers, whichever array they're in.
+  LinkDistances Cell(const int64_t p,
+                     const int k) const;
+  uint64_t CellPtr(const uint64_t i) const { return _compact ? _cell_ptr32[i] : _cell_ptr[i]; }
+  // CompileLinks: Add the links in _new_links into the compressed storage.  Each bin's new links
+  // go after its existing ones, in the order in which they were added.  This must be called after
+  // adding any links, before using the matrix.
+  void CompileLinks();
+  // Helper functions for ReadFile() and WriteFile(), which handle the two file formats.
+  void ReadTextFile(const string &CLM_file);
+  void ReadBinaryFile(const string &CLM_file);
+  void ReadHeaderLine(const string &line,
+                      string &contig_lens_file,
+                      string &RE_sites_file);
+  void FinishReadFile(const string &CLM_file,
+                      const bool seen_data,
+                      const string &contig_lens_file,
+                      const string &RE_sites_file);
+  string FileHeader(const string &CLM_file,
+                    const bool heatmap) const;
+  void WriteTextFile(const string &CLM_file,
+                     const bool heatmap) const;
+  void WriteBinaryFile(const string &CLM_file) const;
+  void WriteFileData(const string &CLM_file,
+                     const bool heatmap,
+                     const bool text) const;
+  // WriteAuxFiles: Write the contig lengths and RE sites of a de novo CLM to <CLM_file>.lens and
+  // <CLM_file>.RE_sites.
+  void WriteAuxFiles(const string &CLM_file) const;
   // LoadRESitesFile: Fill _contig_RE_sites.
   void LoadRESitesFile(const string & RE_sites_file);
   // AddToMatrix: Add a individual Hi-C link to the matrix.  This function is only used when loading
-  // data from SAM files.
+  // data from SAM files.  AddIntraContigLink does the same for a link within one contig, which goes
+  // in bin [2*contig][2*contig].  The links aren't usable until CompileLinks() is called.
   void AddLinkToMatrix(const int contig1,
                        const int contig2,
                        const int read1_dist1,
                        const int read1_dist2,
                        const int read2_dist1,
                        const int read2_dist2);
+  void AddIntraContigLink(const int contig,
+                          const int dist);
 
   // CalculateRepeatFactors: Fill the _repeat_factors vector.  This vector contains the 'factor', or
   // multiplicity, of each contig: the ratio by which the total  density of links in each contig
@@ -207,13 +380,55 @@ class ChromLinkMatrix {
   // FindGapSize(): Helper function for SpaceContigs().  Finds the best estimate of the gap size
   // following contig #pos in the ContigOrdering.  Uses not just the links between contigs #pos and
   // #pos+1, but also other links between more distant contigs if their gaps have already been
-  // estimated.
+  // estimated.  The search over gap sizes goes from coarse to fine, and gap_likelihood caches the
+  // expected links across calls.  If exhaustive = true, every gap size is tried instead (this is
+  // much slower, and is for testing the coarse-to-fine search.)  If best_score isn't NULL, it's set
+  // to the log-likelihood of the gap size found.
   int FindGapSize(const ContigOrdering &order,
                   const int pos,
-                  const LinkSizeDistribution &lsd,
-                  const vector<double> &enrichments ) const;
+                  GapLikelihood &gap_likelihood,
+                  const vector<double> &enrichments,
+                  const bool exhaustive = false,
+                  double *best_score = NULL) const;
   void ReportOrderingSize(const ContigOrdering &order) const;
 
+  // PairScore: The contribution to OrderingScore() of the links between two oriented contigs
+  // separated by D bp.  ShredInsertionScores: Helper function for ReinsertShreds(); finds the
+  // OrderingScore of every way of inserting a shred into an ordering, incrementally.
+  double PairScore(const int contig1,
+                   const bool rc1,
+                   const int contig2,
+                   const bool rc2,
+                   const int64_t D) const;
+  // ShredInsertionScores uses scratch for its working arrays; ReinsertShreds() keeps one for all
+  // its shreds, so that scoring a shred doesn't allocate anything.
+  struct ShredScratch {
+    vector<int64_t> P, Q;
+    vector<double> straddle_delta;
+    vector<int> S;
+  };
+  void ShredInsertionScores(const ContigOrdering &order,
+                            const vector<int> &shred,
+                            vector<double> &fw_scores,
+                            vector<double> &rc_scores,
+                            ShredScratch &scratch) const;
+  // OrderingScoreOf: The body of OrderingScore(), for a ContigOrdering or a ShredInsertion.  It
+  // picks an OrderingScoreKernel, which is compiled separately for each combination of: oriented or
+  // not; which pairs are scored (all, the ones that touch [range_start,range_stop), or the ones
+  // on either side of range_start); and de novo contig lengths (_contig_lengths) or fixed ones
+  // (_contig_size).  So the kernels' loops don't test any of these.
+  enum ScoreRange { SCORE_ALL, SCORE_RANGE, SCORE_AROUND };
+  template<class Ordering> double OrderingScoreOf(const Ordering &order,
+                                                  const bool oriented,
+                                                  const int range_start,
+                                                  const int range_stop) const;
+  template<class Ordering, ScoreRange Range> double OrderingScoreOf(const Ordering &order,
+                                                                    const bool oriented,
+                                                                    const int range_start,
+                                                                    const int range_stop) const;
+  template<class Ordering, bool Oriented, ScoreRange Range, bool DeNovo>
+  double OrderingScoreKernel(const Ordering &order, const int range_start, const int range_stop) const;
+
   /* DATA */
   // The species under consideration.  Knowing this helps us avoid confusion.
   string _species;
@@ -225,14 +440,72 @@ class ChromLinkMatrix {
   vector<int> _contig_RE_sites; // number of restriction enzyme (RE) sites per contig
   int _most_contig_REs; // largest element in _contig_RE_sites; -1 for non-de novo CLMs
 
-  /* MAIN DATA STRUCTURE: a matrix with size (2*_N_contigs) x (2*_N_contigs); each element is a vector of read pairs' distances */
-  vector<int> ** _matrix;
+  /* MAIN DATA STRUCTURE: a matrix with size (2*_N_contigs) x (2*_N_contigs); each element is a list of read pairs' distances.
+     Bin [2*c2+rc2][2*c1+rc1] always holds the same links as bin [2*c1+(1-rc1)][2*c2+(1-rc2)], so only the contig pairs (c1,c2) with c1 <= c2 are stored, in
+     compressed sparse form:
+     -- The pairs with links are sorted by c1, then c2.  c1's pairs are [_pair_ptr[c1],_pair_ptr[c1+1]), and _pair_c2[p] is the c2 of pair p.
+     -- The links of pair p in orientation k = 2*rc1 + rc2 are _dists[ _cell_ptr[4*p+k], _cell_ptr[4*p+k+1] ).
+     -- If _compact, the distances are in _dist_codes instead (with the same indices), as 16-bit codes, and the cell pointers are in _cell_ptr32; see
+        SetCompactDists().
+     These arrays point either into the vectors below, or directly into _mapped_file, if the matrix was read from a binary CLM file. */
+  const uint64_t *_pair_ptr; // size _N_contigs+1
+  const int32_t  *_pair_c2;  // size N_pairs
+  const uint64_t *_cell_ptr; // size 4*N_pairs+1
+  const uint32_t *_cell_ptr32;
+  const int32_t  *_dists;
+  const uint16_t *_dist_codes;
+  bool _compact;
+  vector<uint64_t> _pair_ptr_data, _cell_ptr_data;
+  vector<uint32_t> _cell_ptr32_data;
+  vector<int32_t> _pair_c2_data, _dists_data;
+  vector<uint16_t> _dist_codes_data;
+  MappedFile *_mapped_file;
   bool _matrix_init; // is the matrix initialized? (if not, don't free it!)
+  // Links that have been added since the last CompileLinks(): the contig pair (c1 <= c2) and the distance in each orientation k (or -1 for none).
+  struct NewLink {
+    int32_t c1, c2;
+    int32_t dists[4];
+  };
+  vector<NewLink> _new_links;
+  // MakeLink, MakeIntraContigLink: Make the NewLink records for AddLinkToMatrix() and
+  // AddIntraContigLink().
+  static NewLink MakeLink(const int contig1,
+                          const int contig2,
+                          const int read1_dist1,
+                          const int read1_dist2,
+                          const int read2_dist1,
+                          const int read2_dist2);
+  static NewLink MakeIntraContigLink(const int contig,
+                                     const int dist);
+  // WriteSpilledBinaryFile: Write the binary CLM file for links that were spilled to disk as
+  // NewLink records (in spill_files, in the order in which they were added) rather than added to
+  // this matrix, using about memory_budget bytes of memory.  The file is exactly what adding the
+  // links, calling CompileLinks(), and calling WriteFile() would make.
+  void WriteSpilledBinaryFile(const string &CLM_file,
+                              const vector<string> &spill_files,
+                              const size_t memory_budget) const;
+  // Cache for ContigOrientLogLikelihood(): the log-likelihood of pair p in orientation k is
+  // _orient_LLs[4*p+k], or NaN if it hasn't been calculated yet.  Filled lazily, and cleared
+  // whenever the matrix changes.  Because of this cache, ContigOrientLogLikelihood() isn't
+  // thread-safe, even though it's const.
+  mutable vector<double> _orient_LLs;
   // "Repetitiveness factors" for each contig: the number of total links involving this contig,
   // divided by the average.  Used in normalization.
   vector<double> _repeat_factors;
   // tree: A spanning tree.  An intermediate result, created by MakeTrunkOrder, used by MakeFullOrder.
   mutable vector< vector<int> > _tree;
+  // Checkpointing (see SetCheckpoints).  Checkpointing is off if _checkpoint_head is empty.
+  // ReadCheckpoint opens a step's checkpoint file and reads past its header, or returns false if
+  // there is no checkpoint with the right stamp.  WriteCheckpoint writes the file (atomically, via
+  // a temporary file) with the header and then the output of 'write'.  CheckpointDue returns true
+  // if it's been at least _checkpoint_seconds since the last checkpoint was written.
+  string CheckpointFile(const string &step) const { return _checkpoint_head + "." + step + ".checkpoint"; }
+  bool ReadCheckpoint(const string &step, ifstream &in) const;
+  void WriteCheckpoint(const string &step, const function<void(ostream &)> &write) const;
+  bool CheckpointDue() const;
+  string _checkpoint_head, _checkpoint_stamp;
+  double _checkpoint_seconds;
+  mutable chrono::steady_clock::time_point _last_checkpoint;
   // The set of SAM files used to gather this data.
   vector<string> _SAM_files;
   // Maximum distance used in the OrderingScore() function.  Higher values give more precise results but take much more runtime.  Defaults to 10Mb.
@@ -245,10 +518,15 @@ class ChromLinkMatrix {
                                     const string &RE_sites_file,
                                     const ClusterVec &clusters,
                                     vector<ChromLinkMatrix *> CLMs);
-  friend void LoadDeNovoCLMsFromSAM(const vector<string> &SAM_files,
-                                    const string &RE_sites_file,
-                                    const ClusterVec &clusters,
-                                    vector<ChromLinkMatrix *> CLMs);
+  friend void LoadDeNovoCLMs(const vector<string> &SAM_files,
+                             const HiCLinkFile *link_file,
+                             const string &RE_sites_file,
+                             const ClusterVec &clusters,
+                             vector<ChromLinkMatrix *> CLMs,
+                             const int N_threads,
+                             const vector<string> &CLM_files,
+                             const size_t memory_budget,
+                             const double subsample_fraction);
 };
 
 // LoadDeNovoCLMsFromSAM: Import one or more SAM/BAM files and create a set of de novo
@@ -258,7 +536,9 @@ class ChromLinkMatrix {
 // represent ChromLinkMatrices for the  cluster ID equal to their index in the vector, and will be
 // filled accordingly.  If you are creating a set of ChromLinkMatrices for each chromosome, this is
 // much faster than calling LoadFromSAMDeNovo individually for each ChromLinkMatrix  object because
-// it only reads through the SAM file(s) once.
+// it only reads through the SAM file(s) once.  Multiple SAM files are read in parallel, with up to
+// N_threads threads (0 = one per core; see SAMIngest.h).  If subsample_fraction < 1, only that
+// fraction of the read pairs is used (see SAMStepper::FilterSubsample).
 void LoadDeNovoCLMsFromSAM(const string &SAM_file,
                            const string &RE_sites_file,
                            const ClusterVec &clusters,
@@ -266,7 +546,44 @@ void LoadDeNovoCLMsFromSAM(const string &SAM_file,
 void LoadDeNovoCLMsFromSAM(const vector<string> &SAM_files,
                            const string &RE_sites_file,
                            const ClusterVec &clusters,
-                           vector<ChromLinkMatrix *> CLMs);
+                           vector<ChromLinkMatrix *> CLMs,
+                           const int N_threads = 1,
+                           const double subsample_fraction = 1);
+
+// LoadDeNovoCLMsFromLinks: Exactly like LoadDeNovoCLMsFromSAM, but reads the Hi-C links from a
+// HiCLinkFile that was extracted from the SAM files (see HiCLinks.h).  This is much faster.
+void LoadDeNovoCLMsFromLinks(const HiCLinkFile &links,
+                             const string &RE_sites_file,
+                             const ClusterVec &clusters,
+                             vector<ChromLinkMatrix *> CLMs,
+                             const int N_threads = 1);
+
+// WriteDeNovoCLMFilesFromLinks: Like LoadDeNovoCLMsFromLinks followed by CLMs[i]->WriteFile(
+// CLM_files[i]) for each non-NULL CLM, but with bounded memory.  The links go straight to spill
+// files on disk as they're read, and each CLM file is then made from its spill files by an external
+// merge sort, using about memory_budget bytes of memory in all.  The CLM objects get their contig
+// data but no links.  The CLM files (always binary) are identical to those made in memory.
+void WriteDeNovoCLMFilesFromLinks(const HiCLinkFile &links,
+                                  const string &RE_sites_file,
+                                  const ClusterVec &clusters,
+                                  vector<ChromLinkMatrix *> CLMs,
+                                  const vector<string> &CLM_files,
+                                  const size_t memory_budget,
+                                  const int N_threads = 1);
+
+// LoadDeNovoCLMs: The implementation of LoadDeNovoCLMsFromSAM, LoadDeNovoCLMsFromLinks, and
+// WriteDeNovoCLMFilesFromLinks.  If link_file is NULL, read the SAM files; otherwise read
+// link_file.  If CLM_files is non-empty, spill the links and write the CLM files, as in
+// WriteDeNovoCLMFilesFromLinks, instead of filling the CLMs.
+void LoadDeNovoCLMs(const vector<string> &SAM_files,
+                    const HiCLinkFile *link_file,
+                    const string &RE_sites_file,
+                    const ClusterVec &clusters,
+                    vector<ChromLinkMatrix *> CLMs,
+                    const int N_threads,
+                    const vector<string> &CLM_files = vector<string>(),
+                    const size_t memory_budget = 0,
+                    const double subsample_fraction = 1);
 
 // LoadNonDeNovoCLMsFromSAM: Import one or more SAM/BAM files and create a set of non-de novo
 // ChromLinkMatrices corresponding to each chromosome.  As many or as few of the ChromLinkMatrix
@@ -279,3 +279,31 @@ ClusterVec::SortByMedian()
 
   *this = sorted;
 }
+
+
+
+
+
+
+
+// ClusterIndex constructor: Flatten the clusters into the member array and the lookup tables.
+ClusterIndex::ClusterIndex( const ClusterVec & clusters, const int N_contigs )
+  : _offsets( 1, 0 ),
+    _cluster_IDs( N_contigs < 0 ? clusters.N_contigs() : N_contigs, -1 ),
+    _local_IDs  ( _cluster_IDs.size(), -1 )
+{
+  _offsets.reserve( clusters.size() + 1 );
+  _members.reserve( clusters.SizeSum() );
+
+  for ( size_t i = 0; i < clusters.size(); i++ ) {
+    int local_ID = 0;
+    for ( set<int>::const_iterator it = clusters[i].begin(); it != clusters[i].end(); ++it ) {
+      assert( *it >= 0 && *it < (int) _cluster_IDs.size() );
+      assert( _cluster_IDs[*it] == -1 ); // a contig can't be in two clusters
+      _cluster_IDs[*it] = i;
+      _local_IDs  [*it] = local_ID++;
+      _members.push_back( *it );
+    }
+    _offsets.push_back( _members.size() );
+  }
+}
@@ -25,6 +25,10 @@
  * The ClusterVec is a low-level object.  It contains no data structures except the vector< set<int> > and the number of contigs.  It only knows the contigs by
  * their IDs and knows nothing about them except what cluster they are in.
  *
+ * A ClusterIndex is a flat, read-only snapshot of a ClusterVec, for code that needs to look up contigs by cluster and clusters by contig many times.  The
+ * members of all the clusters are kept in one sorted array, cluster after cluster, and each contig has a table entry with its cluster ID and its local ID,
+ * i.e., its index among the members of its cluster, which is the contig ID that the ChromLinkMatrix and ContigOrdering for that cluster use.
+ *
  *
  *
  * Josh Burton
@@ -38,6 +42,7 @@
 
 
 
+#include <assert.h>
 #include <inttypes.h> // uint64_t
 #include <iostream>
 #include <vector>
@@ -92,4 +97,49 @@ class ClusterVec : public vector< set<int> >
 
 
 
+
+class ClusterIndex
+{
+ public:
+
+  // Members: a view of the contig IDs in one cluster, in increasing order.
+  struct Members {
+    const int * _begin, * _end;
+    const int * begin() const { return _begin; }
+    const int * end()   const { return _end; }
+    size_t size() const { return _end - _begin; }
+    int operator[]( const size_t i ) const { return _begin[i]; }
+  };
+
+  /* CONSTRUCTORS */
+  ClusterIndex() : _offsets( 1, 0 ) {}
+  // Build the index.  The lookup tables cover N_contigs contigs, or clusters.N_contigs() if N_contigs < 0.  No contig may be in more than one cluster.
+  explicit ClusterIndex( const ClusterVec & clusters, const int N_contigs = -1 );
+
+  /* QUERIES */
+  int N_clusters() const { return _offsets.size() - 1; }
+  int N_contigs() const { return _cluster_IDs.size(); }
+
+  // The members of cluster i are at positions [ offset(i), offset(i+1) ) in the flat array; so offset(i) is also the number of contigs in clusters 0..i-1.
+  int offset( const int i ) const { return _offsets[i]; }
+  int cluster_size( const int i ) const { return _offsets[i+1] - _offsets[i]; }
+  Members members( const int i ) const { Members m = { _members.data() + _offsets[i], _members.data() + _offsets[i+1] }; return m; }
+  int member( const int i, const int local_ID ) const { assert( local_ID < cluster_size(i) ); return _members[ _offsets[i] + local_ID ]; }
+
+  // Contig to cluster ID and local ID, or -1 for contigs not in a cluster.
+  int cluster_ID( const int contig ) const { return _cluster_IDs[contig]; }
+  int local_ID  ( const int contig ) const { return   _local_IDs[contig]; }
+  const vector<int> & cluster_IDs() const { return _cluster_IDs; }
+  const vector<int> &   local_IDs() const { return   _local_IDs; }
+
+
+ private:
+  vector<int> _offsets; // size N_clusters + 1
+  vector<int> _members; // size SizeSum()
+  vector<int> _cluster_IDs, _local_IDs; // size N_contigs
+};
+
+
+
+
 #endif
@@ -21,7 +21,7 @@
 #include "TrueMapping.h"
 
 #include <assert.h>
-#include <stdlib.h> // srand48, lrand48
+#include <stdlib.h> // srand48, lrand48, nrand48
 #include <limits.h> // INT_MAX
 #include <cmath> // sqrt
 #include <iostream>
@@ -31,7 +31,7 @@
 #include <string>
 #include <vector>
 #include <set>
-#include <algorithm> // count, reverse
+#include <algorithm> // count, reverse, rotate
 
 
 
@@ -365,9 +365,9 @@ ContigOrdering::AddContig( const int contig_ID, const int pos, const bool rc, co
 }
 
 
-// Adds a set of previously used contigs in position pos (pos = -1: add to end).  Always use orientation FW.  Quality scores and gaps can't be added this way.
+// Adds a set of previously unused contigs in position pos (pos = -1: add to end).  Always use orientation FW.  Quality scores and gaps can't be added this way.
 void
-ContigOrdering::AddContigs( vector<int> contig_IDs, const int pos )
+ContigOrdering::AddContigs( const vector<int> & contig_IDs, const int pos )
 {
   // Sanity checks.
   int size = contig_IDs.size();
@@ -409,6 +409,25 @@ ContigOrdering::RemoveContig( const int pos )
 }
 
 
+// Remove the N contigs in positions [pos,pos+N).  After AddContigs( contig_IDs, pos ), this puts the ContigOrdering back as it was, so a change can be tried
+// out in place and then undone.  The vector's memory is kept, so the next insertion doesn't need to allocate.
+void
+ContigOrdering::RemoveContigs( const int pos, const int N )
+{
+  // Sanity checks.
+  assert( pos >= 0 && N >= 0 && pos + N <= _N_contigs_used );
+  assert( !has_Q_scores() && !has_gaps() ); // don't add Q-scores or gaps and then modify the underlying ordering!
+
+  // Bookkeeping.
+  for ( int i = pos; i < pos + N; i++ )
+    _contigs_used[ contig_ID(i) ] = false;
+  _N_contigs_used -= N;
+
+  // Remove the contigs from the ordering.
+  _data.erase( _data.begin() + pos, _data.begin() + pos + N );
+}
+
+
 
 
 // Move a contig from position old_pos to new_pos, without changing any contig orientations.
@@ -421,20 +440,12 @@ ContigOrdering::MoveContig( const int old_pos, const int new_pos )
   assert( !has_Q_scores() && !has_gaps() ); // don't add Q-scores or gaps and then modify the underlying ordering!
   if ( old_pos == new_pos ) return; // no work to do
 
-  // Find the contig that's being moved.
-  int contig_ID = _data[old_pos];
   //cout << "Moving a contig (" << _data[old_pos] << ") from " << old_pos << " to " << new_pos << endl;
 
-  // Shift the contigs in between as necessary.
-  if ( new_pos > old_pos )
-    for ( int i = old_pos; i < new_pos; i++ )
-      _data[i] = _data[i+1];
-  else
-    for ( int i = old_pos; i > new_pos; i-- )
-      _data[i] = _data[i-1];
-
-  // Put the moved contig into its new place.
-  _data[new_pos] = contig_ID;
+  // Shift the contigs in between by one (a single memmove), and put the moved contig into its new place.
+  vector<int>::iterator it = _data.begin();
+  if ( new_pos > old_pos ) rotate( it + old_pos, it + old_pos + 1, it + new_pos + 1 );
+  else                     rotate( it + new_pos, it + old_pos, it + old_pos + 1 );
 }
 
 
@@ -495,30 +506,41 @@ ContigOrdering::InvertRandom( const int N )
   }
 }
 
+// ChooseRandomPerturbation: Helper function for PerturbRandom().  Choose a random change to an ordering of N_contigs_used contigs: either an Invert() or a
+// MoveContig(), between positions start and stop.  rand() returns random non-negative longs, as lrand48() does.
+template<class RandFunc> static bool
+ChooseRandomPerturbation( const int N_contigs_used, RandFunc rand, int & start, int & stop )
+{
+  int N_contigs_squared_m1 = N_contigs_used * N_contigs_used - 1;
+
+  // First, choose a random operation: either MoveContig() or Invert().
+  bool invert = rand() & 1;
+
+  // Next, choose a random distance over which to apply the operation.
+  // The following line of code generates a random distance in the range [1,N_contigs_used) and favors small distances over large ones.
+  int dist = int( N_contigs_used - sqrt( 1 + rand() % N_contigs_squared_m1 ) );
+  //cout << "dist = " << dist << endl;
+
+  // Next, choose a random starting place for the random perturbation.
+  start = rand() % ( N_contigs_used - dist );
+  stop = start + dist;
+
+  // Lastly, if this is a MoveContig() (not an Invert) then maybe switch the positions.
+  if ( !invert && rand() & 1 ) { int swap = start; start = stop; stop = swap; }
+  //cout << "Perturbation is a " << ( invert ? "inversion" : "move" ) << " between " << start << " and " << stop << endl;
+
+  return invert;
+}
+
+
 // PerturbRandom: Apply one or more random changes, either MoveContig() or Invert().
 void
 ContigOrdering::PerturbRandom( const int N )
 {
   int start, stop;
-  int N_contigs_squared_m1 = _N_contigs_used * _N_contigs_used - 1;
 
   for ( int i = 0; i < N; i++ ) {
-
-    // First, choose a random operation: either MoveContig() or Invert().
-    bool invert = lrand48() & 1;
-
-    // Next, choose a random distance over which to apply the operation.
-    // The following line of code generates a random distance in the range [1,N_contigs_used) and favors small distances over large ones.
-    int dist = int( _N_contigs_used - sqrt( 1 + lrand48() % N_contigs_squared_m1 ) );
-    //cout << "dist = " << dist << endl;
-
-    // Next, choose a random starting place for the random perturbation.
-    start = lrand48() % ( _N_contigs_used - dist );
-    stop = start + dist;
-
-    // Lastly, if this is a MoveContig() (not an Invert) then maybe switch the positions.
-    if ( !invert && lrand48() & 1 ) { int swap = start; start = stop; stop = swap; }
-    //cout << "Perturbation is a " << ( invert ? "inversion" : "move" ) << " between " << start << " and " << stop << endl;
+    bool invert = ChooseRandomPerturbation( _N_contigs_used, lrand48, start, stop );
 
     // Apply the random perturbation.
     if ( invert ) Invert( start, stop );
@@ -528,6 +550,15 @@ ContigOrdering::PerturbRandom( const int N )
 }
 
 
+// RandomPerturbation: Choose one random change, using the caller's own random number state.
+bool
+ContigOrdering::RandomPerturbation( unsigned short xsubi[3], int & start, int & stop ) const
+{
+  assert( _N_contigs_used >= 2 );
+  return ChooseRandomPerturbation( _N_contigs_used, [xsubi]() { return nrand48( xsubi ); }, start, stop );
+}
+
+
 
 
 void
@@ -678,73 +709,62 @@ ContigOrdering::SetGaps( const vector<int> & gaps )
  * Each edge between two contigs has a weight equal to the log-likelihood of the set of observed link sizes between the two contigs, in the given orientation.
  * For an ASCII illustration of the four possible contig orientations and the implied link sizes, see ChromLinkMatrix -> LoadLinkMatricesFromSAM().
  *
+ * The WDAG is a FlatWDAG, so that orderings of thousands of contigs don't need thousands of separately allocated nodes.  The node IDs are 0 for the start,
+ * 2i+1 and 2i+2 for contig #i's fw and rc nodes, and 2N+1 for the end.  Each edge between contigs is labeled with the orientations it implies, 2*rc1 + rc2;
+ * the edges from the start node are labeled rc2, and the edges into the end node are labeled -1.
+ *
  *************************************************************************************************************************************************************/
-WDAG
+FlatWDAG
 ContigOrdering::OrientationWDAG( const ChromLinkMatrix * clm ) const
 {
 
   // Build a WDAG representing the possible paths through this ContigOrdering with different orientations of the contigs.
   // This method for building a WDAG follows HMM:to_WDAG().
-  WDAG wdag;
-
-  wdag.Reserve( 2 * _N_contigs_used + 2 );
+  FlatWDAG wdag;
 
-  // Vectors to keep track of the WDAGNode objects.
-  vector<WDAGNode *> contig_fw( _N_contigs_used, NULL );
-  vector<WDAGNode *> contig_rc( _N_contigs_used, NULL );
-  char edge_name[50];
+  wdag.Reserve( 2 * _N_contigs_used + 2, 4 * _N_contigs_used + 2 );
 
   // Create the start node.
-  WDAGNode * start_node = wdag.AddNode();
+  const int start_node = wdag.AddNode();
   wdag.SetReqStart( start_node );
 
 
-  // Step through the set of contigs and create two new nodes for each contig.
-  for ( int i = 0; i < _N_contigs_used; i++ ) {
-
-    contig_fw[i] = wdag.AddNode();
-    contig_rc[i] = wdag.AddNode();
+  // Step through the set of contigs and create two new nodes for each contig, with the edges entering them.
+  for ( int i = 0; i < _N_contigs_used; i++ )
+    for ( int rc2 = 0; rc2 < 2; rc2++ ) {
 
-    // For the first contig, connect the fw and rc nodes to the start nodes.
-    // The input weights are 0 because there's no a priori reason to favor one orientation over the other.
-    if ( i == 0 ) {
-      sprintf( edge_name, "S__%d_fw", i ); // "S" = start
-      contig_fw[i]->AddEdge( start_node, edge_name, 0 );
-      sprintf( edge_name, "S__%d_rc", i ); // "S" = start
-      contig_rc[i]->AddEdge( start_node, edge_name, 0 );
-    }
+      const int node2 = wdag.AddNode();
+      assert( node2 == 2*i + 1 + rc2 );
 
-    // For all contigs past the first, there are four edges that need to be made between this node and the previos node, corresponding to the four possible
-    // combined orientations of the two contigs.
-    else {
-
-      for ( int rc1 = 0; rc1 < 2; rc1++ )
-	for ( int rc2 = 0; rc2 < 2; rc2++ ) {
+      // For the first contig, connect the fw and rc nodes to the start nodes.
+      // The input weights are 0 because there's no a priori reason to favor one orientation over the other.
+      if ( i == 0 ) {
+	wdag.AddEdge( start_node, rc2, 0 );
+	continue;
+      }
 
-	  int contig1 = contig_ID(i-1);
-	  int contig2 = contig_ID(i);
+      // For all contigs past the first, there are four edges that need to be made between this contig's nodes and the previous contig's nodes,
+      // corresponding to the four possible combined orientations of the two contigs.
+      for ( int rc1 = 0; rc1 < 2; rc1++ ) {
 
-	  // Each oriented pair of contigs points to an element in the ChromLinkMatrix, which is a vector<int> giving the distance between the reads in those
-	  // two contigs, assuming the contigs are immediately adjacent with the specified orientations.
-	  double log_like = clm->ContigOrientLogLikelihood( contig1, rc1, contig2, rc2 );
+	int contig1 = contig_ID(i-1);
+	int contig2 = contig_ID(i);
 
-	  // Make the edge.
-	  WDAGNode * node1 = rc1 ? contig_rc[i-1] : contig_fw[i-1];
-	  WDAGNode * node2 = rc2 ? contig_rc[i  ] : contig_fw[i  ];
-	  sprintf( edge_name, "T__%d_%s__%d_%s", i-1, (rc1 ? "rc" : "fw"), i, (rc2 ? "rc" : "fw") ); // "T" = transition
-	  node2->AddEdge( node1, edge_name, log_like );
+	// Each oriented pair of contigs points to an element in the ChromLinkMatrix, which is a list of the distances between the reads in those
+	// two contigs, assuming the contigs are immediately adjacent with the specified orientations.
+	double log_like = clm->ContigOrientLogLikelihood( contig1, rc1, contig2, rc2 );
 
-	}
+	// Make the edge.
+	const int node1 = 2*(i-1) + 1 + rc1;
+	wdag.AddEdge( node1, 2*rc1 + rc2, log_like );
+      }
     }
 
 
-  }
-
-
   // Finally, create the ending node.  This node's input weights are all 0.
-  WDAGNode * end_node = wdag.AddNode();
-  end_node->AddEdge( _N_contigs_used == 0 ? start_node : contig_fw[_N_contigs_used-1], "F", 0 ); // "F" = finish
-  end_node->AddEdge( _N_contigs_used == 0 ? start_node : contig_rc[_N_contigs_used-1], "F", 0 ); // "F" = finish
+  const int end_node = wdag.AddNode();
+  wdag.AddEdge( _N_contigs_used == 0 ? start_node : 2*_N_contigs_used - 1, -1, 0 );
+  wdag.AddEdge( _N_contigs_used == 0 ? start_node : 2*_N_contigs_used,     -1, 0 );
   wdag.SetReqEnd( end_node );
 
   assert( wdag.N() == 2 * _N_contigs_used + 2 );
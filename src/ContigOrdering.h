@@ -87,13 +87,17 @@ class ContigOrdering
 
   // Local modifications
   void AddContig( const int contig_ID, const int pos = -1, const bool rc = FW, const double orient_Q_score = -1, const int gap = -1 ); // pos = -1: add to end
-  void AddContigs( vector<int> contig_IDs, const int pos = -1 ); // adds a set of previously used contigs (orientation always fw)
+  void AddContigs( const vector<int> & contig_IDs, const int pos = -1 ); // adds a set of previously unused contigs (orientation always fw)
   void RemoveContig( const int pos ); // remove a contig (note that input integer is a position, not an ID!)
+  void RemoveContigs( const int pos, const int N ); // remove the N contigs at positions [pos,pos+N); this undoes AddContigs( contig_IDs, pos )
   void MoveContig( const int old_pos, const int new_pos ); // moves a contig from position old_pos to new_pos; doesn't change orientation
   void Invert( const int start ) { Invert(start,start); } // flip the order of one contig
   void Invert( const int start, const int stop ); // flip the order of the numbers in the range [start,stop]
   void InvertRandom( const int N = 1 ); // apply N random inversions via Invert()
   void PerturbRandom( const int N = 1 ); // apply N random changes: either MoveContig() or Invert()
+  // Choose a random change as PerturbRandom() does, but don't apply it, and use the random number state xsubi (see nrand48) instead of the global state, so
+  // that several threads can perturb their own orderings at once.  Returns true for Invert(start,stop), false for MoveContig(start,stop).
+  bool RandomPerturbation( unsigned short xsubi[3], int & start, int & stop ) const;
 
   // Global modifications
   void Clear(); // un-use all contigs
@@ -132,7 +136,7 @@ class ContigOrdering
 
 
   // Make a WDAG representing contig orientations in this ContigOrdering.
-  WDAG OrientationWDAG( const ChromLinkMatrix * clm ) const; // clm is used just to call ContigOrientLogLikelihood()
+  FlatWDAG OrientationWDAG( const ChromLinkMatrix * clm ) const; // clm is used just to call ContigOrientLogLikelihood()
 
 
   /* OUTPUT FUNCTIONS */
@@ -173,6 +177,30 @@ class ContigOrdering
 
 
 
+// A ShredInsertion is a view of a ContigOrdering with a "shred" of unused contigs inserted at position pos - inverted, if rc - without making the new
+// ContigOrdering.  It has the same query functions as a ContigOrdering has for the contigs' positions and orientations, so ChromLinkMatrix::OrderingScore()
+// can score the insertion directly.  To make the insertion for real, use ContigOrdering::AddContigs().  The view only holds references to the ordering and
+// the shred, so they mustn't change while it's in use.
+class ShredInsertion
+{
+ public:
+  ShredInsertion( const ContigOrdering & order, const vector<int> & shred, const int pos, const bool rc = FW )
+    : _order( order ), _shred( shred ), _pos( pos ), _rc( rc ) { assert( pos >= 0 && pos <= order.N_contigs_used() ); }
+
+  int N_contigs()      const { return _order.N_contigs(); }
+  int N_contigs_used() const { return _order.N_contigs_used() + _shred.size(); }
+  int  contig_ID( const int pos ) const { const int K = _shred.size(); return pos < _pos ? _order.contig_ID(pos) : pos < _pos + K ? _shred[ _rc ? _pos + K - 1 - pos : pos - _pos ] : _order.contig_ID(pos-K); }
+  bool contig_rc( const int pos ) const { const int K = _shred.size(); return pos < _pos ? _order.contig_rc(pos) : pos < _pos + K ? _rc : _order.contig_rc(pos-K); }
+
+ private:
+  const ContigOrdering & _order;
+  const vector<int> & _shred;
+  const int _pos;
+  const bool _rc;
+};
+
+
+
 
 
 
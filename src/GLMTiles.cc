@@ -0,0 +1,176 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+// For documentation, see GLMTiles.h
+#include "GLMTiles.h"
+
+#include <assert.h>
+#include <stdlib.h> // exit
+#include <string.h> // strerror
+#include <errno.h>
+#include <fcntl.h> // open
+#include <unistd.h> // pread, close
+#include <algorithm> // upper_bound, lower_bound, max
+#include <iostream>
+
+
+
+// Constructor: Open the file, read in the row pointers, and divide the rows into tiles.
+GLMTileCache::GLMTileCache( const string & GLM_file, const size_t N_rows, const uint64_t N_nonzero,
+			    const size_t row_ptr_offset, const size_t col_offset, const size_t value_offset, const size_t value_size, const size_t memory_budget )
+  : _file( GLM_file ),
+    _col_offset( col_offset ),
+    _value_offset( value_offset ),
+    _value_size( value_size ),
+    _memory_budget( memory_budget ),
+    _memory_used( 0 )
+{
+  assert( value_size == sizeof(int64_t) || value_size == sizeof(uint32_t) );
+  _fd = open( GLM_file.c_str(), O_RDONLY );
+  if ( _fd == -1 ) {
+    cerr << "ERROR: GLMTileCache: can't open file " << GLM_file << ": " << strerror( errno ) << endl;
+    exit(1);
+  }
+
+  _row_ptr.resize( N_rows+1 );
+  ReadBytes( _row_ptr.data(), _row_ptr.size() * sizeof(uint64_t), row_ptr_offset );
+  assert( _row_ptr[0] == 0 );
+  assert( _row_ptr[N_rows] == N_nonzero );
+
+  // Make the tiles.  Each nonzero element takes 16 bytes in memory (a column ID and a value), so a tile of a quarter of the budget holds this many elements.
+  // A single row with more elements than this gets a tile of its own.
+  const uint64_t tile_N_nonzero = max( memory_budget / 4 / ( sizeof(size_t) + sizeof(int64_t) ), size_t(1) );
+  _tile_starts.push_back( 0 );
+  for ( size_t i = 0; i < N_rows; i++ )
+    if ( _row_ptr[i+1] - _row_ptr[ _tile_starts.back() ] >= tile_N_nonzero )
+      _tile_starts.push_back( i+1 );
+  if ( _tile_starts.back() != N_rows ) _tile_starts.push_back( N_rows );
+
+  Tile empty;
+  empty.loaded = false;
+  _tiles.resize( N_tiles(), empty );
+
+  cout << "GLMTileCache: " << N_rows << " rows, " << N_nonzero << " nonzero elements, in " << N_tiles() << " tiles, with a memory budget of "
+       << ( memory_budget >> 20 ) << " MB" << endl;
+}
+
+
+
+GLMTileCache::~GLMTileCache()
+{
+  close( _fd );
+}
+
+
+
+
+// tile: Return the rows in tile #t.  If the tile isn't in memory, read it in, dropping the least recently used tiles to make room for it.
+GLMRows
+GLMTileCache::tile( const size_t t )
+{
+  assert( t < N_tiles() );
+  Tile & tile = _tiles[t];
+  const size_t begin = _tile_starts[t], end = _tile_starts[t+1];
+
+  if ( tile.loaded )
+    _LRU.splice( _LRU.begin(), _LRU, tile.LRU_pos ); // mark as most recently used
+
+  else {
+    const uint64_t first = _row_ptr[begin], N = _row_ptr[end] - first;
+    const size_t tile_size = N * ( sizeof(size_t) + sizeof(int64_t) ) + ( end - begin + 1 ) * sizeof(size_t);
+
+    // Make room for this tile.  Always keep at least this tile, even if it alone is bigger than the budget.
+    while ( !_LRU.empty() && _memory_used + tile_size > _memory_budget ) {
+      Tile & old = _tiles[ _LRU.back() ];
+      _memory_used -= old.col.size() * ( sizeof(size_t) + sizeof(int64_t) ) + old.row_ptr.size() * sizeof(size_t);
+      vector<size_t>().swap( old.row_ptr ); // free memory
+      vector<size_t>().swap( old.col );
+      vector<int64_t>().swap( old.value );
+      old.loaded = false;
+      _LRU.pop_back();
+    }
+
+    // Read the tile.  The file stores the column IDs as 32-bit ints, and in a compact file, the values too.
+    tile.row_ptr.resize( end - begin + 1 );
+    for ( size_t i = begin; i <= end; i++ )
+      tile.row_ptr[i-begin] = _row_ptr[i] - first;
+
+    vector<int32_t> col( N );
+    ReadBytes( col.data(), N * sizeof(int32_t), _col_offset + first * sizeof(int32_t) );
+    tile.col.assign( col.begin(), col.end() );
+
+    if ( _value_size == sizeof(uint32_t) ) {
+      vector<uint32_t> value( N );
+      ReadBytes( value.data(), N * sizeof(uint32_t), _value_offset + first * sizeof(uint32_t) );
+      tile.value.assign( value.begin(), value.end() );
+    }
+    else {
+      tile.value.resize( N );
+      ReadBytes( tile.value.data(), N * sizeof(int64_t), _value_offset + first * sizeof(int64_t) );
+    }
+
+    tile.loaded = true;
+    _LRU.push_front( t );
+    tile.LRU_pos = _LRU.begin();
+    _memory_used += tile_size;
+  }
+
+  GLMRows rows;
+  rows.begin = begin;
+  rows.end = end;
+  rows.row_ptr = tile.row_ptr.data();
+  rows.col = tile.col.data();
+  rows.value = tile.value.data();
+  return rows;
+}
+
+
+
+
+// at: Return the matrix element (i,j), by a binary search within row i.
+int64_t
+GLMTileCache::at( const size_t i, const size_t j )
+{
+  assert( i < N_rows() );
+  if ( _row_ptr[i] == _row_ptr[i+1] ) return 0; // empty row: no need to read it in
+
+  const size_t t = upper_bound( _tile_starts.begin(), _tile_starts.end(), i ) - _tile_starts.begin() - 1;
+  const GLMRows rows = tile(t);
+
+  const size_t * row_begin = rows.col + rows.row_ptr[ i - rows.begin ];
+  const size_t * row_end   = rows.col + rows.row_ptr[ i - rows.begin + 1 ];
+  const size_t * p = lower_bound( row_begin, row_end, j );
+  return ( p != row_end && *p == j ) ? rows.value[ p - rows.col ] : 0;
+}
+
+
+
+
+// ReadBytes: Read N bytes at this offset in the file, or throw an error and exit.
+void
+GLMTileCache::ReadBytes( void * buf, const size_t N, const size_t offset ) const
+{
+  size_t N_read = 0;
+  while ( N_read < N ) {
+    const ssize_t n = pread( _fd, static_cast<char *>( buf ) + N_read, N - N_read, offset + N_read );
+    if ( n <= 0 ) {
+      cerr << "ERROR: GLMTileCache: can't read " << N << " bytes at offset " << offset << " in file " << _file << " - it may be truncated or corrupted"
+	   << ( n < 0 ? string( ": " ) + strerror( errno ) : string( "." ) ) << endl;
+      exit(1);
+    }
+    N_read += n;
+  }
+}
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+/**************************************************************************************************************************************************************
+ *
+ * GLMTiles.h
+ *
+ * A GLMTileCache gives read access to the matrix in a binary GLM file (see GenomeLinkMatrix.cc) without loading the whole matrix into memory.  It is used by
+ * GenomeLinkMatrix's out-of-core mode, for assemblies so fragmented (or bins so small) that the matrix doesn't fit in memory.
+ *
+ * The binary GLM file stores the matrix in CSR form.  Its rows are divided into tiles: blocks of consecutive rows, each with about the same number of nonzero
+ * elements.  Tiles are read from the file as they're needed, and kept in memory until the tiles in memory would take up more than the memory budget, at
+ * which point the least recently used tiles are dropped.  Only the row pointers (8 bytes per row) are always in memory.
+ *
+ * A GLMTileCache is not thread-safe: even reading from it can change the cache.  It can't be copied; share it by pointer if necessary.
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+#ifndef _GLM_TILES__H
+#define _GLM_TILES__H
+
+#include <inttypes.h> // uint64_t, int64_t
+#include <list>
+#include <string>
+#include <vector>
+using namespace std;
+
+
+
+// GLMRows: A view of the rows [begin,end) of a matrix in CSR form.  The nonzero elements in row i are (col[k],value[k]), for k in the range
+// [ row_ptr[i-begin], row_ptr[i-begin+1] ).
+struct GLMRows
+{
+  size_t begin, end;
+  const size_t * row_ptr;
+  const size_t * col;
+  const int64_t * value;
+};
+
+
+
+class GLMTileCache
+{
+ public:
+
+  // Constructor: Open a binary GLM file whose matrix has N_rows rows and N_nonzero nonzero elements, and whose arrays (row_ptr, col, value) start at these
+  // byte offsets in the file.  Each value takes value_size bytes: 8 (int64_t), or 4 (uint32_t) in a compact GLM file.  Read in the row pointers, and
+  // divide the rows into tiles of about a quarter of memory_budget (in bytes) each.  If the file can't be read, throw an error and exit.
+  GLMTileCache( const string & GLM_file, const size_t N_rows, const uint64_t N_nonzero,
+		const size_t row_ptr_offset, const size_t col_offset, const size_t value_offset, const size_t value_size, const size_t memory_budget );
+  ~GLMTileCache();
+
+  // Query functions.
+  size_t N_rows() const { return _row_ptr.size() - 1; }
+  size_t N_tiles() const { return _tile_starts.size() - 1; }
+
+  // tile: Return the rows in tile #t, reading them in from the file if necessary.  The view is only good until the next call to tile() or at().
+  GLMRows tile( const size_t t );
+
+  // at: Return the matrix element (i,j).
+  int64_t at( const size_t i, const size_t j );
+
+
+ private:
+  GLMTileCache( const GLMTileCache & ); // not copyable
+  GLMTileCache & operator=( const GLMTileCache & );
+
+  // Read N bytes at this offset in the file, or throw an error and exit.
+  void ReadBytes( void * buf, const size_t N, const size_t offset ) const;
+
+  struct Tile {
+    bool loaded;
+    vector<size_t> row_ptr, col; // row_ptr is relative to the start of the tile
+    vector<int64_t> value;
+    list<size_t>::iterator LRU_pos; // position of this tile in _LRU, if it's loaded
+  };
+
+  string _file;
+  int _fd;
+  size_t _col_offset, _value_offset, _value_size;
+  size_t _memory_budget, _memory_used; // in bytes
+
+  vector<uint64_t> _row_ptr; // the row pointers of the whole matrix
+  vector<size_t> _tile_starts; // the first row of each tile, followed by N_rows()
+  vector<Tile> _tiles;
+  list<size_t> _LRU; // the tiles in memory, most recently used first
+};
+
+
+
+#endif
@@ -18,30 +18,39 @@
 #include "GenomeLinkMatrix.h"
 #include "TrueMapping.h"
 #include "TextFileParsers.h" // ParseTabDelimFile
+#include "MappedFile.h"
+#include "SAMIngest.h"
+#include "Parallel.h"
+#include "HiCLinks.h"
+#include "Heatmap.h"
 
 #include <sys/time.h> // struct timeval, gettimeofday
 #include <assert.h>
+#include <string.h> // memcpy, memset, strnlen
 #include <set>
 #include <map> // map, multimap
+#include <queue> // priority_queue
 #include <string>
 #include <vector>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <iomanip> // boolalpha
-#include <algorithm> // max_element
-#include <numeric> // accumulate
+#include <algorithm> // max_element, copy
+#include <numeric> // accumulate, partial_sum
 
 // Boost libraries
 #include <boost/algorithm/string.hpp> // split
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
-#include <boost/numeric/ublas/matrix_sparse.hpp> // mapped_matrix, compressed_matrix
+#include <boost/numeric/ublas/matrix_sparse.hpp> // compressed_matrix
 
 
 // Modules in ~/include (must add -L~/include and -lJ<module> to link)
 #include "TimeMem.h"
 #include "gtools/HumanGenome.h"
 #include "gtools/SAMStepper.h" // NTargetsInSAM(), TargetLengths()
+#include "khash.h"
 
 
 
@@ -127,7 +136,7 @@ GenomeLinkMatrix::GenomeLinkMatrix( const string & species, const int bin_size )
 
 
 // Load a non-de novo GenomeLinkMatrix with a set of SAM files representing human-genome alignments.  Split the GLM into bins of size bin_size.
-GenomeLinkMatrix::GenomeLinkMatrix( const vector<string> & SAM_files, const int bin_size )
+GenomeLinkMatrix::GenomeLinkMatrix( const vector<string> & SAM_files, const int bin_size, const int N_threads, const double subsample_fraction )
 {
   assert( !SAM_files.empty() );
   assert( bin_size > 0 );
@@ -165,7 +174,7 @@ GenomeLinkMatrix::GenomeLinkMatrix( const vector<string> & SAM_files, const int
 
 
   // Fill the matrix with data from the SAM files.
-  LoadFromSAMNonDeNovo( SAM_files );
+  LoadFromSAMNonDeNovo( SAM_files, N_threads, subsample_fraction );
 }
 
 
@@ -175,7 +184,34 @@ GenomeLinkMatrix::GenomeLinkMatrix( const vector<string> & SAM_files, const int
 // Load a de novo GenomeLinkMatrix with a set of SAM files representing alignments to contigs.
 // Also optionally load a list of the number of restriction sites per contig.  If a file is given, contigs' RE lengths will be used for normalization, instead
 // of their lengths in bp.
-GenomeLinkMatrix::GenomeLinkMatrix( const string & species, const vector<string> & SAM_files, const string & RE_sites_file )
+GenomeLinkMatrix::GenomeLinkMatrix( const string & species, const vector<string> & SAM_files, const string & RE_sites_file, const int N_threads,
+				    const double subsample_fraction )
+{
+  InitDeNovo( species, SAM_files, RE_sites_file );
+
+  // Fill the matrix with data from the SAM files.
+  LoadFromSAMDeNovo( SAM_files, N_threads, subsample_fraction );
+}
+
+
+
+
+// Load a de novo GenomeLinkMatrix from a HiCLinkFile, which was extracted from the SAM files.  This gives exactly the same result as loading from the SAM
+// files themselves, but it's much faster.
+GenomeLinkMatrix::GenomeLinkMatrix( const string & species, const HiCLinkFile & links, const string & RE_sites_file, const int N_threads )
+{
+  InitDeNovo( species, links.SAM_files(), RE_sites_file );
+
+  // Fill the matrix with data from the link file.
+  LoadFromLinks( links, vector<int>( _N_bins, 1 ), N_threads );
+}
+
+
+
+
+// InitDeNovo: Helper function for the de novo constructors.  Set up everything about this de novo GenomeLinkMatrix except the link data.
+void
+GenomeLinkMatrix::InitDeNovo( const string & species, const vector<string> & SAM_files, const string & RE_sites_file )
 {
   assert( !SAM_files.empty() );
   _bin_size = 0; // setting this indicates at this a de novo GLM
@@ -216,10 +252,6 @@ GenomeLinkMatrix::GenomeLinkMatrix( const string & species, const vector<string>
 
   // Create an empty matrix for these bins.
   InitMatrix();
-
-
-  // Fill the matrix with data from the SAM files.
-  LoadFromSAMDeNovo( SAM_files );
 }
 
 
@@ -233,11 +265,41 @@ static const unsigned LINE_LEN = 50000;
 
 
 
+/* The binary GLM format.  As in the binary CLM format (see ChromLinkMatrix.cc), all integers are in the native byte order of the machine that wrote the
+ * file, and every array starts on an 8-byte boundary so that the file can be mmap'ed.  The matrix is stored in CSR (compressed sparse row) form, which is
+ * the in-memory layout of a row-major ublas::compressed_matrix, so loading the file is a straight copy with no parsing.
+ *
+ *   GLMBinaryHeader                     the fixed-size header below
+ *   char     text[header_text_len]      the "# ..." header lines of the text format, zero-padded
+ *   uint64_t row_ptr[N_bins+1]          the nonzero elements in row X are elements [row_ptr[X], row_ptr[X+1]) of the next two arrays
+ *   int32_t  col[N_nonzero]             the column Y of each nonzero element, in increasing order within each row (zero-padded to 8 bytes)
+ *   int64_t  value[N_nonzero]           the number of links between bins X and Y
+ *
+ * As in the text format, the main diagonal is not stored.  A compact GLM file (see WriteFile) is written as version 2 of the format, which is the same except
+ * that value is a uint32_t array.
+ */
+static const char GLM_BINARY_MAGIC[8] = { 'L', 'A', 'C', 'H', 'G', 'L', 'M', '\0' };
+static const uint32_t GLM_BINARY_VERSION = 1;
+static const uint32_t GLM_BINARY_VERSION_COMPACT = 2;
+static const uint32_t GLM_BYTE_ORDER_MARK = 0x01020304;
+
+struct GLMBinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  int32_t N_bins;
+  int32_t bin_size;
+  uint64_t header_text_len; // padded to a multiple of 8
+  uint64_t N_nonzero;
+};
+
+
 
 // ReadFile: Read the data from file GLM_file into this GenomeLinkMatrix.
 // The file GLM_file should have been created by a previous call to GenomeLinkMatrix::WriteFile(), and needs to have a commented header as defined there.
+// It may be in either the binary or the text format.  If memory_budget > 0 and the file is binary, this GLM is out-of-core: the matrix is left in the file.
 void
-GenomeLinkMatrix::ReadFile( const string & GLM_file )
+GenomeLinkMatrix::ReadFile( const string & GLM_file, const size_t memory_budget )
 {
   cout << "GenomeLinkMatrix::ReadFile   <-  " << GLM_file << endl;
   assert( boost::filesystem::is_regular_file( GLM_file ) );
@@ -247,7 +309,41 @@ GenomeLinkMatrix::ReadFile( const string & GLM_file )
   _N_bins = -1;
   _bin_size = -1;
   _species = "";
+  _tiles.reset();
+
+  if ( FileHasMagic( GLM_file, GLM_BINARY_MAGIC, sizeof(GLM_BINARY_MAGIC) ) )
+    ReadBinaryFile( GLM_file, memory_budget );
+  else {
+    if ( memory_budget > 0 ) cerr << "WARNING: GenomeLinkMatrix::ReadFile: GLM file '" << GLM_file << "' is in the text format, so it can't be used out of core.  Loading it into memory." << endl;
+    ReadTextFile( GLM_file );
+  }
+
+
+  assert( _N_bins != -1 );
+  assert( _bin_size != -1 );
+  assert( _species != "" );
+  assert( !_SAM_files.empty() );
+
 
+  // Set the original order to identity (i.e., no rearrangement until ReorderContigsByRef() gets called.)
+  _contig_orig_order.clear();
+  for ( int i = 0; i < _N_bins; i++ )
+    _contig_orig_order.push_back(i);
+
+  _contig_skip = vector<bool>( _N_bins, false );
+
+  // If this is a de novo GLM, set the contig lengths in accordance with the SAM files.
+  if ( _bin_size == 0 )
+    _contig_lengths = TargetLengths( _SAM_files[0] );
+}
+
+
+
+
+// ReadTextFile: Helper function for ReadFile().  Read a GLM file in the text format.
+void
+GenomeLinkMatrix::ReadTextFile( const string & GLM_file )
+{
   char line[LINE_LEN];
   vector<string> tokens;
 
@@ -261,35 +357,8 @@ GenomeLinkMatrix::ReadFile( const string & GLM_file )
     assert( strlen(line)+1 < LINE_LEN );
     if ( in.fail() ) break;
 
-    // If this is a header line, look for useful data in it.  These header lines were generated in GenomeLinkMatrix::WriteFile, below.
-    if ( line[0] == '#' ) {
-      boost::split( tokens, line, boost::is_any_of(" ") );
-      assert( tokens.size() > 3 );
-
-      if ( tokens[1] == "Species" ) // line: "# species = human"
-	_species = tokens[3];
-
-      else if ( tokens[1] == "N_bins" ) { // line: "# N_bins = 1"
-	_N_bins = boost::lexical_cast<int>( tokens[3] );
-	cout << "N_bins = " << _N_bins << endl;
-	InitMatrix();
-      }
-
-      else if ( tokens[1] == "bin_size" ) // line: "# bin_size = 1"
-	_bin_size = boost::lexical_cast<int>( tokens[3] );
-
-      else if ( tokens[1] == "RE_sites_file" ) { // line: "# RE_sites_file = <filename>"
-	if ( !boost::filesystem::is_regular_file( tokens[3] ) ) {
-	  cout << "ERROR: Trying to load RE sites file that doesn't seem to exist.  You need to create the following file: " << tokens[3] << endl;
-	  cout << "Try running `CountMotifsInFasta.pl <ref fasta> <RE motif>`.\n";
-	}
-	LoadRESitesFile( tokens[3] );
-      }
-
-      else if ( tokens[1] == "SAM" ) // line: "# SAM files used in generating this dataset: test.sam"
-	for ( size_t i = 8; i < tokens.size(); i++ )
-	  _SAM_files.push_back( tokens[i] );
-    }
+    // If this is a header line, look for useful data in it.  These header lines were generated in GenomeLinkMatrix::FileHeader, below.
+    if ( line[0] == '#' ) ReadHeaderLine( line );
 
     else if ( line[0] == 'X' ) continue; // skip the header line of the matrix itself
 
@@ -308,25 +377,105 @@ GenomeLinkMatrix::ReadFile( const string & GLM_file )
   }
 
   in.close();
+}
 
 
 
-  assert( _N_bins != -1 );
-  assert( _bin_size != -1 );
-  assert( _species != "" );
-  assert( !_SAM_files.empty() );
 
+// ReadBinaryFile: Helper function for ReadFile().  Read a GLM file in the binary format (see above).  The file is mmap'ed, and its CSR arrays are copied
+// directly into the arrays underlying _matrix.  Or, if memory_budget > 0, the arrays are left in the file, to be read in a tile at a time by a GLMTileCache.
+void
+GenomeLinkMatrix::ReadBinaryFile( const string & GLM_file, const size_t memory_budget )
+{
+  const MappedFile file( GLM_file );
+  const GLMBinaryHeader & header = *file.at<GLMBinaryHeader>(0);
 
-  // Set the original order to identity (i.e., no rearrangement until ReorderContigsByRef() gets called.)
-  _contig_orig_order.clear();
-  for ( int i = 0; i < _N_bins; i++ )
-    _contig_orig_order.push_back(i);
+  if ( header.byte_order != GLM_BYTE_ORDER_MARK ) {
+    cerr << "ERROR: GenomeLinkMatrix::ReadFile: GLM file '" << GLM_file << "' was written on a machine with a different byte order.  Re-create it with OVERWRITE_GLM = 1." << endl;
+    exit(1);
+  }
+  if ( header.version != GLM_BINARY_VERSION && header.version != GLM_BINARY_VERSION_COMPACT ) {
+    cerr << "ERROR: GenomeLinkMatrix::ReadFile: GLM file '" << GLM_file << "' has format version " << header.version << ", but this version of Lachesis reads versions " << GLM_BINARY_VERSION << " and " << GLM_BINARY_VERSION_COMPACT << ".  Re-create it with OVERWRITE_GLM = 1." << endl;
+    exit(1);
+  }
+  const bool compact = header.version == GLM_BINARY_VERSION_COMPACT;
+
+  // Parse the header lines, exactly as in the text format.  One of these lines sets _N_bins and calls InitMatrix().
+  size_t offset = sizeof(GLMBinaryHeader);
+  const char * text = file.at<char>( offset, header.header_text_len );
+  vector<string> lines;
+  string header_text( text, strnlen( text, header.header_text_len ) );
+  boost::split( lines, header_text, boost::is_any_of("\n") );
+  for ( size_t i = 0; i < lines.size(); i++ )
+    if ( !lines[i].empty() && lines[i][0] == '#' ) ReadHeaderLine( lines[i] );
+  offset += header.header_text_len;
+  assert( _N_bins == header.N_bins );
+  assert( _bin_size == header.bin_size );
+
+  // Find the arrays.
+  const uint64_t N = header.N_nonzero;
+  const size_t row_ptr_offset = offset;
+  const uint64_t * row_ptr = file.at<uint64_t>( offset, _N_bins+1 );
+  offset += ( _N_bins+1 ) * sizeof(uint64_t);
+  const size_t col_offset = offset;
+  const int32_t * col = file.at<int32_t>( offset, N );
+  offset += PadTo8( N * sizeof(int32_t) );
+  const size_t value_offset = offset;
+  const size_t value_size = compact ? sizeof(uint32_t) : sizeof(int64_t);
+  const char * value = file.at<char>( offset, N * value_size );
+  assert( row_ptr[0] == 0 );
+  assert( row_ptr[_N_bins] == N );
+
+  // Out of core, leave the arrays in the file.  (The pages of the mapping that were never touched are never read in.)
+  if ( memory_budget > 0 ) {
+    _tiles.reset( new GLMTileCache( GLM_file, _N_bins, N, row_ptr_offset, col_offset, value_offset, value_size, memory_budget ) );
+    return;
+  }
 
-  _contig_skip = vector<bool>( _N_bins, false );
+  // Copy the arrays into the matrix.  This is legal because a row-major compressed_matrix stores its data in exactly this form.
+  cout << "Loading matrix data..." << endl;
+  _matrix.reserve( N, false );
+  copy( row_ptr, row_ptr + _N_bins+1, _matrix.index1_data().begin() );
+  copy( col,     col + N,             _matrix.index2_data().begin() );
+  if ( compact ) copy( (const uint32_t *) value, (const uint32_t *) value + N, _matrix.value_data().begin() );
+  else           copy( (const int64_t *)  value, (const int64_t *)  value + N, _matrix.value_data().begin() );
+  _matrix.set_filled( _N_bins+1, N );
+}
 
-  // If this is a de novo GLM, set the contig lengths in accordance with the SAM files.
-  if ( _bin_size == 0 )
-    _contig_lengths = TargetLengths( _SAM_files[0] );
+
+
+
+// ReadHeaderLine: Helper function for ReadFile().  Parse one of the "# ..." header lines generated by FileHeader().
+void
+GenomeLinkMatrix::ReadHeaderLine( const string & line )
+{
+  vector<string> tokens;
+  boost::split( tokens, line, boost::is_any_of(" ") );
+  assert( tokens.size() > 3 );
+
+  if ( tokens[1] == "Species" ) // line: "# species = human"
+    _species = tokens[3];
+
+  else if ( tokens[1] == "N_bins" ) { // line: "# N_bins = 1"
+    _N_bins = boost::lexical_cast<int>( tokens[3] );
+    cout << "N_bins = " << _N_bins << endl;
+    InitMatrix();
+  }
+
+  else if ( tokens[1] == "bin_size" ) // line: "# bin_size = 1"
+    _bin_size = boost::lexical_cast<int>( tokens[3] );
+
+  else if ( tokens[1] == "RE_sites_file" ) { // line: "# RE_sites_file = <filename>"
+    if ( !boost::filesystem::is_regular_file( tokens[3] ) ) {
+      cout << "ERROR: Trying to load RE sites file that doesn't seem to exist.  You need to create the following file: " << tokens[3] << endl;
+      cout << "Try running `CountMotifsInFasta.pl <ref fasta> <RE motif>`.\n";
+    }
+    LoadRESitesFile( tokens[3] );
+  }
+
+  else if ( tokens[1] == "SAM" ) // line: "# SAM files used in generating this dataset: test.sam"
+    for ( size_t i = 8; i < tokens.size(); i++ )
+      _SAM_files.push_back( tokens[i] );
 }
 
 
@@ -335,17 +484,25 @@ GenomeLinkMatrix::ReadFile( const string & GLM_file )
 
 
 // WriteFile: Write the data in this GenomeLinkMatrix to file GLM_file.
-// The output format is a long tall table with (_N_bins^2) rows and three columns: X, Y, Z.  X and Y are bin IDs; Z is the value in the bin.
-// It's printed as a "sparse matrix", so that lines with Z=0 are not printed.
-// This format is designed for easy input to GenomeLinkMatrix::ReadFile(), or to R and Perl.  (NOTE: R and Perl may not like the new sparse-matrix format.)
+// By default the file is in the binary format (see above), which is much faster to read.  If text = true, the file is in the text format (see WriteTextFile).
+// If compact = true, the binary file is in the compact format, which is about a third smaller.
 void
-GenomeLinkMatrix::WriteFile( const string & GLM_file ) const
+GenomeLinkMatrix::WriteFile( const string & GLM_file, const bool text, const bool compact ) const
 {
   cout << "GenomeLinkMatrix::WriteFile  ->  " << GLM_file << endl;
 
-  ofstream out( GLM_file.c_str(), ios::out );
+  if ( text ) WriteTextFile( GLM_file );
+  else        WriteBinaryFile( GLM_file, compact );
+}
+
 
-  // Print a header to file.  The header is for easier human reading and also contains numbers used by GenomeLinkMatrix::ReadFile().
+
+
+// FileHeader: Helper function for WriteFile().  The header is for easier human reading and also contains numbers used by GenomeLinkMatrix::ReadFile().
+string
+GenomeLinkMatrix::FileHeader() const
+{
+  ostringstream out;
   out << "# GenomeLinkMatrix file - see GenomeLinkMatrix.h for documentation of this object type" << endl;
   out << "# Species = " << _species << endl;
   out << "# N_bins = " << _N_bins << endl;
@@ -355,19 +512,38 @@ GenomeLinkMatrix::WriteFile( const string & GLM_file ) const
   for ( size_t i = 0; i < _SAM_files.size(); i++ )
     out << " " << _SAM_files[i];
   out << endl;
+  return out.str();
+}
+
+
+
 
-  // Print the table to file.
+// WriteTextFile: Helper function for WriteFile().
+// The output format is a long tall table with (_N_bins^2) rows and three columns: X, Y, Z.  X and Y are bin IDs; Z is the value in the bin.
+// It's printed as a "sparse matrix", so that lines with Z=0 are not printed.
+// This format is designed for easy input to GenomeLinkMatrix::ReadFile(), or to R and Perl.  (NOTE: R and Perl may not like the new sparse-matrix format.)
+void
+GenomeLinkMatrix::WriteTextFile( const string & GLM_file ) const
+{
+  ofstream out( GLM_file.c_str(), ios::out );
+
+  // Print a header to file.
+  out << FileHeader();
+
+  // Print the table to file.  Only visit the elements that are actually stored in the sparse matrix; the rest are 0 anyway.
   out << "X\tY\tZ" << endl;
-  for ( int x = 0; x < _N_bins; x++ )
-    for ( int y = 0; y < _N_bins; y++ ) {
+  ForEachRowBlock( [&]( const GLMRows & rows ) {
+      for ( size_t i = rows.begin; i < rows.end; i++ )
+	for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ ) {
 
-      // Skip the main diagonal.  We don't need this data in our histogram because we're interested in links *between* bins, not within a bin.
-      if ( x == y ) continue;
+	  // Skip the main diagonal.  We don't need this data in our histogram because we're interested in links *between* bins, not within a bin.
+	  if ( rows.col[k] == i ) continue;
 
-      // Also skip empty bins.  This makes the matrix sparse.
-      if ( _matrix(x,y) == 0 ) continue;
-      out << x << '\t' << y << '\t' << _matrix(x,y) << endl;
-    }
+	  // Also skip empty bins.  This makes the matrix sparse.
+	  if ( rows.value[k] == 0 ) continue;
+	  out << i << '\t' << rows.col[k] << '\t' << rows.value[k] << endl;
+	}
+    } );
 
   out.close();
 }
@@ -375,6 +551,84 @@ GenomeLinkMatrix::WriteFile( const string & GLM_file ) const
 
 
 
+// WriteBinaryFile: Helper function for WriteFile().  Write the binary format described above.
+// The matrix is read three times over: once to count the nonzero off-diagonal elements in each row, and then once for each of the col and value arrays.  So
+// the arrays are written out a block of rows at a time, and an out-of-core GLM is never all in memory.
+void
+GenomeLinkMatrix::WriteBinaryFile( const string & GLM_file, bool compact ) const
+{
+  // Find the row pointers of the nonzero off-diagonal elements in CSR form.  Also check whether the values fit in the compact format.
+  vector<uint64_t> row_ptr( _N_bins+1, 0 );
+  bool values_fit = true;
+  ForEachRowBlock( [&]( const GLMRows & rows ) {
+      for ( size_t i = rows.begin; i < rows.end; i++ )
+	for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ )
+	  if ( rows.col[k] != i && rows.value[k] != 0 ) {
+	    row_ptr[i+1]++;
+	    if ( rows.value[k] < 0 || rows.value[k] > UINT32_MAX ) values_fit = false;
+	  }
+    } );
+  for ( int i = 0; i < _N_bins; i++ )
+    row_ptr[i+1] += row_ptr[i];
+  const uint64_t N = row_ptr[_N_bins];
+
+  if ( compact && !values_fit ) {
+    cerr << "WARNING: GenomeLinkMatrix::WriteFile: some of the values in this GLM don't fit in 32 bits, so GLM file '" << GLM_file << "' can't be compact." << endl;
+    compact = false;
+  }
+
+  const string header_text = FileHeader();
+
+  GLMBinaryHeader header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, GLM_BINARY_MAGIC, sizeof(GLM_BINARY_MAGIC) );
+  header.version = compact ? GLM_BINARY_VERSION_COMPACT : GLM_BINARY_VERSION;
+  header.byte_order = GLM_BYTE_ORDER_MARK;
+  header.N_bins = _N_bins;
+  header.bin_size = _bin_size;
+  header.header_text_len = PadTo8( header_text.size() + 1 ); // include at least one terminating '\0'
+  header.N_nonzero = N;
+
+  ofstream out( GLM_file.c_str(), ios::out | ios::binary );
+  out.write( reinterpret_cast<const char *>( &header ), sizeof(header) );
+  out.write( header_text.c_str(), header_text.size() + 1 );
+  WritePadding( out, header_text.size() + 1 );
+  out.write( reinterpret_cast<const char *>( row_ptr.data() ), row_ptr.size() * sizeof(uint64_t) );
+
+  vector<int32_t> col;
+  ForEachRowBlock( [&]( const GLMRows & rows ) {
+      col.clear();
+      for ( size_t i = rows.begin; i < rows.end; i++ )
+	for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ )
+	  if ( rows.col[k] != i && rows.value[k] != 0 ) col.push_back( rows.col[k] );
+      out.write( reinterpret_cast<const char *>( col.data() ), col.size() * sizeof(int32_t) );
+    } );
+  WritePadding( out, N * sizeof(int32_t) );
+
+  vector<int64_t> value;
+  vector<uint32_t> value32;
+  ForEachRowBlock( [&]( const GLMRows & rows ) {
+      value.clear();
+      for ( size_t i = rows.begin; i < rows.end; i++ )
+	for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ )
+	  if ( rows.col[k] != i && rows.value[k] != 0 ) value.push_back( rows.value[k] );
+      if ( compact ) {
+	value32.assign( value.begin(), value.end() );
+	out.write( reinterpret_cast<const char *>( value32.data() ), value32.size() * sizeof(uint32_t) );
+      }
+      else out.write( reinterpret_cast<const char *>( value.data() ), value.size() * sizeof(int64_t) );
+    } );
+
+  if ( !out ) {
+    cerr << "ERROR: GenomeLinkMatrix::WriteFile: failed to write GLM file '" << GLM_file << "'" << endl;
+    exit(1);
+  }
+  out.close();
+}
+
+
+
+
 
 // LoadForSAMDeNovo: A wrapper for LoadFromSAM for de novo GLMs.
 void
@@ -382,22 +636,23 @@ GenomeLinkMatrix::LoadFromSAMDeNovo( const string & SAM_file )
 {
   assert( DeNovo() ); // this indicates that the input contigs aren't split into bins
   assert( _N_bins > 0 );
-  LoadFromSAM( SAM_file, vector<int>( _N_bins, 1 ) );
+  LoadFromSAM( vector<string>( 1, SAM_file ), vector<int>( _N_bins, 1 ), 1, 1 );
 }
 
 
 
-// This multi-SAM-file function is a wrapper for the one-SAM-file function.
+// The multi-SAM-file version reads the SAM files in parallel, using up to N_threads threads.
 void
-GenomeLinkMatrix::LoadFromSAMDeNovo( const vector<string> & SAM_files )
+GenomeLinkMatrix::LoadFromSAMDeNovo( const vector<string> & SAM_files, const int N_threads, const double subsample_fraction )
 {
   // Check the existence of *all* of the files, before taking the time to load in *any* of the files.
   assert( !SAM_files.empty() );
   for ( size_t i = 0; i < SAM_files.size(); i++ )
     assert( boost::filesystem::is_regular_file( SAM_files[i] ) );
 
-  for ( size_t i = 0; i < SAM_files.size(); i++ )
-    LoadFromSAMDeNovo( SAM_files[i] );
+  assert( DeNovo() ); // this indicates that the input contigs aren't split into bins
+  assert( _N_bins > 0 );
+  LoadFromSAM( SAM_files, vector<int>( _N_bins, 1 ), N_threads, subsample_fraction );
 }
 
 
@@ -411,22 +666,23 @@ GenomeLinkMatrix::LoadFromSAMNonDeNovo( const string & SAM_file )
 {
   assert( _species == "human" );
   assert( !DeNovo() );
-  LoadFromSAM( SAM_file, BinsPerChromInHumanGenome() );
+  LoadFromSAM( vector<string>( 1, SAM_file ), BinsPerChromInHumanGenome(), 1, 1 );
 }
 
 
 
-// This multi-SAM-file function is a wrapper for the one-SAM-file function.
+// The multi-SAM-file version reads the SAM files in parallel, using up to N_threads threads.
 void
-GenomeLinkMatrix::LoadFromSAMNonDeNovo( const vector<string> & SAM_files )
+GenomeLinkMatrix::LoadFromSAMNonDeNovo( const vector<string> & SAM_files, const int N_threads, const double subsample_fraction )
 {
   // Check the existence of *all* of the files, before taking the time to load in *any* of the files.
   assert( !SAM_files.empty() );
   for ( size_t i = 0; i < SAM_files.size(); i++ )
     assert( boost::filesystem::is_regular_file( SAM_files[i] ) );
 
-  for ( size_t i = 0; i < SAM_files.size(); i++ )
-    LoadFromSAMNonDeNovo( SAM_files[i] );
+  assert( _species == "human" );
+  assert( !DeNovo() );
+  LoadFromSAM( SAM_files, BinsPerChromInHumanGenome(), N_threads, subsample_fraction );
 }
 
 
@@ -435,6 +691,80 @@ GenomeLinkMatrix::LoadFromSAMNonDeNovo( const vector<string> & SAM_files )
 
 
 
+// NormalizedLinks, DividedLinks: The arithmetic done on each matrix element by NormalizeToDeNovoContigLengths() and SkipRepeats(), respectively.
+// Out-of-core GLMs do this arithmetic as each element is read in (see LazyLink), so it's kept here, in one place, to make sure the numbers come out exactly
+// the same as in memory.  Only nonzero elements are changed.
+static inline int64_t
+NormalizedLinks( const int64_t N_links, const int64_t longest_squared, const int len1, const int len2 )
+{
+  if ( N_links == 0 ) return 0;
+  return N_links * longest_squared / double( (int64_t) len1 * (int64_t) len2 );
+}
+
+static inline int64_t
+DividedLinks( const int64_t N_links, const double factor )
+{
+  if ( N_links == 0 ) return 0;
+  return N_links / factor;
+}
+
+
+
+// RewriteMatrix: Replace each element (i,j) of this compressed matrix with f(i,j,value), and if new_ID != NULL, move it to ( new_ID[i], new_ID[j] ).  The rows
+// are split among up to N_threads threads.  f() is given the old indices, and must be safe to call from several threads at once.
+// Without new_ID, the values are changed in place.  With it, the rows are moved by a counting sort: each new row is the same size as the old row that's moved
+// there, so the new row pointers are a prefix sum of the old row sizes.  Then each old row is copied into its new place, and sorted by its new column IDs.
+template<class F> static void
+RewriteMatrix( boost::numeric::ublas::compressed_matrix<int64_t> & matrix, const int N_bins, const vector<int> * new_ID, const F & f, const int N_threads )
+{
+  const size_t N_rows = min( (size_t) N_bins, (size_t) matrix.filled1() - 1 ); // rows past index1_data()[filled1()-1] are empty
+  const size_t * row_ptr = &matrix.index1_data()[0];
+  const size_t * col = &matrix.index2_data()[0];
+  int64_t * value = &matrix.value_data()[0];
+  const size_t N = row_ptr[N_rows];
+  const int N_blocks = min( NThreadsToUse( N_threads ), max( N_bins, 1 ) );
+
+  if ( !new_ID ) {
+    ParallelForRanges( N_rows, N_blocks, [&]( const int, const size_t begin, const size_t end ) {
+	for ( size_t i = begin; i < end; i++ )
+	  for ( size_t k = row_ptr[i]; k < row_ptr[i+1]; k++ )
+	    value[k] = f( i, col[k], value[k] );
+      } );
+    return;
+  }
+
+  vector<size_t> new_row_ptr( N_bins+1, 0 );
+  for ( size_t i = 0; i < N_rows; i++ )
+    new_row_ptr[ (*new_ID)[i] + 1 ] = row_ptr[i+1] - row_ptr[i];
+  partial_sum( new_row_ptr.begin(), new_row_ptr.end(), new_row_ptr.begin() );
+  assert( new_row_ptr[N_bins] == N );
+
+  vector<size_t> new_col( N );
+  vector<int64_t> new_value( N );
+  ParallelForRanges( N_rows, N_blocks, [&]( const int, const size_t begin, const size_t end ) {
+      vector< pair<size_t,int64_t> > row;
+      for ( size_t i = begin; i < end; i++ ) {
+	row.clear();
+	for ( size_t k = row_ptr[i]; k < row_ptr[i+1]; k++ )
+	  row.push_back( make_pair( (*new_ID)[ col[k] ], f( i, col[k], value[k] ) ) );
+	sort( row.begin(), row.end() ); // the column IDs are unique, so this sorts by column
+	size_t p = new_row_ptr[ (*new_ID)[i] ];
+	for ( size_t k = 0; k < row.size(); k++, p++ ) {
+	  new_col[p] = row[k].first;
+	  new_value[p] = row[k].second;
+	}
+      }
+    } );
+
+  // Put the new arrays into the matrix.  This is legal because a row-major compressed_matrix stores its data in exactly this form (as in ReadBinaryFile).
+  copy( new_row_ptr.begin(), new_row_ptr.end(), matrix.index1_data().begin() );
+  copy( new_col.begin(), new_col.end(), matrix.index2_data().begin() );
+  copy( new_value.begin(), new_value.end(), matrix.value_data().begin() );
+  matrix.set_filled( N_bins+1, N );
+}
+
+
+
 // NormalizeToDeNovoContigLengths: In a de novo GLM, adjust the matrix data to account for the fact that some bins are smaller.
 void
 GenomeLinkMatrix::NormalizeToDeNovoContigLengths( const bool use_RE_sites )
@@ -458,14 +788,17 @@ GenomeLinkMatrix::NormalizeToDeNovoContigLengths( const bool use_RE_sites )
   int64_t longest_squared = longest_contig * longest_contig;
 
 
+  // Out of core, the matrix can't be changed, so just record the normalization; it will be applied to each element as it's read in (see LazyLink).
+  if ( _tiles ) {
+    _lazy_longest_squared = longest_squared;
+    _lazy_use_RE_sites = use_RE_sites;
+    return;
+  }
+
   // Now, normalize!  The math is performed in a single step for each bin, to minimize the effect of rounding error.
-  for ( int i = 0; i < _N_bins; i++ )
-    for ( int j = 0; j < _N_bins; j++ )
-      if ( _matrix(i,j) != 0 ) {
-	//cout << "DEBUG:\ti = " << i << "\tj = " << j << "\tmatrix = " << _matrix(i,j) << "\tlongest_squared = " << longest_squared << "\tlen[i] = " << lens[i] << "\tlen[j] = " << lens[j] << "\t-> RESULT: ";
-	_matrix(i,j) = _matrix(i,j) * longest_squared / double( (int64_t) lens[i] * (int64_t) lens[j] );
-	//cout << _matrix(i,j) << endl;
-      }
+  // Only the elements that are actually stored in the sparse matrix are visited; the rest are 0 anyway.
+  RewriteMatrix( _matrix, _N_bins, NULL,
+		 [&]( const size_t i, const size_t j, const int64_t x ) { return NormalizedLinks( x, longest_squared, lens[i], lens[j] ); }, 1 );
 }
 
 
@@ -481,6 +814,23 @@ void
 GenomeLinkMatrix::ReorderContigsByRef( TrueMapping & true_mapping )
 {
   cout << "ReorderContigsByRef" << endl;
+  const vector<int> contig_order = ReorderBinsByRef( true_mapping );
+
+  // Convert the link matrix to the new ordering.
+  RewriteMatrix( _matrix, _N_bins, &contig_order, []( const size_t, const size_t, const int64_t x ) { return x; }, 1 );
+}
+
+
+
+// ReorderBinsByRef: Helper for ReorderContigsByRef() and Preprocess().  Do everything ReorderContigsByRef() does, except for the matrix itself - that's left
+// to the caller.  Return the new ID of each contig.
+vector<int>
+GenomeLinkMatrix::ReorderBinsByRef( TrueMapping & true_mapping )
+{
+  if ( _tiles ) {
+    cerr << "ERROR: GenomeLinkMatrix::ReorderContigsByRef: can't reorder an out-of-core GenomeLinkMatrix." << endl;
+    exit(1);
+  }
 
   // Get the full ordering of the contigs on reference.
   vector<int> contig_order = true_mapping.QueriesToGenomeOrder();
@@ -490,21 +840,6 @@ GenomeLinkMatrix::ReorderContigsByRef( TrueMapping & true_mapping )
   // Update the TrueMapping.
   true_mapping.ReorderQueries( contig_order );
 
-
-
-  // Convert the link matrix to the new ordering.  This can be time-consuming for large matrices.
-  // The use of iterators here follows the example at: http://www.guwi17.de/ublas/matrix_sparse_usage.html#Q1
-  boost::numeric::ublas::mapped_matrix<int64_t> new_matrix( _N_bins, _N_bins );
-
-  boost::numeric::ublas::compressed_matrix<int64_t>::const_iterator1 it1;
-  boost::numeric::ublas::compressed_matrix<int64_t>::const_iterator2 it2;
-
-  for ( it1 = _matrix.begin1(); it1 != _matrix.end1(); ++it1 )
-    for ( it2 = it1.begin(); it2 != it1.end(); ++it2 )
-      new_matrix( contig_order[ it2.index1() ], contig_order[ it2.index2() ] ) = *it2;
-
-  _matrix = new_matrix;
-
   // Convert the _contig_lengths, _contig_RE_sites, and _contig_skip vectors to the new ordering.
   vector<int>  old_contig_lengths  = _contig_lengths;
   vector<int>  old_contig_RE_sites = _contig_RE_sites;
@@ -516,6 +851,7 @@ GenomeLinkMatrix::ReorderContigsByRef( TrueMapping & true_mapping )
     _contig_skip      [ contig_order[i] ] = old_contig_skip[i];
   }
 
+  return contig_order;
 }
 
 
@@ -578,23 +914,46 @@ void
 GenomeLinkMatrix::SkipRepeats( const double & repeat_multiplicity, const bool flip )
 {
   cout << "SkipRepeats with repeat_multiplicity = " << repeat_multiplicity << ", flip = " << noboolalpha << flip << endl;
-  bool verbose = false;
 
   // Find the number of Hi-C links on each contig.  This is as simple as adding rows/columns in the matrix.  Also calculate the total sum.
-  // The use of iterators here follows the example at: http://www.guwi17.de/ublas/matrix_sparse_usage.html#Q1
+  // Only the elements that are actually stored in the sparse matrix are visited; the rest are 0 anyway.
   int64_t N_links_total = 0;
   vector<int64_t> N_links( _N_bins, 0 );
 
-  boost::numeric::ublas::compressed_matrix<int64_t>::const_iterator1 it1;
-  boost::numeric::ublas::compressed_matrix<int64_t>::const_iterator2 it2;
-  for ( it1 = _matrix.begin1(); it1 != _matrix.end1(); ++it1 )
-    for ( it2 = it1.begin(); it2 != it1.end(); ++it2 ) {
-      N_links_total           += _matrix( it2.index1(), it2.index2() );
-      N_links[ it2.index1() ] += _matrix( it2.index1(), it2.index2() );
-      N_links[ it2.index2() ] += _matrix( it2.index1(), it2.index2() );
+  ForEachRowBlock( [&]( const GLMRows & rows ) {
+      for ( size_t i = rows.begin; i < rows.end; i++ )
+	for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ ) {
+	  N_links_total          += rows.value[k];
+	  N_links[i]             += rows.value[k];
+	  N_links[ rows.col[k] ] += rows.value[k];
+	}
+    } );
+
+  vector<double> factors = RepeatFactors( N_links, N_links_total, repeat_multiplicity );
+
+  // Adjust all link densities by their repetitiveness factors.  This mitigates the effect of mappability and repeat-mediated mapping variation.
+  // Out of core, just record the factors; they will be applied to each element as it's read in (see LazyLink).
+  if ( _tiles ) {
+    if ( !_lazy_repeat_factors.empty() ) {
+      cerr << "ERROR: GenomeLinkMatrix::SkipRepeats: can't be called twice on an out-of-core GenomeLinkMatrix." << endl;
+      exit(1);
     }
+    _lazy_repeat_factors = factors;
+  }
+  else
+    RewriteMatrix( _matrix, _N_bins, NULL, [&]( const size_t i, const size_t, const int64_t x ) { return DividedLinks( x, factors[i] ); }, 1 );
+}
+
 
 
+// RepeatFactors: Helper for SkipRepeats() and Preprocess().  Given the number of Hi-C links on each contig (N_links) and in the whole matrix (N_links_total),
+// find each contig's repetitiveness factor: the number of links it contains, divided by average.  Mark the contigs whose factor is at least
+// repeat_multiplicity for skipping, and return the factors.
+vector<double>
+GenomeLinkMatrix::RepeatFactors( const vector<int64_t> & N_links, const int64_t N_links_total, const double & repeat_multiplicity )
+{
+  bool verbose = false;
+
   // Calculate how many links should be used as a threshold in determining whether a contig is repetitive.
   double N_links_avg = 2.0 * N_links_total / _N_bins;
   if ( verbose ) {
@@ -610,13 +969,10 @@ GenomeLinkMatrix::SkipRepeats( const double & repeat_multiplicity, const bool fl
 
 
   // Find the repetitiveness factor for each contig: the number of links it contains, divided by average.
+  vector<double> factors( _N_bins );
   for ( int i = 0; i < _N_bins; i++ ) {
     double factor = N_links[i] / N_links_avg;
-
-    // Adjust all link densities by their repetitiveness factors.  This mitigates the effect of mappability and repeat-mediated mapping variation.
-    for ( int j = 0; j < _N_bins; j++ )
-      if ( _matrix(i,j) != 0 )
-	_matrix(i,j) /= factor;
+    factors[i] = factor;
 
     // Regions that are too repetitive can't be trusted, so skip them entirely.
     if ( factor >= repeat_multiplicity ) {
@@ -631,6 +987,93 @@ GenomeLinkMatrix::SkipRepeats( const double & repeat_multiplicity, const bool fl
 
   // The number of contigs reported as repetitive includes contigs that may have already been marked for skipping, e.g., by SkipShortContigs().
   cout << "Marked " << N_repetitive << " contigs (avg length " << avg_len << ") as too repetitive to inform clustering (CLUSTER_MAX_LINK_DENSITY = " << repeat_multiplicity << ")." << endl;
+
+  return factors;
+}
+
+
+
+
+// Preprocess: Do the pre-processing of a de novo GLM before clustering.  This is exactly equivalent to calling NormalizeToDeNovoContigLengths(),
+// ReorderContigsByRef() (if there's a TrueMapping), SkipContigsWithFewREs(), and SkipRepeats(), in that order; but instead of five passes over the matrix
+// (one of which built the whole matrix over again), it makes two, and they're split across up to N_threads threads:
+// 1. Normalize each element in place, and add it into the number of links on its contigs (for SkipRepeats).  Each thread adds up its own rows' links, and
+//    keeps its own tally of the links in each column; the tallies are added together at the end.  The sums are of integers, so the result is the same no
+//    matter how many threads are used.
+// 2. Move each element to its new place (if there's a TrueMapping), and divide it by its row's repetitiveness factor.
+// Out of core, the normalizations are only recorded anyway (see LazyLink), so this just calls the functions in order.
+void
+GenomeLinkMatrix::Preprocess( const bool use_RE_sites, TrueMapping * true_mapping, const int min_N_REs, const double repeat_multiplicity, const int N_threads )
+{
+  if ( _tiles ) {
+    NormalizeToDeNovoContigLengths( use_RE_sites );
+    if ( true_mapping ) ReorderContigsByRef( *true_mapping );
+    SkipContigsWithFewREs( min_N_REs );
+    SkipRepeats( repeat_multiplicity );
+    return;
+  }
+
+  cout << "Preprocess: NormalizeToDeNovoContigLengths" << ( use_RE_sites ? " (using RE sites)" : " (using lengths in bp)" ) << ( true_mapping ? ", ReorderContigsByRef" : "" )
+       << ", SkipContigsWithFewREs with min_N_REs = " << min_N_REs << ", SkipRepeats with repeat_multiplicity = " << repeat_multiplicity << endl;
+
+  // Checks and normalization factors, as in NormalizeToDeNovoContigLengths().
+  assert( DeNovo() );
+  assert( !_normalized );
+  _normalized = true;
+  if ( use_RE_sites ) assert( !_contig_RE_sites.empty() );
+  const vector<int> lens = use_RE_sites ? _contig_RE_sites : _contig_lengths; // a copy, because ReorderBinsByRef() will change the original
+  const int64_t longest_contig = *( max_element( lens.begin(), lens.end() ) );
+  const int64_t longest_squared = longest_contig * longest_contig;
+
+
+  // 1. Normalize, and count the links on each contig.
+  const size_t N_rows = min( (size_t) _N_bins, (size_t) _matrix.filled1() - 1 ); // rows past index1_data()[filled1()-1] are empty
+  const size_t * row_ptr = &_matrix.index1_data()[0];
+  const size_t * col = &_matrix.index2_data()[0];
+  int64_t * value = &_matrix.value_data()[0];
+
+  const int N_blocks = min( NThreadsToUse( N_threads ), max( _N_bins, 1 ) );
+  vector<int64_t> N_links( _N_bins, 0 );
+  vector< vector<int64_t> > block_col_links( N_blocks );
+  vector<int64_t> block_N_links_total( N_blocks, 0 );
+
+  ParallelForRanges( N_rows, N_blocks, [&]( const int b, const size_t begin, const size_t end ) {
+      vector<int64_t> & col_links = block_col_links[b];
+      col_links.resize( _N_bins, 0 );
+      for ( size_t i = begin; i < end; i++ )
+	for ( size_t k = row_ptr[i]; k < row_ptr[i+1]; k++ ) {
+	  value[k] = NormalizedLinks( value[k], longest_squared, lens[i], lens[ col[k] ] );
+	  block_N_links_total[b] += value[k];
+	  N_links[i]             += value[k];
+	  col_links[ col[k] ]    += value[k];
+	}
+    } );
+
+  int64_t N_links_total = 0;
+  for ( int b = 0; b < N_blocks; b++ ) {
+    N_links_total += block_N_links_total[b];
+    for ( int i = 0; i < _N_bins; i++ ) N_links[i] += block_col_links[b][i];
+    vector<int64_t>().swap( block_col_links[b] ); // free memory
+  }
+
+
+  // Reorder the contigs, except for the matrix itself, and put the link counts in the new order.
+  vector<int> contig_order;
+  if ( true_mapping ) {
+    contig_order = ReorderBinsByRef( *true_mapping );
+    const vector<int64_t> old_N_links = N_links;
+    for ( int i = 0; i < _N_bins; i++ )
+      N_links[ contig_order[i] ] = old_N_links[i];
+  }
+
+  SkipContigsWithFewREs( min_N_REs );
+  const vector<double> factors = RepeatFactors( N_links, N_links_total, repeat_multiplicity );
+
+
+  // 2. Reorder the matrix, and divide by the repetitiveness factors (which are in the new order).
+  RewriteMatrix( _matrix, _N_bins, true_mapping ? &contig_order : NULL,
+		 [&]( const size_t i, const size_t, const int64_t x ) { return DividedLinks( x, factors[ true_mapping ? contig_order[i] : i ] ); },
+		 N_threads );
 }
 
 
@@ -638,12 +1081,191 @@ GenomeLinkMatrix::SkipRepeats( const double & repeat_multiplicity, const bool fl
 
 
 
+// MergeScore: An entry in the priority queue of possible merges in AHClustering.
+struct MergeScore {
+  double score; // average linkage between the two clusters
+  int64_t order; // order in which the entries were added to the queue
+  int cluster1, cluster2;
+};
+
+// Priority for MergeScores: the highest score comes first, and ties go to whichever entry was added first.  This is exactly the order of the multimap that
+// AHClustering used to use, so the clustering results don't change.
+struct MergeScoreLess {
+  bool operator()( const MergeScore & a, const MergeScore & b ) const {
+    if ( a.score != b.score ) return a.score < b.score;
+    return a.order > b.order;
+  }
+};
+
+// MergeScoreQueue: A binary heap of MergeScores.  Much more compact than a multimap, and the top entry is always at the front.
+class MergeScoreQueue
+{
+ public:
+  MergeScoreQueue() : _N_pushed(0) {}
+
+  bool empty() const { return _heap.empty(); }
+  const MergeScore & top() const { return _heap.top(); }
+  void pop() { _heap.pop(); }
+  void push( const double score, const int cluster1, const int cluster2 ) {
+    MergeScore m = { score, _N_pushed++, cluster1, cluster2 };
+    _heap.push( m );
+  }
+
+  // assign: Replace the queue's contents with these entries, in one O(N) heap construction.  The entries are numbered in the order given, exactly as if they
+  // had been push()'ed one at a time.  The scores vector is consumed.
+  void assign( vector<MergeScore> & scores ) {
+    for ( size_t i = 0; i < scores.size(); i++ ) scores[i].order = i;
+    _N_pushed = scores.size();
+    _heap = priority_queue< MergeScore, vector<MergeScore>, MergeScoreLess >( MergeScoreLess(), std::move( scores ) );
+  }
+
+ private:
+  priority_queue< MergeScore, vector<MergeScore>, MergeScoreLess > _heap;
+  int64_t _N_pushed;
+};
+
+
+
+
+// MergeClusterLinks: Helper function for AHClustering.  Clusters c1 and c2 have just been merged into cluster new_c.  Make the adjacency list links[new_c] by
+// adding together links[c1] and links[c2] (both are sorted by cluster ID), dropping entries for clusters that no longer exist (including c1 and c2
+// themselves).  Then, for each cluster K in the new list, add new_c to the opposite-direction list reverse_links[K].  Finally, free links[c1] and links[c2].
+static void
+MergeClusterLinks( vector< vector< pair<int,int64_t> > > & links, const int c1, const int c2, const int new_c, const vector<bool> & cluster_exists,
+		   vector< vector< pair<int,int64_t> > > & reverse_links )
+{
+  const vector< pair<int,int64_t> > & links1 = links[c1];
+  const vector< pair<int,int64_t> > & links2 = links[c2];
+  vector< pair<int,int64_t> > & new_links = links[new_c];
+  assert( new_links.empty() );
+
+  size_t a = 0, b = 0;
+  while ( a < links1.size() || b < links2.size() ) {
+    pair<int,int64_t> link;
+    if      ( b == links2.size() || ( a < links1.size() && links1[a].first < links2[b].first ) ) link = links1[a++];
+    else if ( a == links1.size() || links2[b].first < links1[a].first ) link = links2[b++];
+    else { link = links1[a++]; link.second += links2[b++].second; }
+
+    if ( !cluster_exists[ link.first ] ) continue;
+    new_links.push_back( link );
+    reverse_links[ link.first ].push_back( make_pair( new_c, link.second ) ); // new_c is the highest cluster ID yet, so this list stays sorted
+  }
+
+  vector< pair<int,int64_t> >().swap( links[c1] ); // free memory
+  vector< pair<int,int64_t> >().swap( links[c2] );
+}
+
+
+
+
 // AHClustering: Apply a greedy agglomerative hierarchical clustering algorithm to cluster the contigs into scaffolds.
 // The distance metric between clusters is "average linkage", as described here: http://www2.statistics.com/resources/glossary/a/avglnkg.php
 // CEN_contigs, if not an empty vector, lists a set of contig IDs (0-indexed) for contigs containing centromeres.  These contigs will NOT be merged.
+// The merging itself is done by AHMerge; this decides when to stop.
 // Sets: _clusters (via SetClusters())
 void
-GenomeLinkMatrix::AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CEN_contigs, const double MIN_AVG_LINKAGE, const double NONINFORMATIVE_RATIO, const bool DRAW_DOTPLOT, const TrueMapping * true_mapping )
+GenomeLinkMatrix::AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CEN_contigs, const double MIN_AVG_LINKAGE, const double NONINFORMATIVE_RATIO, const bool DRAW_DOTPLOT, const TrueMapping * true_mapping, const int N_threads )
+{
+  // Determine the number of non-skipped contigs (contigs not marked either short or reptitive by the Skip() functions.)
+  int N_non_skipped = count( _contig_skip.begin(), _contig_skip.end(), false );
+
+  cout << "AHClustering!  (N informative contigs = " << N_non_skipped << ", N_CLUSTERS_MIN=" << N_CLUSTERS_MIN << ", MIN_AVG_LINKAGE=" << MIN_AVG_LINKAGE << ", NONINFORMATIVE_RATIO=" << NONINFORMATIVE_RATIO << ")" << endl;
+
+  // There can't be more CEN contigs than clusters.
+  assert( (int) CEN_contigs.size() <= N_CLUSTERS_MIN );
+
+  // HEUR: Range for number of clusters that will get printed out to SKY dotplots at out/dotplot.SKY.<n>.jpg
+  const int N_CLUSTERS_MAX = DRAW_DOTPLOT ? 1.25 * N_CLUSTERS_MIN : N_CLUSTERS_MIN;
+
+  const vector<int> bin_to_clusterID =
+    AHMerge( CEN_contigs, MIN_AVG_LINKAGE, N_threads, [&]( const int N_merges, const int N_non_singleton_clusters, const vector<int> & bin_to_clusterID ) {
+
+      // If the number of clusters remaining is sufficiently small, analyze the results.
+      if ( N_merges > N_non_skipped / 2 && N_non_singleton_clusters <= N_CLUSTERS_MAX ) {
+	SetClusters( bin_to_clusterID, NONINFORMATIVE_RATIO, N_threads );
+
+	// Report on contigs that appear to be mis-clustered (i.e., they belong to a different chromosome than the plurality of other contigs in their cluster.)
+	if ( true_mapping != NULL ) ReportMisclusteredContigs( *true_mapping );
+
+	// Make a dotplot.
+	if ( true_mapping != NULL && DRAW_DOTPLOT ) {
+	  DrawClusterDotplot( *true_mapping );
+	  string cmd = "mv dotplot.txt dotplot." + boost::lexical_cast<string>(N_non_singleton_clusters) + ".txt";
+	  system( cmd.c_str() );
+	  cmd = "mv out/dotplot.SKY.jpg out/dotplot.SKY." + boost::lexical_cast<string>(N_non_singleton_clusters) + ".jpg";
+	  system( cmd.c_str() );
+	}
+
+	// If the number of clusters remaining is SUPER small, we're done.
+	//if ( N_merges_remaining == N_CLUSTERS_MIN ) {
+	if ( N_non_singleton_clusters == N_CLUSTERS_MIN ) {
+	  cout << N_merges << " merges made so far; this leaves " << N_CLUSTERS_MIN << " clusters, and so we're done!" << endl;
+	  return true;
+	}
+
+      }
+      return false;
+    } );
+
+  // We've broken out of the clustering loop, so we're done, but set clusters one last time.
+  SetClusters( bin_to_clusterID, NONINFORMATIVE_RATIO, N_threads );
+
+}
+
+
+
+// AHClusteringSweep: Cluster with every combination of N_CLUSTERS_MINs and NONINFORMATIVE_RATIOs, from a single run of the merges.  For each N_CLUSTERS_MIN,
+// the merges stop at the same point as in AHClustering: the first merge after more than half of the informative contigs have been merged, at which there
+// are N_CLUSTERS_MIN non-singleton clusters; or the last merge, if there never are.  The merges go on until every N_CLUSTERS_MIN has been reached.
+// Sets: _clusters (via SetClusters()), to each set of clusters in turn
+void
+GenomeLinkMatrix::AHClusteringSweep( const vector<int> & N_CLUSTERS_MINs, const vector<int> & CEN_contigs, const double MIN_AVG_LINKAGE, const vector<double> & NONINFORMATIVE_RATIOs,
+				     const function< void( const size_t, const size_t ) > & report, const int N_threads )
+{
+  int N_non_skipped = count( _contig_skip.begin(), _contig_skip.end(), false );
+
+  cout << "AHClusteringSweep!  (N informative contigs = " << N_non_skipped << ", N_CLUSTERS_MIN =";
+  for ( size_t a = 0; a < N_CLUSTERS_MINs.size(); a++ ) cout << ' ' << N_CLUSTERS_MINs[a];
+  cout << ", MIN_AVG_LINKAGE=" << MIN_AVG_LINKAGE << ", NONINFORMATIVE_RATIO =";
+  for ( size_t b = 0; b < NONINFORMATIVE_RATIOs.size(); b++ ) cout << ' ' << NONINFORMATIVE_RATIOs[b];
+  cout << ")" << endl;
+
+  for ( size_t a = 0; a < N_CLUSTERS_MINs.size(); a++ )
+    assert( (int) CEN_contigs.size() <= N_CLUSTERS_MINs[a] );
+
+  // Do the merges, and keep a copy of bin_to_clusterID at each stopping point.  (bin_to_clusterID is never empty, so an empty cut hasn't been reached.)
+  vector< vector<int> > cuts( N_CLUSTERS_MINs.size() );
+  size_t N_cuts = 0;
+  const vector<int> last_bin_to_clusterID =
+    AHMerge( CEN_contigs, MIN_AVG_LINKAGE, N_threads, [&]( const int N_merges, const int N_non_singleton_clusters, const vector<int> & bin_to_clusterID ) {
+      if ( N_merges <= N_non_skipped / 2 ) return false;
+      for ( size_t a = 0; a < N_CLUSTERS_MINs.size(); a++ )
+	if ( cuts[a].empty() && N_non_singleton_clusters == N_CLUSTERS_MINs[a] ) {
+	  cout << N_merges << " merges made so far; this leaves " << N_CLUSTERS_MINs[a] << " clusters, for N_CLUSTERS_MIN=" << N_CLUSTERS_MINs[a] << endl;
+	  cuts[a] = bin_to_clusterID;
+	  N_cuts++;
+	}
+      return N_cuts == cuts.size();
+    } );
+
+  // Set each set of clusters, and report on it.
+  for ( size_t a = 0; a < N_CLUSTERS_MINs.size(); a++ )
+    for ( size_t b = 0; b < NONINFORMATIVE_RATIOs.size(); b++ ) {
+      cout << "AHClusteringSweep: clusters for N_CLUSTERS_MIN=" << N_CLUSTERS_MINs[a] << ", NONINFORMATIVE_RATIO=" << NONINFORMATIVE_RATIOs[b] << endl;
+      SetClusters( cuts[a].empty() ? last_bin_to_clusterID : cuts[a], NONINFORMATIVE_RATIOs[b], N_threads );
+      report( a, b );
+    }
+}
+
+
+
+// AHMerge: The merging loop of AHClustering.  Starting with each non-skipped contig in its own cluster, repeatedly merge the two clusters with the highest
+// average linkage.  After each merge, call after_merge( N_merges, N_non_singleton_clusters, bin_to_clusterID ); stop if it returns true, or if there are no
+// more merges to make.  Return the final bin_to_clusterID, in which skipped contigs have cluster ID -1.
+// The merges don't depend on when the loop stops, so one run of AHMerge can find the clusters for many values of N_CLUSTERS_MIN (see AHClusteringSweep).
+vector<int>
+GenomeLinkMatrix::AHMerge( const vector<int> & CEN_contigs, const double MIN_AVG_LINKAGE, const int N_threads,
+			   const function< bool( const int, const int, const vector<int> & ) > & after_merge ) const
 {
   // Determine the number of non-skipped contigs (contigs not marked either short or reptitive by the Skip() functions.)  If there are none, throw an error.
   int N_non_skipped = count( _contig_skip.begin(), _contig_skip.end(), false );
@@ -652,13 +1274,10 @@ GenomeLinkMatrix::AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CE
   }
   assert ( N_non_skipped > 0 );
 
-  cout << "AHClustering!  (N informative contigs = " << N_non_skipped << ", N_CLUSTERS_MIN=" << N_CLUSTERS_MIN << ", MIN_AVG_LINKAGE=" << MIN_AVG_LINKAGE << ", NONINFORMATIVE_RATIO=" << NONINFORMATIVE_RATIO << ")" << endl;
-
   // Check that the CEN_contigs vector makes sense, if it's non-empty.
-  // All values must be in the range of contig IDs, and there can't be more values than clusters.
+  // All values must be in the range of contig IDs.
   int N_CEN_contigs = CEN_contigs.size(); // may be 0, in which case no CEN-based filtering happens, and that's ok
 
-  assert( N_CEN_contigs <= N_CLUSTERS_MIN );
   for ( int i = 0; i < N_CEN_contigs; i++ ) {
     assert( CEN_contigs[i] >= 0 ); // this was checked when CLUSTER_CONTIGS_WITH_CENS was input
     if ( CEN_contigs[i] >= _N_bins ) { // this wasn't, so report informatively on it now
@@ -671,20 +1290,15 @@ GenomeLinkMatrix::AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CE
 
 
 
-  set<int>::const_iterator set_it1, set_it2;
-
-  // HEUR: Range for number of clusters that will get printed out to SKY dotplots at out/dotplot.SKY.<n>.jpg
-  static const int N_CLUSTERS_MAX = DRAW_DOTPLOT ? 1.25 * N_CLUSTERS_MIN : N_CLUSTERS_MIN;
-
 
 
 
-  const int PRUNE_RATE = 10; // prune after each time we do 1/PRUNE_RATE of the total remaining number of merges; this only affects runtime
 
   // These objects will contain intermediate products of the algorithm.
   vector<bool> cluster_exists( 2 * _N_bins, false );
   vector<int> cluster_size( 2 * _N_bins, 0 );
   vector<int> bin_to_clusterID( _N_bins, -1 );
+  vector< vector<int> > cluster_bins( 2 * _N_bins ); // the bins in each cluster
 
   // Put each contig in its own distinct cluster (except contigs marked with contig_skip, which get left out for now).
   // This is the starting point of agglomerative clustering.
@@ -694,22 +1308,69 @@ GenomeLinkMatrix::AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CE
     cluster_exists[i] = true;
     cluster_size[i] = 1;
     bin_to_clusterID[i] = i;
+    cluster_bins[i].push_back(i);
   }
   assert( N_contigs_skipped == _N_bins - N_non_skipped );
 
 
 
-  // Calculate all possible "merge scores" for all pairs of clusters.  Make a list sorted by distance.
+  // Make the sparse adjacency lists of the clusters.  For each cluster X, links_out[X] is a list of (cluster ID K, total number of links from the bins in X to
+  // the bins in K) - i.e., the sum of _matrix(x,k) - for every cluster K that X has links to, sorted by K.  links_in[X] is the same, but for links from K to X.
+  // (_matrix may not be symmetric, e.g., after ReorderContigsByRef(), so the two directions have to be kept separate.)  When two clusters merge, the new
+  // cluster's lists are simply the sums of theirs.
+  // Entries for clusters that have since been merged away are left in the lists, and skipped over; they're removed when the cluster itself is merged.
+  vector< vector< pair<int,int64_t> > > links_out( 2 * _N_bins ), links_in( 2 * _N_bins );
+
+  // Calculate all possible "merge scores" for all pairs of clusters, and put them in a priority queue.
   // The initial "merge score" values for the initial (one-bin) clusters is simply the amount of link data between each pair of bins.
-  // Also make a matrix to keep track of the merge scores for each pair of clusters.  This is the same data as merge_score_map, but in a different form.
+  // Scores involving clusters that have been merged away are left in the queue and thrown out when they reach the top ("lazy invalidation").
+  // Only the nonzero entries of _matrix are visited, a block of rows at a time (see ForEachRowBlock).  Each block's rows are split into sub-blocks, one per
+  // thread; each thread makes the links_out lists and the candidate scores for its own rows.  The sub-blocks' scores are then queued in row order, so the
+  // queue (and hence the clustering) is the same no matter how many threads are used, or whether the GLM is out of core.
   cout << "Creating a 'merge score map'..." << endl;
-  multimap< double, pair<int64_t,int>, greater<double> > merge_score_map;
-  for ( int i = 0; i < _N_bins; i++ )
-    if ( !_contig_skip[i] )
-      for ( int j = i+1; j < _N_bins; j++ )
-	if ( !_contig_skip[j] )
-	  if ( _matrix(i,j) > MIN_AVG_LINKAGE )
-	    merge_score_map.insert( make_pair( _matrix(i,j), make_pair(i,j) ) );
+  MergeScoreQueue merge_score_map;
+  {
+    const int N_blocks = min( NThreadsToUse( N_threads ), max( _N_bins, 1 ) );
+    vector< vector<MergeScore> > block_scores( N_blocks );
+    vector<MergeScore> scores;
+
+    ForEachRowBlock( [&]( const GLMRows & rows ) {
+	ParallelForRanges( rows.end - rows.begin, N_blocks, [&]( const int b, const size_t begin, const size_t end ) {
+	    for ( size_t i = rows.begin + begin; i < rows.begin + end; i++ ) {
+	      if ( _contig_skip[i] ) continue;
+	      for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ ) {
+		const size_t j = rows.col[k];
+		const int64_t value = rows.value[k];
+		if ( _contig_skip[j] || i == j || value <= 0 ) continue;
+		links_out[i].push_back( make_pair( j, value ) );
+		if ( j > i && value > MIN_AVG_LINKAGE ) {
+		  MergeScore m = { (double) value, 0, (int) i, (int) j };
+		  block_scores[b].push_back( m );
+		}
+	      }
+	    }
+	  } );
+
+	for ( int b = 0; b < N_blocks; b++ ) {
+	  scores.insert( scores.end(), block_scores[b].begin(), block_scores[b].end() );
+	  block_scores[b].clear();
+	}
+      } );
+
+    // Make the links_in lists by transposing links_out.  Going through the rows in order leaves each links_in list sorted.
+    vector<size_t> N_in( _N_bins, 0 );
+    for ( int i = 0; i < _N_bins; i++ )
+      for ( size_t k = 0; k < links_out[i].size(); k++ )
+	N_in[ links_out[i][k].first ]++;
+    for ( int j = 0; j < _N_bins; j++ )
+      links_in[j].reserve( N_in[j] );
+    for ( int i = 0; i < _N_bins; i++ )
+      for ( size_t k = 0; k < links_out[i].size(); k++ )
+	links_in[ links_out[i][k].first ].push_back( make_pair( i, links_out[i][k].second ) );
+
+    vector< vector<MergeScore> >().swap( block_scores ); // free memory
+    merge_score_map.assign( scores );
+  }
 
   // TEMP
   vector< pair<int,int> > merges_to_do;
@@ -726,7 +1387,6 @@ GenomeLinkMatrix::AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CE
 
 
   int N_merges = 0;
-  int N_merges_since_prune = 0;
   int N_non_singleton_clusters = 0;
 
 
@@ -734,45 +1394,46 @@ GenomeLinkMatrix::AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CE
   // Hierarchical clustering!  Repeatedly perform the following three steps:
   // 1. Find the pair of clusters with the highest "merge score".
   // 2. Merge this pair and record the merging.
-  // 3. Update the multimap<> of merge scores to reflect the merging.
+  // 3. Update the queue of merge scores to reflect the merging.
 
   while ( 1 ) {
     if ( merge_score_map.empty() )  { cout << "empty merge score map. weird. maybe everything is over-clustered." << endl; break; }
 
     // 1. Find the pair of clusters with the highest "merge score".
-    // This is easy - it's simply the first item in the map for which two clusters actually exist.
-    multimap< double, pair<int64_t,int>, greater<double> >::iterator it;
-
-    for ( it = merge_score_map.begin(); it != merge_score_map.end(); ++it )
-      if ( cluster_exists[ it->second.first ] && cluster_exists[ it->second.second ] ) {
-
-
-	// If the CEN_contigs vector is set, it indicates contigs known to contain yeast centromeres.  Don't allow a merge that combines multiple such contigs.
-	int N_CENs_in_clusters = 0;
-	for ( int i = 0; i < N_CEN_contigs; i++ ) {
-	  int cID = bin_to_clusterID[ CEN_contigs[i] ];
-	  if ( cID == it->second.first || cID == it->second.second ) N_CENs_in_clusters++;
-	}
+    // This is easy - it's simply the first item in the queue for which two clusters actually exist.  Items for which they don't are thrown out.
+    // Items for merges that are disallowed are also thrown out, since they will never become allowed: the clusters' sets of contigs don't change.
+    while ( !merge_score_map.empty() ) {
+      const MergeScore & top = merge_score_map.top();
+      if ( !cluster_exists[ top.cluster1 ] || !cluster_exists[ top.cluster2 ] ) { merge_score_map.pop(); continue; }
+
+
+      // If the CEN_contigs vector is set, it indicates contigs known to contain yeast centromeres.  Don't allow a merge that combines multiple such contigs.
+      int N_CENs_in_clusters = 0;
+      for ( int i = 0; i < N_CEN_contigs; i++ ) {
+	int cID = bin_to_clusterID[ CEN_contigs[i] ];
+	if ( cID == top.cluster1 || cID == top.cluster2 ) N_CENs_in_clusters++;
+      }
 
-	if ( N_CENs_in_clusters > 1 ) {
-	  cout << "Disallowing a merge because it would put " << N_CENs_in_clusters << " CEN contigs (#" << it->second.first << ",#" << it->second.second << ") into the same cluster" << endl;
-	  continue;
-	}
+      if ( N_CENs_in_clusters > 1 ) {
+	cout << "Disallowing a merge because it would put " << N_CENs_in_clusters << " CEN contigs (#" << top.cluster1 << ",#" << top.cluster2 << ") into the same cluster" << endl;
+	merge_score_map.pop();
+	continue;
+      }
 
 
-	break;
-      }
+      break;
+    }
 
-    if ( it == merge_score_map.end() ) {
+    if ( merge_score_map.empty() ) {
       cout << "No more merges to do (because MIN_AVG_LINKAGE = " << MIN_AVG_LINKAGE << "); so clustering is done after " << N_merges << " merges" << endl;
       break;
     }
 
-    //cout << "CHOOSING MERGE: " << it->first << "\t" << it->second.first << "," << it->second.second << endl;
-    double best_linkage = it->first;
+    //cout << "CHOOSING MERGE: " << merge_score_map.top().score << "\t" << merge_score_map.top().cluster1 << "," << merge_score_map.top().cluster2 << endl;
+    double best_linkage = merge_score_map.top().score;
     assert( best_linkage > 0 );
-    int best_i = it->second.first;
-    int best_j = it->second.second;
+    int best_i = merge_score_map.top().cluster1;
+    int best_j = merge_score_map.top().cluster2;
     if ( best_i > best_j ) { int swap = best_i; best_i = best_j; best_j = swap; }
 
     // TEMP: assign certain merges-to-do
@@ -788,15 +1449,14 @@ GenomeLinkMatrix::AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CE
     // 2. Merge this pair and record the merging.
     int new_cluster_ID = _N_bins + N_merges;
     N_merges++;
-    N_merges_since_prune++;
     //int N_merges_remaining = _N_bins - N_merges - N_contigs_skipped;
     //cout << "MERGE #" << N_merges << ": Best linkage has value = " << best_linkage << "\tbetween clusters " << PrintSet( _clusters[best_i] ) << " and " << PrintSet( _clusters[best_j] ) << endl;
 
 
 
     // Merge together clusters best_i, best_j into a new cluster.
-    // We do this instead of merging one cluster into another so that we don't have to remove all the existing entries in the merge score map that correspond
-    // to the existing clusters; we can just mark these clusters as unused so that we can skip over those entries.
+    // We do this instead of merging one cluster into another so that we don't have to remove all the existing entries in the merge score queue that
+    // correspond to the existing clusters; we can just mark these clusters as unused so that we can skip over those entries.
     assert( cluster_exists[best_i] );
     assert( cluster_exists[best_j] );
     cluster_exists[best_i] = false;
@@ -809,99 +1469,39 @@ GenomeLinkMatrix::AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CE
     N_non_singleton_clusters--;
 
 
-    set<int> new_cluster;
-    for ( int bin = 0; bin < _N_bins; bin++ )
-      if ( bin_to_clusterID[bin] == best_i || bin_to_clusterID[bin] == best_j ) {
-	bin_to_clusterID[bin] = new_cluster_ID;
-	new_cluster.insert(bin);
-      }
-
-
-    // 3. Update the multimap<> of merge scores to reflect the merging.  This has two sub-parts, 3a and 3b.
+    vector<int> & new_cluster = cluster_bins[new_cluster_ID];
+    new_cluster.swap( cluster_bins[best_i] );
+    new_cluster.insert( new_cluster.end(), cluster_bins[best_j].begin(), cluster_bins[best_j].end() );
+    vector<int>().swap( cluster_bins[best_j] );
+    for ( size_t k = 0; k < new_cluster.size(); k++ )
+      bin_to_clusterID[ new_cluster[k] ] = new_cluster_ID;
 
-    // 3a. Find all merge scores involving clusters that have been used, and remove them.
-    // We only do this rarely because it's very time-consuming.
-    if ( N_merges_since_prune > ( _N_bins - N_merges ) / PRUNE_RATE ) {
-      N_merges_since_prune = 0;
 
-      for ( it = merge_score_map.begin(); it != merge_score_map.end(); it++ ) {
-	while ( it != merge_score_map.end() &&
-		( !cluster_exists[ it->second.first  ] ||
-		  !cluster_exists[ it->second.second ] ) )
-	  //cout << "MERGE_SCORE_MAP\tERASING:\t" << it->first << "\t" << it->second.first << "," << it->second.second << endl;
-	  merge_score_map.erase(it++);
+    // 3. Update the queue of merge scores to reflect the merging.
+    // Find the new cluster's adjacency lists by merging the two old clusters' lists, and add the new cluster to its neighbors' lists.
+    MergeClusterLinks( links_out, best_i, best_j, new_cluster_ID, cluster_exists, links_in );
+    MergeClusterLinks( links_in,  best_i, best_j, new_cluster_ID, cluster_exists, links_out );
 
-	if ( it == merge_score_map.end() ) break;
-      }
+    // Calculate new score entries for the new cluster - that is, the average linkage from each other cluster to this cluster.  They're added to the queue in
+    // order of cluster ID.
+    const vector< pair<int,int64_t> > & new_links = links_in[new_cluster_ID];
+    for ( size_t k = 0; k < new_links.size(); k++ ) {
+      const int i = new_links[k].first;
+      double avg_linkage = double( new_links[k].second ) / cluster_size[i] / cluster_size[new_cluster_ID];
+      //cout << "ADDING LINK TO MERGE_SCORE_MAP: \t" << min(i,new_cluster_ID) << ',' << max(i,new_cluster_ID) << "\tScore = " << avg_linkage << endl;
 
+      if ( avg_linkage < MIN_AVG_LINKAGE ) continue;
+      merge_score_map.push( avg_linkage, min(i,new_cluster_ID), max(i,new_cluster_ID) );
     }
 
-
-    // 3b. Calculate new score entries for the new cluster - that is, the average linkage from this cluster to each other cluster.
-    vector<int64_t> total_linkage_by_cluster( 2 * _N_bins, 0 );
-    //set<int, greater<int> > linkages_by_cluster;
-
-    for ( int i = 0; i < _N_bins; i++ ) {
-      int cluster_ID = bin_to_clusterID[i];
-      if ( cluster_ID == new_cluster_ID ) continue; // no need to calculate linkages within a cluster
-      if ( cluster_ID == -1 ) continue; // this happens if _contig_skip[i]
-
-      // This loop is a runtime bottleneck, but attempts to fix it haven't worked...
-      for ( set<int>::const_iterator it = new_cluster.begin(); it != new_cluster.end(); ++it ) {
-	total_linkage_by_cluster[cluster_ID] += _matrix( i, *it );
-	//linkages_by_cluster.insert( _matrix( i, *it ) );
-      }
-    }
-
-
-    for ( int i = 0; i < 2 * _N_bins; i++ )
-      if ( total_linkage_by_cluster[i] > 0 ) {
-	assert( cluster_exists[i] );
-	double avg_linkage = double( total_linkage_by_cluster[i] ) / cluster_size[i] / cluster_size[new_cluster_ID];
-	//cout << "ADDING LINK TO MERGE_SCORE_MAP: \t" << min(i,new_cluster_ID) << ',' << max(i,new_cluster_ID) << "\tScore = " << avg_linkage << endl;
-
-	if ( avg_linkage < MIN_AVG_LINKAGE ) continue;
-	//PRINT2( avg_linkage, THING );
-	//avg_linkage += THING;
-	//avg_linkage /= 2;
-	merge_score_map.insert( make_pair( avg_linkage, make_pair( min(i,new_cluster_ID), max(i,new_cluster_ID) ) ) );
-      }
-
-    //PRINT4( N_merges,  N_non_singleton_clusters, N_CLUSTERS_MAX, N_CLUSTERS_MIN );
-
-    // If the number of clusters remaining is sufficiently small, analyze the results.
-    if ( N_merges > N_non_skipped / 2 && N_non_singleton_clusters <= N_CLUSTERS_MAX ) {
-      SetClusters( bin_to_clusterID, NONINFORMATIVE_RATIO );
-
-      // Report on contigs that appear to be mis-clustered (i.e., they belong to a different chromosome than the plurality of other contigs in their cluster.)
-      if ( true_mapping != NULL ) ReportMisclusteredContigs( *true_mapping );
-
-      // Make a dotplot.
-      if ( true_mapping != NULL && DRAW_DOTPLOT ) {
-	DrawClusterDotplot( *true_mapping );
-	string cmd = "mv dotplot.txt dotplot." + boost::lexical_cast<string>(N_non_singleton_clusters) + ".txt";
-	system( cmd.c_str() );
-	cmd = "mv out/dotplot.SKY.jpg out/dotplot.SKY." + boost::lexical_cast<string>(N_non_singleton_clusters) + ".jpg";
-	system( cmd.c_str() );
-      }
-
-      // If the number of clusters remaining is SUPER small, we're done.
-      //if ( N_merges_remaining == N_CLUSTERS_MIN ) {
-      if ( N_non_singleton_clusters == N_CLUSTERS_MIN ) {
-	cout << N_merges << " merges made so far; this leaves " << N_CLUSTERS_MIN << " clusters, and so we're done!" << endl;
-	break;
-      }
-
-    }
+    // Let the caller look at the clusters so far, and decide whether to stop here.
+    if ( after_merge( N_merges, N_non_singleton_clusters, bin_to_clusterID ) ) break;
 
     cout << "Merge #" << N_merges << ": Clusters\t#" << best_i << "," << best_j << "\t-> " << new_cluster_ID << "\tLinkage = " << best_linkage << endl;
 
   }
 
-
-  // We've broken out of the clustering loop, so we're done, but set clusters one last time.
-  SetClusters( bin_to_clusterID, NONINFORMATIVE_RATIO );
-
+  return bin_to_clusterID;
 }
 
 
@@ -940,101 +1540,106 @@ GenomeLinkMatrix::ExcludeLowQualityContigs( const TrueMapping & true_mapping )
 // STEP 4: Repeat Steps 1-3 until no more changes are made.
 // To move a contig (Step 3), its number of links must be at least <annealing_factor> times as much as the links for the cluster the contig is already in.
 // Hence a low annealing_factor (close to 1) is more permissive; a higher annealing_factor is less so.
+//
+// Steps 1-3 are done Jacobi-style: in each iteration, every contig's best cluster is chosen given the clusters as they were at the start of the iteration,
+// and then all the moves are made at once.  So the contigs can be considered in parallel, on up to N_threads threads, and the result doesn't depend on the
+// number of threads.  Ties between clusters go to the contig's own cluster, and then to the lowest-numbered cluster.
+// The link totals in Step 2 are kept for every contig and cluster, and updated as contigs move, so each iteration only visits the nonzero entries of _matrix
+// in the rows of the contigs that moved.
 void
-GenomeLinkMatrix::MoveContigsInClusters( const double annealing_factor )
+GenomeLinkMatrix::MoveContigsInClusters( const double annealing_factor, const int N_threads )
 {
   cout << "MoveContigsInClusters with annealing_factor = " << annealing_factor << endl;
   assert( annealing_factor >= 1 );
+  assert( DeNovo() ); // this uses _contig_lengths
 
-  // Pre-processing: Make a lookup table of contig ID to cluster ID, and a table of the total contig length of each cluster.
-  int N_clusters = _clusters.size();
+  // Pre-processing: Make a lookup table of contig ID to cluster ID, and a table of the number of contigs in each cluster.
+  const int N_clusters = _clusters.size();
 
   vector<int> bin_to_clusterID( _N_bins, -1 );
-  vector<int> cluster_length( N_clusters, 0 );
+  vector<int> cluster_size( N_clusters, 0 );
   for ( int i = 0; i < N_clusters; i++ )
     for ( set<int>::const_iterator it = _clusters[i].begin(); it != _clusters[i].end(); ++it ) {
       bin_to_clusterID[ *it ] = i;
-      cluster_length[i] += _contig_lengths[*it];
+      cluster_size[i]++;
     }
 
+  // Visit the nonzero entries of _matrix, a block of rows at a time (as in AHClustering), to fill in two data structures:
+  // links_in: the transposes of the rows.  links_in[j] is a list of (i,_matrix(i,j)) for every nonzero entry in column j, other than (j,j).  (_matrix may not
+  //           be symmetric, e.g., after ReorderContigsByRef().)
+  // total_N_links_by_len: STEP 2, for all contigs at once.  total_N_links_by_len[ i * N_clusters + c ] is the sum of _matrix(i,j) * _contig_lengths[j] over
+  //           all contigs j != i in cluster c.  Each thread fills in the totals for its own rows.
+  const int N_blocks = min( NThreadsToUse( N_threads ), max( _N_bins, 1 ) );
+  vector< vector< pair<int,int64_t> > > links_in( _N_bins );
+  vector<int64_t> total_N_links_by_len( size_t(_N_bins) * N_clusters, 0 );
+
+  ForEachRowBlock( [&]( const GLMRows & rows ) {
+      for ( size_t i = rows.begin; i < rows.end; i++ )
+	for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ )
+	  if ( rows.col[k] != i && rows.value[k] != 0 ) links_in[ rows.col[k] ].push_back( make_pair( i, rows.value[k] ) );
+
+      ParallelForRanges( rows.end - rows.begin, N_blocks, [&]( const int b, const size_t begin, const size_t end ) {
+	  for ( size_t i = rows.begin + begin; i < rows.begin + end; i++ )
+	    for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ ) {
+	      const size_t j = rows.col[k];
+	      if ( i == j ) continue; // don't do self-links
+	      const int cluster_j = bin_to_clusterID[j];
+	      if ( cluster_j != -1 ) total_N_links_by_len[ i * N_clusters + cluster_j ] += rows.value[k] * _contig_lengths[j];
+	    }
+	} );
+    } );
 
 
 
   // STEP 4: Repeat Steps 1-3 until no more changes are made.  (In practice, only iterate 20 times, to avoid infinite loops.)
+  vector<int> best_cluster( _N_bins, -1 );
   for ( int x = 0; x < 20; x++ ) {
 
-    int N_changes = 0;
-
-    // STEP 1. Loop over all contigs in clusters.
-    for ( int i = 0; i < _N_bins; i++ ) {
-      int cluster_i = bin_to_clusterID[i];
-      if ( cluster_i == -1 ) continue;
-
-      // STEP 2. Find the number of links between this contig and all other contigs in its cluster, and between this contig and all contigs in other clusters.
-      //vector<int> total_N_links( N_clusters, 0 );
-      //vector<int>   max_N_links( N_clusters, 0 );
-      vector<int64_t> total_N_links_by_len( N_clusters, 0 );
-      //vector< set<int> > N_links_set( N_clusters );
-
-      // Loop over all contigs and find the total number of links connecting this contig (i) to all other contigs (j).
-      for ( int j = 0; j < _N_bins; j++ ) {
-	if ( i == j ) continue; // don't do self-links
-	int cluster_j = bin_to_clusterID[j];
-	if ( cluster_j == -1 ) continue;
-
-	if ( _matrix(i,j) != 0 ) {
-	  //total_N_links       [ cluster_j ] += _matrix(i,j);
-	  //max_N_links         [ cluster_j ] = max( max_N_links[cluster_j], _matrix(i,j) );
-	  total_N_links_by_len[ cluster_j ] += _matrix(i,j) * _contig_lengths[j];
-	  //N_links_set[cluster_j].insert( _matrix(i,j) );
-	}
-      }
-
-      // STEP 3. Find which cluster has the most average links to this contig.  If it's not the cluster the contig is already in, move it to that cluster.
-
-      // Find the average number of links between this contig and all other contigs in its cluster.  Use this as a starting point.
-      int cluster_i_size = _clusters[cluster_i].size() - 1; // subtract 1 to discount this contig in normalization
-      int best_cluster = cluster_i;
-      double best_cluster_avg_N_links = double( total_N_links_by_len[cluster_i] ) / cluster_i_size;
-      //best_cluster_avg_N_links = median_of_set( N_links_set[cluster_i] );
-      //best_cluster_avg_N_links = max_N_links[cluster_i];
-      best_cluster_avg_N_links *= annealing_factor;
-      //PRINT2( i, max_N_links[i] );
-
-      // Normalize the link numbers to find the average distance for each cluster.
-      for ( int j = 0; j < N_clusters; j++ ) {
-
-	if ( j == cluster_i ) continue;
-	double avg_N_links = double( total_N_links_by_len[j] ) / ( _clusters[j].size() );
-	//avg_N_links = median_of_set( N_links_set[j] );
-	//avg_N_links = max_N_links[j];
-
-	if ( avg_N_links > best_cluster_avg_N_links ) {
-	  //if ( max_N_links[j] > best_cluster_max_N_links ) {
-	  best_cluster_avg_N_links = avg_N_links;
-	  best_cluster = j;
+    // STEPS 1 and 3. Loop over all contigs in clusters, and find which cluster has the most average links to each contig.
+    ParallelForRanges( _N_bins, N_blocks, [&]( const int b, const size_t begin, const size_t end ) {
+	for ( size_t i = begin; i < end; i++ ) {
+	  const int cluster_i = bin_to_clusterID[i];
+	  best_cluster[i] = cluster_i;
+	  if ( cluster_i == -1 ) continue;
+	  const int64_t * N_links_by_len = &total_N_links_by_len[ i * N_clusters ];
+
+	  // Find the average number of links between this contig and all other contigs in its cluster.  Use this as a starting point.
+	  int cluster_i_size = cluster_size[cluster_i] - 1; // subtract 1 to discount this contig in normalization
+	  double best_cluster_avg_N_links = double( N_links_by_len[cluster_i] ) / cluster_i_size;
+	  best_cluster_avg_N_links *= annealing_factor;
+
+	  // Normalize the link numbers to find the average distance for each cluster.
+	  for ( int j = 0; j < N_clusters; j++ ) {
+	    if ( j == cluster_i ) continue;
+	    double avg_N_links = double( N_links_by_len[j] ) / cluster_size[j];
+	    if ( avg_N_links > best_cluster_avg_N_links ) {
+	      best_cluster_avg_N_links = avg_N_links;
+	      best_cluster[i] = j;
+	    }
+	  }
 	}
-	//PRINT4( i, j, total_N_links_by_len[j], avg_N_links );
-      }
-
-      assert( best_cluster != -1 ); // if this fails, the contig has no links to any contigs in any clusters
+      } );
 
-      // If this contig is in the right cluster already, we're done.
-      if ( cluster_i == best_cluster ) continue;
+    // Move each contig that isn't in its best cluster, in order of contig ID, and update data structures.
+    int N_changes = 0;
+    for ( int i = 0; i < _N_bins; i++ ) {
+      const int cluster_i = bin_to_clusterID[i];
+      if ( cluster_i == best_cluster[i] ) continue;
 
       N_changes++;
-
-      // Move this contig to the other cluster, and update data structures.
-      bin_to_clusterID[i] = best_cluster;
-      cluster_length[cluster_i]    -= _contig_lengths[i];
-      cluster_length[best_cluster] += _contig_lengths[i];
-      _clusters[cluster_i]   .erase( i );
-      _clusters[best_cluster].insert( i );
-
-
-      //PRINT4( i, cluster_i, best_cluster, best_cluster_avg_N_links );
-
-
+      bin_to_clusterID[i] = best_cluster[i];
+      cluster_size[cluster_i]--;
+      cluster_size[best_cluster[i]]++;
+      _clusters[cluster_i]     .erase( i );
+      _clusters[best_cluster[i]].insert( i );
+
+      // Every contig j with links to contig i now has those links counted toward i's new cluster instead of its old one.
+      for ( size_t k = 0; k < links_in[i].size(); k++ ) {
+	const int j = links_in[i][k].first;
+	const int64_t N_links_by_len = links_in[i][k].second * _contig_lengths[i];
+	total_N_links_by_len[ size_t(j) * N_clusters + cluster_i       ] -= N_links_by_len;
+	total_N_links_by_len[ size_t(j) * N_clusters + best_cluster[i] ] += N_links_by_len;
+      }
     }
 
     // STEP 4: Repeat Steps 1-3 until no more changes are made.
@@ -1130,13 +1735,25 @@ GenomeLinkMatrix::ValidateClusters( const TrueMapping * true_mapping, const bool
       // To weight the link densities properly, it's necessary to find the product of the contig lengths.
       int64_t len_product = int64_t( _contig_lengths[i] ) * int64_t( _contig_lengths[j] ) >> N_bitshifts; // divide by 2^20 to avoid overflow
 
-      assert( ( same_cluster ? N_links_same_cluster : N_links_diff_cluster ) >= 0 );
-
       ( same_cluster ? total_len_same_cluster : total_len_diff_cluster ) += len_product;
-      ( same_cluster ?   N_links_same_cluster :   N_links_diff_cluster ) += len_product * _matrix(i,j);
-
     }
 
+  // The links only need to be added up over the elements actually stored in the sparse matrix; the rest are 0 anyway.
+  ForEachRowBlock( [&]( const GLMRows & rows ) {
+      for ( size_t i = rows.begin; i < rows.end; i++ )
+	for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ ) {
+	  const size_t j = rows.col[k];
+	  if ( cluster_ID[i] == -1 || cluster_ID[j] == -1 ) continue; // both contigs must be clustered
+	  bool same_cluster = ( cluster_ID[i] == cluster_ID[j] );
+
+	  int64_t len_product = int64_t( _contig_lengths[i] ) * int64_t( _contig_lengths[j] ) >> N_bitshifts; // divide by 2^20 to avoid overflow
+
+	  assert( ( same_cluster ? N_links_same_cluster : N_links_diff_cluster ) >= 0 );
+
+	  ( same_cluster ? N_links_same_cluster : N_links_diff_cluster ) += len_product * rows.value[k];
+	}
+    } );
+
   double density_same_cluster = double( N_links_same_cluster ) / total_len_same_cluster;
   double density_diff_cluster = double( N_links_diff_cluster ) / total_len_diff_cluster;
 
@@ -1149,8 +1766,6 @@ GenomeLinkMatrix::ValidateClusters( const TrueMapping * true_mapping, const bool
 
   cout << "Done clustering!" << endl;
 
-  multimap< double, int, greater<double> > cluster_linkages;
-
   if (0)
   // Find the individual amount of intra-cluster enrichment for each contig.  This is akin to a quality score for each individual contig.
   for ( int i = 0; i < _N_bins; i++ ) {
@@ -1158,15 +1773,13 @@ GenomeLinkMatrix::ValidateClusters( const TrueMapping * true_mapping, const bool
     if ( cluster == -1 ) continue; // don't calculate quality scores for non-clustered contigs
 
     // Find the average linkage between this contig and all other contigs in its cluster.  Also find the average linkage with all other contigs.
-    //FindClusterLinkages( i, cluster_linkages );
-    //if ( cluster_linkages.empty() ) { cout << "CONTIG #" << i << ": NO LINKS" << endl; continue; }
 
     int64_t N_in_cluster = 0, N_out_of_cluster = 0;
     double linkage_in_cluster = 0, linkage_out_of_cluster = 0;
     for ( int j = 0; j < _N_bins; j++ ) {
       if ( i == j ) continue;
       ( bin_to_clusterID[j] == cluster ?       N_in_cluster :       N_out_of_cluster ) ++;
-      ( bin_to_clusterID[j] == cluster ? linkage_in_cluster : linkage_out_of_cluster ) += _matrix( i, j );
+      ( bin_to_clusterID[j] == cluster ? linkage_in_cluster : linkage_out_of_cluster ) += NLinks( i, j );
     }
 
     double ratio = ( linkage_in_cluster / N_in_cluster ) / ( linkage_out_of_cluster / N_out_of_cluster );
@@ -1362,26 +1975,45 @@ GenomeLinkMatrix::GetClusters() const
 
 
 
-// DrawHeatmap: Call WriteFile("heatmap.txt"), then run the R script "heatmap.R", which uses R and ggplot2 to make a heatmap image of this GenomeLinkMatrix.
+// DrawHeatmap: Draw a heatmap image of this GenomeLinkMatrix at out/<heatmap_file> (a PNG file, by default out/heatmap.png.)
+// The nonzero elements are binned down to a 1024 x 1024 image in one pass over them, with the colors of heatmap.R.  The main diagonal isn't stored, so it
+// stays blank, as it would in a plot of the text GLM file.
 void
 GenomeLinkMatrix::DrawHeatmap( const string & heatmap_file ) const
 {
-  WriteFile("heatmap.txt");
+  const string file = "out/" + ( heatmap_file == "" ? string( "heatmap.png" ) : heatmap_file );
+  cout << "Plotting a heatmap at " << file << endl;
 
-  // The R script "heatmap.R" is hardwired to take "heatmap.txt" as input and write to out/heatmap.jpg.
-  // For details on how this script works, see the script itself.
-  cout << "Plotting a heatmap at out/" << heatmap_file << endl;
-  system("./heatmap.R");
+  HeatmapPyramid heatmap( _N_bins );
+  AddToHeatmap( heatmap );
 
-  // Copy the file heatmap.jpg into the place desired.
-  if ( heatmap_file != "" && heatmap_file != "heatmap.jpg" )
-    system( ( "cp out/heatmap.jpg out/" + heatmap_file ).c_str() );
+  system( "mkdir -p out" );
+  heatmap.WritePNG( file );
 
   cout << "Done plotting!" << endl;
 }
 
 
 
+void
+GenomeLinkMatrix::AddToHeatmap( HeatmapPyramid & heatmap, const vector<int> & new_IDs, const double scale ) const
+{
+  assert( new_IDs.empty() || (int) new_IDs.size() == _N_bins );
+
+  ForEachRowBlock( [&]( const GLMRows & rows ) {
+      for ( size_t i = rows.begin; i < rows.end; i++ ) {
+	const int new_i = new_IDs.empty() ? i : new_IDs[i];
+	if ( new_i == -1 ) continue;
+	for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ ) {
+	  const int new_j = new_IDs.empty() ? rows.col[k] : new_IDs[ rows.col[k] ];
+	  if ( new_j != -1 ) heatmap.Add( new_i, new_j, rows.value[k] * scale );
+	}
+      }
+    } );
+}
+
+
+
 
 
 
@@ -1398,6 +2030,75 @@ GenomeLinkMatrix::InitMatrix()
   assert( _N_bins > 0 );
   _matrix.resize( _N_bins, _N_bins, 0 );
   _normalized = false;
+  _lazy_longest_squared = 0;
+  _lazy_use_RE_sites = false;
+  _lazy_repeat_factors.clear();
+}
+
+
+
+
+// NLinks: Return the matrix element (i,j), with any normalizations applied.
+int64_t
+GenomeLinkMatrix::NLinks( const int i, const int j ) const
+{
+  if ( !_tiles ) return _matrix(i,j);
+  return LazyLink( i, j, _tiles->at( i, j ) );
+}
+
+
+
+
+// ForEachRowBlock: Call f() on blocks of rows that cover the whole matrix, in order.
+// In memory, the whole matrix is a single block, straight from the CSR arrays underlying _matrix.  Out of core, each tile is a block, and the normalizations
+// are applied to a copy of the tile's values.
+void
+GenomeLinkMatrix::ForEachRowBlock( const function< void( const GLMRows & ) > & f ) const
+{
+  if ( !_tiles ) {
+    GLMRows rows;
+    rows.begin = 0;
+    rows.end = min( (size_t) _N_bins, (size_t) _matrix.filled1() - 1 ); // rows past index1_data()[filled1()-1] are empty
+    rows.row_ptr = &_matrix.index1_data()[0];
+    rows.col = &_matrix.index2_data()[0];
+    rows.value = &_matrix.value_data()[0];
+    f( rows );
+    return;
+  }
+
+  const bool lazy = _lazy_longest_squared != 0 || !_lazy_repeat_factors.empty();
+  vector<int64_t> values;
+
+  for ( size_t t = 0; t < _tiles->N_tiles(); t++ ) {
+    GLMRows rows = _tiles->tile(t);
+
+    if ( lazy ) {
+      values.assign( rows.value, rows.value + rows.row_ptr[ rows.end - rows.begin ] );
+      for ( size_t i = rows.begin; i < rows.end; i++ )
+	for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ )
+	  values[k] = LazyLink( i, rows.col[k], values[k] );
+      rows.value = values.data();
+    }
+
+    f( rows );
+  }
+}
+
+
+
+
+// LazyLink: Out of core, apply the normalizations that have been done on this GLM to element (i,j), in the order they must have been done in (see
+// NormalizeToDeNovoContigLengths and SkipRepeats).
+int64_t
+GenomeLinkMatrix::LazyLink( const int i, const int j, int64_t N_links ) const
+{
+  if ( _lazy_longest_squared != 0 ) {
+    const vector<int> & lens = _lazy_use_RE_sites ? _contig_RE_sites : _contig_lengths;
+    N_links = NormalizedLinks( N_links, _lazy_longest_squared, lens[i], lens[j] );
+  }
+  if ( !_lazy_repeat_factors.empty() )
+    N_links = DividedLinks( N_links, _lazy_repeat_factors[i] );
+  return N_links;
 }
 
 
@@ -1438,20 +2139,163 @@ GenomeLinkMatrix::LoadRESitesFile( const string & RE_sites_file )
 
 
 
+// BinPairTally: A tally of the links between pairs of bins, used by LoadFromSAM and LoadFromLinks to accumulate the Hi-C data before it is put into _matrix.
+// This is a hash table (see khash.h) keyed on the bin pair, packed into 64 bits.  Since the matrix is symmetric, each pair is stored only once, with the
+// lower bin ID first.
+KHASH_MAP_INIT_INT64( bin_pair, int64_t )
+
+struct BinPairTally
+{
+  BinPairTally() : _hash( kh_init(bin_pair) ) {}
+  ~BinPairTally() { kh_destroy( bin_pair, _hash ); }
+
+  // add: Add N links between bins bin1 and bin2 (in either order).
+  void add( int bin1, int bin2, const int64_t N = 1 )
+  {
+    if ( bin1 > bin2 ) swap( bin1, bin2 );
+    int absent;
+    khiter_t k = kh_put( bin_pair, _hash, ( khint64_t(bin1) << 32 ) | khint64_t(bin2), &absent );
+    assert( absent >= 0 ); // out of memory
+    if ( absent ) kh_value( _hash, k ) = N;
+    else          kh_value( _hash, k ) += N;
+  }
+
+  // add: Add all of the links in another tally into this one.
+  void add( const BinPairTally & tally )
+  {
+    for ( khiter_t k = kh_begin( tally._hash ); k != kh_end( tally._hash ); k++ )
+      if ( kh_exist( tally._hash, k ) ) add( kh_key( tally._hash, k ) >> 32, kh_key( tally._hash, k ) & 0xffffffff, kh_value( tally._hash, k ) );
+  }
+
+  // free: Empty this tally and release its memory.
+  void free() { kh_destroy( bin_pair, _hash ); _hash = kh_init(bin_pair); }
+
+  size_t size() const { return kh_size( _hash ); }
+
+  khash_t(bin_pair) * _hash;
+
+private:
+  BinPairTally( const BinPairTally & ); // not copyable
+  BinPairTally & operator=( const BinPairTally & );
+};
+
+
+
+
 // LoadFromSAM: Fill this GenomeLinkMatrix with data from one or more SAM/BAM files.
 // Note that this is NOT the same function as ChromLinkMatrix::LoadFromSAM() because the two objects store Hi-C data differently.
-// DO NOT CALL THIS FUNCTION DIRECTLY - instead call the wrappers LoadFromSAMDeNovo() or LoadFromSAMNonDeNovo(), which fill bins_per_contig.
+// The files are read in parallel (see SAMIngest.h), each into its own BinPairTally; these are then added together in file order, and the total is put into
+// _matrix at the end.  Only the subsample of the read pairs given by subsample_fraction is used (see SAMStepper::FilterSubsample).
 void
-GenomeLinkMatrix::LoadFromSAM( const string & SAM_file, const vector<int> & bins_per_contig )
+GenomeLinkMatrix::LoadFromSAM( const vector<string> & SAM_files, const vector<int> & bins_per_contig, const int N_threads, const double subsample_fraction )
 {
+  const vector<int> contig_offsets = ContigOffsets( bins_per_contig );
+
+  vector<BinPairTally> links( SAM_files.size() );
+  BinPairTally total;
+
+  ForEachSAMFile( SAM_files, N_threads,
+		  [&]( const size_t i, ostream & log ) { ReadLinksFromSAM( SAM_files[i], subsample_fraction, contig_offsets, links[i], log ); },
+		  [&]( const size_t i ) {
+		    _SAM_files.push_back( SAM_files[i] );
+		    total.add( links[i] );
+		    links[i].free(); // free memory
+		  } );
+
+  SetMatrixFromTally( total );
+}
+
+
+
+
+// LoadFromLinks: Fill this GenomeLinkMatrix with data from a HiCLinkFile.  This is just like LoadFromSAM, but much faster.
+// As in LoadFromSAM, each SAM file's records are tallied separately, possibly in parallel, and the tallies are added together in file order.
+void
+GenomeLinkMatrix::LoadFromLinks( const HiCLinkFile & links, const vector<int> & bins_per_contig, const int N_threads )
+{
+  const vector<int> contig_offsets = ContigOffsets( bins_per_contig );
+
+  vector<BinPairTally> file_links( links.N_SAM_files() );
+  BinPairTally total;
+
+  ForEachSAMFile( links.SAM_files(), N_threads,
+		  [&]( const size_t i, ostream & log ) { ReadLinksFromLinkFile( links, i, contig_offsets, file_links[i], log ); },
+		  [&]( const size_t i ) {
+		    _SAM_files.push_back( links.SAM_files()[i] );
+		    total.add( file_links[i] );
+		    file_links[i].free(); // free memory
+		  } );
+
+  SetMatrixFromTally( total );
+}
+
 
-  bool verbose = true;
 
-  cout << "Reading Hi-C data (" << _species << ") from SAM file " << SAM_file << (verbose ? "\t(dot = 1M alignments)" : "" ) << endl;
-  assert( boost::filesystem::is_regular_file( SAM_file ) );
-  _SAM_files.push_back( SAM_file );
 
-  // Using the number of bins in each contig, find the offset of each contig in the vector of bins.  This is just an indexing exercise.
+// SetMatrixFromTally: Helper function for LoadFromSAM and LoadFromLinks.  Add the links in the tally into _matrix.
+// The row-major compressed arrays underlying _matrix are built directly (as in ReadBinaryFile), in one pass over the bin pairs sorted by (lower bin, higher
+// bin).  In that order, each row's entries come out already sorted by column: first the entries below the diagonal, from the pairs whose higher bin is this
+// row, then the ones on and above it, from the pairs whose lower bin is this row.
+void
+GenomeLinkMatrix::SetMatrixFromTally( BinPairTally & tally )
+{
+  cout << "Building the sparse matrix from " << tally.size() << " pairs of linked bins..." << endl;
+
+  // If _matrix already has data in it, fold that into the tally too.  Since _matrix is symmetric, only take the entries on and above the diagonal.
+  typedef boost::numeric::ublas::compressed_matrix<int64_t> CM;
+  for ( CM::const_iterator1 it1 = _matrix.begin1(); it1 != _matrix.end1(); ++it1 )
+    for ( CM::const_iterator2 it2 = it1.begin(); it2 != it1.end(); ++it2 )
+      if ( it2.index1() <= it2.index2() && *it2 != 0 ) tally.add( it2.index1(), it2.index2(), *it2 );
+
+  // Sort the bin pairs.
+  vector< pair<khint64_t,int64_t> > pairs;
+  pairs.reserve( tally.size() );
+  for ( khiter_t k = kh_begin( tally._hash ); k != kh_end( tally._hash ); k++ )
+    if ( kh_exist( tally._hash, k ) ) pairs.push_back( make_pair( kh_key( tally._hash, k ), kh_value( tally._hash, k ) ) );
+  tally.free();
+  sort( pairs.begin(), pairs.end() );
+
+  // Count the entries in each row.  Each pair of distinct bins makes two entries in the matrix, one in each bin's row.
+  vector<size_t> row_start( _N_bins+1, 0 );
+  for ( size_t i = 0; i < pairs.size(); i++ ) {
+    const int bin1 = pairs[i].first >> 32, bin2 = pairs[i].first & 0xffffffff;
+    row_start[bin1+1]++;
+    if ( bin1 != bin2 ) row_start[bin2+1]++;
+  }
+  for ( int i = 0; i < _N_bins; i++ )
+    row_start[i+1] += row_start[i];
+  const size_t N = row_start[_N_bins];
+
+  // Fill the arrays.
+  _matrix = CM( _N_bins, _N_bins, N );
+  CM::index_array_type & index1 = _matrix.index1_data();
+  CM::index_array_type & index2 = _matrix.index2_data();
+  CM::value_array_type & value  = _matrix.value_data();
+  copy( row_start.begin(), row_start.end(), index1.begin() );
+
+  vector<size_t> & next = row_start; // next[i] = position of the next entry in row i
+  for ( size_t i = 0; i < pairs.size(); i++ ) {
+    const int bin1 = pairs[i].first >> 32, bin2 = pairs[i].first & 0xffffffff;
+    index2[ next[bin1] ] = bin2;
+    value [ next[bin1] ] = pairs[i].second;
+    next[bin1]++;
+    if ( bin1 == bin2 ) continue;
+    index2[ next[bin2] ] = bin1;
+    value [ next[bin2] ] = pairs[i].second;
+    next[bin2]++;
+  }
+
+  _matrix.set_filled( _N_bins+1, N );
+}
+
+
+
+
+// ContigOffsets: Helper function for LoadFromSAM and LoadFromLinks.  Using the number of bins in each contig, find the offset of each contig in the vector of
+// bins.  This is just an indexing exercise.
+vector<int>
+GenomeLinkMatrix::ContigOffsets( const vector<int> & bins_per_contig ) const
+{
   int contig_start = 0;
   vector<int> contig_offsets;
   int N_chroms = bins_per_contig.size();
@@ -1461,85 +2305,123 @@ GenomeLinkMatrix::LoadFromSAM( const string & SAM_file, const vector<int> & bins
   }
   assert( contig_start == _N_bins ); // this will fail if _N_bins is not the sum of bins_per_contig.
 
-  vector<int> contig_lens = TargetLengths( SAM_file );
+  return contig_offsets;
+}
 
 
-  // Set up a mapped matrix to handle the data as it comes in.  Later this will be converted to a compressed_matrix object for referencing.
-  boost::numeric::ublas::mapped_matrix<double> mapped_matrix( _N_bins, _N_bins );
 
 
+// LinkBins: Helper function for ReadLinksFromSAM and ReadLinksFromLinkFile.  Decide whether this read (at tid.pos, with mapping quality qual, and with its
+// mate at mtid.mpos) should be counted in the matrix.  If so, return true and find the bins of the read and of its mate.
+bool
+GenomeLinkMatrix::LinkBins( const int tid, const int pos, const int mtid, const int mpos, const int qual, const vector<int> & contig_offsets,
+			    int & bin1, int & bin2 ) const
+{
+  const int N_chroms = contig_offsets.size();
 
-  // Set up a SAMStepper object to read in the alignments.
-  SAMStepper stepper(SAM_file);
-  stepper.FilterAlignedPairs(); // Only look at read pairs where both reads aligned to the assembly.
+  // Ignore the oddly large number of cases where both reads map to the same location.  (Maybe these are cases in which really only one read mapped?  Dunno.)
+  if ( pos == mpos ) return false;
 
-  // Loop over all alignments.
-  for ( bam1_t * align = stepper.next_read(); align != NULL; align = stepper.next_read() ) {
-    const bam1_core_t & c = align->core;
+  // Ignore reads whose partner is not aligned.
+  if ( mtid == -1 ) return false;
 
-    //cout << "ALIGNMENT POSITIONS: " << c.tid << "." << c.pos << "\t" << c.mtid << "." << c.mpos << endl;
+  // Ignore reads with mapping quality 0.  (In the GSM862723 dataset this is roughly 4% of reads.)
+  if ( qual == 0 ) return false;
 
-    if ( verbose && stepper.N_aligns_read() % 1000000 == 0 ) cout << "." << flush;
+  // Skip links involving non-canonical chromosomes.
+  if ( tid >= N_chroms || mtid >= N_chroms ) return false;
 
-    // Ignore the oddly large number of cases where both reads map to the same location.  (Maybe these are cases in which really only one read mapped?  Dunno.)
-    if ( c.pos == c.mpos ) continue;
+  // Find the bin ID of each read.  If the contigs are not being divided, then the contig IDs correspond with bin IDs, and this is easy.
+  bin1 = contig_offsets[ tid];
+  bin2 = contig_offsets[mtid];
 
-    // Ignore reads whose partner is not aligned.
-    if ( c.mtid == -1 ) continue;
+  // For non-de novo GLMs, adjust the bin IDs by finding the bin ID of each read's position *within its chromosome*, and then applying the chromosomal offset
+  // to the bin IDs.  This makes each genomic position (within a range of bin_size) into a unique bin ID.
+  if ( !DeNovo() ) {
+    bin1 +=  pos / _bin_size;
+    bin2 += mpos / _bin_size;
+  }
 
-    // Ignore reads with mapping quality 0.  (In the GSM862723 dataset this is roughly 4% of reads.)
-    if ( c.qual == 0 ) continue;
+  assert( bin1 < _N_bins );
+  assert( bin2 < _N_bins );
 
-    // Skip links involving non-canonical chromosomes.
-    if ( c.tid >= N_chroms || c.mtid >= N_chroms ) continue;
+  // Don't bother marking intra-bin links; these are not informative for clustering.
+  return bin1 != bin2;
+}
 
-    // Find the bin ID of each read.  If the contigs are not being divided, then the contig IDs correspond with bin IDs, and this is easy.
-    int bin1 = contig_offsets[c. tid];
-    int bin2 = contig_offsets[c.mtid];
 
-    // For non-de novo GLMs, adjust the bin IDs by finding the bin ID of each read's position *within its chromosome*, and then applying the chromosomal offset
-    // to the bin IDs.  This makes each genomic position (within a range of bin_size) into a unique bin ID.
-    if ( !DeNovo() ) {
-      bin1 += c. pos / _bin_size;
-      bin2 += c.mpos / _bin_size;
-    }
 
-    assert( bin1 < _N_bins );
-    assert( bin2 < _N_bins );
 
-    // Don't bother marking intra-bin links; these are not informative for clustering.
-    if ( bin1 == bin2 ) continue;
+// ReadLinksFromLinkFile: Helper function for LoadFromLinks.  Tally the records from SAM file #i in the HiCLinkFile into 'file_links'.
+// Each read pair counts as two reads, just as if the reads had been read one at a time from the SAM file.
+// Like ReadLinksFromSAM, this doesn't modify this GenomeLinkMatrix, so it can run in a worker thread.
+void
+GenomeLinkMatrix::ReadLinksFromLinkFile( const HiCLinkFile & links, const size_t i, const vector<int> & contig_offsets,
+					 BinPairTally & file_links, ostream & log ) const
+{
+  log << "Reading Hi-C data (" << _species << ") for SAM file " << links.SAM_files()[i] << " from link file " << links.file() << endl;
 
-    // TEMP: Re-weight links by their distance from the edge of the contig. (this isn't done yet, doesn't seem to have an effect - I need to work on it more!)
-    double weight = 1;
-    if(0) {
-      const int & len1 = _contig_lengths[bin1];
-      const int & len2 = _contig_lengths[bin2];
-
-      int dist1 = min( c. pos, abs( len1 - c. pos ) );
-      int dist2 = min( c.mpos, abs( len2 - c.mpos ) );
-      int dist = dist1 + dist2; // minimum = 0; maximum = (len1+len2)/2
-      double dist_norm = 2 * dist / double( len1+len2 ); // minimum = 0; maximum = 1
-      weight = 2 * ( 1 - dist_norm ); // minimum = 0; maximum = 2 (max is at dist = 0)
-      //PRINT3( dist, dist_norm, weight );
-    }
+  int bin1, bin2;
+  for ( const HiCLink * link = links.begin(i); link != links.end(i); ++link ) {
+
+    if ( LinkBins( link->tid, link->pos, link->mtid, link->mpos, link->qual, contig_offsets, bin1, bin2 ) )
+      file_links.add( bin1, bin2 );
 
-    // Tally the appropriate spots in the 2-d matrix.
-    mapped_matrix(bin1,bin2) += weight;
-    mapped_matrix(bin2,bin1) += weight;
+    // The other read in a pair.
+    if ( link->type == HIC_LINK_PAIR && LinkBins( link->mtid, link->mpos, link->tid, link->pos, link->mqual, contig_offsets, bin1, bin2 ) )
+      file_links.add( bin1, bin2 );
   }
 
+  log << "N aligns read from " << links.SAM_files()[i] << ": " << links.N_aligns(i) << endl;
+  log << "N pairs of linked bins: " << file_links.size() << endl;
+}
+
 
 
 
-  if ( verbose ) cout << endl;
-  cout << "N aligns read from " << SAM_file << ": " << stepper.N_aligns_read() << endl;
+// ReadLinksFromSAM: Helper function for LoadFromSAM.  Tally the Hi-C links in one SAM/BAM file into 'links', writing progress output to log.
+// This function may be run on several SAM files at once, in different threads, so it doesn't modify this GenomeLinkMatrix.
+void
+GenomeLinkMatrix::ReadLinksFromSAM( const string & SAM_file, const double subsample_fraction, const vector<int> & contig_offsets, BinPairTally & links,
+				    ostream & log ) const
+{
+  bool verbose = true;
+
+  log << "Reading Hi-C data (" << _species << ") from SAM file " << SAM_file << (verbose ? "\t(dot = 1M alignments)" : "" ) << endl;
+  assert( boost::filesystem::is_regular_file( SAM_file ) );
+
+
+  // Set up a SAMStepper object to read in the alignments.
+  SAMStepper stepper(SAM_file);
+  stepper.FilterAlignedPairs(); // Only look at read pairs where both reads aligned to the assembly.
+  stepper.FilterSubsample( subsample_fraction );
+
+  // Loop over all alignments, a batch at a time.
+  SAMBatch aligns;
+  int64_t N_aligns_before = 0;
+  while ( stepper.next_batch( aligns ) ) {
+    for ( size_t j = 0; j < aligns.size(); j++ ) {
+
+      //cout << "ALIGNMENT POSITIONS: " << aligns.tid[j] << "." << aligns.pos[j] << "\t" << aligns.mtid[j] << "." << aligns.mpos[j] << endl;
+
+      if ( verbose && ( N_aligns_before + j + 1 ) % 1000000 == 0 ) log << "." << flush;
+
+      // Find the bins of this read and its mate, if the read is to be counted at all.
+      int bin1, bin2;
+      if ( !LinkBins( aligns.tid[j], aligns.pos[j], aligns.mtid[j], aligns.mpos[j], aligns.qual[j], contig_offsets, bin1, bin2 ) ) continue;
+
+      // Tally this pair of bins.
+      links.add( bin1, bin2 );
+    }
+    N_aligns_before += aligns.size();
+  }
 
 
-  // Convert all the data from this SAM file to compressed_matrix format, and add it in.
-  cout << "Compressing mapped_matrix data..." << endl;
-  boost::numeric::ublas::compressed_matrix<int64_t> compressed_matrix = mapped_matrix;
-  _matrix = _matrix + compressed_matrix;
+
+
+  if ( verbose ) log << endl;
+  log << "N aligns read from " << SAM_file << ": " << stepper.N_aligns_read() << endl;
+  log << "N pairs of linked bins: " << links.size() << endl;
 }
 
 
@@ -1579,7 +2461,7 @@ GenomeLinkMatrix::BinsPerChromInHumanGenome() const
 // skipped contig needs to link into that cluster with at least NONINFORMATIVE_RATIO times as many links as any other cluster.  So, lower values of
 // NONINFORMATIVE_RATIO (above 0) lead to more aggressive clustering of skipped contigs.
 void
-GenomeLinkMatrix::SetClusters( const vector<int> & bin_to_clusterID, const double NONINFORMATIVE_RATIO )
+GenomeLinkMatrix::SetClusters( const vector<int> & bin_to_clusterID, const double NONINFORMATIVE_RATIO, const int N_threads )
 {
   cout << "SetClusters" << endl;
   assert( (int) bin_to_clusterID.size() == _N_bins );
@@ -1598,38 +2480,105 @@ GenomeLinkMatrix::SetClusters( const vector<int> & bin_to_clusterID, const doubl
 
 
 
-  // Now loop over all skipped contigs.  For each skipped contig, determine which cluster it has the largest average linkage to.
+  // Now loop over all skipped contigs.  For each skipped contig, determine which cluster it has the largest average linkage to, and compare that linkage
+  // to the second-largest.  The average linkage to a cluster is the sum of the contig's links to the cluster's contigs, over the cluster's size.
+  // This only takes a scan of the contig's row of the matrix: each link to a contig in a cluster adds to that cluster's sum.  The clusters it has no links to
+  // have an average linkage of 0.  The best and second-best clusters are chosen as if from a list of all the clusters in order of decreasing average linkage,
+  // with ties going to the lower cluster ID.  (If only one cluster is eligible, the second-best linkage is taken to be 0.)
+  // The rows are split among up to N_threads threads, and each contig's result is recorded in its own slot: its best cluster if it passes the ratio test,
+  // or -1 if it fails, or -2 if there are no clusters it could go into.
+  const vector<int> contig_cluster = _clusters.cluster_IDs();
+  vector<int> eligible_clusters; // clusters that skipped contigs can be put into
+  vector<bool> eligible( _clusters.size(), false );
+  for ( size_t j = 0; j < _clusters.size(); j++ )
+    if ( _clusters[j].size() > 1 || cluster_noninformative_into_singletons ) {
+      eligible_clusters.push_back( j );
+      eligible[j] = true;
+    }
+
+  vector<int> skipped_cluster( _N_bins, -1 );
+  const int N_blocks = min( NThreadsToUse( N_threads ), max( _N_bins, 1 ) );
+
+  ForEachRowBlock( [&]( const GLMRows & rows ) {
+      ParallelForRanges( rows.end - rows.begin, N_blocks, [&]( const int, const size_t begin, const size_t end ) {
+	  vector<int64_t> total_linkage( _clusters.size(), 0 );
+	  vector<bool> linked( _clusters.size(), false );
+	  vector<int> linked_clusters;
+
+	  for ( size_t i = rows.begin + begin; i < rows.begin + end; i++ ) {
+	    if ( bin_to_clusterID[i] != -1 ) continue; // this indicates a skipped contig
+	    assert( contig_cluster[i] == -1 );
+
+	    // Determine, for each cluster, the total linkage between this skipped contig and the contigs in that cluster.
+	    for ( size_t k = rows.row_ptr[i-rows.begin]; k < rows.row_ptr[i-rows.begin+1]; k++ ) {
+	      const size_t j = rows.col[k];
+	      const int cluster = contig_cluster[j];
+	      if ( j == i || cluster == -1 || !eligible[cluster] ) continue;
+	      if ( !linked[cluster] ) {
+		linked[cluster] = true;
+		linked_clusters.push_back( cluster );
+	      }
+	      total_linkage[cluster] += rows.value[k];
+	    }
+
+	    // Find the best and second-best clusters: from the clusters with links, and from the first two (by ID) clusters without, which have a linkage of 0.
+	    int best_cluster = -1, second_best_cluster = -1;
+	    double best_avg_linkage = 0, second_best_avg_linkage = 0;
+	    int N_zeros = 0;
+	    for ( size_t x = 0; x < linked_clusters.size() + eligible_clusters.size() && N_zeros < 2; x++ ) {
+	      int cluster;
+	      double avg_linkage = 0;
+	      if ( x < linked_clusters.size() ) {
+		cluster = linked_clusters[x];
+		avg_linkage = total_linkage[cluster] / double( _clusters[cluster].size() );
+	      }
+	      else {
+		cluster = eligible_clusters[ x - linked_clusters.size() ];
+		if ( linked[cluster] ) continue;
+		N_zeros++;
+	      }
+
+	      if ( best_cluster == -1 || avg_linkage > best_avg_linkage || ( avg_linkage == best_avg_linkage && cluster < best_cluster ) ) {
+		second_best_cluster = best_cluster;
+		second_best_avg_linkage = best_avg_linkage;
+		best_cluster = cluster;
+		best_avg_linkage = avg_linkage;
+	      }
+	      else if ( second_best_cluster == -1 || avg_linkage > second_best_avg_linkage || ( avg_linkage == second_best_avg_linkage && cluster < second_best_cluster ) ) {
+		second_best_cluster = cluster;
+		second_best_avg_linkage = avg_linkage;
+	      }
+	    }
+
+	    for ( size_t x = 0; x < linked_clusters.size(); x++ ) {
+	      total_linkage[ linked_clusters[x] ] = 0;
+	      linked[ linked_clusters[x] ] = false;
+	    }
+	    linked_clusters.clear();
+
+	    if ( best_cluster == -1 ) { skipped_cluster[i] = -2; continue; } // there are no clusters to put this contig in
+
+	    // Compare this best cluster's linkage to the second-best.
+	    double ratio = best_avg_linkage / second_best_avg_linkage;
+	    bool pass_ratio = ratio >= NONINFORMATIVE_RATIO;
+	    if ( second_best_avg_linkage == 0 ) pass_ratio = ( best_avg_linkage > 0 ); // handle division by 0
+	    skipped_cluster[i] = pass_ratio ? best_cluster : -1;
+	  }
+	} );
+    } );
+
+  // Record the cluster with the highest average linkage to each skipped contig that passed.
+  // Don't assign the skipped contigs to clusters in the loop above (otherwise they would influence the placement of subsequent skipped contigs.)
   map<int,int> skipped_clusters;
   int N_pass_ratio = 0, N_fail_ratio = 0, N_fail_cluster = 0;
-
   for ( int i = 0; i < _N_bins; i++ ) {
-    if ( bin_to_clusterID[i] != -1 ) continue; // this indicates a skipped contig
-
-    // Determine, for each cluster, the average amount of linkage between this skipped contig and the contigs in that cluster.
-    multimap< double, int, greater<double> > cluster_linkages;
-    FindClusterLinkages( i, cluster_linkages );
-
-    if ( cluster_linkages.empty() ) { N_fail_cluster++; continue; } // this contig has no links with any established clusters - so don't assign it to a cluster
-
-    // Find the cluster that contains the most average linkage to this contig.
-    multimap< double, int, greater<double> >::const_iterator it = cluster_linkages.begin();
-    double best_avg_linkage = it->first;
-    int best_cluster = it->second;
-    it++;
-
-    // Compare this best cluster's linkage to the second-best.
-    double second_best_avg_linkage = it->first;
-    double ratio = best_avg_linkage / second_best_avg_linkage;
-    bool pass_ratio = ratio >= NONINFORMATIVE_RATIO;
-    if ( second_best_avg_linkage == 0 ) pass_ratio = ( best_avg_linkage > 0 ); // handle division by 0
-    //cout << "CONTIG #" << i << " (len=" << _contig_lengths[i] << ")\tBEST (" << best_cluster << "): " << best_avg_linkage << "\tSECOND BEST: " << second_best_avg_linkage << "\tRATIO: " << ratio << "\t->\t" << ( pass ? "NO" : "YES" ) << endl;
-
-    if ( !pass_ratio ) { N_fail_ratio++; continue; }
-
-    // Record the cluster with the highest average linkage to this skipped contig.
-    // Don't yet assign the skipped contig to the cluster (otherwise it will influence the placement of subsequent skipped contigs.)
-    skipped_clusters[i] = best_cluster;
-    N_pass_ratio++;
+    if ( bin_to_clusterID[i] != -1 ) continue;
+    if      ( skipped_cluster[i] == -2 ) N_fail_cluster++;
+    else if ( skipped_cluster[i] == -1 ) N_fail_ratio++;
+    else {
+      skipped_clusters[i] = skipped_cluster[i];
+      N_pass_ratio++;
+    }
   }
 
 
@@ -1647,47 +2596,6 @@ GenomeLinkMatrix::SetClusters( const vector<int> & bin_to_clusterID, const doubl
 
 
 
-// FindClusterLinkages: Make a map of [avg linkage from this contig to a cluster] -> [the cluster ID], sorted in descending order by linkage.
-// Uses the variable _clusters in place.
-// May return an empty multimap, if this contig has no links to any contigs in any clusters.
-void
-GenomeLinkMatrix::FindClusterLinkages( const int contig_ID, multimap< double, int, greater<double> > & cluster_linkages ) const
-{
-  assert( !_clusters.empty() );
-
-  cluster_linkages.clear(); // this is the output object
-
-  for ( size_t j = 0; j < _clusters.size(); j++ ) {
-
-    int64_t total_linkage = 0;
-    //int64_t max_linkage = 0;
-    //set<int> linkages;
-
-    // Find this cluster's size.  If it's a singleton cluster, skip it (unless cluster_noninformative_into_singletons is set.)
-    int cluster_size = _clusters[j].size();
-    if ( cluster_size == 1 && !cluster_noninformative_into_singletons ) continue;
-
-    // Calculate the average linkage beween this contig and this cluster. (alternative, commented forms: calculate maximum or median instead)
-    for ( set<int>::const_iterator it = _clusters[j].begin(); it != _clusters[j].end(); ++it ) {
-      if ( contig_ID == *it ) cluster_size--; // if the contig is in the cluster, normalize the cluster size properly
-      else total_linkage += _matrix( contig_ID, *it );
-      //PRINT3( contig_ID, *it, _matrix( contig_ID, *it ) );
-      //max_linkage = max( max_linkage, _matrix( contig_ID, *it ) );
-      //linkages.insert( _matrix( contig_ID, *it ) );
-    }
-    double avg_linkage = total_linkage / double( cluster_size );
-
-    //int median_linkage = median_of_set( linkages );
-    //PRINT3( avg_linkage, median_linkage, max_linkage );
-
-    cluster_linkages.insert( make_pair( avg_linkage, j ) );
-    //cout << "Contig #" << contig_ID << " (len=" << _contig_lengths[contig_ID] << ") into cluster #" << j << " (size = " << _clusters[j].size() << "):\tavg_linkage = " << avg_linkage << endl;
-  }
-}
-
-
-
-
 // cluster_w_len: Helper struct for CanonicalizeClusters, below.
 struct cluster_w_len {
   int cluster_ID;
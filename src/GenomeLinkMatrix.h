@@ -24,7 +24,10 @@
  * The main data structure is the 2-D matrix, which is a Boost UBLAS compressed_matrix.  This structure is memory-efficient for large, sparse matrices, which
  * are otherwise O(N^2) in memory and very problematic to use.  It is less memory-efficient than a simple 2-D array for small, dense matrices, but in this case
  * the overall memory usage is quite low.  The only danger is that there may be cases where the matrix is large, yet still dense - perhaps when there is a huge
- * amount of Hi-C data.
+ * amount of Hi-C data.  For these cases there is an out-of-core mode: a GLM loaded from a binary GLM file with a memory budget leaves the matrix on disk,
+ * and reads it in blocks of rows ("tiles") as they're needed, keeping no more than about memory_budget bytes of them in memory at once (see GLMTiles.h).
+ * Normalization is then applied to each matrix element as it's read in, rather than to the matrix itself.  Out-of-core GLMs can't be reordered by
+ * ReorderContigsByRef().
  * This class is fundamentally different from ChromLinkMatrix because the main data structure is a matrix of ints instead of a matrix of vectors.
  *
  * There are two different types of GenomeLinkMatrices: "de novo" and "non-de novo".
@@ -46,8 +49,9 @@
  * -- Cluster these bins based on their link density.  This creates a ClusterVec object.  This is the main algorithm!
  * -- Analyze and validate the clusters.
  *
- * The functions ReadFile() and WriteFile() can be used to read/write GenomeLinkMatrix objects from GenomeLinkMatrix format (*.GLM) files.
- * GLM files can be made into graphics using heatmap.R.
+ * The functions ReadFile() and WriteFile() can be used to read/write GenomeLinkMatrix objects from GenomeLinkMatrix format (*.GLM) files.  There are two GLM
+ * formats: a binary format, which stores the matrix in CSR form and can be loaded quickly via mmap (this is the default for cache files), and a text format,
+ * which is human-readable.  ReadFile() reads either one.  Text GLM files can be made into graphics using heatmap.R.
  *
  *
  * Algorithm notes:
@@ -73,9 +77,14 @@
 
 #include "ClusterVec.h"
 #include "TrueMapping.h"
+#include "HiCLinks.h"
+#include "GLMTiles.h"
 #include <string>
 #include <vector>
 #include <map> // multimap
+#include <memory> // shared_ptr
+#include <functional>
+#include <iostream>
 using namespace std;
 
 // Boost libraries
@@ -83,6 +92,10 @@ using namespace std;
 
 
 
+struct BinPairTally; // defined in GenomeLinkMatrix.cc
+class HeatmapPyramid; // see Heatmap.h
+
+
 
 class GenomeLinkMatrix
 {
@@ -93,33 +106,46 @@ class GenomeLinkMatrix
   // Make a non-de novo GenomeLinkMatrix with no Hi-C link data.  This isn't good for much other than calling NonDeNovoTrueMapping().
   GenomeLinkMatrix( const string & species, const int bin_size );
   // Load a non-de novo GenomeLinkMatrix (HUMAN ONLY) with a set of SAM files representing human-genome alignments.  Split the GLM into bins of size bin_size.
-  GenomeLinkMatrix( const vector<string> & SAM_files, const int bin_size );
+  // The SAM files are read with up to N_threads threads (0 = one per core; see SAMIngest.h).  If subsample_fraction < 1, only that fraction of the read
+  // pairs is used (see SAMStepper::FilterSubsample).
+  GenomeLinkMatrix( const vector<string> & SAM_files, const int bin_size, const int N_threads = 1, const double subsample_fraction = 1 );
   // Load a de novo GenomeLinkMatrix with a set of SAM files representing alignments to contigs.
-  GenomeLinkMatrix( const string & species, const vector<string> & SAM_files, const string & RE_sites_file = "" );
+  GenomeLinkMatrix( const string & species, const vector<string> & SAM_files, const string & RE_sites_file = "", const int N_threads = 1,
+		    const double subsample_fraction = 1 );
+  // Load a de novo GenomeLinkMatrix from a HiCLinkFile, which was extracted from a set of SAM files.  This is equivalent to, but faster than, loading from the
+  // SAM files themselves.
+  GenomeLinkMatrix( const string & species, const HiCLinkFile & links, const string & RE_sites_file = "", const int N_threads = 1 );
   // Load a GenomeLinkMatrix from a file that was previously written with WriteFile().  This may or may not be a de novo GLM.
-  GenomeLinkMatrix( const string & LM_file ) { ReadFile( LM_file ); }
+  // If memory_budget > 0 and the file is in the binary format, the GLM is out-of-core, using about this many bytes of memory for the matrix (see above).
+  GenomeLinkMatrix( const string & LM_file, const size_t memory_budget = 0 ) { ReadFile( LM_file, memory_budget ); }
 
 
 
   /* QUERY FUNCTIONS */
   int N_bins() const { return _N_bins; }
+  const vector<int> & ContigLengths() const { return _contig_lengths; } // in the current order of the contigs (see ReorderContigsByRef)
+  bool OutOfCore() const { return _tiles != NULL; }
 
 
   /* FILE I/O */
 
-  // ReadFile: Read the data from file GLM_file into this GenomeLinkMatrix.
-  void ReadFile( const string & GLM_file );
-  // WriteFile: Write the data in this GenomeLinkMatrix to file GLM_file.
-  void WriteFile( const string & GLM_file ) const;
+  // ReadFile: Read the data from file GLM_file into this GenomeLinkMatrix.  The file may be in the binary or the text format.
+  // If memory_budget > 0 and the file is binary, leave the matrix in the file, making this GLM out-of-core.
+  void ReadFile( const string & GLM_file, const size_t memory_budget = 0 );
+  // WriteFile: Write the data in this GenomeLinkMatrix to file GLM_file.  By default this writes the binary format; if text = true, write the text format.
+  // If compact = true, the binary format stores each link count in 32 bits instead of 64, if they all fit (they always do, unless the GLM is normalized).
+  void WriteFile( const string & GLM_file, const bool text = false, const bool compact = false ) const;
 
 
-  // LoadForSAMDeNovo: A wrapper for LoadFromSAM for de novo GLMs.
+  // LoadForSAMDeNovo: A wrapper for LoadFromSAM for de novo GLMs.  Multiple SAM files are read in parallel, with up to N_threads threads, and optionally
+  // subsampled.
   void LoadFromSAMDeNovo( const        string  & SAM_file  );
-  void LoadFromSAMDeNovo( const vector<string> & SAM_files );
+  void LoadFromSAMDeNovo( const vector<string> & SAM_files, const int N_threads = 1, const double subsample_fraction = 1 );
 
-  // LoadFromSAMNonDeNovo: A wrapper for LoadFromSAM for non-de novo GLMs.
+  // LoadFromSAMNonDeNovo: A wrapper for LoadFromSAM for non-de novo GLMs.  Multiple SAM files are read in parallel, with up to N_threads threads, and
+  // optionally subsampled.
   void LoadFromSAMNonDeNovo( const        string  & SAM_file  );
-  void LoadFromSAMNonDeNovo( const vector<string> & SAM_files );
+  void LoadFromSAMNonDeNovo( const vector<string> & SAM_files, const int N_threads = 1, const double subsample_fraction = 1 );
 
 
   /* DATA PRE-PROCESSING: NORMALIZATION, RE-ORDERING, ETC. */
@@ -150,18 +176,28 @@ class GenomeLinkMatrix
   // This should be run AFTER normalizing for contig length.
   void SkipRepeats( const double & repeat_multiplicity, const bool flip = false );
 
+  // Preprocess: In a de novo GLM, do all of the pre-processing before clustering: exactly the same as NormalizeToDeNovoContigLengths( use_RE_sites ),
+  // ReorderContigsByRef( *true_mapping ) (unless true_mapping is NULL), SkipContigsWithFewREs( min_N_REs ), and SkipRepeats( repeat_multiplicity ), in that
+  // order.  It's faster, because it makes only two passes over the matrix, and uses up to N_threads threads (0 = one per core).
+  void Preprocess( const bool use_RE_sites, TrueMapping * true_mapping, const int min_N_REs, const double repeat_multiplicity, const int N_threads = 1 );
+
   /* MAIN CLUSTERING ALGORITHMS
      Contigs that have been marked as "skipped" by one of the Skip...() functions are not used in clustering.  However, if set_skipped_contigs = true, then
      after clustering, skipped contigs are assigned to clusters by how well they match the non-skipped contigs (see SetClusters()).
      Contigs that have been marked as centromeric (CEN_contigs) will not be merged into the same cluster.
   */
 
-  // Agglomerative Hierarchical clustering
-  void AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CEN_contigs, const double MIN_AVG_LINKAGE, const double NONINFORMATIVE_RATIO, const bool DRAW_DOTPLOT, const TrueMapping * true_mapping );
+  // Agglomerative Hierarchical clustering.  The initial merge scores are calculated on up to N_threads threads; the clustering itself is serial.
+  void AHClustering( const int N_CLUSTERS_MIN, const vector<int> & CEN_contigs, const double MIN_AVG_LINKAGE, const double NONINFORMATIVE_RATIO, const bool DRAW_DOTPLOT, const TrueMapping * true_mapping, const int N_threads = 1 );
+  // AHClusteringSweep: Cluster as AHClustering( N_CLUSTERS_MINs[a], CEN_contigs, MIN_AVG_LINKAGE, NONINFORMATIVE_RATIOs[b], false, NULL, N_threads ) would,
+  // for every a and b; after setting each set of clusters, call report(a,b), which can look at them (e.g., with GetClusters().)  The merges are only done
+  // once, since N_CLUSTERS_MIN only decides where they stop, and NONINFORMATIVE_RATIO only affects the clusters' skipped contigs.
+  void AHClusteringSweep( const vector<int> & N_CLUSTERS_MINs, const vector<int> & CEN_contigs, const double MIN_AVG_LINKAGE, const vector<double> & NONINFORMATIVE_RATIOs,
+			  const function< void( const size_t, const size_t ) > & report, const int N_threads = 1 );
 
   // Improvements to clustering algorithms.
   void ExcludeLowQualityContigs( const TrueMapping & true_mapping ); // remove from the clusters all contigs whose alignments to reference are sketchy
-  void MoveContigsInClusters( const double annealing_factor );
+  void MoveContigsInClusters( const double annealing_factor, const int N_threads = 1 ); // the candidate moves are evaluated on up to N_threads threads
 
 
 
@@ -180,14 +216,18 @@ class GenomeLinkMatrix
 
   /* OUTPUT AND REPORTING */
 
-  int64_t NLinks( const int i, const int j ) const { return _matrix(i,j); }
+  // NLinks: Return the matrix element (i,j).  Out of core, this reads in the tile containing row i, so it's best to ask for elements one row at a time.
+  int64_t NLinks( const int i, const int j ) const;
 
   // SetClusters/GetClusters: Set or return the ClusterVec produced by Cluster().  Note that the clusters are not guaranteed to be in any particular order.
   void SetClusters( const ClusterVec & clusters ) { _clusters = clusters; }
   ClusterVec GetClusters() const;
 
-  // DrawHeatmap: Call WriteFile("heatmap.txt"), then run the R script "heatmap.R", which uses R and ggplot2 to make a heatmap image of this GenomeLinkMatrix.
+  // DrawHeatmap: Draw a heatmap image of this GenomeLinkMatrix at out/<heatmap_file> (a PNG file, by default out/heatmap.png), using a HeatmapPyramid.
   void DrawHeatmap( const string & heatmap_file = "" ) const;
+  // AddToHeatmap: Add each nonzero element (i,j) of the matrix, times scale, to the heatmap as element ( new_IDs[i], new_IDs[j] ), in one pass over the matrix.
+  // Rows and columns with new_IDs = -1 are left out.  If new_IDs is empty, the rows and columns keep their own IDs.
+  void AddToHeatmap( HeatmapPyramid & heatmap, const vector<int> & new_IDs = vector<int>(), const double scale = 1 ) const;
 
   // DrawClusterDotplot: Create a visual dotplot of a set of clusters, using QuickDotplot.  This requires a TrueMapping.
   void DrawClusterDotplot( const TrueMapping & true_mapping ) const;
@@ -197,6 +237,29 @@ class GenomeLinkMatrix
   // DeNovo: Return true iff this is a de novo GLM.
   bool DeNovo() const { return _bin_size == 0; }
 
+  // Helper functions for ReadFile() and WriteFile(), which handle the two file formats.
+  void ReadTextFile  ( const string & GLM_file );
+  void ReadBinaryFile( const string & GLM_file, const size_t memory_budget );
+  void ReadHeaderLine( const string & line );
+  string FileHeader() const;
+  void WriteTextFile  ( const string & GLM_file ) const;
+  void WriteBinaryFile( const string & GLM_file, const bool compact ) const;
+
+  // ForEachRowBlock: Call f() on blocks of rows that cover the whole matrix, in order.  In memory, the whole matrix is a single block, straight from the
+  // arrays underlying _matrix; out of core, each tile is a block.
+  void ForEachRowBlock( const function< void( const GLMRows & ) > & f ) const;
+  // LazyLink: Out of core, apply the normalizations that have been done (by NormalizeToDeNovoContigLengths() and SkipRepeats()) to element (i,j).
+  int64_t LazyLink( const int i, const int j, int64_t N_links ) const;
+
+  // Helpers for the pre-processing functions, shared with Preprocess().
+  // ReorderBinsByRef: Everything ReorderContigsByRef() does, except that it leaves the matrix alone.  Returns the new ID of each contig.
+  vector<int> ReorderBinsByRef( TrueMapping & true_mapping );
+  // RepeatFactors: Find each contig's repetitiveness factor from its number of links, mark the repetitive contigs for skipping, and return the factors.
+  vector<double> RepeatFactors( const vector<int64_t> & N_links, const int64_t N_links_total, const double & repeat_multiplicity );
+
+  // InitDeNovo: Set up everything in a de novo GLM except the link data.  Used by the de novo constructors.
+  void InitDeNovo( const string & species, const vector<string> & SAM_files, const string & RE_sites_file );
+
   // Initialize the matrix of data and allocate memory for it.
   void InitMatrix();
 
@@ -206,16 +269,34 @@ class GenomeLinkMatrix
   // LoadFromSAM: Fill this GenomeLinkMatrix's matrix with Hi-C data from one or more SAM/BAM files containing human genome-aligned reads.
   // Note that this is NOT the same function as ChromLinkMatrix::LoadFromSAM() because the two objects store Hi-C data differently.
   // DO NOT CALL THIS FUNCTION DIRECTLY - instead call the wrappers LoadFromSAMDeNovo() or LoadFromSAMNonDeNovo(), which fill bins_per_contig.
-  void LoadFromSAM( const string & SAM_file, const vector<int> & bins_per_contig );
+  // Only the subsample of the read pairs given by subsample_fraction is used.
+  void LoadFromSAM( const vector<string> & SAM_files, const vector<int> & bins_per_contig, const int N_threads, const double subsample_fraction );
+  // ReadLinksFromSAM: Helper for LoadFromSAM.  Tally one SAM file's links into 'links', without modifying this object, so it can run in a worker thread.
+  void ReadLinksFromSAM( const string & SAM_file, const double subsample_fraction, const vector<int> & contig_offsets, BinPairTally & links, ostream & log ) const;
+
+  // LoadFromLinks: Like LoadFromSAM, but reads the links from a HiCLinkFile instead.
+  void LoadFromLinks( const HiCLinkFile & links, const vector<int> & bins_per_contig, const int N_threads );
+  // ReadLinksFromLinkFile: Helper for LoadFromLinks.  Tally the records for SAM file #i into 'file_links', without modifying this object.
+  void ReadLinksFromLinkFile( const HiCLinkFile & links, const size_t i, const vector<int> & contig_offsets, BinPairTally & file_links, ostream & log ) const;
+  // SetMatrixFromTally: Helper for LoadFromSAM and LoadFromLinks.  Add the tallied links into _matrix, building its compressed arrays in a single pass.
+  void SetMatrixFromTally( BinPairTally & tally );
+
+  // ContigOffsets: Find the index of the first bin in each contig, given the number of bins in each contig.
+  vector<int> ContigOffsets( const vector<int> & bins_per_contig ) const;
+  // LinkBins: Decide whether a read should be counted in the matrix.  If so, return true and fill bin1, bin2 with the bins of the read and its mate.
+  bool LinkBins( const int tid, const int pos, const int mtid, const int mpos, const int qual, const vector<int> & contig_offsets, int & bin1, int & bin2 ) const;
 
   // Count the number of bins in the human genome.  This only works in non-de novo GLMs.
   vector<int> BinsPerChromInHumanGenome() const;
 
   // SetClusters: Assign the informative contigs (_skip_contig=false) into clusters in accordance with bin_to_clusterID.
   // If NONINFORMATIVE_RATIO != 0, also assign the skipped contigs to clusters by how well they match the non-skipped contigs.
-  void SetClusters( const vector<int> & bin_to_clusterID, const double NONINFORMATIVE_RATIO );
-  // FindClusterLinkages: Make a map of [avg linkage from this contig to a cluster] -> [the cluster ID], sorted in descending order by linkage.
-  void FindClusterLinkages( const int contig_ID, multimap< double, int, greater<double> > & cluster_linkages ) const;
+  // The skipped contigs are handled in parallel, on up to N_threads threads.
+  void SetClusters( const vector<int> & bin_to_clusterID, const double NONINFORMATIVE_RATIO, const int N_threads = 1 );
+  // AHMerge: The merging loop of AHClustering and AHClusteringSweep.  After each merge, call after_merge( N_merges, N_non_singleton_clusters,
+  // bin_to_clusterID ); stop if it returns true.  Return the final bin_to_clusterID.
+  vector<int> AHMerge( const vector<int> & CEN_contigs, const double MIN_AVG_LINKAGE, const int N_threads,
+		       const function< bool( const int, const int, const vector<int> & ) > & after_merge ) const;
   void CanonicalizeClusters(); // reorder the clusters by total contig length
 
 
@@ -244,6 +325,14 @@ class GenomeLinkMatrix
 
   bool _normalized; // has NormalizeToDeNovoContigLengths() been called?
 
+  // Out-of-core mode.  _tiles holds the matrix (and _matrix is empty); it's shared by copies of this GLM.  The normalizations are recorded here instead of
+  // being applied to the matrix: _lazy_longest_squared is 0 until NormalizeToDeNovoContigLengths() is called, and _lazy_repeat_factors (one per bin) is
+  // empty until SkipRepeats() is called.
+  shared_ptr<GLMTileCache> _tiles;
+  int64_t _lazy_longest_squared;
+  bool _lazy_use_RE_sites;
+  vector<double> _lazy_repeat_factors;
+
   // contig_skip: Flags indicating which contigs should not be used in clustering (though they may get added in afterward; see SetClusters.)
   // Contigs may be marked for skipping if they are (1) repetitive, as determined by SkipRepeats(); or (2) too short, as determined by SkipShortContigs().
   vector<bool> _contig_skip;
@@ -0,0 +1,281 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+// For documentation, see Heatmap.h
+#include "Heatmap.h"
+
+#include <assert.h>
+#include <stdlib.h> // exit, system
+#include <math.h> // log10
+#include <algorithm> // sort, max, min
+#include <fstream>
+#include <iostream>
+#include <utility> // pair
+
+#include <zlib.h> // compress2, crc32
+
+
+
+// Constructor: Drop the levels that would be wider than necessary.
+HeatmapPyramid::HeatmapPyramid( const size_t N, const int N_levels, const int tile_size )
+  : _N( N ),
+    _N_levels( N_levels ),
+    _tile_size( tile_size ),
+    _palette( SpectralPalette() )
+{
+  assert( N_levels >= 1 );
+  assert( tile_size >= 1 );
+  while ( _N_levels > 1 && Width( _N_levels-2 ) >= _N ) _N_levels--;
+  _N_cells = min( _N, Width( _N_levels-1 ) );
+}
+
+
+
+void
+HeatmapPyramid::Add( const size_t i, const size_t j, const double value )
+{
+  assert( i < _N && j < _N );
+  if ( value == 0 ) return;
+
+  const uint64_t cell_i = i * _N_cells / _N, cell_j = j * _N_cells / _N;
+  _cells[ cell_i * _N_cells + cell_j ] += value;
+}
+
+
+
+// The palettes, from RColorBrewer.
+vector<uint32_t>
+HeatmapPyramid::SpectralPalette()
+{
+  const uint32_t colors[] = { 0x5E4FA2, 0x3288BD, 0x66C2A5, 0xABDDA4, 0xE6F598, 0xFFFFBF, 0xFEE08B, 0xFDAE61, 0xF46D43, 0xD53E4F, 0x9E0142 };
+  return vector<uint32_t>( colors, colors + sizeof(colors) / sizeof(uint32_t) );
+}
+
+vector<uint32_t>
+HeatmapPyramid::HeatPalette()
+{
+  const uint32_t colors[] = { 0xFFFFCC, 0xFFEDA0, 0xFED976, 0xFEB24C, 0xFD8D3C, 0xFC4E2A, 0xE31A1C, 0xBD0026, 0x800026, 0x000000 };
+  return vector<uint32_t>( colors, colors + sizeof(colors) / sizeof(uint32_t) );
+}
+
+
+
+void
+HeatmapPyramid::WritePNG( const string & PNG_file, const int level ) const
+{
+  const size_t W = Width( level );
+  bool written = false;
+  Render( level, W, [&]( const size_t, const size_t, const vector<uint8_t> & image ) {
+      WritePNGFile( PNG_file, W, W, image );
+      written = true;
+    } );
+
+  // If there's no data at all, write a blank image.
+  if ( !written ) WritePNGFile( PNG_file, W, W, vector<uint8_t>( 3*W*W, 255 ) );
+}
+
+
+
+void
+HeatmapPyramid::WriteTiles( const string & dir ) const
+{
+  system( ( "mkdir -p " + dir ).c_str() );
+
+  ofstream out( ( dir + "/tiles.txt" ).c_str(), ios::out );
+  out << "# Heatmap tiles of a " << _N << " x " << _N << " matrix, made by Lachesis" << endl;
+  out << "# Each tile is " << _tile_size << " x " << _tile_size << " pixels.  At level z, tile <z>/<x>_<y>.png is column x and row y of the image." << endl;
+  out << "# Tiles with no data in them are not written." << endl;
+  out << "# level\twidth_in_pixels\tmatrix_rows_per_pixel\tN_tiles_written" << endl;
+
+  for ( int z = 0; z < _N_levels; z++ ) {
+    const string level_dir = dir + "/" + to_string( z );
+    system( ( "mkdir -p " + level_dir ).c_str() );
+
+    int N_tiles = 0;
+    Render( z, _tile_size, [&]( const size_t x, const size_t y, const vector<uint8_t> & image ) {
+	WritePNGFile( level_dir + "/" + to_string( x ) + "_" + to_string( y ) + ".png", _tile_size, _tile_size, image );
+	N_tiles++;
+      } );
+
+    out << z << '\t' << Width( z ) << '\t' << double( _N ) / Width( z ) << '\t' << N_tiles << endl;
+  }
+
+  out.close();
+}
+
+
+
+void
+HeatmapPyramid::Render( const int level, const size_t region_size, const function< void( const size_t, const size_t, const vector<uint8_t> & ) > & write ) const
+{
+  assert( level >= 0 && level < _N_levels );
+  const uint64_t W = Width( level );
+  assert( W % region_size == 0 );
+
+  // Bin the cells down to this level's pixels.  Each cell covers the pixels from first(c) up to but not including last(c), which is just one pixel unless
+  // the image is wider than the matrix.  The deepest level's width is a multiple of this level's, so the pixels are exactly the sums of the deeper pixels.
+  auto first = [&]( const uint64_t c ) { return c * W / _N_cells; };
+  auto last  = [&]( const uint64_t c ) { return max( first(c) + 1, ( c+1 ) * W / _N_cells ); };
+
+  unordered_map<uint64_t,double> pixels;
+  for ( unordered_map<uint64_t,double>::const_iterator it = _cells.begin(); it != _cells.end(); ++it ) {
+    const uint64_t ci = it->first / _N_cells, cj = it->first % _N_cells;
+    for ( uint64_t y = first(ci); y < last(ci); y++ )
+      for ( uint64_t x = first(cj); x < last(cj); x++ )
+	pixels[ y * W + x ] += it->second;
+  }
+
+  double max_value = 0;
+  for ( unordered_map<uint64_t,double>::const_iterator it = pixels.begin(); it != pixels.end(); ++it )
+    max_value = max( max_value, it->second );
+
+  // Sort the pixels by the region they fall in, so each region can be drawn in turn without holding more than one image in memory.
+  const uint64_t N_regions_per_row = W / region_size;
+  vector< pair<uint64_t,uint64_t> > order; // (region ID, pixel ID)
+  order.reserve( pixels.size() );
+  for ( unordered_map<uint64_t,double>::const_iterator it = pixels.begin(); it != pixels.end(); ++it ) {
+    const uint64_t y = it->first / W, x = it->first % W;
+    order.push_back( make_pair( ( y / region_size ) * N_regions_per_row + x / region_size, it->first ) );
+  }
+  sort( order.begin(), order.end() );
+
+  // The breaks, in this level's pixels.
+  vector<uint64_t> break_pixels;
+  for ( size_t i = 0; i < _breaks.size(); i++ )
+    if ( _breaks[i] > 0 && _breaks[i] < _N )
+      break_pixels.push_back( _breaks[i] * W / _N );
+
+  vector<uint8_t> image( 3 * region_size * region_size );
+  auto set_pixel = [&]( const uint64_t y, const uint64_t x, const uint32_t color ) {
+    uint8_t * p = &image[ 3 * ( y * region_size + x ) ];
+    p[0] = color >> 16;
+    p[1] = ( color >> 8 ) & 0xFF;
+    p[2] = color & 0xFF;
+  };
+
+  for ( size_t start = 0; start < order.size(); ) {
+    const uint64_t region = order[start].first;
+    const uint64_t y0 = ( region / N_regions_per_row ) * region_size, x0 = ( region % N_regions_per_row ) * region_size;
+
+    fill( image.begin(), image.end(), 255 );
+    size_t k = start;
+    for ( ; k < order.size() && order[k].first == region; k++ ) {
+      const uint64_t pixel = order[k].second;
+      set_pixel( pixel / W - y0, pixel % W - x0, Color( pixels[pixel], max_value ) );
+    }
+
+    // Draw the breaks as dashed black lines, 4 pixels on and 4 off.
+    for ( size_t b = 0; b < break_pixels.size(); b++ )
+      for ( uint64_t t = 0; t < region_size; t++ ) {
+	if ( ( ( ( y0 + t ) / 4 ) % 2 ) == 0 && break_pixels[b] >= x0 && break_pixels[b] < x0 + region_size ) set_pixel( t, break_pixels[b] - x0, 0 );
+	if ( ( ( ( x0 + t ) / 4 ) % 2 ) == 0 && break_pixels[b] >= y0 && break_pixels[b] < y0 + region_size ) set_pixel( break_pixels[b] - y0, t, 0 );
+      }
+
+    write( x0 / region_size, y0 / region_size, image );
+    start = k;
+  }
+}
+
+
+
+// Color: Place log10( 1 + value ) on the scale, and interpolate between the two nearest colors in the palette.
+uint32_t
+HeatmapPyramid::Color( const double value, const double max_value ) const
+{
+  assert( !_palette.empty() );
+  if ( _palette.size() == 1 || max_value <= 0 ) return _palette[0];
+
+  double t = log10( 1 + max( value, 0.0 ) ) / log10( 1 + max_value );
+  t = min( max( t, 0.0 ), 1.0 ) * ( _palette.size() - 1 );
+  const size_t lo = min( size_t( t ), _palette.size() - 2 );
+  const double frac = t - lo;
+
+  uint32_t color = 0;
+  for ( int shift = 16; shift >= 0; shift -= 8 ) {
+    const double c0 = ( _palette[lo] >> shift ) & 0xFF, c1 = ( _palette[lo+1] >> shift ) & 0xFF;
+    color |= uint32_t( c0 + frac * ( c1 - c0 ) + 0.5 ) << shift;
+  }
+  return color;
+}
+
+
+
+
+// WritePNGChunk: Write one PNG chunk: its length, type, data, and a CRC of the type and data (all integers big-endian.)
+static void
+WritePNGChunk( ostream & out, const char * type, const vector<uint8_t> & data )
+{
+  auto write_uint32 = [&]( const uint32_t x ) {
+    const char bytes[4] = { char( x >> 24 ), char( x >> 16 ), char( x >> 8 ), char( x ) };
+    out.write( bytes, 4 );
+  };
+
+  write_uint32( data.size() );
+  out.write( type, 4 );
+  if ( !data.empty() ) out.write( (const char *) data.data(), data.size() );
+
+  uLong crc = crc32( 0, (const Bytef *) type, 4 );
+  if ( !data.empty() ) crc = crc32( crc, data.data(), data.size() );
+  write_uint32( crc );
+}
+
+
+
+// WritePNGFile: The image is written as 8-bit RGB, with no filtering (each scanline starts with a 0 byte), compressed into a single IDAT chunk by zlib.
+void
+WritePNGFile( const string & PNG_file, const size_t width, const size_t height, const vector<uint8_t> & rgb )
+{
+  assert( rgb.size() == 3 * width * height );
+
+  vector<uint8_t> raw;
+  raw.reserve( ( 3 * width + 1 ) * height );
+  for ( size_t y = 0; y < height; y++ ) {
+    raw.push_back( 0 ); // filter type: none
+    raw.insert( raw.end(), rgb.begin() + 3 * width * y, rgb.begin() + 3 * width * ( y+1 ) );
+  }
+
+  uLongf compressed_size = compressBound( raw.size() );
+  vector<uint8_t> compressed( compressed_size );
+  if ( compress2( compressed.data(), &compressed_size, raw.data(), raw.size(), Z_DEFAULT_COMPRESSION ) != Z_OK ) {
+    cerr << "ERROR: WritePNGFile: zlib failed to compress the image for " << PNG_file << endl;
+    exit(1);
+  }
+  compressed.resize( compressed_size );
+
+  ofstream out( PNG_file.c_str(), ios::out | ios::binary );
+  if ( !out ) {
+    cerr << "ERROR: WritePNGFile: can't open file " << PNG_file << endl;
+    exit(1);
+  }
+
+  const char signature[8] = { char(137), 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+  out.write( signature, 8 );
+
+  vector<uint8_t> IHDR;
+  for ( int shift = 24; shift >= 0; shift -= 8 ) IHDR.push_back( width  >> shift );
+  for ( int shift = 24; shift >= 0; shift -= 8 ) IHDR.push_back( height >> shift );
+  IHDR.push_back( 8 ); // bit depth
+  IHDR.push_back( 2 ); // color type: RGB
+  IHDR.push_back( 0 ); // compression method: deflate
+  IHDR.push_back( 0 ); // filter method
+  IHDR.push_back( 0 ); // interlace method: none
+
+  WritePNGChunk( out, "IHDR", IHDR );
+  WritePNGChunk( out, "IDAT", compressed );
+  WritePNGChunk( out, "IEND", vector<uint8_t>() );
+
+  out.close();
+}
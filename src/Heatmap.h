@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+/**************************************************************************************************************************************************************
+ *
+ * Heatmap.h
+ *
+ * A HeatmapPyramid draws a heatmap of a square matrix of Hi-C link data (e.g., a GenomeLinkMatrix or a ChromLinkMatrix) straight to PNG images, without
+ * writing the matrix out as text for an R script to read.  The matrix elements are added one at a time, in a single pass over the nonzero elements, and
+ * binned down to a fixed grid of pixels as they go; only the nonzero pixels are kept.
+ *
+ * The heatmap can be drawn at a series of zoom levels, in the spirit of the multi-resolution .mcool format.  At level z, the image is tile_size * 2^z pixels
+ * on a side, cut into 2^z x 2^z tiles of tile_size x tile_size pixels.  Matrix row i is drawn in pixel row i * W / N (for an N x N matrix and a W-pixel-wide
+ * image), and likewise for the columns; so each level's pixels are exactly the sums of the next level's pixels.  The deepest level is the first at which the
+ * image is at least N pixels wide, so that each pixel holds at most one matrix element.  WriteTiles() writes every tile with data at every level, so a viewer
+ * can zoom in on part of the matrix (e.g., one chromosome group) without anything having to be redrawn.
+ *
+ * The colors show log10( 1 + value ), on a scale from 0 to the largest pixel value at the level.  Pixels with no data are white.
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+#ifndef _HEATMAP__H
+#define _HEATMAP__H
+
+#include <inttypes.h> // uint8_t, uint32_t, uint64_t
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+
+
+class HeatmapPyramid
+{
+ public:
+
+  // Constructor: Set up a heatmap of an N x N matrix, with up to N_levels zoom levels of tile_size x tile_size tiles.  (There are fewer levels if the deepest
+  // one would be wider than necessary; see above.)  So with N_levels = 1, the heatmap is a single tile_size x tile_size image.
+  HeatmapPyramid( const size_t N, const int N_levels = 1, const int tile_size = 1024 );
+
+  // Add: Add value to matrix element (i,j).  The elements can be added in any order.
+  void Add( const size_t i, const size_t j, const double value );
+
+  // SetBreaks: Draw dashed lines before these rows and columns of the matrix, e.g., at the boundaries between chromosome groups.
+  void SetBreaks( const vector<size_t> & breaks ) { _breaks = breaks; }
+
+  // SetPalette: Set the colors of the scale, from lowest to highest, as 0xRRGGBB values.  The default is SpectralPalette().
+  void SetPalette( const vector<uint32_t> & palette ) { _palette = palette; }
+  static vector<uint32_t> SpectralPalette(); // blue to red, as in heatmap.R
+  static vector<uint32_t> HeatPalette(); // yellow to red to black, as in heatmap.MWAH.R
+
+  // Query functions.
+  int N_levels() const { return _N_levels; }
+  size_t Width( const int level ) const { return size_t( _tile_size ) << level; }
+
+  // WritePNG: Write the whole heatmap at this level as one PNG image.  The image is Width(level) pixels on a side, so this is meant for the shallow levels.
+  void WritePNG( const string & PNG_file, const int level = 0 ) const;
+
+  // WriteTiles: Write each tile with data in it, at every level, to <dir>/<z>/<x>_<y>.png, where x and y are the tile's column and row (from 0, at the top
+  // left).  Also write <dir>/tiles.txt, which describes the pyramid.
+  void WriteTiles( const string & dir ) const;
+
+
+ private:
+
+  // Render: Draw the heatmap at this level, cut into square images of region_size pixels on a side.  For each image that has data in it, call
+  // write( x, y, image ), where x and y are its column and row, and the image is its RGB bytes, row by row.
+  void Render( const int level, const size_t region_size, const function< void( const size_t, const size_t, const vector<uint8_t> & ) > & write ) const;
+
+  // Color: The color of this value, on a scale from 0 to max_value, as 0xRRGGBB.
+  uint32_t Color( const double value, const double max_value ) const;
+
+  size_t _N; // size of the matrix
+  int _N_levels, _tile_size;
+
+  // The data, binned down to the deepest level's pixels: _cells[ row * _N_cells + col ].  If the deepest level is wider than the matrix, the cells are just
+  // the matrix elements.
+  size_t _N_cells;
+  unordered_map<uint64_t,double> _cells;
+
+  vector<size_t> _breaks;
+  vector<uint32_t> _palette;
+};
+
+
+
+// WritePNGFile: Write an RGB image (width x height pixels, as RGB bytes row by row) to a PNG file.  If the file can't be written, throw an error and exit.
+void WritePNGFile( const string & PNG_file, const size_t width, const size_t height, const vector<uint8_t> & rgb );
+
+
+
+#endif
@@ -0,0 +1,357 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+// For documentation, see HiCLinks.h
+#include "HiCLinks.h"
+#include "MappedFile.h"
+#include "SAMIngest.h"
+
+#include <assert.h>
+#include <string.h> // memcpy, strnlen
+#include <stdio.h> // rename, remove
+#include <sys/stat.h> // stat
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+// Boost libraries
+#include <boost/algorithm/string.hpp> // split
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+// Modules in ~/include (must add -L~/include and -lJ<module> to link)
+#include "gtools/SAMStepper.h" // SAMStepper, ReadNamesMatch
+
+
+
+/* The HiCLinkFile format.  As in the binary cache files (see ChromLinkMatrix.cc), all integers are in the native byte order of the machine that wrote the
+ * file, and every array starts on an 8-byte boundary so that the file can be mmap'ed and used in place.
+ *
+ *   HiCLinkHeader                       the fixed-size header below
+ *   char     text[header_text_len]      one line per SAM file, "<size>\t<mtime>\t<filename>", then "subsample\t<fraction>" if the fraction is less
+ *                                       than 1; zero-padded
+ *   HiCLinkFileEntry table[N_SAM_files] where each SAM file's records are, and how many alignments it had
+ *   HiCLink  links[]                    the records from all the SAM files, in order
+ */
+static const char LINK_FILE_MAGIC[8] = { 'L', 'A', 'C', 'H', 'L', 'N', 'K', '\0' };
+static const uint32_t LINK_FILE_VERSION = 1;
+static const uint32_t LINK_FILE_BYTE_ORDER_MARK = 0x01020304;
+
+struct HiCLinkHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t N_SAM_files;
+  uint64_t header_text_len; // padded to a multiple of 8
+};
+
+struct HiCLinkFileEntry {
+  uint64_t first_link;
+  uint64_t N_links;
+  int64_t N_aligns;
+};
+
+
+// The records are read and written in batches of this many.
+static const size_t LINK_BATCH_SIZE = 1 << 20;
+
+
+
+
+// SAMFilesStamp: Make the header text for a HiCLinkFile from this set of SAM files.  If any of the files change, the text will change too.
+string
+HiCLinkFile::SAMFilesStamp( const vector<string> & SAM_files, const double subsample_fraction )
+{
+  ostringstream oss;
+  for ( size_t i = 0; i < SAM_files.size(); i++ ) {
+    struct stat st;
+    if ( stat( SAM_files[i].c_str(), &st ) != 0 ) {
+      cerr << "ERROR: HiCLinkFile: can't find SAM/BAM file " << SAM_files[i] << endl;
+      exit(1);
+    }
+    oss << (int64_t) st.st_size << '\t' << (int64_t) st.st_mtime << '\t' << SAM_files[i] << '\n';
+  }
+  if ( subsample_fraction < 1 ) oss << "subsample\t" << subsample_fraction << '\n';
+  return oss.str();
+}
+
+
+
+// ReadHeader: Helper function.  Read the fixed-size header and the header text from this link file, which must be a HiCLinkFile.
+// Return false if it was written by an incompatible version (or on an incompatible machine.)
+static bool
+ReadHeader( const MappedFile & file, HiCLinkHeader & header, string & text )
+{
+  header = *file.at<HiCLinkHeader>(0);
+  if ( header.byte_order != LINK_FILE_BYTE_ORDER_MARK || header.version != LINK_FILE_VERSION ) return false;
+
+  const char * t = file.at<char>( sizeof(HiCLinkHeader), header.header_text_len );
+  text = string( t, strnlen( t, header.header_text_len ) );
+  return true;
+}
+
+
+
+
+// Constructor: Load (i.e., mmap) a HiCLinkFile that was created by Extract().
+HiCLinkFile::HiCLinkFile( const string & link_file )
+  : _file( link_file ),
+    _subsample_fraction( 1 )
+{
+  if ( !FileHasMagic( link_file, LINK_FILE_MAGIC, sizeof(LINK_FILE_MAGIC) ) ) {
+    cerr << "ERROR: HiCLinkFile: file '" << link_file << "' is not a Hi-C link file." << endl;
+    exit(1);
+  }
+
+  HiCLinkHeader header;
+  string text;
+  if ( !ReadHeader( _file, header, text ) ) {
+    cerr << "ERROR: HiCLinkFile: file '" << link_file << "' was written by a different version of Lachesis (or on a machine with a different byte order).  Delete it, and it will be re-created from the SAM/BAM files." << endl;
+    exit(1);
+  }
+
+  // Get the SAM filenames, and the subsample fraction, from the header text.
+  vector<string> lines, tokens;
+  boost::split( lines, text, boost::is_any_of("\n") );
+  for ( size_t i = 0; i < lines.size(); i++ ) {
+    if ( lines[i].empty() ) continue;
+    boost::split( tokens, lines[i], boost::is_any_of("\t") );
+    if ( tokens.size() == 2 && tokens[0] == "subsample" ) {
+      _subsample_fraction = boost::lexical_cast<double>( tokens[1] );
+      continue;
+    }
+    assert( tokens.size() == 3 );
+    _SAM_files.push_back( tokens[2] );
+  }
+  assert( _SAM_files.size() == header.N_SAM_files );
+
+  // Read the table of SAM files, and find the records.
+  size_t offset = sizeof(HiCLinkHeader) + header.header_text_len;
+  const HiCLinkFileEntry * table = _file.at<HiCLinkFileEntry>( offset, header.N_SAM_files );
+  offset += header.N_SAM_files * sizeof(HiCLinkFileEntry);
+
+  uint64_t N_links = 0;
+  for ( size_t i = 0; i < header.N_SAM_files; i++ ) {
+    assert( table[i].first_link == N_links );
+    _first_link.push_back( N_links );
+    _N_aligns  .push_back( table[i].N_aligns );
+    N_links += table[i].N_links;
+  }
+  _first_link.push_back( N_links );
+
+  _links = _file.at<HiCLink>( offset, N_links );
+}
+
+
+
+
+// IsUpToDate: Return true iff link_file is a HiCLinkFile that was made from exactly this list of SAM/BAM files, and none of them have changed since.
+bool
+HiCLinkFile::IsUpToDate( const string & link_file, const vector<string> & SAM_files, const double subsample_fraction )
+{
+  if ( !FileHasMagic( link_file, LINK_FILE_MAGIC, sizeof(LINK_FILE_MAGIC) ) ) return false;
+
+  const MappedFile file( link_file );
+  HiCLinkHeader header;
+  string text;
+  if ( !ReadHeader( file, header, text ) ) return false;
+
+  return text == SAMFilesStamp( SAM_files, subsample_fraction );
+}
+
+
+
+
+// ExtractLinksFromSAM: Helper function for Extract().  Read one SAM/BAM file, pair up its reads as SAMStepper::next_pair() would, and write a HiCLink record
+// for each pair (or unpaired read) to the file part_file, keeping only the subsample of the reads given by subsample_fraction.  Return the number of
+// records; also fill N_aligns.  Writes progress output to log.
+static uint64_t
+ExtractLinksFromSAM( const string & SAM_file, const double subsample_fraction, const string & part_file, int64_t & N_aligns, ostream & log )
+{
+  bool verbose = true;
+
+  log << "Extracting Hi-C links from SAM file " << SAM_file << (verbose ? "\t(dot = 1M alignments)" : "" ) << endl;
+  assert( boost::filesystem::is_regular_file( SAM_file ) );
+
+  ofstream out( part_file.c_str(), ios::out | ios::binary );
+  if ( !out ) {
+    cerr << "ERROR: HiCLinkFile: can't write to file " << part_file << endl;
+    exit(1);
+  }
+
+  vector<HiCLink> batch;
+  batch.reserve( LINK_BATCH_SIZE );
+  uint64_t N_links = 0;
+
+  // The fields of an alignment that go into its HiCLink record.
+  struct Align {
+    int32_t tid, pos, mtid, mpos, qual;
+  };
+
+  // Add a record to the batch, writing out the batch if it's full.
+  auto add_link = [&]( const Align & c1, const Align & c2, const HiCLinkType type ) {
+    HiCLink link;
+    link.tid  = c1.tid;
+    link.pos  = c1.pos;
+    link.qual = c1.qual;
+    link.type = type;
+    link.unused = 0;
+    if ( type == HIC_LINK_PAIR ) { link.mtid = c2.tid;  link.mpos = c2.pos;  link.mqual = c2.qual; }
+    else                         { link.mtid = c1.mtid; link.mpos = c1.mpos; link.mqual = 0; }
+    batch.push_back( link );
+    N_links++;
+
+    if ( batch.size() == LINK_BATCH_SIZE ) {
+      out.write( (const char *) batch.data(), batch.size() * sizeof(HiCLink) );
+      batch.clear();
+    }
+  };
+
+  // A read with no pair.  If it wouldn't be used by the GenomeLinkMatrix either, it isn't worth keeping.  (See GenomeLinkMatrix::LinkBins().)
+  auto add_single = [&]( const Align & c ) {
+    if ( c.pos == c.mpos || c.mtid == -1 || c.qual == 0 ) return;
+    add_link( c, c, HIC_LINK_SINGLE );
+  };
+
+  // A read pair.  Pairs are always kept, even if neither read is usable, because the LinkSizeDistribution counts them.
+  auto add_pair = [&]( const Align & c1, const Align & c2 ) {
+    if ( c1.tid == c2.mtid && c2.tid == c1.mtid && c1.pos == c2.mpos && c2.pos == c1.mpos )
+      add_link( c1, c2, HIC_LINK_PAIR );
+    else {
+      add_link( c1, c1, HIC_LINK_BROKEN );
+      add_link( c2, c2, HIC_LINK_BROKEN );
+    }
+  };
+
+
+  // Set up a SAMStepper object to read in the alignments.
+  SAMStepper stepper( SAM_file );
+  stepper.FilterAlignedPairs(); // Only look at read pairs where both reads aligned to the assembly.
+  stepper.FilterSubsample( subsample_fraction );
+
+  // Loop over all alignments, a batch at a time.  Each read is held back until we know whether the next read is its pair.  This is the same logic as in
+  // next_pair().
+  SAMBatch aligns;
+  Align prev = { -1, -1, -1, -1, 0 };
+  bool have_prev = false;
+  int64_t N_aligns_before = 0;
+
+  while ( stepper.next_batch( aligns ) ) {
+    for ( size_t j = 0; j < aligns.size(); j++ ) {
+
+      if ( verbose && ( N_aligns_before + j + 1 ) % 1000000 == 0 ) log << "." << flush;
+
+      const Align align = { aligns.tid[j], aligns.pos[j], aligns.mtid[j], aligns.mpos[j], aligns.qual[j] };
+      if ( have_prev && aligns.pairs_with_prev[j] ) {
+	add_pair( prev, align );
+	have_prev = false;
+      }
+      else {
+	if ( have_prev ) add_single( prev );
+	prev = align;
+	have_prev = true;
+      }
+    }
+    N_aligns_before += aligns.size();
+  }
+  if ( have_prev ) add_single( prev );
+
+  out.write( (const char *) batch.data(), batch.size() * sizeof(HiCLink) );
+  out.close();
+  if ( out.fail() ) {
+    cerr << "ERROR: HiCLinkFile: failed writing to file " << part_file << endl;
+    exit(1);
+  }
+
+  if ( verbose ) log << endl;
+  log << "N aligns read from " << SAM_file << ": " << stepper.N_aligns_read() << "; Hi-C link records: " << N_links << endl;
+
+  N_aligns = stepper.N_aligns_read();
+  return N_links;
+}
+
+
+
+
+// Extract: Read through a set of SAM/BAM files once and write all of their read pairs to a new HiCLinkFile at link_file.
+// Each SAM file's records are written by a worker thread to a temporary file, and these are then concatenated into the link file, in order.
+void
+HiCLinkFile::Extract( const vector<string> & SAM_files, const string & link_file, const int N_threads, const double subsample_fraction )
+{
+  cout << "HiCLinkFile::Extract   ->  " << link_file;
+  if ( subsample_fraction < 1 ) cout << " (subsample of " << subsample_fraction << " of the read pairs)";
+  cout << endl;
+  assert( !SAM_files.empty() );
+
+  // Write to a temporary file, and rename it at the end.  This way an interrupted run never leaves behind a link file that looks complete.
+  const string tmp_file = link_file + ".tmp";
+  ofstream out( tmp_file.c_str(), ios::out | ios::binary );
+  if ( !out ) {
+    cerr << "ERROR: HiCLinkFile: can't write to file " << tmp_file << endl;
+    exit(1);
+  }
+
+  // Write the header.  The table of SAM files is written as a placeholder here and filled in at the end.
+  const string text = SAMFilesStamp( SAM_files, subsample_fraction );
+
+  HiCLinkHeader header;
+  memcpy( header.magic, LINK_FILE_MAGIC, sizeof(LINK_FILE_MAGIC) );
+  header.version = LINK_FILE_VERSION;
+  header.byte_order = LINK_FILE_BYTE_ORDER_MARK;
+  header.N_SAM_files = SAM_files.size();
+  header.header_text_len = PadTo8( text.size() );
+  out.write( (const char *) &header, sizeof(header) );
+  out.write( text.c_str(), text.size() );
+  WritePadding( out, text.size() );
+
+  const streampos table_pos = out.tellp();
+  vector<HiCLinkFileEntry> table( SAM_files.size() );
+  out.write( (const char *) table.data(), table.size() * sizeof(HiCLinkFileEntry) );
+
+
+  // Read the SAM files in parallel, and append their records to the link file in order.
+  vector<string> part_files( SAM_files.size() );
+  uint64_t N_links = 0;
+
+  ForEachSAMFile( SAM_files, N_threads,
+		  [&]( const size_t i, ostream & log ) {
+		    part_files[i] = link_file + ".part" + boost::lexical_cast<string>(i);
+		    table[i].N_links = ExtractLinksFromSAM( SAM_files[i], subsample_fraction, part_files[i], table[i].N_aligns, log );
+		  },
+		  [&]( const size_t i ) {
+		    table[i].first_link = N_links;
+		    N_links += table[i].N_links;
+
+		    ifstream in( part_files[i].c_str(), ios::in | ios::binary );
+		    if ( table[i].N_links > 0 ) out << in.rdbuf();
+		    in.close();
+		    remove( part_files[i].c_str() );
+		  } );
+
+  out.seekp( table_pos );
+  out.write( (const char *) table.data(), table.size() * sizeof(HiCLinkFileEntry) );
+  out.close();
+
+  if ( out.fail() || rename( tmp_file.c_str(), link_file.c_str() ) != 0 ) {
+    cerr << "ERROR: HiCLinkFile: failed writing to file " << link_file << endl;
+    exit(1);
+  }
+
+  cout << "Wrote " << N_links << " Hi-C link records to " << link_file << endl;
+}
@@ -0,0 +1,119 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+/**************************************************************************************************************************************************************
+ *
+ * HiCLinks.h
+ *
+ * A HiCLinkFile is a compact, binary digest of the Hi-C read alignments in a set of SAM/BAM files: for each read pair, just the contig IDs, positions, and
+ * mapping qualities of the two reads.  This is everything the GenomeLinkMatrix, the ChromLinkMatrices, and the LinkSizeDistribution ever look at.
+ *
+ * Decompressing and parsing the SAM/BAM files is by far the slowest part of loading the Hi-C data, and without this file it would have to be done once for
+ * the GenomeLinkMatrix (in clustering) and again for the ChromLinkMatrices (in ordering), because the CLMs can't be made until the clusters are known.  With
+ * it, the SAM/BAM files are read just once, by HiCLinkFile::Extract(), and all of the link matrices are built by stepping through the HiCLinkFile, which is
+ * mmap'ed and needs no parsing at all.
+ *
+ * The reads are paired up exactly as SAMStepper::next_pair() pairs them, so the results are the same as if each object had read the SAM files itself.
+ * Reads that aren't part of a pair are kept as well (the GenomeLinkMatrix uses them), along with the mate information (mtid, mpos) from their own records.
+ *
+ * The file remembers the size and modification time of each SAM/BAM file it was made from, so IsUpToDate() can tell whether it needs to be re-made.
+ * It may hold only a subsample of the read pairs (see SAMStepper::FilterSubsample), for quick preview runs; if so, it remembers the fraction too.
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+#ifndef _HIC_LINKS__H
+#define _HIC_LINKS__H
+
+#include "MappedFile.h"
+
+#include <inttypes.h> // int32_t, uint8_t, uint64_t
+#include <string>
+#include <vector>
+using namespace std;
+
+
+
+// The types of HiCLink records.
+enum HiCLinkType {
+  HIC_LINK_PAIR = 0,   // a read pair: read 1 is at (tid,pos) with quality qual, read 2 is at (mtid,mpos) with quality mqual
+  HIC_LINK_SINGLE = 1, // a read with no pair in the file: (tid,pos,qual) are its own, and (mtid,mpos) are its mate's position, as given in its record
+  HIC_LINK_BROKEN = 2  // one of the two reads in a pair whose records disagree about each other's positions; stored as two consecutive records, like SINGLEs
+};
+
+
+// A HiCLink is one record in a HiCLinkFile.  It describes a read pair (or a single read; see above) in 20 bytes, versus several hundred in a BAM file.
+struct HiCLink {
+  int32_t tid, pos;   // contig ID (i.e., SAM target ID) and position of the read (or of read 1)
+  int32_t mtid, mpos; // contig ID and position of its mate
+  uint8_t qual, mqual; // mapping quality of read 1 and read 2 (for SINGLE and BROKEN records, mqual is unused)
+  uint8_t type;        // a HiCLinkType
+  uint8_t unused;
+};
+
+
+
+class HiCLinkFile
+{
+ public:
+
+  // Constructor: Load (i.e., mmap) a HiCLinkFile that was created by Extract().
+  HiCLinkFile( const string & link_file );
+
+
+  // Extract: Read through a set of SAM/BAM files once and write all of their read pairs to a new HiCLinkFile at link_file.  The SAM/BAM files are read in
+  // parallel, with up to N_threads threads (0 = one per core; see SAMIngest.h.)  If subsample_fraction < 1, only that fraction of the read pairs is kept.
+  static void Extract( const vector<string> & SAM_files, const string & link_file, const int N_threads = 1, const double subsample_fraction = 1 );
+
+  // IsUpToDate: Return true iff link_file is a HiCLinkFile that was made from exactly this list of SAM/BAM files, with this subsample fraction, and none of
+  // the files have changed since.
+  static bool IsUpToDate( const string & link_file, const vector<string> & SAM_files, const double subsample_fraction = 1 );
+
+  // SAMFilesStamp: Return a line of text for each SAM/BAM file, with its size, modification time, and name, plus a line with the subsample fraction if it's
+  // less than 1.  If any of the files change, the text will change too.  This is stored in the HiCLinkFile, so IsUpToDate() can check it; it can also be
+  // used to check other files made from the SAM/BAM files.
+  static string SAMFilesStamp( const vector<string> & SAM_files, const double subsample_fraction = 1 );
+
+
+  /* QUERY FUNCTIONS */
+  const string & file() const { return _file.file(); }
+  const vector<string> & SAM_files() const { return _SAM_files; }
+  size_t N_SAM_files() const { return _SAM_files.size(); }
+  double subsample_fraction() const { return _subsample_fraction; } // the fraction of the read pairs that were kept by Extract()
+
+  // The records from SAM file #i are in the range [ begin(i), end(i) ), in the order in which they appeared in the SAM file.
+  const HiCLink * begin( const size_t i ) const { return _links + _first_link[i]; }
+  const HiCLink * end  ( const size_t i ) const { return _links + _first_link[i+1]; }
+
+  // N_aligns: The number of alignments in SAM file #i that passed SAMStepper::FilterAlignedPairs(), as in SAMStepper::N_aligns_read().
+  int64_t N_aligns( const size_t i ) const { return _N_aligns[i]; }
+
+
+ private:
+
+  const MappedFile _file;
+  vector<string> _SAM_files;
+  double _subsample_fraction;
+  vector<uint64_t> _first_link; // index of the first record from each SAM file (plus one at the end)
+  vector<int64_t> _N_aligns;
+  const HiCLink * _links;
+};
+
+
+
+#endif
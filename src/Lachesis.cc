@@ -25,6 +25,7 @@
  * GenomeLinkMatrix: A matrix of Hi-C links between all contigs.  Contains contig clustering algorithms.
  * ChromLinkMatrix: A matrix of Hi-C links between contigs in a group.  Contains contig ordering, orienting, and spacing algorithms.
  * LinkSizeDistribution: The density of Hi-C links as a function of distance.  Used for contig spacing.
+ * HiCLinkFile: A compact digest of the Hi-C read pairs in the SAM/BAM files, so that the SAM/BAM files only need to be read once.
  * ClusterVec: A vector< set<int> > describing a clustering result.
  * ContigOrdering: An ordering of contigs in a group, eventually including orientation and spacing.
  * TrueMapping: The true location of each contig on the reference assembly, if there is one.  Used for reference-based validation.
@@ -45,20 +46,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <inttypes.h> // uint64_t
 
 // STL declarations
 #include <ctime>
 #include <cerrno>
+#include <memory> // unique_ptr
+#include <numeric> // accumulate
 #include <string>
+#include <thread>
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <algorithm> // stable_sort, count
 using namespace std;
 
 // Modules in ~/include (must add -L~/include and -lJ<module> to link)
 #include "TimeMem.h"
 
 // Boost includes
+#include <boost/algorithm/string.hpp> // split
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 
@@ -67,10 +75,13 @@ using namespace std;
 #include "GenomeLinkMatrix.h"
 #include "ChromLinkMatrix.h"
 #include "LinkSizeDistribution.h"
+#include "HiCLinks.h"
 #include "ClusterVec.h"
 #include "ContigOrdering.h"
 #include "TrueMapping.h"
 #include "Reporter.h"
+#include "ScaffoldedFasta.h"
+#include "Parallel.h"
 
 
 
@@ -81,11 +92,192 @@ using namespace std;
 
 
 
+// HiCLinksFile: Return the filename of the HiCLinkFile that holds the Hi-C links from the SAM files.  If the file doesn't exist yet, or if it's out of date
+// (or if overwrite = true), create it by reading the SAM files.  Reading the SAM files is the slowest step in loading the Hi-C data, and this way it's only
+// done once, no matter how many of the GLM and CLMs need to be made.  With SUBSAMPLE_FRACTION < 1, only the subsample of the read pairs is extracted, into
+// a file of its own (see RunParams::CacheTag), and everything made from the link file uses just that subsample.
+string
+HiCLinksFile( const RunParams & run_params, const bool overwrite )
+{
+  string link_file = run_params._out_dir + "/cached_data/all" + run_params.CacheTag() + ".links";
+
+  if ( overwrite || !HiCLinkFile::IsUpToDate( link_file, run_params._SAM_files, run_params._subsample_fraction ) ) {
+    cout << "Need to read SAM files and create the Hi-C link file at " << link_file << ".  This will take a while." << endl;
+    StageTimer timer( "read SAM files" );
+    HiCLinkFile::Extract( run_params._SAM_files, link_file, run_params._N_threads, run_params._subsample_fraction );
+  }
+
+  return link_file;
+}
+
+
+
+// Hash: Return a 64-bit FNV-1a hash of this text, as 16 hex digits.
+static string
+Hash( const string & text )
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for ( size_t i = 0; i < text.size(); i++ ) {
+    hash ^= (unsigned char) text[i];
+    hash *= 1099511628211ULL;
+  }
+  char hex[17];
+  sprintf( hex, "%016" PRIx64, hash );
+  return hex;
+}
+
+// ReadHashFile, WriteHashFile: Read and write the hash in a *.hash file.  ReadHashFile returns "" if the file doesn't exist.
+static string
+ReadHashFile( const string & hash_file )
+{
+  string hash;
+  ifstream in( hash_file.c_str(), ios::in );
+  in >> hash;
+  return hash;
+}
+
+static void
+WriteHashFile( const string & hash_file, const string & hash )
+{
+  ofstream out( hash_file.c_str(), ios::out );
+  out << hash << endl;
+}
+
+
+// CLMHash: Return a hash of everything that goes into the CLM file for cluster #i: the names of the contigs in the cluster, the SAM/BAM files (with their
+// sizes and modification times, and the SUBSAMPLE_FRACTION; see HiCLinkFile::SAMFilesStamp), the RE sites file, and whether the link distances are compact
+// (see COMPACT_STORAGE).  It is stored in groupN.CLM.hash, so that later runs can tell whether this CLM is still good, no matter what happened to the other
+// clusters.
+static string
+CLMHash( const RunParams & run_params, const ClusterVec & clusters, const size_t i )
+{
+  ostringstream text;
+  text << "CLM\n" << run_params._species << '\n';
+  text << HiCLinkFile::SAMFilesStamp( run_params._SAM_files, run_params._subsample_fraction );
+  text << HiCLinkFile::SAMFilesStamp( vector<string>( 1, run_params.DraftContigRESitesFilename() ) );
+  if ( run_params._compact_storage ) text << "compact\n";
+  const vector<string> & contig_names = *run_params.LoadDraftContigNames();
+  for ( set<int>::const_iterator it = clusters[i].begin(); it != clusters[i].end(); ++it )
+    text << contig_names[*it] << '\n';
+  return Hash( text.str() );
+}
+
+// OrderingHash: Return a hash of everything that goes into the orderings of a cluster: its CLM (as given by CLMHash) and the ordering parameters.  It is
+// stored in cached_data/groupN.ordering.hash.
+static string
+OrderingHash( const RunParams & run_params, const string & CLM_hash )
+{
+  ostringstream text;
+  text << "ordering\n" << CLM_hash << '\n';
+  text << run_params._order_min_N_REs_in_trunk << '\t' << run_params._order_min_N_REs_in_shreds << '\t' << run_params._order_refine_seconds << '\n';
+  return Hash( text.str() );
+}
+
+
+
+
+// GroupSelection: The set of groups that this invocation of Lachesis orders.  By default, this is all of them; in distributed mode, it's chosen on the
+// command line with --groups or --task-array (see main).  In distributed mode, each job orders only its own groups, reading the CLMs from (and writing the
+// orderings to) the shared OUTPUT_DIR, so the groups can be ordered on many machines at once.  Afterward, 'Lachesis <ini_file> --gather' does the reporting.
+struct GroupSelection
+{
+  GroupSelection() : all( true ), N_tasks( 0 ), task_ID( 0 ) {}
+
+  bool all; // order all of the groups
+  vector<int> groups; // --groups: order these groups
+  int N_tasks, task_ID; // --task-array: order this task's share of the groups, when they're dealt out among N_tasks tasks (see Selected)
+
+  // Selected: Return a vector with an entry for each cluster, marking the clusters in this selection.
+  // For a task array, the clusters are dealt out in order of decreasing size, so each task gets a similar share of the work.  Task IDs are taken modulo
+  // N_tasks, so any N_tasks consecutive IDs (e.g., 0 to N-1 in SLURM, or 1 to N in SGE) cover all of the groups.
+  vector<bool>
+  Selected( const ClusterVec & clusters ) const
+  {
+    vector<bool> selected( clusters.size(), all );
+
+    for ( size_t k = 0; k < groups.size(); k++ ) {
+      if ( groups[k] < 0 || groups[k] >= (int) clusters.size() ) {
+	cerr << "ERROR: --groups: there is no group #" << groups[k] << "; the groups are numbered 0 to " << (int) clusters.size() - 1 << "." << endl;
+	exit(1);
+      }
+      selected[ groups[k] ] = true;
+    }
+
+    if ( N_tasks > 0 ) {
+      vector<size_t> by_size( clusters.size() );
+      for ( size_t i = 0; i < clusters.size(); i++ )
+	by_size[i] = i;
+      stable_sort( by_size.begin(), by_size.end(), [&]( const size_t a, const size_t b ) { return clusters[a].size() > clusters[b].size(); } );
+      for ( size_t r = 0; r < by_size.size(); r++ )
+	if ( (int) ( r % N_tasks ) == task_ID % N_tasks ) selected[ by_size[r] ] = true;
+    }
+
+    return selected;
+  }
+
+  // Name: A short name for this selection, to keep the files written by different jobs apart.  It's empty for the default selection of all groups.
+  string
+  Name() const
+  {
+    if ( all ) return "";
+    if ( N_tasks > 0 ) return "task" + boost::lexical_cast<string>( task_ID );
+    string name = "groups";
+    for ( size_t k = 0; k < groups.size(); k++ )
+      name += ( k ? "_" : "" ) + boost::lexical_cast<string>( groups[k] );
+    return name;
+  }
+};
+
+
+
+
+// LoadGLM: Load the GenomeLinkMatrix for all of the contigs, for clustering.  Use the cached_data/all.GLM file if it exists; otherwise make it.
+// The caller must delete the GenomeLinkMatrix.
+static GenomeLinkMatrix *
+LoadGLM( const RunParams & run_params, const TrueMapping * true_mapping )
+{
+  GenomeLinkMatrix * glm;
+
+  // Look for the *.GLM file, which describes the data in a GenomeLinkMatrix.
+  // If the OVERWRITE_GLM flag is not set, and if the file exists (because of a previous run), read the data from it to make a GenomeLinkMatrix object.
+  // Otherwise, create the data from the Hi-C link file (which may require reading the SAM files), which takes longer.
+  // With a memory budget, the GLM is used out of core: it's left in the file and read in as needed (see GenomeLinkMatrix.h).
+  string GLM_file = run_params._out_dir + "/cached_data/all" + run_params.CacheTag() + ".GLM";
+  size_t GLM_memory_budget = size_t( run_params._GLM_memory_budget ) << 20;
+  if ( GLM_memory_budget > 0 && run_params._text_cache_files ) {
+    cerr << "WARNING: GLM_MEMORY_BUDGET is ignored when TEXT_CACHE_FILES = 1; the GLM will be held in memory." << endl;
+    GLM_memory_budget = 0;
+  }
+  if ( GLM_memory_budget > 0 && true_mapping && run_params._sim_bin_size == 0 ) {
+    cerr << "WARNING: GLM_MEMORY_BUDGET is ignored when the GLM is reordered by reference (USE_REFERENCE = 1, SIM_BIN_SIZE = 0); the GLM will be held in memory." << endl;
+    GLM_memory_budget = 0;
+  }
+
+  if ( !boost::filesystem::is_regular_file( GLM_file ) || run_params._overwrite_GLM ) {
+    const HiCLinkFile links( HiCLinksFile( run_params, run_params._overwrite_GLM ) );
+    glm = new GenomeLinkMatrix( run_params._species, links, run_params.DraftContigRESitesFilename(), run_params._N_threads );
+    glm->WriteFile( GLM_file, run_params._text_cache_files, run_params._compact_storage );
+
+    // Out of core, free the matrix that was just made, and use the file instead.
+    if ( GLM_memory_budget > 0 ) {
+      delete glm;
+      glm = new GenomeLinkMatrix( GLM_file, GLM_memory_budget );
+    }
+  }
+  else
+    glm = new GenomeLinkMatrix( GLM_file, GLM_memory_budget );
+
+  return glm;
+}
+
+
+
 // Run the Lachesis clustering algorithm.
 void
 LachesisClustering( const RunParams & run_params )
 {
   cout << "\n\t|~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~|\n\t|                                 |\n\t|       LACHESIS CLUSTERING       |\n\t|                                 |\n\t|~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~|\n\n";
+  StageTimer timer( "clustering" );
 
   // Make the directories needed for this run, if necessary.
   system ( ( "mkdir -p " + run_params._out_dir + "/cached_data" ).c_str() );
@@ -95,33 +287,23 @@ LachesisClustering( const RunParams & run_params )
   TrueMapping * true_mapping = run_params.LoadTrueMapping();
   const bool postfosmid = false; // placeholder for parameters optimized for the post-fosmid case
 
-  GenomeLinkMatrix * glm;
-
-  // Look for the *.GLM file, which describes the data in a GenomeLinkMatrix.
-  // If the OVERWRITE_GLM flag is not set, and if the file exists (because of a previous run), read the data from it to make a GenomeLinkMatrix object.
-  // Otherwise, create the data by reading the SAM files, which takes longer.
-  string GLM_file = run_params._out_dir + "/cached_data/all.GLM";
-  if ( !boost::filesystem::is_regular_file( GLM_file ) || run_params._overwrite_GLM ) {
-    glm = new GenomeLinkMatrix( run_params._species, run_params._SAM_files, run_params.DraftContigRESitesFilename() );
-    glm->WriteFile( GLM_file );
-  }
-  else
-    glm = new GenomeLinkMatrix( GLM_file );
-
-  // Pre-processing.
-  glm->NormalizeToDeNovoContigLengths( true );
-  if ( true_mapping && run_params._sim_bin_size == 0 ) glm->ReorderContigsByRef( *true_mapping );
+  StageTimer load_timer( "load GLM" );
+  GenomeLinkMatrix * glm = LoadGLM( run_params, true_mapping );
 
-  glm->SkipContigsWithFewREs( run_params._cluster_min_RE_sites );
-  glm->SkipRepeats( postfosmid ? 1.2 : run_params._cluster_max_link_density );
+  // Pre-processing: normalize, reorder by the reference (if there is one), and skip uninformative and repetitive contigs.
+  glm->Preprocess( true, ( true_mapping && run_params._sim_bin_size == 0 ) ? true_mapping : NULL, run_params._cluster_min_RE_sites,
+		   postfosmid ? 1.2 : run_params._cluster_max_link_density, run_params._N_threads );
+  load_timer.Stop();
 
-  if ( run_params._cluster_draw_heatmap ) glm->DrawHeatmap( "heatmap.jpg" );
+  if ( run_params._cluster_draw_heatmap ) glm->DrawHeatmap( "heatmap.png" );
 
 
-  glm->AHClustering( run_params._cluster_N, run_params._cluster_CEN_contig_IDs, 0, run_params._cluster_noninformative_ratio, run_params._cluster_draw_dotplot, true_mapping );
+  StageTimer AHC_timer( "AHClustering" );
+  glm->AHClustering( run_params._cluster_N, run_params._cluster_CEN_contig_IDs, 0, run_params._cluster_noninformative_ratio, run_params._cluster_draw_dotplot, true_mapping, run_params._N_threads );
+  AHC_timer.Stop();
 
   // Improve the clustering results, in the postfosmid case.
-  if ( postfosmid ) glm->MoveContigsInClusters( 1.2 );
+  if ( postfosmid ) glm->MoveContigsInClusters( 1.2, run_params._N_threads );
   //glm->UndoMisjoins();
 
   // If only using high-quality (i.e., well-aligning to reference) contigs, throw out the low-quality contigs at the last minute.
@@ -141,11 +323,236 @@ LachesisClustering( const RunParams & run_params )
 
 
 
-// Run the Lachesis ordering and orienting algorithms.
+// ClusteringSweep: The grid of clustering parameters for a parameter sweep (see LachesisClusteringSweep), from the --sweep options.  Each option gives a list
+// of values for one of the clustering parameters, e.g., '--sweep CLUSTER_N=16,20,24'; the parameters that aren't given take their values from the INI file.
+struct ClusteringSweep
+{
+  vector<int> N, min_RE_sites;
+  vector<double> max_link_density, noninformative_ratio;
+
+  bool empty() const { return N.empty() && min_RE_sites.empty() && max_link_density.empty() && noninformative_ratio.empty(); }
+
+  // Add: Parse one --sweep option, of the form KEY=value1,value2,...
+  void
+  Add( const string & option )
+  {
+    const size_t eq = option.find( '=' );
+    const string key = option.substr( 0, eq );
+    vector<string> values;
+    if ( eq != string::npos ) boost::split( values, option.substr( eq+1 ), boost::is_any_of(",") );
+
+    try {
+      for ( size_t k = 0; k < values.size(); k++ ) {
+	if      ( key == "CLUSTER_N" )                    N.push_back( boost::lexical_cast<int>( values[k] ) );
+	else if ( key == "CLUSTER_MIN_RE_SITES" )         min_RE_sites.push_back( boost::lexical_cast<int>( values[k] ) );
+	else if ( key == "CLUSTER_MAX_LINK_DENSITY" )     max_link_density.push_back( boost::lexical_cast<double>( values[k] ) );
+	else if ( key == "CLUSTER_NONINFORMATIVE_RATIO" ) noninformative_ratio.push_back( boost::lexical_cast<double>( values[k] ) );
+	else break;
+      }
+    }
+    catch ( boost::bad_lexical_cast & ) { values.clear(); }
+
+    if ( key != "CLUSTER_N" && key != "CLUSTER_MIN_RE_SITES" && key != "CLUSTER_MAX_LINK_DENSITY" && key != "CLUSTER_NONINFORMATIVE_RATIO" ) {
+      cerr << "ERROR: --sweep: can't sweep over '" << key << "'; the parameters that can be swept are CLUSTER_N, CLUSTER_MIN_RE_SITES, CLUSTER_MAX_LINK_DENSITY, and CLUSTER_NONINFORMATIVE_RATIO" << endl;
+      exit(1);
+    }
+    if ( values.empty() ) {
+      cerr << "ERROR: --sweep: can't read a list of values from '" << option << "' (e.g., '--sweep " << key << "=1,2,3')" << endl;
+      exit(1);
+    }
+    for ( size_t k = 0; k < N.size(); k++ )
+      if ( N[k] <= 0 ) { cerr << "ERROR: --sweep: CLUSTER_N must be positive" << endl; exit(1); }
+    for ( size_t k = 0; k < noninformative_ratio.size(); k++ )
+      if ( noninformative_ratio[k] != 0 && noninformative_ratio[k] <= 1 ) { cerr << "ERROR: --sweep: CLUSTER_NONINFORMATIVE_RATIO must be 0 or more than 1" << endl; exit(1); }
+  }
+
+  // Fill: Give the parameters that weren't swept over their values from the INI file.
+  void
+  Fill( const RunParams & run_params )
+  {
+    if ( N.empty() )                    N.push_back( run_params._cluster_N );
+    if ( min_RE_sites.empty() )         min_RE_sites.push_back( run_params._cluster_min_RE_sites );
+    if ( max_link_density.empty() )     max_link_density.push_back( run_params._cluster_max_link_density );
+    if ( noninformative_ratio.empty() ) noninformative_ratio.push_back( run_params._cluster_noninformative_ratio );
+  }
+
+  // Name: The name of the subdirectory of <OUTPUT_DIR>/sweep with the clusters for this combination of parameters.  The doubles are written with %.15g, so that
+  // e.g. 0.1 is "0.1" rather than boost::lexical_cast's "0.10000000000000001", but distinct values given on the command line still get distinct names.
+  string
+  Name( const size_t a, const size_t b, const size_t c, const size_t d ) const
+  {
+    return "N" + boost::lexical_cast<string>( N[a] ) + ".RE" + boost::lexical_cast<string>( min_RE_sites[b] ) + ".LD" + DoubleStr( max_link_density[c] )
+      + ".NR" + DoubleStr( noninformative_ratio[d] );
+  }
+
+  static string
+  DoubleStr( const double x )
+  {
+    char str[32];
+    sprintf( str, "%.15g", x );
+    return str;
+  }
+};
+
+
+
+// Run the Lachesis clustering algorithm for every combination of the clustering parameters in sweep, and write each set of clusters to its own directory,
+// <OUTPUT_DIR>/sweep/<name>/ (see ClusteringSweep::Name), along with a table of all of them at <OUTPUT_DIR>/sweep/summary.txt.  Nothing in main_results is
+// changed.  The GLM is only loaded once.  The pre-processing depends on CLUSTER_MIN_RE_SITES and CLUSTER_MAX_LINK_DENSITY, so each pair of them gets its own
+// copy of the GLM; these jobs are independent, so they're run at once, each in its own process.  Within a job, one run of the merges serves every value of
+// CLUSTER_N and CLUSTER_NONINFORMATIVE_RATIO (see GenomeLinkMatrix::AHClusteringSweep).
 void
-LachesisOrdering( const RunParams & run_params )
+LachesisClusteringSweep( const RunParams & run_params, ClusteringSweep sweep )
+{
+  cout << "\n\t|~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~|\n\t|                                 |\n\t|    LACHESIS CLUSTERING SWEEP    |\n\t|                                 |\n\t|~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~|\n\n";
+  StageTimer timer( "clustering sweep" );
+
+  sweep.Fill( run_params );
+  const string sweep_dir = run_params._out_dir + "/sweep";
+  system ( ( "mkdir -p " + run_params._out_dir + "/cached_data" ).c_str() );
+  system ( ( "mkdir -p " + sweep_dir ).c_str() );
+
+  StageTimer load_timer( "load GLM" );
+  TrueMapping * true_mapping = run_params.LoadTrueMapping();
+  const GenomeLinkMatrix * glm = LoadGLM( run_params, true_mapping );
+  load_timer.Stop();
+  run_params.LoadDraftContigNames(); // load the contig names first, so that each process doesn't have to load them again
+
+  // The jobs: one for each pair of CLUSTER_MIN_RE_SITES and CLUSTER_MAX_LINK_DENSITY.  The threads are shared among the jobs running at once.
+  const size_t N_jobs = sweep.min_RE_sites.size() * sweep.max_link_density.size();
+  const int N_procs = min( (size_t) NThreadsToUse( run_params._N_threads ), N_jobs );
+  const int N_threads_per_job = max( 1, NThreadsToUse( run_params._N_threads ) / N_procs );
+  vector<size_t> schedule( N_jobs );
+  for ( size_t k = 0; k < N_jobs; k++ )
+    schedule[k] = k;
+
+  cout << "Clustering with " << sweep.N.size() * N_jobs * sweep.noninformative_ratio.size() << " combinations of parameters, in " << N_jobs << " jobs" << endl;
+
+  StageTimer sweep_timer( "AHClusteringSweep" );
+  ForEachInChildProcess( N_jobs, schedule, N_procs, [&]( const size_t k ) {
+      const size_t b = k / sweep.max_link_density.size(), c = k % sweep.max_link_density.size();
+      cout << ": Sweep job #" << k << ": CLUSTER_MIN_RE_SITES=" << sweep.min_RE_sites[b] << ", CLUSTER_MAX_LINK_DENSITY=" << sweep.max_link_density[c] << endl;
+
+      // Pre-process a copy of the GLM.  Reordering the contigs by reference changes the TrueMapping, so each job gets its own.
+      GenomeLinkMatrix job_glm( *glm );
+      TrueMapping * job_true_mapping = run_params.LoadTrueMapping();
+      job_glm.Preprocess( true, ( job_true_mapping && run_params._sim_bin_size == 0 ) ? job_true_mapping : NULL, sweep.min_RE_sites[b],
+			  sweep.max_link_density[c], N_threads_per_job );
+
+      job_glm.AHClusteringSweep( sweep.N, run_params._cluster_CEN_contig_IDs, 0, sweep.noninformative_ratio, [&]( const size_t a, const size_t d ) {
+	  job_glm.ValidateClusters( job_true_mapping );
+	  const string dir = sweep_dir + "/" + sweep.Name( a, b, c, d );
+	  system ( ( "mkdir -p " + dir ).c_str() );
+	  ClusterVec clusters = job_glm.GetClusters();
+	  clusters.WriteFile( dir + "/clusters.txt" );
+	  clusters.WriteFile( dir + "/clusters.by_name.txt", run_params.LoadDraftContigNames() );
+	}, N_threads_per_job );
+
+      if ( job_true_mapping ) delete job_true_mapping;
+    } );
+  sweep_timer.Stop();
+
+
+  // Write the summary table, from the cluster files.
+  const string summary_file = sweep_dir + "/summary.txt";
+  ofstream out( summary_file.c_str(), ios::out );
+  out << "#name\tCLUSTER_N\tCLUSTER_MIN_RE_SITES\tCLUSTER_MAX_LINK_DENSITY\tCLUSTER_NONINFORMATIVE_RATIO\tN_groups\tN_contigs_clustered\tlength_clustered\tpct_length_clustered" << endl;
+  const vector<int> & contig_lengths = glm->ContigLengths();
+  const int64_t total_len = accumulate( contig_lengths.begin(), contig_lengths.end(), int64_t(0) );
+  for ( size_t a = 0; a < sweep.N.size(); a++ )
+    for ( size_t b = 0; b < sweep.min_RE_sites.size(); b++ )
+      for ( size_t c = 0; c < sweep.max_link_density.size(); c++ )
+	for ( size_t d = 0; d < sweep.noninformative_ratio.size(); d++ ) {
+	  const string name = sweep.Name( a, b, c, d );
+	  const ClusterVec clusters( sweep_dir + "/" + name + "/clusters.txt" );
+	  int64_t len = 0;
+	  for ( size_t i = 0; i < clusters.size(); i++ )
+	    for ( set<int>::const_iterator it = clusters[i].begin(); it != clusters[i].end(); ++it )
+	      len += contig_lengths[*it];
+	  out << name << '\t' << sweep.N[a] << '\t' << sweep.min_RE_sites[b] << '\t' << sweep.max_link_density[c] << '\t' << sweep.noninformative_ratio[d] << '\t'
+	      << clusters.size() << '\t' << clusters.SizeSum() << '\t' << len << '\t' << ( total_len ? 100.0 * len / total_len : 0 ) << endl;
+	}
+  out.close();
+  cout << "Wrote a summary of the clustering sweep to " << summary_file << endl;
+
+  delete glm;
+  if ( true_mapping ) delete true_mapping; // cleanup
+}
+
+
+
+
+// LachesisOrderCluster: Helper function for LachesisOrdering.  Load the ChromLinkMatrix for cluster #i, and use it to order and orient the contigs.
+// When the orderings are written, also write order_hash (see OrderingHash) to stamp them.  RefineOrder uses N_threads threads.
+// If new_CLM is given, it's cluster #i's ChromLinkMatrix, which was just made in memory and hasn't been written yet.  Order with it directly, and meanwhile
+// write its CLM file on another thread; once that's done, stamp the file with CLM_hash (see CLMHash).
+void
+LachesisOrderCluster( const RunParams & run_params, const ClusterVec & clusters, const size_t i, const string & order_hash, const int N_threads,
+		      ChromLinkMatrix * new_CLM = NULL, const string & CLM_hash = "" )
+{
+  // The ordering functions change cout's formatting (e.g., its precision).  Restore it afterward, so each cluster's log looks the same no matter which
+  // clusters were ordered before it, or in which process.
+  const streamsize cout_precision = cout.precision();
+  const ios::fmtflags cout_flags = cout.flags();
+
+  cout << ": Ordering on cluster #" << i << endl;
+  StageTimer timer( "ordering group " + boost::lexical_cast<string>(i) );
+
+  // Read in the ChromLinkMatrix from the *.CLM file.  This file should have
+  // been created by LachesisOrdering if it didn't already exist.
+  string i_str = boost::lexical_cast<string>(i);
+  string clm_input = run_params._out_dir + "/cached_data/group" + i_str + run_params.CacheTag() + ".CLM";
+  cout << "TESTME: " + clm_input + "\n";
+  unique_ptr<ChromLinkMatrix> clm_read;
+  thread CLM_writer;
+  if ( new_CLM == NULL ) {
+    clm_read.reset( new ChromLinkMatrix(clm_input) );
+    if ( run_params._compact_storage ) clm_read->SetCompactDists( true ); // a binary CLM file is already compact, but a text CLM file isn't
+  }
+  else CLM_writer = new_CLM->WriteFileAsync( clm_input, run_params._text_cache_files );
+  ChromLinkMatrix & clm = new_CLM == NULL ? *clm_read : *new_CLM;
+
+  // Checkpoint the ordering as it goes (see ORDER_CHECKPOINT_SECONDS), so that if this run is interrupted, the next one resumes where it left off.
+  // The checkpoints are stamped with order_hash, so they're only used if the CLM and the ordering parameters haven't changed.
+  clm.SetCheckpoints( run_params._out_dir + "/cached_data/group" + i_str, order_hash, run_params._order_checkpoint_seconds );
+
+  //clm.PrefilterLinks( clusters[i], run_params.LoadTrueMapping() );
+
+  // Main algorithms to find the orderings in this chromosome: first the
+  // 'trunk' ordering, then the full ordering.  Each of the orderings is also oriented.
+  //clm.DrawHeatmap( "heatmap." + boost::lexical_cast<string>(i) + ".png" );
+  ContigOrdering trunk = clm.MakeTrunkOrder(run_params._order_min_N_REs_in_trunk);
+  ContigOrdering order = clm.MakeFullOrder (run_params._order_min_N_REs_in_shreds);
+  if ( run_params._order_refine_seconds > 0 ) clm.RefineOrder( order, run_params._order_refine_seconds, N_threads );
+  string trunk_file = run_params._out_dir + "/cached_data/group"  + i_str + ".trunk.ordering";
+  trunk.WriteFile( trunk_file, clusters[i], run_params.LoadDraftContigNames());
+  string ordering_file = run_params._out_dir + "/main_results/group" + i_str + ".ordering";
+  order.WriteFile(ordering_file, clusters[i], run_params.LoadDraftContigNames());
+  if (run_params._use_ref && run_params._order_draw_dotplots) {
+    string dotplot_file = "clm." + i_str + ".dotplot.txt";
+    order.DrawDotplotVsTruth(clusters[i], *(run_params.LoadTrueMapping()), dotplot_file);
+  }
+  if ( new_CLM != NULL ) {
+    CLM_writer.join();
+    WriteHashFile( clm_input + ".hash", CLM_hash );
+  }
+  WriteHashFile( run_params._out_dir + "/cached_data/group" + i_str + ".ordering.hash", order_hash );
+  clm.RemoveCheckpoints();
+
+  cout.precision( cout_precision );
+  cout.flags( cout_flags );
+  timer.Stop();
+}
+
+
+
+
+// Run the Lachesis ordering and orienting algorithms on the selected groups (by default, all of them; see GroupSelection.)
+void
+LachesisOrdering( const RunParams & run_params, const GroupSelection & selection )
 {
   cout << "\n\t|~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~|\n\t|                                 |\n\t|        LACHESIS ORDERING        |\n\t|                                 |\n\t|~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~|\n\n";
+  StageTimer timer( "ordering" );
 
   // Load the clusters of contigs.
   string clusters_file = run_params._out_dir + "/main_results/clusters.by_name.txt";
@@ -157,69 +564,116 @@ LachesisOrdering( const RunParams & run_params )
   const ClusterVec clusters( clusters_file, run_params.LoadDraftContigNames() );
   assert( (int) clusters.size() >= run_params._cluster_N );
 
+  const vector<bool> selected = selection.Selected( clusters );
+  const size_t N_selected = count( selected.begin(), selected.end(), true );
+  if ( !selection.all ) {
+    cout << "Distributed mode: ordering " << N_selected << " of " << clusters.size() << " groups:";
+    for ( size_t i = 0; i < clusters.size(); i++ )
+      if ( selected[i] ) cout << ' ' << i;
+    cout << endl;
+  }
+
 
   system ( ( "mkdir -p " + run_params._out_dir + "/cached_data" ).c_str() ); // make the directory, if necessary
 
-  // Look for the complete set of ChromLinkMatrix files (*.CLM).  If the CLM files don't all already exist (or if the OVERWRITE_CLMS flag is set), create them.
-  // This requires loading the SAM files, which is time-consuming, so we only do it if we have to.
-  // But creating the set of CLMs all at once only requires reading through the SAM files once, so it's much faster than creating them all individually.
+  // Find which ChromLinkMatrix files (*.CLM) need to be made: those that don't exist yet, or whose hash files (see CLMHash) show that they were made from a
+  // different set of contigs or Hi-C data than their cluster has now (or if the OVERWRITE_CLMS flag is set, all of them).  The rest are reused, so after a
+  // change to the clustering, only the clusters that changed are redone.  Only the selected clusters are considered, so that in distributed mode, each job
+  // makes its own groups' CLMs, and no two jobs write the same file.
+  // This requires loading the Hi-C links, which is time-consuming, so we only do it if we have to.
+  // But creating the set of CLMs all at once only requires reading through the links once, so it's much faster than creating them all individually.
+  // The links come from the Hi-C link file made during clustering, so the SAM files usually don't have to be read again.
+  vector<string> CLM_files( clusters.size() ), CLM_hashes( clusters.size() );
+  vector<bool> CLM_stale( clusters.size() );
+  vector<ChromLinkMatrix *> CLMs( clusters.size(), NULL ); // the CLMs made in memory, which haven't been written to their files yet
+  size_t N_CLMs_stale = 0;
   for ( size_t i = 0; i < clusters.size(); i++ ) {
-    string CLM_file = run_params._out_dir + "/cached_data/group" + boost::lexical_cast<string>( i ) + ".CLM";
-
-    cout << "01 HERE.\n";
-    if ( !boost::filesystem::is_regular_file( CLM_file ) || run_params._overwrite_CLMs ) {
-      cout << "Need to read SAM files and create ChromLinkMatrix files at " << run_params._out_dir << "/cached_data/group*.CLM.  This will take a while." << endl;
+    if ( !selected[i] ) continue;
+    CLM_files[i] = run_params._out_dir + "/cached_data/group" + boost::lexical_cast<string>( i ) + run_params.CacheTag() + ".CLM";
+    CLM_hashes[i] = CLMHash( run_params, clusters, i );
+    CLM_stale[i] = run_params._overwrite_CLMs || !boost::filesystem::is_regular_file( CLM_files[i] ) || ReadHashFile( CLM_files[i] + ".hash" ) != CLM_hashes[i];
+    if ( CLM_stale[i] ) N_CLMs_stale++;
+  }
 
-      // Initialize a set of ChromLinkMatrix objects, each with the proper number of contigs.
-      vector<ChromLinkMatrix *> CLMs( clusters.size() );
-      for ( size_t j = 0; j < clusters.size(); j++ )
+  if ( N_CLMs_stale > 0 ) {
+    cout << "Need to read Hi-C links and create " << N_CLMs_stale << " of " << N_selected << " ChromLinkMatrix files at " << run_params._out_dir
+	 << "/cached_data/group*" << run_params.CacheTag() << ".CLM.  This will take a while." << endl;
+    StageTimer CLM_timer( "make CLMs" );
+
+    // Initialize a ChromLinkMatrix object, with the proper number of contigs, for each CLM to be made.  The others stay NULL, so they aren't loaded.
+    // Remove their hash files first, so a CLM file can't be stamped as good unless it was finished.
+    CLMs.assign( clusters.size(), NULL );
+    for ( size_t j = 0; j < clusters.size(); j++ )
+      if ( CLM_stale[j] ) {
+	boost::filesystem::remove( CLM_files[j] + ".hash" );
 	CLMs[j] = new ChromLinkMatrix( run_params._species, clusters[j].size() );
-
-      // Read all of the SAM files and fill all of the ChromLinkMatrices.
-      LoadDeNovoCLMsFromSAM( run_params._SAM_files, run_params.DraftContigRESitesFilename(), clusters, CLMs );
-
-      // Write the ChromLinkMatrices to files.
-      for ( size_t j = 0; j < clusters.size(); j++ ) {
-	string new_file_head = run_params._out_dir + "/cached_data/group" + boost::lexical_cast<string>( j );
-	string new_CLM_file = new_file_head + ".CLM";
-	CLMs[j]->WriteFile( new_CLM_file );
-	delete CLMs[j];
+	CLMs[j]->SetCompactDists( run_params._compact_storage );
       }
 
-      break;
+    const HiCLinkFile links( HiCLinksFile( run_params, false ) );
+    bool spill = run_params._CLM_memory_budget > 0;
+    if ( spill && run_params._text_cache_files ) {
+      cerr << "WARNING: CLM_MEMORY_BUDGET is ignored when TEXT_CACHE_FILES = 1; the CLMs will be built in memory." << endl;
+      spill = false;
     }
+
+    // With a memory budget, spill the Hi-C links to disk and write the CLM files from there.  The ordering below reads them back from the files.
+    if ( spill ) {
+      WriteDeNovoCLMFilesFromLinks( links, run_params.DraftContigRESitesFilename(), clusters, CLMs, CLM_files,
+				    size_t( run_params._CLM_memory_budget ) << 20, run_params._N_threads );
+      for ( size_t j = 0; j < clusters.size(); j++ )
+	if ( CLMs[j] != NULL ) {
+	  WriteHashFile( CLM_files[j] + ".hash", CLM_hashes[j] );
+	  delete CLMs[j];
+	  CLMs[j] = NULL;
+	}
+    }
+
+    // Otherwise, read all of the Hi-C links and fill all of the ChromLinkMatrices.  They're kept in memory and handed straight to the ordering below, which
+    // writes their files in the background while it orders them; so no group waits for every CLM to be written, and no CLM is read back from its file.
+    else LoadDeNovoCLMsFromLinks( links, run_params.DraftContigRESitesFilename(), clusters, CLMs, run_params._N_threads );
   }
 
 
 
-  // Loop over all clusters.  For each cluster, load a ChromLinkMatrix object and use it to order and orient the contigs.
+  // Find which clusters need to be ordered: those whose CLMs were just made, whose ordering files don't exist, or whose orderings were made with other
+  // parameters (see OrderingHash).  The rest of the orderings are reused.
+  vector<size_t> to_order;
+  vector<string> order_hashes( clusters.size() );
   for ( size_t i = 0; i < clusters.size(); i++ ) {
-    cout << ": Ordering on cluster #" << i << endl;
-
-    // Read in the ChromLinkMatrix from the *.CLM file.  This file should have
-    // been created above if it didn't already exist.
+    if ( !selected[i] ) continue;
     string i_str = boost::lexical_cast<string>(i);
-    string clm_input = run_params._out_dir + "/cached_data/group" + i_str + ".CLM";
-    cout << "TESTME: " + clm_input + "\n";
-    ChromLinkMatrix clm(clm_input);
-
-    //clm.PrefilterLinks( clusters[i], run_params.LoadTrueMapping() );
-
-    // Main algorithms to find the orderings in this chromosome: first the
-    // 'trunk' ordering, then the full ordering.  Each of the orderings is also oriented.
-    //clm.DrawHeatmap( "heatmap." + boost::lexical_cast<string>(i) + ".jpg" );
-    ContigOrdering trunk = clm.MakeTrunkOrder(run_params._order_min_N_REs_in_trunk);
-    ContigOrdering order = clm.MakeFullOrder (run_params._order_min_N_REs_in_shreds);
     string trunk_file = run_params._out_dir + "/cached_data/group"  + i_str + ".trunk.ordering";
-    trunk.WriteFile( trunk_file, clusters[i], run_params.LoadDraftContigNames());
     string ordering_file = run_params._out_dir + "/main_results/group" + i_str + ".ordering";
-    order.WriteFile(ordering_file, clusters[i], run_params.LoadDraftContigNames());
-    if (run_params._use_ref && run_params._order_draw_dotplots) {
-      string dotplot_file = "clm." + i_str + ".dotplot.txt";
-      order.DrawDotplotVsTruth(clusters[i], *(run_params.LoadTrueMapping()), dotplot_file);
+    string hash_file = run_params._out_dir + "/cached_data/group" + i_str + ".ordering.hash";
+    order_hashes[i] = OrderingHash( run_params, CLM_hashes[i] );
+    if ( CLM_stale[i] || !boost::filesystem::is_regular_file( trunk_file ) || !boost::filesystem::is_regular_file( ordering_file ) ||
+	 ReadHashFile( hash_file ) != order_hashes[i] ) {
+      boost::filesystem::remove( hash_file );
+      to_order.push_back(i);
     }
   }
-
+  if ( to_order.size() < N_selected )
+    cout << "Reusing the orderings of " << N_selected - to_order.size() << " of " << N_selected << " clusters, which haven't changed." << endl;
+
+  // Order these clusters.  The clusters are independent of each other, so up to N_THREADS of them are ordered at once, largest first (since they take the
+  // longest).  Each one is ordered in its own process; its output is printed all at once, in cluster order, so the logs don't interleave.
+  // Each process inherits its cluster's CLM, if it was just made; once the cluster is done, the CLM is freed here as well.
+  // Load the contig names first, so that each process doesn't have to load them again.
+  run_params.LoadDraftContigNames();
+  vector<size_t> schedule( to_order.size() );
+  for ( size_t k = 0; k < to_order.size(); k++ )
+    schedule[k] = k;
+  stable_sort( schedule.begin(), schedule.end(), [&]( const size_t a, const size_t b ) { return clusters[ to_order[a] ].size() > clusters[ to_order[b] ].size(); } );
+
+  // The threads are shared among the clusters being ordered at once, so RefineOrder gets a share of them.
+  const int N_procs = max( (size_t) 1, min( (size_t) NThreadsToUse( run_params._N_threads ), to_order.size() ) );
+  const int N_threads_per_job = max( 1, NThreadsToUse( run_params._N_threads ) / N_procs );
+  StageTimer order_timer( "order groups" );
+  ForEachInChildProcess( to_order.size(), schedule, N_procs,
+			 [&]( const size_t k ) { LachesisOrderCluster( run_params, clusters, to_order[k], order_hashes[ to_order[k] ], N_threads_per_job,
+								       CLMs[ to_order[k] ], CLM_hashes[ to_order[k] ] ); },
+			 [&]( const size_t k ) { delete CLMs[ to_order[k] ]; CLMs[ to_order[k] ] = NULL; } );
 
 }
 
@@ -230,6 +684,7 @@ LachesisOrdering( const RunParams & run_params )
 
 // Run the Lachesis reporting functions, centered around the Reporter class.
 void LachesisReporting(const RunParams &run_params) {
+  StageTimer timer( "reporting" );
   // Load the clusters of contigs.
   string clusters_file = run_params._out_dir + "/main_results/clusters.by_name.txt";
   //string clusters_file = run_params._out_dir + "/main_results/clusters.merged_with_RAD.by_name.txt.split"; // TEMP
@@ -279,12 +734,98 @@ void LachesisReporting(const RunParams &run_params) {
 
   // Optional: Make a heatmap of the whole assembly.  This is a usual reference-free visual evaluation.
   if ( run_params._report_draw_heatmap ) MakeWholeAssemblyHeatmap( run_params );
+
+  // Optional: Write the output assembly, with a scaffold for each ordered group.
+  if ( run_params._report_scaffolded_fasta ) WriteScaffoldedFasta( run_params, clusters );
+}
+
+
+
+
+
+
+
+
+
+// LachesisGather: The last step of a distributed run (see GroupSelection).  Check that every group has an up-to-date ordering, then run the reporting.
+void
+LachesisGather( const RunParams & run_params )
+{
+  string clusters_file = run_params._out_dir + "/main_results/clusters.by_name.txt";
+  if ( !boost::filesystem::is_regular_file( clusters_file ) ) {
+    cerr << "ERROR: Can't find file '" << clusters_file << "' with clusters.  The clustering must be done before a distributed run can be gathered." << endl;
+    exit(1);
+  }
+  const ClusterVec clusters( clusters_file, run_params.LoadDraftContigNames() );
+
+  // An ordering's hash file is only written once the ordering is finished, so a matching hash means the ordering is complete, and was made from the
+  // current clusters and parameters.
+  vector<size_t> missing;
+  for ( size_t i = 0; i < clusters.size(); i++ ) {
+    string i_str = boost::lexical_cast<string>(i);
+    string CLM_file = run_params._out_dir + "/cached_data/group" + i_str + run_params.CacheTag() + ".CLM";
+    string hash_file = run_params._out_dir + "/cached_data/group" + i_str + ".ordering.hash";
+    const string CLM_hash = CLMHash( run_params, clusters, i );
+    if ( ReadHashFile( CLM_file + ".hash" ) != CLM_hash || ReadHashFile( hash_file ) != OrderingHash( run_params, CLM_hash ) ||
+	 !boost::filesystem::is_regular_file( run_params._out_dir + "/cached_data/group" + i_str + ".trunk.ordering" ) ||
+	 !boost::filesystem::is_regular_file( run_params._out_dir + "/main_results/group" + i_str + ".ordering" ) )
+      missing.push_back(i);
+  }
+
+  if ( !missing.empty() ) {
+    cerr << "ERROR: --gather: " << missing.size() << " of " << clusters.size() << " groups don't have up-to-date orderings yet:";
+    for ( size_t k = 0; k < missing.size(); k++ )
+      cerr << ' ' << missing[k];
+    cerr << "\nOrder them first (e.g., with 'Lachesis <ini_file> --groups <IDs>'), then gather again." << endl;
+    exit(1);
+  }
+
+  cout << "Gathering the orderings of all " << clusters.size() << " groups." << endl;
+  LachesisReporting( run_params );
 }
 
 
 
 
 
+// PrintSyntax: Print the command-line syntax of Lachesis.
+void
+PrintSyntax()
+{
+  cout << "Syntax: Lachesis <ini_file> [--groups <IDs> | --task-array <N_tasks> | --gather | --sweep <KEY>=<values> ...]" << endl;
+  cout << "For a sample ini_file, see Lachesis.ini." << endl;
+  cout << "Options for distributed runs, in which the groups are ordered by many jobs at once (run the clustering first, with DO_ORDERING = 0):" << endl;
+  cout << "  --groups <IDs>         Only order these groups (e.g., '--groups 3,7,12'), then stop." << endl;
+  cout << "  --task-array <N_tasks> Only order this job's share of the groups, then stop.  The groups are dealt out among N_tasks jobs in a job array; this" << endl;
+  cout << "                         job's ID is read from SLURM_ARRAY_TASK_ID, SGE_TASK_ID, PBS_ARRAYID, or LSB_JOBINDEX." << endl;
+  cout << "  --gather               Once every group is ordered, do the reporting." << endl;
+  cout << "Options for tuning the clustering:" << endl;
+  cout << "  --sweep <KEY>=<values> Instead of the usual run, cluster with every combination of these values of the clustering parameters (e.g., '--sweep" << endl;
+  cout << "                         CLUSTER_N=16,20,24 --sweep CLUSTER_MIN_RE_SITES=25,50'), and write each set of clusters to OUTPUT_DIR/sweep/.  The keys" << endl;
+  cout << "                         can be CLUSTER_N, CLUSTER_MIN_RE_SITES, CLUSTER_MAX_LINK_DENSITY, and CLUSTER_NONINFORMATIVE_RATIO; the others take their" << endl;
+  cout << "                         values from the ini_file." << endl << endl;
+}
+
+
+
+// TaskArrayID: Return the ID of this job in a cluster job array, from the environment variables set by the common schedulers.
+int
+TaskArrayID()
+{
+  const char * vars[4] = { "SLURM_ARRAY_TASK_ID", "SGE_TASK_ID", "PBS_ARRAYID", "LSB_JOBINDEX" };
+  for ( int k = 0; k < 4; k++ ) {
+    const char * value = getenv( vars[k] );
+    if ( value == NULL ) continue;
+    try { return boost::lexical_cast<int>( value ); }
+    catch ( boost::bad_lexical_cast & ) {
+      cerr << "ERROR: --task-array: can't read a task ID from " << vars[k] << " = '" << value << "'.  Is this job part of a job array?" << endl;
+      exit(1);
+    }
+  }
+  cerr << "ERROR: --task-array: none of SLURM_ARRAY_TASK_ID, SGE_TASK_ID, PBS_ARRAYID, LSB_JOBINDEX is set.  Is this job part of a job array?" << endl;
+  exit(1);
+}
+
 
 
 
@@ -297,23 +838,76 @@ int main(int argc, char * argv[]) {
   cout << endl << endl;
 
   // If an INI file was not specified, print syntax and exit.
-  if (argc != 2) {
-    cout << "Syntax: Lachesis <ini_file>" << endl;
-    cout << "For a sample ini_file, see Lachesis.ini." << endl << endl;
+  if (argc < 2) {
+    PrintSyntax();
     cout << "Defaulting to test_case.ini\n";
     ini_file = "INIs/test_case.ini";
   } else {
     ini_file = argv[1];
   }
 
+  // Parse the options for distributed runs.
+  GroupSelection selection;
+  ClusteringSweep sweep;
+  bool gather = false;
+  for ( int k = 2; k < argc; k++ ) {
+    const string option = argv[k];
+    const bool has_arg = ( k+1 < argc );
+    if ( option == "--gather" ) gather = true;
+    else if ( option == "--sweep" && has_arg ) sweep.Add( argv[++k] );
+    else if ( option == "--groups" && has_arg ) {
+      vector<string> IDs;
+      boost::split( IDs, argv[++k], boost::is_any_of(",") );
+      for ( size_t j = 0; j < IDs.size(); j++ ) {
+	try { selection.groups.push_back( boost::lexical_cast<int>( IDs[j] ) ); }
+	catch ( boost::bad_lexical_cast & ) { cerr << "ERROR: --groups: can't read group ID '" << IDs[j] << "'" << endl; exit(1); }
+      }
+      selection.all = false;
+    }
+    else if ( option == "--task-array" && has_arg ) {
+      try { selection.N_tasks = boost::lexical_cast<int>( argv[++k] ); }
+      catch ( boost::bad_lexical_cast & ) { selection.N_tasks = 0; }
+      if ( selection.N_tasks <= 0 ) { cerr << "ERROR: --task-array: N_tasks must be a positive integer" << endl; exit(1); }
+      selection.task_ID = TaskArrayID();
+      selection.all = false;
+    }
+    else {
+      cerr << "ERROR: Can't parse command-line option '" << option << "'" << endl;
+      PrintSyntax();
+      exit(1);
+    }
+  }
+  if ( gather && !selection.all ) {
+    cerr << "ERROR: --gather can't be combined with --groups or --task-array" << endl;
+    exit(1);
+  }
+  if ( !sweep.empty() && ( gather || !selection.all ) ) {
+    cerr << "ERROR: --sweep can't be combined with --groups, --task-array, or --gather" << endl;
+    exit(1);
+  }
+
   // Input the Lachesis.ini file and find run parameters.
   const RunParams run_params(ini_file);
+  StageTimer timer( "Lachesis" );
 
   // Run the steps of the Lachesis ordering!
+  // In distributed mode, just order the selected groups, or gather the results.
+  // In a parameter sweep, just do the clustering sweep.
+  if ( !sweep.empty() ) LachesisClusteringSweep( run_params, sweep );
+  else if ( gather ) LachesisGather( run_params );
+  else if ( !selection.all ) LachesisOrdering( run_params, selection );
+  else {
+    if ( run_params._do_clustering ) LachesisClustering( run_params );
+    if ( run_params._do_ordering )   LachesisOrdering  ( run_params, selection );
+    if ( run_params._do_reporting )  LachesisReporting ( run_params );
+  }
+  timer.Stop();
 
-  if ( run_params._do_clustering ) LachesisClustering( run_params );
-  if ( run_params._do_ordering )   LachesisOrdering  ( run_params );
-  if ( run_params._do_reporting )  LachesisReporting ( run_params );
+  // Write the timing of each stage of this run to a machine-readable file.  For the breakdown within the ordering of each group, see the TIMING lines in the
+  // log; those stages ran in child processes, so only their totals (in "order groups") are in this file.  Each job in a distributed run, and each sweep,
+  // gets its own file.
+  system ( ( "mkdir -p " + run_params._out_dir ).c_str() );
+  WriteStageTimingJSON( run_params._out_dir + "/stage_timing" + ( !sweep.empty() ? ".sweep" : selection.all ? "" : "." + selection.Name() ) + ".json" );
 
   cout << ": Done!" << endl;
   return 0;
@@ -0,0 +1,315 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+
+/**************************************************************************************************************************************************************
+ *
+ * LachesisBench.cc
+ *
+ * A benchmark of the Lachesis clustering and ordering engines, on synthetic Hi-C data.  This is a separate program from Lachesis, built with
+ * 'make LachesisBench'.  It is used to catch performance regressions, and to estimate the size of a job before submitting it.
+ *
+ * For each scale (i.e., number of contigs), LachesisBench makes a synthetic genome, with N_GROUPS chromosomes that have been broken into contigs, and
+ * simulates Hi-C read pairs on it, with a fraction NOISE of the pairs placed at random (see SyntheticHiC.h.)  The read pairs are written to a SAM file,
+ * along with an RE sites file for the contigs.  Then the data go through the Lachesis pipeline, exactly as in a real run: reading
+ * the SAM file into a HiCLinkFile, making the GenomeLinkMatrix and clustering it, making the ChromLinkMatrices, and ordering, orienting and spacing each
+ * group.  Each stage is timed, and the results go to a CSV file, one line per stage, with the wall time, the CPU time, the peak resident set usage, and
+ * the number of calls counted by each CallCounter (see TimeMem.h).  In the ordering stages, the numbers are summed over all groups.  The results of the
+ * pipeline are written to each scale's directory, as clusters.txt and group*.ordering, so that runs can be checked against each other (see
+ * PerfRegression.pl.)
+ *
+ *
+ * Syntax: LachesisBench [ARG=value ...]
+ *
+ * N_CONTIGS          Comma-separated list of scales at which to run (default: 100,400,1600)
+ * N_GROUPS           Number of chromosomes in the synthetic genome (default: 10)
+ * LINKS_PER_CONTIG   Number of Hi-C read pairs to simulate, per contig (default: 200)
+ * NOISE              Fraction of read pairs placed at random (default: 0.05)
+ * MIN_CONTIG_LEN     Contig lengths are uniformly distributed in [MIN_CONTIG_LEN,MAX_CONTIG_LEN] (default: 20000)
+ * MAX_CONTIG_LEN     (default: 200000)
+ * SEED               Random seed (default: 1)
+ * SPACE_CONTIGS      Whether to run SpaceContigs, which is much slower than the other stages (default: 1)
+ * N_THREADS          Number of threads to use in the parallel steps; 0 means one per processor core (default: 1)
+ * COMPACT            Whether to use compact storage for the GLM file and the CLMs, as with COMPACT_STORAGE in the INI file (default: 0)
+ * OUT_DIR            Directory for the synthetic data and the cache files (default: bench)
+ * CSV                The output CSV file (default: <OUT_DIR>/bench.csv)
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+
+// C libraries
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h> // strstr, used in ParsedArgs.h
+
+// STL declarations
+#include <string>
+#include <vector>
+#include <set>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip> // setprecision
+#include <functional>
+using namespace std;
+
+// Modules in ~/include (must add -L~/include and -lJ<module> to link)
+#include "TimeMem.h"
+#include "ParsedArgs.h"
+
+// Boost includes
+#include <boost/algorithm/string.hpp> // split
+#include <boost/lexical_cast.hpp>
+
+// Local includes
+#include "GenomeLinkMatrix.h"
+#include "ChromLinkMatrix.h"
+#include "LinkSizeDistribution.h"
+#include "HiCLinks.h"
+#include "ClusterVec.h"
+#include "ContigOrdering.h"
+#include "Parallel.h"
+#include "SyntheticHiC.h"
+
+
+
+// Heuristic parameters for clustering and ordering.  These are the values in the test case (see INIs/test_case.ini.)
+static const int CLUSTER_MIN_RE_SITES = 25;
+static const double CLUSTER_MAX_LINK_DENSITY = 2;
+static const double CLUSTER_NONINFORMATIVE_RATIO = 3;
+static const int ORDER_MIN_N_RES_IN_TRUNK = 15;
+static const int ORDER_MIN_N_RES_IN_SHREDS = 15;
+
+// The parameters of one benchmark scale: the synthetic data, and how to run the pipeline on them.
+struct BenchParams : public SyntheticHiCParams
+{
+  bool space_contigs;
+  int N_threads;
+  bool compact;
+  string dir; // directory for this scale's files
+};
+
+
+
+// The measurements of one stage.  In stages that are run once for each group, these accumulate.
+struct StageStats
+{
+  string stage;
+  double wall, CPU, peak_RSS;
+  vector<int64_t> N_calls; // one per CallCounter
+};
+
+
+// Measure: Run work() and add its wall time, CPU time, and calls to the StageStats with this name, making it if necessary.  Stages are kept in the order
+// in which they're first run.
+void
+Measure( vector<StageStats> & stats, const string & stage, const function< void() > & work )
+{
+  const vector<CallCounter *> & counters = CallCounter::All();
+
+  size_t i = 0;
+  while ( i < stats.size() && stats[i].stage != stage ) i++;
+  if ( i == stats.size() ) {
+    StageStats s;
+    s.stage = stage;
+    s.wall = s.CPU = s.peak_RSS = 0;
+    s.N_calls.resize( counters.size(), 0 );
+    stats.push_back( s );
+  }
+
+  vector<int64_t> N_calls_start( counters.size() );
+  for ( size_t j = 0; j < counters.size(); j++ )
+    N_calls_start[j] = counters[j]->N();
+  const double CPU_start = CPUTime( true );
+  const double wall_start = WallTime();
+
+  work();
+
+  stats[i].wall += WallTime() - wall_start;
+  stats[i].CPU += CPUTime( true ) - CPU_start;
+  stats[i].peak_RSS = PeakMemUsage( true );
+  for ( size_t j = 0; j < counters.size(); j++ )
+    stats[i].N_calls[j] += counters[j]->N() - N_calls_start[j];
+}
+
+
+
+
+// RunBench: Run the benchmark at one scale, and write its lines to the CSV file.
+void
+RunBench( const BenchParams & params, ostream & csv )
+{
+  cout << Time() << ": LachesisBench: N_contigs = " << params.N_contigs << ", N_groups = " << params.N_groups << ", links per contig = "
+       << params.links_per_contig << endl;
+  system( ( "mkdir -p " + params.dir ).c_str() );
+
+  const string SAM_file = params.dir + "/synthetic.sam";
+  const string RE_sites_file = params.dir + "/synthetic.RE_sites.txt";
+  const string link_file = params.dir + "/all.links";
+  const string GLM_file = params.dir + "/all.GLM";
+  vector<StageStats> stats;
+  int64_t N_pairs = 0;
+
+  Measure( stats, "generate SAM", [&]() { N_pairs = MakeSyntheticHiC( params, SAM_file, RE_sites_file ); } );
+  Measure( stats, "read SAM", [&]() { HiCLinkFile::Extract( vector<string>( 1, SAM_file ), link_file, params.N_threads ); } );
+  const HiCLinkFile links( link_file );
+
+
+  // Clustering.
+  GenomeLinkMatrix * glm = NULL;
+  Measure( stats, "make GLM", [&]() { glm = new GenomeLinkMatrix( "bench", links, RE_sites_file, params.N_threads ); } );
+  Measure( stats, "write GLM", [&]() { glm->WriteFile( GLM_file, false, params.compact ); } );
+  delete glm;
+  Measure( stats, "read GLM", [&]() { glm = new GenomeLinkMatrix( GLM_file ); } );
+  Measure( stats, "GLM preprocessing", [&]() { glm->Preprocess( true, NULL, CLUSTER_MIN_RE_SITES, CLUSTER_MAX_LINK_DENSITY, params.N_threads ); } );
+  Measure( stats, "AHClustering", [&]() {
+      glm->AHClustering( params.N_groups, vector<int>(), 0, CLUSTER_NONINFORMATIVE_RATIO, false, NULL, params.N_threads );
+    } );
+  const ClusterVec clusters = glm->GetClusters();
+  delete glm;
+
+  const vector<string> contig_names = SyntheticContigNames( params.N_contigs );
+  clusters.WriteFile( params.dir + "/clusters.txt", &contig_names );
+
+
+  // Make the ChromLinkMatrices, and write them to files and read them back, as in a real run.
+  vector<ChromLinkMatrix *> CLMs( clusters.size() );
+  vector<string> CLM_files( clusters.size() );
+  for ( size_t i = 0; i < clusters.size(); i++ ) {
+    CLMs[i] = new ChromLinkMatrix( "bench", clusters[i].size() );
+    CLMs[i]->SetCompactDists( params.compact );
+    CLM_files[i] = params.dir + "/group" + boost::lexical_cast<string>( i ) + ".CLM";
+  }
+  Measure( stats, "make CLMs", [&]() { LoadDeNovoCLMsFromLinks( links, RE_sites_file, clusters, CLMs, params.N_threads ); } );
+  Measure( stats, "write CLMs", [&]() {
+      for ( size_t i = 0; i < clusters.size(); i++ )
+	CLMs[i]->WriteFile( CLM_files[i] );
+    } );
+  for ( size_t i = 0; i < clusters.size(); i++ )
+    delete CLMs[i];
+  Measure( stats, "read CLMs", [&]() {
+      for ( size_t i = 0; i < clusters.size(); i++ )
+	CLMs[i] = new ChromLinkMatrix( CLM_files[i] );
+    } );
+
+  // The LinkSizeDistribution is written to its cache file and read back, too.
+  const string LSD_file = params.dir + "/LinkSizeDistribution.txt";
+  LinkSizeDistribution * lsd = NULL;
+  Measure( stats, "make LinkSizeDistribution", [&]() { lsd = new LinkSizeDistribution( links, params.N_threads ); } );
+  Measure( stats, "write LinkSizeDistribution", [&]() { lsd->WriteFile( LSD_file ); } );
+  delete lsd;
+  Measure( stats, "read LinkSizeDistribution", [&]() { lsd = new LinkSizeDistribution( LSD_file ); } );
+  assert( LinkSizeDistribution::IsUpToDate( LSD_file, links.SAM_files() ) );
+
+
+  // Order, orient, and space each group.  These are the same steps as in ChromLinkMatrix::MakeTrunkOrder() and MakeFullOrder(), with each one timed.
+  for ( size_t i = 0; i < clusters.size(); i++ ) {
+    const ChromLinkMatrix & clm = *CLMs[i];
+    if ( !clm.has_links() ) continue;
+
+    vector< vector<int> > tree;
+    ContigOrdering order( clm.N_contigs(), false );
+    Measure( stats, "FindSpanningTree", [&]() { tree = clm.FindSpanningTree( ORDER_MIN_N_RES_IN_TRUNK ); } );
+    clm.SmoothThornsInTree( tree );
+    Measure( stats, "ReinsertShreds", [&]() { order = clm.ReinsertShreds( tree, ORDER_MIN_N_RES_IN_SHREDS ); } );
+    Measure( stats, "OrientContigs", [&]() { clm.OrientContigs( order ); } );
+    if ( params.space_contigs ) Measure( stats, "SpaceContigs", [&]() { clm.SpaceContigs( order, *lsd ); } );
+    order.WriteFile( params.dir + "/group" + boost::lexical_cast<string>( i ) + ".ordering", clusters[i], &contig_names );
+  }
+
+  for ( size_t i = 0; i < clusters.size(); i++ )
+    delete CLMs[i];
+  delete lsd;
+
+
+  // Write the results.
+  for ( size_t i = 0; i < stats.size(); i++ ) {
+    const StageStats & s = stats[i];
+    csv << params.N_contigs << ',' << params.N_groups << ',' << N_pairs << ',' << s.stage << ',' << fixed << setprecision(3) << s.wall << ',' << s.CPU
+	<< ',' << setprecision(0) << s.peak_RSS;
+    for ( size_t j = 0; j < s.N_calls.size(); j++ )
+      csv << ',' << s.N_calls[j];
+    csv << endl;
+  }
+}
+
+
+
+
+int main( int argc, char * argv[] )
+{
+  ParsedArgs args = ParseArgs( argc, argv );
+  args.RequireOrDefault( "N_CONTIGS", "100,400,1600" );
+  args.RequireOrDefault( "N_GROUPS", "10" );
+  args.RequireOrDefault( "LINKS_PER_CONTIG", "200" );
+  args.RequireOrDefault( "NOISE", "0.05" );
+  args.RequireOrDefault( "MIN_CONTIG_LEN", "20000" );
+  args.RequireOrDefault( "MAX_CONTIG_LEN", "200000" );
+  args.RequireOrDefault( "SEED", "1" );
+  args.RequireOrDefault( "SPACE_CONTIGS", "1" );
+  args.RequireOrDefault( "N_THREADS", "1" );
+  args.RequireOrDefault( "COMPACT", "0" );
+  args.RequireOrDefault( "OUT_DIR", "bench" );
+  args.RequireOrDefault( "CSV", args["OUT_DIR"] + "/bench.csv" );
+
+  BenchParams params;
+  params.N_groups = args.ValueAsInt( "N_GROUPS" );
+  params.links_per_contig = args.ValueAsInt( "LINKS_PER_CONTIG" );
+  params.noise = args.ValueAsDouble( "NOISE" );
+  params.min_contig_len = args.ValueAsInt( "MIN_CONTIG_LEN" );
+  params.max_contig_len = args.ValueAsInt( "MAX_CONTIG_LEN" );
+  params.seed = args.ValueAsInt( "SEED" );
+  params.space_contigs = args.ValueAsBool( "SPACE_CONTIGS" );
+  params.N_threads = args.ValueAsInt( "N_THREADS" );
+  params.compact = args.ValueAsBool( "COMPACT" );
+  if ( params.N_groups < 1 || params.links_per_contig < 1 || params.noise < 0 || params.noise > 1
+       || params.min_contig_len < 1000 || params.max_contig_len < params.min_contig_len ) {
+    cerr << "ERROR: LachesisBench: Bad parameters.  See LachesisBench.cc for the syntax." << endl;
+    exit(1);
+  }
+
+  vector<string> scales;
+  boost::split( scales, args["N_CONTIGS"], boost::is_any_of(",") );
+
+  system( ( "mkdir -p " + args["OUT_DIR"] ).c_str() );
+  ofstream csv( args["CSV"].c_str(), ios::out );
+  if ( !csv ) {
+    cerr << "ERROR: LachesisBench: Can't write to file " << args["CSV"] << endl;
+    exit(1);
+  }
+  csv << "N_contigs,N_groups,N_read_pairs,stage,wall_sec,CPU_sec,peak_RSS_KB";
+  const vector<CallCounter *> & counters = CallCounter::All();
+  for ( size_t j = 0; j < counters.size(); j++ )
+    csv << ',' << counters[j]->name() << "_calls";
+  csv << endl;
+
+  for ( size_t i = 0; i < scales.size(); i++ ) {
+    params.N_contigs = boost::lexical_cast<int>( scales[i] );
+    if ( params.N_contigs < params.N_groups ) {
+      cerr << "ERROR: LachesisBench: N_CONTIGS (" << params.N_contigs << ") must be at least N_GROUPS (" << params.N_groups << ")" << endl;
+      exit(1);
+    }
+    params.dir = args["OUT_DIR"] + "/N" + scales[i];
+    RunBench( params, csv );
+  }
+
+  csv.close();
+  cout << Time() << ": LachesisBench: Done!  Results are in " << args["CSV"] << endl;
+  return 0;
+}
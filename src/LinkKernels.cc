@@ -0,0 +1,374 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+
+// For documentation, see LinkKernels.h
+#include "LinkKernels.h"
+
+#include <math.h> // log, fabs
+#include <stdlib.h> // getenv, exit
+#include <string.h> // strcmp
+#include <algorithm> // min
+#include <vector>
+#include <iostream>
+using namespace std;
+
+// The vector kernels are only compiled on x86-64 with GCC-compatible compilers, which can compile them without any special flags (via the 'target'
+// attribute) and which can check the processor's features at run time (via __builtin_cpu_supports).
+#if defined(__x86_64__) && defined(__GNUC__)
+#define LINK_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+
+
+/* SCALAR KERNELS */
+
+static double
+SumReciprocalsScalar( const int32_t * x, const size_t N, const int64_t offset )
+{
+  double sum = 0;
+  for ( size_t i = 0; i < N; i++ )
+    sum += 1.0 / double( x[i] + offset );
+  return sum;
+}
+
+
+static double
+SumLogsScalar( const int32_t * x, const size_t N )
+{
+  double sum = 0;
+  for ( size_t i = 0; i < N; i++ )
+    sum += log( double( x[i] ) );
+  return sum;
+}
+
+
+
+
+#ifdef LINK_KERNELS_X86
+
+/* AVX2 KERNELS
+ *
+ * The reciprocals are taken in double precision, so each term is exactly the same as in the scalar kernel; only the order of the additions differs.
+ *
+ * The log kernel avoids calling log() on every element.  Instead each lane keeps a running product, which is renormalized into [1,2) after every
+ * multiplication by stripping off its binary exponent and adding that exponent to a separate integer counter.  At the end, the sum of logs in each lane is
+ * ln(product) + exponent * ln(2).  (The product can't overflow, since it's < 2 * 2^31 before each renormalization.)  This only works for x > 0, so if any
+ * x <= 0 is found, the scalar kernel is used instead, to give the same result (-inf or NaN) as the scalar code would.
+ */
+
+__attribute__(( target("avx2") )) static double
+SumReciprocalsAVX2( const int32_t * x, const size_t N, const int64_t offset )
+{
+  const __m256d one = _mm256_set1_pd( 1.0 );
+  const __m256d off = _mm256_set1_pd( double( offset ) );
+  __m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+
+  size_t i = 0;
+  for ( ; i + 8 <= N; i += 8 ) {
+    const __m256d x0 = _mm256_cvtepi32_pd( _mm_loadu_si128( (const __m128i *) ( x + i ) ) );
+    const __m256d x1 = _mm256_cvtepi32_pd( _mm_loadu_si128( (const __m128i *) ( x + i + 4 ) ) );
+    sum0 = _mm256_add_pd( sum0, _mm256_div_pd( one, _mm256_add_pd( x0, off ) ) );
+    sum1 = _mm256_add_pd( sum1, _mm256_div_pd( one, _mm256_add_pd( x1, off ) ) );
+  }
+  if ( i + 4 <= N ) {
+    const __m256d x0 = _mm256_cvtepi32_pd( _mm_loadu_si128( (const __m128i *) ( x + i ) ) );
+    sum0 = _mm256_add_pd( sum0, _mm256_div_pd( one, _mm256_add_pd( x0, off ) ) );
+    i += 4;
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd( lanes, _mm256_add_pd( sum0, sum1 ) );
+  double sum = ( lanes[0] + lanes[1] ) + ( lanes[2] + lanes[3] );
+  for ( ; i < N; i++ )
+    sum += 1.0 / double( x[i] + offset );
+  return sum;
+}
+
+
+__attribute__(( target("avx2") )) static double
+SumLogsAVX2( const int32_t * x, const size_t N )
+{
+  const __m256i mantissa_mask = _mm256_set1_epi64x( 0x000FFFFFFFFFFFFFLL );
+  const __m256i one_bits = _mm256_set1_epi64x( 0x3FF0000000000000LL ); // the bits of 1.0
+  const __m256d zero = _mm256_setzero_pd();
+  __m256d product = _mm256_set1_pd( 1.0 ), bad = _mm256_setzero_pd();
+  __m256i exponent = _mm256_setzero_si256(); // sum of the biased exponents stripped off the products
+
+  size_t N_steps = 0;
+  size_t i = 0;
+  for ( ; i + 4 <= N; i += 4, N_steps++ ) {
+    const __m256d xi = _mm256_cvtepi32_pd( _mm_loadu_si128( (const __m128i *) ( x + i ) ) );
+    bad = _mm256_or_pd( bad, _mm256_cmp_pd( xi, zero, _CMP_LE_OQ ) );
+    const __m256i bits = _mm256_castpd_si256( _mm256_mul_pd( product, xi ) );
+    exponent = _mm256_add_epi64( exponent, _mm256_srli_epi64( bits, 52 ) );
+    product = _mm256_castsi256_pd( _mm256_or_si256( _mm256_and_si256( bits, mantissa_mask ), one_bits ) );
+  }
+  if ( _mm256_movemask_pd( bad ) ) return SumLogsScalar( x, N );
+
+  double lanes[4];
+  int64_t exponents[4];
+  _mm256_storeu_pd( lanes, product );
+  _mm256_storeu_si256( (__m256i *) exponents, exponent );
+  double sum = 0;
+  for ( int j = 0; j < 4; j++ )
+    sum += log( lanes[j] ) + double( exponents[j] - 1023 * int64_t( N_steps ) ) * M_LN2;
+  for ( ; i < N; i++ )
+    sum += log( double( x[i] ) );
+  return sum;
+}
+
+
+
+
+/* AVX-512 KERNELS
+ *
+ * These are the same as the AVX2 kernels, but with 8 lanes instead of 4.
+ *
+ * The unmasked forms of some AVX-512 intrinsics (_mm512_cvtepi32_pd, _mm512_srli_epi64, _mm512_reduce_add_pd) are built in GCC's headers on top of
+ * _mm512_undefined_*(), which GCC 12 reports as "may be used uninitialized" under -Wall.  So the zero-masked forms are used here, with all lanes set, and
+ * the final sum over the lanes is done by hand, in the same order as _mm512_reduce_add_pd.
+ */
+
+#define ALL_LANES __mmask8( 0xFF )
+
+__attribute__(( target("avx512f") )) static inline __m512d
+LoadInt32AsDouble( const int32_t * x )
+{
+  return _mm512_maskz_cvtepi32_pd( ALL_LANES, _mm256_loadu_si256( (const __m256i *) x ) );
+}
+
+
+__attribute__(( target("avx512f") )) static inline double
+SumLanes( const __m512d v )
+{
+  double l[8];
+  _mm512_storeu_pd( l, v );
+  const double t0 = l[4] + l[0], t1 = l[5] + l[1], t2 = l[6] + l[2], t3 = l[7] + l[3];
+  return ( t2 + t0 ) + ( t3 + t1 );
+}
+
+__attribute__(( target("avx512f") )) static double
+SumReciprocalsAVX512( const int32_t * x, const size_t N, const int64_t offset )
+{
+  const __m512d one = _mm512_set1_pd( 1.0 );
+  const __m512d off = _mm512_set1_pd( double( offset ) );
+  __m512d sum0 = _mm512_setzero_pd(), sum1 = _mm512_setzero_pd();
+
+  size_t i = 0;
+  for ( ; i + 16 <= N; i += 16 ) {
+    const __m512d x0 = LoadInt32AsDouble( x + i );
+    const __m512d x1 = LoadInt32AsDouble( x + i + 8 );
+    sum0 = _mm512_add_pd( sum0, _mm512_div_pd( one, _mm512_add_pd( x0, off ) ) );
+    sum1 = _mm512_add_pd( sum1, _mm512_div_pd( one, _mm512_add_pd( x1, off ) ) );
+  }
+  if ( i + 8 <= N ) {
+    const __m512d x0 = LoadInt32AsDouble( x + i );
+    sum0 = _mm512_add_pd( sum0, _mm512_div_pd( one, _mm512_add_pd( x0, off ) ) );
+    i += 8;
+  }
+
+  double sum = SumLanes( _mm512_add_pd( sum0, sum1 ) );
+  for ( ; i < N; i++ )
+    sum += 1.0 / double( x[i] + offset );
+  return sum;
+}
+
+
+__attribute__(( target("avx512f") )) static double
+SumLogsAVX512( const int32_t * x, const size_t N )
+{
+  const __m512i mantissa_mask = _mm512_set1_epi64( 0x000FFFFFFFFFFFFFLL );
+  const __m512i one_bits = _mm512_set1_epi64( 0x3FF0000000000000LL ); // the bits of 1.0
+  const __m512d zero = _mm512_setzero_pd();
+  __m512d product = _mm512_set1_pd( 1.0 );
+  __m512i exponent = _mm512_setzero_si512(); // sum of the biased exponents stripped off the products
+  __mmask8 bad = 0;
+
+  size_t N_steps = 0;
+  size_t i = 0;
+  for ( ; i + 8 <= N; i += 8, N_steps++ ) {
+    const __m512d xi = LoadInt32AsDouble( x + i );
+    bad |= _mm512_cmp_pd_mask( xi, zero, _CMP_LE_OQ );
+    const __m512i bits = _mm512_castpd_si512( _mm512_mul_pd( product, xi ) );
+    exponent = _mm512_add_epi64( exponent, _mm512_maskz_srli_epi64( ALL_LANES, bits, 52 ) );
+    product = _mm512_castsi512_pd( _mm512_or_si512( _mm512_and_si512( bits, mantissa_mask ), one_bits ) );
+  }
+  if ( bad ) return SumLogsScalar( x, N );
+
+  double lanes[8];
+  int64_t exponents[8];
+  _mm512_storeu_pd( lanes, product );
+  _mm512_storeu_si512( exponents, exponent );
+  double sum = 0;
+  for ( int j = 0; j < 8; j++ )
+    sum += log( lanes[j] ) + double( exponents[j] - 1023 * int64_t( N_steps ) ) * M_LN2;
+  for ( ; i < N; i++ )
+    sum += log( double( x[i] ) );
+  return sum;
+}
+
+#undef ALL_LANES
+
+#endif // LINK_KERNELS_X86
+
+
+
+
+/* DISPATCH */
+
+struct LinkKernelSet
+{
+  const char * ISA;
+  double (*sum_reciprocals)( const int32_t *, const size_t, const int64_t );
+  double (*sum_logs)( const int32_t *, const size_t );
+};
+
+
+// KernelsAgreeWithScalar: Check a set of vector kernels against the scalar kernels, on a test input resembling real link data (distances from 1 bp to
+// ~10 Mb, in arrays of every length up to 100, so that all of the tail-handling code gets tested.)  Return true iff all results agree within a relative
+// tolerance that allows for the different order of the additions.
+static bool
+KernelsAgreeWithScalar( const LinkKernelSet & kernels )
+{
+  static const double TOLERANCE = 1e-12;
+
+  vector<int32_t> x( 100 );
+  uint32_t seed = 12345;
+  for ( size_t i = 0; i < x.size(); i++ ) {
+    seed = seed * 1103515245 + 12345; // a simple LCG, so the test is the same on every run
+    x[i] = 1 + ( seed >> 8 ) % 10000000;
+  }
+
+  for ( size_t N = 0; N <= x.size(); N++ ) {
+    const double recip_scalar = SumReciprocalsScalar( &x[0], N, 1000 );
+    const double recip = kernels.sum_reciprocals( &x[0], N, 1000 );
+    if ( fabs( recip - recip_scalar ) > TOLERANCE * fabs( recip_scalar ) ) return false;
+
+    const double logs_scalar = SumLogsScalar( &x[0], N );
+    const double logs = kernels.sum_logs( &x[0], N );
+    if ( fabs( logs - logs_scalar ) > TOLERANCE * fabs( logs_scalar ) ) return false;
+  }
+
+  return true;
+}
+
+
+// ChooseKernels: Pick the fastest set of kernels that this processor supports and that passes the equivalence check, unless LACHESIS_LINK_KERNELS=scalar.
+static LinkKernelSet
+ChooseKernels()
+{
+  const LinkKernelSet scalar = { "scalar", SumReciprocalsScalar, SumLogsScalar };
+
+  const char * forced = getenv( "LACHESIS_LINK_KERNELS" );
+  if ( forced != NULL && *forced != '\0' ) {
+    if ( strcmp( forced, "scalar" ) == 0 ) return scalar;
+    cerr << "ERROR: LinkKernels: LACHESIS_LINK_KERNELS = '" << forced << "'; the only value it can have is 'scalar'." << endl;
+    exit(1);
+  }
+
+#ifdef LINK_KERNELS_X86
+  vector<LinkKernelSet> candidates;
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports( "avx512f" ) ) {
+    const LinkKernelSet avx512 = { "AVX-512", SumReciprocalsAVX512, SumLogsAVX512 };
+    candidates.push_back( avx512 );
+  }
+  if ( __builtin_cpu_supports( "avx2" ) ) {
+    const LinkKernelSet avx2 = { "AVX2", SumReciprocalsAVX2, SumLogsAVX2 };
+    candidates.push_back( avx2 );
+  }
+
+  for ( size_t i = 0; i < candidates.size(); i++ ) {
+    if ( KernelsAgreeWithScalar( candidates[i] ) ) return candidates[i];
+    cerr << "WARNING: LinkKernels: the " << candidates[i].ISA << " kernels disagree with the scalar kernels; not using them." << endl;
+  }
+#endif
+
+  return scalar;
+}
+
+
+// Kernels: Return the kernels to use.  They are chosen on the first call (which is thread-safe in C++11).
+static const LinkKernelSet &
+Kernels()
+{
+  static const LinkKernelSet kernels = ChooseKernels();
+  return kernels;
+}
+
+
+
+
+double
+SumReciprocals( const int32_t * x, const size_t N, const int64_t offset )
+{
+  return Kernels().sum_reciprocals( x, N, offset );
+}
+
+
+double
+SumLogs( const int32_t * x, const size_t N )
+{
+  return Kernels().sum_logs( x, N );
+}
+
+
+const char *
+LinkKernelsISA()
+{
+  return Kernels().ISA;
+}
+
+
+
+
+/* KERNELS ON CODED DISTANCES */
+
+// The number of codes decoded at a time.  The decoded block stays in L1 cache.
+static const size_t CODE_BLOCK = 1024;
+
+
+double
+SumReciprocals( const uint16_t * codes, const size_t N, const int64_t offset )
+{
+  int32_t x[CODE_BLOCK];
+  double sum = 0;
+  for ( size_t i = 0; i < N; i += CODE_BLOCK ) {
+    const size_t n = min( CODE_BLOCK, N - i );
+    for ( size_t j = 0; j < n; j++ )
+      x[j] = DecodeLinkDist( codes[i+j] );
+    sum += SumReciprocals( x, n, offset );
+  }
+  return sum;
+}
+
+
+double
+SumLogs( const uint16_t * codes, const size_t N )
+{
+  int32_t x[CODE_BLOCK];
+  double sum = 0;
+  for ( size_t i = 0; i < N; i += CODE_BLOCK ) {
+    const size_t n = min( CODE_BLOCK, N - i );
+    for ( size_t j = 0; j < n; j++ )
+      x[j] = DecodeLinkDist( codes[i+j] );
+    sum += SumLogs( x, n );
+  }
+  return sum;
+}
@@ -0,0 +1,91 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+
+/**************************************************************************************************************************************************************
+ *
+ * LinkKernels.h
+ *
+ * Vectorized kernels for the reductions over Hi-C link distances that dominate the run time of contig ordering: the sum of 1/x (in
+ * ChromLinkMatrix::OrderingScore) and the sum of ln(x) (in ChromLinkMatrix::ContigOrientLogLikelihood).
+ *
+ * The kernels are chosen at run time, on the first call, according to what the processor supports: AVX-512, AVX2, or plain scalar code.  The vector
+ * kernels add the terms in a different order from the scalar loops, so their results may differ in the last few bits; before a vector kernel is used, it
+ * is checked against the scalar code on a test input, and if it disagrees by more than a small relative tolerance, the scalar code is used instead.
+ * Setting the environment variable LACHESIS_LINK_KERNELS=scalar forces the scalar code, whose results don't depend on the processor.  PerfRegression.pl
+ * does this, so that its output checksums are the same on every machine.
+ *
+ * This module also defines the 16-bit link distance codes used by compact ChromLinkMatrices (see EncodeLinkDist, below), and kernels that work on them.
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+#ifndef _LINK_KERNELS__H
+#define _LINK_KERNELS__H
+
+#include <inttypes.h> // uint16_t, int32_t, int64_t
+#include <stddef.h> // size_t
+
+
+
+// SumReciprocals: Return the sum of 1 / ( x[i] + offset ) for i in [0,N).
+double SumReciprocals( const int32_t * x, const size_t N, const int64_t offset );
+
+// SumLogs: Return the sum of ln( x[i] ) for i in [0,N).
+double SumLogs( const int32_t * x, const size_t N );
+
+// LinkKernelsISA: Return the name of the instruction set used by the kernels ("AVX-512", "AVX2", or "scalar").
+const char * LinkKernelsISA();
+
+
+
+/* COMPACT LINK DISTANCES
+ *
+ * A compact ChromLinkMatrix stores each link distance in 16 bits instead of 32.  The code is a small floating-point format: distances below 4,096 are
+ * stored exactly, and larger distances keep only their 12 most significant bits.  Each code decodes to the middle of the range of distances that share it,
+ * so a distance d comes back within d/4096 of where it was: a relative error of at most 0.025%, which is about 1/180 of the width of a
+ * LinkSizeDistribution bin (a factor of 2^(1/16), or 4.4%).  Every distance in [0,2^31) has a code; negative distances are coded as 0.
+ *
+ * The top 5 bits of a code are an exponent e and the low 11 bits are a mantissa m.  If e = 0, the distance is m.  Otherwise it's ( 2048 + m ) * 2^(e-1),
+ * plus half of 2^(e-1) to put it in the middle of its range.
+ */
+
+// EncodeLinkDist: Return the code for this distance.  EncodeLinkDist( DecodeLinkDist(code) ) == code.
+inline uint16_t
+EncodeLinkDist( const int32_t dist )
+{
+  if ( dist < 2048 ) return dist < 0 ? 0 : dist;
+  const int e = 21 - __builtin_clz( dist ); // dist is in [ 2^(e+10), 2^(e+11) )
+  return ( e << 11 ) | ( ( dist >> ( e-1 ) ) & 2047 );
+}
+
+// DecodeLinkDist: Return the distance that this code stands for.
+inline int32_t
+DecodeLinkDist( const uint16_t code )
+{
+  const int e = code >> 11, m = code & 2047;
+  if ( e == 0 ) return m;
+  return ( ( 2048 + m ) << ( e-1 ) ) + ( ( 1 << ( e-1 ) ) >> 1 );
+}
+
+// SumReciprocals, SumLogs: The same as above, but for distances given as codes.  The codes are decoded a block at a time and passed to the kernels above.
+double SumReciprocals( const uint16_t * codes, const size_t N, const int64_t offset );
+double SumLogs( const uint16_t * codes, const size_t N );
+
+
+#endif
@@ -17,6 +17,9 @@
 // For documentation, see LinkSizeDistribution.h
 #include "LinkSizeDistribution.h"
 #include "TextFileParsers.h" // TokenizeFile
+#include "SAMIngest.h"
+#include "HiCLinks.h"
+#include "Parallel.h" // NThreadsToUse, ParallelForRanges
 
 
 #include <assert.h>
@@ -24,10 +27,11 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <iomanip> // setprecision
 #include <numeric> // accumulate
-#include <algorithm> // max_element
+#include <algorithm> // max_element, sort, lower_bound, upper_bound, max
 
 // Modules in ~/include (must add -L~/include and -lJ<module> to link)
 #include "TimeMem.h"
@@ -37,6 +41,7 @@
 // Boost libraries
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/join.hpp>
 
 
 
@@ -50,6 +55,9 @@ static const double _SIXTEENTH_ROOT_OF_2 = sqrt( sqrt( sqrt( sqrt( 2 ) ) ) ); //
 // that it converts the link density numbers into a hopefully more intuitive order of magnitude.
 static const double _BIN_NORM = 1e6;
 
+// Count the calls to log_likelihood_D(), in both LinkSizeDistribution and GapLikelihood.  See StageTimer in TimeMem.h.
+static CallCounter log_likelihood_D_calls( "log_likelihood_D" );
+
 
 
 // Calculate the integer log2 of any number (e.g., uint_log2(2) = 1, uint_log2(5) = 2, uint_log2(15) = 3).  Note that uint_log2(0) = 0.
@@ -93,6 +101,67 @@ uint_16log2_frac( const double x ) {
 
 
 
+// The bin lookup tables used by LinkBinOf().  Every distance in [2^p,2^(p+1)) has the same 16 bins in its octave, and the bin within the octave depends only
+// on the distance's mantissa: m = dist << (30-p), a 30-bit fixed-point number in [2^30,2^31) representing dist/2^p in [1,2).  Bin #k of the octave starts at the
+// mantissa threshold[k].  The thresholds are found once, by a binary search over uint_16log2_frac() - the function that originally defined the bins - so the
+// bins come out exactly the same as they always have, rounding errors included.  Then, first_bin[c] is the bin containing the start of the cell
+// [2^30 + c*2^22, 2^30 + (c+1)*2^22) of mantissas with leading bits c.  The cells are narrower than the bins, so a cell contains at most one threshold, and
+// one comparison finishes the lookup.
+static const int LINK_BIN_CELL_BITS = 8;
+
+struct LinkBinTables
+{
+  uint32_t threshold[17]; // threshold[16] = 2^31 is a sentinel
+  uint8_t first_bin[ 1 << LINK_BIN_CELL_BITS ];
+
+  LinkBinTables()
+  {
+    const uint32_t ONE = 1u << 30;
+    threshold[0] = ONE;
+    for ( int k = 1; k < 16; k++ ) {
+      uint32_t lo = threshold[k-1], hi = 2 * ONE - 1; // uint_16log2_frac( hi / 2^30 ) >= k
+      while ( lo < hi ) {
+	const uint32_t mid = lo + ( hi - lo ) / 2;
+	if ( (int) uint_16log2_frac( double(mid) / ONE ) >= k ) hi = mid;
+	else lo = mid + 1;
+      }
+      threshold[k] = lo;
+    }
+    threshold[16] = 2 * ONE;
+
+    const int shift = 30 - LINK_BIN_CELL_BITS;
+    for ( uint32_t c = 0; c < ( 1u << LINK_BIN_CELL_BITS ); c++ ) {
+      const uint32_t cell_start = ONE + ( c << shift ), cell_end = cell_start + ( 1u << shift );
+      int k = 0;
+      while ( threshold[k+1] <= cell_start ) k++;
+      assert( k == 15 || threshold[k+2] >= cell_end ); // no more than one threshold in the cell
+      first_bin[c] = k;
+    }
+  }
+};
+
+static const LinkBinTables link_bin_tables;
+
+
+
+// LinkBinOf: The implementation of LinkSizeDistribution::LinkBin().  Instead of calculating log2(dist), find the octave of dist from its leading bit, and
+// the bin within the octave from its mantissa, with a table lookup and a comparison (see LinkBinTables).  There are no branches, so loops over this can be
+// vectorized.  It gives exactly the same result as the original method:
+//   16 * uint_log2( dist / _MIN_LINK_DIST ) + uint_16log2_frac( double(dist) / ( _MIN_LINK_DIST << uint_log2( dist / _MIN_LINK_DIST ) ) )
+// because the division by a power of 2 is exact.
+static inline int
+LinkBinOf( const int dist )
+{
+  const uint32_t d = dist < 0 ? 0 : dist;
+  const int p = 31 - __builtin_clz( d | 1 ); // position of the leading bit
+  const uint32_t m = d << ( 30 - p );
+  const int k = link_bin_tables.first_bin[ ( m >> ( 30 - LINK_BIN_CELL_BITS ) ) & ( ( 1 << LINK_BIN_CELL_BITS ) - 1 ) ];
+  const int bin = 16 * ( p - 12 ) + k + ( m >= link_bin_tables.threshold[k+1] );
+  return dist < LinkSizeDistribution::_MIN_LINK_DIST ? -1 : bin;
+}
+
+
+
 
 
 
@@ -104,19 +173,143 @@ uint_16log2_frac( const double x ) {
 // 4. Read through the SAM file(s) and find the number of links in each bin.
 // 5. Normalize to calculate the link density for each intra-contig bin.
 // 6. Assume the distribution approximates 1/x for large x, and extrapolate to bins beyond the intra-contig link length.
-LinkSizeDistribution::LinkSizeDistribution( const vector<string> & SAM_files )
-  : _SAM_files( SAM_files )
+// Steps 1-3 are in MakeBins(), and steps 5-6 are in CalculateLinkDensity().
+LinkSizeDistribution::LinkSizeDistribution( const vector<string> & SAM_files, const int N_threads, const double subsample_fraction )
+  : _SAM_files( SAM_files ),
+    _SAM_files_stamp( HiCLinkFile::SAMFilesStamp( SAM_files, subsample_fraction ) )
 {
   cout << "LinkSizeDistribution!" << endl;
 
-  bool verbose = true;
-
   // Check that the input files all exist.
   assert( !SAM_files.empty() );
   for ( size_t i = 0; i < SAM_files.size(); i++ )
     assert( boost::filesystem::is_regular_file( SAM_files[i] ) );
 
+  // 1-3. Make the bins.
+  vector<int> contig_lens = TargetLengths( SAM_files[0] );
+  int N_contigs = contig_lens.size();
+  vector<int64_t> bin_norms;
+  const int N_intra_contig_bins = MakeBins( contig_lens, bin_norms );
+
+
+  // 4. Read through the SAM files(s) and find the number of links in each bin.
+
+  // This vector will contain the tally of intra-contig Hi-C link sizes per bin.
+  vector<int> N_links( N_intra_contig_bins, 0 );
+
+  // Tally to keep track of how many read pairs pass the filters.
+  vector<int> passes( 4, 0 );
+
+  // Read the SAM files in parallel (see SAMIngest.h).  Each file gets its own tallies, which are added into the totals in file order.
+  vector< vector<int> > file_N_links( SAM_files.size() ), file_passes( SAM_files.size() );
+
+  ForEachSAMFile( SAM_files, N_threads,
+		  [&]( const size_t i, ostream & log ) { ReadLinksFromSAM( SAM_files[i], subsample_fraction, N_contigs, N_intra_contig_bins, file_N_links[i], file_passes[i], log ); },
+		  [&]( const size_t i ) {
+		    for ( int j = 0; j < N_intra_contig_bins; j++ ) N_links[j] += file_N_links[i][j];
+		    for ( int j = 0; j < 4; j++ ) passes[j] += file_passes[i][j];
+		  } );
+
+
+  // 5-6. Find the link densities.
+  CalculateLinkDensity( N_intra_contig_bins, bin_norms, N_links, passes );
+}
+
+
+
+
+// Constructor for LinkSizeDistribution.  Derives the distribution from a HiCLinkFile instead of from the SAM files.  The method, and the result, are exactly
+// the same as in the constructor above.
+LinkSizeDistribution::LinkSizeDistribution( const HiCLinkFile & link_file, const int N_threads )
+  : _SAM_files( link_file.SAM_files() ),
+    _SAM_files_stamp( HiCLinkFile::SAMFilesStamp( link_file.SAM_files(), link_file.subsample_fraction() ) )
+{
+  cout << "LinkSizeDistribution!" << endl;
+
+  // 1-3. Make the bins.
+  vector<int> contig_lens = TargetLengths( _SAM_files[0] );
+  int N_contigs = contig_lens.size();
+  vector<int64_t> bin_norms;
+  const int N_intra_contig_bins = MakeBins( contig_lens, bin_norms );
+
+
+  // 4. Step through the link file and find the number of links in each bin.
+  // The records from all the SAM files lie end to end in the link file, so split them into one block per thread, tally each block separately, and add the
+  // tallies together.  They're just counts, so the totals don't depend on the blocking.  A broken pair is two consecutive records, so don't start a block
+  // in the middle of a run of broken records.
+  cout << "Reading Hi-C data from link file " << link_file.file() << endl;
+
+  const HiCLink * begin = link_file.begin(0), * end = link_file.end( link_file.N_SAM_files() - 1 );
+  const int N_blocks = max( NThreadsToUse( N_threads ), 1 );
+  vector<const HiCLink *> block_starts( 1, begin );
+  for ( int b = 1; b < N_blocks; b++ ) {
+    const HiCLink * start = max( begin + ( end - begin ) * b / N_blocks, block_starts.back() );
+    while ( start != end && start->type == HIC_LINK_BROKEN ) start++;
+    block_starts.push_back( start );
+  }
+  block_starts.push_back( end );
+
+  vector< vector<int> > block_N_links( N_blocks, vector<int>( N_intra_contig_bins, 0 ) ), block_passes( N_blocks, vector<int>( 4, 0 ) );
+  ParallelForRanges( N_blocks, N_blocks, [&]( const int b, const size_t, const size_t ) {
+      TallyLinks( block_starts[b], block_starts[b+1], N_contigs, N_intra_contig_bins, block_N_links[b], block_passes[b] );
+    } );
+
+  vector<int> N_links( N_intra_contig_bins, 0 );
+  vector<int> passes( 4, 0 );
+  for ( int b = 0; b < N_blocks; b++ ) {
+    for ( int j = 0; j < N_intra_contig_bins; j++ ) N_links[j] += block_N_links[b][j];
+    for ( int j = 0; j < 4; j++ ) passes[j] += block_passes[b][j];
+  }
+
 
+  // 5-6. Find the link densities.
+  CalculateLinkDensity( N_intra_contig_bins, bin_norms, N_links, passes );
+}
+
+
+
+
+// TallyLinks: Helper function for the HiCLinkFile constructor.  Tally the pairs in the link file records [begin,end) into N_links and passes, as in
+// ReadLinksFromSAM().  The range must not split up a broken pair.  This function doesn't modify this LinkSizeDistribution, so it can run in a worker thread.
+void
+LinkSizeDistribution::TallyLinks( const HiCLink * begin, const HiCLink * end, const int N_contigs, const int N_intra_contig_bins, vector<int> & N_links,
+				  vector<int> & passes ) const
+{
+  for ( const HiCLink * link = begin; link != end; ++link ) {
+
+    // Unpaired reads aren't used here; see SAMStepper::next_pair().
+    if ( link->type == HIC_LINK_SINGLE ) continue;
+
+    passes[0]++;
+
+    // A pair whose two records disagree is stored as two consecutive records.  If both reads have MQ > 0, this pair fails the sanity checks in
+    // ReadLinksFromSAM().
+    if ( link->type == HIC_LINK_BROKEN ) {
+      const HiCLink * link2 = ++link;
+      assert( link2 != end && link2->type == HIC_LINK_BROKEN );
+      assert( link[-1].qual == 0 || link2->qual == 0 );
+      continue;
+    }
+
+    // Ignore reads with mapping quality 0.
+    if ( link->qual == 0 || link->mqual == 0 ) continue;
+    passes[1]++;
+
+    assert( link->tid  < N_contigs );
+    assert( link->mtid < N_contigs );
+
+    TallyLink( link->tid, link->pos, link->mtid, link->mpos, N_intra_contig_bins, N_links, passes );
+  }
+}
+
+
+
+
+// MakeBins: Helper function for the constructors.  Steps 1-3 of the method: make the bins of link lengths, determine the range of intra-contig links (given
+// the contig lengths), and find the length of assayable intra-contig sequence in each bin (bin_norms).  Return the number of intra-contig bins.
+int
+LinkSizeDistribution::MakeBins( const vector<int> & contig_lens, vector<int64_t> & bin_norms )
+{
   // 1. Make geometrically sized bins of link lengths in the range [MIN_LINK_DIST, MAX_LINK_DIST].
 
   // Make a set of bins that spans the possible range of intra-contig links.  We want the bins to be numerous, but also geometrically sized.
@@ -144,7 +337,6 @@ LinkSizeDistribution::LinkSizeDistribution( const vector<string> & SAM_files )
 
   // 2. Determine the range of intra-contig links that we are capable of looking for.
   // The length of the longest contig in the assembly sets an upper bound on this length.
-  vector<int> contig_lens = TargetLengths( SAM_files[0] );
   int N_contigs = contig_lens.size();
 
   _max_intra_contig_link_dist = *( max_element( contig_lens.begin(), contig_lens.end() ) );
@@ -165,7 +357,7 @@ LinkSizeDistribution::LinkSizeDistribution( const vector<string> & SAM_files )
   // -- In reality, there must be room for aligning reads, which have nonzero length.  But we're dealing only with links much longer than a read.
   // -- When aligning to scaffolds rather than contigs, some regions can't be assayed for links because they have gaps.  This is a more serious problem and
   //    I'm not sure how it might perturb the results that we fail to account for gaps.
-  vector<int64_t> bin_norms( N_intra_contig_bins, 0 );
+  bin_norms.assign( N_intra_contig_bins, 0 );
   for ( int i = 0; i < N_contigs; i++ ) {
 
     // For each link bin, calculate the distance on this contig over which links in this bin can be found.
@@ -177,69 +369,18 @@ LinkSizeDistribution::LinkSizeDistribution( const vector<string> & SAM_files )
     }
   }
 
+  return N_intra_contig_bins;
+}
 
-  // 4. Read through the SAM files(s) and find the number of links in each bin.
-
-  // This vector will contain the tally of intra-contig Hi-C link sizes per bin.
-  vector<int> N_links( N_intra_contig_bins, 0 );
-
-  // Tally to keep track of how many read pairs pass the filters.
-  vector<int> passes( 4, 0 );
-
-  // Loop over the input SAM files.
-  for ( size_t i = 0; i < SAM_files.size(); i++ ) {
-
-    cout << "Reading Hi-C data from SAM file " << SAM_files[i] << (verbose ? "\t(dot = 1M alignments)" : "" ) << endl;
-
-
-    // Set up a SAMStepper object to read in the alignments.
-    SAMStepper stepper( SAM_files[i] );
-    stepper.FilterAlignedPairs(); // Only look at read pairs where both reads aligned to the assembly.
-
-    // Loop over all pairs of alignments in the SAM file.
-    // Note that the next_pair() function assumes that all reads in a SAM file are paired, and the two reads in a pair occur in consecutive order.
-    //for ( bam1_t * align = stepper.next_read(); align != NULL; align = stepper.next_read() ) {
-    for ( pair< bam1_t *, bam1_t *> aligns = stepper.next_pair(); aligns.first != NULL; aligns = stepper.next_pair() ) {
-
-      if ( verbose && stepper.N_aligns_read() % 1000000 == 0 ) cout << "." << flush;
-
-      const bam1_core_t & c1 = aligns.first->core;
-      const bam1_core_t & c2 = aligns.second->core;
-
-      passes[0]++;
-
-      // Ignore reads with mapping quality 0.
-      if ( c1.qual == 0 || c2.qual == 0 ) continue;
-      passes[1]++;
-
-      // Sanity checks to make sure the read pairs appear as they should in the SAM file.
-      assert( c1.tid == c2.mtid );
-      assert( c2.tid == c1.mtid );
-      assert( c1.pos == c2.mpos );
-      assert( c2.pos == c1.mpos );
-      assert( c1.tid < N_contigs );
-      assert( c2.tid < N_contigs );
-
-      // Only allow intra-contig links.  Note that this is the opposite of the GenomeLinkMatrix and ChromLinkMatrix, in which we only allow intER-contig links.
-      if ( c1.tid != c2.tid ) continue;
-      passes[2]++;
-
-      // Find the distance implied by this link.
-      int dist = abs( c2.pos - c1.pos );
-      if ( dist < _MIN_LINK_DIST ) continue; // note that most links will fail this filter unless _MIN_LINK_DIST is set unnecessarily small
-      passes[3]++;
 
-      // Convert the distance into a bin.
-      int bin = LinkBin( dist );
-      //PRINT4( dist, _max_intra_contig_link_dist, bin, N_intra_contig_bins );
-      assert( bin != -1 );
-      assert( bin < N_intra_contig_bins );
-      N_links[bin]++;
-    }
 
-    if ( verbose ) cout << endl;
-  }
 
+// CalculateLinkDensity: Helper function for the constructors.  Report the numbers of read pairs passing each filter (passes), then do steps 5-6 of the
+// method, using the tally of intra-contig links in each bin (N_links) and the assayable sequence in each bin (bin_norms).  This fills _link_density.
+void
+LinkSizeDistribution::CalculateLinkDensity( const int N_intra_contig_bins, const vector<int64_t> & bin_norms, const vector<int> & N_links,
+					    const vector<int> & passes )
+{
   // Report the results of the pass filtering.
   cout << "Done reading SAM files!  Pass filters:" << endl;
   cout << "\ttotal number of read pairs:\t" << passes[0] << endl;
@@ -305,12 +446,90 @@ LinkSizeDistribution::LinkSizeDistribution( const vector<string> & SAM_files )
 
 
 
+// ReadLinksFromSAM: Helper function for the constructor.  Read one SAM/BAM file and tally its intra-contig Hi-C links (N_links) and the number of read pairs
+// passing each filter (passes), using only the subsample of read pairs given by subsample_fraction, writing progress output to log.  This function doesn't modify this LinkSizeDistribution, so it can run in a worker thread.
+void
+LinkSizeDistribution::ReadLinksFromSAM( const string & SAM_file, const double subsample_fraction, const int N_contigs, const int N_intra_contig_bins,
+					vector<int> & N_links, vector<int> & passes, ostream & log ) const
+{
+  bool verbose = true;
+  N_links.assign( N_intra_contig_bins, 0 );
+  passes.assign( 4, 0 );
+
+  log << "Reading Hi-C data from SAM file " << SAM_file << (verbose ? "\t(dot = 1M alignments)" : "" ) << endl;
+
+
+  // Set up a SAMStepper object to read in the alignments.
+  SAMStepper stepper( SAM_file );
+  stepper.FilterAlignedPairs(); // Only look at read pairs where both reads aligned to the assembly.
+  stepper.FilterSubsample( subsample_fraction );
+
+  // Loop over all pairs of alignments in the SAM file.
+  // Note that the next_pair() function assumes that all reads in a SAM file are paired, and the two reads in a pair occur in consecutive order.
+  //for ( bam1_t * align = stepper.next_read(); align != NULL; align = stepper.next_read() ) {
+  for ( pair< bam1_t *, bam1_t *> aligns = stepper.next_pair(); aligns.first != NULL; aligns = stepper.next_pair() ) {
+
+    if ( verbose && stepper.N_aligns_read() % 1000000 == 0 ) log << "." << flush;
+
+    const bam1_core_t & c1 = aligns.first->core;
+    const bam1_core_t & c2 = aligns.second->core;
+
+    passes[0]++;
+
+    // Ignore reads with mapping quality 0.
+    if ( c1.qual == 0 || c2.qual == 0 ) continue;
+    passes[1]++;
+
+    // Sanity checks to make sure the read pairs appear as they should in the SAM file.
+    assert( c1.tid == c2.mtid );
+    assert( c2.tid == c1.mtid );
+    assert( c1.pos == c2.mpos );
+    assert( c2.pos == c1.mpos );
+    assert( c1.tid < N_contigs );
+    assert( c2.tid < N_contigs );
+
+    TallyLink( c1.tid, c1.pos, c2.tid, c2.pos, N_intra_contig_bins, N_links, passes );
+  }
+
+  if ( verbose ) log << endl;
+}
+
+
+
+
+// TallyLink: Helper function for the constructors.  Tally a read pair that has passed the mapping-quality filter (i.e., passes[1]): if it's an intra-contig
+// link of usable length, add it to N_links.
+void
+LinkSizeDistribution::TallyLink( const int tid1, const int pos1, const int tid2, const int pos2, const int N_intra_contig_bins, vector<int> & N_links,
+				 vector<int> & passes ) const
+{
+  // Only allow intra-contig links.  Note that this is the opposite of the GenomeLinkMatrix and ChromLinkMatrix, in which we only allow intER-contig links.
+  if ( tid1 != tid2 ) return;
+  passes[2]++;
+
+  // Find the distance implied by this link.
+  int dist = abs( pos2 - pos1 );
+  if ( dist < _MIN_LINK_DIST ) return; // note that most links will fail this filter unless _MIN_LINK_DIST is set unnecessarily small
+  passes[3]++;
+
+  // Convert the distance into a bin.
+  int bin = LinkBin( dist );
+  //PRINT4( dist, _max_intra_contig_link_dist, bin, N_intra_contig_bins );
+  assert( bin != -1 );
+  assert( bin < N_intra_contig_bins );
+  N_links[bin]++;
+}
+
+
+
+
 // ReadFile: Read a LinkSizeDistribution file that was created with the WriteFile() function, below.
 void
 LinkSizeDistribution::ReadFile( const string & infile )
 {
   // Set dummy values for local variables.  These MUST be overwritten by the input file.
   _SAM_files.clear();
+  _SAM_files_stamp = "";
   _N_bins = -1;
   _max_intra_contig_link_dist = -1;
 
@@ -342,6 +561,10 @@ LinkSizeDistribution::ReadFile( const string & infile )
 	for ( size_t j = 8; j < tokens.size(); j++ )
 	  _SAM_files.push_back( tokens[j] );
 
+      // Line: "# SAM_file_stamp <size> <mtime> <file>" (one line of HiCLinkFile::SAMFilesStamp)
+      else if ( tokens.size() > 2 && tokens[1] == "SAM_file_stamp" )
+	_SAM_files_stamp += boost::join( vector<string>( tokens.begin() + 2, tokens.end() ), "\t" ) + '\n';
+
       continue;
     }
 
@@ -390,6 +613,9 @@ LinkSizeDistribution::WriteFile( const string & outfile ) const
   for ( size_t i = 0; i < _SAM_files.size(); i++ )
     out << " " << _SAM_files[i];
   out << endl;
+  istringstream stamp( _SAM_files_stamp );
+  for ( string line; getline( stamp, line ); )
+    out << "# SAM_file_stamp " << line << endl;
   out << "#\n";
   out << "#bin_start\tlink_density" << endl;
 
@@ -407,6 +633,20 @@ LinkSizeDistribution::WriteFile( const string & outfile ) const
 
 
 
+// IsUpToDate: Return true iff LSD_file is a LinkSizeDistribution file that was made from exactly this list of SAM/BAM files, with this subsample fraction,
+// and none of them have changed since (see HiCLinkFile::SAMFilesStamp).  Files written before the stamp was added to the format are never up to date.
+bool
+LinkSizeDistribution::IsUpToDate( const string & LSD_file, const vector<string> & SAM_files, const double subsample_fraction )
+{
+  if ( !boost::filesystem::is_regular_file( LSD_file ) ) return false;
+
+  const LinkSizeDistribution lsd( LSD_file );
+  return lsd._SAM_files == SAM_files && lsd._SAM_files_stamp == HiCLinkFile::SAMFilesStamp( SAM_files, subsample_fraction );
+}
+
+
+
+
 // DrawDotplot: Use QuickDotplot to make a dotplot of this LinkSizeDistribution at out/LinkSizeDistribution.jpg.
 // If rescale = true, multiply each bin's link density by the bin size.  This makes a graph that looks roughly flat (y = C) instead of decreasing (y = C/x).
 void
@@ -528,6 +768,11 @@ LinkSizeDistribution::FindDistanceBetweenLinks( const int L1_0, const int L2_0,
   int best_D = -1;
   double best_log_likelihood = -INT_MAX;
 
+  // Each value of D is only tried once here, so there's no point in caching the expected links.  See GapLikelihood in LinkSizeDistribution.h.
+  GapLikelihood gap_likelihood( *this );
+  vector<int> sorted_links( links );
+  sort( sorted_links.begin(), sorted_links.end() );
+
 
 
 
@@ -541,7 +786,7 @@ LinkSizeDistribution::FindDistanceBetweenLinks( const int L1_0, const int L2_0,
   int D_Q2  = ( D_min + D_max ) / 2;
   //double LL_D_min = log_likelihood_D( D_min, L1, L2, LDE, links, log_factorial );
   //double LL_D_max = log_likelihood_D( D_max, L1, L2, LDE, links, log_factorial );
-  double LL_D_Q2  = log_likelihood_D( D_Q2,  L1, L2, LDE, links, log_factorial );
+  double LL_D_Q2  = gap_likelihood.log_likelihood_D( D_Q2,  L1, L2, LDE, sorted_links, log_factorial, false );
   //PRINT6( D_min, LL_D_min, D_max, LL_d_max, D_Q2, LL_D_Q2 );
 
 
@@ -560,8 +805,8 @@ LinkSizeDistribution::FindDistanceBetweenLinks( const int L1_0, const int L2_0,
       // Take 11 samples, using a step from -5 to +5.
       int step = bin_size / 11;
       for ( int i = -5; i <= 5; i++ ) {
-	LL_D_Q1 += log_likelihood_D( D_Q1 + i*step, L1, L2, LDE, links, log_factorial );
-	LL_D_Q3 += log_likelihood_D( D_Q3 + i*step, L1, L2, LDE, links, log_factorial );
+	LL_D_Q1 += gap_likelihood.log_likelihood_D( D_Q1 + i*step, L1, L2, LDE, sorted_links, log_factorial, false );
+	LL_D_Q3 += gap_likelihood.log_likelihood_D( D_Q3 + i*step, L1, L2, LDE, sorted_links, log_factorial, false );
 	//PRINT6( i, step, D_Q1, D_Q1+i*step, D_Q3, D_Q3+i*step );
       }
       LL_D_Q1 /= 11;
@@ -569,8 +814,8 @@ LinkSizeDistribution::FindDistanceBetweenLinks( const int L1_0, const int L2_0,
 
     }
     else {
-      LL_D_Q1 = log_likelihood_D( D_Q1, L1, L2, LDE, links, log_factorial );
-      LL_D_Q3 = log_likelihood_D( D_Q3, L1, L2, LDE, links, log_factorial );
+      LL_D_Q1 = gap_likelihood.log_likelihood_D( D_Q1, L1, L2, LDE, sorted_links, log_factorial, false );
+      LL_D_Q3 = gap_likelihood.log_likelihood_D( D_Q3, L1, L2, LDE, sorted_links, log_factorial, false );
       //PRINT4( LL_D_Q1, LL_D_Q3 );
     }
 
@@ -610,7 +855,7 @@ LinkSizeDistribution::FindDistanceBetweenLinks( const int L1_0, const int L2_0,
 
     for ( int D = 0; D < MAX_D; D += D_step ) {
 
-      double log_likelihood = log_likelihood_D( D, L1, L2, LDE, links, log_factorial );
+      double log_likelihood = gap_likelihood.log_likelihood_D( D, L1, L2, LDE, sorted_links, log_factorial, false );
       cout << "STUFF:\t" << D << "\t" << log_likelihood << endl;
 
       // Record the value of D that gives the best log-likelihood.
@@ -651,40 +896,28 @@ LinkSizeDistribution::BinSize( const int bin_ID ) const
 
 // LinkBin: convert a link distance to a bin ID.
 // Bin #x has a range starting at L = _MIN_LINK_DIST * 2^(x/16).  Therefore, a link of distance L belongs in bin #x = int( 16 * log_2 ( L / _MIN_LINK_DIST ) ).
-// This function is called VERY frequently, so it's engineered to be super fast by using bit-shifting and avoiding any direct calls to the log function.
+// This function is called VERY frequently, so it's engineered to be super fast: see LinkBinOf(), above.
 // Also note that if dist >= _MAX_LINK_DIST, the return value will be a bin ID that's higher than _N_bins, and this is not checked for.
 int
 LinkSizeDistribution::LinkBin( const int dist ) const
 {
-  if ( dist < _MIN_LINK_DIST ) return -1;
-
-  // First, use bit shifting to find the integral part of log2(dist).  This narrows down the possible bin range to 16 bins.
-  unsigned int dist_over_min = dist / _MIN_LINK_DIST; // this division is faster when _MIN_LINK_DIST is a power of 2, because the computer can use bit-shifting
-  unsigned int log2_i = uint_log2(dist_over_min);
-  //PRINT3( dist, dist_over_min, log2_i );
-
-  // Now, find the fractional part of log2(dist), multiplied by 16.  This determines exactly which bin the link is in.
-  int log2_f = uint_16log2_frac( double(dist) / ( _MIN_LINK_DIST << log2_i) );
-  return 16 * log2_i + log2_f;
-
-  // OLD VERSION: use a four-step binary search to find exactly which of the 16 possible bins in its range this distance falls into.
-  // This sometimes produces slightly different results sometimes due to rounding errors.
-  int bin = 16 * log2_i;
-  if ( bin+8 < _N_bins && dist >= _bin_starts[bin+8] ) bin += 8;
-  if ( bin+4 < _N_bins && dist >= _bin_starts[bin+4] ) bin += 4;
-  if ( bin+2 < _N_bins && dist >= _bin_starts[bin+2] ) bin += 2;
-  if ( bin+1 < _N_bins && dist >= _bin_starts[bin+1] ) bin += 1;
-  //assert( dist >= _bin_starts[bin] );
-  //assert( dist <  _bin_starts[bin+1] );
-  //PRINT3( dist, bin, _bin_starts[bin] );
-  //assert( bin % 16 == log2_f ); // this fails occasionally because of rounding errors
-
-  return bin;
+  return LinkBinOf( dist );
+}
+
+
+
+// LinkBins: Fill bins[j] with LinkBin( dists[j] + D ), for j in [0,N).  The loop has no branches, so the compiler can vectorize it.
+void
+LinkSizeDistribution::LinkBins( const int * dists, const size_t N, const int D, int * bins ) const
+{
+  for ( size_t j = 0; j < N; j++ )
+    bins[j] = LinkBinOf( dists[j] + D );
 }
 
 
 
 
+
 // log_likelihood_D: A helper function for FindDistanceBetweenLinks.  Given two contigs of length L1 and L2, calculate the log-likelihood of the observed
 // links between them, supposing they're at a distance D from each other.
 //
@@ -695,6 +928,7 @@ LinkSizeDistribution::LinkBin( const int dist ) const
 double
 LinkSizeDistribution::log_likelihood_D( const int D, const int L1, const int L2, const double LDE, const vector<int> & links, const vector<double> & log_factorial ) const
 {
+  ++log_likelihood_D_calls;
 
   const bool verbose = false;
   const int print_winner = -1; // go with 64973 for the first pairing in fly group3
@@ -709,12 +943,12 @@ LinkSizeDistribution::log_likelihood_D( const int D, const int L1, const int L2,
 
 
   // 2. Find the actual number of links falling into each bin, by adding D to each of the lengths of the input links.
-  vector<int> N_observed_links( _N_bins, 0 );
-  for ( size_t j = 0; j < links.size(); j++ ) {
-    int bin = LinkBin( links[j] + D ); // if we hadn't limited D to MAX_D, this might return a bin ID greater than _N_bins, which would be bad
-    if ( bin == -1 ) continue; // link (with D) is too small to fit in any bin
-    N_observed_links[bin]++;
-  }
+  // If we hadn't limited D to MAX_D, LinkBins() might return a bin ID greater than _N_bins, which would be bad.
+  vector<int> N_observed_links( _N_bins, 0 ), bins( links.size() );
+  LinkBins( links.data(), links.size(), D, bins.data() );
+  for ( size_t j = 0; j < links.size(); j++ )
+    if ( bins[j] != -1 ) // -1 means the link (with D) is too small to fit in any bin
+      N_observed_links[ bins[j] ]++;
 
 
 
@@ -849,45 +1083,158 @@ LinkSizeDistribution::FindExpectedInterContigLinks( const int D, const int L1, c
     // If this bin doesn't include any lengths of links that could exist between C1 and C2, its expectation remains at 0.
     if ( bin_stop <= D || bin_start >= D+L1+L2 ) continue;
 
-    // Find the number of observable links of this length (i.e., a vertical slice of the above trapezoid.)
-    // We do this by determining where the bin falls with respect to the trapezoid's corners, then adding up its area piecemeal.
-    int64_t N_observable_links = 0;
-
-    // If the bin falls anywhere along the left slope of the trapezoid...
-    if ( bin_start < D+L1 ) {
-      int64_t left_slope_min = max( bin_start, D );
-      int64_t left_slope_max = min( bin_stop, D+L1 );
-      int64_t middle_x = ( left_slope_min + left_slope_max ) / 2;
-      int64_t middle_y = middle_x - D;
-      if ( verbose ) PRINT5( "LEFT", left_slope_min, left_slope_max, middle_x, middle_y );
-      N_observable_links += ( left_slope_max - left_slope_min ) * middle_y;
-    }
+    const int64_t N_observable_links = NObservableInterContigLinks( i, D, L1, L2, verbose );
+
+    // Calculate the expected number of links between C1 and C2 by multiplying the number of observable lengths by the density of links in this size range.
+    // Also adjust by the LDE (link density enrichment), to take into account fluctuations in link density across the genome.
+    result[i] = N_observable_links * _link_density[i] / _BIN_NORM * LDE;
+    if ( verbose ) PRINT5( i, bin_start, bin_stop, N_observable_links, result[i] );
 
-    // If the bin falls anywhere along the flat middle of the trapezoid...
-    if ( bin_stop >= D+L1 && bin_start < D+L2 ) {
-      int64_t flat_min = max( bin_start, D+L1 );
-      int64_t flat_max = min( bin_stop,  D+L2 );
-      if ( verbose ) PRINT3( "FLAT", flat_min, flat_max );
-      N_observable_links += ( flat_max - flat_min ) * L1;
+  }
+
+}
+
+
+
+
+// NObservableInterContigLinks: Helper function for FindExpectedInterContigLinks.  Find the number of possible links in bin #bin_ID between two contigs of
+// lengths L1,L2 at a distance D (i.e., a vertical slice of the trapezoid shown above.)
+int64_t
+LinkSizeDistribution::NObservableInterContigLinks( const int bin_ID, const int D, const int L1, const int L2, const bool verbose ) const
+{
+  const int bin_start = _bin_starts[bin_ID], bin_stop = _bin_starts[bin_ID+1];
+
+  // Find the number of observable links of this length (i.e., a vertical slice of the above trapezoid.)
+  // We do this by determining where the bin falls with respect to the trapezoid's corners, then adding up its area piecemeal.
+  int64_t N_observable_links = 0;
+
+  // If the bin falls anywhere along the left slope of the trapezoid...
+  if ( bin_start < D+L1 ) {
+    int64_t left_slope_min = max( bin_start, D );
+    int64_t left_slope_max = min( bin_stop, D+L1 );
+    int64_t middle_x = ( left_slope_min + left_slope_max ) / 2;
+    int64_t middle_y = middle_x - D;
+    if ( verbose ) PRINT5( "LEFT", left_slope_min, left_slope_max, middle_x, middle_y );
+    N_observable_links += ( left_slope_max - left_slope_min ) * middle_y;
+  }
+
+  // If the bin falls anywhere along the flat middle of the trapezoid...
+  if ( bin_stop >= D+L1 && bin_start < D+L2 ) {
+    int64_t flat_min = max( bin_start, D+L1 );
+    int64_t flat_max = min( bin_stop,  D+L2 );
+    if ( verbose ) PRINT3( "FLAT", flat_min, flat_max );
+    N_observable_links += ( flat_max - flat_min ) * L1;
+  }
+
+  // If the bin falls anywhere along the right slope of the trapezoid...
+  if ( bin_stop >= D+L2 ) {
+    int64_t right_slope_min = max( bin_start, D+L2 );
+    int64_t right_slope_max = min( bin_stop, D+L1+L2 );
+    int64_t middle_x = ( right_slope_min + right_slope_max ) / 2;
+    int64_t middle_y = D+L1+L2 - middle_x;
+    if ( verbose ) PRINT5( "RIGHT", right_slope_min, right_slope_max, middle_x, middle_y );
+    N_observable_links += ( right_slope_max - right_slope_min ) * middle_y;
+  }
+
+  assert( N_observable_links >= 0 ); // avoid overflow
+  return N_observable_links;
+}
+
+
+
+
+// GapLikelihood constructor.  Find the smallest link distance in each bin, by a binary search over the output of LinkBin() (which never decreases as the
+// distance increases).  The bins found this way may differ slightly from _bin_starts, because of rounding in LinkBin(); but these are the bins that
+// log_likelihood_D() actually uses.
+GapLikelihood::GapLikelihood( const LinkSizeDistribution & lsd )
+  : _lsd( lsd ), _N_cached_values( 0 )
+{
+  _bin_first_dist.resize( _lsd._N_bins + 1 );
+  for ( int bin = 0; bin <= _lsd._N_bins; bin++ ) {
+    int64_t lo = LinkSizeDistribution::_MIN_LINK_DIST, hi = INT_MAX;
+    assert( _lsd.LinkBin( hi ) >= bin );
+    while ( lo < hi ) {
+      const int64_t mid = ( lo + hi ) / 2;
+      if ( _lsd.LinkBin( mid ) >= bin ) hi = mid;
+      else lo = mid + 1;
     }
+    _bin_first_dist[bin] = lo;
+  }
+}
+
+
+
 
-    // If the bin falls anywhere along the right slope of the trapezoid...
-    if ( bin_stop >= D+L2 ) {
-      int64_t right_slope_min = max( bin_start, D+L2 );
-      int64_t right_slope_max = min( bin_stop, D+L1+L2 );
-      int64_t middle_x = ( right_slope_min + right_slope_max ) / 2;
-      int64_t middle_y = D+L1+L2 - middle_x;
-      if ( verbose ) PRINT5( "RIGHT", right_slope_min, right_slope_max, middle_x, middle_y );
-      N_observable_links += ( right_slope_max - right_slope_min ) * middle_y;
+// FindExpectedLinks: Find the expected number of links in each bin (without the factor of LDE) between contigs of lengths L1,L2 at a distance D.  This is
+// the same calculation as in LinkSizeDistribution::FindExpectedInterContigLinks(), but only over the bins that overlap the range [D,D+L1+L2).
+void
+GapLikelihood::FindExpectedLinks( const int D, const int L1, const int L2, ExpectedLinks & expected ) const
+{
+  const vector<int> & bin_starts = _lsd._bin_starts;
+  const int N_bins = _lsd._N_bins;
+
+  // Find the first bin with bin_stop > D, and the first bin after it with bin_start >= D+L1+L2.
+  const int first = max( 0, int( upper_bound( bin_starts.begin(), bin_starts.begin() + N_bins + 1, D ) - bin_starts.begin() ) - 1 );
+  const int stop = min( N_bins, int( lower_bound( bin_starts.begin(), bin_starts.begin() + N_bins + 1, D+L1+L2 ) - bin_starts.begin() ) );
+
+  expected.first_bin = first;
+  expected.N_expected.clear();
+  for ( int i = first; i < stop; i++ )
+    expected.N_expected.push_back( _lsd.NObservableInterContigLinks( i, D, L1, L2 ) * _lsd._link_density[i] / _BIN_NORM );
+}
+
+
+
+
+// log_likelihood_D: Same as LinkSizeDistribution::log_likelihood_D(), for sorted links.  The steps of the calculation are the same as there, and so is the
+// order of the arithmetic, so the result is exactly the same.
+double
+GapLikelihood::log_likelihood_D( const int D, const int L1, const int L2, const double LDE, const vector<int> & sorted_links,
+				 const vector<double> & log_factorial, const bool use_cache )
+{
+  ++log_likelihood_D_calls;
+
+  // 1. Find the expected number of links in each bin, either from the cache or by calculating them.
+  const ExpectedLinks * expected = &_scratch;
+  if ( use_cache ) {
+    const Key key = { L1, L2, D };
+    unordered_map< Key, ExpectedLinks, KeyHash >::const_iterator it = _cache.find( key );
+    if ( it == _cache.end() ) {
+      if ( _N_cached_values > _MAX_CACHED_VALUES ) {
+	_cache.clear();
+	_N_cached_values = 0;
+      }
+      ExpectedLinks & new_expected = _cache[key];
+      FindExpectedLinks( D, L1, L2, new_expected );
+      _N_cached_values += new_expected.N_expected.size();
+      expected = &new_expected;
     }
+    else expected = &it->second;
+  }
+  else FindExpectedLinks( D, L1, L2, _scratch );
 
-    assert( N_observable_links >= 0 ); // avoid overflow
 
-    // Calculate the expected number of links between C1 and C2 by multiplying the number of observable lengths by the density of links in this size range.
-    // Also adjust by the LDE (link density enrichment), to take into account fluctuations in link density across the genome.
-    result[i] = N_observable_links * _link_density[i] / _BIN_NORM * LDE;
-    if ( verbose ) PRINT5( i, bin_start, bin_stop, N_observable_links, result[i] );
+  // 2-3. Walk through the bins in order, counting the links (with D added) that fall into each one, and add up the log-likelihood over all bins with a
+  // nonzero expectation of links.  Bins outside this range all have an expectation of 0, so they're skipped, just as in log_likelihood_D().
+  const int first = expected->first_bin;
+  const int N = expected->N_expected.size();
+  size_t k = lower_bound( sorted_links.begin(), sorted_links.end(), _bin_first_dist[first] - D ) - sorted_links.begin();
 
+  double log_likelihood = 0;
+  for ( int j = 0; j < N; j++ ) {
+
+    // Count the links in this bin: those with _bin_first_dist[bin] <= link + D < _bin_first_dist[bin+1].
+    const int64_t bin_stop = _bin_first_dist[first+j+1] - D;
+    const size_t k_start = k;
+    while ( k < sorted_links.size() && sorted_links[k] < bin_stop ) k++;
+
+    const double m = expected->N_expected[j] * LDE;
+    const int n_observed = k - k_start;
+    if ( m == 0 ) continue;
+
+    log_likelihood += -m + n_observed * log(m) - log_factorial[n_observed];
   }
 
+  assert( log_likelihood <= 0 );
+  return log_likelihood;
 }
@@ -58,8 +58,13 @@
 
 
 
+#include "HiCLinks.h"
+
+#include <inttypes.h> // int64_t
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <iostream>
 #include <math.h> // sqrt
 using namespace std;
 
@@ -68,7 +73,12 @@ using namespace std;
 class LinkSizeDistribution
 {
  public:
-  LinkSizeDistribution( const vector<string> & SAM_files );
+  // Derive a LinkSizeDistribution from a set of SAM files, which are read in parallel with up to N_threads threads (0 = one per core; see SAMIngest.h).
+  // If subsample_fraction < 1, only that fraction of the read pairs is used (see SAMStepper::FilterSubsample).
+  LinkSizeDistribution( const vector<string> & SAM_files, const int N_threads = 1, const double subsample_fraction = 1 );
+  // Derive a LinkSizeDistribution from a HiCLinkFile, which was extracted from a set of SAM files.  This is equivalent to, but faster than, the above.
+  // The link file is split into blocks that are tallied in parallel, with up to N_threads threads (0 = one per core).
+  LinkSizeDistribution( const HiCLinkFile & link_file, const int N_threads = 1 );
   LinkSizeDistribution( const string & infile ) { ReadFile( infile ); }
 
 
@@ -77,6 +87,10 @@ class LinkSizeDistribution
   void ReadFile ( const string & infile );
   void WriteFile( const string & outfile ) const;
 
+  // IsUpToDate: Return true iff LSD_file is a file written by WriteFile() for a LinkSizeDistribution made from exactly these SAM files, with this subsample
+  // fraction, and none of them have changed since.  If so, the distribution can be read from the file instead of being made again.
+  static bool IsUpToDate( const string & LSD_file, const vector<string> & SAM_files, const double subsample_fraction = 1 );
+
   // DrawDotplot: Use QuickDotplot to make a dotplot of this LinkSizeDistribution at out/LinkSizeDistribution.jpg.
   void DrawDotplot( const bool rescale = false ) const;
 
@@ -113,9 +127,26 @@ class LinkSizeDistribution
   /* PRIVATE FUNCTIONS: used locally */
   int BinSize( const int bin_ID ) const; // size in bp of a bin
   int LinkBin( const int dist ) const; // convert a link distance to a bin ID
+  void LinkBins( const int * dists, const size_t N, const int D, int * bins ) const; // bins[j] = LinkBin( dists[j] + D ) for j in [0,N)
 
   void FindExpectedIntraContigLinks( const int L, vector<double> & result, const bool verbose = false ) const;
   void FindExpectedInterContigLinks( const int D, const int L1, const int L2, const double LDE, vector<double> & result, const bool verbose = false ) const;
+  // NObservableInterContigLinks: Helper for FindExpectedInterContigLinks.  The number of possible links in bin #bin_ID between contigs of lengths L1, L2 at
+  // a distance D (i.e., the area of a slice of the trapezoid shown in LinkSizeDistribution.cc).
+  int64_t NObservableInterContigLinks( const int bin_ID, const int D, const int L1, const int L2, const bool verbose = false ) const;
+
+  // Helpers for the constructors: steps 1-3 and 5-6 of building the distribution (see LinkSizeDistribution.cc), which don't depend on the input format.
+  int MakeBins( const vector<int> & contig_lens, vector<int64_t> & bin_norms );
+  void CalculateLinkDensity( const int N_intra_contig_bins, const vector<int64_t> & bin_norms, const vector<int> & N_links, const vector<int> & passes );
+  // TallyLink: Tally one read pair with MQ > 0 into N_links, if it's an intra-contig link of usable length.
+  void TallyLink( const int tid1, const int pos1, const int tid2, const int pos2, const int N_intra_contig_bins, vector<int> & N_links, vector<int> & passes ) const;
+  // TallyLinks: Tally the pairs in the link file records [begin,end) into N_links, without modifying this object, so it can run in a worker thread.
+  void TallyLinks( const HiCLink * begin, const HiCLink * end, const int N_contigs, const int N_intra_contig_bins, vector<int> & N_links,
+		   vector<int> & passes ) const;
+
+  // ReadLinksFromSAM: Helper for the constructor.  Tally the intra-contig links in one SAM file, without modifying this object, so it can run in a worker thread.
+  void ReadLinksFromSAM( const string & SAM_file, const double subsample_fraction, const int N_contigs, const int N_intra_contig_bins, vector<int> & N_links,
+			 vector<int> & passes, ostream & log ) const;
 
 
 
@@ -134,7 +165,59 @@ class LinkSizeDistribution
 
 
   vector<string> _SAM_files; // the SAM files used to create this distribution
+  string _SAM_files_stamp; // HiCLinkFile::SAMFilesStamp( _SAM_files ) as of when this distribution was made; checked by IsUpToDate()
+
+  friend class GapLikelihood;
+  friend void TestLinkBin( const LinkSizeDistribution & lsd ); // in TestLachesis.cc
+};
+
 
+
+
+/* GapLikelihood: A fast way to evaluate LinkSizeDistribution::log_likelihood_D() many times, as is done when searching for the best gap size between
+ * contigs (see LinkSizeDistribution::FindDistanceBetweenLinks() and ChromLinkMatrix::FindGapSize().)  The results are exactly the same as those of
+ * log_likelihood_D(), but they're found faster, in two ways:
+ * 1. The expected number of links in each bin depends only on (L1,L2,D), apart from a factor of LDE.  So the expected links are cached, keyed by (L1,L2,D),
+ *    and only the bins that can hold links (i.e., that overlap the range [D,D+L1+L2)) are calculated and stored.  The same (L1,L2,D) come up again and
+ *    again in the gap size searches as scaffolds grow during SpaceContigs().
+ * 2. The links are given sorted, and the distance at which each bin begins is precomputed, so the links can be counted into bins in a single merge-like
+ *    pass, without calling LinkBin() on each link.  Shifting D just shifts the bin boundaries along the sorted links.
+ */
+class GapLikelihood
+{
+ public:
+  GapLikelihood( const LinkSizeDistribution & lsd );
+
+  // log_likelihood_D: Same as lsd.log_likelihood_D( D, L1, L2, LDE, sorted_links, log_factorial ), except that sorted_links must be sorted.
+  // If use_cache = false, the expected links for (L1,L2,D) aren't stored for later calls; use this when the same (L1,L2,D) won't come up again.
+  double log_likelihood_D( const int D, const int L1, const int L2, const double LDE, const vector<int> & sorted_links, const vector<double> & log_factorial,
+			   const bool use_cache = true );
+
+ private:
+  // The expected number of links in bins [first_bin, first_bin + N_expected.size()), not including the factor of LDE.  All other bins expect 0 links.
+  struct ExpectedLinks {
+    int first_bin;
+    vector<double> N_expected;
+  };
+
+  struct Key {
+    int L1, L2, D;
+    bool operator==( const Key & k ) const { return L1 == k.L1 && L2 == k.L2 && D == k.D; }
+  };
+  struct KeyHash {
+    size_t operator()( const Key & k ) const { return ( size_t(k.L1) * 1000003 + size_t(k.L2) ) * 1000003 + size_t(k.D); }
+  };
+
+  void FindExpectedLinks( const int D, const int L1, const int L2, ExpectedLinks & expected ) const;
+
+  // HEUR: The maximum number of expected-link values to hold in the cache (~128 MB).  If the cache gets bigger than this, it's cleared.
+  static const size_t _MAX_CACHED_VALUES = 1 << 24;
+
+  const LinkSizeDistribution & _lsd;
+  vector<int64_t> _bin_first_dist; // the smallest link distance that LinkBin() puts in each bin, for bins 0 through _N_bins (inclusive)
+  unordered_map< Key, ExpectedLinks, KeyHash > _cache;
+  size_t _N_cached_values;
+  ExpectedLinks _scratch; // used when use_cache = false
 };
 
 
@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+// For documentation, see MappedFile.h
+#include "MappedFile.h"
+
+#include <assert.h>
+#include <string.h> // memcmp, strerror
+#include <errno.h>
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <string>
+#include <fstream>
+#include <iostream>
+
+
+
+// Constructor: Map the file read-only into memory.  If the file can't be opened or mapped, throw an error and exit.
+MappedFile::MappedFile( const string & file )
+  : _file( file ), _data( NULL ), _size( 0 )
+{
+  int fd = open( file.c_str(), O_RDONLY );
+  if ( fd == -1 ) {
+    cerr << "ERROR: MappedFile: can't open file " << file << ": " << strerror( errno ) << endl;
+    exit(1);
+  }
+
+  struct stat st;
+  if ( fstat( fd, &st ) != 0 ) {
+    cerr << "ERROR: MappedFile: can't stat file " << file << ": " << strerror( errno ) << endl;
+    exit(1);
+  }
+  _size = st.st_size;
+
+  // mmap() refuses to map 0 bytes, but an empty file is a legal (if useless) thing to map.
+  if ( _size > 0 ) {
+    void * addr = mmap( NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if ( addr == MAP_FAILED ) {
+      cerr << "ERROR: MappedFile: can't mmap file " << file << ": " << strerror( errno ) << endl;
+      exit(1);
+    }
+    _data = static_cast<const char *>( addr );
+
+    // The cache files are read front to back, so tell the kernel to read ahead aggressively.
+    madvise( addr, _size, MADV_SEQUENTIAL );
+  }
+
+  close( fd ); // the mapping stays valid after the file descriptor is closed
+}
+
+
+
+MappedFile::~MappedFile()
+{
+  if ( _data != NULL ) munmap( const_cast<char *>( _data ), _size );
+}
+
+
+
+
+// FileHasMagic: Return true iff the file exists and begins with the first magic_len bytes of magic.  Used to distinguish binary cache files from text ones.
+bool
+FileHasMagic( const string & file, const char * magic, const size_t magic_len )
+{
+  ifstream in( file.c_str(), ios::in | ios::binary );
+  if ( !in ) return false;
+
+  string head( magic_len, '\0' );
+  in.read( &head[0], magic_len );
+  if ( in.gcount() != (streamsize) magic_len ) return false;
+
+  return memcmp( head.data(), magic, magic_len ) == 0;
+}
+
+
+
+// WritePadding: Write 0's to the output stream until the number of bytes written (N_bytes) is a multiple of 8.
+void
+WritePadding( ostream & out, const uint64_t N_bytes )
+{
+  static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+  out.write( zeros, PadTo8( N_bytes ) - N_bytes );
+}
@@ -0,0 +1,93 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+/**************************************************************************************************************************************************************
+ *
+ * MappedFile.h
+ *
+ * A MappedFile is a read-only, memory-mapped view of a file on disk.  It is used to load the binary cache files (e.g., group*.CLM) without parsing or copying
+ * them: the data arrays in these files are laid out so that they can be used in place, directly from the mapped memory.
+ *
+ * The mapping lasts as long as the MappedFile object does.  MappedFile objects can't be copied; share them by pointer if necessary.
+ *
+ * Also in this module: helper functions for writing the binary cache files, so that every array in them starts on an 8-byte boundary.
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+#ifndef _MAPPED_FILE__H
+#define _MAPPED_FILE__H
+
+#include <inttypes.h> // uint64_t
+#include <stdlib.h> // exit
+#include <iostream>
+#include <string>
+using namespace std;
+
+
+
+class MappedFile
+{
+ public:
+
+  // Constructor: Map the file read-only into memory.  If the file can't be opened or mapped, throw an error and exit.
+  MappedFile( const string & file );
+  ~MappedFile();
+
+  // Query functions.
+  const string & file() const { return _file; }
+  const char * data() const { return _data; }
+  size_t size() const { return _size; }
+
+  // at: Return a pointer to the object of type T at this byte offset into the file.  Asserts that the object lies entirely within the file.
+  template<class T> const T * at( const size_t offset, const size_t N = 1 ) const;
+
+
+ private:
+  MappedFile( const MappedFile & ); // not copyable
+  MappedFile & operator=( const MappedFile & );
+
+  string _file;
+  const char * _data;
+  size_t _size;
+};
+
+
+
+template<class T> const T *
+MappedFile::at( const size_t offset, const size_t N ) const
+{
+  if ( offset + N * sizeof(T) > _size ) {
+    cerr << "ERROR: MappedFile: file " << _file << " is too short (" << _size << " bytes) - it may be truncated or corrupted." << endl;
+    exit(1);
+  }
+  return reinterpret_cast<const T *>( _data + offset );
+}
+
+
+
+// FileHasMagic: Return true iff the file exists and begins with the first magic_len bytes of magic.  Used to distinguish binary cache files from text ones.
+bool FileHasMagic( const string & file, const char * magic, const size_t magic_len );
+
+// PadTo8: Round a byte count up to the next multiple of 8.
+inline uint64_t PadTo8( const uint64_t N_bytes ) { return ( N_bytes + 7 ) & ~uint64_t(7); }
+
+// WritePadding: Write 0's to the output stream until the number of bytes written (N_bytes) is a multiple of 8.
+void WritePadding( ostream & out, const uint64_t N_bytes );
+
+
+#endif
@@ -0,0 +1,171 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+// For documentation, see Parallel.h
+#include "Parallel.h"
+
+#include <assert.h>
+#include <stdio.h> // tmpfile, fflush
+#include <stdlib.h> // exit
+#include <unistd.h> // fork, dup2, _exit, usleep
+#include <sys/wait.h> // waitpid
+#include <vector>
+#include <iostream>
+#include <thread>
+
+
+
+// NThreadsToUse: Convert the N_THREADS parameter into an actual number of threads.
+int
+NThreadsToUse( const int N_threads )
+{
+  if ( N_threads > 0 ) return N_threads;
+
+  // hardware_concurrency() may return 0 if it can't tell.
+  const int N_cores = thread::hardware_concurrency();
+  return N_cores > 0 ? N_cores : 1;
+}
+
+
+
+
+// ParallelForRanges: Split the range [0,N) into N_ranges contiguous blocks, and call work(r,begin,end) on each block r on its own thread.
+void
+ParallelForRanges( const size_t N, const int N_ranges, const function< void( const int, const size_t, const size_t ) > & work )
+{
+  if ( N_ranges <= 1 ) {
+    work( 0, 0, N );
+    return;
+  }
+
+  vector<thread> workers;
+  for ( int r = 0; r < N_ranges; r++ )
+    workers.push_back( thread( work, r, N * r / N_ranges, N * (r+1) / N_ranges ) );
+
+  for ( int r = 0; r < N_ranges; r++ )
+    workers[r].join();
+}
+
+
+
+
+
+// PrintLog: Helper function for ForEachInChildProcess.  Copy the contents of this temporary file to cout, then close it.
+static void
+PrintLog( FILE * log )
+{
+  rewind( log );
+  char buf[65536];
+  size_t N_read;
+  while ( ( N_read = fread( buf, 1, sizeof(buf), log ) ) > 0 )
+    cout.write( buf, N_read );
+  cout << flush;
+  fclose( log );
+}
+
+
+
+// ForEachInChildProcess: Call work(i) for each i in [0,N), each in its own child process, with up to N_procs children running at once.
+void
+ForEachInChildProcess( const size_t N, const vector<size_t> & schedule, const int N_procs, const function< void( const size_t ) > & work,
+		       const function< void( const size_t ) > & finished )
+{
+  assert( schedule.size() == N );
+
+  if ( N_procs <= 1 || N <= 1 ) {
+    for ( size_t i = 0; i < N; i++ ) {
+      work( i );
+      if ( finished ) finished( i );
+    }
+    return;
+  }
+
+
+  vector<FILE *> logs( N, NULL );
+  vector<pid_t> pids( N, -1 );
+  vector<bool> done( N, false );
+  size_t N_started = 0, N_running = 0, N_printed = 0;
+  bool failed = false;
+
+  // Flush everything before forking, or the children will inherit the unprinted output and print it again.
+  cout << flush;
+  fflush( stdout );
+
+  while ( N_printed < N ) {
+
+    // Start as many jobs as possible.
+    while ( !failed && N_started < N && N_running < (size_t) N_procs ) {
+      const size_t i = schedule[ N_started++ ];
+      logs[i] = tmpfile();
+      if ( logs[i] == NULL ) { cerr << "ERROR: ForEachInChildProcess: can't create a temporary file for the output of job #" << i << endl; exit(1); }
+
+      pids[i] = fork();
+      if ( pids[i] < 0 ) { cerr << "ERROR: ForEachInChildProcess: fork() failed for job #" << i << endl; exit(1); }
+
+      if ( pids[i] == 0 ) { // child process
+	dup2( fileno( logs[i] ), STDOUT_FILENO );
+	work( i );
+	cout << flush;
+	fflush( stdout );
+	_exit(0); // skip the parent's atexit handlers and static destructors
+      }
+      N_running++;
+    }
+
+    // Wait for one job to finish.  Only wait on our own children's pids: waitpid(-1) would also reap any other child of this process (e.g., one started by
+    // popen), and then the count of running jobs would be off.  There's no blocking wait for "any of these pids", so poll them, with a short sleep between
+    // polls; the jobs take far longer than that.
+    while ( N_running > 0 ) {
+      bool any_done = false;
+      for ( size_t i = 0; i < N; i++ ) {
+	if ( pids[i] <= 0 || done[i] ) continue;
+	int status;
+	const pid_t pid = waitpid( pids[i], &status, WNOHANG );
+	if ( pid == 0 ) continue; // still running
+	if ( pid < 0 ) { cerr << "ERROR: ForEachInChildProcess: waitpid() failed for job #" << i << " (pid " << pids[i] << ")" << endl; exit(1); }
+
+	done[i] = true;
+	any_done = true;
+	N_running--;
+	if ( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ) {
+	  if ( finished ) finished( i );
+	  continue;
+	}
+
+	failed = true;
+	cerr << "ERROR: ForEachInChildProcess: job #" << i << " (pid " << pid << ") ";
+	if ( WIFEXITED( status ) ) cerr << "exited with status " << WEXITSTATUS( status ) << endl;
+	else if ( WIFSIGNALED( status ) ) cerr << "was killed by signal " << WTERMSIG( status ) << endl;
+	else cerr << "ended with wait status " << status << endl;
+      }
+      if ( any_done ) break;
+      usleep( 10000 );
+    }
+
+    // Print the logs of all finished jobs, in order.
+    while ( N_printed < N && done[N_printed] )
+      PrintLog( logs[ N_printed++ ] );
+
+    // If a job failed, let the running jobs finish, then print all the logs that are ready (the failed job's log may explain the failure) and quit.
+    if ( failed && N_running == 0 ) {
+      for ( size_t i = N_printed; i < N; i++ )
+	if ( done[i] ) PrintLog( logs[i] );
+      cerr << "ERROR: ForEachInChildProcess: a child process failed (see above)" << endl;
+      exit(1);
+    }
+  }
+}
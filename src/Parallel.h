@@ -0,0 +1,63 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+/**************************************************************************************************************************************************************
+ *
+ * Parallel.h
+ *
+ * Simple helpers for running independent pieces of work on several threads (or processes) at once.  The N_THREADS parameter in the ini file sets how many
+ * threads to use.
+ *
+ * For parallel reading of SAM/BAM files, see SAMIngest.h.
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+#ifndef _PARALLEL__H
+#define _PARALLEL__H
+
+#include <stddef.h> // size_t
+#include <vector>
+#include <functional>
+using namespace std;
+
+
+
+// NThreadsToUse: Convert the N_THREADS parameter into an actual number of threads.  If N_threads <= 0, use one thread per processor core.
+int NThreadsToUse( const int N_threads );
+
+
+// ParallelForRanges: Split the range [0,N) into N_ranges contiguous blocks of (nearly) equal size, in order, and call work(r,begin,end) on block r, with each
+// block on its own thread.  Returns when all the blocks are done.  Callers can fill per-block results indexed by r, then combine them in order.
+// Calls to work() must not modify any shared data, except for the caller's per-block or per-index slots.  If N_ranges <= 1, runs on the calling thread.
+void ParallelForRanges( const size_t N, const int N_ranges, const function< void( const int, const size_t, const size_t ) > & work );
+
+
+// ForEachInChildProcess: Call work(i) for each i in [0,N), each in its own child process (via fork), with up to N_procs children running at once.  The jobs
+// are started in the order given by schedule (a permutation of [0,N)), so e.g. the longest jobs can be started first.
+// Each child's stdout is captured, and the logs are printed to cout strictly in order of i, as they become available; so the output is the same as if the
+// jobs had been run one at a time.  If a child fails (e.g., on an assert), report its exit status, and exit once its log has been printed.
+// Only the children started here are waited on, so other children of the calling process (e.g., from popen) are left alone.
+// work() can't change anything in the parent process: it must write its results to files.  Use this for jobs that write to cout throughout, or that use
+// code that isn't thread-safe.  If N_procs <= 1, the jobs are simply run in order of i, on the calling process, with output going straight to cout.
+// If given, finished(i) is called on the calling process as soon as job #i is done (e.g., to free the memory that only job #i needed.)
+void ForEachInChildProcess( const size_t N, const vector<size_t> & schedule, const int N_procs, const function< void( const size_t ) > & work,
+			    const function< void( const size_t ) > & finished = function< void( const size_t ) >() );
+
+
+#endif
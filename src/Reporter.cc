@@ -21,7 +21,9 @@
 #include "ClusterVec.h"
 #include "ContigOrdering.h"
 #include "GenomeLinkMatrix.h" // for MakeWholeAssemblyHeatmap only
+#include "Heatmap.h" // for MakeWholeAssemblyHeatmap only
 #include "TextFileParsers.h" // ParseTabDelimFile()
+#include "Parallel.h" // NThreadsToUse, ParallelForRanges
 
 // C++ includes
 #include <assert.h>
@@ -55,35 +57,19 @@ static char _LINE[10000];
 
 
 
-// AND(): Calculate the logical AND of two dynamic_bitsets.
+// AND(): Calculate the logical AND of two dynamic_bitsets, a block (machine word) at a time.
 boost::dynamic_bitset<>
-AND( const boost::dynamic_bitset<> a, const boost::dynamic_bitset<> b )
+AND( const boost::dynamic_bitset<> & a, const boost::dynamic_bitset<> & b )
 {
   assert ( a.size() == b.size() );
-  boost::dynamic_bitset<> c( a.size(), false );
-  for ( size_t i = 0; i < a.size(); i++ )
-    if ( a[i] && b[i] )
-      c[i] = true;
-
+  boost::dynamic_bitset<> c( a );
+  c &= b;
   return c;
 }
 
 
 
 
-// SetToVec: Convert a set<int> into a vector<int> for easy random access.
-vector<int>
-SetToVec( const set<int> & s )
-{
-  vector<int> v;
-  for ( set<int>::const_iterator it = s.begin(); it != s.end(); ++it )
-    v.push_back( *it );
-  return v;
-}
-
-
-
-
 // Calculate the Pearson correlation coefficient, r, indicating correlation between two data sets.  Ranges from -1 to 1.
 double
 PearsonCorrelation( const vector<double> & x, const vector<double> & y )
@@ -130,6 +116,36 @@ PearsonCorrelation( const vector<double> & x, const vector<double> & y )
 
 
 
+// OrderingFlags::Resize: Make room for flags on N_contigs contigs.  New flags are false.
+void
+OrderingFlags::Resize( const int N_contigs )
+{
+  used        .resize( N_contigs );
+  high_quality.resize( N_contigs );
+  unaligned   .resize( N_contigs );
+  chr_mismatch.resize( N_contigs );
+  order_error .resize( N_contigs );
+  orient_error.resize( N_contigs );
+}
+
+
+
+// OrderingFlags::Merge: OR another set of OrderingFlags (of the same size) into this one.
+void
+OrderingFlags::Merge( const OrderingFlags & flags )
+{
+  used         |= flags.used;
+  high_quality |= flags.high_quality;
+  unaligned    |= flags.unaligned;
+  chr_mismatch |= flags.chr_mismatch;
+  order_error  |= flags.order_error;
+  orient_error |= flags.orient_error;
+}
+
+
+
+
+
 // Constructor!  Load in all the data, and do a bunch of sanity checks.  trunks and orders can both be empty, or they can both be full.
 Reporter::Reporter( const RunParams & run_params,
 		    const ClusterVec & clusters,
@@ -144,6 +160,7 @@ Reporter::Reporter( const RunParams & run_params,
     _contig_lengths( TargetLengths( run_params._SAM_files[0] ) ),
     _total_contig_length( accumulate( _contig_lengths.begin(), _contig_lengths.end(), int64_t(0) ) ),
     _clusters( clusters ),
+    _cluster_index( clusters, _N_contigs ),
     _trunks( trunks ),
     _orders( orders ),
     _data( new ReporterData() )
@@ -230,10 +247,23 @@ Reporter::Eval() const
   EvalClustering();
 
   // Evaluate all the orderings, if there are any.
+  // The orderings are independent, so they're evaluated in parallel, in contiguous blocks.  Each block marks its own OrderingFlags, and these are merged
+  // into _data at the end.  No contig is in two clusters, so the result is the same as if the orderings had been evaluated one at a time.
   if ( _N_orderings > 0 ) {
-    for ( int i = 0; i < _N_orderings; i++ ) {
-      EvalOrderAccuracy( i, false ); // trunks
-      EvalOrderAccuracy( i, true ); // full orderings
+    const int N_ranges = min( NThreadsToUse( _run_params._N_threads ), _N_orderings );
+    vector<OrderingFlags> trunk_flags( N_ranges ), order_flags( N_ranges );
+    ParallelForRanges( _N_orderings, N_ranges, [&]( const int r, const size_t begin, const size_t end ) {
+	for ( size_t i = begin; i < end; i++ ) {
+	  EvalOrderAccuracy( i, false, trunk_flags[r] ); // trunks
+	  EvalOrderAccuracy( i, true,  order_flags[r] ); // full orderings
+	}
+      } );
+
+    _data->trunk_flags.Resize( _N_contigs );
+    _data->order_flags.Resize( _N_contigs );
+    for ( int r = 0; r < N_ranges; r++ ) {
+      _data->trunk_flags.Merge( trunk_flags[r] );
+      _data->order_flags.Merge( order_flags[r] );
     }
   }
 
@@ -279,11 +309,14 @@ Reporter::EvalClustering() const
 {
   cout << "EvalClustering" << endl;
 
-  // Mark contigs that are in the cluster.
+  // Mark contigs that are in the cluster, and find the length of each cluster.
   _data->in_cluster.resize( _N_contigs );
+  _data->cluster_len.assign( _N_clusters, 0 );
   for ( int i = 0; i < _N_clusters; i++ )
-    for ( set<int>::const_iterator it = _clusters[i].begin(); it != _clusters[i].end(); ++it )
+    for ( set<int>::const_iterator it = _clusters[i].begin(); it != _clusters[i].end(); ++it ) {
       _data->in_cluster[*it] = true;
+      _data->cluster_len[i] += _contig_lengths[*it];
+    }
 
 
   // If there's no reference, nothing more can be done.
@@ -373,21 +406,24 @@ Reporter::EvalClustering() const
 // If full_order, then eval _orders[cluster_ID]; otherwise eval _trunks[cluster_ID].
 void
 Reporter::EvalOrderAccuracy( int cluster_ID, bool full_order ) const
+{
+  EvalOrderAccuracy( cluster_ID, full_order, full_order ? _data->order_flags : _data->trunk_flags );
+}
+
+
+
+// Like EvalOrderAccuracy() above, but mark the flags in the given OrderingFlags rather than in the ReporterData struct.
+void
+Reporter::EvalOrderAccuracy( int cluster_ID, bool full_order, OrderingFlags & flags ) const
 {
   bool verbose = false;
 
-  // Initialize the variables in the ReporterData struct.
-  OrderingFlags & flags = full_order ? _data->order_flags : _data->trunk_flags;
-  flags.used        .resize( _N_contigs );
-  flags.high_quality.resize( _N_contigs );
-  flags.unaligned   .resize( _N_contigs );
-  flags.chr_mismatch.resize( _N_contigs );
-  flags.order_error .resize( _N_contigs );
-  flags.orient_error.resize( _N_contigs );
+  // Initialize the flags.
+  flags.Resize( _N_contigs );
 
 
-  // Convert this cluster to a local vector<> for easier random access.
-  const vector<int> cluster = SetToVec( _clusters[cluster_ID] );
+  // Get the contigs in this cluster, for random access by local ID.
+  const ClusterIndex::Members cluster = _cluster_index.members( cluster_ID );
 
 
   const ContigOrdering & scaffold = full_order ? _orders[cluster_ID] : _trunks[cluster_ID];
@@ -510,8 +546,8 @@ Reporter::EvalGapSizes( int cluster_ID, bool full_order ) const
 {
   RequireReference(); // can't eval gap sizes without a reference
 
-  // Convert this cluster to a local vector<> for easier random access.
-  const vector<int> cluster = SetToVec( _clusters[cluster_ID] );
+  // Get the contigs in this cluster, for random access by local ID.
+  const ClusterIndex::Members cluster = _cluster_index.members( cluster_ID );
 
   // Get the scaffold.
   const ContigOrdering & scaffold = full_order ? _orders[cluster_ID] : _trunks[cluster_ID];
@@ -711,14 +747,9 @@ Reporter::ReportChartWithReference() const
     for ( size_t j = 0; j + chrom_name.size() < 14; j++ ) chrom_name += ' '; // note that chrom_name.size() increases with each iteration
 
 
-    // Calculate the total cluster length.
-    boost::dynamic_bitset<> in_cluster( _N_contigs );
-    int cluster_N = 0;
-    for ( set<int>::const_iterator it = _clusters[i].begin(); it != _clusters[i].end(); ++it ) {
-      cluster_N++;
-      in_cluster[*it] = true;
-    }
-    int64_t cluster_len = contig_length_if( in_cluster );
+    // Look up the total cluster length.
+    int cluster_N = _clusters[i].size();
+    int64_t cluster_len = _data->cluster_len[i];
 
     // For each chromosome, calculate percentages, and print a line to the chart.
     double pct_N_bad         = 100.0 * _data->cluster_N_bad  [i] / ( _data->cluster_N_good  [i] + _data->cluster_N_bad  [i] + epsilon );
@@ -849,11 +880,8 @@ Reporter::ReportChartNoReference() const
   out << horiz_line;
   for ( int i = 0; i < _N_clusters; i++ ) {
 
-    // Calculate the total cluster length.
-    boost::dynamic_bitset<> in_cluster( _N_contigs );
-    for ( set<int>::const_iterator it = _clusters[i].begin(); it != _clusters[i].end(); ++it )
-      in_cluster[*it] = true;
-    int64_t cluster_len = contig_length_if( in_cluster );
+    // Look up the total cluster length.
+    int64_t cluster_len = _data->cluster_len[i];
 
     sprintf( _LINE, "| %6d   | %7ld   | %11ld |\n", i, _clusters[i].size(), cluster_len );
     out << _LINE;
@@ -926,12 +954,10 @@ Reporter::HistogramOrderingErrors(const bool full_order,
 
   vector<int64_t> N_total(N_bins, 0), len_total(N_bins, 0), N_order_error(N_bins, 0), N_orient_error(N_bins, 0), N_o_and_o_error(N_bins, 0);
 
-  // Now loop over all contigs and gather data.
-  for (int i = 0; i < _N_contigs; i++) {
-    // Skip contigs that aren't used or that don't align; these don't have the option of being ordering errors.
-    if (!flags.used[i] || flags.unaligned[i]) {
-      continue;
-    }
+  // Now loop over the contigs that are used and aligned, and gather data.  (Contigs that aren't used or that don't align don't have the option of
+  // being ordering errors.)
+  const boost::dynamic_bitset<> used_aligned = flags.used - flags.unaligned;
+  for (size_t i = used_aligned.find_first(); i != boost::dynamic_bitset<>::npos; i = used_aligned.find_next(i)) {
 
     // For each contig, look up its length, and determine the bin it belongs in.
     int len = lens[i];
@@ -992,8 +1018,8 @@ Reporter::DotplotOrderAccuracy( const int ordering_ID, const bool full_order, co
   vector<int> contig_order = _true_mapping->QueriesToGenomeOrder();
 
 
-  // Convert this ordering to a local vector<> for easier random access.
-  vector<int> cluster = SetToVec( _clusters[ordering_ID] );
+  // Get the contigs in this ordering's cluster, for random access by local ID.
+  const ClusterIndex::Members cluster = _cluster_index.members( ordering_ID );
   assert( scaffold.N_contigs() == (int) cluster.size() );
   int N_contigs_used = scaffold.N_contigs_used();
 
@@ -1106,10 +1132,14 @@ void
 Reporter::ReportChartOrderingErrors( const bool full_order, ostream & out ) const
 {
   // Get the dataset: is this the full order or not?
-  OrderingFlags flags = full_order ? _data->order_flags : _data->trunk_flags;
+  const OrderingFlags & flags = full_order ? _data->order_flags : _data->trunk_flags;
   string label = full_order ? "FULL ORDER" : "TRUNK";
 
   // Derive numbers.
+  const boost::dynamic_bitset<> HQ_order_errors  = AND( flags.high_quality, flags.order_error );
+  const boost::dynamic_bitset<> HQ_orient_errors = AND( flags.high_quality, flags.orient_error );
+  const int         N_HQ = flags.high_quality.count();
+  const int64_t len_HQ = contig_length_if( flags.high_quality );
   int N_contigs_in_chroms = flags.used.count() - flags.unaligned.count();
   int64_t len_contigs_in_chroms = contig_length_if( flags.used ) - contig_length_if( flags.unaligned );
   double   pct_N_chr_mismatches = 100.0 * flags.chr_mismatch.count() / N_contigs_in_chroms;
@@ -1118,10 +1148,10 @@ Reporter::ReportChartOrderingErrors( const bool full_order, ostream & out ) cons
   double pct_len_order_errors = 100.0 * contig_length_if( flags.order_error ) / len_contigs_in_chroms;
   double   pct_N_orient_errors = 100.0 * flags.orient_error.count() / N_contigs_in_chroms;
   double pct_len_orient_errors = 100.0 * contig_length_if( flags.orient_error ) / len_contigs_in_chroms;
-  double   pct_N_HQ_order_errors = 100.0 * AND( flags.high_quality, flags.order_error ).count() / flags.high_quality.count();
-  double pct_len_HQ_order_errors = 100.0 * contig_length_if( AND( flags.high_quality, flags.order_error ) ) / contig_length_if( flags.high_quality );
-  double   pct_N_HQ_orient_errors = 100.0 * AND( flags.high_quality, flags.orient_error ).count() / flags.high_quality.count();
-  double pct_len_HQ_orient_errors = 100.0 * contig_length_if( AND( flags.high_quality, flags.orient_error ) ) / contig_length_if( flags.high_quality );
+  double   pct_N_HQ_order_errors = 100.0 * HQ_order_errors.count() / N_HQ;
+  double pct_len_HQ_order_errors = 100.0 * contig_length_if( HQ_order_errors ) / len_HQ;
+  double   pct_N_HQ_orient_errors = 100.0 * HQ_orient_errors.count() / N_HQ;
+  double pct_len_HQ_orient_errors = 100.0 * contig_length_if( HQ_orient_errors ) / len_HQ;
 
 
   // Print the chart, not including horizontal lines.
@@ -1160,10 +1190,10 @@ Reporter::contig_length_if( const boost::dynamic_bitset<> & bits ) const
 {
   assert( (int) bits.size() == _N_contigs );
 
+  // Visit only the set bits: find_first() and find_next() skip over empty blocks a word at a time.
   int64_t length = 0;
-  for ( int i = 0; i < _N_contigs; i++ )
-    if ( bits[i] )
-      length += _contig_lengths[i];
+  for ( size_t i = bits.find_first(); i != boost::dynamic_bitset<>::npos; i = bits.find_next(i) )
+    length += _contig_lengths[i];
 
   return length;
 }
@@ -1183,7 +1213,8 @@ Reporter::contig_length_if( const boost::dynamic_bitset<> & bits ) const
 // 2. Convert these data structures into a single vector that maps the original order of contigs onto an order that describes how Lachesis has ordered them.
 // 3. Load a GenomeLinkMatrix to get the quantity of Hi-C links between all pairs of contigs.
 // 4. Make a heatmap of the GLM's data, with the contigs reordered as in Step 2.
-// Uses the R script heatmap.MWAH.R.  Makes an output file heatmap.txt and an auxiliary output file heatmap.chrom_breaks.txt.
+// The heatmap is drawn by a HeatmapPyramid, with the colors of heatmap.MWAH.R and dashed lines between the clusters.  It's written as an overview image,
+// out/heatmap.MWAH.png, and as a pyramid of zoomable tiles, out/heatmap.MWAH.tiles/ (see Heatmap.h).
 void
 MakeWholeAssemblyHeatmap( const RunParams & run_params, const int PLOT_N, const bool USE_RES )
 {
@@ -1202,6 +1233,7 @@ MakeWholeAssemblyHeatmap( const RunParams & run_params, const int PLOT_N, const
   int N_contigs = contig_lengths.size();
   vector<int> contig_N_REs = ParseTabDelimFile<int>( run_params.DraftContigRESitesFilename(), 1 );
   assert( N_contigs == (int) contig_lengths.size() );
+  const ClusterIndex cluster_index( clusters, N_contigs );
 
   // Find which contigs are the PLOT_N longest.  Note that even these contigs will not be plotted if they are not also clustered and ordered.
   vector<int> contig_lengths_sorted = USE_RES ? contig_N_REs : contig_lengths;
@@ -1226,18 +1258,15 @@ MakeWholeAssemblyHeatmap( const RunParams & run_params, const int PLOT_N, const
   int new_ID = 0;
   int64_t total_len = 0;
 
-  // Make an output file that delineates chromosomes.
-  ofstream out2( "heatmap.chrom_breaks.txt" );
-  out2 << "0" << endl;
+  // Note where each cluster ends, to delineate chromosomes.
+  vector<size_t> chrom_breaks;
 
   for ( size_t i = 0; i < clusters.size(); i++ ) {
 
     //cout << "New cluster starts at #" << new_ID << endl;
 
-    // Convert this cluster from a set<int> into a vector<int> for easy random access.
-    vector<int> cluster;
-    for ( set<int>::const_iterator it = clusters[i].begin(); it != clusters[i].end(); ++it )
-      cluster.push_back( *it );
+    // Get the contigs in this cluster, for random access by local ID.
+    const ClusterIndex::Members cluster = cluster_index.members(i);
 
     // Loop over all the contigs in this cluster ordering, and add them to the lookup table.
     for ( int j = 0; j < orders[i].N_contigs_used(); j++ ) {
@@ -1259,7 +1288,7 @@ MakeWholeAssemblyHeatmap( const RunParams & run_params, const int PLOT_N, const
 
     }
 
-    out2 << ( double(new_ID) - 0.5 ) << endl;
+    chrom_breaks.push_back( new_ID );
 
     /*
     // Find all the contigs in this cluster that haven't been added to the ordering, and add them in at the end.
@@ -1272,46 +1301,32 @@ MakeWholeAssemblyHeatmap( const RunParams & run_params, const int PLOT_N, const
     */
 
   }
-  out2.close();
 
   int N_contigs_used = new_ID;
   cout << "Total number of contigs that are sufficiently long (among the top " << PLOT_N << ") and are clustered and ordered, and will therefore go into the histogram = " << N_contigs_used << " (length = " << total_len << ")" << endl;
 
 
   // 3. Load a GenomeLinkMatrix to get the quantity of Hi-C links between all pairs of contigs.
-  GenomeLinkMatrix glm( run_params._out_dir + "/cached_data/all.GLM" );
+  // With a memory budget, it's out of core (see GenomeLinkMatrix.h), so it's read one row at a time, as below.
+  GenomeLinkMatrix glm( run_params._out_dir + "/cached_data/all" + run_params.CacheTag() + ".GLM", size_t( run_params._GLM_memory_budget ) << 20 );
 
   // Normalize this GenomeLinkMatrix.
   glm.NormalizeToDeNovoContigLengths( USE_RES );
 
 
 
-  // 4. Make a heatmap of the GLM's data, with the contigs reordered as in Step 2.
-  cout << "Writing a heatmap to heatmap.txt" << endl;
-  ofstream out( "heatmap.txt" );
-  out << "X\tY\tZ\n";
-
-  for ( int i = 0; i < N_contigs_used; i++ )
-    for ( int j = 0; j < N_contigs_used; j++ ) {
-      if ( i == j ) continue; // leave the main diagonal blank - there's no data there anyway
-
-      int i_old = new_to_old[i];
-      int j_old = new_to_old[j];
-
-      double data = glm.NLinks( i_old, j_old );
-      //if ( data == 0 ) continue; // don't print a lack of data, including along the main diagonal
-
-      // Rescale the data to put it into a more intuitive range for visual clarity.
-      data /= 1000;
-
-      //PRINT5( i, j, i_old, j_old, data );
-      out << i << '\t' << j << '\t' << data << endl;
-    }
-
-  out.close();
+  // 4. Make a heatmap of the GLM's data, with the contigs reordered as in Step 2.  The main diagonal is left blank - there's no data there anyway.
+  // The data are divided by 1000 to put them into a more intuitive range for visual clarity.
+  // The deepest zoom level is the first with at least one pixel per contig, up to 8192 x 8192 pixels; the overview is (up to) 1024 x 1024 pixels.
+  HeatmapPyramid heatmap( N_contigs_used, 6, 256 );
+  heatmap.SetPalette( HeatmapPyramid::HeatPalette() );
+  heatmap.SetBreaks( chrom_breaks );
+  glm.AddToHeatmap( heatmap, old_to_new, 1.0 / 1000 );
 
-  cout << "Making out/heatmap.MWAH.jpg... this may take a while" << endl;
-  system( "heatmap.MWAH.R" );
+  system( "mkdir -p out" );
+  cout << "Making out/heatmap.MWAH.png and out/heatmap.MWAH.tiles/" << endl;
+  heatmap.WritePNG( "out/heatmap.MWAH.png", min( 2, heatmap.N_levels() - 1 ) );
+  heatmap.WriteTiles( "out/heatmap.MWAH.tiles" );
 
   cout << "Done with that heatmap!" << endl;
 }
@@ -74,6 +74,11 @@ struct OrderingFlags
   boost::dynamic_bitset<> chr_mismatch; // this contig is in an ordering and doesn't match the chromosome of the previous contig in the same ordering
   boost::dynamic_bitset<> order_error;  // this contig is in an ordering at a location of an ordering error
   boost::dynamic_bitset<> orient_error; // this contig is in an ordering and is oriented incorrectly
+
+  // Resize: Make room for flags on N_contigs contigs.  New flags are false.
+  void Resize( const int N_contigs );
+  // Merge: OR another set of OrderingFlags (of the same size) into this one.
+  void Merge( const OrderingFlags & flags );
 };
 
 
@@ -86,6 +91,7 @@ struct ReporterData
   vector<int> cluster_chrom; // for each cluster, the chromosome containing the plurality (by length) of its contigs
   vector<int>     cluster_N_good,   cluster_N_bad,   cluster_N_unaligned;   // for each cluster, the number of contigs (in|not in) the plurality chromosome
   vector<int64_t> cluster_len_good, cluster_len_bad, cluster_len_unaligned; // for each cluster, the length of contigs (in|not in) the plurality chromosome
+  vector<int64_t> cluster_len; // for each cluster, the total length of its contigs
 
   boost::dynamic_bitset<> in_cluster; // flags indicating whether each contig is in a cluster
 
@@ -113,7 +119,7 @@ class Reporter
    * The ReportChart() functions then use these numbers to print pretty output files.
    */
 
-  void Eval() const; // main top-level function; calls other Eval() functions
+  void Eval() const; // main top-level function; calls other Eval() functions.  The orderings are evaluated in parallel, with up to N_THREADS threads.
   void EvalContigUsage() const; // non-reference-based
   void EvalClustering() const;
   void EvalOrderAccuracy( int cluster_ID, bool full_order ) const; // if full_order, then eval _orders[cluster_ID]; otherwise eval _trunks[cluster_ID]
@@ -139,6 +145,10 @@ class Reporter
   // RequireReference: Throw a verbose error if _true_mapping == NULL.  This should always be called before anything that uses _true_mapping.
   void RequireReference() const;
 
+  // EvalOrderAccuracy: Mark the flags for the contigs in one ordering in the given OrderingFlags, rather than in _data.  This only reads shared data, so
+  // several orderings can be evaluated at once, each into its own OrderingFlags.
+  void EvalOrderAccuracy( int cluster_ID, bool full_order, OrderingFlags & flags ) const;
+
   // Helper functions for ReportChart().
   void ReportChartOrderingPercentages( ostream & out ) const;
   void ReportChartOrderingErrors( const bool full_order, ostream & out ) const;
@@ -165,6 +175,7 @@ class Reporter
   const int64_t _total_contig_length;
 
   const ClusterVec _clusters;
+  const ClusterIndex _cluster_index; // flat copy of _clusters, for looking up contigs' global IDs from their local IDs
   const vector<ContigOrdering> _trunks, _orders; // these are empty if !_has_ordering
 
 
@@ -23,6 +23,7 @@
 #include <string>
 #include <map>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 
 
@@ -122,7 +123,10 @@ RunParams::ParseIniFile( const string & ini_file )
   // This is the order in which RunParams expects to see the parameters.  It's also the order in which the parameters appear in the default INI files.
   // It's important to enforce the order because some parameters depend on earlier ones (e.g., SAM_DIR must be loaded so we know where to look for SAM_FILES.)
   // If you want to permanently add or remove any parameters, make sure to update N_keys as well as keys_order_array.
-  const int N_keys = 28;
+  // The first N_required_keys keys must all appear.  The keys after that are optional: they may be left out of the INI file (in which case they keep the
+  // default values set below), but if they do appear, they must still appear in order.  This lets older INI files keep working as new options are added.
+  const int N_required_keys = 28;
+  const int N_keys = 37;
   const char * keys_order_array[] = { "SPECIES", "OUTPUT_DIR",
 				      "DRAFT_ASSEMBLY_FASTA", "SAM_DIR", "SAM_FILES", "RE_SITE_SEQ",
 				      "USE_REFERENCE", "SIM_BIN_SIZE", "REF_ASSEMBLY_FASTA", "BLAST_FILE_HEAD",
@@ -130,7 +134,10 @@ RunParams::ParseIniFile( const string & ini_file )
 				      "CLUSTER_N", "CLUSTER_CONTIGS_WITH_CENS", "CLUSTER_MIN_RE_SITES", "CLUSTER_MAX_LINK_DENSITY",
 				      "CLUSTER_NONINFORMATIVE_RATIO", "CLUSTER_DRAW_HEATMAP", "CLUSTER_DRAW_DOTPLOT",
 				      "ORDER_MIN_N_RES_IN_TRUNK", "ORDER_MIN_N_RES_IN_SHREDS", "ORDER_DRAW_DOTPLOTS",
-				      "REPORT_EXCLUDED_GROUPS", "REPORT_QUALITY_FILTER", "REPORT_DRAW_HEATMAP" };
+				      "REPORT_EXCLUDED_GROUPS", "REPORT_QUALITY_FILTER", "REPORT_DRAW_HEATMAP",
+				      "TEXT_CACHE_FILES", "N_THREADS", "GLM_MEMORY_BUDGET", "CLM_MEMORY_BUDGET", "ORDER_REFINE_SECONDS",
+				      "COMPACT_STORAGE", "ORDER_CHECKPOINT_SECONDS", "REPORT_SCAFFOLDED_FASTA",
+				      "SUBSAMPLE_FRACTION" };
   const vector<string> keys_order( keys_order_array, keys_order_array + N_keys );
 
   // For certain keys, we can have any (nonzero) number of values appear after the key.  Mark these keys.  For all other keys, exactly one value is required.
@@ -144,6 +151,18 @@ RunParams::ParseIniFile( const string & ini_file )
 
 
 
+  // Default values for the optional keys.
+  _text_cache_files = false;
+  _N_threads = 0;
+  _GLM_memory_budget = 0;
+  _CLM_memory_budget = 0;
+  _order_refine_seconds = 0;
+  _compact_storage = false;
+  _order_checkpoint_seconds = 600;
+  _report_scaffolded_fasta = false;
+  _subsample_fraction = 1;
+
+
   vector<string> tokens;
   int current_key_ID = 0;
 
@@ -185,10 +204,14 @@ RunParams::ParseIniFile( const string & ini_file )
     if ( !variable_N_values.at(key) && tokens.size() != 3 )
       ReportParseFailure( "Key '" + key + "' should be followed by only one value, but multiple values are given." );
 
-    // Require the key to be the next key in the ordered list.
-    if ( key != keys_order[current_key_ID] )
+    // Require the key to be the next key in the ordered list.  Optional keys that have been left out of the INI file are skipped over.
+    if ( current_key_ID == N_keys )
+      ReportParseFailure( "Key '" + key + "' appears after all of the keys have already been seen.  Make sure no key appears twice in the INI file." );
+    int next_key_ID = current_key_ID;
+    while ( next_key_ID >= N_required_keys && next_key_ID+1 < N_keys && key != keys_order[next_key_ID] ) next_key_ID++;
+    if ( key != keys_order[next_key_ID] )
       ReportParseFailure( "Key '" + key + "' appears too early in the INI file; we expect to see the key '" + keys_order[current_key_ID] + "' instead.\nMake sure not to change the order in which the keys appear in the INI file." );
-    current_key_ID++;
+    current_key_ID = next_key_ID + 1;
 
 
 
@@ -216,7 +239,7 @@ RunParams::ParseIniFile( const string & ini_file )
     }
     else if ( key == "DRAFT_ASSEMBLY_FASTA" ) {
       _draft_assembly_fasta = value;
-      if ( !boost::filesystem::is_regular_file( value ) && !boost::filesystem::is_regular_file( value + ".names" ) ) // technically this should also check for the existence of <assembly-fasta>.counts_<RE_SITE_SEQ>.txt, but RE_SITE_SEQ hasn't been loaded in yet
+      if ( !boost::filesystem::is_regular_file( value ) && !boost::filesystem::is_regular_file( value + ".fai" ) && !boost::filesystem::is_regular_file( value + ".names" ) ) // technically this should also check for the existence of <assembly-fasta>.counts_<RE_SITE_SEQ>.txt, but RE_SITE_SEQ hasn't been loaded in yet
 	ReportParseFailure( "Can't find file '" + value + "'." );
     }
     else if ( key == "SAM_DIR" ) {
@@ -243,12 +266,13 @@ RunParams::ParseIniFile( const string & ini_file )
     else if ( key == "REF_ASSEMBLY_FASTA" ) {
       _ref_assembly_fasta = value;
       if ( _use_ref )
-	if ( !boost::filesystem::is_regular_file( value ) && !boost::filesystem::is_regular_file( value + ".names" ) )
+	if ( !boost::filesystem::is_regular_file( value ) && !boost::filesystem::is_regular_file( value + ".fai" ) && !boost::filesystem::is_regular_file( value + ".names" ) )
 	  ReportParseFailure( "Can't find file '" + value + "'." );
     }
     else if ( key == "BLAST_FILE_HEAD" ) {
       _BLAST_file_head = value;
-      if ( _use_ref && _sim_bin_size == 0 && !boost::filesystem::is_regular_file( value + ".1.blast.out" ) && !boost::filesystem::is_regular_file( _out_dir + "/cached_data/TrueMapping.assembly.txt" ) )
+      if ( _use_ref && _sim_bin_size == 0 && !boost::filesystem::is_regular_file( value + ".1.blast.out" ) && !boost::filesystem::is_regular_file( value + ".1.blast.out.gz" ) &&
+	   !boost::filesystem::is_regular_file( _out_dir + "/cached_data/TrueMapping.assembly.txt" ) && !boost::filesystem::is_regular_file( _out_dir + "/cached_data/TrueMapping.assembly.bin" ) )
 	ReportParseFailure( "BLAST_FILE_HEAD = " + value + " doesn't seem to point to any usable BLAST alignment files, and no cached data is available in OUTPUT_DIR." );
     }
     else if ( key == "DO_CLUSTERING" )  _do_clustering  = ConvertOrFail<bool>( value );
@@ -291,6 +315,33 @@ RunParams::ParseIniFile( const string & ini_file )
     }
     else if ( key == "REPORT_QUALITY_FILTER" ) _report_quality_filter = ConvertOrFail<int>( value );
     else if ( key == "REPORT_DRAW_HEATMAP" )   _report_draw_heatmap   = ConvertOrFail<bool>( value );
+    else if ( key == "TEXT_CACHE_FILES" )      _text_cache_files      = ConvertOrFail<bool>( value );
+    else if ( key == "N_THREADS" ) {
+      _N_threads = ConvertOrFail<int>( value );
+      if ( _N_threads < 0 ) ReportParseFailure( "N_THREADS must be 0 (one thread per processor core) or a positive number of threads." );
+    }
+    else if ( key == "GLM_MEMORY_BUDGET" ) {
+      _GLM_memory_budget = ConvertOrFail<int>( value );
+      if ( _GLM_memory_budget < 0 ) ReportParseFailure( "GLM_MEMORY_BUDGET must be 0 (keep the GLM in memory) or a positive number of megabytes." );
+    }
+    else if ( key == "CLM_MEMORY_BUDGET" ) {
+      _CLM_memory_budget = ConvertOrFail<int>( value );
+      if ( _CLM_memory_budget < 0 ) ReportParseFailure( "CLM_MEMORY_BUDGET must be 0 (build the CLMs in memory) or a positive number of megabytes." );
+    }
+    else if ( key == "ORDER_REFINE_SECONDS" ) {
+      _order_refine_seconds = ConvertOrFail<double>( value );
+      if ( _order_refine_seconds < 0 ) ReportParseFailure( "ORDER_REFINE_SECONDS must be 0 (no refinement) or a positive number of seconds." );
+    }
+    else if ( key == "COMPACT_STORAGE" )       _compact_storage       = ConvertOrFail<bool>( value );
+    else if ( key == "ORDER_CHECKPOINT_SECONDS" ) {
+      _order_checkpoint_seconds = ConvertOrFail<double>( value );
+      if ( _order_checkpoint_seconds < 0 ) ReportParseFailure( "ORDER_CHECKPOINT_SECONDS must be 0 (no checkpoints) or a positive number of seconds." );
+    }
+    else if ( key == "REPORT_SCAFFOLDED_FASTA" ) _report_scaffolded_fasta = ConvertOrFail<bool>( value );
+    else if ( key == "SUBSAMPLE_FRACTION" ) {
+      _subsample_fraction = ConvertOrFail<double>( value );
+      if ( _subsample_fraction <= 0 || _subsample_fraction > 1 ) ReportParseFailure( "SUBSAMPLE_FRACTION must be a fraction of the read pairs, greater than 0 and at most 1." );
+    }
 
 
     // Record this line.
@@ -308,7 +359,10 @@ RunParams::ParseIniFile( const string & ini_file )
   }
 
 
-  assert( current_key_ID == N_keys );
+  if ( current_key_ID < N_required_keys ) {
+    cerr << "ERROR: INI file " << _ini_file << " ends before the key '" << keys_order[current_key_ID] << "' appears.  All keys through '" << keys_order[N_required_keys-1] << "' are required." << endl;
+    exit(1);
+  }
 }
 
 
@@ -320,7 +374,7 @@ vector<string> *
 RunParams::LoadRefGenomeContigNames() const
 {
   // If this function hasn't already been run, parse the fasta file and get the reference assembly's contig/chromosome names.
-  // Note that this reads the file <_ref_assembly_fasta>.names, and will create the file if necessary.
+  // Note that this reads the index <_ref_assembly_fasta>.fai (or the older <_ref_assembly_fasta>.names), and will create the index if necessary.
   if ( _ref_contig_names.empty() ) _ref_contig_names = GetFastaNames( _ref_assembly_fasta );
   return &_ref_contig_names;
 }
@@ -333,7 +387,7 @@ vector<string> *
 RunParams::LoadDraftContigNames() const
 {
   // If this function hasn't already been run, parse the fasta file and get the draft contig names.
-  // Note that this reads the file <_draft_assembly_fasta>.names, and will create the file if necessary.
+  // Note that this reads the index <_draft_assembly_fasta>.fai (or the older <_draft_assembly_fasta>.names), and will create the index if necessary.
   if ( _draft_contig_names.empty() ) _draft_contig_names = GetFastaNames( _draft_assembly_fasta );
   return &_draft_contig_names;
 }
@@ -341,17 +395,17 @@ RunParams::LoadDraftContigNames() const
 
 
 // Get the filename that contains the number of restriction enzyme sites for each contig in the draft assembly.  This might require generating the file,
-// by calling the script CountMotifsInFasta.pl.
+// by calling CountMotifsInFasta() (see TextFileParsers.h).
 string
 RunParams::DraftContigRESitesFilename() const
 {
   string RE_sites_file = _draft_assembly_fasta + ".counts_" + _RE_site_seq + ".txt";
 
-  // If this function hasn't already been run, the file may not exist, in which case the script CountMotifsInFasta.pl needs to be run.
+  // If this function hasn't already been run, the file may not exist, in which case the RE sites need to be counted.  (This makes the same file as the
+  // script CountMotifsInFasta.pl.)
   if ( !boost::filesystem::is_regular_file( RE_sites_file ) ) {
-    string cmd = "CountMotifsInFasta.pl " + _draft_assembly_fasta + " " + _RE_site_seq;
-    system( cmd.c_str() );
-    assert( boost::filesystem::is_regular_file( RE_sites_file ) ); // if this fails, the CountMotifsInFasta.pl script didn't run correctly
+    StageTimer timer( "count RE sites" );
+    CountMotifsInFasta( _draft_assembly_fasta, _RE_site_seq, RE_sites_file, _N_threads );
   }
 
   return RE_sites_file;
@@ -359,6 +413,19 @@ RunParams::DraftContigRESitesFilename() const
 
 
 
+// Get the tag that goes into the names of the cache files made from the Hi-C reads (all.links, all.GLM, group*.CLM), so that the caches made from a
+// subsample of the reads are kept apart from the full ones and from each other.  The tag is empty if all of the reads are used.
+string
+RunParams::CacheTag() const
+{
+  if ( _subsample_fraction == 1 ) return "";
+  ostringstream tag;
+  tag << ".sample" << _subsample_fraction;
+  return tag.str();
+}
+
+
+
 // Load a TrueMapping using the files in this RunParams object.
 // If _use_ref == false, returns a NULL pointer; otherwise returns a new object that must be 'delete'd later to save memory.
 TrueMapping *
@@ -380,7 +447,7 @@ RunParams::LoadTrueMapping() const
     _sim_bin_size != 0 ?
     new TrueMapping( _species, _sim_bin_size, _draft_contig_names, _ref_contig_names )
     :
-    new TrueMapping( _species, _draft_contig_names, _ref_contig_names, _BLAST_file_head, _out_dir, _SAM_files[0] );
+    new TrueMapping( _species, _draft_contig_names, _ref_contig_names, _BLAST_file_head, _out_dir, _SAM_files[0], _N_threads );
 
 
   // Remove heterochromatic regions from the fly reference.
@@ -56,9 +56,12 @@ class RunParams
   vector<string> * LoadDraftContigNames() const;
 
   // Get the filename that contains the number of restriction enzyme sites for each contig in the draft assembly.  This might require generating the file,
-  // by calling the script CountMotifsInFasta.pl.
+  // by calling CountMotifsInFasta() (see TextFileParsers.h).
   string DraftContigRESitesFilename() const;
 
+  // Get the tag for the names of the cache files made from the Hi-C reads: "" if SUBSAMPLE_FRACTION = 1, and otherwise ".sample<fraction>".
+  string CacheTag() const;
+
   // Load a TrueMapping using the files in this RunParams object.
   // If _use_ref == false, returns a NULL pointer; otherwise returns a new object that must be 'delete'd later to save memory.
   TrueMapping * LoadTrueMapping() const;
@@ -78,7 +81,7 @@ class RunParams
   string _draft_assembly_fasta; // FASTA file of draft assembly
   string _SAM_dir; // directory containing SAM/BAM files
   vector<string> _SAM_files; // the set of SAM/BAM files
-  string _RE_site_seq; // used in LoadDraftContigRESites(), which passes it to CountMotifsInFasta.pl
+  string _RE_site_seq; // used in DraftContigRESitesFilename(), which passes it to CountMotifsInFasta()
 
   // Reference assembly files (optional).
   bool _use_ref;
@@ -104,6 +107,17 @@ class RunParams
   int _report_quality_filter;
   bool _report_draw_heatmap;
 
+  // Optional parameters.  These keys may be left out of the INI file, in which case they take default values.
+  bool _text_cache_files; // write the cache files (all.GLM, group*.CLM) in the human-readable text format instead of the faster binary format
+  int _N_threads; // maximum number of threads to use in parallel steps (e.g., reading SAM files); 0 means one per processor core
+  int _GLM_memory_budget; // if > 0, read the GLM (cached_data/all.GLM) from disk as needed during clustering, keeping about this many megabytes of it in memory
+  int _CLM_memory_budget; // if > 0, build the CLM files with about this many megabytes of memory, spilling the Hi-C links to disk; 0 means build them in memory
+  double _order_refine_seconds; // if > 0, refine each group's full ordering by simulated annealing for about this many seconds; 0 means no refinement
+  bool _compact_storage; // store the CLMs' link distances as 16-bit codes (in memory and in the cache files), and the GLM file's link counts in 32 bits
+  double _order_checkpoint_seconds; // if > 0, checkpoint each group's ordering in progress about this often, so an interrupted run can resume; 0 means never
+  bool _report_scaffolded_fasta; // in reporting, write the output assembly (Lachesis_assembly.fasta and .agp), as CreateScaffoldedFasta.pl does
+  double _subsample_fraction; // if < 1, use only this fraction of the read pairs, chosen deterministically by read name, for a quick preview run
+
  private:
   // A listing of all of the lines from the ini file that were used in the creation of this RunParams object.
   vector<string> _params;
@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+// For documentation, see SAMIngest.h
+#include "SAMIngest.h"
+
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <algorithm> // min
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+
+// ForEachSAMFile: For each SAM file i, call work(i,log) on one of up to N_threads worker threads, then call merge(i) on the calling thread.
+void
+ForEachSAMFile( const vector<string> & SAM_files, const int N_threads,
+		const function< void( const size_t, ostream & ) > & work,
+		const function< void( const size_t ) > & merge )
+{
+  const size_t N_files = SAM_files.size();
+  const size_t N_workers = min( (size_t) NThreadsToUse( N_threads ), N_files );
+
+  // With only one worker, there's no need for any of the machinery below.
+  if ( N_workers <= 1 ) {
+    for ( size_t i = 0; i < N_files; i++ ) {
+      work( i, cout );
+      if ( merge ) merge( i );
+    }
+    return;
+  }
+
+
+  // Shared state.  The workers take files in order from a common counter, so the earliest files finish first (roughly) and the merging can get started.
+  vector<ostringstream> logs( N_files );
+  vector<bool> done( N_files, false );
+  size_t next_file = 0;
+  mutex m;
+  condition_variable file_done;
+
+  vector<thread> workers;
+  for ( size_t t = 0; t < N_workers; t++ )
+    workers.push_back( thread( [&]() {
+	  while ( 1 ) {
+	    size_t i;
+	    {
+	      lock_guard<mutex> lock( m );
+	      if ( next_file == N_files ) return;
+	      i = next_file++;
+	    }
+
+	    work( i, logs[i] );
+
+	    {
+	      lock_guard<mutex> lock( m );
+	      done[i] = true;
+	    }
+	    file_done.notify_all();
+	  }
+	} ) );
+
+
+  // Print the logs and merge the results in file order, as each file becomes available.
+  for ( size_t i = 0; i < N_files; i++ ) {
+    {
+      unique_lock<mutex> lock( m );
+      file_done.wait( lock, [&]() { return done[i]; } );
+    }
+    cout << logs[i].str() << flush;
+    logs[i].str( "" );
+    if ( merge ) merge( i );
+  }
+
+  for ( size_t t = 0; t < N_workers; t++ )
+    workers[t].join();
+}
@@ -0,0 +1,58 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+/**************************************************************************************************************************************************************
+ *
+ * SAMIngest.h
+ *
+ * A small engine for reading a set of SAM/BAM files in parallel.  Reading the Hi-C alignments is the slowest step in building a GenomeLinkMatrix, a set of
+ * ChromLinkMatrices, or a LinkSizeDistribution: almost all of the time is spent decompressing and parsing the files, one alignment at a time.  The files are
+ * independent of each other, so ForEachSAMFile() gives each file its own worker thread with its own SAMStepper.
+ *
+ * Each worker fills a thread-local accumulator (supplied by the caller), and writes its console output (e.g., the '.' progress dots) to its own log stream.
+ * The logs are printed, and the accumulators merged, strictly in the order of the input files.  Hence the output, and the resulting data structure, are
+ * exactly the same as if the files had been read one at a time.
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+#ifndef _SAM_INGEST__H
+#define _SAM_INGEST__H
+
+#include "Parallel.h" // NThreadsToUse
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <functional>
+using namespace std;
+
+
+
+// ForEachSAMFile: For each SAM file i, call work(i,log) on one of up to N_threads worker threads, then call merge(i) on the calling thread.
+// -- work(i,log) should read SAM_files[i] into a thread-local accumulator, writing any console output to log rather than to cout.  Calls to work() must not
+//    modify any shared data.
+// -- merge(i) should add the accumulator for file i into the final result.  The merge() calls happen in file order, each one right after file i's log is
+//    printed to cout.  merge may be NULL.
+// If only one thread is used, the files are simply read in order, with output going straight to cout.
+void ForEachSAMFile( const vector<string> & SAM_files, const int N_threads,
+		     const function< void( const size_t, ostream & ) > & work,
+		     const function< void( const size_t ) > & merge );
+
+
+#endif
@@ -0,0 +1,385 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+// For documentation, see ScaffoldedFasta.h
+#include "ScaffoldedFasta.h"
+#include "ContigOrdering.h"
+#include "MappedFile.h"
+#include "Parallel.h" // NThreadsToUse, ParallelForRanges
+#include "TextFileParsers.h" // GetFastaIndex
+
+#include <assert.h>
+#include <stdio.h> // rename
+#include <stdlib.h> // exit
+#include <string.h> // memchr, memcpy, strerror
+#include <errno.h>
+#include <fcntl.h> // open
+#include <unistd.h> // pwrite, ftruncate, close
+#include <inttypes.h> // int64_t, uint64_t
+#include <algorithm> // min
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+// Modules in ~/include (must add -L~/include and -lJ<module> to link)
+#include "TimeMem.h" // StageTimer
+
+
+
+static const int UNKNOWN_GAP_SIZE = 1000; // the size of gaps between contigs whose size isn't known, as in CreateScaffoldedFasta.pl
+static const int64_t FASTA_LINE_LEN = 80; // number of bases per line in the output FASTA
+
+
+
+// ScaffoldPiece: A piece of an output sequence: a contig in some orientation, or a gap.  Only the first length bases of the (oriented) contig are used;
+// this is less than the contig's length only if the contig ends the scaffold and ends in N's, which are trimmed off.
+struct ScaffoldPiece
+{
+  int contig; // contig ID, or -1 for a gap
+  bool rc;
+  int64_t length;
+  bool known_size; // gaps only: whether the size of the gap is known (from the ordering file)
+};
+
+// OutputSequence: A sequence in the output FASTA, and its place in the file.
+struct OutputSequence
+{
+  string name;
+  vector<ScaffoldPiece> pieces;
+  int64_t length;
+  uint64_t offset; // byte offset of the header line
+  uint64_t N_bytes; // header line plus sequence lines
+
+  OutputSequence( const string & name_ ) : name( name_ ), length( 0 ), offset( 0 ), N_bytes( 0 ) {}
+  void AddContig( const int contig, const bool rc, const int64_t len ) { ScaffoldPiece p = { contig, rc, len, true }; pieces.push_back(p); length += len; }
+  void AddGap( const int64_t len, const bool known_size ) { ScaffoldPiece p = { -1, false, len, known_size }; pieces.push_back(p); length += len; }
+};
+
+
+
+// ComplementTable: The complement of each character, as in CreateScaffoldedFasta.pl: all IUPAC codes are complemented, in either case, and everything
+// else (including N's) stays the same.
+struct ComplementTable
+{
+  char c[256];
+  ComplementTable()
+  {
+    for ( int i = 0; i < 256; i++ ) c[i] = char(i);
+    const char * codes = "ACGTacgtRYrySWswKMkmBDHVbdhv", * complements = "TGCAtgcaYRyrWSwsMKmkVHDBvhdb";
+    for ( int i = 0; codes[i]; i++ ) c[ (unsigned char) codes[i] ] = complements[i];
+  }
+};
+
+
+// ReverseComplement: Reverse-complement the sequence [begin,end) in place, swapping the bases in from both ends at once.
+static void
+ReverseComplement( char * begin, char * end )
+{
+  static const ComplementTable table;
+  char * a = begin, * b = end - 1;
+  for ( ; a < b; a++, b-- ) {
+    const char x = table.c[ (unsigned char) *a ];
+    *a = table.c[ (unsigned char) *b ];
+    *b = x;
+  }
+  if ( a == b ) *a = table.c[ (unsigned char) *a ];
+}
+
+
+
+
+// FastaContigs: The draft assembly FASTA, memory-mapped, with the location of each contig's sequence in it.
+class FastaContigs
+{
+ public:
+  FastaContigs( const string & fasta_file )
+    : _file( fasta_file )
+  {
+    GetFastaIndex( fasta_file, _names, _lengths, _offsets );
+  }
+
+  size_t N_contigs() const { return _names.size(); }
+  const string & name( const int ID ) const { return _names[ID]; }
+  int64_t length( const int ID ) const { return _lengths[ID]; }
+
+  // GetSequence: Copy contig #ID's sequence (in the given orientation) into seq, without the line breaks.
+  void GetSequence( const int ID, const bool rc, vector<char> & seq ) const
+  {
+    seq.resize( _lengths[ID] );
+    const char * data = _file.data();
+    size_t pos = _offsets[ID];
+    int64_t N_bases = 0;
+
+    // Copy the sequence a line at a time.
+    while ( N_bases < _lengths[ID] ) {
+      if ( pos >= _file.size() ) {
+	cerr << "ERROR: WriteScaffoldedFasta: the FASTA file " << _file.file() << " is shorter than its index (" << _file.file() << ".fai) says.  Delete the index and Lachesis will remake it." << endl;
+	exit(1);
+      }
+      const char * newline = (const char *) memchr( data + pos, '\n', _file.size() - pos );
+      size_t line_stop = ( newline == NULL ? _file.size() : newline - data );
+      if ( line_stop > pos && data[line_stop-1] == '\r' ) line_stop--;
+      const int64_t N = min( int64_t( line_stop - pos ), _lengths[ID] - N_bases );
+      memcpy( seq.data() + N_bases, data + pos, N );
+      N_bases += N;
+      pos = ( newline == NULL ? _file.size() : newline - data + 1 );
+    }
+
+    if ( rc ) ReverseComplement( seq.data(), seq.data() + seq.size() );
+  }
+
+ private:
+  const MappedFile _file;
+  vector<string> _names;
+  vector<int64_t> _lengths, _offsets;
+};
+
+
+
+
+// FastaWriter: Stream one sequence into its place in the output file, a buffer at a time, breaking it into lines of FASTA_LINE_LEN bases.
+class FastaWriter
+{
+ public:
+  FastaWriter( const int fd, const string & file ) : _fd( fd ), _file( file ), _offset( 0 ), _column( 0 ) { _buffer.reserve( BUFFER_SIZE ); }
+
+  void Start( const OutputSequence & seq )
+  {
+    _offset = seq.offset;
+    _column = 0;
+    _buffer.push_back( '>' );
+    _buffer.insert( _buffer.end(), seq.name.begin(), seq.name.end() );
+    _buffer.push_back( '\n' );
+  }
+
+  // Append: Append N bases, copied from seq, or N N's if seq is NULL.
+  void Append( const char * seq, int64_t N )
+  {
+    while ( N > 0 ) {
+      const int64_t N_line = min( N, FASTA_LINE_LEN - _column );
+      if ( seq != NULL ) { _buffer.insert( _buffer.end(), seq, seq + N_line ); seq += N_line; }
+      else _buffer.insert( _buffer.end(), N_line, 'N' );
+      N -= N_line;
+      _column += N_line;
+      if ( _column == FASTA_LINE_LEN ) { _buffer.push_back( '\n' ); _column = 0; }
+      if ( _buffer.size() >= BUFFER_SIZE ) Flush();
+    }
+  }
+
+  // Finish: End the last line of the sequence, write out the rest of it, and return the offset just past it.
+  uint64_t Finish()
+  {
+    if ( _column > 0 ) _buffer.push_back( '\n' );
+    Flush();
+    return _offset;
+  }
+
+ private:
+  void Flush()
+  {
+    for ( size_t N_written = 0; N_written < _buffer.size(); ) {
+      const ssize_t N = pwrite( _fd, _buffer.data() + N_written, _buffer.size() - N_written, _offset + N_written );
+      if ( N <= 0 ) {
+	cerr << "ERROR: WriteScaffoldedFasta: failed to write to file " << _file << ": " << strerror( errno ) << endl;
+	exit(1);
+      }
+      N_written += N;
+    }
+    _offset += _buffer.size();
+    _buffer.clear();
+  }
+
+  static const size_t BUFFER_SIZE = 1 << 22;
+  const int _fd;
+  const string _file;
+  uint64_t _offset;
+  int64_t _column;
+  vector<char> _buffer;
+};
+
+
+
+
+// WriteAGP: Write the AGP file that describes the output sequences.  Each sequence is an object; its components are the contigs and gaps in it.
+static void
+WriteAGP( const string & AGP_file, const vector<OutputSequence> & seqs, const FastaContigs & fasta )
+{
+  ofstream out( AGP_file.c_str(), ios::out );
+  out << "##agp-version\t2.1" << endl;
+  out << "# Made by Lachesis.  The gaps between contigs in the same scaffold are of type N if their size is known, and type U otherwise." << endl;
+
+  for ( size_t i = 0; i < seqs.size(); i++ ) {
+    int64_t start = 1;
+    int part = 1;
+    for ( size_t j = 0; j < seqs[i].pieces.size(); j++ ) {
+      const ScaffoldPiece & p = seqs[i].pieces[j];
+      if ( p.length == 0 ) continue; // an empty contig has no place in the AGP
+      out << seqs[i].name << '\t' << start << '\t' << start + p.length - 1 << '\t' << part++ << '\t';
+      if ( p.contig == -1 )
+	out << ( p.known_size ? 'N' : 'U' ) << '\t' << p.length << "\tscaffold\tyes\tproximity_ligation" << endl;
+      else {
+	// A contig whose end was trimmed off is only used from its beginning, in the scaffold's orientation.
+	const int64_t len = fasta.length( p.contig );
+	out << "W\t" << fasta.name( p.contig ) << '\t' << ( p.rc ? len - p.length + 1 : 1 ) << '\t' << ( p.rc ? len : p.length ) << '\t' << ( p.rc ? '-' : '+' ) << endl;
+      }
+      start += p.length;
+    }
+  }
+
+  out.close();
+  if ( !out ) {
+    cerr << "ERROR: WriteScaffoldedFasta: failed to write file " << AGP_file << endl;
+    exit(1);
+  }
+}
+
+
+
+
+void
+WriteScaffoldedFasta( const RunParams & run_params, const ClusterVec & clusters )
+{
+  StageTimer timer( "write scaffolded fasta" );
+  const string fasta_out = run_params._out_dir + "/Lachesis_assembly.fasta";
+  const string AGP_out   = run_params._out_dir + "/Lachesis_assembly.agp";
+  cout << "WriteScaffoldedFasta with input fasta = " << run_params._draft_assembly_fasta << ", writing " << fasta_out << " and " << AGP_out << endl;
+
+  const FastaContigs fasta( run_params._draft_assembly_fasta );
+  if ( (int) fasta.N_contigs() != clusters.N_contigs() ) {
+    cerr << "ERROR: WriteScaffoldedFasta: the clusters have " << clusters.N_contigs() << " contigs, but the FASTA file " << run_params._draft_assembly_fasta
+	 << " has " << fasta.N_contigs() << ".  Was Lachesis run on this assembly?" << endl;
+    exit(1);
+  }
+
+  const ClusterIndex cluster_index( clusters );
+  vector<OutputSequence> seqs;
+  vector<bool> contig_used( fasta.N_contigs(), false );
+  vector<char> seq;
+
+
+  // PHASE 1: For each ordering, make a single scaffold.
+  int N_scaffolds = 0;
+  for ( size_t i = 0; i < clusters.size(); i++ ) {
+    const string order_file = run_params._out_dir + "/main_results/group" + boost::lexical_cast<string>(i) + ".ordering";
+    if ( !boost::filesystem::is_regular_file( order_file ) ) continue;
+    const ContigOrdering order( order_file );
+    if ( order.N_contigs_used() == 0 ) continue; // e.g., a singleton group
+    assert( order.N_contigs() == cluster_index.cluster_size(i) );
+
+    OutputSequence scaffold( "" );
+    for ( int j = 0; j < order.N_contigs_used(); j++ ) {
+      const int ID = cluster_index.member( i, order.contig_ID(j) );
+      contig_used[ID] = true;
+      scaffold.AddContig( ID, order.contig_rc(j), fasta.length(ID) );
+      const int gap = order.gap_size(j);
+      if ( j+1 < order.N_contigs_used() && gap != 0 ) scaffold.AddGap( gap < 0 ? UNKNOWN_GAP_SIZE : gap, gap >= 0 );
+    }
+
+    // As in CreateScaffoldedFasta.pl, remove any N's at the end of the scaffold.
+    while ( !scaffold.pieces.empty() ) {
+      ScaffoldPiece & p = scaffold.pieces.back();
+      int64_t N_trailing_Ns = p.length;
+      if ( p.contig != -1 ) {
+	fasta.GetSequence( p.contig, p.rc, seq );
+	N_trailing_Ns = 0;
+	while ( N_trailing_Ns < p.length && seq[ p.length - N_trailing_Ns - 1 ] == 'N' ) N_trailing_Ns++;
+      }
+      p.length -= N_trailing_Ns;
+      scaffold.length -= N_trailing_Ns;
+      if ( p.length > 0 ) break;
+      scaffold.pieces.pop_back();
+    }
+
+    scaffold.name = "Lachesis_group" + boost::lexical_cast<string>(i) + "__" + boost::lexical_cast<string>( order.N_contigs_used() ) + "_contigs__length_" + boost::lexical_cast<string>( scaffold.length );
+    cout << "Scaffold from " << order_file << ": " << order.N_contigs_used() << " contigs, length = " << scaffold.length << endl;
+    seqs.push_back( scaffold );
+    N_scaffolds++;
+  }
+
+
+  // PHASE 2: Each contig that is clustered into a group but not ordered within that group.
+  int N_unordered_contigs = 0;
+  for ( size_t i = 0; i < clusters.size(); i++ )
+    for ( set<int>::const_iterator it = clusters[i].begin(); it != clusters[i].end(); ++it ) {
+      if ( contig_used[*it] ) continue;
+      contig_used[*it] = true;
+      seqs.push_back( OutputSequence( fasta.name(*it) + "__unordered_in_group" + boost::lexical_cast<string>(i) ) );
+      seqs.back().AddContig( *it, false, fasta.length(*it) );
+      N_unordered_contigs++;
+    }
+
+
+  // PHASE 3: Each contig that is not clustered.
+  int N_unclustered_contigs = 0;
+  for ( size_t ID = 0; ID < fasta.N_contigs(); ID++ ) {
+    if ( contig_used[ID] ) continue;
+    seqs.push_back( OutputSequence( fasta.name(ID) + "__unclustered" ) );
+    seqs.back().AddContig( ID, false, fasta.length(ID) );
+    N_unclustered_contigs++;
+  }
+
+  cout << "WriteScaffoldedFasta: " << N_scaffolds << " scaffolds, " << N_unordered_contigs << " contigs that were clustered but not ordered, and "
+       << N_unclustered_contigs << " contigs that were not clustered" << endl;
+
+
+  // Lay out the output file.  Each sequence takes its header line, plus its bases, plus a newline for each line of bases.
+  uint64_t file_size = 0;
+  for ( size_t i = 0; i < seqs.size(); i++ ) {
+    seqs[i].offset = file_size;
+    seqs[i].N_bytes = seqs[i].name.size() + 2 + seqs[i].length + ( seqs[i].length + FASTA_LINE_LEN - 1 ) / FASTA_LINE_LEN;
+    file_size += seqs[i].N_bytes;
+  }
+
+  // Write the sequences into their places, on up to N_THREADS threads.  Each thread takes the next sequence not yet written, so the (big) scaffolds,
+  // which come first, are spread out over the threads.  The file is written under a temporary name and then moved into place, so it's never incomplete.
+  const string tmp_file = fasta_out + ".tmp";
+  const int fd = open( tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+  if ( fd == -1 || ftruncate( fd, file_size ) != 0 ) {
+    cerr << "ERROR: WriteScaffoldedFasta: can't create file " << tmp_file << ": " << strerror( errno ) << endl;
+    exit(1);
+  }
+
+  atomic<size_t> next_seq( 0 );
+  const int N_threads = min( NThreadsToUse( run_params._N_threads ), int( max( seqs.size(), size_t(1) ) ) );
+  ParallelForRanges( N_threads, N_threads, [&]( const int, const size_t, const size_t ) {
+      FastaWriter writer( fd, tmp_file );
+      vector<char> contig_seq;
+      for ( size_t i = next_seq++; i < seqs.size(); i = next_seq++ ) {
+	writer.Start( seqs[i] );
+	for ( size_t j = 0; j < seqs[i].pieces.size(); j++ ) {
+	  const ScaffoldPiece & p = seqs[i].pieces[j];
+	  if ( p.contig == -1 ) writer.Append( NULL, p.length );
+	  else {
+	    fasta.GetSequence( p.contig, p.rc, contig_seq );
+	    writer.Append( contig_seq.data(), p.length );
+	  }
+	}
+	const uint64_t end = writer.Finish();
+	assert( end == seqs[i].offset + seqs[i].N_bytes );
+      }
+    } );
+
+  if ( close( fd ) != 0 || rename( tmp_file.c_str(), fasta_out.c_str() ) != 0 ) {
+    cerr << "ERROR: WriteScaffoldedFasta: failed to write file " << fasta_out << ": " << strerror( errno ) << endl;
+    exit(1);
+  }
+
+  WriteAGP( AGP_out, seqs, fasta );
+  cout << "WriteScaffoldedFasta: done!  Wrote " << seqs.size() << " sequences (" << file_size << " bytes) to " << fasta_out << endl;
+}
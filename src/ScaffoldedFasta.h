@@ -0,0 +1,55 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+/**************************************************************************************************************************************************************
+ *
+ * ScaffoldedFasta.h
+ *
+ * WriteScaffoldedFasta() writes the final output assembly: the draft contigs, put together into one scaffold per group as the group*.ordering files say.
+ * It makes the same FASTA as the script CreateScaffoldedFasta.pl, and also describes it in the AGP format (version 2.1), which records where each contig
+ * and gap is in the scaffolds.
+ *
+ * The draft assembly FASTA is memory-mapped, and its contigs are found via its index (<fasta-file>.fai; see GetFastaIndex() in TextFileParsers.h), so
+ * only the sequence that's written is ever read.  The size of every sequence in the output is known in advance, so the output file is laid out first, and
+ * then the scaffolds are written into their places in parallel, each one streamed out a buffer at a time.
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+#ifndef _SCAFFOLDED_FASTA__H
+#define _SCAFFOLDED_FASTA__H
+
+#include "RunParams.h"
+#include "ClusterVec.h"
+
+#include <string>
+using namespace std;
+
+
+
+// WriteScaffoldedFasta: Write the output assembly to <OUTPUT_DIR>/Lachesis_assembly.fasta, using the clusters and the orderings in
+// <OUTPUT_DIR>/main_results/group*.ordering (a group without an ordering file is taken to be unordered), with up to N_THREADS threads.  Also write its
+// description to <OUTPUT_DIR>/Lachesis_assembly.agp.  As in CreateScaffoldedFasta.pl, the FASTA contains, in order:
+// 1. One scaffold for each group with contigs ordered: its contigs in order and orientation, separated by gaps of N's of the sizes in the ordering file
+//    (or 1000 bp, where the size isn't known.)  The scaffold is named "Lachesis_group<i>__<N>_contigs__length_<length>".
+// 2. Each contig that's clustered into a group but not ordered in it, named "<contig>__unordered_in_group<i>".
+// 3. Each contig that isn't clustered, named "<contig>__unclustered".
+void WriteScaffoldedFasta( const RunParams & run_params, const ClusterVec & clusters );
+
+
+
+#endif
@@ -0,0 +1,163 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+// For documentation, see SyntheticHiC.h
+#include "SyntheticHiC.h"
+
+#include <stdlib.h> // exit
+#include <math.h> // log, exp
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm> // shuffle, upper_bound
+#include <numeric> // accumulate
+#include <random>
+using namespace std;
+
+#include <boost/lexical_cast.hpp>
+
+
+
+// The range of the distance between the two reads in a simulated read pair.
+static const double MIN_LINK_DIST = 100;
+static const double MAX_LINK_DIST = 1e8;
+
+
+
+// MakeSyntheticHiC: Make the synthetic genome and simulate Hi-C read pairs on it.
+int64_t
+MakeSyntheticHiC( const SyntheticHiCParams & params, const string & SAM_file, const string & RE_sites_file, vector<int> * true_groups )
+{
+  mt19937_64 rng( params.seed );
+  uniform_real_distribution<double> unif( 0, 1 );
+
+  // Make the contigs, and lay them out on the chromosomes, in random order and orientation.
+  const int N = params.N_contigs;
+  vector<int> lens( N );
+  for ( int i = 0; i < N; i++ )
+    lens[i] = params.min_contig_len + int( unif(rng) * ( params.max_contig_len - params.min_contig_len + 1 ) );
+
+  vector<int> order( N );
+  for ( int i = 0; i < N; i++ ) order[i] = i;
+  shuffle( order.begin(), order.end(), rng );
+
+  const int N_groups = min( params.N_groups, N );
+  vector< vector<int> > chrom_contigs( N_groups ); // contigs on each chromosome, in order
+  vector< vector<int64_t> > chrom_starts( N_groups ); // start of each contig on its chromosome
+  vector<int64_t> chrom_lens( N_groups, 0 );
+  vector<bool> rc( N );
+  for ( int i = 0; i < N; i++ ) {
+    const int c = order[i], chrom = i % N_groups;
+    rc[c] = unif(rng) < 0.5;
+    chrom_contigs[chrom].push_back( c );
+    chrom_starts[chrom].push_back( chrom_lens[chrom] );
+    chrom_lens[chrom] += lens[c];
+  }
+  if ( true_groups != NULL ) {
+    true_groups->resize( N );
+    for ( int chrom = 0; chrom < N_groups; chrom++ )
+      for ( size_t i = 0; i < chrom_contigs[chrom].size(); i++ )
+	(*true_groups)[ chrom_contigs[chrom][i] ] = chrom;
+  }
+  const int64_t genome_len = accumulate( chrom_lens.begin(), chrom_lens.end(), int64_t(0) );
+
+  // Pick a chromosome at random, weighted by length.
+  auto random_chrom = [&]() {
+    int64_t x = int64_t( unif(rng) * genome_len );
+    int chrom = 0;
+    while ( chrom+1 < N_groups && x >= chrom_lens[chrom] ) { x -= chrom_lens[chrom]; chrom++; }
+    return chrom;
+  };
+
+  // Find the contig and (forward-strand) contig position of a position on a chromosome.
+  auto locate = [&]( const int chrom, const int64_t x, int & contig, int & pos ) {
+    const vector<int64_t> & starts = chrom_starts[chrom];
+    const size_t i = upper_bound( starts.begin(), starts.end(), x ) - starts.begin() - 1;
+    contig = chrom_contigs[chrom][i];
+    pos = x - starts[i];
+    if ( rc[contig] ) pos = lens[contig] - 1 - pos;
+  };
+
+
+  // Write the RE sites file.  Say there's an RE site every 256 bp (roughly the density of a 4-bp motif.)
+  ofstream RE_out( RE_sites_file.c_str(), ios::out );
+  for ( int i = 0; i < N; i++ )
+    RE_out << "contig" << i << '\t' << lens[i] / 256 << '\n';
+  RE_out.close();
+
+
+  // Write the SAM file.  The header lists the contigs; then each read pair is two consecutive records.
+  ofstream out( SAM_file.c_str(), ios::out );
+  if ( !out ) {
+    cerr << "ERROR: MakeSyntheticHiC: Can't write to file " << SAM_file << endl;
+    exit(1);
+  }
+  out << "@HD\tVN:1.0\tSO:unsorted\n";
+  for ( int i = 0; i < N; i++ )
+    out << "@SQ\tSN:contig" << i << "\tLN:" << lens[i] << '\n';
+
+  const int64_t N_pairs = int64_t( N ) * params.links_per_contig;
+  const double log_dist_range = log( MAX_LINK_DIST / MIN_LINK_DIST );
+  for ( int64_t k = 0; k < N_pairs; k++ ) {
+    int chrom1 = random_chrom(), chrom2 = chrom1;
+    int64_t x1 = int64_t( unif(rng) * chrom_lens[chrom1] ), x2;
+
+    // Pick the position of the second read.  The distance is drawn from a 1/x distribution (i.e., its log is uniform.)  If it falls off the end of the
+    // chromosome, try again.
+    if ( unif(rng) < params.noise ) {
+      chrom2 = random_chrom();
+      x2 = int64_t( unif(rng) * chrom_lens[chrom2] );
+    }
+    else
+      while ( 1 ) {
+	const int64_t dist = int64_t( MIN_LINK_DIST * exp( unif(rng) * log_dist_range ) );
+	x2 = unif(rng) < 0.5 ? x1 - dist : x1 + dist;
+	if ( x2 >= 0 && x2 < chrom_lens[chrom1] ) break;
+      }
+
+    int contig1, pos1, contig2, pos2;
+    locate( chrom1, x1, contig1, pos1 );
+    locate( chrom2, x2, contig2, pos2 );
+
+    // SAM positions are 1-based.
+    const string mate1 = contig1 == contig2 ? "=" : "contig" + boost::lexical_cast<string>( contig2 );
+    const string mate2 = contig1 == contig2 ? "=" : "contig" + boost::lexical_cast<string>( contig1 );
+    out << 'r' << k << "\t65\tcontig"  << contig1 << '\t' << pos1+1 << "\t60\t50M\t" << mate1 << '\t' << pos2+1 << "\t0\t*\t*\n";
+    out << 'r' << k << "\t129\tcontig" << contig2 << '\t' << pos2+1 << "\t60\t50M\t" << mate2 << '\t' << pos1+1 << "\t0\t*\t*\n";
+  }
+
+  out.close();
+  if ( out.fail() ) {
+    cerr << "ERROR: MakeSyntheticHiC: Failed writing to file " << SAM_file << endl;
+    exit(1);
+  }
+  return N_pairs;
+}
+
+
+
+
+// SyntheticContigNames: The names of the contigs in a synthetic data set.
+vector<string>
+SyntheticContigNames( const int N_contigs )
+{
+  vector<string> names( N_contigs );
+  for ( int i = 0; i < N_contigs; i++ )
+    names[i] = "contig" + boost::lexical_cast<string>( i );
+  return names;
+}
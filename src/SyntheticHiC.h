@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+/**************************************************************************************************************************************************************
+ *
+ * SyntheticHiC.h
+ *
+ * Synthetic Hi-C data, for LachesisBench and TestLachesis.  MakeSyntheticHiC() makes a synthetic genome, with N_groups chromosomes that have been broken
+ * into contigs of random length, laid out in random order and orientation.  Then it simulates Hi-C read pairs on the genome: one read is placed at random,
+ * and the other is placed at a distance drawn from a 1/x distribution, so the link density falls off with distance as in real Hi-C data.  A fraction noise
+ * of the pairs are placed at random, anywhere in the genome.  The read pairs are written to a SAM file (unsorted, with the two reads of each pair in
+ * consecutive records), along with an RE sites file for the contigs.  The contigs are named "contig0", "contig1", etc.
+ *
+ * The data depend only on the parameters (including the seed), so they're the same on every run.
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+#ifndef _SYNTHETIC_HIC__H
+#define _SYNTHETIC_HIC__H
+
+#include <inttypes.h> // int64_t
+#include <string>
+#include <vector>
+using namespace std;
+
+
+
+// The parameters of a synthetic data set.
+struct SyntheticHiCParams
+{
+  int N_contigs, N_groups, links_per_contig;
+  double noise;
+  int min_contig_len, max_contig_len; // contig lengths are uniformly distributed in [min_contig_len,max_contig_len]
+  unsigned seed;
+};
+
+
+// MakeSyntheticHiC: Make the synthetic genome and simulate Hi-C read pairs on it.  Write the read pairs to a SAM file, and the number of RE sites on each
+// contig to an RE sites file (in the format made by CountMotifsInFasta.pl).  Return the number of read pairs.  If true_groups isn't NULL, fill it with the
+// chromosome that each contig came from.
+int64_t MakeSyntheticHiC( const SyntheticHiCParams & params, const string & SAM_file, const string & RE_sites_file, vector<int> * true_groups = NULL );
+
+
+// SyntheticContigNames: The names of the contigs in a synthetic data set.
+vector<string> SyntheticContigNames( const int N_contigs );
+
+
+#endif
@@ -0,0 +1,545 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+
+
+/**************************************************************************************************************************************************************
+ *
+ * TestLachesis.cc
+ *
+ * Tests of the fast paths in the Lachesis clustering and ordering code, against slower reference versions, on synthetic Hi-C data (see SyntheticHiC.h.)
+ * Like LachesisBench, this is a separate program, built with 'make TestLachesis'.  Each test prints one PASS or FAIL line; the program returns 1 if any
+ * test failed.
+ *
+ *
+ * Syntax: TestLachesis [ARG=value ...]
+ *
+ * OUT_DIR            Directory for the synthetic data and the cache files (default: test)
+ * SEED               Random seed for the synthetic data, and for the tests' random orderings and shreds (default: 1)
+ *
+ *
+ *************************************************************************************************************************************************************/
+
+
+
+// C libraries
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h> // strstr, used in ParsedArgs.h
+
+// STL declarations
+#include <string>
+#include <vector>
+#include <iostream>
+#include <utility> // pair
+#include <algorithm> // transform, used in ParsedArgs.h
+using namespace std;
+
+// Modules in ~/include (must add -L~/include and -lJ<module> to link)
+#include "TimeMem.h"
+#include "ParsedArgs.h"
+#include "gtools/SAMStepper.h" // TargetLengths
+
+// Boost includes
+#include <boost/lexical_cast.hpp>
+
+// Local includes
+#include "sam.h"  // from samtools 0.19; samopen etc., used in MakeIndexedBAM
+#include "ChromLinkMatrix.h"
+#include "LinkSizeDistribution.h"
+#include "HiCLinks.h"
+#include "ClusterVec.h"
+#include "ContigOrdering.h"
+#include "SyntheticHiC.h"
+
+
+
+// Heuristic parameters for ordering.  These are the values in the test case (see INIs/test_case.ini.)
+static const int ORDER_MIN_N_RES_IN_TRUNK = 15;
+static const int ORDER_MIN_N_RES_IN_SHREDS = 15;
+
+
+static int N_failed = 0;
+
+// Report: Print the result of one test.
+void
+Report( const string & test, const bool pass, const string & details )
+{
+  cout << ( pass ? "PASS" : "FAIL" ) << "\t" << test << "\t" << details << endl;
+  if ( !pass ) N_failed++;
+}
+
+
+
+// The synthetic data set that the tests run on: the Hi-C links, with the contigs clustered into their true chromosomes, a CLM for each cluster, and the
+// full ordering of each cluster, as made by MakeFullOrder().
+struct TestData
+{
+  string dir, SAM_file, RE_sites_file;
+  ClusterVec clusters;
+  vector<ChromLinkMatrix *> CLMs;
+  vector<ContigOrdering> orders;
+  LinkSizeDistribution * lsd;
+
+  TestData( const string & out_dir, const unsigned seed );
+  ~TestData();
+};
+
+
+TestData::TestData( const string & out_dir, const unsigned seed )
+  : dir( out_dir )
+{
+  // Make few enough contigs that SpaceContigs (with the exhaustive gap size searches) runs in a minute or so.
+  SyntheticHiCParams params;
+  params.N_contigs = 60;
+  params.N_groups = 3;
+  params.links_per_contig = 200;
+  params.noise = 0.05;
+  params.min_contig_len = 20000;
+  params.max_contig_len = 200000;
+  params.seed = seed;
+
+  system( ( "mkdir -p " + dir ).c_str() );
+  SAM_file = dir + "/synthetic.sam";
+  RE_sites_file = dir + "/synthetic.RE_sites.txt";
+  const string link_file = dir + "/all.links";
+  vector<int> true_groups;
+  MakeSyntheticHiC( params, SAM_file, RE_sites_file, &true_groups );
+  HiCLinkFile::Extract( vector<string>( 1, SAM_file ), link_file );
+  const HiCLinkFile links( link_file );
+
+  clusters = ClusterVec( true_groups );
+  CLMs.resize( clusters.size() );
+  for ( size_t i = 0; i < clusters.size(); i++ )
+    CLMs[i] = new ChromLinkMatrix( "test", clusters[i].size() );
+  LoadDeNovoCLMsFromLinks( links, RE_sites_file, clusters, CLMs );
+  lsd = new LinkSizeDistribution( links );
+
+  for ( size_t i = 0; i < clusters.size(); i++ ) {
+    CLMs[i]->MakeTrunkOrder( ORDER_MIN_N_RES_IN_TRUNK );
+    orders.push_back( CLMs[i]->MakeFullOrder( ORDER_MIN_N_RES_IN_SHREDS ) );
+  }
+}
+
+
+TestData::~TestData()
+{
+  for ( size_t i = 0; i < CLMs.size(); i++ )
+    delete CLMs[i];
+  delete lsd;
+}
+
+
+
+// The original LinkSizeDistribution::LinkBin(), before the table lookup in LinkBinOf(), with its helper functions, copied verbatim (except for dropping the
+// 'register' keyword).  TestLinkBin checks that the new version gives exactly the same bins.
+inline unsigned int
+uint_log2( const unsigned int x )
+{
+  static const unsigned int b[] = {0x2, 0xC, 0xF0, 0xFF00, 0xFFFF0000};
+  static const unsigned int S[] = {1, 2, 4, 8, 16};
+
+  unsigned int x2 = x;
+  unsigned int answer = 0;
+  if ( x2 & b[4] ) { x2 >>= S[4]; answer |= S[4]; }
+  if ( x2 & b[3] ) { x2 >>= S[3]; answer |= S[3]; }
+  if ( x2 & b[2] ) { x2 >>= S[2]; answer |= S[2]; }
+  if ( x2 & b[1] ) { x2 >>= S[1]; answer |= S[1]; }
+  if ( x2 & b[0] ) { x2 >>= S[0]; answer |= S[0]; }
+  return answer;
+}
+
+inline unsigned int
+uint_16log2_frac( const double x ) {
+
+  int l = 0;
+  double x2 = x * x;
+  if ( x2 > 2 ) { x2 /= 2; l += 8; }
+  x2 *= x2;
+  if ( x2 > 2 ) { x2 /= 2; l += 4; }
+  x2 *= x2;
+  if ( x2 > 2 ) { x2 /= 2; l += 2; }
+  x2 *= x2;
+  if ( x2 > 2 ) { x2 /= 2; l += 1; }
+
+  return l;
+}
+
+int
+OldLinkBin( const int dist )
+{
+  static const int _MIN_LINK_DIST = LinkSizeDistribution::_MIN_LINK_DIST;
+  if ( dist < _MIN_LINK_DIST ) return -1;
+
+  unsigned int dist_over_min = dist / _MIN_LINK_DIST;
+  unsigned int log2_i = uint_log2(dist_over_min);
+  int log2_f = uint_16log2_frac( double(dist) / ( _MIN_LINK_DIST << log2_i) );
+  return 16 * log2_i + log2_f;
+}
+
+
+
+// TestLinkBin: Compare LinkBin() and LinkBins() with the original LinkBin(), above, at every distance from a little below _MIN_LINK_DIST (where the bins
+// start) up to _MAX_LINK_DIST (where they end.)  LinkBins() is called on blocks of the distances, with a different offset D for each block.
+void
+TestLinkBin( const LinkSizeDistribution & lsd )
+{
+  static const int BLOCK = 4096;
+  vector<int> dists( BLOCK ), bins( BLOCK );
+  for ( int j = 0; j < BLOCK; j++ )
+    dists[j] = j;
+
+  int64_t N_tested = 0, N_mismatches = 0;
+  for ( int D = -BLOCK; D <= LinkSizeDistribution::_MAX_LINK_DIST; D += BLOCK ) {
+    lsd.LinkBins( &dists[0], BLOCK, D, &bins[0] );
+    for ( int j = 0; j < BLOCK; j++ ) {
+      const int old_bin = OldLinkBin( D + j );
+      if ( lsd.LinkBin( D + j ) != old_bin || bins[j] != old_bin ) N_mismatches++;
+      N_tested++;
+    }
+  }
+
+  Report( "LinkBin", N_mismatches == 0, boost::lexical_cast<string>( N_mismatches ) + " of " + boost::lexical_cast<string>( N_tested )
+	  + " distances binned differently from the original LinkBin()" );
+}
+
+
+
+
+// MakeIndexedBAM: Write a coordinate-sorted copy of a SAM file as a BAM file, and index it, as 'samtools sort' and 'samtools index' would.  The unaligned
+// reads go at the end.
+void
+MakeIndexedBAM( const string & SAM_file, const string & BAM_file )
+{
+  samfile_t * in = samopen( SAM_file.c_str(), "r", 0 );
+  assert( in != NULL );
+  vector<bam1_t *> aligns;
+  bam1_t * align = bam_init1();
+  while ( samread( in, align ) >= 0 ) {
+    aligns.push_back( align );
+    align = bam_init1();
+  }
+  bam_destroy1( align );
+
+  stable_sort( aligns.begin(), aligns.end(), []( const bam1_t * a, const bam1_t * b ) {
+      if ( a->core.tid != b->core.tid ) return uint32_t( a->core.tid ) < uint32_t( b->core.tid ); // tid = -1 sorts last
+      return a->core.pos < b->core.pos; } );
+
+  samfile_t * out = samopen( BAM_file.c_str(), "wb", in->header );
+  assert( out != NULL );
+  for ( size_t i = 0; i < aligns.size(); i++ ) {
+    samwrite( out, aligns[i] );
+    bam_destroy1( aligns[i] );
+  }
+  samclose( out );
+  samclose( in );
+  bam_index_build( BAM_file.c_str() );
+}
+
+
+
+// CLMDiffs: The number of cells (pairs of contigs, with orientations) in which two ChromLinkMatrices have different sets of links.
+int
+CLMDiffs( const ChromLinkMatrix & a, const ChromLinkMatrix & b )
+{
+  if ( a.N_contigs() != b.N_contigs() ) return -1;
+  int N_diffs = 0;
+  for ( int c1 = 0; c1 < a.N_contigs(); c1++ )
+    for ( int c2 = c1; c2 < a.N_contigs(); c2++ )
+      for ( int rc = 0; rc < 4; rc++ ) {
+	const LinkDistances la = a.Links( c1, rc & 1, c2, rc & 2 ), lb = b.Links( c1, rc & 1, c2, rc & 2 );
+	vector<int> da( la.begin(), la.end() ), db( lb.begin(), lb.end() );
+	sort( da.begin(), da.end() );
+	sort( db.begin(), db.end() );
+	if ( da != db ) N_diffs++;
+      }
+  return N_diffs;
+}
+
+
+
+// TestIndexedBAM: Make the CLMs from a coordinate-sorted, indexed BAM copy of the SAM file, which reads only the clusters' contigs, one cluster at a
+// time (see ReadCLMLinksFromIndexedBAM in ChromLinkMatrix.cc), and compare them with the CLMs made from the SAM file, which is read straight through.
+// They should have exactly the same links, with any number of threads, and from the single-cluster constructor as well.
+void
+TestIndexedBAM( const TestData & data )
+{
+  const string BAM_file = data.dir + "/synthetic.sorted.bam";
+  MakeIndexedBAM( data.SAM_file, BAM_file );
+
+  vector<ChromLinkMatrix *> SAM_CLMs( data.clusters.size() );
+  for ( size_t i = 0; i < data.clusters.size(); i++ )
+    SAM_CLMs[i] = new ChromLinkMatrix( "test", data.clusters[i].size() );
+  LoadDeNovoCLMsFromSAM( vector<string>( 1, data.SAM_file ), data.RE_sites_file, data.clusters, SAM_CLMs );
+  int64_t N_links = 0;
+  for ( size_t i = 0; i < SAM_CLMs.size(); i++ )
+    for ( int c1 = 0; c1 < SAM_CLMs[i]->N_contigs(); c1++ )
+      for ( int c2 = c1+1; c2 < SAM_CLMs[i]->N_contigs(); c2++ )
+	N_links += SAM_CLMs[i]->NLinks( c1, c2 );
+
+  for ( int N_threads = 1; N_threads <= 3; N_threads += 2 ) {
+    vector<ChromLinkMatrix *> BAM_CLMs( data.clusters.size() );
+    for ( size_t i = 0; i < data.clusters.size(); i++ )
+      BAM_CLMs[i] = new ChromLinkMatrix( "test", data.clusters[i].size() );
+    LoadDeNovoCLMsFromSAM( vector<string>( 1, BAM_file ), data.RE_sites_file, data.clusters, BAM_CLMs, N_threads );
+    int N_diffs = 0;
+    for ( size_t i = 0; i < data.clusters.size(); i++ ) {
+      const int diffs = CLMDiffs( *SAM_CLMs[i], *BAM_CLMs[i] );
+      N_diffs += diffs < 0 ? 1 : diffs;
+      delete BAM_CLMs[i];
+    }
+    Report( "IndexedBAM, " + boost::lexical_cast<string>( N_threads ) + " thread(s)", N_links > 0 && N_diffs == 0,
+	    boost::lexical_cast<string>( N_diffs ) + " cells differ between the CLMs from the indexed BAM and from the SAM (" +
+	    boost::lexical_cast<string>( N_links ) + " links)" );
+  }
+
+  const ChromLinkMatrix single( "test", vector<string>( 1, BAM_file ), data.RE_sites_file, data.clusters, 0 );
+  const int diffs = CLMDiffs( *SAM_CLMs[0], single );
+  Report( "IndexedBAM, one cluster", diffs == 0, boost::lexical_cast<string>( diffs ) + " cells differ in cluster 0" );
+
+  for ( size_t i = 0; i < SAM_CLMs.size(); i++ )
+    delete SAM_CLMs[i];
+}
+
+
+
+
+// PlainOrder: A copy of an ordering, without its orientation quality scores (see OrientContigs), so that it can be edited.
+ContigOrdering
+PlainOrder( const ContigOrdering & order )
+{
+  ContigOrdering plain( order.N_contigs(), false );
+  for ( int i = 0; i < order.N_contigs_used(); i++ )
+    plain.AddContig( order.contig_ID(i), -1, order.contig_rc(i) );
+  return plain;
+}
+
+
+
+// CompareOrderingScores: Compare OrderingScore() with OrderingScoreReference() on one ordering, with and without orientation: over the whole ordering,
+// around a position, and in ranges, including the ranges at the ends.  The kernels add up the same terms in the same order as the reference, so the scores
+// should be exactly equal.  Returns the number of scores that differ; adds the number compared, and the number that are nonzero, to N_scores and N_nonzero.
+int
+CompareOrderingScores( const ChromLinkMatrix & CLM, const ContigOrdering & order, int & N_scores, int & N_nonzero )
+{
+  const int N = order.N_contigs_used();
+  const int start = lrand48() % N;
+  vector< pair<int,int> > ranges;
+  ranges.push_back( make_pair( -1, -1 ) );
+  ranges.push_back( make_pair( 0, -1 ) );
+  ranges.push_back( make_pair( N, -1 ) );
+  ranges.push_back( make_pair( 1 + lrand48() % (N-1), -1 ) );
+  ranges.push_back( make_pair( 0, N ) );
+  ranges.push_back( make_pair( 0, 1 ) );
+  ranges.push_back( make_pair( N-1, N ) );
+  ranges.push_back( make_pair( start, start + 1 + lrand48() % (N-start) ) );
+
+  int N_diffs = 0;
+  for ( int oriented = 0; oriented <= 1; oriented++ )
+    for ( size_t i = 0; i < ranges.size(); i++ ) {
+      const double score = CLM.OrderingScore( order, oriented, ranges[i].first, ranges[i].second );
+      if ( score != CLM.OrderingScoreReference( order, oriented, ranges[i].first, ranges[i].second ) ) N_diffs++;
+      if ( score != 0 ) N_nonzero++;
+      N_scores++;
+    }
+  return N_diffs;
+}
+
+
+
+// TestOrderingScore: Compare the compiled OrderingScore() kernels with OrderingScoreReference(), on the clusters' orderings and on random perturbations of
+// them.  The de novo kernels run on the clusters' CLMs.  The non-de novo kernels run on a CLM that treats the longest contig as a chromosome, cut into
+// fixed-size bins (as in LoadNonDeNovoCLMsFromSAM), in which the intra-contig links are the links between bins.  Each CLM is tested with the default
+// _CP_score_dist, which is longer than the orderings, and with one a few contigs long, so the scores are cut off.
+void
+TestOrderingScore( const TestData & data )
+{
+  static const int N_PERTURBATIONS = 50;
+  static const int BIN_SIZE = 2000;
+  static const int DEFAULT_CP_SCORE_DIST = 10000000; // as set in the ChromLinkMatrix constructors
+
+  const vector<int> lens = TargetLengths( data.SAM_file );
+  const int longest = max_element( lens.begin(), lens.end() ) - lens.begin();
+  vector<ChromLinkMatrix *> bin_CLMs( lens.size(), NULL );
+  bin_CLMs[longest] = new ChromLinkMatrix( "test", BIN_SIZE, lens[longest] );
+  LoadNonDeNovoCLMsFromSAM( data.SAM_file, bin_CLMs );
+  ChromLinkMatrix & bin_CLM = *bin_CLMs[longest];
+
+  for ( int de_novo = 1; de_novo >= 0; de_novo-- ) {
+    int N_diffs = 0, N_scores = 0, N_nonzero = 0;
+    for ( int cut_off = 0; cut_off <= 1; cut_off++ ) {
+      const int CP_score_dist = !cut_off ? DEFAULT_CP_SCORE_DIST : de_novo ? 300000 : 5 * BIN_SIZE;
+      for ( size_t i = 0; i < ( de_novo ? data.CLMs.size() : 1 ); i++ ) {
+	ChromLinkMatrix & CLM = de_novo ? *data.CLMs[i] : bin_CLM;
+	ContigOrdering order = de_novo ? PlainOrder( data.orders[i] ) : ContigOrdering( bin_CLM.N_contigs() );
+	CLM.SetCPScoreDist( CP_score_dist );
+	for ( int p = 0; p < N_PERTURBATIONS; p++ ) {
+	  N_diffs += CompareOrderingScores( CLM, order, N_scores, N_nonzero );
+	  order.PerturbRandom( 1 );
+	}
+	CLM.SetCPScoreDist( DEFAULT_CP_SCORE_DIST );
+      }
+    }
+    Report( string( "OrderingScore, " ) + ( de_novo ? "de novo" : "non-de novo" ), N_nonzero > 0 && N_diffs == 0,
+	    boost::lexical_cast<string>( N_diffs ) + " of " + boost::lexical_cast<string>( N_scores ) + " scores differ from OrderingScoreReference() ("
+	    + boost::lexical_cast<string>( N_nonzero ) + " nonzero)" );
+  }
+
+  delete bin_CLMs[longest];
+}
+
+
+
+
+// Contents: The contigs of an ordering (or of a ShredInsertion), in order, with ~ID for a contig that's rc, as in ContigOrdering::_data.
+template<class Ordering> vector<int>
+Contents( const Ordering & order )
+{
+  vector<int> contents( order.N_contigs_used() );
+  for ( int i = 0; i < order.N_contigs_used(); i++ )
+    contents[i] = order.contig_rc(i) ? ~order.contig_ID(i) : order.contig_ID(i);
+  return contents;
+}
+
+
+// SameContigsUsed: True iff two orderings have the same set of used contigs, according to contig_used().
+bool
+SameContigsUsed( const ContigOrdering & a, const ContigOrdering & b )
+{
+  for ( int c = 0; c < a.N_contigs(); c++ )
+    if ( a.contig_used(c) != b.contig_used(c) ) return false;
+  return a.N_contigs_used() == b.N_contigs_used();
+}
+
+
+
+// TestShredInsertion: Compare a ShredInsertion view with the ordering it stands for, made with AddContigs() (and Invert(), if rc): cut a random shred out
+// of each cluster's ordering, and put it back at every position, in both orientations.  The view and the ordering must have the same contigs as a
+// brute-force insertion into a vector, and OrderingScore() must give them exactly the same scores, over the whole ordering, in the shred, and around it.
+// Also check that RemoveContigs() undoes each AddContigs(), and check MoveContig() against a vector erase and insert.
+void
+TestShredInsertion( const TestData & data )
+{
+  static const int N_SHREDS = 10, MAX_SHRED_SIZE = 5, N_MOVES = 200;
+
+  int N_insertions = 0, N_view_diffs = 0, N_score_diffs = 0, N_undo_diffs = 0, N_moves = 0, N_move_diffs = 0;
+  for ( size_t i = 0; i < data.CLMs.size(); i++ ) {
+    const ChromLinkMatrix & CLM = *data.CLMs[i];
+    const ContigOrdering plain = PlainOrder( data.orders[i] );
+    const int N = plain.N_contigs_used();
+
+    for ( int s = 0; s < N_SHREDS; s++ ) {
+      const int K = 1 + lrand48() % min( MAX_SHRED_SIZE, N-1 ), p = lrand48() % ( N-K+1 );
+      vector<int> shred;
+      for ( int x = p; x < p+K; x++ )
+	shred.push_back( plain.contig_ID(x) );
+      ContigOrdering base = plain;
+      base.RemoveContigs( p, K );
+      const vector<int> base_contents = Contents( base );
+
+      for ( int j = 0; j <= N-K; j++ )
+	for ( int rc = 0; rc <= 1; rc++ ) {
+	  vector<int> expected = base_contents;
+	  for ( int x = 0; x < K; x++ )
+	    expected.insert( expected.begin() + j + x, rc ? ~shred[K-1-x] : shred[x] );
+
+	  const ShredInsertion view( base, shred, j, rc );
+	  ContigOrdering made = base;
+	  made.AddContigs( shred, j );
+	  if ( rc ) made.Invert( j, j+K-1 );
+	  if ( Contents( view ) != expected || Contents( made ) != expected ) N_view_diffs++;
+
+	  for ( int oriented = 0; oriented <= 1; oriented++ )
+	    if ( CLM.OrderingScore( view, oriented ) != CLM.OrderingScore( made, oriented ) ||
+		 CLM.OrderingScore( view, oriented, j, j+K ) != CLM.OrderingScore( made, oriented, j, j+K ) ||
+		 CLM.OrderingScore( view, oriented, j ) != CLM.OrderingScore( made, oriented, j ) )
+	      N_score_diffs++;
+
+	  made.RemoveContigs( j, K );
+	  if ( Contents( made ) != base_contents || !SameContigsUsed( made, base ) ) N_undo_diffs++;
+	  N_insertions++;
+	}
+    }
+
+    ContigOrdering moved = plain;
+    vector<int> expected = Contents( plain );
+    for ( int m = 0; m < N_MOVES; m++ ) {
+      const int old_pos = lrand48() % N, new_pos = lrand48() % N;
+      moved.MoveContig( old_pos, new_pos );
+      const int x = expected[old_pos];
+      expected.erase( expected.begin() + old_pos );
+      expected.insert( expected.begin() + new_pos, x );
+      if ( Contents( moved ) != expected ) N_move_diffs++;
+      N_moves++;
+    }
+  }
+
+  const string of_insertions = " of " + boost::lexical_cast<string>( N_insertions ) + " shred insertions";
+  Report( "ShredInsertion, contigs", N_insertions > 0 && N_view_diffs == 0,
+	  boost::lexical_cast<string>( N_view_diffs ) + of_insertions + " put the contigs in the wrong places" );
+  Report( "ShredInsertion, scores", N_insertions > 0 && N_score_diffs == 0,
+	  boost::lexical_cast<string>( N_score_diffs ) + of_insertions + " scored differently from the orderings made with AddContigs()" );
+  Report( "RemoveContigs", N_insertions > 0 && N_undo_diffs == 0,
+	  boost::lexical_cast<string>( N_undo_diffs ) + of_insertions + " weren't undone by RemoveContigs()" );
+  Report( "MoveContig", N_moves > 0 && N_move_diffs == 0,
+	  boost::lexical_cast<string>( N_move_diffs ) + " of " + boost::lexical_cast<string>( N_moves ) + " moves differ from a vector erase and insert" );
+}
+
+
+
+
+// TestGapSizeSearch: In SpaceContigs, compare the coarse-to-fine gap size search in FindGapSize() with an exhaustive search over every gap size.  Both
+// searches score the gap sizes with the same function, so the coarse-to-fine search can't do better; it should find the same best score at (nearly) every
+// gap.  It may miss a narrow peak that falls between the points of the coarse grid, so a few misses are allowed.
+void
+TestGapSizeSearch( const TestData & data )
+{
+  static const double MAX_MISS_RATE = 0.05;
+
+  pair<int, int> check( 0, 0 );
+  for ( size_t i = 0; i < data.CLMs.size(); i++ ) {
+    ContigOrdering order = data.orders[i];
+    data.CLMs[i]->SpaceContigs( order, *data.lsd, &check );
+  }
+
+  const bool pass = check.first > 0 && check.second <= MAX_MISS_RATE * check.first;
+  Report( "FindGapSize", pass, boost::lexical_cast<string>( check.second ) + " of " + boost::lexical_cast<string>( check.first )
+	  + " coarse-to-fine searches missed the exhaustive search's best score" );
+}
+
+
+
+
+int main( int argc, char * argv[] )
+{
+  ParsedArgs args = ParseArgs( argc, argv );
+  args.RequireOrDefault( "OUT_DIR", "test" );
+  args.RequireOrDefault( "SEED", "1" );
+
+  cout << Time() << ": TestLachesis: making the synthetic data in " << args["OUT_DIR"] << endl;
+  const TestData data( args["OUT_DIR"], args.ValueAsInt( "SEED" ) );
+  srand48( args.ValueAsInt( "SEED" ) ); // after making the data, whose orderings call find_longest_path(), which seeds lrand48 from the clock
+
+  TestLinkBin( *data.lsd );
+  TestIndexedBAM( data );
+  TestOrderingScore( data );
+  TestShredInsertion( data );
+  TestGapSizeSearch( data );
+
+  cout << Time() << ": TestLachesis: " << ( N_failed ? boost::lexical_cast<string>( N_failed ) + " test(s) FAILED" : "all tests passed" ) << endl;
+  return N_failed ? 1 : 0;
+}
@@ -16,16 +16,27 @@
 
 // For documentation, see TextFileParsers.h
 #include "TextFileParsers.h"
+#include "MappedFile.h"
+#include "Parallel.h" // NThreadsToUse, ParallelForRanges
 
 // C libraries
 #include <assert.h>
+#include <ctype.h> // isalnum, isspace
+#include <limits.h> // INT_MAX
+#include <inttypes.h> // uint64_t
+#include <stdio.h> // rename
+#include <stdlib.h> // strtol
+#include <string.h> // strcmp, memchr
+#include <zlib.h> // gzopen
 
 // STL declarations
 #include <vector>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 // Boost libraries
 #include <boost/algorithm/string.hpp> // split
@@ -33,7 +44,6 @@
 #include <boost/lexical_cast.hpp>
 
 
-
 static const unsigned LINE_LEN = 1000000000;
 char LINE[LINE_LEN];
 
@@ -148,17 +158,70 @@ template vector<string> ParseTabDelimFile( const string & infile, const size_t c
 
 
 
+// FaiIsCurrent: Helper function for GetFastaNames and GetFastaSizes.  Return true iff the index <fasta-file>.fai exists and isn't older than the FASTA.
+// (If the FASTA itself is missing, any index is taken to be current.)
+static bool
+FaiIsCurrent( const string & fasta_file )
+{
+  const string fai_file = fasta_file + ".fai";
+  if ( !boost::filesystem::is_regular_file( fai_file ) ) return false;
+  if ( !boost::filesystem::is_regular_file( fasta_file ) ) return true;
+  return boost::filesystem::last_write_time( fai_file ) >= boost::filesystem::last_write_time( fasta_file );
+}
+
+
+
+// LoadFastaIndex: Helper function for GetFastaNames, GetFastaSizes, and GetFastaIndex.  Get the names and lengths (and, if offsets isn't NULL, the sequence
+// offsets) of the contigs in a FASTA from its index, <fasta-file>.fai.
+// If the index isn't current, make it by calling MakeFastaIndexFile, and use the names and lengths (and offsets) found while making it.
+static void
+LoadFastaIndex( const string & fasta_file, vector<string> & names, vector<int64_t> & lengths, vector<int64_t> * offsets = NULL )
+{
+  names.clear();
+  lengths.clear();
+  if ( offsets != NULL ) offsets->clear();
+
+  const string fai_file = fasta_file + ".fai";
+  if ( !FaiIsCurrent( fasta_file ) ) {
+    cout << "Calling MakeFastaIndexFile on " << fasta_file << endl;
+    assert( boost::filesystem::is_regular_file( fasta_file ) );
+    MakeFastaIndexFile( fasta_file, &names, &lengths, offsets ); // whether or not the index can be written, this finds everything that's in it
+    return;
+  }
+
+  // Read the index.  Each line is: name, length, offset, bases per line, bytes per line (tab-delimited).  Only the first three columns are used here.
+  ifstream in( fai_file.c_str(), ios::in );
+  string line;
+  vector<string> tokens;
+  while ( getline( in, line ) ) {
+    boost::split( tokens, line, boost::is_any_of("\t") );
+    if ( tokens.size() < ( offsets == NULL ? 2 : 3 ) ) {
+      cerr << "ERROR: FASTA index file " << fai_file << " has a malformed line: `" << line << "'.  Delete it and Lachesis will remake it." << endl;
+      exit(1);
+    }
+    names  .push_back( tokens[0] );
+    lengths.push_back( boost::lexical_cast<int64_t>( tokens[1] ) );
+    if ( offsets != NULL ) offsets->push_back( boost::lexical_cast<int64_t>( tokens[2] ) );
+  }
+}
+
+
+
+
 // GetFastaNames: Input a FASTA filename and return the set of contig names in that FASTA.
-// This function uses ParseTabDelimFile() on <fasta-file>.names, and if necessary it calls MakeFastaNamesFile() first to create <fasta-file>.names.
+// This function reads the index <fasta-file>.fai if it is current.  Otherwise it uses ParseTabDelimFile() on <fasta-file>.names, if that file exists, or else
+// it calls MakeFastaIndexFile() to create <fasta-file>.fai.
 vector<string>
 GetFastaNames( const string & fasta_file )
 {
   string names_file = fasta_file + ".names";
-  if( !boost::filesystem::is_regular_file( names_file ) ) {
-    cout << "Calling MakeFastaNamesFile on " << names_file << endl;
-    assert( boost::filesystem::is_regular_file( fasta_file ) );
-    MakeFastaNamesFile( fasta_file );
+  if ( FaiIsCurrent( fasta_file ) || !boost::filesystem::is_regular_file( names_file ) ) {
+    vector<string> names;
+    vector<int64_t> lengths;
+    LoadFastaIndex( fasta_file, names, lengths );
+    return names;
   }
+
   vector<string> names = ParseTabDelimFile<string>( names_file, 0 );
 
   // Sanity check.
@@ -173,21 +236,28 @@ GetFastaNames( const string & fasta_file )
 
 
 // GetFastaSizes: Input a FASTA filename and return the set of contig lengths in that FASTA.
-// This function uses TokenizeFile() on <fasta-file>.FastaSize, and if necessary it runs the command FastaSize to create the file <fasta-file>.FastaSize.
+// This function reads the index <fasta-file>.fai if it is current.  Otherwise it uses TokenizeFile() on <fasta-file>.FastaSize, if that file exists, or
+// else it calls MakeFastaIndexFile() to create <fasta-file>.fai.
 vector<int>
 GetFastaSizes( const string & fasta_file )
 {
-  string FastaSize_file = fasta_file  + ".FastaSize";
+  vector<int> contig_sizes;
 
-  // Make the FastaSize file, if necessary.
-  if ( !boost::filesystem::is_regular_file( FastaSize_file ) ) {
-    string cmd = "FastaSize " + fasta_file + " > " + FastaSize_file;
-    system( cmd.c_str() );
-    assert( boost::filesystem::is_regular_file( FastaSize_file ) );
+  string FastaSize_file = fasta_file  + ".FastaSize";
+  if ( FaiIsCurrent( fasta_file ) || !boost::filesystem::is_regular_file( FastaSize_file ) ) {
+    vector<string> names;
+    vector<int64_t> lengths;
+    LoadFastaIndex( fasta_file, names, lengths );
+    for ( size_t i = 0; i < lengths.size(); i++ ) {
+      if ( lengths[i] > INT_MAX ) {
+	cerr << "ERROR: GetFastaSizes: contig " << names[i] << " in FASTA " << fasta_file << " is too long (" << lengths[i] << " bp) for Lachesis." << endl;
+	exit(1);
+      }
+      contig_sizes.push_back( lengths[i] );
+    }
+    return contig_sizes;
   }
 
-  vector<int> contig_sizes;
-
   vector< vector<string> > FastaSize_tokens;
   TokenizeFile( fasta_file + ".FastaSize", FastaSize_tokens, true );
   int N_contigs = FastaSize_tokens.size() - 1; // the FastaSize file has one line for each contig, plus a summary line at the end
@@ -207,6 +277,17 @@ GetFastaSizes( const string & fasta_file )
 
 
 
+// GetFastaIndex: Input a FASTA filename and return the names, lengths, and sequence offsets of its contigs.
+// This function reads the index <fasta-file>.fai if it is current.  Otherwise it calls MakeFastaIndexFile() to create <fasta-file>.fai.
+void
+GetFastaIndex( const string & fasta_file, vector<string> & names, vector<int64_t> & lengths, vector<int64_t> & offsets )
+{
+  LoadFastaIndex( fasta_file, names, lengths, &offsets );
+}
+
+
+
+
 // MakeFastaNamesFile: Input a FASTA filename.  Create a file at <fasta-file>.names, containing all of the contig names in the FASTA, without the leading '>'.
 // This is a wrapper for the Unix command: grep "\>" fasta-file | cut -c2- > fasta-file.names
 // After running this, the contig names can be read in via: ParseTabDelimFile<string>( fasta-file.names, 0 )
@@ -220,6 +301,268 @@ MakeFastaNamesFile( const string & fasta_file )
 
 
 
+// MakeFastaIndexFile: Input a FASTA filename.  Create the samtools-style index <fasta-file>.fai, with one line per contig: name, length, offset of the
+// sequence in the file, bases per line, and bytes per line.  As in samtools faidx, a contig's name is its header line up to the first whitespace.
+// The FASTA is memory-mapped and read in one pass.  If names, lengths, and offsets aren't NULL, they are also filled with the contigs' names, lengths, and
+// sequence offsets.  If the FASTA can't be indexed (some contig's lines aren't all the same length, except the last), no index is written, and this
+// returns false.
+bool
+MakeFastaIndexFile( const string & fasta_file, vector<string> * names, vector<int64_t> * lengths, vector<int64_t> * offsets )
+{
+  const MappedFile file( fasta_file );
+  const char * data = file.data();
+  const size_t size = file.size();
+
+  vector<string> contig_names;
+  vector<int64_t> contig_lengths, contig_offsets, line_bases, line_bytes;
+  bool indexable = true, short_line = false; // short_line: the current contig has had a line shorter than its first line, so that must be its last line
+
+  for ( size_t line_start = 0; line_start < size; ) {
+    const char * newline = (const char *) memchr( data + line_start, '\n', size - line_start );
+    const size_t line_stop = ( newline == NULL ? size : newline - data );
+    const size_t next_line = min( line_stop + 1, size );
+
+    // A header line starts a new contig.
+    if ( data[line_start] == '>' ) {
+      size_t name_stop = line_start + 1;
+      while ( name_stop < line_stop && !isspace( (unsigned char) data[name_stop] ) ) name_stop++;
+      contig_names.push_back( string( data + line_start + 1, name_stop - line_start - 1 ) );
+      contig_lengths.push_back( 0 );
+      contig_offsets.push_back( next_line );
+      line_bases.push_back( 0 );
+      line_bytes.push_back( 0 );
+      short_line = false;
+    }
+
+    // A sequence line adds to the current contig (if any: samtools ignores sequence before the first header).
+    else if ( !contig_names.empty() ) {
+      const int64_t bytes = next_line - line_start;
+      const int64_t bases = line_stop - line_start - ( line_stop > line_start && data[line_stop-1] == '\r' ? 1 : 0 );
+      if ( line_bases.back() == 0 ) { line_bases.back() = bases; line_bytes.back() = bytes; }
+      else if ( short_line && bases > 0 ) indexable = false;
+      else if ( bases > line_bases.back() ) indexable = false;
+      if ( bases < line_bases.back() ) short_line = true;
+      contig_lengths.back() += bases;
+    }
+
+    line_start = next_line;
+  }
+
+  if ( names   != NULL ) *names   = contig_names;
+  if ( lengths != NULL ) *lengths = contig_lengths;
+  if ( offsets != NULL ) *offsets = contig_offsets;
+
+  if ( !indexable ) {
+    cout << "WARNING: MakeFastaIndexFile: the lines of some contig in " << fasta_file << " have different lengths, so it can't be indexed; reading it without an index" << endl;
+    return false;
+  }
+
+  // Write the index to a temporary file, then move it into place, so that the index is never incomplete.
+  const string fai_file = fasta_file + ".fai", tmp_file = fai_file + ".tmp";
+  ofstream out( tmp_file.c_str(), ios::out );
+  for ( size_t i = 0; i < contig_names.size(); i++ )
+    out << contig_names[i] << '\t' << contig_lengths[i] << '\t' << contig_offsets[i] << '\t' << line_bases[i] << '\t' << line_bytes[i] << '\n';
+  out.close();
+  if ( !out || rename( tmp_file.c_str(), fai_file.c_str() ) != 0 ) {
+    cout << "WARNING: MakeFastaIndexFile: can't write to file " << fai_file << "; reading " << fasta_file << " without an index" << endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+
+
+// RE_SITES: Some restriction enzymes used for Hi-C, and their sites, so CountMotifsInFasta() can take the enzyme name instead of the site.
+static const char * RE_SITES[][2] = {
+  { "HindIII", "AAGCTT" }, { "NcoI", "CCATGG" }, { "DpnII", "GATC" }, { "MboI", "GATC" }, { "Sau3AI", "GATC" },
+  { "NlaIII", "CATG" }, { "MseI", "TTAA" }, { "AluI", "AGCT" }, { "DdeI", "CTNAG" }, { "HinfI", "GANTC" } };
+
+// IUPACBases: Helper function for CountMotifsInFasta.  Return the bases matched by this IUPAC code, or NULL if it isn't one.
+static const char *
+IUPACBases( const char code )
+{
+  switch ( code ) {
+  case 'A': return "A";   case 'C': return "C";   case 'G': return "G";   case 'T': return "T";
+  case 'R': return "AG";  case 'Y': return "CT";  case 'S': return "CG";  case 'W': return "AT";  case 'K': return "GT";  case 'M': return "AC";
+  case 'B': return "CGT"; case 'D': return "AGT"; case 'H': return "ACT"; case 'V': return "ACG"; case 'N': return "ACGT";
+  default: return NULL;
+  }
+}
+
+// IUPACComplement: Helper function for CountMotifsInFasta.  Return the complement of this IUPAC code.
+static char
+IUPACComplement( const char code )
+{
+  const char * codes = "ACGTRYSWKMBDHVN", * complements = "TGCAYRWSMKVHDBN";
+  return complements[ strchr( codes, code ) - codes ];
+}
+
+
+// IsFastaNameChar: Helper function for CountMotifsInFasta.  Return true iff this character can be in a contig name, as CountMotifsInFasta.pl sees it.
+static bool
+IsFastaNameChar( const char c )
+{
+  return isalnum( (unsigned char) c ) || c == '_' || c == '|' || c == '.';
+}
+
+
+// MotifScanner: Helper struct for CountMotifsInFasta.  Scans sequence for a set of motifs at once, with the bit-parallel Shift-And algorithm: the motifs'
+// letters are laid end to end in the bits of a 64-bit word, and bit j of the state is set iff the last few bases match the motif's letters up to bit j.
+// Each base updates the state for every motif with one shift, one OR, and one AND.
+struct MotifScanner
+{
+  uint64_t masks[256]; // for each base, the letters (bits) that it matches
+  uint64_t starts, ends; // the first and last letter of each motif
+  vector<uint64_t> motif_bits; // all of the letters of each motif
+
+  MotifScanner( const vector<string> & motifs );
+
+  // Count: Return the number of instances of the motifs in the sequence [begin,end), which may be broken up by newlines.  As in CountMotifsInFasta.pl,
+  // the instances of each motif don't overlap (each one starts after the previous one ends), and only upper-case bases match.
+  int64_t Count( const char * begin, const char * end ) const;
+};
+
+
+MotifScanner::MotifScanner( const vector<string> & motifs )
+  : starts( 0 ), ends( 0 )
+{
+  memset( masks, 0, sizeof(masks) );
+
+  int bit = 0;
+  for ( size_t i = 0; i < motifs.size(); i++ ) {
+    const string & motif = motifs[i];
+    if ( bit + motif.size() > 64 ) {
+      cerr << "ERROR: CountMotifsInFasta: the motifs are too long (more than 64 bases in all.)" << endl;
+      exit(1);
+    }
+
+    starts |= uint64_t(1) << bit;
+    ends   |= uint64_t(1) << ( bit + motif.size() - 1 );
+    motif_bits.push_back( ( motif.size() == 64 ? ~uint64_t(0) : ( uint64_t(1) << motif.size() ) - 1 ) << bit );
+    for ( size_t j = 0; j < motif.size(); j++ )
+      for ( const char * b = IUPACBases( motif[j] ); *b; b++ )
+	masks[ (unsigned char) *b ] |= uint64_t(1) << ( bit + j );
+    bit += motif.size();
+  }
+}
+
+
+int64_t
+MotifScanner::Count( const char * begin, const char * end ) const
+{
+  int64_t count = 0;
+  uint64_t state = 0;
+
+  for ( const char * p = begin; p < end; p++ ) {
+    if ( *p == '\n' ) continue; // the contig's sequence continues on the next line
+    state = ( ( state << 1 ) | starts ) & masks[ (unsigned char) *p ];
+
+    // If any motif has just been matched, count it and start looking for that motif again.
+    if ( state & ends )
+      for ( size_t i = 0; i < motif_bits.size(); i++ )
+	if ( state & ends & motif_bits[i] ) {
+	  count++;
+	  state &= ~motif_bits[i];
+	}
+  }
+
+  return count;
+}
+
+
+
+// CountMotifsInFasta: Count the instances of the motifs in each contig, and write the counts to outfile.
+void
+CountMotifsInFasta( const string & fasta_file, const string & motif, const string & outfile, const int N_threads )
+{
+  cout << "CountMotifsInFasta: counting instances of motif " << motif << " in the contigs of " << fasta_file << endl;
+
+  // Split the motif into motifs, replacing enzyme names with their sites, and check that they make sense.
+  vector<string> motifs;
+  boost::split( motifs, motif, boost::is_any_of("_") );
+  for ( size_t i = 0; i < motifs.size(); i++ ) {
+    for ( size_t j = 0; j < sizeof(RE_SITES) / sizeof(RE_SITES[0]); j++ )
+      if ( motifs[i] == RE_SITES[j][0] ) motifs[i] = RE_SITES[j][1];
+
+    if ( motifs[i].empty() || motifs[i].find_first_not_of( "ACGTRYSWKMBDHVN" ) != string::npos ) {
+      cerr << "ERROR: CountMotifsInFasta: Nonsensical motif sequence '" << motifs[i] << "': Must contain only A,C,G,T and other IUPAC codes, or be the name of a known enzyme" << endl;
+      exit(1);
+    }
+
+    // Only the motif itself is counted, not its reverse complement, which is the same for the palindromic sites of most restriction enzymes.
+    string motif_rc( motifs[i].rbegin(), motifs[i].rend() );
+    for ( size_t j = 0; j < motif_rc.size(); j++ )
+      motif_rc[j] = IUPACComplement( motif_rc[j] );
+    if ( motif_rc != motifs[i] )
+      cout << "WARNING: CountMotifsInFasta: Motif '" << motifs[i] << "' is not its own reverse complement.  Its reverse complement won't be counted." << endl;
+  }
+  const MotifScanner scanner( motifs );
+
+  // Find the contigs in the FASTA.  Each header line (a '>' followed by a name made of letters, digits, and "_|.") starts a new contig, whose sequence
+  // runs up to the next header line.  As in CountMotifsInFasta.pl, any sequence before the first header goes to a contig with an empty name, and an empty
+  // FASTA has one empty contig.
+  const MappedFile file( fasta_file );
+  const char * data = file.data();
+  const size_t size = file.size();
+  vector<string> names;
+  vector<size_t> starts, stops; // contig i's sequence is the range [starts[i],stops[i]) of the file, including newlines
+
+  for ( size_t line_start = 0; line_start < size; ) {
+    const char * newline = (const char *) memchr( data + line_start, '\n', size - line_start );
+    const size_t line_stop = ( newline == NULL ? size : newline - data );
+    size_t name_len = 0;
+    if ( data[line_start] == '>' )
+      while ( line_start + 1 + name_len < line_stop && IsFastaNameChar( data[ line_start + 1 + name_len ] ) ) name_len++;
+
+    if ( name_len > 0 ) {
+      if ( !names.empty() ) stops.back() = line_start;
+      names.push_back( string( data + line_start + 1, name_len ) );
+      starts.push_back( min( line_stop + 1, size ) );
+      stops.push_back( size );
+    }
+    else if ( names.empty() ) {
+      names.push_back( "" );
+      starts.push_back( line_start );
+      stops.push_back( size );
+    }
+
+    line_start = line_stop + 1;
+  }
+  if ( names.empty() ) {
+    names.push_back( "" );
+    starts.push_back( 0 );
+    stops.push_back( 0 );
+  }
+
+  // Count the motifs in the contigs.  Split the contigs among the threads into blocks with about the same amount of sequence.
+  const int N_ranges = NThreadsToUse( N_threads );
+  cout << "CountMotifsInFasta: scanning " << names.size() << " contigs (" << size << " bytes) with " << N_ranges << " threads" << endl;
+  vector<int64_t> counts( names.size(), 0 );
+  ParallelForRanges( N_ranges, N_ranges, [&]( const int r, const size_t, const size_t ) {
+      const size_t begin = lower_bound( stops.begin(), stops.end(), size * r / N_ranges ) - stops.begin();
+      const size_t end = ( r+1 == N_ranges ? names.size() : lower_bound( stops.begin(), stops.end(), size * (r+1) / N_ranges ) - stops.begin() );
+      for ( size_t i = begin; i < end; i++ )
+	counts[i] = scanner.Count( data + starts[i], data + stops[i] );
+    } );
+
+  // Write the counts to a temporary file, then move it into place, so that outfile is never incomplete.
+  const string tmp_file = outfile + ".tmp";
+  ofstream out( tmp_file.c_str(), ios::out );
+  for ( size_t i = 0; i < names.size(); i++ )
+    out << names[i] << '\t' << counts[i] << '\n';
+  out.close();
+  if ( !out || rename( tmp_file.c_str(), outfile.c_str() ) != 0 ) {
+    cerr << "ERROR: CountMotifsInFasta: can't write to file " << outfile << endl;
+    exit(1);
+  }
+
+  cout << "CountMotifsInFasta: done; wrote " << outfile << endl;
+}
+
+
+
 
 
 
@@ -370,145 +713,247 @@ TabulateAlignsToTarget( const int query_ID, const vector<int> & align_on_query,
 
 
 
-// ParseBlastAlignmentFiles: Input a set of BLAST files describing a set of queries aligning to targets.  Also input query lengths and target names.
-// Determine the full extent of each query sequence's position on target, and write the results to outfile.
-//
-// For each query sequence, find the best target (chromosome) - that is, the one containing the plurality of aligned sequence.
-// Then, once we've chosen that target, we employ a "growing from a seed" algorithm: start with the region corresponding to the one best alignment, then keep
-// expanding it to include other alignments, until it's as big as the query.
-//
-// Also derive two "mapping quality scores" for each query:
-// Unique alignability: What fraction of the bases in this contig appear in exactly one alignment to reference?
-// Target specificity: Of the bases that align uniquely, what fraction aligns to the plurality target?
-void
-ParseBlastAlignmentFiles( const vector<string> & BLAST_files, const vector<int> & query_lengths, const vector<string> & target_names, const string & outfile )
+// BlastHit: One alignment of a query onto a target, as described by a non-commented line in a BLAST output file.
+struct BlastHit
 {
-  ifstream in;
-  char line[LINE_LEN];
-  vector<string> tokens;
+  int target_ID;
+  int start_on_Q, stop_on_Q;
+  int start_on_T, stop_on_T; // iff stop_on_T < start_on_T, the alignment is RC
+};
 
 
-  ofstream out( outfile.c_str(), ios::out );
+// BlastFileHits: The hits in one BLAST output file, grouped by query, in the order in which the queries appear in the file.
+struct BlastFileHits
+{
+  vector< vector<BlastHit> > queries;
+  string bad_target; // if non-empty, the file names a target that isn't in target_names, and parsing stopped there
+};
 
-  int N_queries = query_lengths.size();
-  int N_targets = target_names.size();
 
-  // Make a lookup table of target name -> ID.
-  map<string,int> target_names_to_IDs;
-  for ( size_t i = 0; i < target_names.size(); i++ )
-    target_names_to_IDs[ target_names[i] ] = i;
 
+// GzGetLine: Read one line from a file opened with gzopen (which reads plain text and gzipped files alike), without the trailing newline.
+// Return false at end of file.
+static bool
+GzGetLine( gzFile in, string & line )
+{
+  char buf[65536];
+  line.clear();
+  while ( gzgets( in, buf, sizeof(buf) ) != NULL ) {
+    size_t len = strlen( buf );
+    if ( len > 0 && buf[len-1] == '\n' ) { line.append( buf, len-1 ); return true; }
+    line.append( buf, len ); // the line is longer than buf, or it's the last line and it has no newline
+  }
+  return !line.empty();
+}
 
-  // Make a header for the cache file.  This doesn't get parsed anywhere but it's useful for human readability.
-  out << "# This file was created by the function ParseBlastAlignmentFiles in TextFileParsers.cc" << endl;
-  out << "#" << endl;
-  out << "# N assembly contigs = " << N_queries << endl;
-  out << "# N reference contigs = " << N_targets << endl;
-  out << "#" << endl;
-  out << "# There is one row for each query, containing six numbers:" << endl;
-  out << "# query_ID\tbest_target\tstart_on_target\tstop_on_target\tunique_alignability\ttarget_specificity" << endl;
 
+// SplitInPlace: Split a line into tokens at each ' ' or '\t', by overwriting the delimiters with '\0's.  The tokens point into the line itself.
+// As with boost::split (which this replaces in ParseBlastFile), consecutive delimiters produce empty tokens.
+static void
+SplitInPlace( string & line, vector<const char *> & tokens )
+{
+  tokens.clear();
+  char * p = &line[0];
+  tokens.push_back( p );
+  for ( ; *p != '\0'; p++ )
+    if ( *p == ' ' || *p == '\t' ) {
+      *p = '\0';
+      tokens.push_back( p+1 );
+    }
+}
 
-  int file_ID = 0; // index in BLAST_files
-  int query_ID = -1; // will get incremented to 0 for first query
-  int N_hits = 0;
-  vector<int> align_on_query; // will record which parts of the query sequence are aligned, and to which target
-  BlastAlignmentVec BLAST_aligns( N_targets ); // will record the locations of all BLAST alignments of this query onto the target sequences
 
+// TokenToInt: Convert a token to an int, asserting that the whole token is a number.
+static int
+TokenToInt( const char * token )
+{
+  char * end;
+  long x = strtol( token, &end, 10 );
+  assert( end != token && *end == '\0' ); // if this fails, the BLAST file is formatted in an unexpected way
+  return x;
+}
 
-  // Loop through the lines of the BLAST output file, and if necessary through multiple BLAST output files, until we've seen enough queries.
-  while ( query_ID+1 < N_queries ) {
 
-    // Open a new file if necessary.
-    if ( !in.is_open() ) {
-      assert( N_hits == 0 ); // If this fails, the BLAST file has incorrectly reported its number of hits.
 
-      string BLAST_chunk_file = BLAST_files[file_ID++];
-      //cout << "Reading from input file: " << BLAST_chunk_file << " (query_ID = " << query_ID+1 << ")" << endl;
-      assert( boost::filesystem::is_regular_file( BLAST_chunk_file ) );
-      in.open( BLAST_chunk_file.c_str(), ios::in );
-    }
+// ParseBlastFile: Helper function for ParseBlastAlignmentFiles.  Read one BLAST output file (plain text or gzipped), and collect its hits by query.
+// This only looks at the file itself, so the BLAST files can be parsed in parallel.  Each query in the file starts with a "# BLASTN" comment line.
+static void
+ParseBlastFile( const string & BLAST_file, const unordered_map<string,int> & target_names_to_IDs, BlastFileHits & hits )
+{
+  assert( boost::filesystem::is_regular_file( BLAST_file ) );
+  gzFile in = gzopen( BLAST_file.c_str(), "rb" );
+  if ( in == NULL ) {
+    cerr << "ERROR: Can't open BLAST file " << BLAST_file << endl;
+    exit(1);
+  }
+  gzbuffer( in, 1 << 20 );
 
-    // Read the BLAST output file line-by-line.  When we're done with the file, close it and prepare to open the next one.
-    in.getline( line, LINE_LEN );
-    check_line_len();
-    if ( in.fail() ) { in.close(); continue; }
+  string line, target_name;
+  vector<const char *> tokens;
+  int N_hits = 0;
 
+  // Read the BLAST output file line-by-line.
+  while ( GzGetLine( in, line ) ) {
 
-    boost::split( tokens, line, boost::is_any_of(" \t") );
-    assert( tokens.size() > 0 );
+    SplitInPlace( line, tokens );
 
     // Parse commented lines to get metadata
-    if ( tokens[0] == "#" ) {
+    if ( strcmp( tokens[0], "#" ) == 0 ) {
 
       assert( tokens.size() >= 3 ); // if this assert fails, the BLAST file is formatted in an unexpected way, maybe due to a blastn version mismatch
 
       // "BLASTN" line indicates the start of a new query
-      if ( tokens[1] == "BLASTN" ) {
-
-	// Tabulate data from previous query.
-	if ( query_ID != -1 ) TabulateAlignsToTarget( query_ID, align_on_query, BLAST_aligns, N_targets, out );
-
-	// Start a new query!
-	query_ID++;
-	align_on_query = vector<int>( query_lengths[query_ID], -1 );
-	BLAST_aligns = BlastAlignmentVec( N_targets );
+      if ( strcmp( tokens[1], "BLASTN" ) == 0 ) {
+	assert( N_hits == 0 ); // If this fails, the BLAST file has incorrectly reported its number of hits.
+	hits.queries.push_back( vector<BlastHit>() );
       }
 
-      // "Query:" line gives query name; make sure it matches the name in the query_names (the queries must appear in the same order!)
-      // Actually, don't make sure of this; this is too stringent because different BLAST files have slightly different formats
-      // We want to get the token in the line that represents the first word after "Query:", but taking into account the possibility of multiple spaces.
-      // This is too hard so let's just comment it out.
-      else if ( tokens[1] == "Query:" ) {} // assert( tokens[2] == _query_names[query_ID] );
-
       // "XXX hits found" line indicates the number of lines that will follow that describe alignments
-      else if ( tokens[2] == "hits" ) N_hits = boost::lexical_cast<int>( tokens[1] );
+      // (We don't check the "Query:" line against the query names; different BLAST versions format it slightly differently.)
+      else if ( strcmp( tokens[2], "hits" ) == 0 ) N_hits = TokenToInt( tokens[1] );
 
       continue;
     }
 
 
-    // If control reaches here, this line is non-commented and thus describes a hit on query_ID.
+    // If control reaches here, this line is non-commented and thus describes a hit on the current query.
     N_hits--;
 
+    assert( !hits.queries.empty() ); // if this fails, the file has hits before its first "# BLASTN" line
     assert( tokens.size() >= 10 );
-    if ( target_names_to_IDs.find( tokens[1] ) == target_names_to_IDs.end() ) {
-      cout << "ERROR: Target (chromosome) name mismatch.  Name `" << tokens[1] << "' in BLAST file " << BLAST_files[--file_ID] << " not found in reference file." << endl;
-      system( ( "rm " + outfile ).c_str() );
-      exit(1);
+    target_name.assign( tokens[1] );
+    unordered_map<string,int>::const_iterator target = target_names_to_IDs.find( target_name );
+    if ( target == target_names_to_IDs.end() ) {
+      hits.bad_target = target_name;
+      break;
     }
 
-    // Find where this query aligns.
-    int target_ID = target_names_to_IDs[ tokens[1] ];
-    int start_on_Q = boost::lexical_cast<int>( tokens[6] );
-    int  stop_on_Q = boost::lexical_cast<int>( tokens[7] );
-    int start_on_T = boost::lexical_cast<int>( tokens[8] );
-    int  stop_on_T = boost::lexical_cast<int>( tokens[9] );
-    assert( start_on_Q < stop_on_Q );
-    assert(  stop_on_Q <= query_lengths[query_ID] );  // if this fails, the query sequences in the BLAST file don't match the target sequences in the SAM file
-    assert( start_on_T >= 0 );
-    assert(  stop_on_T >= 0 ); // note: the sign of ( start_on_T - stop_on_T ) may be positive or negative, and determines the orientation of the alignment
+    BlastHit hit;
+    hit.target_ID  = target->second;
+    hit.start_on_Q = TokenToInt( tokens[6] );
+    hit.stop_on_Q  = TokenToInt( tokens[7] );
+    hit.start_on_T = TokenToInt( tokens[8] );
+    hit.stop_on_T  = TokenToInt( tokens[9] );
+    hits.queries.back().push_back( hit );
+  }
+
+  if ( hits.bad_target.empty() ) assert( N_hits == 0 ); // If this fails, the BLAST file has incorrectly reported its number of hits.
+  gzclose( in );
+}
+
+
+
+// TabulateQuery: Helper function for ParseBlastAlignmentFiles.  Mark the bases of this query that are covered by its hits, and collect the hits on each
+// target, then pass it all to TabulateAlignsToTarget.
+static void
+TabulateQuery( const int query_ID, const int query_len, const vector<BlastHit> & hits, const int N_targets, ostream & out )
+{
+  vector<int> align_on_query( query_len, -1 ); // will record which parts of the query sequence are aligned, and to which target
+  BlastAlignmentVec BLAST_aligns( N_targets ); // will record the locations of all BLAST alignments of this query onto the target sequences
+
+  for ( size_t i = 0; i < hits.size(); i++ ) {
+    const BlastHit & hit = hits[i];
+    assert( hit.start_on_Q < hit.stop_on_Q );
+    assert( hit.stop_on_Q <= query_len );  // if this fails, the query sequences in the BLAST file don't match the target sequences in the SAM file
+    assert( hit.start_on_T >= 0 );
+    assert( hit.stop_on_T  >= 0 ); // note: the sign of ( start_on_T - stop_on_T ) may be positive or negative, and determines the orientation of the alignment
 
     // Mark each base on this query as aligning to this target sequence.
     // The code for the align_on_query vector is: -1: no alignment seen (yet); X>=0: aligns to exactly one location on target #X; -2: multiple alignment
-    for ( int i = start_on_Q; i < stop_on_Q; i++ ) {
-      if ( align_on_query[i] == -1 ) align_on_query[i] = target_ID;
-      else align_on_query[i] = -2;
+    for ( int j = hit.start_on_Q; j < hit.stop_on_Q; j++ ) {
+      if ( align_on_query[j] == -1 ) align_on_query[j] = hit.target_ID;
+      else align_on_query[j] = -2;
     }
 
     // Record this alignment in the BLAST_aligns struct.
     // If this target turns out to be the 'best' one, we'll use the alignments onto it to determine where the query sequence is on the target.
-    BLAST_aligns.Add( target_ID, start_on_T, stop_on_T );
+    BLAST_aligns.Add( hit.target_ID, hit.start_on_T, hit.stop_on_T );
+  }
+
+  TabulateAlignsToTarget( query_ID, align_on_query, BLAST_aligns, N_targets, out );
+}
+
+
 
 
+// ParseBlastAlignmentFiles: Input a set of BLAST files describing a set of queries aligning to targets.  Also input query lengths and target names.
+// Determine the full extent of each query sequence's position on target, and write the results to outfile.
+//
+// For each query sequence, find the best target (chromosome) - that is, the one containing the plurality of aligned sequence.
+// Then, once we've chosen that target, we employ a "growing from a seed" algorithm: start with the region corresponding to the one best alignment, then keep
+// expanding it to include other alignments, until it's as big as the query.
+//
+// Also derive two "mapping quality scores" for each query:
+// Unique alignability: What fraction of the bases in this contig appear in exactly one alignment to reference?
+// Target specificity: Of the bases that align uniquely, what fraction aligns to the plurality target?
+//
+// The queries in the BLAST files appear in order, and no query is split between two files, so the files are parsed independently, on up to N_threads
+// threads.  The queries are then tabulated in parallel too, and the results are written in query order.
+void
+ParseBlastAlignmentFiles( const vector<string> & BLAST_files, const vector<int> & query_lengths, const vector<string> & target_names, const string & outfile,
+			  const int N_threads )
+{
+  int N_queries = query_lengths.size();
+  int N_targets = target_names.size();
+  const int N_ranges = NThreadsToUse( N_threads );
+
+  // Make a lookup table of target name -> ID.
+  unordered_map<string,int> target_names_to_IDs;
+  target_names_to_IDs.reserve( N_targets );
+  for ( size_t i = 0; i < target_names.size(); i++ )
+    target_names_to_IDs[ target_names[i] ] = i;
+
+
+  // Parse the BLAST files.
+  vector<BlastFileHits> file_hits( BLAST_files.size() );
+  ParallelForRanges( BLAST_files.size(), min( N_ranges, (int) BLAST_files.size() ), [&]( const int r, const size_t begin, const size_t end ) {
+      for ( size_t i = begin; i < end; i++ )
+	ParseBlastFile( BLAST_files[i], target_names_to_IDs, file_hits[i] );
+    } );
+
+  // Collect the hits of each query, in order.  Any queries beyond the first N_queries are ignored.
+  vector<const vector<BlastHit> *> query_hits;
+  query_hits.reserve( N_queries );
+  for ( size_t i = 0; i < BLAST_files.size(); i++ ) {
+    if ( !file_hits[i].bad_target.empty() ) {
+      cout << "ERROR: Target (chromosome) name mismatch.  Name `" << file_hits[i].bad_target << "' in BLAST file " << BLAST_files[i] << " not found in reference file." << endl;
+      exit(1);
+    }
+    for ( size_t j = 0; j < file_hits[i].queries.size() && (int) query_hits.size() < N_queries; j++ )
+      query_hits.push_back( &file_hits[i].queries[j] );
   }
 
+  if ( (int) query_hits.size() != N_queries ) {
+    cout << "ERROR: The BLAST files describe " << query_hits.size() << " queries, but the SAM file header lists " << N_queries << " contigs.  The SAM file you used to find the query lengths may have an internal inconsistency." << endl;
+    exit(1);
+  }
 
-  // Don't forget the last listed query!
-  assert( query_ID + 1 == N_queries ); // if this assert fails, the SAM file you used to find the query_lengths may have an internal inconsistency
-  TabulateAlignsToTarget( query_ID, align_on_query, BLAST_aligns, N_targets, out );
 
-  in.close();
+  // Tabulate the queries, in contiguous blocks.  Each block writes its rows to its own buffer.
+  vector<ostringstream> rows( N_ranges );
+  ParallelForRanges( N_queries, N_ranges, [&]( const int r, const size_t begin, const size_t end ) {
+      for ( size_t i = begin; i < end; i++ )
+	TabulateQuery( i, query_lengths[i], *query_hits[i], N_targets, rows[r] );
+    } );
 
 
+  ofstream out( outfile.c_str(), ios::out );
+
+  // Make a header for the cache file.  This doesn't get parsed anywhere but it's useful for human readability.
+  out << "# This file was created by the function ParseBlastAlignmentFiles in TextFileParsers.cc" << endl;
+  out << "#" << endl;
+  out << "# N assembly contigs = " << N_queries << endl;
+  out << "# N reference contigs = " << N_targets << endl;
+  out << "#" << endl;
+  out << "# There is one row for each query, containing six numbers:" << endl;
+  out << "# query_ID\tbest_target\tstart_on_target\tstop_on_target\tunique_alignability\ttarget_specificity" << endl;
+
+  for ( int r = 0; r < N_ranges; r++ )
+    out << rows[r].str();
+
+  if ( !out ) {
+    cerr << "ERROR: ParseBlastAlignmentFiles: failed to write file '" << outfile << "'" << endl;
+    exit(1);
+  }
+  out.close();
 }
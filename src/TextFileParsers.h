@@ -26,9 +26,11 @@
  * GetFastaNames
  * GetFastaSizes
  *
- * one function to create an output text file:
+ * three functions to create an output text file:
  *
  * MakeFastaNamesFile
+ * MakeFastaIndexFile
+ * CountMotifsInFasta
  *
  * and one function that does both:
  *
@@ -45,6 +47,7 @@
 
 
 
+#include <inttypes.h> // int64_t
 #include <vector>
 #include <string>
 using namespace std;
@@ -82,17 +85,25 @@ ParseTabDelimFile( const string & infile, const size_t column_ID );
 
 
 // GetFastaNames: Input a FASTA filename and return the set of contig names in that FASTA.
-// This function uses ParseTabDelimFile() on <fasta-file>.names, and if necessary it calls MakeFastaNamesFile() first to create <fasta-file>.names.
+// This function reads the index <fasta-file>.fai if it is current.  Otherwise it uses ParseTabDelimFile() on <fasta-file>.names, if that file exists, or else
+// it calls MakeFastaIndexFile() to create <fasta-file>.fai.
 vector<string>
 GetFastaNames( const string & fasta_file );
 
 
 // GetFastaSizes: Input a FASTA filename and return the set of contig lengths in that FASTA.
-// This function uses TokenizeFile() on <fasta-file>.FastaSize, and if necessary it runs the command FastaSize to create the file <fasta-file>.FastaSize.
+// This function reads the index <fasta-file>.fai if it is current.  Otherwise it uses TokenizeFile() on <fasta-file>.FastaSize, if that file exists, or
+// else it calls MakeFastaIndexFile() to create <fasta-file>.fai.
 vector<int>
 GetFastaSizes( const string & fasta_file );
 
 
+// GetFastaIndex: Input a FASTA filename and return the names, lengths, and sequence offsets (the byte offset of each contig's first base in the file) of the
+// contigs in that FASTA.  This function reads the index <fasta-file>.fai if it is current.  Otherwise it calls MakeFastaIndexFile() to create it.
+void
+GetFastaIndex( const string & fasta_file, vector<string> & names, vector<int64_t> & lengths, vector<int64_t> & offsets );
+
+
 // MakeFastaNamesFile: Input a FASTA filename.  Create a file at <fasta-file>.names, containing all of the contig names in the FASTA, without the leading '>'.
 // This is a wrapper for the Unix command: grep "\>" fasta-file | cut -c2- > fasta-file.names
 // After running this, the contig names can be read in via: ParseTabDelimFile<string>( fasta-file.names, 0 )
@@ -100,11 +111,31 @@ void
 MakeFastaNamesFile( const string & fasta_file );
 
 
+// MakeFastaIndexFile: Input a FASTA filename.  Create the samtools-style index <fasta-file>.fai (name, length, offset, bases per line, bytes per line), from
+// which GetFastaNames() and GetFastaSizes() can load the contig names and lengths without reading the FASTA.  The FASTA is read in one pass.
+// If names, lengths, and offsets aren't NULL, they are also filled with the contigs' names, lengths, and sequence offsets.  Returns false (and writes no
+// index) if the FASTA can't be indexed, i.e., some contig's lines aren't all the same length.
+bool
+MakeFastaIndexFile( const string & fasta_file, vector<string> * names = NULL, vector<int64_t> * lengths = NULL, vector<int64_t> * offsets = NULL );
+
+
+// CountMotifsInFasta: Input a FASTA filename and a restriction site motif.  Count the instances of the motif in each contig of the FASTA, and write them to
+// outfile, one line per contig: contig name, tab, count.  This is the file made by the script CountMotifsInFasta.pl, and read by the LoadRESitesFile()
+// functions of GenomeLinkMatrix and ChromLinkMatrix; the counts are also the same as those of CountMotifsInFasta.pl.
+// The motif may contain IUPAC codes (e.g., N = any base), or it may be the name of a common enzyme (e.g., HindIII, DpnII, MboI.)  To count several motifs,
+// separate them with underscores (e.g., AAGCTT_CCATGG); then each contig's count is the sum of the counts of the motifs.
+// The FASTA is memory-mapped, and the contigs are scanned in parallel, with up to N_threads threads (0 = one per core; see Parallel.h).
+void
+CountMotifsInFasta( const string & fasta_file, const string & motif, const string & outfile, const int N_threads = 1 );
+
+
 
 // ParseBlastAlignmentFiles: Input a set of BLAST files describing a set of queries aligning to targets.  Also input query lengths and target names.
 // Determine the full extent of each query sequence's position on target, and write the results to outfile.
+// The BLAST files may be gzipped.  They are parsed in parallel, with up to N_threads threads (0 = one per core; see Parallel.h).
 // For a detailed description of the method used here, see the comments in the function.
 void
-ParseBlastAlignmentFiles( const vector<string> & BLAST_files, const vector<int> & query_lengths, const vector<string> & target_names, const string & outfile );
+ParseBlastAlignmentFiles( const vector<string> & BLAST_files, const vector<int> & query_lengths, const vector<string> & target_names, const string & outfile,
+			  const int N_threads = 1 );
 
 #endif
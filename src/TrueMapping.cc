@@ -17,14 +17,18 @@
 // For documentation, see TrueMapping.h
 #include "TrueMapping.h"
 #include "TextFileParsers.h" // ParseBlastAlignmentFiles
+#include "MappedFile.h"
 
 
 #include <assert.h>
 #include <math.h>
+#include <string.h> // memcpy, memset
+#include <inttypes.h> // int32_t, uint32_t
 #include <string>
 #include <vector>
 #include <map>
 #include <iostream>
+#include <fstream>
 #include <numeric> // accumulate
 #include <algorithm> // count, max_element, min_element
 
@@ -55,8 +59,8 @@ static const unsigned LINE_LEN = 10000;
 
 
 // Load in a set of BLAST alignments for a de novo GLM.  Also load in query and target names.  The dummy_SAM_file is for getting contig lengths.
-// Files should exist: <BLAST_file_head>.blast.out, <BLAST_file_head>.*.blast.out (for * = 1,2,3,...)
-TrueMapping::TrueMapping( const string & species, const vector<string> & query_names, const vector<string> & target_names, const string & BLAST_file_head, const string & out_dir, const string & dummy_SAM_file )
+// Files should exist: <BLAST_file_head>.*.blast.out or <BLAST_file_head>.*.blast.out.gz (for * = 1,2,3,...)
+TrueMapping::TrueMapping( const string & species, const vector<string> & query_names, const vector<string> & target_names, const string & BLAST_file_head, const string & out_dir, const string & dummy_SAM_file, const int N_threads )
   : _species( species ),
     _query_names( query_names ),
     _target_names( target_names )
@@ -76,12 +80,13 @@ TrueMapping::TrueMapping( const string & species, const vector<string> & query_n
   _qual_specificity .resize( NQueries(), 0 );
 
   // Determine the cache file name and the set of available BLAST files for ReadBlastAlignsFromFileSet, below.
-  // The BLAST files take the form <BLAST_file_head>.*.blast.out, with * = 1,2,...
+  // The BLAST files take the form <BLAST_file_head>.*.blast.out, with * = 1,2,..., and each one may be gzipped.
   string cache_file = out_dir + "/cached_data/TrueMapping.assembly.txt";
   vector<string> BLAST_files;
   for ( int i = 1;; i++ ) {
     string file = BLAST_file_head + "." + boost::lexical_cast<string>(i) + ".blast.out";
-    if ( boost::filesystem::is_regular_file( file ) ) BLAST_files.push_back( file );
+    if      ( boost::filesystem::is_regular_file( file ) ) BLAST_files.push_back( file );
+    else if ( boost::filesystem::is_regular_file( file + ".gz" ) ) BLAST_files.push_back( file + ".gz" );
     else break;
   }
 
@@ -91,7 +96,7 @@ TrueMapping::TrueMapping( const string & species, const vector<string> & query_n
   // This is initially done by parsing a set of BLAST files (which takes a lot of runtime due to file I/O) and then carefully expanding the BLAST alignments
   // into whole-contig alignments.  The results of this method are written to a cache file.  If the cache filename already exists, we can save time by reading
   // the alignments directly from it.  Either way, the function will fill local variables.
-  ReadBlastAlignsFromFileSet( species, dummy_SAM_file, BLAST_files, cache_file );
+  ReadBlastAlignsFromFileSet( species, dummy_SAM_file, BLAST_files, cache_file, N_threads );
 
   // Count the number of unaligned sequences.
   int N_unaligned = count( _target.begin(), _target.end(), -1 );
@@ -578,9 +583,19 @@ TrueMapping::ReorderQueries( const vector<int> & new_ordering )
 // Helper function for the TrueMapping constructor.
 // Read alignment info from the BLAST files and write them in a simple format to TrueMapping_file.  If TrueMapping_file already exists, just read from it
 // directly, to save runtime.  Either way, load the alignment data into this TrueMapping object.
+// The data are also cached in binary form, in a file with the same name as TrueMapping_file but the extension ".bin".  This file is quicker to load, so it's
+// used instead of TrueMapping_file whenever it's at least as new.  (If TrueMapping_file is re-created, the binary cache is re-created from it.)
 void
-TrueMapping::ReadBlastAlignsFromFileSet( const string & species, const string & dummy_SAM_file, const vector<string> & BLAST_files, const string & TrueMapping_file )
+TrueMapping::ReadBlastAlignsFromFileSet( const string & species, const string & dummy_SAM_file, const vector<string> & BLAST_files, const string & TrueMapping_file, const int N_threads )
 {
+  const string binary_file = boost::filesystem::path( TrueMapping_file ).replace_extension( ".bin" ).string();
+
+  if ( boost::filesystem::is_regular_file( binary_file ) &&
+       ( !boost::filesystem::is_regular_file( TrueMapping_file ) ||
+	 boost::filesystem::last_write_time( binary_file ) >= boost::filesystem::last_write_time( TrueMapping_file ) ) ) {
+    ReadBinaryCache( binary_file );
+    return;
+  }
 
   // If the cache file doesn't already exist, we must create it.
   // Parse the alignments, calculate the best target and the quality metrics, and create a cache file.  Runtime on human: ~1 min.
@@ -607,7 +622,7 @@ TrueMapping::ReadBlastAlignsFromFileSet( const string & species, const string &
 
     // Do the parsing!
     cout << "Parsing BLAST files to find contig alignments to reference; will cache results at " << TrueMapping_file << endl;
-    ParseBlastAlignmentFiles( BLAST_files, query_lengths, _target_names, TrueMapping_file );
+    ParseBlastAlignmentFiles( BLAST_files, query_lengths, _target_names, TrueMapping_file, N_threads );
   }
 
 
@@ -645,6 +660,105 @@ TrueMapping::ReadBlastAlignsFromFileSet( const string & species, const string &
   }
   assert( query_ID == NQueries() );
 
+  WriteBinaryCache( binary_file );
+}
+
+
+
+/* Binary cache file format.  All integers are in the native byte order; the byte-order mark catches files moved between machines.
+ *
+ *   TrueMappingBinaryHeader                  (see below)
+ *   int32_t  target[N_queries]               _target (zero-padded to 8 bytes)
+ *   int32_t  start [N_queries]               _start  (zero-padded to 8 bytes)
+ *   int32_t  stop  [N_queries]               _stop   (zero-padded to 8 bytes)
+ *   double   alignability[N_queries]         _qual_alignability
+ *   double   specificity [N_queries]         _qual_specificity
+ */
+static const char TRUE_MAPPING_BINARY_MAGIC[8] = { 'L', 'A', 'C', 'H', 'T', 'M', 'P', '\0' };
+static const uint32_t TRUE_MAPPING_BINARY_VERSION = 1;
+static const uint32_t TRUE_MAPPING_BYTE_ORDER_MARK = 0x01020304;
+
+struct TrueMappingBinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  int32_t N_queries;
+  int32_t N_targets;
+};
+
+
+
+// ReadBinaryCache: Load the alignment data from a binary cache file made by WriteBinaryCache().
+void
+TrueMapping::ReadBinaryCache( const string & file )
+{
+  const MappedFile mapped( file );
+  const TrueMappingBinaryHeader & header = *mapped.at<TrueMappingBinaryHeader>(0);
+
+  if ( memcmp( header.magic, TRUE_MAPPING_BINARY_MAGIC, sizeof(TRUE_MAPPING_BINARY_MAGIC) ) != 0 ||
+       header.byte_order != TRUE_MAPPING_BYTE_ORDER_MARK || header.version != TRUE_MAPPING_BINARY_VERSION ) {
+    cerr << "ERROR: TrueMapping: cached file '" << file << "' is from another machine or another version of Lachesis, or is corrupted.  Delete it and let Lachesis re-create it." << endl;
+    exit(1);
+  }
+  if ( header.N_queries != NQueries() || header.N_targets != NTargets() ) {
+    PRINT4( header.N_queries, NQueries(), header.N_targets, NTargets() );
+    cerr << "ERROR: Assembly size in draft assembly fasta doesn't seem to match the cached file at " << file << ".  If the cached file is from an earlier dataset, just delete it and let Lachesis re-create it." << endl;
+    exit(1);
+  }
+
+  const size_t N = NQueries();
+  size_t offset = sizeof(TrueMappingBinaryHeader);
+  const int32_t * target = mapped.at<int32_t>( offset, N );
+  offset += PadTo8( N * sizeof(int32_t) );
+  const int32_t * start = mapped.at<int32_t>( offset, N );
+  offset += PadTo8( N * sizeof(int32_t) );
+  const int32_t * stop = mapped.at<int32_t>( offset, N );
+  offset += PadTo8( N * sizeof(int32_t) );
+  const double * alignability = mapped.at<double>( offset, N );
+  offset += N * sizeof(double);
+  const double * specificity = mapped.at<double>( offset, N );
+
+  _target.assign( target, target + N );
+  _start .assign( start,  start  + N );
+  _stop  .assign( stop,   stop   + N );
+  _qual_alignability.assign( alignability, alignability + N );
+  _qual_specificity .assign( specificity,  specificity  + N );
+}
+
+
+
+// WriteBinaryCache: Write the alignment data to a binary cache file, in the format described above.
+void
+TrueMapping::WriteBinaryCache( const string & file ) const
+{
+  TrueMappingBinaryHeader header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, TRUE_MAPPING_BINARY_MAGIC, sizeof(TRUE_MAPPING_BINARY_MAGIC) );
+  header.version = TRUE_MAPPING_BINARY_VERSION;
+  header.byte_order = TRUE_MAPPING_BYTE_ORDER_MARK;
+  header.N_queries = NQueries();
+  header.N_targets = NTargets();
+
+  const vector<int32_t> target( _target.begin(), _target.end() );
+  const vector<int32_t> start ( _start .begin(), _start .end() );
+  const vector<int32_t> stop  ( _stop  .begin(), _stop  .end() );
+
+  ofstream out( file.c_str(), ios::out | ios::binary );
+  out.write( reinterpret_cast<const char *>( &header ), sizeof(header) );
+  out.write( reinterpret_cast<const char *>( target.data() ), target.size() * sizeof(int32_t) );
+  WritePadding( out, target.size() * sizeof(int32_t) );
+  out.write( reinterpret_cast<const char *>( start.data() ), start.size() * sizeof(int32_t) );
+  WritePadding( out, start.size() * sizeof(int32_t) );
+  out.write( reinterpret_cast<const char *>( stop.data() ), stop.size() * sizeof(int32_t) );
+  WritePadding( out, stop.size() * sizeof(int32_t) );
+  out.write( reinterpret_cast<const char *>( _qual_alignability.data() ), _qual_alignability.size() * sizeof(double) );
+  out.write( reinterpret_cast<const char *>( _qual_specificity .data() ), _qual_specificity .size() * sizeof(double) );
+
+  if ( !out ) {
+    cerr << "ERROR: TrueMapping: failed to write cache file '" << file << "'" << endl;
+    exit(1);
+  }
+  out.close();
 }
 
 
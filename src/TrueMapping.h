@@ -31,6 +31,8 @@
  * The input to the TrueMapping class is a text file of BLAST output representing the alignment of the draft assembly to the true reference.  To create this
  * file, run blastn with -outfmt 7.  It may be a computational hassle to get blastn to run with a reasonable amount of time and memory usage.  To speed it up,
  * restrict the space of allowable alignments (here's a set of options that was used successfully on human: -perc_identity 99 -evalue 100 -word_size 50).
+ * The BLAST output may be split into many files, which may be gzipped.  The whole-contig alignments derived from them are cached in two files, a
+ * human-readable text file and a binary file that is loaded on later runs; see ReadBlastAlignsFromFileSet().
  *
  * Alternatively, a TrueMapping class can be created for a non-de novo assembly that consists of the reference genome split up into "bins" of equal length.
  *
@@ -76,8 +78,9 @@ class TrueMapping
   // Default constructor.  This is only invoked when another object that contains a TrueMapping object (e.g., Reporter) is instantiated.
   TrueMapping() {}
   // Load in a set of BLAST alignments for a de novo GLM.  Also load in query and target names.  The dummy_SAM_file is for getting contig lengths.
-  // Files should exist: <BLAST_file_head>.blast.out, <BLAST_file_head>.*.blast.out (for * = 1,2,3,...)
-  TrueMapping( const string & species, const vector<string> & query_names, const vector<string> & target_names, const string & BLAST_file_head, const string & out_dir, const string & dummy_SAM_file );
+  // Files should exist: <BLAST_file_head>.*.blast.out or <BLAST_file_head>.*.blast.out.gz (for * = 1,2,3,...)
+  // The BLAST files are parsed with up to N_threads threads (0 = one per core.)
+  TrueMapping( const string & species, const vector<string> & query_names, const vector<string> & target_names, const string & BLAST_file_head, const string & out_dir, const string & dummy_SAM_file, const int N_threads = 1 );
   // Create a TrueMapping for a de novo GLM made by chopping up a reference genome into bins of size BIN_SIZE.  The species must be human (for now).
   TrueMapping( const string & species, const int BIN_SIZE, const vector<string> & query_names, const vector<string> & target_names );
   // Create a TrueMapping for a non-de novo GLM.
@@ -138,7 +141,12 @@ class TrueMapping
   // Helper function for the TrueMapping constructor.
   // Read alignment info from the BLAST files and write them in a simple format to TrueMapping_file.  If TrueMapping_file already exists, just read from it
   // directly, to save runtime.  Either way, load the alignment data into this TrueMapping object.
-  void ReadBlastAlignsFromFileSet( const string & species, const string & dummy_SAM_file, const vector<string> & BLAST_files, const string & TrueMapping_file );
+  // The data are also cached in binary form, in a file with the same name as TrueMapping_file but the extension ".bin"; this file is loaded instead of
+  // TrueMapping_file if it's at least as new.
+  void ReadBlastAlignsFromFileSet( const string & species, const string & dummy_SAM_file, const vector<string> & BLAST_files, const string & TrueMapping_file, const int N_threads );
+  // Read/write the binary cache of the alignment data (_target, _start, _stop, and the quality scores.)
+  void ReadBinaryCache( const string & file );
+  void WriteBinaryCache( const string & file ) const;
 
   /* The following three functions assume that species() == "human" and that the chromosomes are named in accordance with the standard in HumanGenome.h. */
 
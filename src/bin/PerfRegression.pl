@@ -0,0 +1,440 @@
+#!/usr/bin/perl -w
+use strict;
+
+#############################################################################
+#                                                                           #
+# This software and its documentation are copyright (c) 2014-2015 by Joshua #
+# N. Burton and the University of Washington.  All rights are reserved.     #
+#                                                                           #
+# THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  #
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                #
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  #
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      #
+# CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT #
+# OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  #
+# THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                #
+#                                                                           #
+#############################################################################
+
+
+
+# PerfRegression.pl
+#
+# A performance regression suite for Lachesis.  Run the pipeline on a set of datasets, measure each stage, and compare the measurements (and the results)
+# against stored baselines.  This is how to check that a change to Lachesis is a real speedup that doesn't change the output.
+#
+# The datasets:
+# -- synthetic: LachesisBench on synthetic datasets of 2000 and 8000 contigs, without SpaceContigs.  The numbers come from LachesisBench's CSV file.
+# -- spacing: LachesisBench on a small synthetic dataset (60 contigs), with SpaceContigs, which is much slower than the other stages.
+# -- test_case: The bundled test case (INIs/test_case.ini), run by Lachesis from scratch.  The stages and their numbers come from the run's
+#    stage_timing.json (see StageTimer in TimeMem.h); stages that appear more than once (e.g., ReinsertShreds, once per group) are summed.  This one isn't
+#    run by default, and it isn't in the committed baseline, because the test case's data isn't all in the repository (its FASTA files aren't.)
+#
+# For each stage, three numbers are measured: the wall time, the peak resident set size, and the number of calls to each function that has a CallCounter
+# (e.g., OrderingScore).  Each dataset is run REPS times, and the lowest wall time and RSS are used, which are the least noisy.  The results (clusters.txt
+# and group*.ordering) are compared by their MD5 checksums.
+#
+# The runs use the scalar link kernels (LACHESIS_LINK_KERNELS=scalar; see LinkKernels.h), unless --native_kernels is given.  The vector kernels round
+# differently, and on some datasets that changes the results, so only the scalar runs are the same on every machine.
+#
+# There are two baselines:
+# -- The committed baseline (perf_baseline.txt, in this script's directory) has only the numbers that don't depend on the machine: the call counts and the
+#    checksums of the synthetic and spacing datasets, with the default --threads=1.  Every run is compared with it, except with --native_kernels.  If a
+#    change is meant to change these numbers, rewrite them with --update_committed, and commit the new baseline with the change.
+# -- The local baseline (by default perf_baseline.local.txt in the --work_dir, or perf_baseline.local.native.txt with --native_kernels) has all of the
+#    numbers, including the wall times and RSSs, which are only meaningful on the machine where they were measured.  Make it with --update, on your
+#    machine, before making any changes.  If it exists, every run is compared with it too; the wall times and RSSs are only checked if it does.
+#
+# A number fails if it has gone up by more than the tolerance:
+# -- wall time: more than TIME_TOL (as a fraction of the baseline) plus TIME_SLACK seconds, since the smallest stages take only milliseconds.
+# -- peak RSS: more than RSS_TOL (as a fraction) plus 1 MB.
+# -- call counts: more than CALLS_TOL (as a fraction).  The call counts don't depend on the machine or the load, so by default any increase fails.
+# A number that has gone down by more than the tolerance is reported as an improvement.  A checksum fails if it has changed at all.  The script returns 0
+# iff nothing failed.
+#
+# Syntax: PerfRegression.pl [options]
+# --update              Write the measurements to the local baseline, instead of comparing (the datasets not run keep their old baselines)
+# --update_committed    Write the call counts and checksums to the committed baseline, instead of comparing
+# --baseline=FILE       The committed baseline file (default: perf_baseline.txt, in this script's directory)
+# --local_baseline=FILE The local baseline file (default: perf_baseline.local.txt, in the --work_dir)
+# --datasets=LIST       Comma-separated list of datasets to run (default: synthetic,spacing)
+# --reps=N              Number of times to run each dataset (default: 3)
+# --threads=N           N_THREADS for Lachesis and LachesisBench (default: 1; more threads make the wall times noisier)
+# --native_kernels      Use the fastest link kernels that the processor supports, and compare only with the local baseline
+# --time_tol=X          (default: 0.25)
+# --time_slack=X        (default: 0.05)
+# --rss_tol=X           (default: 0.2)
+# --calls_tol=X         (default: 0)
+# --lachesis=PATH       The Lachesis executable (default: ../Lachesis, relative to this script, if it exists; otherwise Lachesis, in the PATH)
+# --bench=PATH          The LachesisBench executable, made with 'make LachesisBench' (default: ../LachesisBench, or LachesisBench in the PATH)
+# --work_dir=DIR        Directory for the runs' output (default: perf_regression, in this script's directory)
+# --verbose             Report every comparison, not just the failures and improvements
+#
+# The baselines aren't installed with the scripts, so run this script from the source tree (src/bin).
+# The script runs in its own directory, because the paths in INIs/test_case.ini are relative to it (as in testme.sh.)
+
+
+
+
+
+use FindBin;
+use Getopt::Long;
+use Digest::MD5;
+use JSON::PP;
+use Cwd 'abs_path';
+use File::Spec;
+
+
+sub run_test_case( $ );
+sub run_bench( $$$ );
+sub min_over_reps( $ );
+sub checksums( $$ );
+sub machine_independent( $ );
+sub read_baseline( $ );
+sub write_baseline( $$$ );
+sub find_exe( $$ );
+
+
+
+# Get the options.
+my ( $update, $update_committed ) = ( 0, 0 );
+my $baseline_file = "$FindBin::Bin/perf_baseline.txt";
+my $local_baseline_file;
+my $datasets = "synthetic,spacing";
+my $reps = 3;
+my $threads = 1;
+my $native_kernels = 0;
+my ( $time_tol, $time_slack, $rss_tol, $calls_tol ) = ( 0.25, 0.05, 0.2, 0 );
+my ( $lachesis, $bench );
+my $work_dir = "$FindBin::Bin/perf_regression";
+my $verbose = 0;
+
+GetOptions( "update" => \$update, "update_committed" => \$update_committed, "baseline=s" => \$baseline_file, "local_baseline=s" => \$local_baseline_file,
+	    "datasets=s" => \$datasets, "reps=i" => \$reps, "threads=i" => \$threads, "native_kernels" => \$native_kernels, "time_tol=f" => \$time_tol, "time_slack=f" => \$time_slack, "rss_tol=f" => \$rss_tol, "calls_tol=f" => \$calls_tol,
+	    "lachesis=s" => \$lachesis, "bench=s" => \$bench, "work_dir=s" => \$work_dir, "verbose" => \$verbose )
+    or die "Syntax: $0 [options]; see the top of $0 for the options.\n";
+die "ERROR: --reps must be at least 1\n" unless $reps >= 1;
+die "ERROR: --update and --update_committed can't be used together\n" if $update && $update_committed;
+die "ERROR: --update_committed can't be used with --native_kernels: the committed baseline is of the scalar kernels\n" if $update_committed && $native_kernels;
+die "ERROR: --update_committed: the test_case dataset can't go in the committed baseline, since its data isn't all in the repository\n"
+    if $update_committed && grep { $_ eq 'test_case' } split /,/, $datasets;
+
+$lachesis = &find_exe( $lachesis, "Lachesis" );
+$bench    = &find_exe( $bench,    "LachesisBench" );
+$baseline_file = File::Spec->rel2abs( $baseline_file );
+$work_dir = File::Spec->rel2abs( $work_dir );
+$local_baseline_file = "$work_dir/perf_baseline.local" . ( $native_kernels ? '.native' : '' ) . ".txt" unless defined $local_baseline_file;
+$local_baseline_file = File::Spec->rel2abs( $local_baseline_file );
+$ENV{LACHESIS_LINK_KERNELS} = 'scalar' unless $native_kernels; # inherited by Lachesis and LachesisBench
+unless ( $update || $update_committed ) {
+    die "ERROR: Can't find the committed baseline file $baseline_file\n" unless $native_kernels || -e $baseline_file;
+    die "ERROR: Can't find the local baseline file $local_baseline_file.  With --native_kernels, there's nothing else to compare with; make one with "
+	. "$0 --update --native_kernels, before making any changes.\n" if $native_kernels && !-e $local_baseline_file;
+}
+system( "mkdir -p $work_dir" ) == 0 or die "ERROR: Can't make directory $work_dir\n";
+chdir $FindBin::Bin or die "ERROR: Can't cd to $FindBin::Bin: $!\n";
+
+
+# The measurements.  $now{$dataset}{$stage}{$metric} = value, where $stage is 'output' for the checksums (and $metric is the file name.)
+my %now;
+foreach my $dataset ( split /,/, $datasets ) {
+    print localtime() . ": PerfRegression: Running dataset $dataset, $reps times\n";
+    my @runs;
+    if ( $dataset eq 'test_case' ) {
+	push @runs, &run_test_case( "$work_dir/test_case" ) foreach 1..$reps;
+    }
+    elsif ( $dataset eq 'synthetic' ) {
+	push @runs, &run_bench( "$work_dir/synthetic", "N_CONTIGS=2000,8000 SPACE_CONTIGS=0", $dataset ) foreach 1..$reps;
+    }
+    elsif ( $dataset eq 'spacing' ) {
+	push @runs, &run_bench( "$work_dir/spacing", "N_CONTIGS=60 SPACE_CONTIGS=1", $dataset ) foreach 1..$reps;
+    }
+    else {
+	die "ERROR: Unknown dataset '$dataset'.  The datasets are test_case, synthetic, and spacing.\n";
+    }
+
+    # Combine the runs.  A dataset run is a hash of dataset names to stages, since LachesisBench runs several scales at once.
+    foreach my $name ( keys %{$runs[0]} ) {
+	$now{$name} = &min_over_reps( [ map { $_->{$name} } @runs ] );
+    }
+}
+
+
+
+# With --update, just write the local baseline.  With --update_committed, just write the machine-independent numbers to the committed baseline.
+if ( $update || $update_committed ) {
+    my $file = $update ? $local_baseline_file : $baseline_file;
+    my %baseline = -e $file ? %{ &read_baseline( $file ) } : ();
+    $baseline{$_} = $now{$_} foreach keys %now;
+
+    # The committed baseline keeps only the machine-independent numbers, and not the test case (even from an older baseline.)
+    unless ( $update ) {
+	delete $baseline{test_case};
+	foreach my $dataset ( keys %baseline ) {
+	    foreach my $stage ( keys %{$baseline{$dataset}} ) {
+		foreach my $metric ( keys %{$baseline{$dataset}{$stage}} ) {
+		    delete $baseline{$dataset}{$stage}{$metric} unless &machine_independent( $metric );
+		}
+	    }
+	}
+    }
+    &write_baseline( $file, \%baseline, $update );
+    print localtime() . ": PerfRegression: Wrote baseline to $file\n";
+    exit 0;
+}
+
+
+
+# Compare the measurements with the baselines: the committed one (except with --native_kernels), and the local one, if there is one.
+my @baselines;
+push @baselines, [ 'committed', &read_baseline( $baseline_file ) ] unless $native_kernels;
+if ( -e $local_baseline_file ) {
+    push @baselines, [ 'local', &read_baseline( $local_baseline_file ) ];
+}
+else {
+    print localtime() . ": PerfRegression: No local baseline $local_baseline_file, so the wall times and RSSs won't be checked.  Make one with $0 --update, "
+	. "before making any changes.\n";
+}
+
+my ( $N_compared, $N_failed, $N_improved ) = ( 0, 0, 0 );
+printf "%-16s %-28s %-24s %-10s %14s %14s %8s  %s\n", 'DATASET', 'STAGE', 'METRIC', 'VS', 'BASELINE', 'NOW', 'CHANGE', 'STATUS';
+
+foreach my $dataset ( sort keys %now ) {
+    my $N_baselines = 0;
+    foreach my $baseline ( @baselines ) {
+	my ( $vs, $base ) = ( $baseline->[0], $baseline->[1]{$dataset} );
+	next unless defined $base;
+	$N_baselines++;
+
+	foreach my $stage ( sort keys %$base ) {
+	    foreach my $metric ( sort keys %{$base->{$stage}} ) {
+		my $b = $base->{$stage}{$metric};
+		my $n = $now{$dataset}{$stage}{$metric};
+		my $status = 'ok';
+		my $change = '';
+		$N_compared++;
+
+		if ( !defined $n ) {
+		    $status = 'FAILED (missing)';
+		}
+		elsif ( $stage eq 'output' ) {
+		    $status = 'FAILED (output changed)' if $n ne $b;
+		    $b = substr( $b, 0, 12 );
+		    $n = substr( $n, 0, 12 );
+		}
+		else {
+		    my ( $tol, $slack ) = $metric eq 'wall_sec' ? ( $time_tol, $time_slack ) : $metric eq 'peak_RSS_KB' ? ( $rss_tol, 1024 ) : ( $calls_tol, 0 );
+		    $change = $b > 0 ? sprintf( "%+.0f%%", 100 * ( $n - $b ) / $b ) : '';
+		    if    ( $n > $b * ( 1 + $tol ) + $slack ) { $status = 'FAILED' }
+		    elsif ( $n < $b * ( 1 - $tol ) - $slack ) { $status = 'improved'; $N_improved++ }
+		}
+
+		$N_failed++ if $status =~ /^FAILED/;
+		printf "%-16s %-28s %-24s %-10s %14s %14s %8s  %s\n", $dataset, $stage, $metric, $vs, $b, defined $n ? $n : '-', $change, $status
+		    if $verbose || $status ne 'ok';
+	    }
+	}
+
+	foreach my $stage ( sort keys %{$now{$dataset}} ) {
+	    print "$dataset: stage '$stage' is not in the $vs baseline\n" unless exists $base->{$stage};
+	}
+    }
+
+    print "$dataset: not in any baseline; skipping.  Run with --update to add it to the local baseline.\n" unless $N_baselines;
+}
+
+print localtime() . ": PerfRegression: $N_compared comparisons, $N_failed failed, $N_improved improved\n";
+exit( $N_failed ? 1 : 0 );
+
+
+
+
+
+
+
+# SUBROUTINES
+
+
+
+# run_test_case: Run Lachesis on the test case, from scratch, with its output in $out_dir.  Return a hash of 'test_case' to its stages.
+sub run_test_case( $ ) {
+    my ( $out_dir ) = @_;
+    system( "rm -rf $out_dir" );
+
+    # Make a copy of the INI file, with the output going to $out_dir.
+    my $ini = "$work_dir/test_case.ini";
+    open IN, '<', 'INIs/test_case.ini' or die "ERROR: Can't find INIs/test_case.ini: $!";
+    open OUT, '>', $ini or die "ERROR: Can't write to $ini: $!";
+    while (<IN>) {
+	s/^OUTPUT_DIR\s*=.*/OUTPUT_DIR = $out_dir/;
+	s/^N_THREADS\s*=.*/N_THREADS = $threads/;
+	print OUT;
+    }
+    close IN;
+    close OUT;
+
+    system( "$lachesis $ini > $work_dir/test_case.out 2> $work_dir/test_case.err" ) == 0
+	or die "ERROR: Lachesis failed on the test case; see $work_dir/test_case.out and $work_dir/test_case.err\n";
+
+    # Read the stage timing file.  Add up the numbers for each stage name.
+    my $json_file = "$out_dir/stage_timing.json";
+    open JSON, '<', $json_file or die "ERROR: Can't find $json_file: $!";
+    my $timing = decode_json( join '', <JSON> );
+    close JSON;
+
+    my %stages;
+    foreach my $s ( @{ $timing->{stages} } ) {
+	my $stage = $stages{ $s->{name} } ||= {};
+	$stage->{wall_sec} += $s->{wall_sec};
+	$stage->{peak_RSS_KB} = $s->{peak_RSS_KB} if !defined $stage->{peak_RSS_KB} || $s->{peak_RSS_KB} > $stage->{peak_RSS_KB};
+	$stage->{"$_\_calls"} += $s->{calls}{$_} foreach keys %{ $s->{calls} };
+    }
+
+    my @outputs = ( 'main_results/clusters.txt', map { s/^\Q$out_dir\E\///; $_ } glob "$out_dir/main_results/group*.ordering" );
+    $stages{output} = &checksums( $out_dir, \@outputs );
+    return { test_case => \%stages };
+}
+
+
+
+# run_bench: Run LachesisBench with these arguments, with its output in $out_dir.  Return a hash of "<dataset>_N<N_contigs>" to the stages for each scale.
+sub run_bench( $$$ ) {
+    my ( $out_dir, $args, $dataset ) = @_;
+    system( "rm -rf $out_dir" );
+
+    system( "$bench $args N_THREADS=$threads OUT_DIR=$out_dir > $out_dir.out 2>&1" ) == 0
+	or die "ERROR: LachesisBench failed; see $out_dir.out\n";
+
+    # Read the CSV file.  Its columns are: N_contigs, N_groups, N_read_pairs, stage, wall_sec, CPU_sec, peak_RSS_KB, then the call counts.
+    my %scales;
+    open CSV, '<', "$out_dir/bench.csv" or die "ERROR: Can't find $out_dir/bench.csv: $!";
+    my @header = split /,/, <CSV>;
+    chomp @header;
+    while (<CSV>) {
+	chomp;
+	my @fields = split /,/;
+	my $stage = $scales{"$dataset\_N$fields[0]"}{ $fields[3] } = {};
+	$stage->{wall_sec} = $fields[4];
+	$stage->{peak_RSS_KB} = $fields[6];
+	$stage->{ $header[$_] } = $fields[$_] foreach 7..$#fields;
+    }
+    close CSV;
+
+    # The results of each scale are in its own directory.
+    foreach my $name ( keys %scales ) {
+	my ( $N ) = $name =~ /_N(\d+)$/;
+	my $dir = "$out_dir/N$N";
+	my @outputs = ( 'clusters.txt', map { s/^\Q$dir\E\///; $_ } glob "$dir/group*.ordering" );
+	$scales{$name}{output} = &checksums( $dir, \@outputs );
+    }
+    return \%scales;
+}
+
+
+
+# min_over_reps: Combine the stages from several runs of a dataset.  Take the lowest wall time and RSS.  The call counts and outputs should be the same in
+# all of the runs; warn if they aren't, and take the first run's.
+sub min_over_reps( $ ) {
+    my ( $runs ) = @_;
+    my %stages;
+    foreach my $stage ( keys %{$runs->[0]} ) {
+	foreach my $metric ( keys %{ $runs->[0]{$stage} } ) {
+	    my @values = map { $_->{$stage}{$metric} } @$runs;
+	    if ( $metric eq 'wall_sec' || $metric eq 'peak_RSS_KB' ) {
+		my $min = $values[0];
+		foreach (@values) { $min = $_ if $_ < $min }
+		$stages{$stage}{$metric} = $min;
+	    }
+	    else {
+		warn "WARNING: $stage $metric differs between runs (@values); is the run deterministic?\n" if grep { $_ ne $values[0] } @values;
+		$stages{$stage}{$metric} = $values[0];
+	    }
+	}
+    }
+    return \%stages;
+}
+
+
+
+# checksums: Return a hash of each of these files (relative to $dir) to its MD5 checksum.
+sub checksums( $$ ) {
+    my ( $dir, $files ) = @_;
+    my %md5;
+    foreach my $file (@$files) {
+	open FILE, '<', "$dir/$file" or die "ERROR: Can't find output file $dir/$file: $!";
+	binmode FILE;
+	$md5{$file} = Digest::MD5->new->addfile( *FILE )->hexdigest;
+	close FILE;
+    }
+    return \%md5;
+}
+
+
+
+# machine_independent: True iff this metric doesn't depend on the machine (given the scalar link kernels): the call counts and the checksums, but not the
+# wall times and RSSs.
+sub machine_independent( $ ) {
+    my ( $metric ) = @_;
+    return $metric ne 'wall_sec' && $metric ne 'peak_RSS_KB';
+}
+
+
+
+# read_baseline: Read a baseline file.  Each non-commented line has 4 tab-delimited tokens: dataset, stage, metric, value.
+sub read_baseline( $ ) {
+    my ( $file ) = @_;
+    my %baseline;
+    open IN, '<', $file or die "ERROR: Can't read baseline file $file: $!";
+    while (<IN>) {
+	next if /^\#/ || /^\s*$/; # skip commented and blank lines
+	chomp;
+	my ( $dataset, $stage, $metric, $value ) = split /\t/;
+	die "ERROR: Can't parse line $. of baseline file $file\n" unless defined $value;
+	$baseline{$dataset}{$stage}{$metric} = $value;
+    }
+    close IN;
+    return \%baseline;
+}
+
+
+
+# write_baseline: Write a baseline file, in the format read by read_baseline().  A local baseline has all of the numbers; the committed one only has the
+# machine-independent ones.
+sub write_baseline( $$$ ) {
+    my ( $file, $baseline, $local ) = @_;
+    open OUT, '>', $file or die "ERROR: Can't write to baseline file $file: $!";
+    if ( $local ) {
+	my $host = `hostname`;
+	chomp $host;
+	print OUT "# Local baseline for PerfRegression.pl, made on $host at " . localtime() . " with REPS = $reps, N_THREADS = $threads, and the "
+	    . ( $native_kernels ? "native" : "scalar" ) . " link kernels.\n";
+	print OUT "# The wall times and RSSs are only meaningful on that machine; make a new baseline with 'PerfRegression.pl --update'.\n";
+    }
+    else {
+	print OUT "# Committed baseline for PerfRegression.pl, with N_THREADS = $threads and the scalar link kernels.  It only has the numbers that don't\n";
+	print OUT "# depend on the machine: the call counts and the output checksums.  Rewrite it with 'PerfRegression.pl --update_committed'.\n";
+    }
+    print OUT "# dataset\tstage\tmetric\tvalue\n";
+    foreach my $dataset ( sort keys %$baseline ) {
+	foreach my $stage ( sort keys %{$baseline->{$dataset}} ) {
+	    foreach my $metric ( sort keys %{$baseline->{$dataset}{$stage}} ) {
+		print OUT "$dataset\t$stage\t$metric\t$baseline->{$dataset}{$stage}{$metric}\n";
+	    }
+	}
+    }
+    close OUT;
+}
+
+
+
+# find_exe: Return the path to an executable: the one given, if any; otherwise ../<name> relative to this script, if it exists; otherwise <name> in the PATH.
+sub find_exe( $$ ) {
+    my ( $given, $name ) = @_;
+    return abs_path( $given ) if defined $given && -x $given;
+    die "ERROR: Can't find executable $given\n" if defined $given;
+    return abs_path( "$FindBin::Bin/../$name" ) if -x "$FindBin::Bin/../$name";
+    my $path = `which $name 2>/dev/null`;
+    chomp $path;
+    die "ERROR: Can't find $name.  Build it, or give its path (see the options at the top of $0.)\n" unless $path;
+    return $path;
+}
@@ -17,9 +17,16 @@
 // For general documentation, see TimeMem.h
 
 #include "TimeMem.h"
+#include <assert.h>
 #include <string>
+#include <vector>
 #include <fstream>
+#include <iostream>
+#include <iomanip> // setprecision
 #include <unistd.h> // sysconf, _SC_PAGE_SIZE
+#include <sys/mman.h> // mmap
+#include <sys/resource.h> // getrusage
+#include <time.h> // clock_gettime
 
 
 // Return the current timestamp, in the format:
@@ -83,3 +90,213 @@ double MemUsage( const bool VM )
    }
 }
 
+
+
+// Return the wall-clock time, in seconds, since some arbitrary starting point.
+double WallTime()
+{
+  timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+
+// Return the CPU time (user + system), in seconds, used by this process so far, and optionally by its finished children.
+double CPUTime( const bool children )
+{
+  rusage usage;
+  getrusage( RUSAGE_SELF, &usage );
+  double CPU = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6 * ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec );
+
+  if ( children ) {
+    getrusage( RUSAGE_CHILDREN, &usage );
+    CPU += usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6 * ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec );
+  }
+
+  return CPU;
+}
+
+
+
+// Return the peak resident set usage of this process so far, in KB, or of its largest finished child if that's larger.
+double PeakMemUsage( const bool children )
+{
+  rusage usage;
+  getrusage( RUSAGE_SELF, &usage );
+  long peak = usage.ru_maxrss; // in KB, on Linux
+
+  if ( children ) {
+    getrusage( RUSAGE_CHILDREN, &usage );
+    if ( usage.ru_maxrss > peak ) peak = usage.ru_maxrss;
+  }
+
+  return peak;
+}
+
+
+
+
+// The counts for all the CallCounters are kept in one page of anonymous shared memory, which is inherited by child processes made by fork().  So calls made
+// in a child process are added to the same counts the parent sees.
+static const size_t MAX_N_CALL_COUNTERS = 512;
+
+static int64_t *
+SharedCallCounts()
+{
+  static int64_t * counts = NULL;
+  if ( counts == NULL ) {
+    void * block = mmap( NULL, MAX_N_CALL_COUNTERS * sizeof(int64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if ( block == MAP_FAILED ) {
+      // Fall back to process-private memory.  Everything still works, except that calls in child processes aren't counted.
+      static int64_t private_counts[ MAX_N_CALL_COUNTERS ];
+      block = private_counts;
+    }
+    counts = (int64_t *) block; // mmap'ed memory is zero-filled
+  }
+  return counts;
+}
+
+
+// The list of CallCounters.  This is a function-local static so that it's ready whenever the first static CallCounter is constructed, in any module.
+static vector<CallCounter *> &
+AllCallCounters()
+{
+  static vector<CallCounter *> counters;
+  return counters;
+}
+
+
+CallCounter::CallCounter( const char * name )
+  : _name( name )
+{
+  vector<CallCounter *> & counters = AllCallCounters();
+  if ( counters.size() == MAX_N_CALL_COUNTERS ) {
+    cerr << "ERROR: CallCounter: Can't make more than " << MAX_N_CALL_COUNTERS << " CallCounters" << endl;
+    exit(1);
+  }
+  _N = SharedCallCounts() + counters.size();
+  counters.push_back( this );
+}
+
+
+const vector<CallCounter *> &
+CallCounter::All()
+{
+  return AllCallCounters();
+}
+
+
+
+
+// A record of one stage, as measured by a StageTimer.
+struct StageRecord
+{
+  string name;
+  int depth; // number of enclosing stages
+  bool done;
+  double wall, CPU, peak_RSS; // seconds, seconds, KB
+  vector<int64_t> N_calls; // calls during this stage, counted by each CallCounter
+};
+
+static vector<StageRecord> stage_records; // in order of when the stages started
+static int N_open_stages = 0;
+
+
+StageTimer::StageTimer( const string & name )
+  : _ID( stage_records.size() ),
+    _stopped( false )
+{
+  StageRecord record;
+  record.name = name;
+  record.depth = N_open_stages++;
+  record.done = false;
+  record.wall = record.CPU = record.peak_RSS = 0;
+  stage_records.push_back( record );
+
+  const vector<CallCounter *> & counters = CallCounter::All();
+  for ( size_t i = 0; i < counters.size(); i++ )
+    _N_calls_start.push_back( counters[i]->N() );
+
+  _CPU_start = CPUTime( true );
+  _wall_start = WallTime();
+}
+
+
+
+void
+StageTimer::Stop()
+{
+  if ( _stopped ) return;
+  _stopped = true;
+  N_open_stages--;
+
+  StageRecord & record = stage_records[_ID];
+  record.done = true;
+  record.wall = WallTime() - _wall_start;
+  record.CPU = CPUTime( true ) - _CPU_start;
+  record.peak_RSS = PeakMemUsage( true );
+
+  const vector<CallCounter *> & counters = CallCounter::All();
+  for ( size_t i = 0; i < counters.size(); i++ )
+    record.N_calls.push_back( counters[i]->N() - ( i < _N_calls_start.size() ? _N_calls_start[i] : 0 ) );
+
+  // Print a one-line summary.  Don't disturb cout's number formatting.
+  const streamsize precision = cout.precision();
+  const ios::fmtflags flags = cout.flags();
+  cout << Time() << ": TIMING: " << record.name << ": wall " << fixed << setprecision(2) << record.wall << " s, CPU " << record.CPU << " s, peak RSS "
+       << setprecision(0) << record.peak_RSS << " KB";
+  for ( size_t i = 0; i < counters.size(); i++ )
+    if ( record.N_calls[i] != 0 ) cout << ", " << counters[i]->name() << " calls: " << record.N_calls[i];
+  cout << endl;
+  cout.precision( precision );
+  cout.flags( flags );
+}
+
+
+
+// JSONString: Quote a string for JSON output.
+static string
+JSONString( const string & s )
+{
+  string quoted = "\"";
+  for ( size_t i = 0; i < s.size(); i++ ) {
+    if ( s[i] == '"' || s[i] == '\\' ) quoted += '\\';
+    if ( (unsigned char) s[i] < 0x20 ) quoted += ' ';
+    else quoted += s[i];
+  }
+  return quoted + "\"";
+}
+
+
+void
+WriteStageTimingJSON( const string & file )
+{
+  ofstream out( file.c_str(), ios::out );
+  if ( !out.good() ) {
+    cerr << "ERROR: WriteStageTimingJSON: Can't open file " << file << " for writing" << endl;
+    exit(1);
+  }
+
+  const vector<CallCounter *> & counters = CallCounter::All();
+  out << "{\n  \"stages\": [";
+
+  bool first = true;
+  for ( size_t i = 0; i < stage_records.size(); i++ ) {
+    const StageRecord & record = stage_records[i];
+    if ( !record.done ) continue; // this stage is still going on
+    out << ( first ? "\n" : ",\n" );
+    first = false;
+
+    out << "    { \"name\": " << JSONString( record.name ) << ", \"depth\": " << record.depth
+	<< fixed << setprecision(3) << ", \"wall_sec\": " << record.wall << ", \"CPU_sec\": " << record.CPU
+	<< setprecision(0) << ", \"peak_RSS_KB\": " << record.peak_RSS << ", \"calls\": {";
+    assert( record.N_calls.size() <= counters.size() );
+    for ( size_t j = 0; j < record.N_calls.size(); j++ )
+      out << ( j == 0 ? " " : ", " ) << JSONString( counters[j]->name() ) << ": " << record.N_calls[j];
+    out << " } }";
+  }
+
+  out << "\n  ]\n}\n";
+  out.close();
+}
@@ -20,11 +20,25 @@
  *
  * This module contains two functions: Time() and MemUsage().
  *
+ * It also contains some simple instrumentation for finding out where a long run spends its time:
+ * WallTime(), CPUTime(), and PeakMemUsage(); the CallCounter class, which counts calls to a hot
+ * function; and the StageTimer class, which measures one stage of a program and records it for
+ * WriteStageTimingJSON().
+ *
  *
  * Usage example:
  *
  * cout << Time() << ": This program is using " << MemUsage() << " KB of memory." << endl;
  *
+ * static CallCounter Foo_calls( "Foo" );
+ * void Foo() { ++Foo_calls; ... }
+ *
+ * {
+ *   StageTimer timer( "foo stage" );
+ *   for ( int i = 0; i < 1000; i++ ) Foo();
+ * } // prints the wall time, CPU time, peak memory, and number of calls to Foo in "foo stage"
+ * WriteStageTimingJSON( "timing.json" );
+ *
  *****************************************************************************/
 
 
@@ -32,7 +46,9 @@
 #ifndef __TIME_MEM_H
 #define __TIME_MEM_H
 
+#include <inttypes.h> // int64_t
 #include <string>
+#include <vector>
 using namespace std;
 
 // Return the current timestamp, in the format:
@@ -46,4 +62,72 @@ string Time();
 double MemUsage( const bool VM = false );
 
 
+// Return the wall-clock time, in seconds, since some arbitrary starting point.  Only differences between calls are meaningful.
+double WallTime();
+
+// Return the CPU time (user + system), in seconds, used by this process so far.
+// If children = true, also include the CPU time of all child processes that have finished and been waited for.
+double CPUTime( const bool children = false );
+
+// Return the peak resident set usage of this process so far, in KB.
+// If children = true, return the larger of this and the peak resident set usage of any child process that has finished and been waited for.
+double PeakMemUsage( const bool children = false );
+
+
+
+// CallCounter: A named count of the calls to some function.  Declare each CallCounter as a static object, and increment it at the top of the function.
+// Every StageTimer reports how many calls each CallCounter counted during its stage.  Incrementing is thread-safe.  The counts are kept in memory that's
+// shared with child processes made by fork(), so calls in child processes (e.g., in ForEachInChildProcess(), in Parallel.h) are counted too.
+class CallCounter
+{
+ public:
+  CallCounter( const char * name );
+
+  void operator++() { __atomic_fetch_add( _N, 1, __ATOMIC_RELAXED ); }
+
+  const char * name() const { return _name; }
+  int64_t N() const { return __atomic_load_n( _N, __ATOMIC_RELAXED ); }
+
+  // All: Every CallCounter that has been declared, in order of construction.
+  static const vector<CallCounter *> & All();
+
+ private:
+  CallCounter( const CallCounter & ); // not copyable
+  CallCounter & operator=( const CallCounter & );
+
+  const char * _name;
+  int64_t * _N; // points into the block of shared memory that holds all the counts
+};
+
+
+
+// StageTimer: Measure one stage of a program, from the construction of this object until Stop() is called or the object goes out of scope.  The stage
+// record has the wall time, the CPU time (including child processes that finish during the stage), the peak resident set usage, and the number of calls
+// counted by each CallCounter during the stage.  When the stage ends, a one-line summary is printed to cout, and the record is saved for
+// WriteStageTimingJSON().  Stages may be nested.  StageTimers aren't thread-safe; only use them on the main thread.
+class StageTimer
+{
+ public:
+  StageTimer( const string & name );
+  ~StageTimer() { Stop(); }
+
+  // Stop: End the stage now, and report on it.  Calling Stop() again does nothing.
+  void Stop();
+
+ private:
+  StageTimer( const StageTimer & ); // not copyable
+  StageTimer & operator=( const StageTimer & );
+
+  size_t _ID; // index of this stage's record
+  bool _stopped;
+  double _wall_start, _CPU_start;
+  vector<int64_t> _N_calls_start;
+};
+
+
+// WriteStageTimingJSON: Write the records of all the stages that have ended in this process so far (in order of when they started) to a JSON file.
+// Stages that ran in child processes aren't included, but their CPU time, memory, and calls are included in the stages that waited for them.
+void WriteStageTimingJSON( const string & file );
+
+
 #endif
@@ -0,0 +1,221 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+// For documentation, see ChromIntervalIndex.h.
+#include "ChromIntervalIndex.h"
+
+#include <assert.h>
+#include <inttypes.h> // int64_t
+#include <vector>
+#include <algorithm> // sort
+using namespace std;
+
+
+
+
+/* FUNCTIONS TO ADD DATA */
+
+
+void
+ChromIntervalIndex::Add( const int chrID, const int start, const int stop, const int ID )
+{
+  assert( !_built ); // can't add intervals after Build()
+  assert( chrID >= 0 );
+  assert( stop >= start );
+  Interval x = { start, stop, stop, ID };
+  _intervals.push_back( x );
+  _chrIDs.push_back( chrID );
+}
+
+
+
+// Sort the intervals, then fill in the max_stop of each node in each chromosome's tree, from the leaves up.
+void
+ChromIntervalIndex::Build()
+{
+  assert( !_built );
+  const size_t N = _intervals.size();
+
+  // Sort the intervals by chromosome, then by start and stop.  Sort their indices, because the chromosome IDs are in a separate vector.
+  vector<size_t> order( N );
+  for ( size_t i = 0; i < N; i++ ) order[i] = i;
+  sort( order.begin(), order.end(), [this]( const size_t i, const size_t j ) {
+      if ( _chrIDs[i] != _chrIDs[j] ) return _chrIDs[i] < _chrIDs[j];
+      if ( _intervals[i].start != _intervals[j].start ) return _intervals[i].start < _intervals[j].start;
+      return _intervals[i].stop < _intervals[j].stop; } );
+
+  vector<Interval> sorted( N );
+  for ( size_t i = 0; i < N; i++ ) sorted[i] = _intervals[ order[i] ];
+  const int N_chroms = N == 0 ? 0 : _chrIDs[ order[N-1] ] + 1;
+  _chrom_begin.assign( N_chroms + 1, 0 );
+  for ( size_t i = 0; i < N; i++ ) _chrom_begin[ _chrIDs[i] + 1 ]++;
+  for ( int c = 0; c < N_chroms; c++ ) _chrom_begin[c+1] += _chrom_begin[c];
+  _intervals.swap( sorted );
+  _chrIDs.clear();
+
+
+  // Make each chromosome's tree.  The nodes at level 0 (the even indices) are leaves, so their max_stop is their own stop (as set in Add().)  For each
+  // higher level k, the nodes are at i0 = 2^k - 1, i0 + 2^(k+1), ...; node i's children are at i - 2^(k-1) and i + 2^(k-1).  A right child may be past
+  // the end of the array, if the array's size isn't a power of 2; then the right subtree's max_stop is that of the last node in the array's own subtree,
+  // which is tracked in last_i and last.
+  _chrom_level.assign( N_chroms, -1 );
+  for ( int c = 0; c < N_chroms; c++ ) {
+    Interval * a = &_intervals[ _chrom_begin[c] ];
+    const int64_t n = _chrom_begin[c+1] - _chrom_begin[c];
+    if ( n == 0 ) continue;
+
+    int64_t last_i = 0; // the rightmost node in the tree
+    int last = 0; // the max_stop of node last_i
+    for ( int64_t i = 0; i < n; i += 2 ) {
+      last_i = i;
+      last = a[i].max_stop;
+    }
+
+    int k;
+    for ( k = 1; ( int64_t(1) << k ) <= n; k++ ) {
+      const int64_t x = int64_t(1) << (k-1), i0 = (x << 1) - 1, step = x << 2;
+      for ( int64_t i = i0; i < n; i += step ) {
+	const int left = a[i-x].max_stop;
+	const int right = i + x < n ? a[i+x].max_stop : last;
+	a[i].max_stop = max( a[i].stop, max( left, right ) );
+      }
+      last_i = ( last_i >> k & 1 ) ? last_i - x : last_i + x; // the parent of the old last_i
+      if ( last_i < n && a[last_i].max_stop > last ) last = a[last_i].max_stop;
+    }
+    _chrom_level[c] = k - 1;
+  }
+
+  _built = true;
+}
+
+
+
+void
+ChromIntervalIndex::clear()
+{
+  _intervals.clear();
+  _chrom_begin.clear();
+  _chrom_level.clear();
+  _chrIDs.clear();
+  _built = false;
+}
+
+
+
+
+/* QUERY FUNCTIONS */
+
+
+int
+ChromIntervalIndex::Find( const int chrID, const int pos ) const
+{
+  const int64_t hit = Query( chrID, pos, pos + 1, NULL );
+  return hit == -1 ? -1 : _intervals[hit].ID;
+}
+
+
+
+// Batched Find.  If a query is on the same chromosome as the one before, at the same position or after it, and still inside the interval found for it,
+// then that's the answer again: any interval before it (in sort order) that contains the new position also contains the old one, which would have been
+// found instead.
+void
+ChromIntervalIndex::Find( const vector<int> & chrIDs, const vector<int> & positions, vector<int> & IDs ) const
+{
+  assert( chrIDs.size() == positions.size() );
+  IDs.resize( chrIDs.size() );
+
+  int prev_chrID = -1, prev_pos = 0;
+  int64_t prev_hit = -1;
+
+  for ( size_t i = 0; i < chrIDs.size(); i++ ) {
+    const int chrID = chrIDs[i], pos = positions[i];
+    if ( !( prev_hit != -1 && chrID == prev_chrID && pos >= prev_pos && pos < _intervals[prev_hit].stop ) )
+      prev_hit = Query( chrID, pos, pos + 1, NULL );
+    prev_chrID = chrID;
+    prev_pos = pos;
+    IDs[i] = prev_hit == -1 ? -1 : _intervals[prev_hit].ID;
+  }
+}
+
+
+
+void
+ChromIntervalIndex::FindOverlaps( const int chrID, const int start, const int stop, vector<int> & IDs ) const
+{
+  vector<size_t> hits;
+  Query( chrID, start, stop, &hits );
+  for ( size_t i = 0; i < hits.size(); i++ )
+    IDs.push_back( _intervals[ hits[i] ].ID );
+}
+
+
+
+
+// The tree walk.  Start at the root and go down, skipping any subtree whose max_stop is <= start (since none of its intervals can reach the query) and any
+// right subtree whose root starts at or after stop (since it and all the intervals after it start too late).  Left subtrees are visited before their
+// roots, and roots before their right subtrees, so the hits come out in sorted order.  Small subtrees (level <= 3, i.e., at most 15 nodes) are just
+// scanned, which is faster than walking them.
+int64_t
+ChromIntervalIndex::Query( const int chrID, const int start, const int stop, vector<size_t> * hits ) const
+{
+  assert( _built ); // call Build() first
+  if ( chrID < 0 || chrID + 1 >= int( _chrom_begin.size() ) ) return -1;
+  const int level = _chrom_level[chrID];
+  if ( level < 0 ) return -1;
+  const size_t offset = _chrom_begin[chrID];
+  const Interval * a = &_intervals[offset];
+  const int64_t n = _chrom_begin[chrID+1] - offset;
+
+  // The stack of nodes to visit.  Each node is at index x, at level k; w is true once its left subtree has been visited.
+  struct Node { int64_t x; int k; bool w; };
+  Node stack[64];
+  int t = 0;
+  Node root = { ( int64_t(1) << level ) - 1, level, false };
+  stack[t++] = root;
+
+  while ( t > 0 ) {
+    const Node z = stack[--t];
+
+    if ( z.k <= 3 ) { // a small subtree: scan its nodes in order
+      const int64_t i0 = z.x >> z.k << z.k;
+      const int64_t i1 = min( n, i0 + ( int64_t(1) << (z.k+1) ) - 1 );
+      for ( int64_t i = i0; i < i1 && a[i].start < stop; i++ )
+	if ( start < a[i].stop ) {
+	  if ( hits == NULL ) return offset + i;
+	  hits->push_back( offset + i );
+	}
+    }
+    else if ( !z.w ) { // visit the left subtree first, then come back to this node
+      const int64_t y = z.x - ( int64_t(1) << (z.k-1) ); // the left child, which may be past the end of the array
+      Node back = { z.x, z.k, true };
+      stack[t++] = back;
+      if ( y >= n || a[y].max_stop > start ) {
+	Node left = { y, z.k - 1, false };
+	stack[t++] = left;
+      }
+    }
+    else if ( z.x < n && a[z.x].start < stop ) { // this node, then its right subtree
+      if ( start < a[z.x].stop ) {
+	if ( hits == NULL ) return offset + z.x;
+	hits->push_back( offset + z.x );
+      }
+      Node right = { z.x + ( int64_t(1) << (z.k-1) ), z.k - 1, false };
+      stack[t++] = right;
+    }
+  }
+
+  return hits == NULL || hits->empty() ? -1 : (*hits)[0];
+}
@@ -0,0 +1,133 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+/******************************************************************************
+ *
+ * ChromIntervalIndex
+ *
+ * A static index of a set of intervals on chromosomes, for fast point and
+ * range queries: which intervals contain a position, or overlap a range?
+ * The intervals may overlap one another.  Each interval has an ID, which is
+ * what the queries return; e.g., a chrom_interval's ID can be its index in a
+ * vector of chrom_intervals.
+ *
+ * The chromosome IDs can be any non-negative ints: chrom_interval::chrID
+ * values, or target IDs in a SAM/BAM file (see SAMStepper::FilterMask.)
+ * Positions are 0-based, and intervals are half-open: [start,stop).
+ *
+ * Usage:
+ * ChromIntervalIndex index;
+ * index.Add( chrID, start, stop, ID ); // as many times as needed
+ * index.Build(); // call once, after all the Add()s and before any queries
+ * int ID = index.Find( chrID, pos );
+ *
+ *
+ * Each chromosome's intervals are kept in one flat array, sorted by start.
+ * The array doubles as an implicit augmented interval tree: the intervals at
+ * the even indices are the leaves, the node at index i with k trailing 1 bits
+ * is at level k, and each node holds the largest stop in its subtree.  So a
+ * query is a walk down a binary tree with no pointers, in O(log N) time (plus
+ * the number of intervals found), touching little memory.  The layout is the
+ * one in Heng Li's cgranges library.
+ *
+ * Once built, the index is not modified by the queries, so it can be queried
+ * from any number of threads at once.
+ *
+ *
+ *****************************************************************************/
+
+
+#ifndef _CHROM_INTERVAL_INDEX__H
+#define _CHROM_INTERVAL_INDEX__H
+
+#include <assert.h>
+#include <stddef.h>
+#include <inttypes.h> // int64_t
+#include <vector>
+using namespace std;
+
+// Local modules in the gtools library.
+#include "ChromInterval.h"
+
+
+class ChromIntervalIndex
+{
+ public:
+
+  /* CONSTRUCTORS */
+
+  ChromIntervalIndex() : _built( false ) {}
+
+  /* FUNCTIONS TO ADD DATA */
+
+  // Add: Add an interval [start,stop) on chromosome chrID, with the given ID.  Call this before Build().
+  void Add( const int chrID, const int start, const int stop, const int ID );
+  // Add a chrom_interval, with its ID.
+  void Add( const chrom_interval & x ) { Add( x.chrID, x.start, x.stop, x.ID ); }
+
+  // Build: Sort the intervals and make the index.  Call this once, after adding all the intervals and before the queries.
+  void Build();
+
+  // clear: Remove all of the intervals.  Intervals can then be added again.
+  void clear();
+
+  /* QUERY FUNCTIONS */
+
+  bool built() const { return _built; }
+  size_t size() const { return _intervals.size(); }
+
+  // Find: If any intervals contain position pos on chromosome chrID, return the ID of the first one (the one with the lowest start, then the lowest stop.)
+  // Otherwise return -1.  An unknown chromosome (e.g., chrID = -1, as for an unaligned read) contains no intervals.
+  int Find( const int chrID, const int pos ) const;
+  bool Contains( const int chrID, const int pos ) const { return Find( chrID, pos ) != -1; }
+
+  // Batched Find: Fill IDs[i] with Find( chrIDs[i], positions[i] ), for each i.  This is faster than calling Find() in a loop when the queries are sorted
+  // (e.g., the reads from a coordinate-sorted BAM file), because it skips the tree walk for each query that's in the same interval as the one before.
+  void Find( const vector<int> & chrIDs, const vector<int> & positions, vector<int> & IDs ) const;
+
+  // FindOverlaps: Append to IDs the IDs of all the intervals that overlap [start,stop) on chromosome chrID, in order of start.
+  void FindOverlaps( const int chrID, const int start, const int stop, vector<int> & IDs ) const;
+
+
+ private:
+
+  // The tree walk that does the work for Find() and FindOverlaps().  Find the intervals overlapping [start,stop) on chromosome chrID, in order of start,
+  // and return the index in _intervals of the first one, or -1 if there are none.  If hits isn't NULL, append all of their indices to it; otherwise, stop
+  // at the first one.
+  int64_t Query( const int chrID, const int start, const int stop, vector<size_t> * hits ) const;
+
+  struct Interval {
+    int start, stop; // the interval is [start,stop)
+    int max_stop; // the largest stop in this node's subtree
+    int ID;
+  };
+
+  // The intervals, sorted by chromosome, then start, then stop.  The intervals on chromosome c are _intervals[ _chrom_begin[c], _chrom_begin[c+1] ), and
+  // _chrom_level[c] is the level of the root of their tree.
+  vector<Interval> _intervals;
+  vector<size_t> _chrom_begin;
+  vector<int> _chrom_level;
+
+  // The chromosome of each interval, as they're added (before Build().)
+  vector<int> _chrIDs;
+
+  bool _built;
+};
+
+
+
+
+#endif
@@ -28,6 +28,7 @@
 // Modules in ~/include/gtools.
 #include "HumanGenome.h"
 #include "ChromInterval.h" // chrom_interval
+#include "ChromIntervalIndex.h"
 #include "FileParsers.h" // ParseBEDgraph
 
 // Boost libraries.
@@ -43,7 +44,8 @@ const map<string,int> chrom_to_chrID = HumanGenome_chrom_IDs();
 
 
 CopyNumberProfile::CopyNumberProfile()
-  : _gap_size( 0 )
+  : _indexed( false ),
+    _gap_size( 0 )
 {
   _CNs.resize  ( HumanGenome_n_chroms );
   _HRCNs.resize( HumanGenome_n_chroms );
@@ -54,7 +56,8 @@ CopyNumberProfile::CopyNumberProfile()
 // Load data in from a BEDgraph file.
 // Files written with CopyNumberProfile::Write() can be loaded here (CNs only!)
 CopyNumberProfile::CopyNumberProfile( const string & BEDgraph_file, const int gap_size )
-  : _gap_size( gap_size )
+  : _indexed( false ),
+    _gap_size( gap_size )
 {
   _CNs.resize  ( HumanGenome_n_chroms );
   _HRCNs.resize( HumanGenome_n_chroms );
@@ -86,6 +89,7 @@ CopyNumberProfile::AddCN( const chrom_interval & interval, const int CN )
 {
   int chrID = interval.chrID;
   assert( chrID != -1 );
+  _indexed = false;
 
   // Consider the already-existing HRCN intervals on this chromosome.
   // Determine whether this HRCN interval can be merged into the existing final
@@ -135,9 +139,16 @@ CopyNumberProfile::AddHRCN( const chrom_interval & interval, const int major_CN,
   assert( chrID != -1 );
   assert( major_CN >= minor_CN );
   pair<int,int> HRCN = make_pair( major_CN, minor_CN );
-
-  // Verify that this region's HRCN is consistent with its already-recorded CN.
-  assert( CN( interval ) == major_CN + minor_CN );
+  _indexed = false;
+
+  // Verify that this region's HRCN is consistent with its already-recorded CN.  Look for the CN call directly in _CNs, searching back from the end, since
+  // the calls are added in order; CN() would remake the index every time data were added.
+  {
+    const map<chrom_interval,int> & CNs = _CNs[chrID];
+    map<chrom_interval,int>::const_reverse_iterator it = CNs.rbegin();
+    while ( it != CNs.rend() && it->first.start > interval.start ) ++it;
+    assert( it != CNs.rend() && it->first.contains( interval ) && it->second == major_CN + minor_CN );
+  }
 
 
   // Consider the already-existing HRCN intervals on this chromosome.
@@ -246,16 +257,13 @@ CopyNumberProfile::CN_regions( const chrom_interval & query ) const
 {
   vector<chrom_interval> regions;
   if ( query.empty() ) return regions; // empty in -> empty out
+  Index();
 
-  // Get the set of copy-number calls (i.e., chrom_intervals) on this chrom.
-  const map<chrom_interval,int> & intervals = _CNs[ query.chrID ];
-
-  // Loop over all the copy-number calls and search for intervals that overlap the query.
-  map<chrom_interval,int>::const_iterator iter;
-  for ( iter = intervals.begin(); iter != intervals.end(); iter++ ) {
-    chrom_interval overlap = iter->first.intersection( query );
-    if ( !overlap.empty() ) regions.push_back( overlap );
-  }
+  // Find the copy-number calls (i.e., chrom_intervals) that overlap the query.  They come in order.
+  vector<int> IDs;
+  _CN_index.FindOverlaps( query.chrID, query.start, query.stop, IDs );
+  for ( size_t i = 0; i < IDs.size(); i++ )
+    regions.push_back( _CN_list[ IDs[i] ].first.intersection( query ) );
 
   return regions;
 }
@@ -294,15 +302,11 @@ CopyNumberProfile::HRCN( const chrom_interval & query ) const
 pair<chrom_interval,int>
 CopyNumberProfile::CN_and_interval( const string & chrom, const int pos ) const
 {
-  // Get the set of copy-number calls (i.e., chrom_intervals) on this chrom.
-  const map<chrom_interval,int> & intervals = _CNs[ chrom_to_chrID.at(chrom) ];
+  Index();
 
-  // Loop over all the copy-number calls and search for an interval that
-  // contains this position.
-  map<chrom_interval,int>::const_iterator iter;
-  for ( iter = intervals.begin(); iter != intervals.end(); iter++ )
-    if ( iter->first.contains(pos) )
-      return *iter;
+  // Look up the copy-number call (i.e., chrom_interval) that contains this position.  The calls don't overlap, so there's at most one.
+  const int ID = _CN_index.Find( chrom_to_chrID.at(chrom), pos );
+  if ( ID != -1 ) return _CN_list[ID];
 
   // If no interval contains this position, return the dummy answer.
   return make_pair( chrom_interval(), -1 );
@@ -316,15 +320,11 @@ CopyNumberProfile::CN_and_interval( const string & chrom, const int pos ) const
 pair<chrom_interval, pair<int,int> >
 CopyNumberProfile::HRCN_and_interval( const string & chrom, const int pos ) const
 {
-  // Get the set of HRCN (i.e., chrom_intervals) on this chrom.
-  const map<chrom_interval, pair<int,int> > & intervals = _HRCNs[ chrom_to_chrID.at(chrom) ];
+  Index();
 
-  // Loop over all the copy-number calls and search for an interval that
-  // contains this position.
-  map<chrom_interval, pair<int,int> >::const_iterator iter;
-  for ( iter = intervals.begin(); iter != intervals.end(); iter++ )
-    if ( iter->first.contains(pos) )
-      return *iter;
+  // Look up the HRCN call (i.e., chrom_interval) that contains this position.  The calls don't overlap, so there's at most one.
+  const int ID = _HRCN_index.Find( chrom_to_chrID.at(chrom), pos );
+  if ( ID != -1 ) return _HRCN_list[ID];
 
   // If no interval contains this position, return the dummy answer.
   return make_pair( chrom_interval(), make_pair(-1,-1) );
@@ -332,6 +332,35 @@ CopyNumberProfile::HRCN_and_interval( const string & chrom, const int pos ) cons
 
 
 
+// Index: If any CN or HRCN data has been added since the last query, (re)make the indices of the CN and HRCN calls.
+void
+CopyNumberProfile::Index() const
+{
+  if ( _indexed ) return;
+
+  _CN_index.clear();
+  _CN_list.clear();
+  for ( size_t i = 0; i < _CNs.size(); i++ )
+    for ( map<chrom_interval,int>::const_iterator it = _CNs[i].begin(); it != _CNs[i].end(); ++it ) {
+      _CN_index.Add( it->first.chrID, it->first.start, it->first.stop, _CN_list.size() );
+      _CN_list.push_back( *it );
+    }
+  _CN_index.Build();
+
+  _HRCN_index.clear();
+  _HRCN_list.clear();
+  for ( size_t i = 0; i < _HRCNs.size(); i++ )
+    for ( map< chrom_interval, pair<int,int> >::const_iterator it = _HRCNs[i].begin(); it != _HRCNs[i].end(); ++it ) {
+      _HRCN_index.Add( it->first.chrID, it->first.start, it->first.stop, _HRCN_list.size() );
+      _HRCN_list.push_back( *it );
+    }
+  _HRCN_index.Build();
+
+  _indexed = true;
+}
+
+
+
 /************************************
  *                                  *
  *         OUTPUT FUNCTIONS         *
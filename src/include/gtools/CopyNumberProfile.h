@@ -23,12 +23,11 @@
  *
  *
  * The main query function is CN(), which can be called on either a single
- * position or a chrom_interval, and returns a called copy number.  If you have
- * a sorted set of positions or chrom_intervals, using the CopyNumberProfile
- * isn't as quite as fast as the stepping-through-both-sorted-sets-at-once
- * method (as demonstrated in HapSplitter::CallHapResolvedCopyNumbers) because
- * each individual call requires CopyNumberProfile to look through the whole
- * set of copy-number calls.
+ * position or a chrom_interval, and returns a called copy number.  The
+ * queries look up the copy-number calls in a ChromIntervalIndex, so each one
+ * takes O(log N) time, however many calls there are.  The index is made at
+ * the first query after any CN or HRCN data is added, so once you're done
+ * adding data, make one query before querying from several threads at once.
  *
  *
  * The CopyNumberProfile can also store HRCNs (Haplotype-Resolved Copy Numbers)
@@ -52,6 +51,7 @@
 
 
 #include "ChromInterval.h"
+#include "ChromIntervalIndex.h"
 
 #include <string>
 #include <map>
@@ -120,6 +120,9 @@ class CopyNumberProfile
   pair<chrom_interval,int> CN_and_interval( const string & chrom, const int pos ) const;
   pair<chrom_interval, pair<int,int> > HRCN_and_interval( const string & chrom, const int pos ) const;
 
+  // Index: If any CN or HRCN data has been added since the last query, (re)make _CN_index and _HRCN_index.
+  void Index() const;
+
 
   // Copy-number calls, and haplotype-resolved copy-number (HRCN) calls.
   // These vectors are indexed by chromosome.  The chrom_intervals on which CNs
@@ -127,6 +130,13 @@ class CopyNumberProfile
   vector< map< chrom_interval, int > > _CNs;
   vector< map< chrom_interval, pair<int,int> > > _HRCNs;
 
+  // Indices of the CN and HRCN calls, for the queries; made by Index().  An interval's ID is its index in _CN_list or _HRCN_list, which are flat copies of
+  // _CNs and _HRCNs.
+  mutable bool _indexed;
+  mutable ChromIntervalIndex _CN_index, _HRCN_index;
+  mutable vector< pair< chrom_interval, int > > _CN_list;
+  mutable vector< pair< chrom_interval, pair<int,int> > > _HRCN_list;
+
   // Acceptable size of gaps between CNs and HRCNs.
   // Gaps of size <= _gap_size will be merged by AddCN and AddHRCN.
   int _gap_size;
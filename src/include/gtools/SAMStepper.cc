@@ -17,12 +17,14 @@
 // For documentation, see SAMStepper.h
 #include "SAMStepper.h"
 
+#include <stdlib.h> // exit
 #include <string.h>
 #include <assert.h>
 #include <vector>
 #include <string>
 #include <iostream>
 #include "../TimeMem.h"
+#include "ChromIntervalIndex.h"
 
 // Boost libraries
 #include <boost/algorithm/string.hpp> // to_upper
@@ -59,6 +61,8 @@ SAMStepper::~SAMStepper()
   if ( _N_pairs_read  > 0 ) free(_align2->data);
   delete _align;
   delete _align2;
+  if ( _iter  != NULL ) bam_iter_destroy(_iter);
+  if ( _index != NULL ) bam_index_destroy(_index);
   samclose(_SAM);
 }
 
@@ -89,6 +93,17 @@ SAMStepper::Init()
   _filter_chrom = -1;
   _filter_start = -1;
   _filter_end = -1;
+  _subsample_fraction = 1;
+  _mask = NULL;
+
+  // The index is only used if a region filter is set.
+  _indexed = true;
+  for ( size_t i = 0; i < _SAM_files.size(); i++ )
+    if ( !HasBAMIndex( _SAM_files[i] ) ) _indexed = false;
+  _use_index = false;
+  _region_ID = 0;
+  _index = NULL;
+  _iter = NULL;
 
   // Open the first SAM/BAM file.  (Don't yet read any alignments from it!)
   assert( !_SAM_files.empty() );
@@ -126,6 +141,61 @@ SAMStepper::FilterRegion( const int chrom, const int start, const int end )
   _filter_chrom = chrom;
   _filter_start = start;
   _filter_end = end;
+
+  // With an index, read only this region.  The index finds the reads overlapping [start,end]; the filter above then keeps those starting in it.
+  if ( _indexed && chrom != -1 ) {
+    const Region region = { chrom, ( start != -1 && end != -1 ? start : 0 ), ( start != -1 && end != -1 ? end + 1 : 1 << 29 ) };
+    _regions.assign( 1, region );
+    _use_index = true;
+    _ID = 0;
+    samclose(_SAM);
+    _SAM = open_next();
+  }
+}
+
+
+void
+SAMStepper::FilterSubsample( const double fraction )
+{
+  assert( _N_aligns_read == 0 && _N_pairs_read == 0 ); // can't turn on a filter after beginning to go through alignments
+  assert( fraction > 0 && fraction <= 1 );
+  _subsample_fraction = fraction;
+}
+
+
+void
+SAMStepper::FilterMask( const ChromIntervalIndex & mask )
+{
+  assert( _N_aligns_read == 0 && _N_pairs_read == 0 ); // can't turn on a filter after beginning to go through alignments
+  assert( mask.built() );
+  _mask = &mask;
+}
+
+
+void
+SAMStepper::FilterRegions( const vector<int> & chroms )
+{
+  assert( _N_aligns_read == 0 && _N_pairs_read == 0 ); // can't turn on a filter after beginning to go through alignments
+
+  _filter_aligned = true; // a read can't align to a specific region if it doesn't align at all!
+  _filter_chroms.assign( N_targets(), false );
+  for ( size_t i = 0; i < chroms.size(); i++ ) {
+    assert( chroms[i] >= 0 && chroms[i] < N_targets() );
+    _filter_chroms[ chroms[i] ] = true;
+  }
+
+  // With an index, read only these chromosomes, in this order.
+  if ( _indexed ) {
+    _regions.clear();
+    for ( size_t i = 0; i < chroms.size(); i++ ) {
+      const Region region = { chroms[i], 0, 1 << 29 }; // 1 << 29 is the largest position that a BAI index can hold
+      _regions.push_back( region );
+    }
+    _use_index = true;
+    _ID = 0;
+    samclose(_SAM);
+    _SAM = open_next();
+  }
 }
 
 
@@ -136,51 +206,91 @@ samfile_t *
 SAMStepper::open_next()
 {
   if ( _verbose ) cout << Time() << ": SAMStepper is opening file: " << _SAM_files[_ID] << endl;
+
+  if ( _use_index ) {
+    if ( _iter  != NULL ) bam_iter_destroy(_iter);
+    if ( _index != NULL ) bam_index_destroy(_index);
+    _iter = NULL;
+    _region_ID = 0;
+    _index = bam_index_load( _SAM_files[_ID].c_str() );
+    if ( _index == NULL ) {
+      cerr << "ERROR: SAMStepper: can't load the BAM index for file " << _SAM_files[_ID] << endl;
+      exit(1);
+    }
+  }
+
   return open_SAM( _SAM_files[_ID] );
 }
 
 
 
 
+// read_next(): Read the next alignment into _align, from the file or (if using the index) from the next region in the file.  Return false at the end of
+// the file.
+bool
+SAMStepper::read_next()
+{
+  if ( !_use_index ) return samread( _SAM, _align ) != -1;
+
+  while ( 1 ) {
+    if ( _iter == NULL ) {
+      if ( _region_ID == _regions.size() ) return false;
+      const Region & region = _regions[ _region_ID++ ];
+      _iter = bam_iter_query( _index, region.chrom, region.start, region.end );
+    }
+    if ( bam_iter_read( _SAM->x.bam, _iter, _align ) >= 0 ) return true;
+    bam_iter_destroy(_iter);
+    _iter = NULL;
+  }
+}
+
+
+
+
 // next_read(): Main function to get an alignment.  Fills the variable _align and also returns it.  Return NULL if there are no more alignments to get.
 bam1_t *
 SAMStepper::next_read()
 {
-  // Get the next alignment from the currently open SAM/BAM file.
-  while ( samread( _SAM, _align ) != -1 ) {
-    const bam1_core_t & c = _align->core;
+  // Loop over the SAM/BAM files, starting with the currently open one.  (This is a loop rather than a recursion, so it doesn't matter how many files there
+  // are, or how many of them have no alignments that pass the filters.)
+  while ( 1 ) {
 
-    // If alignment and/or range filters have been set, skip over any read that doesn't meet them.
-    bool aligned = !( c.flag & 0x4 );
-    if ( _filter_aligned && !aligned ) continue;
+    // Get the next alignment from the currently open SAM/BAM file.
+    while ( read_next() ) {
+      const bam1_core_t & c = _align->core;
 
-    if ( _filter_aligned_pair && ( c.flag & 0x8 ) ) continue;
+      // If alignment and/or range filters have been set, skip over any read that doesn't meet them.
+      bool aligned = !( c.flag & 0x4 );
+      if ( _filter_aligned && !aligned ) continue;
 
-    if ( _filter_chrom != -1 && _filter_chrom != c.tid ) continue;
-    if ( ( _filter_start != -1 && _filter_end != -1 ) && ( c.pos < _filter_start || c.pos > _filter_end ) ) continue;
+      if ( _filter_aligned_pair && ( c.flag & 0x8 ) ) continue;
 
-    // Sanity check.  Aligned reads should satisfy all of these.
-    if ( aligned ) {
-      assert( c.tid != -1 ); // note that c.pos == -1 can occur because for some reason c.pos is 1 less than the number in the POS column of the samfile
-      assert( c.n_cigar > 0 );
-    }
+      if ( _filter_chrom != -1 && _filter_chrom != c.tid ) continue;
+      if ( !_filter_chroms.empty() && ( c.tid < 0 || !_filter_chroms[c.tid] ) ) continue;
+      if ( ( _filter_start != -1 && _filter_end != -1 ) && ( c.pos < _filter_start || c.pos > _filter_end ) ) continue;
+      if ( _subsample_fraction < 1 && !SubsampleKeeps( bam1_qname(_align), _subsample_fraction ) ) continue;
+      if ( _mask != NULL && ( _mask->Contains( c.tid, c.pos ) || _mask->Contains( c.mtid, c.mpos ) ) ) continue;
 
-    _N_aligns_read++;
-    return _align;
-  }
+      // Sanity check.  Aligned reads should satisfy all of these.
+      if ( aligned ) {
+	assert( c.tid != -1 ); // note that c.pos == -1 can occur because for some reason c.pos is 1 less than the number in the POS column of the samfile
+	assert( c.n_cigar > 0 );
+      }
 
+      _N_aligns_read++;
+      return _align;
+    }
 
-  // If control reaches here, we've exhausted this SAM/BAM file.
-  // If there are no more files, we're done: return NULL.
-  if ( _ID + 1 == (int)_SAM_files.size() ) return NULL;
 
-  // If there's another SAM/BAM file to open, open it.
-  _ID++;
-  samclose(_SAM);
-  _SAM = open_next();
+    // If control reaches here, we've exhausted this SAM/BAM file.
+    // If there are no more files, we're done: return NULL.
+    if ( _ID + 1 == (int)_SAM_files.size() ) return NULL;
 
-  // Now recurse on next_read() so that we can actually find and return an alignment.
-  return next_read();
+    // If there's another SAM/BAM file to open, open it.
+    _ID++;
+    samclose(_SAM);
+    _SAM = open_next();
+  }
 }
 
 
@@ -203,18 +313,8 @@ SAMStepper::next_pair()
   // (which oddly happens sometimes with MT-aligned reads in this one SAM file.)
   while ( 1 ) {
 
-    // Find the first non-matching character between the names.
-    // If it's punctuation (i.e., not alphanumeric), or if we reach the end of the strings, the names are considered to match.
     //cout << "NAMES: " << bam1_qname(_align) << "\t" << bam1_qname(_align2) << endl;
-    const char * name1 = bam1_qname(_align);
-    const char * name2 = bam1_qname(_align2);
-    int len1 = strlen(name1), len2 = strlen(name2);
-    //cout << "LENGTHS = " << len1 << '\t' << len2 << '\t' << name1[len2] << '\t' << boolalpha << isalpha(name1[len2]) << endl;
-    if ( strncmp( name1, name2, min( len1, len2 ) ) == 0 ) {
-      if ( len1 == len2 ) break;
-      else if ( len1 > len2 ) { if ( !isalnum( name1[len2] ) ) break; }
-      else if ( len2 > len1 ) { if ( !isalnum( name2[len1] ) ) break; }
-    }
+    if ( ReadNamesMatch( bam1_qname(_align), bam1_qname(_align2) ) ) break;
 
     // No match found.  Move on.
     _N_aligns_read--; // offset the increase due to the extra next_read() call
@@ -232,6 +332,91 @@ SAMStepper::next_pair()
 
 
 
+// next_batch(): Get the next N alignments (or as many as are left) that pass the filters, as in next_read(), and put them in batch, replacing its contents.
+// Return the number of alignments in the batch; 0 means there are no more alignments.
+size_t
+SAMStepper::next_batch( SAMBatch & batch, const size_t N )
+{
+  batch.clear();
+
+  for ( bam1_t * align = NULL; batch.size() < N && ( align = next_read() ) != NULL; ) {
+    const bam1_core_t & c = align->core;
+    batch.tid .push_back( c.tid );
+    batch.pos .push_back( c.pos );
+    batch.mtid.push_back( c.mtid );
+    batch.mpos.push_back( c.mpos );
+    batch.qual.push_back( c.qual );
+    batch.flag.push_back( c.flag );
+
+    const char * name = bam1_qname(align);
+    batch.pairs_with_prev.push_back( _N_aligns_read > 1 && ReadNamesMatch( _prev_name.c_str(), name ) );
+    _prev_name = name;
+  }
+
+  return batch.size();
+}
+
+
+
+void
+SAMBatch::clear()
+{
+  tid.clear();
+  pos.clear();
+  mtid.clear();
+  mpos.clear();
+  qual.clear();
+  flag.clear();
+  pairs_with_prev.clear();
+}
+
+
+
+
+// ReadNamesMatch(): Return true iff these two read names appear to belong to the same fragment (i.e., the two reads are a pair.)
+// Find the first non-matching character between the names.  If it's punctuation (i.e., not alphanumeric), or if we reach the end of the strings, the names
+// are considered to match.  For example, "read1/1" matches "read1/2", and "read1" matches "read1.2", but "read1" doesn't match "read12".
+bool
+ReadNamesMatch( const char * name1, const char * name2 )
+{
+  int len1 = strlen(name1), len2 = strlen(name2);
+  //cout << "LENGTHS = " << len1 << '\t' << len2 << '\t' << name1[len2] << '\t' << boolalpha << isalpha(name1[len2]) << endl;
+  if ( strncmp( name1, name2, min( len1, len2 ) ) != 0 ) return false;
+
+  if ( len1 == len2 ) return true;
+  else if ( len1 > len2 ) return !isalnum( name1[len2] );
+  else                    return !isalnum( name2[len1] );
+}
+
+
+
+
+// SubsampleKeeps(): Return true iff a read with this name is in the subsample of reads with the given fraction.
+// The hash is a 64-bit FNV-1a hash of the name, followed by the finalizer of the splitmix64 generator so that names that differ only in their last few
+// characters (e.g., consecutive read numbers) are spread evenly over [0,1).  It doesn't depend on the platform, so every run picks the same reads.
+bool
+SubsampleKeeps( const char * read_name, const double fraction )
+{
+  if ( fraction >= 1 ) return true;
+
+  size_t len = strlen( read_name );
+  if ( len >= 2 && read_name[len-2] == '/' && ( read_name[len-1] == '1' || read_name[len-1] == '2' ) ) len -= 2;
+
+  uint64_t h = 14695981039346656037ULL;
+  for ( size_t i = 0; i < len; i++ ) {
+    h ^= (unsigned char) read_name[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+
+  return ( h >> 11 ) * ( 1.0 / 9007199254740992.0 ) < fraction; // the top 53 bits, as a double in [0,1)
+}
+
+
+
+
 // open_SAM(): A wrapper to samopen() which figures out the open mode (SAM vs. BAM.)
 samfile_t *
 open_SAM( const string & file )
@@ -244,6 +429,18 @@ open_SAM( const string & file )
 
 
 
+// HasBAMIndex(): Return true iff this is a BAM file with a BAI index, at <file>.bai or at <file> with the suffix ".bam" replaced by ".bai".
+// These are the places where bam_index_load() looks.
+bool
+HasBAMIndex( const string & SAM_file )
+{
+  if ( SAM_file.size() < 3 || boost::to_upper_copy( SAM_file.substr( SAM_file.size() - 3 ) ) != "BAM" ) return false;
+  if ( boost::filesystem::is_regular_file( SAM_file + ".bai" ) ) return true;
+  return SAM_file.substr( SAM_file.size() - 3 ) == "bam" && boost::filesystem::is_regular_file( SAM_file.substr( 0, SAM_file.size() - 3 ) + "bai" );
+}
+
+
+
 // NTargetsInSAM(): Return the number of target sequences in this SAM file.
 int
 NTargetsInSAM( const string & SAM_file )
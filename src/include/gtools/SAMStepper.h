@@ -33,6 +33,15 @@
  *
  * }
  *
+ * -- or, to loop over just the alignment fields (see SAMBatch) in tight loops --
+ *
+ * SAMBatch batch;
+ * while ( stepper.next_batch( batch ) ) {
+ *   for ( size_t i = 0; i < batch.size(); i++ ) {
+ *     // do something with batch.tid[i], batch.pos[i], ...
+ *   }
+ * }
+ *
  *
  *
  *
@@ -43,6 +52,17 @@
  * Hence a subsequent call to next_read() or next_pair() will change the pointer, as well as any bam1_core_t &'s (but not bam1_core_t's) pointing inside the
  * alignment.
  *
+ * Random access: if every file is a BAM file with a BAI index (<file>.bai, or <file> with ".bam" replaced by ".bai"), FilterRegion() and FilterRegions()
+ * jump straight to the requested regions via the index, instead of reading the whole file and discarding the reads elsewhere.  Indexed BAM files are
+ * coordinate-sorted, so the two reads of a pair are generally not consecutive, and next_pair() can't find them; pair the reads from next_read() by name
+ * instead.  Each SAMStepper has its own file handles, so several SAMStepper objects can read different regions of the same files in parallel threads.
+ *
+ * Subsampling: FilterSubsample() keeps a fixed fraction of the reads, chosen by a hash of the read name (see SubsampleKeeps()).  The two reads of a pair
+ * have the same name, so they're kept or dropped together, and the same reads are kept on every run, in every thread, and however the files are read.
+ *
+ * Masking: FilterMask() drops the reads in (or with mates in) a set of regions, such as repeats or copy-number anomalies, given as a ChromIntervalIndex
+ * on the SAM target IDs.  The test uses the positions of both reads, so again both reads of a pair are kept or dropped together.
+ *
  *
  * This class was originally a helper class in the AlgorithmOctopus module of SimCancer (July 2011).
  *
@@ -56,15 +76,32 @@
 #ifndef __SAM_STEPPER_H
 #define __SAM_STEPPER_H
 
+#include <inttypes.h> // int32_t
 #include <vector>
 #include <string>
 #include <assert.h>
 using namespace std;
 
+class ChromIntervalIndex;
+
 // To compile using this, you must include -I<samtools dir>
 #include <bam/sam.h>
 
 
+// SAMBatch: A block of alignments, as returned by SAMStepper::next_batch(), with the fields of the alignments' cores laid out as a struct of arrays.
+// The arrays are reused from one call to the next, so a loop over batches doesn't allocate memory once the arrays have grown to the batch size.
+struct SAMBatch
+{
+  vector<int32_t> tid, pos, mtid, mpos;
+  vector<uint8_t> qual; // mapping quality
+  vector<uint16_t> flag;
+  vector<uint8_t> pairs_with_prev; // 1 iff this read's name matches the name of the read before it (possibly in the previous batch), as in next_pair()
+
+  size_t size() const { return tid.size(); }
+  void clear();
+};
+
+
 class SAMStepper
 {
 
@@ -86,8 +123,16 @@ class SAMStepper
   void FilterAligned();
   // FilterAlignedPairs: Only accept reads in pairs that both aligned (i.e., FLAG & 0x4 == 0 and FLAG & 0x8 == 0).
   void FilterAlignedPairs();
-  // FilterRegion: Only accept reads that align to a specific chromosome and/or range.
+  // FilterRegion: Only accept reads that align to a specific chromosome and/or range.  Uses the BAM index, if there is one (see Indexed()).
   void FilterRegion( const int chrom, const int start = -1, const int end = -1 );
+  // FilterRegions: Only accept reads that align to any of a set of chromosomes.  Uses the BAM index, if there is one, to read the chromosomes in the order
+  // given; otherwise the reads come in file order.
+  void FilterRegions( const vector<int> & chroms );
+  // FilterSubsample: Only accept reads whose names pass SubsampleKeeps( name, fraction ).  fraction = 1 accepts all reads.
+  void FilterSubsample( const double fraction );
+  // FilterMask: Only accept reads where neither the read's position nor its mate's (c.tid/c.pos and c.mtid/c.mpos) is in any of mask's intervals.  The
+  // mask's chromosome IDs are the SAM target IDs.  The mask must be built, and it must stay in existence as long as this SAMStepper reads alignments.
+  void FilterMask( const ChromIntervalIndex & mask );
 
 
   // next_read(): Main function to get an alignment.  Return NULL if there are no more alignments to get.
@@ -95,11 +140,17 @@ class SAMStepper
   // next_pair(): Get a pair of alignments.  Assume paired reads appear in consecutive order in the file, and skip over unpaired reads.
   // Return pair<NULL,NULL> if there are no more paired alignments to get.
   pair< bam1_t *, bam1_t * > next_pair();
+  // next_batch(): Get the next N alignments (or as many as are left) that pass the filters, as in next_read(), and put them in batch, replacing its contents.
+  // Return the number of alignments in the batch; 0 means there are no more alignments.  Don't mix calls to next_batch() with calls to next_pair().
+  size_t next_batch( SAMBatch & batch, const size_t N = 4096 );
 
   /* QUERY FUNCTIONS */
 
   int N_targets() const { assert( _SAM != NULL ); return _SAM->header->n_targets; }
 
+  // Indexed: True iff all of the files are BAM files with BAI indices, so that the region filters use random access.
+  bool Indexed() const { return _indexed; }
+
   // as_SAM_line: A wrapper to bam_format1, which formats a bam1_t object as a string in the format of a line in a SAM file (with no newline).
   char * as_SAM_line( const bam1_t * align ) const { return bam_format1( _SAM->header, align ); }
 
@@ -116,9 +167,13 @@ class SAMStepper
   // Init(): Set up the SAMStepper object.  This is immediately called by any constructor.
   void Init();
 
-  // Open the next SAM/BAM file in the set, via open_SAM().
+  // Open the next SAM/BAM file in the set, via open_SAM().  If using the index, also load the file's index into _index.
   samfile_t * open_next();
 
+  // read_next(): Read the next alignment into _align, from the file or (if using the index) from the next region in the file.  Return false at the end
+  // of the file.
+  bool read_next();
+
 
   /* PRIVATE DATA */
 
@@ -130,11 +185,23 @@ class SAMStepper
   bool _init; // has Init() been called yet?
   int64_t _N_aligns_read; // number of alignments returned so far via next_read() *or* next_pair().  This does NOT include alignments filtered out.
   int64_t _N_pairs_read; // number of pairs of alignments returned so far via next_pair().
+  string _prev_name; // the name of the last read returned by next_batch()
 
   // Optional filtering variables.  These can be set by the Filter() functions, and they control which alignments are returned by next().
   bool _filter_aligned;
   bool _filter_aligned_pair;
   int _filter_chrom, _filter_start, _filter_end;
+  vector<bool> _filter_chroms; // if non-empty, indexed by chromosome: which ones are accepted (set by FilterRegions)
+  double _subsample_fraction; // set by FilterSubsample
+  const ChromIntervalIndex * _mask; // set by FilterMask, or NULL
+
+  // Random access via the BAM index.  If _use_index, the regions in _regions (chromosome, start, end) are read in order, from each file in turn.
+  struct Region { int chrom, start, end; };
+  bool _indexed, _use_index;
+  vector<Region> _regions;
+  size_t _region_ID; // index of the next region to read in the current file
+  bam_index_t * _index; // index of the current file
+  bam_iter_t _iter; // iterator over the current region, or NULL
 
   static const bool _verbose = false;
 };
@@ -142,11 +209,23 @@ class SAMStepper
 
 
 
+// ReadNamesMatch(): Return true iff these two read names appear to belong to the same fragment.  This is the test next_pair() uses to find pairs of reads.
+bool ReadNamesMatch( const char * name1, const char * name2 );
+
+// SubsampleKeeps(): Return true iff a read with this name is in the subsample of reads with the given fraction.  The read name is hashed to a number in
+// [0,1), and the read is kept iff that's less than the fraction; so the subsample for a smaller fraction is a subset of the one for a larger fraction.  A
+// final "/1" or "/2" on the read name is ignored.
+bool SubsampleKeeps( const char * read_name, const double fraction );
+
+
 // Wrapper to samopen() which figures out the open mode (SAM vs. BAM.)
 // This function is separate from the SAMStepper class and is designed to be usable outside it.
 // To avoid memory leaks, be sure to eventually call samclose() on all pointers returned from open_SAM().
 samfile_t * open_SAM( const string & SAM_file );
 
+// HasBAMIndex(): Return true iff this is a BAM file with a BAI index, at <file>.bai or at <file> with the suffix ".bam" replaced by ".bai".
+bool HasBAMIndex( const string & SAM_file );
+
 // The following 5 functions all use open_SAM.
 
 // NTargetsInSAM(): Return the number of target sequences in this SAM file.
@@ -0,0 +1,184 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+/******************************************************************************
+ *
+ * TestChromIntervalIndex.cc
+ *
+ * Test ChromIntervalIndex against a linear scan over the same intervals, on
+ * random sets of overlapping intervals of many sizes (including the sizes
+ * around powers of 2, where the implicit tree is incomplete), with point,
+ * range, and batched queries.  Prints the number of mismatches for each kind
+ * of query, and returns 1 if there are any.
+ *
+ *****************************************************************************/
+
+
+// C libraries
+#include <assert.h>
+#include <stdio.h>
+
+// STL declarations
+#include <vector>
+#include <iostream>
+#include <algorithm> // sort
+#include <random>
+using namespace std;
+
+
+// Local declarations
+#include "ChromIntervalIndex.h"
+
+
+
+// An interval, as given to the index.
+struct TestInterval { int chrID, start, stop, ID; };
+
+static int N_mismatches_point = 0, N_mismatches_range = 0, N_mismatches_batch = 0;
+
+
+
+// The linear scan.  Find returns the index (in intervals) of the interval containing pos with the lowest start, then the lowest stop, or -1.
+int
+ScanFind( const vector<TestInterval> & intervals, const int chrID, const int pos )
+{
+  int best = -1;
+  for ( size_t i = 0; i < intervals.size(); i++ ) {
+    const TestInterval & x = intervals[i];
+    if ( x.chrID != chrID || pos < x.start || pos >= x.stop ) continue;
+    if ( best == -1 || x.start < intervals[best].start || ( x.start == intervals[best].start && x.stop < intervals[best].stop ) )
+      best = i;
+  }
+  return best;
+}
+
+
+// FindOverlaps returns the IDs of all the intervals that overlap [start,stop), sorted.
+vector<int>
+ScanFindOverlaps( const vector<TestInterval> & intervals, const int chrID, const int start, const int stop )
+{
+  vector<int> IDs;
+  for ( size_t i = 0; i < intervals.size(); i++ )
+    if ( intervals[i].chrID == chrID && intervals[i].start < stop && start < intervals[i].stop )
+      IDs.push_back( intervals[i].ID );
+  sort( IDs.begin(), IDs.end() );
+  return IDs;
+}
+
+
+
+// Check the ID that the index found for a point query.  Intervals with the same start and stop may be sorted in either order, so compare the intervals
+// themselves, not the IDs.  (The IDs are the indices in intervals.)
+bool
+SameFind( const vector<TestInterval> & intervals, const int found_ID, const int scan )
+{
+  if ( found_ID == -1 || scan == -1 ) return found_ID == scan;
+  return intervals[found_ID].start == intervals[scan].start && intervals[found_ID].stop == intervals[scan].stop;
+}
+
+
+
+// Test the index on one random set of N intervals, on N_chroms chromosomes of length chrom_len (chromosome 1 has no intervals, if N_chroms > 2.)
+void
+TestIntervalSet( mt19937 & rng, const int N, const int N_chroms, const int chrom_len, const int max_interval_len )
+{
+  uniform_int_distribution<int> chrom_dist( 0, N_chroms - 1 ), pos_dist( 0, chrom_len ), len_dist( 0, max_interval_len );
+
+  vector<TestInterval> intervals;
+  ChromIntervalIndex index;
+  for ( int i = 0; i < N; i++ ) {
+    int chrID = chrom_dist( rng );
+    if ( chrID == 1 && N_chroms > 2 ) chrID = 0;
+    const int start = pos_dist( rng );
+    TestInterval x = { chrID, start, start + len_dist( rng ), i }; // some intervals are empty: stop == start
+    intervals.push_back( x );
+    index.Add( x.chrID, x.start, x.stop, x.ID );
+  }
+  index.Build();
+  assert( index.size() == intervals.size() );
+
+
+  // Point queries, including positions off the ends of the chromosomes, and chromosomes that aren't in the index.
+  uniform_int_distribution<int> query_chrom_dist( -1, N_chroms ), query_pos_dist( -10, chrom_len + max_interval_len + 10 );
+  for ( int q = 0; q < 1000; q++ ) {
+    const int chrID = query_chrom_dist( rng ), pos = query_pos_dist( rng );
+    const int found = index.Find( chrID, pos );
+    const int scan = ScanFind( intervals, chrID, pos );
+    if ( !SameFind( intervals, found, scan ) || index.Contains( chrID, pos ) != ( scan != -1 ) ) N_mismatches_point++;
+  }
+
+  // Range queries.  The index should find the same intervals, in order of start.
+  for ( int q = 0; q < 1000; q++ ) {
+    const int chrID = query_chrom_dist( rng ), start = query_pos_dist( rng ), stop = start + len_dist( rng );
+    vector<int> found;
+    index.FindOverlaps( chrID, start, stop, found );
+    bool in_order = true;
+    for ( size_t i = 1; i < found.size(); i++ )
+      if ( intervals[ found[i-1] ].start > intervals[ found[i] ].start ) in_order = false;
+    sort( found.begin(), found.end() );
+    if ( !in_order || found != ScanFindOverlaps( intervals, chrID, start, stop ) ) N_mismatches_range++;
+  }
+
+  // Batched point queries, sorted by chromosome and position (as from a sorted BAM file), with repeated positions, and then the same queries unsorted.
+  vector< pair<int,int> > queries;
+  for ( int q = 0; q < 2000; q++ )
+    queries.push_back( make_pair( query_chrom_dist( rng ), query_pos_dist( rng ) ) );
+  for ( int q = 0; q < 200; q++ )
+    queries.push_back( queries[q] );
+  for ( int unsorted = 0; unsorted < 2; unsorted++ ) {
+    if ( unsorted ) shuffle( queries.begin(), queries.end(), rng );
+    else sort( queries.begin(), queries.end() );
+    vector<int> chrIDs, positions, found;
+    for ( size_t q = 0; q < queries.size(); q++ ) {
+      chrIDs.push_back( queries[q].first );
+      positions.push_back( queries[q].second );
+    }
+    index.Find( chrIDs, positions, found );
+    assert( found.size() == queries.size() );
+    for ( size_t q = 0; q < queries.size(); q++ )
+      if ( !SameFind( intervals, found[q], ScanFind( intervals, chrIDs[q], positions[q] ) ) ) N_mismatches_batch++;
+  }
+}
+
+
+
+
+int main( int argc, char * argv[] )
+{
+  mt19937 rng( 1 );
+
+  // Sizes around the powers of 2, and some others.  Short and long intervals, so that the trees are sparse and dense.
+  vector<int> sizes;
+  for ( int p = 0; p <= 12; p++ )
+    for ( int d = -1; d <= 1; d++ )
+      if ( (1 << p) + d >= 0 ) sizes.push_back( (1 << p) + d );
+  sizes.push_back( 1000 );
+  sizes.push_back( 3000 );
+
+  int N_sets = 0;
+  for ( size_t i = 0; i < sizes.size(); i++ )
+    for ( int N_chroms = 1; N_chroms <= 4; N_chroms += 3 )
+      for ( int max_len = 10; max_len <= 100000; max_len *= 100 ) {
+	TestIntervalSet( rng, sizes[i], N_chroms, 1000000, max_len );
+	N_sets++;
+      }
+
+  cout << "TestChromIntervalIndex: " << N_sets << " interval sets; mismatches with the linear scan: " << N_mismatches_point << " in point queries, "
+       << N_mismatches_range << " in range queries, " << N_mismatches_batch << " in batched queries" << endl;
+  const bool pass = N_mismatches_point == 0 && N_mismatches_range == 0 && N_mismatches_batch == 0;
+  cout << ( pass ? "PASS" : "FAIL" ) << endl;
+  return pass ? 0 : 1;
+}
@@ -20,6 +20,7 @@
 // C and C++ includes
 #include <assert.h>
 #include <math.h> // exp, log
+#include <pthread.h>
 #include <stdio.h>
 
 #include <iostream>
@@ -49,6 +50,8 @@ HMM::HMM( const int N_states, const int N_symbols )
   _ran_viterbi    = false;
   _ran_baum_welch = false;
 
+  _use_WDAG = false;
+  _N_threads = 1;
 }
 
 
@@ -139,6 +142,18 @@ HMM::SetTimeEmissProbs( const vector< vector<double> > & probs )
 
 
 
+// Choose how to run the training algorithms: on the WDAG made by to_WDAG(),
+// or directly on the trellis, with up to N_threads threads.
+void
+HMM::SetAlgorithm( const bool use_WDAG, const int N_threads )
+{
+  assert( N_threads >= 1 );
+  _use_WDAG = use_WDAG;
+  _N_threads = N_threads;
+}
+
+
+
 // Return true if this HMM has loaded all the data it needs to run training.
 bool
 HMM::HasAllData() const
@@ -280,12 +295,8 @@ HMM::AdjustProbsToViterbi( const vector<string> & best_path, vector<int> & state
 {
   assert( !best_path.empty() ); // if this fails, the WDAG has failed - typically because there is no way to get from the beginning to the end of the path due to transmission/emission probabilities that are 0
 
-  // Get the names of the edges in the best path, and tally the number of times
-  // each edge name appears.  Thus find the observed transition and
-  // emission probabilities.
-  vector< vector<int> > trans_counts( _N_states, vector<int>( _N_states, 0 ) );
-  vector< vector<int> > emiss_counts( _N_states, vector<int>( _N_symbols,0 ) );
-  vector<int> state_counts( _N_states, 0 );
+  // Get the names of the edges in the best path.  The emission edges give the
+  // sequence of states; the transition edges just join them.
   states.clear();
 
   for ( size_t i = 0; i < best_path.size(); i++ ) {
@@ -298,19 +309,35 @@ HMM::AdjustProbsToViterbi( const vector<string> & best_path, vector<int> & state
     *iss >> type >> S1 >> S2;
     assert( type == 'S' || type == 'T' || type == 'E' || type == 'F' );
 
-    // Transition edges.
-    if ( type == 'T' ) trans_counts[S1][S2]++;
-
     // Emission edges.
-    if ( type == 'E' ) {
-      if ( is_discrete_HMM() ) emiss_counts[S1][S2]++;
-      state_counts[S1]++;
-      states.push_back(S1);
-    }
+    if ( type == 'E' ) states.push_back(S1);
 
     delete iss;
   }
 
+  return AdjustProbsToViterbi( states );
+}
+
+
+
+// As part of Viterbi training, apply the sequence of states in the best path
+// to get new probabilities.
+// Return true if any of the probabilities change.
+bool
+HMM::AdjustProbsToViterbi( const vector<int> & states )
+{
+  // Tally the number of times each transition and each emission appears in
+  // the path.  Thus find the observed transition and emission probabilities.
+  vector< vector<int> > trans_counts( _N_states, vector<int>( _N_states, 0 ) );
+  vector< vector<int> > emiss_counts( _N_states, vector<int>( _N_symbols,0 ) );
+  vector<int> state_counts( _N_states, 0 );
+
+  for ( size_t t = 0; t < states.size(); t++ ) {
+    if ( t > 0 ) trans_counts[ states[t-1] ][ states[t] ]++;
+    if ( is_discrete_HMM() ) emiss_counts[ states[t] ][ _observations[t] ]++;
+    state_counts[ states[t] ]++;
+  }
+
   assert( states.size() == NTimepoints() );
 
   bool change = false;
@@ -512,16 +539,28 @@ HMM::ViterbiTraining( vector<int> & predicted_states )
 {
   assert( HasAllData() );
 
-  // Create a WDAG for this HMM.
-  WDAG wdag = to_WDAG();
+  bool change;
+
+  // Find the best path directly on the trellis, unless we've been asked to
+  // use the WDAG.
+  if ( !_use_WDAG ) {
+    TrellisViterbi( predicted_states );
+    change = AdjustProbsToViterbi( predicted_states );
+  }
+
+  else {
 
-  // Compute the highest-weight path on this WDAG.
-  wdag.FindBestPath();
+    // Create a WDAG for this HMM.
+    WDAG wdag = to_WDAG();
 
+    // Compute the highest-weight path on this WDAG.
+    wdag.FindBestPath();
 
-  // Apply the highest-weight path to find the probabilities and predict the
-  // set of hidden states.
-  bool change = AdjustProbsToViterbi( wdag._best_edges, predicted_states );
+
+    // Apply the highest-weight path to find the probabilities and predict the
+    // set of hidden states.
+    change = AdjustProbsToViterbi( wdag._best_edges, predicted_states );
+  }
 
   _ran_viterbi = true;
 
@@ -540,6 +579,14 @@ HMM::BaumWelchTraining( double & log_like )
 {
   assert( HasAllData() );
 
+  // Run forward-backward directly on the trellis, unless we've been asked to
+  // use the WDAG.
+  if ( !_use_WDAG ) {
+    bool change = TrellisBaumWelch( log_like );
+    _ran_baum_welch = true;
+    return change;
+  }
+
   // Create a WDAG for this HMM.
   WDAG wdag = to_WDAG();
 
@@ -565,6 +612,611 @@ HMM::BaumWelchTraining( double & log_like )
 
 
 
+/* TRELLIS KERNELS
+ *
+ * to_WDAG() lays out the HMM as a graph with 2*N_states nodes per timepoint
+ * and a named edge for every transition, which is O(T*S^2) objects and strings
+ * just to run the standard trellis recursions (T = NTimepoints(), S =
+ * N_states.)  The functions below run the same recursions on flat arrays:
+ * emiss[t*S+j] is the log-probability of state j emitting the data at
+ * timepoint t, and the transition matrix is laid out so that each recursion's
+ * inner loop runs over contiguous memory.
+ *
+ * Viterbi works in log space, with the same additions in the same order as
+ * WDAG::FindBestPath() on the WDAG, so on one thread it finds the same path.
+ * Forward-backward works in log space too, but via the usual scaling: the
+ * emission probabilities at each timepoint are divided by the largest of them,
+ * and the forward and backward vectors are normalized at every timepoint, so
+ * the recursions themselves are plain sums of products, and the normalizers'
+ * logs add up to the log-likelihood.
+ *
+ * A long sequence is split into chunks, one per thread, in three passes:
+ * (1) in parallel, find each chunk's "transfer matrix", which says how the
+ *     chunk carries each state at its start to each state at its end (for the
+ *     first chunk, just run the recursion);
+ * (2) in turn, carry the vectors across the chunk boundaries with the transfer
+ *     matrices;
+ * (3) in parallel, run each chunk's recursion from its boundary vectors.
+ * Finding a transfer matrix takes S times as long as running the recursion, so
+ * the sequence is only split when there are more than S+1 threads.  The result
+ * depends on the number of chunks only through floating-point rounding.
+ */
+
+
+
+// The trellis kernels split a sequence into chunks of at least this many
+// timepoints.
+static const size_t MIN_CHUNK_SIZE = 10000;
+
+
+
+// TrellisChunks: Split timepoints [0,T) into chunks for N_threads threads.
+// Chunk c is [bounds[c],bounds[c+1]).
+static vector<size_t>
+TrellisChunks( const size_t T, const int S, const int N_threads )
+{
+  size_t N_chunks = 1;
+  if ( N_threads > S + 1 ) N_chunks = min( size_t( N_threads ), T / MIN_CHUNK_SIZE );
+  if ( N_chunks < 1 ) N_chunks = 1;
+
+  vector<size_t> bounds( N_chunks + 1 );
+  for ( size_t c = 0; c <= N_chunks; c++ )
+    bounds[c] = T * c / N_chunks;
+  return bounds;
+}
+
+
+
+// RunChunks: Call work( context, c ) for each chunk c in [0,N_chunks), on up
+// to N_threads POSIX threads.  Thread k takes chunks k, k+N, k+2N, ...
+struct ChunkThread {
+  void (*work)( void *, size_t );
+  void * context;
+  size_t first, step, N_chunks;
+};
+
+static void *
+RunChunkThread( void * arg )
+{
+  const ChunkThread * job = (const ChunkThread *) arg;
+  for ( size_t c = job->first; c < job->N_chunks; c += job->step )
+    job->work( job->context, c );
+  return NULL;
+}
+
+static void
+RunChunks( void (*work)( void *, size_t ), void * context, const size_t N_chunks, const int N_threads )
+{
+  const size_t N = min( N_chunks, size_t( N_threads ) );
+  vector<ChunkThread> jobs( N );
+  for ( size_t k = 0; k < N; k++ ) {
+    jobs[k].work = work;
+    jobs[k].context = context;
+    jobs[k].first = k;
+    jobs[k].step = N;
+    jobs[k].N_chunks = N_chunks;
+  }
+
+  // Run the first job in this thread.  If a thread can't be started, run its
+  // job here too.
+  vector<pthread_t> threads( N );
+  vector<bool> started( N, false );
+  for ( size_t k = 1; k < N; k++ )
+    started[k] = ( pthread_create( &threads[k], NULL, RunChunkThread, &jobs[k] ) == 0 );
+  RunChunkThread( &jobs[0] );
+  for ( size_t k = 1; k < N; k++ ) {
+    if ( started[k] ) pthread_join( threads[k], NULL );
+    else RunChunkThread( &jobs[k] );
+  }
+}
+
+
+
+// Find the log-probability of each state emitting the data at each timepoint,
+// as a flat NTimepoints() x N_states array.
+void
+HMM::TrellisEmissions( vector<double> & emiss ) const
+{
+  const size_t T = NTimepoints();
+  const int S = _N_states;
+  emiss.resize( T * S );
+  for ( size_t t = 0; t < T; t++ )
+    for ( int j = 0; j < S; j++ )
+      emiss[t*S+j] = is_discrete_HMM() ? _symbol_emiss_probs[j][ _observations[t] ] : _time_emiss_probs[t][j];
+}
+
+
+
+
+// VITERBI
+
+
+
+// ViterbiStep: One step of the Viterbi recursion, in log space:
+// out[j] = max_i( in[i] + trans(i->j) ) + emiss_t[j], where trans_T[j*S+i] =
+// trans(i->j).  If back != NULL, also record the best i for each j.  Ties go
+// to the lowest i, as in WDAG::FindBestPath().
+static inline void
+ViterbiStep( const int S, const double * trans_T, const double * emiss_t, const double * in, double * out, int * back )
+{
+  for ( int j = 0; j < S; j++ ) {
+    const double * col = trans_T + j*S;
+    double best = LOG_ZERO;
+    int best_i = -1;
+    for ( int i = 0; i < S; i++ ) {
+      const double w = in[i] + col[i];
+      if ( best < w ) { best = w; best_i = i; }
+    }
+    out[j] = best + emiss_t[j];
+    if ( back != NULL ) back[j] = best_i;
+  }
+}
+
+
+struct ViterbiContext {
+  int S;
+  const vector<size_t> * bounds;
+  const double * init, * trans_T, * emiss;
+  vector< vector<double> > transfer; // pass 1: for chunk 0, the scores at its end; for chunk c > 0, its max-plus transfer matrix, [i*S+j]
+  vector< vector<double> > entry; // pass 2: the scores at timepoint bounds[c]-1
+  vector< vector<double> > exit; // pass 3: the scores at timepoint bounds[c+1]-1
+  int * back; // pass 3: back[t*S+j] = the best state at t-1, given state j at t
+};
+
+
+// Pass 1.  transfer[i*S+j] is the score of the best path from state i at the
+// chunk's start to state j at its end, not counting the emission at the start.
+static void
+ViterbiTransfer( void * context, size_t c )
+{
+  ViterbiContext & V = *( (ViterbiContext *) context );
+  const int S = V.S;
+  const size_t b = (*V.bounds)[c], e = (*V.bounds)[c+1];
+  vector<double> & M = V.transfer[c];
+  vector<double> next( S );
+
+  if ( c == 0 ) {
+    M.assign( V.init, V.init + S );
+    for ( int j = 0; j < S; j++ ) M[j] += V.emiss[j];
+    for ( size_t t = 1; t < e; t++ ) {
+      ViterbiStep( S, V.trans_T, V.emiss + t*S, &M[0], &next[0], NULL );
+      M.swap( next );
+    }
+    return;
+  }
+
+  M.assign( S*S, LOG_ZERO );
+  for ( int i = 0; i < S; i++ ) {
+    double * row = &M[i*S];
+    row[i] = 0;
+    for ( size_t t = b; t < e; t++ ) {
+      ViterbiStep( S, V.trans_T, V.emiss + t*S, row, &next[0], NULL );
+      copy( next.begin(), next.end(), row );
+    }
+  }
+}
+
+
+// Pass 3.  Run the recursion over the chunk, from its entry scores, and record
+// the back-pointers.
+static void
+ViterbiChunk( void * context, size_t c )
+{
+  ViterbiContext & V = *( (ViterbiContext *) context );
+  const int S = V.S;
+  const size_t b = (*V.bounds)[c], e = (*V.bounds)[c+1];
+  vector<double> cur( S ), next( S );
+
+  size_t t = b;
+  if ( c == 0 ) {
+    for ( int j = 0; j < S; j++ ) {
+      cur[j] = V.init[j] + V.emiss[j];
+      V.back[j] = -1;
+    }
+    t++;
+  }
+  else cur = V.entry[c];
+
+  for ( ; t < e; t++ ) {
+    ViterbiStep( S, V.trans_T, V.emiss + t*S, &cur[0], &next[0], V.back + t*S );
+    cur.swap( next );
+  }
+  V.exit[c] = cur;
+}
+
+
+
+// Find the best path through the trellis, and return the state at each
+// timepoint.
+void
+HMM::TrellisViterbi( vector<int> & states ) const
+{
+  const size_t T = NTimepoints();
+  const int S = _N_states;
+
+  vector<double> emiss, trans_T( S*S );
+  TrellisEmissions( emiss );
+  for ( int i = 0; i < S; i++ )
+    for ( int j = 0; j < S; j++ )
+      trans_T[j*S+i] = _trans_probs[i][j];
+
+  const vector<size_t> bounds = TrellisChunks( T, S, _N_threads );
+  const size_t N_chunks = bounds.size() - 1;
+  vector<int> back( T * S );
+
+  ViterbiContext V;
+  V.S = S;
+  V.bounds = &bounds;
+  V.init = &_init_probs[0];
+  V.trans_T = &trans_T[0];
+  V.emiss = &emiss[0];
+  V.transfer.resize( N_chunks );
+  V.entry.resize( N_chunks );
+  V.exit.resize( N_chunks );
+  V.back = &back[0];
+
+  // Passes 1 and 2: find the scores at the start of each chunk.
+  if ( N_chunks > 1 ) {
+    RunChunks( ViterbiTransfer, &V, N_chunks, _N_threads );
+    V.entry[1] = V.transfer[0];
+    for ( size_t c = 2; c < N_chunks; c++ ) {
+      const vector<double> & in = V.entry[c-1], & M = V.transfer[c-1];
+      V.entry[c].assign( S, LOG_ZERO );
+      for ( int i = 0; i < S; i++ )
+	for ( int j = 0; j < S; j++ )
+	  V.entry[c][j] = max( V.entry[c][j], in[i] + M[i*S+j] );
+    }
+  }
+
+  // Pass 3.
+  RunChunks( ViterbiChunk, &V, N_chunks, _N_threads );
+
+  // Find the best final state, and trace the path back from it.
+  const vector<double> & last = V.exit.back();
+  double best = LOG_ZERO;
+  int best_j = -1;
+  for ( int j = 0; j < S; j++ )
+    if ( best < last[j] ) { best = last[j]; best_j = j; }
+  assert( best_j != -1 ); // if this fails, there is no way to get from the beginning to the end of the path due to transmission/emission probabilities that are 0
+
+  states.resize( T );
+  states[T-1] = best_j;
+  for ( size_t t = T-1; t > 0; t-- ) {
+    states[t-1] = back[ t*S + states[t] ];
+    assert( states[t-1] != -1 );
+  }
+}
+
+
+
+
+// FORWARD-BACKWARD
+
+
+
+// Normalize: Divide v[0..S) by its sum, and return the log of the sum.
+static inline double
+Normalize( const int S, double * v )
+{
+  double sum = 0;
+  for ( int j = 0; j < S; j++ ) sum += v[j];
+  assert( sum > 0 ); // if this fails, the data can't be produced by any path
+  const double inv = 1 / sum;
+  for ( int j = 0; j < S; j++ ) v[j] *= inv;
+  return log( sum );
+}
+
+
+// ForwardStep: One (unnormalized) step of the forward recursion:
+// out[j] = sum_i( in[i] * P[i*S+j] ) * e_t[j].
+static inline void
+ForwardStep( const int S, const double * P, const double * e_t, const double * in, double * out )
+{
+  for ( int j = 0; j < S; j++ ) out[j] = 0;
+  for ( int i = 0; i < S; i++ ) {
+    const double a = in[i];
+    const double * row = P + i*S;
+    for ( int j = 0; j < S; j++ ) out[j] += a * row[j];
+  }
+  for ( int j = 0; j < S; j++ ) out[j] *= e_t[j];
+}
+
+
+// BackwardStep: One (unnormalized) step of the backward recursion, from
+// timepoint t to t-1: out[i] = sum_j( P[i*S+j] * e_t[j] * in[j] ).  Also
+// leaves e_t[j] * in[j] in eb.
+static inline void
+BackwardStep( const int S, const double * P, const double * e_t, const double * in, double * out, double * eb )
+{
+  for ( int j = 0; j < S; j++ ) eb[j] = e_t[j] * in[j];
+  for ( int i = 0; i < S; i++ ) {
+    const double * row = P + i*S;
+    double sum = 0;
+    for ( int j = 0; j < S; j++ ) sum += row[j] * eb[j];
+    out[i] = sum;
+  }
+}
+
+
+struct ForwardBackwardContext {
+  int S, N_symbols;
+  const vector<size_t> * bounds;
+  const double * init, * P, * e; // in linear space; e is the scaled emission probabilities, e[t*S+j]
+  const int * observations; // NULL for a continuous HMM
+  // Pass 1: for chunk 0, the forward vector at its end.  For chunk c > 0, its
+  // transfer matrix: row i is the forward vector at the chunk's end, given
+  // state i just before it, normalized; transfer_log[c][i] is its log-scale.
+  vector< vector<double> > transfer, transfer_log;
+  // Pass 2: the forward vector just before each chunk, and the backward vector
+  // at its end.
+  vector< vector<double> > alpha_entry, beta_exit;
+  // Pass 3: the forward vectors, alpha[t*S+j], and each chunk's sums of the
+  // posterior probabilities, and of the logs of the forward normalizers.
+  double * alpha;
+  vector< vector<double> > init_sums, state_sums, trans_sums, emiss_sums;
+  vector<double> log_like;
+};
+
+
+// Pass 1.
+static void
+ForwardBackwardTransfer( void * context, size_t c )
+{
+  ForwardBackwardContext & F = *( (ForwardBackwardContext *) context );
+  const int S = F.S;
+  const size_t b = (*F.bounds)[c], e = (*F.bounds)[c+1];
+  vector<double> next( S );
+
+  if ( c == 0 ) {
+    vector<double> & a = F.transfer[0];
+    a.resize( S );
+    for ( int j = 0; j < S; j++ ) a[j] = F.init[j] * F.e[j];
+    Normalize( S, &a[0] );
+    for ( size_t t = 1; t < e; t++ ) {
+      ForwardStep( S, F.P, F.e + t*S, &a[0], &next[0] );
+      Normalize( S, &next[0] );
+      a.swap( next );
+    }
+    return;
+  }
+
+  F.transfer[c].assign( S*S, 0 );
+  F.transfer_log[c].assign( S, 0 );
+  for ( int i = 0; i < S; i++ ) {
+    double * row = &F.transfer[c][i*S];
+    row[i] = 1;
+    for ( size_t t = b; t < e; t++ ) {
+      ForwardStep( S, F.P, F.e + t*S, row, &next[0] );
+      double sum = 0;
+      for ( int j = 0; j < S; j++ ) sum += next[j];
+      if ( sum == 0 ) { // state i can't start this chunk
+	F.transfer_log[c][i] = LOG_ZERO;
+	fill( row, row + S, 0.0 );
+	break;
+      }
+      F.transfer_log[c][i] += log( sum );
+      for ( int j = 0; j < S; j++ ) row[j] = next[j] / sum;
+    }
+  }
+}
+
+
+// Pass 3.  Run the forward recursion over the chunk from its entry vector,
+// then the backward recursion from its exit vector, adding up the posterior
+// probabilities as it goes.
+static void
+ForwardBackwardChunk( void * context, size_t c )
+{
+  ForwardBackwardContext & F = *( (ForwardBackwardContext *) context );
+  const int S = F.S;
+  const size_t b = (*F.bounds)[c], e = (*F.bounds)[c+1];
+
+  // The forward recursion.
+  double log_like = 0;
+  size_t t = b;
+  if ( c == 0 ) {
+    for ( int j = 0; j < S; j++ ) F.alpha[j] = F.init[j] * F.e[j];
+    log_like += Normalize( S, F.alpha );
+    t++;
+  }
+  for ( ; t < e; t++ ) {
+    const double * in = t == b ? &F.alpha_entry[c][0] : F.alpha + (t-1)*S;
+    ForwardStep( S, F.P, F.e + t*S, in, F.alpha + t*S );
+    log_like += Normalize( S, F.alpha + t*S );
+  }
+  F.log_like[c] = log_like;
+
+  // The backward recursion.
+  vector<double> & init_sums  = F.init_sums [c]; init_sums .assign( S, 0 );
+  vector<double> & state_sums = F.state_sums[c]; state_sums.assign( S, 0 );
+  vector<double> & trans_sums = F.trans_sums[c]; trans_sums.assign( S*S, 0 );
+  vector<double> & emiss_sums = F.emiss_sums[c]; emiss_sums.assign( F.observations ? S * F.N_symbols : 0, 0 );
+  vector<double> beta = F.beta_exit[c], prev( S ), eb( S ), gamma( S );
+
+  for ( size_t t = e; t-- > b; ) {
+
+    // The posterior probability of each state at t.
+    const double * a = F.alpha + t*S;
+    for ( int j = 0; j < S; j++ ) gamma[j] = a[j] * beta[j];
+    Normalize( S, &gamma[0] );
+    for ( int j = 0; j < S; j++ ) state_sums[j] += gamma[j];
+    if ( F.observations )
+      for ( int j = 0; j < S; j++ ) emiss_sums[ j * F.N_symbols + F.observations[t] ] += gamma[j];
+    if ( t == 0 ) {
+      init_sums = gamma;
+      break;
+    }
+
+    // The posterior probability of each transition from t-1 to t.
+    const double * a_prev = t == b ? &F.alpha_entry[c][0] : F.alpha + (t-1)*S;
+    BackwardStep( S, F.P, F.e + t*S, &beta[0], &prev[0], &eb[0] );
+    double Z = 0;
+    for ( int i = 0; i < S; i++ ) Z += a_prev[i] * prev[i];
+    assert( Z > 0 );
+    for ( int i = 0; i < S; i++ ) {
+      const double a_i = a_prev[i] / Z;
+      const double * row = F.P + i*S;
+      double * sums = &trans_sums[i*S];
+      for ( int j = 0; j < S; j++ ) sums[j] += a_i * row[j] * eb[j];
+    }
+
+    Normalize( S, &prev[0] );
+    beta.swap( prev );
+  }
+}
+
+
+
+// Run the forward-backward algorithm on the trellis, and use the posterior
+// probabilities of the states and transitions to get new probabilities, as
+// AdjustProbsToBaumWelch() does.  Also find the log-likelihood (in base 2) of
+// the data.
+// Return true if any of the probabilities change.
+bool
+HMM::TrellisBaumWelch( double & log_like )
+{
+  const size_t T = NTimepoints();
+  const int S = _N_states;
+
+  // Convert the probabilities out of log space.  Scale each timepoint's
+  // emission probabilities so that the largest is 1, and remember the scales.
+  vector<double> e, init( S ), P( S*S );
+  TrellisEmissions( e );
+  double log_scale = 0;
+  for ( size_t t = 0; t < T; t++ ) {
+    double * e_t = &e[t*S];
+    const double m = *max_element( e_t, e_t + S );
+    assert( m != LOG_ZERO );
+    log_scale += m;
+    for ( int j = 0; j < S; j++ ) e_t[j] = exp( e_t[j] - m );
+  }
+  for ( int i = 0; i < S; i++ ) {
+    init[i] = exp( _init_probs[i] );
+    for ( int j = 0; j < S; j++ )
+      P[i*S+j] = exp( _trans_probs[i][j] );
+  }
+
+  const vector<size_t> bounds = TrellisChunks( T, S, _N_threads );
+  const size_t N_chunks = bounds.size() - 1;
+  vector<double> alpha( T * S );
+
+  ForwardBackwardContext F;
+  F.S = S;
+  F.N_symbols = _N_symbols;
+  F.bounds = &bounds;
+  F.init = &init[0];
+  F.P = &P[0];
+  F.e = &e[0];
+  F.observations = is_discrete_HMM() ? &_observations[0] : NULL;
+  F.transfer.resize( N_chunks );
+  F.transfer_log.resize( N_chunks );
+  F.alpha_entry.resize( N_chunks );
+  F.beta_exit.resize( N_chunks );
+  F.alpha = &alpha[0];
+  F.init_sums .resize( N_chunks );
+  F.state_sums.resize( N_chunks );
+  F.trans_sums.resize( N_chunks );
+  F.emiss_sums.resize( N_chunks );
+  F.log_like.resize( N_chunks );
+
+  // Passes 1 and 2: find the forward vector at the start of each chunk, and
+  // the backward vector at its end.  Each is only needed up to a constant, so
+  // the transfer matrices' rows are weighted in log space and then normalized.
+  F.beta_exit.back().assign( S, 1 );
+  if ( N_chunks > 1 ) {
+    RunChunks( ForwardBackwardTransfer, &F, N_chunks, _N_threads );
+    vector<double> w( S );
+
+    F.alpha_entry[1] = F.transfer[0];
+    for ( size_t c = 2; c < N_chunks; c++ ) {
+      const vector<double> & in = F.alpha_entry[c-1], & M = F.transfer[c-1], & M_log = F.transfer_log[c-1];
+      for ( int i = 0; i < S; i++ ) w[i] = in[i] == 0 ? LOG_ZERO : log( in[i] ) + M_log[i];
+      const double m = *max_element( w.begin(), w.end() );
+      assert( m != LOG_ZERO );
+      F.alpha_entry[c].assign( S, 0 );
+      for ( int i = 0; i < S; i++ )
+	for ( int j = 0; j < S; j++ )
+	  F.alpha_entry[c][j] += exp( w[i] - m ) * M[i*S+j];
+      Normalize( S, &F.alpha_entry[c][0] );
+    }
+
+    for ( size_t c = N_chunks-1; c > 0; c-- ) {
+      const vector<double> & out = F.beta_exit[c], & M = F.transfer[c], & M_log = F.transfer_log[c];
+      for ( int i = 0; i < S; i++ ) {
+	double sum = 0;
+	for ( int j = 0; j < S; j++ ) sum += M[i*S+j] * out[j];
+	w[i] = sum == 0 ? LOG_ZERO : log( sum ) + M_log[i];
+      }
+      const double m = *max_element( w.begin(), w.end() );
+      assert( m != LOG_ZERO );
+      F.beta_exit[c-1].resize( S );
+      for ( int i = 0; i < S; i++ ) F.beta_exit[c-1][i] = exp( w[i] - m );
+      Normalize( S, &F.beta_exit[c-1][0] );
+    }
+  }
+
+  // Pass 3.
+  RunChunks( ForwardBackwardChunk, &F, N_chunks, _N_threads );
+
+  // Add up the chunks' posterior probabilities.
+  vector<double> init_sums( S, 0 ), state_sums( S, 0 ), trans_sums( S*S, 0 ), emiss_sums( S * _N_symbols, 0 );
+  log_like = log_scale;
+  for ( size_t c = 0; c < N_chunks; c++ ) {
+    for ( int i = 0; i < S; i++ ) init_sums[i] += F.init_sums[c][i];
+    for ( int i = 0; i < S; i++ ) state_sums[i] += F.state_sums[c][i];
+    for ( int i = 0; i < S*S; i++ ) trans_sums[i] += F.trans_sums[c][i];
+    for ( size_t i = 0; i < F.emiss_sums[c].size(); i++ ) emiss_sums[i] += F.emiss_sums[c][i];
+    log_like += F.log_like[c];
+  }
+  log_like /= log(2);
+
+
+  // Normalize the sums to find the new probabilities, as in
+  // AdjustProbsToBaumWelch().
+  bool change = false;
+
+  const double N_states_total = accumulate( state_sums.begin(), state_sums.end(), 0.0 );
+  _state_freqs.resize( _N_states );
+  for ( int j = 0; j < S; j++ )
+    _state_freqs[j] = state_sums[j] / N_states_total;
+
+  const double N_init = accumulate( init_sums.begin(), init_sums.end(), 0.0 );
+  for ( int j = 0; j < S; j++ ) {
+    const double new_prob = log( init_sums[j] / N_init );
+    if ( _init_probs[j] != new_prob ) change = true;
+    _init_probs[j] = new_prob;
+  }
+
+  for ( int i = 0; i < S; i++ ) {
+    const double denom = accumulate( &trans_sums[i*S], &trans_sums[i*S] + S, 0.0 );
+    for ( int j = 0; j < S; j++ ) {
+      const double new_prob = log( trans_sums[i*S+j] / denom );
+      if ( _trans_probs[i][j] != new_prob ) change = true;
+      _trans_probs[i][j] = new_prob;
+    }
+  }
+
+  if ( is_discrete_HMM() )
+    for ( int i = 0; i < S; i++ ) {
+      const double * sums = &emiss_sums[ i * _N_symbols ];
+      const double denom = accumulate( sums, sums + _N_symbols, 0.0 );
+      for ( int j = 0; j < _N_symbols; j++ ) {
+	const double new_prob = log( sums[j] / denom );
+	if ( _symbol_emiss_probs[i][j] != new_prob ) change = true;
+	_symbol_emiss_probs[i][j] = new_prob;
+      }
+    }
+
+  return change;
+}
+
+
+
+
+
+
+
+
 // Return the number of timepoints.
 // This depends slightly on whether this is a discrete or continuous HMM.
 size_t
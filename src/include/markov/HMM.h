@@ -107,6 +107,14 @@ class HMM : public MarkovModel
   bool ViterbiTraining( vector<int> & predicted_states );
   bool BaumWelchTraining( double & log_like );
 
+  // Choose how the training functions run.  By default, they run the Viterbi
+  // and forward-backward recursions directly on flat arrays of size
+  // NTimepoints() x N_states, using up to N_threads threads on long sequences
+  // (see "TRELLIS KERNELS" in HMM.cc.)  If use_WDAG = true, they instead build
+  // the WDAG of the whole model with to_WDAG() and run its path algorithms.
+  // This takes much more time and memory, but it is useful for debugging.
+  void SetAlgorithm( const bool use_WDAG, const int N_threads = 1 );
+
 
   /* OUTPUT FUNCTIONS UNIQUE TO THE HMM CLASS */
 
@@ -130,8 +138,15 @@ class HMM : public MarkovModel
   // calculated data.  This is the final step of both Viterbi and Baum-Welch.
   // Return true if any of the probabilities change.
   bool AdjustProbsToViterbi( const vector<string> & best_path, vector<int> & states );
+  bool AdjustProbsToViterbi( const vector<int> & states );
   bool AdjustProbsToBaumWelch( const WDAG & wdag );
 
+  // The trellis kernels, which do the same work as to_WDAG() and the WDAG
+  // path algorithms, without making the graph.  See HMM.cc.
+  void TrellisEmissions( vector<double> & emiss ) const;
+  void TrellisViterbi( vector<int> & states ) const;
+  bool TrellisBaumWelch( double & log_like );
+
 
 
 
@@ -148,6 +163,10 @@ class HMM : public MarkovModel
   // Flags for whether or not algorithms have been run.
   bool _ran_viterbi, _ran_baum_welch;
 
+  // How to run the algorithms.  See SetAlgorithm().
+  bool _use_WDAG;
+  int _N_threads;
+
   // NOTE: THESE ARE STORED AS LOGARITHMS
   vector< vector<double> > _symbol_emiss_probs; // used in discrete HMMs
   vector< vector<double> >   _time_emiss_probs; // used in continuous HMMs
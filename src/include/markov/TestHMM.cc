@@ -0,0 +1,204 @@
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+// This software and its documentation are copyright (c) 2014-2015 by Joshua //
+// N. Burton and the University of Washington.  All rights are reserved.     //
+//                                                                           //
+// THIS SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS  //
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF                //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE, AND NON-INFRINGEMENT.  //
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY      //
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT //
+// OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR  //
+// THE USE OR OTHER DEALINGS IN THE SOFTWARE.                                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+
+/******************************************************************************
+ *
+ * TestHMM.cc
+ *
+ * Test the trellis kernels in HMM.cc against the WDAG path algorithms, which
+ * they replaced: on random discrete and continuous HMMs, run several rounds
+ * of Viterbi training and of Baum-Welch training both ways, and compare the
+ * predicted states, the log-likelihoods, and the trained probabilities.  Also
+ * compare the chunked, multi-threaded trellis kernels with the single-threaded
+ * ones, on sequences long enough to be split.  Prints one PASS or FAIL line
+ * per comparison, and returns 1 if any failed.
+ *
+ *****************************************************************************/
+
+
+// C libraries
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+// STL declarations
+#include <string>
+#include <vector>
+#include <iostream>
+using namespace std;
+
+
+// Local declarations
+#include "HMM.h"
+
+
+
+// The tolerances for Baum-Welch.  The trellis kernels use scaled probabilities and the WDAG uses log-sums, so they round differently.
+static const double MAX_LOG_LIKE_REL_DIFF = 1e-9;
+static const double MAX_PROB_DIFF = 1e-7;
+
+static int N_failed = 0;
+
+
+
+void
+Report( const string & test, const bool pass )
+{
+  cout << ( pass ? "PASS" : "FAIL" ) << "\t" << test << endl;
+  if ( !pass ) N_failed++;
+}
+
+
+
+// A random probability vector of length N, with every entry at least 0.05 / N.
+vector<double>
+RandomProbs( const int N )
+{
+  vector<double> probs( N );
+  double sum = 0;
+  for ( int i = 0; i < N; i++ ) {
+    probs[i] = 0.05 / N + drand48();
+    sum += probs[i];
+  }
+  for ( int i = 0; i < N; i++ )
+    probs[i] /= sum;
+  return probs;
+}
+
+
+
+// A random HMM with N_states states and T timepoints.  If N_symbols > 0, it's a discrete HMM, with random observations; otherwise it's continuous, with
+// random emission log-likelihoods.
+HMM
+RandomHMM( const int N_states, const int N_symbols, const size_t T )
+{
+  HMM hmm( N_states, N_symbols );
+  hmm.SetInitProbs( RandomProbs( N_states ) );
+
+  // Make the states sticky, so the Viterbi paths have long runs, as in real data.
+  vector< vector<double> > trans( N_states );
+  for ( int i = 0; i < N_states; i++ ) {
+    trans[i] = RandomProbs( N_states );
+    for ( int j = 0; j < N_states; j++ )
+      trans[i][j] = ( i == j ? 0.8 : 0 ) + 0.2 * trans[i][j];
+  }
+  hmm.SetTransProbs( trans );
+
+  if ( N_symbols > 0 ) {
+    vector< vector<double> > emiss( N_states );
+    for ( int i = 0; i < N_states; i++ )
+      emiss[i] = RandomProbs( N_symbols );
+    hmm.SetSymbolEmissProbs( emiss );
+    vector<int> obs( T );
+    for ( size_t t = 0; t < T; t++ )
+      obs[t] = lrand48() % N_symbols;
+    hmm.SetObservations( obs );
+  }
+  else {
+    vector< vector<double> > emiss( T, vector<double>( N_states ) );
+    for ( size_t t = 0; t < T; t++ )
+      for ( int i = 0; i < N_states; i++ )
+	emiss[t][i] = -5 * drand48();
+    hmm.SetTimeEmissProbs( emiss );
+  }
+
+  return hmm;
+}
+
+
+
+// The largest difference between two HMMs' trained probabilities (not logs): the state frequencies, the transition frequencies, and, in a discrete HMM,
+// the emission probabilities.
+double
+MaxProbDiff( const HMM & a, const HMM & b )
+{
+  const int S = a.NStates();
+  double diff = 0;
+  for ( int i = 0; i < S; i++ ) {
+    diff = max( diff, fabs( a.GetStateFreq(i) - b.GetStateFreq(i) ) );
+    for ( int j = 0; j < S; j++ )
+      diff = max( diff, fabs( a.GetTransitionFreq(i,j) - b.GetTransitionFreq(i,j) ) );
+  }
+  if ( a.is_discrete_HMM() )
+    for ( int i = 0; i < S; i++ )
+      for ( size_t k = 0; k < a._symbol_emiss_probs[i].size(); k++ )
+	diff = max( diff, fabs( exp( a._symbol_emiss_probs[i][k] ) - exp( b._symbol_emiss_probs[i][k] ) ) );
+  return diff;
+}
+
+
+
+// Compare two copies of one HMM, run with different algorithms (see HMM::SetAlgorithm): N_rounds of Viterbi training, then (on fresh copies) N_rounds of
+// Baum-Welch training.  The Viterbi paths and trained probabilities should be identical, and the Baum-Welch results should agree to within rounding.
+void
+CompareAlgorithms( const string & name, const HMM & hmm, const bool use_WDAG_a, const int N_threads_a, const bool use_WDAG_b, const int N_threads_b,
+		   const int N_rounds )
+{
+  {
+    HMM a = hmm, b = hmm;
+    a.SetAlgorithm( use_WDAG_a, N_threads_a );
+    b.SetAlgorithm( use_WDAG_b, N_threads_b );
+    bool same_states = true;
+    for ( int r = 0; r < N_rounds; r++ ) {
+      vector<int> states_a, states_b;
+      const bool changed_a = a.ViterbiTraining( states_a );
+      const bool changed_b = b.ViterbiTraining( states_b );
+      if ( states_a != states_b || changed_a != changed_b ) same_states = false;
+    }
+    Report( name + ": Viterbi paths", same_states );
+    Report( name + ": Viterbi training", MaxProbDiff( a, b ) == 0 );
+  }
+
+  {
+    HMM a = hmm, b = hmm;
+    a.SetAlgorithm( use_WDAG_a, N_threads_a );
+    b.SetAlgorithm( use_WDAG_b, N_threads_b );
+    bool same_log_like = true;
+    for ( int r = 0; r < N_rounds; r++ ) {
+      double log_like_a, log_like_b;
+      a.BaumWelchTraining( log_like_a );
+      b.BaumWelchTraining( log_like_b );
+      if ( fabs( log_like_a - log_like_b ) > MAX_LOG_LIKE_REL_DIFF * fabs( log_like_a ) ) same_log_like = false;
+    }
+    Report( name + ": Baum-Welch log-likelihoods", same_log_like );
+    Report( name + ": Baum-Welch training", MaxProbDiff( a, b ) <= MAX_PROB_DIFF );
+  }
+}
+
+
+
+
+int main( int argc, char * argv[] )
+{
+  srand48( 1 );
+
+  // The trellis kernels vs. the WDAG, on short sequences (the WDAG is slow.)
+  for ( int S = 2; S <= 4; S++ ) {
+    const string S_str = string( 1, '0' + S );
+    CompareAlgorithms( "discrete, " + S_str + " states, trellis vs. WDAG", RandomHMM( S, 6, 2000 ), false, 1, true, 1, 3 );
+    CompareAlgorithms( "continuous, " + S_str + " states, trellis vs. WDAG", RandomHMM( S, 0, 2000 ), false, 1, true, 1, 3 );
+  }
+
+  // The chunked trellis kernels vs. the single-threaded ones, on sequences long enough to be split into chunks (with more than S+1 threads.)
+  for ( int S = 2; S <= 4; S++ ) {
+    const string S_str = string( 1, '0' + S );
+    CompareAlgorithms( "discrete, " + S_str + " states, 8 threads vs. 1", RandomHMM( S, 6, 100000 ), false, 1, false, 8, 3 );
+    CompareAlgorithms( "continuous, " + S_str + " states, 8 threads vs. 1", RandomHMM( S, 0, 100000 ), false, 1, false, 8, 3 );
+  }
+
+  cout << ( N_failed ? "TestHMM: some tests FAILED" : "TestHMM: all tests passed" ) << endl;
+  return N_failed ? 1 : 0;
+}
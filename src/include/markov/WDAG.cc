@@ -23,6 +23,7 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm> // reverse
 
 
 // Boost libraries.
@@ -355,6 +356,126 @@ WDAG::BestNodeIDs() const
 
 
 
+
+FlatWDAG::FlatWDAG()
+{
+  _in_ptr.push_back( 0 );
+  _req_start = _req_end = -1;
+  _best_path_weight = 0;
+}
+
+
+
+// Reserve memory for N_nodes nodes and N_edges edges.
+void
+FlatWDAG::Reserve( const int N_nodes, const int N_edges )
+{
+  _in_ptr.reserve( N_nodes + 1 );
+  _in_parent.reserve( N_edges );
+  _in_label .reserve( N_edges );
+  _in_weight.reserve( N_edges );
+}
+
+
+
+// Add a node to the FlatWDAG.  At first, this node has no parents.  Returns the new node's ID.
+int
+FlatWDAG::AddNode()
+{
+  _in_ptr.push_back( _in_ptr.back() );
+  return N() - 1;
+}
+
+
+
+// Run dynamic programming on this FlatWDAG to find the highest-weight path.  This is the same algorithm as WDAG::FindBestPath(), on the flat layout.
+void
+FlatWDAG::FindBestPath()
+{
+  const int N_nodes = N();
+  assert( N_nodes > 0 );
+  _best_weight.assign( N_nodes, 0 );
+  _best_in_edge.assign( N_nodes, -1 );
+  _best_path_weight = 0;
+  int best_path_end_node = 0; // default solution
+
+  for ( int i = 0; i < N_nodes; i++ ) {
+
+    // If constraining the path start, disallow the null path in all nodes except the specified start.
+    if ( _req_start != -1 && _req_start != i )
+      _best_weight[i] = LOG_ZERO;
+
+    // Look at all the parents of this node, and find which one gives the highest-weight path.
+    double best_weight = _best_weight[i];
+    for ( int e = _in_ptr[i]; e < _in_ptr[i+1]; e++ ) {
+      const double weight = _best_weight[ _in_parent[e] ] + _in_weight[e];
+      if ( best_weight < weight ) {
+	best_weight = weight;
+	_best_in_edge[i] = e;
+      }
+
+      // Keep track of the highest weight we've seen anywhere.
+      if ( best_weight > _best_path_weight ) {
+	_best_path_weight = best_weight;
+	best_path_end_node = i;
+      }
+    }
+    _best_weight[i] = best_weight;
+  }
+
+  // If we are constraining the path end, replace the best path we've seen with the best path ending at the specified end.
+  if ( _req_end != -1 ) {
+    best_path_end_node = _req_end;
+    _best_path_weight = _best_weight[_req_end];
+  }
+
+  // Trace backward from the final node of the best path to find the complete path, then flip it into the proper direction.
+  _best_nodes.clear();
+  _best_edge_labels.clear();
+  _best_nodes.push_back( best_path_end_node );
+  for ( int e = _best_in_edge[best_path_end_node]; e != -1; e = _best_in_edge[ _in_parent[e] ] ) {
+    _best_edge_labels.push_back( _in_label[e] );
+    _best_nodes.push_back( _in_parent[e] );
+  }
+  reverse( _best_nodes.begin(), _best_nodes.end() );
+  reverse( _best_edge_labels.begin(), _best_edge_labels.end() );
+}
+
+
+
+// Find the forward and backward probabilities of each node.  This is the same algorithm as WDAG::FindPosteriorProbs(), on the flat layout.
+void
+FlatWDAG::FindPosteriorProbs()
+{
+  // We can only do this in a FlatWDAG with a definitive start and end point.
+  assert( _req_start != -1 );
+  assert( _req_end != -1 );
+
+  const int N_nodes = N();
+  _fw_prob.assign( N_nodes, LOG_ZERO );
+  _bw_prob.assign( N_nodes, LOG_ZERO );
+  _fw_prob[_req_start] = 0;
+  _bw_prob[_req_end  ] = 0;
+
+  // Process the nodes in forward order, and calculate forward probabilities.
+  for ( int i = 0; i < N_nodes; i++ )
+    for ( int e = _in_ptr[i]; e < _in_ptr[i+1]; e++ )
+      _fw_prob[i] = lnsum( _fw_prob[i], _fw_prob[ _in_parent[e] ] + _in_weight[e] );
+
+  // Now process the nodes in reverse order, and calculate backward probs by pushing each node's probability back along its in-edges to its parents.
+  for ( int i = N_nodes-1; i >= 0; i-- )
+    for ( int e = _in_ptr[i]; e < _in_ptr[i+1]; e++ )
+      _bw_prob[ _in_parent[e] ] = lnsum( _bw_prob[ _in_parent[e] ], _bw_prob[i] + _in_weight[e] );
+
+  // Verify that the total forward and backward probabilities are identical (or at least within the range of floating-point error.)
+  double error = ( Alpha() - Beta() ) / Alpha();
+  assert( error < 1e-6 );
+}
+
+
+
+
+
 // Formula to add two numbers in natural log space.
 // If z = x + y, then ln(z) = lnsum( ln(x) + ln(y) ).
 double
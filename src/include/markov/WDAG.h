@@ -157,6 +157,88 @@ class WDAG {
 
 
 
+/* FlatWDAG: A compact, index-based WDAG, for large graphs on which only the path algorithms (FindBestPath, FindPosteriorProbs) are needed.
+ *
+ * Instead of allocating each node separately, with its in-edges in vectors of pointers and strings, a FlatWDAG keeps all of its in-edges in contiguous
+ * arrays in CSR (compressed sparse row) form: the edges entering node i are [_in_ptr[i], _in_ptr[i+1]) in the arrays _in_parent, _in_label, _in_weight.
+ * Nodes are referred to by their IDs, which are assigned in order of creation, and edges carry integer labels rather than names.
+ *
+ * As in a WDAG, parents must appear before their children.  To keep the CSR layout, edges are always added into the most recently added node, so all of
+ * the edges entering a node must be added after the node is created and before the next node is.  For the same graph, built with the same edges in the
+ * same order, FlatWDAG gives exactly the same results as WDAG (including the tie-breaking between equally good paths.)
+ */
+class FlatWDAG {
+
+ public:
+
+  FlatWDAG();
+
+  // Reserve memory for N_nodes nodes and N_edges edges.
+  void Reserve( const int N_nodes, const int N_edges );
+
+  // Add a node to the FlatWDAG.  At first, this node has no parents.  Returns the new node's ID.
+  int AddNode();
+
+  // Add an edge from node 'parent' into the most recently added node.
+  void AddEdge( const int parent, const int label, const double & weight ) {
+    assert( N() > 0 );
+    assert( parent >= 0 && parent < N() );
+    _in_parent.push_back( parent );
+    _in_label .push_back( label );
+    _in_weight.push_back( weight );
+    _in_ptr.back()++;
+  }
+
+  int N() const { return (int) _in_ptr.size() - 1; }
+  int N_edges() const { return _in_ptr.back(); }
+
+  // Set required start/end nodes, by ID.
+  void SetReqStart( const int node ) { assert( node >= 0 && node < N() ); _req_start = node; }
+  void SetReqEnd  ( const int node ) { assert( node >= 0 && node < N() ); _req_end   = node; }
+
+  // Run dynamic programming on this FlatWDAG to find out the weights of all paths.
+  void FindBestPath(); // Viterbi
+  void FindPosteriorProbs(); // Baum-Welch
+
+  // Requires FindBestPath().
+  double BestWeight() const { return _best_path_weight; }
+  const vector<int> & BestNodeIDs() const { return _best_nodes; }
+  const vector<int> & BestEdgeLabels() const { return _best_edge_labels; }
+
+  // Requires FindPosteriorProbs().  FwProb and BwProb are the forward and backward probabilities (in log space) of each node.
+  double Alpha() const { return _fw_prob[_req_end  ]; }
+  double Beta () const { return _bw_prob[_req_start]; }
+  double FwProb( const int node ) const { return _fw_prob[node]; }
+  double BwProb( const int node ) const { return _bw_prob[node]; }
+
+
+ private:
+
+  // The in-edges of all nodes, in CSR form.
+  vector<int> _in_ptr; // size N+1
+  vector<int> _in_parent, _in_label;
+  vector<double> _in_weight;
+
+  // Required start/end nodes, if any (-1 if none).
+  int _req_start, _req_end;
+
+  // Information about the best path entering each node: its weight, and the index of the edge it comes in on (-1 if start of path).
+  vector<double> _best_weight;
+  vector<int> _best_in_edge;
+
+  // Forward and backward probabilities (in log space), filled by FindPosteriorProbs().
+  vector<double> _fw_prob, _bw_prob;
+
+  /* RESULTS of FindBestPath() */
+  double _best_path_weight;
+  vector<int> _best_nodes, _best_edge_labels;
+};
+
+
+
+
+
+
 // Log of zero.
 #include <limits.h>
 #define LOG_ZERO (-INFINITY)